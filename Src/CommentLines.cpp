@@ -0,0 +1,242 @@
+/////////////////////////////////////////////////////////////////////////////
+//    License (GPLv2+):
+//    This program is free software; you can redistribute it and/or modify
+//    it under the terms of the GNU General Public License as published by
+//    the Free Software Foundation; either version 2 of the License, or (at
+//    your option) any later version.
+//    
+//    This program is distributed in the hope that it will be useful, but
+//    WITHOUT ANY WARRANTY; without even the implied warranty of
+//    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+//    GNU General Public License for more details.
+//
+//    You should have received a copy of the GNU General Public License
+//    along with this program; if not, write to the Free Software
+//    Foundation, Inc., 675 Mass Ave, Cambridge, MA 02139, USA.
+/////////////////////////////////////////////////////////////////////////////
+/** 
+ * @file  CommentLines.cpp
+ *
+ * @brief Code finding diffs of comments only, for ignoring them.
+ */
+
+#include "CommentLines.h"
+#include <string>
+#include <vector>
+#include <algorithm>
+#include <cstring>
+#include <cstdlib>
+#include "diff.h"
+#include "FilterCommentsManager.h"
+#include "CompareOptions.h"
+
+/**
+ * @brief Test if comment marker starts at given position
+ * @param [in] p					- Position in line
+ * @param [in] End					- One character pass the end of the line
+ * @param [in] marker				- Marker to test for, never matches if empty
+ * @return Returns true if marker starts at @p p
+ */
+static inline bool IsCommentMarkerAt(const char *p, const char *End, const std::string &marker)
+{
+	return !marker.empty() && static_cast<size_t>(End - p) >= marker.size() &&
+		memcmp(p, marker.c_str(), marker.size()) == 0;
+}
+
+/**
+ * @brief Scan line for code outside of comments
+ * Comment markers enclosed in quotation marks or apostrophes are not markers.
+ * The scan stops at the EOL of the line.
+ * @param [in] Start				- Start of the line
+ * @param [in] End					- One character pass the end of the line
+ * @param [in,out] InComment		- Is the scan inside a block comment? Set to the state at the end of the line.
+ * @param [in] filtercommentsset	- Comment marker set used to indicate comment blocks.
+ * @param [out] Code				- If not NULL, characters outside comments are appended to this.
+ * @return Returns true if there are other than whitespace characters outside comments
+ */
+static bool ScanCommentLine(const char *Start, const char *End, bool &InComment,
+	const FilterCommentsSet& filtercommentsset, std::string *Code)
+{
+	const std::string &StartMarker = filtercommentsset.StartMarker;
+	const std::string &EndMarker = filtercommentsset.EndMarker;
+	const std::string &InlineMarker = filtercommentsset.InlineMarker;
+	const bool HasBlocks = !StartMarker.empty() && !EndMarker.empty();
+	bool HasCode = false;
+	char prev = '\0';
+	char quote = '\0';
+	const char *p = Start;
+	while (p < End && *p != '\n' && *p != '\r')
+	{
+		if (InComment)
+		{
+			if (IsCommentMarkerAt(p, End, EndMarker))
+			{
+				p += EndMarker.size();
+				InComment = false;
+				prev = '\0';
+			}
+			else
+				++p;
+			continue;
+		}
+		if (quote == '\0')
+		{
+			//Longer marker wins, if both start here (e.g. "--[[" and "--")
+			bool IsBlock = HasBlocks && IsCommentMarkerAt(p, End, StartMarker);
+			bool IsInline = IsCommentMarkerAt(p, End, InlineMarker);
+			if (IsBlock && (!IsInline || StartMarker.size() > InlineMarker.size()))
+			{
+				p += StartMarker.size();
+				InComment = true;
+				continue;
+			}
+			if (IsInline)
+				break;//Rest of the line is comment
+		}
+		char c = *p++;
+		if (c != ' ' && c != '\t')
+			HasCode = true;
+		if (Code)
+			Code->push_back(c);
+		if ((prev != '\\') &&
+			(c == '"' || c == '\'') &&
+			(quote == '\0' || quote == c))
+		{
+			quote ^= c;
+		}
+		prev = c;
+	}
+	return HasCode;
+}
+
+/**
+ * @brief Get LINE_* flags of a line, from classes set by ClassifyCommentLines()
+ */
+static inline int GetLineClass(const file_data &data, int Line)
+{
+	return (data.line_classes[Line >> 2] >> ((Line & 3) * 2)) & 3;
+}
+
+/**
+ * @brief Replace spaces in a string
+ * @param [in] str - String to search
+ * @param [in] rep - String to replace
+ */
+static void ReplaceSpaces(std::string & str, const char *rep)
+{
+	std::string::size_type pos = 0;
+	size_t replen = strlen(rep);
+	while ((pos = str.find_first_of(" \t", pos)) != std::string::npos)
+	{
+		std::string::size_type posend = str.find_first_not_of(" \t", pos);
+		if (posend != std::string::npos)
+			str.replace(pos, posend - pos, rep);
+		else
+			str.replace(pos, 1, rep);
+		pos += replen;
+	}
+}
+
+/**
+@brief Classifies lines of a file for post-filtering, in one pass over the file.
+Every line gets LINE_HAS_CODE flag if it has code outside comments, and
+LINE_IN_COMMENT flag if it starts inside a block comment. Comments are
+followed from the start of the text, so comments opened in the identical
+prefix of the files are known too.
+@param [in,out]  data				- Compared file data, classes are freed with the other buffers.
+@param [in]  filtercommentsset	- Comment marker set used to indicate comment blocks.
+*/
+void ClassifyCommentLines(file_data & data, const FilterCommentsSet& filtercommentsset)
+{
+	data.line_classes = static_cast<unsigned char *>(calloc(data.valid_lines / 4 + 1, 1));
+	if (data.line_classes == NULL)
+		return;
+
+	bool InComment = false;
+	const char *LineStr = data.text_begin ? data.text_begin : data.linbuf[0];
+	while (LineStr < data.linbuf[0])
+	{
+		const char *EndLine = LineStr;
+		while (EndLine < data.linbuf[0] && *EndLine != '\n' && *EndLine != '\r')
+			++EndLine;
+		ScanCommentLine(LineStr, EndLine, InComment, filtercommentsset, NULL);
+		LineStr = EndLine + 1;
+	}
+
+	for (int i = 0; i < data.valid_lines; ++i)
+	{
+		int Class = InComment ? LINE_IN_COMMENT : 0;
+		if (ScanCommentLine(data.linbuf[i], data.linbuf[i + 1], InComment, filtercommentsset, NULL))
+			Class |= LINE_HAS_CODE;
+		data.line_classes[i >> 2] |= static_cast<unsigned char>(Class << ((i & 3) * 2));
+	}
+}
+
+/**
+@brief Tells if a diff block differs only in comments.
+A block is trivial if no line of it has code outside comments, or if lines
+with code have same code in both sides, after removing the comments. Lines
+of both files must be classified by ClassifyCommentLines() first.
+@param [in]  data				- Compared files data.
+@param [in]  LineNumber			- First line of the block in each file.
+@param [in]  QtyLines			- Number of lines in the block in each file.
+@param [in]  filtercommentsset	- Comment marker set used to indicate comment blocks.
+@param [in]  IgnoreWhitespace	- Whitespace compare mode, WHITESPACE_*.
+@param [in]  IgnoreCase			- Is case ignored?
+@return Returns true if the block should be ignored.
+*/
+bool IsCommentChangeOnly(const file_data data[2], const int LineNumber[2], const int QtyLines[2],
+	const FilterCommentsSet& filtercommentsset, int IgnoreWhitespace, bool IgnoreCase)
+{
+	bool HasCode[2] = { false, false };
+	for (int FileNo = 0; FileNo < 2; ++FileNo)
+	{
+		for (int i = 0; i < QtyLines[FileNo] && !HasCode[FileNo]; ++i)
+		{
+			if (GetLineClass(data[FileNo], LineNumber[FileNo] + i) & LINE_HAS_CODE)
+				HasCode[FileNo] = true;
+		}
+	}
+	if (!HasCode[0] && !HasCode[1])
+		return true;//Only comments and whitespace changed
+	if (!HasCode[0] || !HasCode[1])
+		return false;
+
+	//Lets test if only comments are different in lines with code
+	std::vector<std::string> CodeLines[2];
+	for (int FileNo = 0; FileNo < 2; ++FileNo)
+	{
+		for (int i = LineNumber[FileNo]; i < LineNumber[FileNo] + QtyLines[FileNo]; ++i)
+		{
+			int Class = GetLineClass(data[FileNo], i);
+			if (!(Class & LINE_HAS_CODE))
+				continue;
+			bool InComment = (Class & LINE_IN_COMMENT) != 0;
+			std::string LineData;
+			ScanCommentLine(data[FileNo].linbuf[i], data[FileNo].linbuf[i + 1], InComment, filtercommentsset, &LineData);
+
+			if (IgnoreWhitespace == WHITESPACE_IGNORE_ALL)
+			{
+				//Ignore all whitespace
+				ReplaceSpaces(LineData, "");
+			}
+			else if (IgnoreWhitespace == WHITESPACE_IGNORE_CHANGE)
+			{
+				//Ignore change in whitespace char count, and whitespace before comment
+				ReplaceSpaces(LineData, " ");
+				if (!LineData.empty() && LineData.back() == ' ')
+					LineData.pop_back();
+			}
+
+			if (IgnoreCase)
+			{
+				//ignore case
+				std::transform(LineData.begin(), LineData.end(), LineData.begin(), ::toupper);
+			}
+
+			CodeLines[FileNo].push_back(LineData);
+		}
+	}
+	//only difference is trival if code is the same
+	return CodeLines[0] == CodeLines[1];
+}
@@ -0,0 +1,13 @@
+/**
+ * @file  CommentLines.h
+ *
+ * @brief Declaration of functions finding diffs of comments only.
+ */
+#pragma once
+
+struct file_data;
+struct FilterCommentsSet;
+
+void ClassifyCommentLines(file_data & data, const FilterCommentsSet& filtercommentsset);
+bool IsCommentChangeOnly(const file_data data[2], const int LineNumber[2], const int QtyLines[2],
+	const FilterCommentsSet& filtercommentsset, int IgnoreWhitespace, bool IgnoreCase);
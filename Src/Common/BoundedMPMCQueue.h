@@ -0,0 +1,122 @@
+/**
+ * @file  BoundedMPMCQueue.h
+ *
+ * @brief Declaration and implementation of BoundedMPMCQueue class.
+ */
+#pragma once
+
+#include <atomic>
+#include <memory>
+#include <cstddef>
+#include <cassert>
+
+/**
+ * @brief Bounded lock-free multi-producer multi-consumer queue.
+ *
+ * Fixed size ring buffer where every cell has a sequence number telling
+ * whether the cell is free for the producer or filled for the consumer of
+ * the current round. Producers and consumers claim a position with one
+ * compare-and-swap; there are no locks and no allocations after
+ * construction. tryPush() fails when the queue is full and tryPop() when
+ * it is empty, waiting is left to the caller.
+ *
+ * Based on the bounded MPMC queue by Dmitry Vyukov.
+ */
+template <typename T>
+class BoundedMPMCQueue
+{
+public:
+	/**
+	 * @brief Constructor.
+	 * @param [in] capacity Maximum number of items, must be a power of two.
+	 */
+	explicit BoundedMPMCQueue(size_t capacity)
+		: m_cells(new Cell[capacity])
+		, m_mask(capacity - 1)
+		, m_enqueuePos(0)
+		, m_dequeuePos(0)
+	{
+		assert(capacity >= 2 && (capacity & (capacity - 1)) == 0);
+		for (size_t i = 0; i < capacity; ++i)
+			m_cells[i].sequence.store(i, std::memory_order_relaxed);
+	}
+
+	size_t capacity() const { return m_mask + 1; }
+
+	/**
+	 * @brief Add item to the end of the queue.
+	 * @return false if queue is full.
+	 */
+	bool tryPush(const T& value)
+	{
+		Cell *cell;
+		size_t pos = m_enqueuePos.load(std::memory_order_relaxed);
+		for (;;)
+		{
+			cell = &m_cells[pos & m_mask];
+			const size_t seq = cell->sequence.load(std::memory_order_acquire);
+			const ptrdiff_t dif = static_cast<ptrdiff_t>(seq) - static_cast<ptrdiff_t>(pos);
+			if (dif == 0)
+			{
+				if (m_enqueuePos.compare_exchange_weak(pos, pos + 1, std::memory_order_relaxed))
+					break;
+			}
+			else if (dif < 0)
+				return false;
+			else
+				pos = m_enqueuePos.load(std::memory_order_relaxed);
+		}
+		cell->data = value;
+		cell->sequence.store(pos + 1, std::memory_order_release);
+		return true;
+	}
+
+	/**
+	 * @brief Remove item from the front of the queue.
+	 * @return false if queue is empty.
+	 */
+	bool tryPop(T& value)
+	{
+		Cell *cell;
+		size_t pos = m_dequeuePos.load(std::memory_order_relaxed);
+		for (;;)
+		{
+			cell = &m_cells[pos & m_mask];
+			const size_t seq = cell->sequence.load(std::memory_order_acquire);
+			const ptrdiff_t dif = static_cast<ptrdiff_t>(seq) - static_cast<ptrdiff_t>(pos + 1);
+			if (dif == 0)
+			{
+				if (m_dequeuePos.compare_exchange_weak(pos, pos + 1, std::memory_order_relaxed))
+					break;
+			}
+			else if (dif < 0)
+				return false;
+			else
+				pos = m_dequeuePos.load(std::memory_order_relaxed);
+		}
+		value = cell->data;
+		cell->sequence.store(pos + m_mask + 1, std::memory_order_release);
+		return true;
+	}
+
+private:
+	BoundedMPMCQueue(const BoundedMPMCQueue&);
+	BoundedMPMCQueue& operator=(const BoundedMPMCQueue&);
+
+	enum { CACHE_LINE_SIZE = 64 };
+
+	struct Cell
+	{
+		std::atomic<size_t> sequence;
+		T data;
+	};
+
+	std::unique_ptr<Cell[]> m_cells;
+	const size_t m_mask;
+	// Keep producer and consumer positions in separate cache lines
+	char m_pad0[CACHE_LINE_SIZE];
+	std::atomic<size_t> m_enqueuePos;
+	char m_pad1[CACHE_LINE_SIZE];
+	std::atomic<size_t> m_dequeuePos;
+	char m_pad2[CACHE_LINE_SIZE];
+};
@@ -0,0 +1,282 @@
+/**
+ * @file  PooledString.cpp
+ *
+ * @brief Implementation of PooledString and PooledPath classes
+ */
+
+#include "PooledString.h"
+#include <vector>
+#include <algorithm>
+#include <functional>
+#include <Poco/Mutex.h>
+
+using Poco::FastMutex;
+
+namespace
+{
+
+/** @brief Key of a folder node: parent node and name of the folder */
+struct NodeKey
+{
+	PooledPath::Node *pParent;
+	const TCHAR *name;
+	size_t length;
+};
+
+bool IsEntryOf(const PooledString::Entry *pEntry, const String& str)
+{
+	return pEntry->value == str;
+}
+
+bool IsEntryOf(const PooledPath::Node *pNode, const NodeKey& key)
+{
+	const String& name = pNode->name.get();
+	return pNode->pParent == key.pParent &&
+		name.compare(0, String::npos, key.name, key.length) == 0;
+}
+
+PooledString::Entry *NewEntry(const String& str)
+{
+	PooledString::Entry *pEntry = new PooledString::Entry;
+	pEntry->value = str;
+	return pEntry;
+}
+
+/** @brief New node holds a reference to its parent */
+PooledPath::Node *NewEntry(const NodeKey& key)
+{
+	PooledPath::Node *pNode = new PooledPath::Node;
+	pNode->name = String(key.name, key.length);
+	pNode->pParent = key.pParent;
+	pNode->length = (key.pParent ? key.pParent->length + 1 : 0) + key.length;
+	if (key.pParent)
+		key.pParent->refs.fetch_add(1, std::memory_order_relaxed);
+	return pNode;
+}
+
+/**
+ * @brief One part of a pool.
+ * Chained hash table of entries, grown when there are more entries than
+ * buckets.
+ */
+template<class Entry>
+class PoolShard
+{
+public:
+	PoolShard() : m_buckets(INITIAL_BUCKETS), m_nEntries(0) {}
+
+	template<class Key>
+	Entry *Find(const Key& key, size_t hash)
+	{
+		FastMutex::ScopedLock lock(m_mutex);
+		Entry **ppBucket = &m_buckets[hash & (m_buckets.size() - 1)];
+		for (Entry *p = *ppBucket; p; p = p->pNext)
+		{
+			if (p->hash == hash && IsEntryOf(p, key))
+			{
+				p->refs.fetch_add(1, std::memory_order_relaxed);
+				return p;
+			}
+		}
+		Entry *pEntry = NewEntry(key);
+		pEntry->hash = hash;
+		pEntry->refs = 1;
+		pEntry->pNext = *ppBucket;
+		*ppBucket = pEntry;
+		if (++m_nEntries > m_buckets.size())
+			Grow();
+		return pEntry;
+	}
+
+	/**
+	 * @brief Drop a reference.
+	 * @return true if it was the last one, and the entry was removed
+	 * from the pool. The caller deletes the entry.
+	 */
+	bool Release(Entry *pEntry)
+	{
+		FastMutex::ScopedLock lock(m_mutex);
+		if (pEntry->refs.fetch_sub(1, std::memory_order_acq_rel) != 1)
+			return false;
+		Entry **pp = &m_buckets[pEntry->hash & (m_buckets.size() - 1)];
+		while (*pp != pEntry)
+			pp = &(*pp)->pNext;
+		*pp = pEntry->pNext;
+		--m_nEntries;
+		return true;
+	}
+
+	size_t GetSize() const
+	{
+		FastMutex::ScopedLock lock(m_mutex);
+		return m_nEntries;
+	}
+
+private:
+	enum { INITIAL_BUCKETS = 64 };
+
+	void Grow()
+	{
+		std::vector<Entry *> buckets(m_buckets.size() * 2);
+		for (size_t i = 0; i < m_buckets.size(); ++i)
+		{
+			Entry *p = m_buckets[i];
+			while (p)
+			{
+				Entry *pNext = p->pNext;
+				Entry *&pBucket = buckets[p->hash & (buckets.size() - 1)];
+				p->pNext = pBucket;
+				pBucket = p;
+				p = pNext;
+			}
+		}
+		m_buckets.swap(buckets);
+	}
+
+	mutable FastMutex m_mutex;
+	std::vector<Entry *> m_buckets; /**< Size is power of two */
+	size_t m_nEntries;
+};
+
+enum { SHARDS = 64 }; /**< Must match shift in GetShard() */
+
+template<class Entry>
+PoolShard<Entry> *GetShards()
+{
+	// Never destroyed, strings may still be released during static destruction
+	static PoolShard<Entry> *shards = new PoolShard<Entry>[SHARDS];
+	return shards;
+}
+
+/** @brief Shard from the high bits, bucket in shard is chosen by the low bits */
+template<class Entry>
+PoolShard<Entry>& GetShard(size_t hash)
+{
+	return GetShards<Entry>()[hash >> (sizeof(size_t) * 8 - 6)];
+}
+
+template<class Entry>
+size_t GetPoolSize()
+{
+	size_t nEntries = 0;
+	for (int i = 0; i < SHARDS; ++i)
+		nEntries += GetShards<Entry>()[i].GetSize();
+	return nEntries;
+}
+
+const size_t FnvOffsetBasis = sizeof(size_t) > 4 ? static_cast<size_t>(14695981039346656037ULL) : 2166136261U;
+const size_t FnvPrime = sizeof(size_t) > 4 ? static_cast<size_t>(1099511628211ULL) : 16777619U;
+
+/** @brief Continue FNV-1a hash of a path with the name of a folder */
+size_t HashName(size_t hash, const TCHAR *name, size_t length)
+{
+	for (size_t i = 0; i < length; ++i)
+		hash = (hash ^ static_cast<size_t>(name[i])) * FnvPrime;
+	return hash;
+}
+
+}
+
+PooledString::Entry *PooledString::Intern(const String& str)
+{
+	if (str.empty())
+		return NULL;
+	size_t hash = std::hash<String>()(str);
+	return GetShard<Entry>(hash).Find(str, hash);
+}
+
+void PooledString::Free(Entry *pEntry)
+{
+	if (GetShard<Entry>(pEntry->hash).Release(pEntry))
+		delete pEntry;
+}
+
+/** @brief Return number of distinct strings in the pool */
+size_t PooledString::GetPoolSize()
+{
+	return ::GetPoolSize<Entry>();
+}
+
+/**
+ * @brief Find or add the nodes of all folders of a path.
+ * @return Node of the last folder, NULL for empty path.
+ */
+PooledPath::Node *PooledPath::Intern(const String& path)
+{
+	if (path.empty())
+		return NULL;
+	Node *pNode = NULL;
+	size_t start = 0;
+	for (;;)
+	{
+		size_t end = path.find(_T('\\'), start);
+		if (end == String::npos)
+			end = path.length();
+		NodeKey key = { pNode, path.c_str() + start, end - start };
+		size_t hash = HashName(pNode ? pNode->hash : FnvOffsetBasis, key.name, key.length);
+		Node *pChild = GetShard<Node>(hash).Find(key, hash);
+		// Child holds its own reference to the parent
+		Release(pNode);
+		pNode = pChild;
+		if (end == path.length())
+			return pNode;
+		start = end + 1;
+	}
+}
+
+/**
+ * @brief Remove a node which lost its last reference, and its parents
+ * which lose their last reference with it.
+ */
+void PooledPath::Free(Node *pNode)
+{
+	// Parents are released in a loop rather than recursively
+	while (pNode && GetShard<Node>(pNode->hash).Release(pNode))
+	{
+		Node *pParent = pNode->pParent;
+		delete pNode;
+		pNode = pParent;
+	}
+}
+
+/** @brief Rebuild the full path from the names of its folders */
+String PooledPath::get() const
+{
+	if (!m_pNode)
+		return String();
+	String path(m_pNode->length, _T('\\'));
+	size_t end = path.length();
+	for (const Node *p = m_pNode; p; p = p->pParent)
+	{
+		const String& name = p->name.get();
+		end -= name.length();
+		std::copy(name.begin(), name.end(), path.begin() + end);
+		if (p->pParent)
+			--end;
+	}
+	return path;
+}
+
+/** @brief Compare to a path without rebuilding this one */
+bool PooledPath::Equals(const String& path) const
+{
+	if (path.length() != length())
+		return false;
+	size_t end = path.length();
+	for (const Node *p = m_pNode; p; p = p->pParent)
+	{
+		const String& name = p->name.get();
+		end -= name.length();
+		if (path.compare(end, name.length(), name) != 0)
+			return false;
+		if (p->pParent && path[--end] != _T('\\'))
+			return false;
+	}
+	return true;
+}
+
+/** @brief Return number of distinct folders in the pool */
+size_t PooledPath::GetPoolSize()
+{
+	return ::GetPoolSize<Node>();
+}
@@ -0,0 +1,212 @@
+/**
+ * @file  PooledString.h
+ *
+ * @brief Declaration of PooledString and PooledPath classes
+ */
+#pragma once
+
+#include <atomic>
+#include <cstddef>
+#include "UnicodeString.h"
+
+/**
+ * @brief Immutable string shared through a pool.
+ *
+ * Equal strings share one reference counted pool entry, so file names and
+ * folder paths repeated in millions of folder compare items are stored once
+ * and copying an item only copies a pointer. The pool is split into shards
+ * with their own locks, so threads scanning folders at the same time rarely
+ * wait for each other. Entries are freed with their last reference, which
+ * means the strings of a compare go away with its items.
+ *
+ * Can be used instead of boost::flyweight<String>.
+ */
+class PooledString
+{
+public:
+	PooledString() : m_pEntry(NULL) {}
+	PooledString(const String& str) : m_pEntry(Intern(str)) {}
+	PooledString(const TCHAR *str) : m_pEntry(Intern(str)) {}
+	PooledString(const PooledString& other) : m_pEntry(other.m_pEntry) { AddRef(m_pEntry); }
+	PooledString(PooledString&& other) : m_pEntry(other.m_pEntry) { other.m_pEntry = NULL; }
+	~PooledString() { Release(m_pEntry); }
+
+	PooledString& operator=(const PooledString& other)
+	{
+		AddRef(other.m_pEntry);
+		Release(m_pEntry);
+		m_pEntry = other.m_pEntry;
+		return *this;
+	}
+	PooledString& operator=(PooledString&& other)
+	{
+		if (this != &other)
+		{
+			Release(m_pEntry);
+			m_pEntry = other.m_pEntry;
+			other.m_pEntry = NULL;
+		}
+		return *this;
+	}
+	PooledString& operator=(const String& str) { return *this = PooledString(str); }
+	PooledString& operator=(const TCHAR *str) { return *this = PooledString(str); }
+
+	const String& get() const { return m_pEntry ? m_pEntry->value : EmptyString(); }
+	operator const String&() const { return get(); }
+	const TCHAR *c_str() const { return get().c_str(); }
+	bool empty() const { return m_pEntry == NULL; }
+
+	/** @brief Equal strings share the entry, so comparing pointers is enough. */
+	bool operator==(const PooledString& other) const { return m_pEntry == other.m_pEntry; }
+	bool operator!=(const PooledString& other) const { return m_pEntry != other.m_pEntry; }
+
+	static size_t GetPoolSize();
+
+	struct Entry
+	{
+		String value;
+		size_t hash;
+		std::atomic<long> refs;
+		Entry *pNext; /**< Next entry in same hash bucket */
+	};
+
+private:
+	static Entry *Intern(const String& str);
+	static void Free(Entry *pEntry);
+
+	static const String& EmptyString()
+	{
+		static const String empty;
+		return empty;
+	}
+
+	static void AddRef(Entry *pEntry)
+	{
+		if (pEntry)
+			pEntry->refs.fetch_add(1, std::memory_order_relaxed);
+	}
+
+	/**
+	 * @brief Drop a reference.
+	 * Only the last reference is dropped under the shard lock, where it
+	 * can't race with Intern() finding the entry again.
+	 */
+	static void Release(Entry *pEntry)
+	{
+		if (!pEntry)
+			return;
+		long refs = pEntry->refs.load(std::memory_order_relaxed);
+		while (refs > 1)
+		{
+			if (pEntry->refs.compare_exchange_weak(refs, refs - 1, std::memory_order_release, std::memory_order_relaxed))
+				return;
+		}
+		Free(pEntry);
+	}
+
+	Entry *m_pEntry; /**< NULL for empty string */
+};
+
+inline bool operator==(const PooledString& a, const String& b) { return a.get() == b; }
+inline bool operator==(const String& a, const PooledString& b) { return a == b.get(); }
+inline bool operator!=(const PooledString& a, const String& b) { return a.get() != b; }
+inline bool operator!=(const String& a, const PooledString& b) { return a != b.get(); }
+inline bool operator==(const PooledString& a, const TCHAR *b) { return a.get() == b; }
+inline bool operator!=(const PooledString& a, const TCHAR *b) { return a.get() != b; }
+
+/**
+ * @brief Immutable folder path shared through a trie of pooled folders.
+ *
+ * A path is a handle to the node of its last folder. Each node holds the
+ * pooled name of the folder and a reference to the node of its parent
+ * folder, so a folder deep in a tree only adds its own name, and all
+ * items of a folder share one node. The full path is rebuilt when asked
+ * for. Components are separated by backslashes, and any string, also
+ * with empty components, gives back the same string.
+ *
+ * Nodes are found by parent and name from a table split into shards like
+ * the string pool, and freed with their last reference.
+ */
+class PooledPath
+{
+public:
+	PooledPath() : m_pNode(NULL) {}
+	PooledPath(const String& path) : m_pNode(Intern(path)) {}
+	PooledPath(const TCHAR *path) : m_pNode(Intern(path)) {}
+	PooledPath(const PooledPath& other) : m_pNode(other.m_pNode) { AddRef(m_pNode); }
+	PooledPath(PooledPath&& other) : m_pNode(other.m_pNode) { other.m_pNode = NULL; }
+	~PooledPath() { Release(m_pNode); }
+
+	PooledPath& operator=(const PooledPath& other)
+	{
+		AddRef(other.m_pNode);
+		Release(m_pNode);
+		m_pNode = other.m_pNode;
+		return *this;
+	}
+	PooledPath& operator=(PooledPath&& other)
+	{
+		if (this != &other)
+		{
+			Release(m_pNode);
+			m_pNode = other.m_pNode;
+			other.m_pNode = NULL;
+		}
+		return *this;
+	}
+	PooledPath& operator=(const String& path) { return *this = PooledPath(path); }
+	PooledPath& operator=(const TCHAR *path) { return *this = PooledPath(path); }
+
+	String get() const;
+	operator String() const { return get(); }
+	bool empty() const { return m_pNode == NULL; }
+	size_t length() const { return m_pNode ? m_pNode->length : 0; }
+	bool Equals(const String& path) const;
+
+	/** @brief Equal paths share the node, so comparing pointers is enough. */
+	bool operator==(const PooledPath& other) const { return m_pNode == other.m_pNode; }
+	bool operator!=(const PooledPath& other) const { return m_pNode != other.m_pNode; }
+
+	static size_t GetPoolSize();
+
+	struct Node
+	{
+		PooledString name; /**< Last component of the path */
+		Node *pParent; /**< NULL for first component */
+		size_t length; /**< Length of the whole path */
+		size_t hash;
+		std::atomic<long> refs;
+		Node *pNext; /**< Next node in same hash bucket */
+	};
+
+private:
+	static Node *Intern(const String& path);
+	static void Free(Node *pNode);
+
+	static void AddRef(Node *pNode)
+	{
+		if (pNode)
+			pNode->refs.fetch_add(1, std::memory_order_relaxed);
+	}
+
+	/** @brief Drop a reference, see PooledString::Release(). */
+	static void Release(Node *pNode)
+	{
+		if (!pNode)
+			return;
+		long refs = pNode->refs.load(std::memory_order_relaxed);
+		while (refs > 1)
+		{
+			if (pNode->refs.compare_exchange_weak(refs, refs - 1, std::memory_order_release, std::memory_order_relaxed))
+				return;
+		}
+		Free(pNode);
+	}
+
+	Node *m_pNode; /**< NULL for empty path */
+};
+
+inline bool operator==(const PooledPath& a, const String& b) { return a.Equals(b); }
+inline bool operator==(const String& a, const PooledPath& b) { return b.Equals(a); }
+inline bool operator!=(const PooledPath& a, const String& b) { return !a.Equals(b); }
+inline bool operator!=(const String& a, const PooledPath& b) { return !b.Equals(a); }
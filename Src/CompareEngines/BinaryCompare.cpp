@@ -5,87 +5,550 @@
  */
 
 #include "BinaryCompare.h"
+#include <algorithm>
+#include <vector>
+#include <cstring>
 #include "DiffItem.h"
 #include "PathContext.h"
+#include "ContentDigest.h"
 #ifdef _WIN32
+# include <windows.h>
 # include <io.h>
 #else
 # include <unistd.h>
 #endif
 #include <fcntl.h>
+#if defined(_M_X64) || defined(_M_IX86) || defined(__SSE2__)
+# define BINARYCOMPARE_SSE2
+# include <emmintrin.h>
+#endif
 
 namespace CompareEngines
 {
 
-BinaryCompare::BinaryCompare()
+namespace
+{
+
+/** @brief Size of buffer per file when files are read. */
+const size_t ReadBufferSize = 1024 * 256;
+
+/**
+ * @brief Default size from which files are memory-mapped.
+ * For smaller files setting up the mapping costs more than reading.
+ */
+const int64_t MapMinSizeDefault = 4 * 1024 * 1024;
+
+/**
+ * @brief Default size of the view mapped at once per file.
+ */
+#if defined(_WIN64) || defined(__LP64__)
+const size_t MapWindowSizeDefault = 64 * 1024 * 1024;
+#else
+const size_t MapWindowSizeDefault = 16 * 1024 * 1024;
+#endif
+
+/** @brief Returned by compare_files_mapped() when files cannot be mapped. */
+const int MAPPING_FAILED = -1;
+
+#ifdef _WIN32
+
+/**
+ * @brief Read-only memory-mapped file.
+ * Unlike UniMemFile, the file is mapped in windows of given size, so files
+ * larger than address space can be handled.
+ *
+ * Only implemented for Windows, where reading a view of a file truncated
+ * by another process raises EXCEPTION_IN_PAGE_ERROR that is handled in
+ * find_mismatch_mapped(). Elsewhere the same access raises SIGBUS, which
+ * cannot be recovered from locally, so files are always read.
+ */
+class MappedFile
+{
+public:
+	MappedFile();
+	~MappedFile();
+	bool Open(const String& path);
+	void Close();
+	const unsigned char *Map(int64_t offset, size_t len);
+	int64_t GetSize() const { return m_size; }
+
+private:
+	void Unmap();
+
+	HANDLE m_hFile;
+	HANDLE m_hMapping;
+	void *m_pView; /**< Start of current view, NULL if not mapped */
+	size_t m_viewLen; /**< Length of current view */
+	int64_t m_size; /**< File size in bytes */
+};
+
+/** @brief Memory range for PrefetchVirtualMemory() (Windows 8 and later). */
+struct MemoryRangeEntry
+{
+	PVOID VirtualAddress;
+	SIZE_T NumberOfBytes;
+};
+
+typedef BOOL (WINAPI *PrefetchVirtualMemoryFunc)(HANDLE, ULONG_PTR, MemoryRangeEntry *, ULONG);
+
+/**
+ * @brief Start reading given range of a view in the background.
+ * Does nothing in Windows versions not having PrefetchVirtualMemory().
+ */
+static void PrefetchView(void *p, size_t len)
 {
+	static PrefetchVirtualMemoryFunc pfnPrefetchVirtualMemory =
+		reinterpret_cast<PrefetchVirtualMemoryFunc>(
+			GetProcAddress(GetModuleHandleW(L"kernel32.dll"), "PrefetchVirtualMemory"));
+	if (pfnPrefetchVirtualMemory != NULL)
+	{
+		MemoryRangeEntry range = { p, len };
+		pfnPrefetchVirtualMemory(GetCurrentProcess(), 1, &range, 0);
+	}
 }
 
-BinaryCompare::~BinaryCompare()
+static int64_t GetAllocationGranularity()
+{
+	SYSTEM_INFO si;
+	GetSystemInfo(&si);
+	return si.dwAllocationGranularity;
+}
+
+MappedFile::MappedFile()
+: m_hFile(INVALID_HANDLE_VALUE)
+, m_hMapping(NULL)
+, m_pView(NULL)
+, m_viewLen(0)
+, m_size(0)
+{
+}
+
+bool MappedFile::Open(const String& path)
 {
+	Close();
+	// FILE_FLAG_SEQUENTIAL_SCAN makes cache manager read ahead aggressively
+	m_hFile = CreateFile(path.c_str(), GENERIC_READ, FILE_SHARE_READ | FILE_SHARE_WRITE,
+		NULL, OPEN_EXISTING, FILE_FLAG_SEQUENTIAL_SCAN, NULL);
+	if (m_hFile == INVALID_HANDLE_VALUE)
+		return false;
+	LARGE_INTEGER liSize;
+	if (!GetFileSizeEx(m_hFile, &liSize))
+		return false;
+	m_size = liSize.QuadPart;
+	// Empty files cannot be mapped, but there is nothing to map either
+	if (m_size == 0)
+		return true;
+	m_hMapping = CreateFileMapping(m_hFile, NULL, PAGE_READONLY, 0, 0, NULL);
+	return m_hMapping != NULL;
 }
 
-static int compare_files(const String& file1, const String& file2)
+void MappedFile::Close()
 {
-	const size_t bufsize = 1024 * 256;
-	int code;
-	int fd1 = _wopen(file1.c_str(), O_BINARY | O_RDONLY);
-	int fd2 = _wopen(file2.c_str(), O_BINARY | O_RDONLY);
-	if (fd1 != -1 && fd2 != -1)
+	Unmap();
+	if (m_hMapping != NULL)
+		CloseHandle(m_hMapping);
+	if (m_hFile != INVALID_HANDLE_VALUE)
+		CloseHandle(m_hFile);
+	m_hMapping = NULL;
+	m_hFile = INVALID_HANDLE_VALUE;
+	m_size = 0;
+}
+
+/**
+ * @brief Map a view of the file, replacing the previous view.
+ * @param [in] offset Offset of the view in the file.
+ * @param [in] len Length of the view.
+ * @return Pointer to data at @p offset, NULL if mapping failed.
+ */
+const unsigned char *MappedFile::Map(int64_t offset, size_t len)
+{
+	static const int64_t nGranularity = GetAllocationGranularity();
+	Unmap();
+	if (m_hMapping == NULL)
+		return NULL;
+	const int64_t aligned = offset - offset % nGranularity;
+	const size_t delta = static_cast<size_t>(offset - aligned);
+	m_pView = MapViewOfFile(m_hMapping, FILE_MAP_READ,
+		static_cast<DWORD>(aligned >> 32), static_cast<DWORD>(aligned & 0xFFFFFFFF), len + delta);
+	if (m_pView == NULL)
+		return NULL;
+	m_viewLen = len + delta;
+	PrefetchView(m_pView, m_viewLen);
+	return static_cast<const unsigned char *>(m_pView) + delta;
+}
+
+void MappedFile::Unmap()
+{
+	if (m_pView != NULL)
+		UnmapViewOfFile(m_pView);
+	m_pView = NULL;
+	m_viewLen = 0;
+}
+
+MappedFile::~MappedFile()
+{
+	Close();
+}
+
+#endif
+
+/**
+ * @brief Find first mismatching byte, one byte at a time.
+ * memcmp() is used to skip over equal blocks quickly.
+ */
+static size_t find_mismatch_generic(const unsigned char *const buf[], int nfiles, size_t len)
+{
+	const size_t blocksize = 4096;
+	const unsigned char *a = buf[0], *b = buf[1], *c = buf[nfiles - 1];
+	size_t i = 0;
+	for (; i < len; i += blocksize)
 	{
+		const size_t n = (std::min)(blocksize, len - i);
+		if (memcmp(a + i, b + i, n) != 0 || (nfiles > 2 && memcmp(b + i, c + i, n) != 0))
+			break;
+	}
+	for (; i < len; ++i)
+	{
+		if (a[i] != b[i] || b[i] != c[i])
+			return i;
+	}
+	return len;
+}
+
+#ifdef BINARYCOMPARE_SSE2
+
+static bool HasSSE2()
+{
+#if defined(_M_X64) || defined(__SSE2__)
+	return true;
+#else
+	static const bool bSSE2 = !!IsProcessorFeaturePresent(PF_XMMI64_INSTRUCTIONS_AVAILABLE);
+	return bSSE2;
+#endif
+}
+
+static inline unsigned lowest_bit_index(unsigned mask)
+{
+	unsigned n = 0;
+	while (!(mask & 1))
+	{
+		mask >>= 1;
+		++n;
+	}
+	return n;
+}
+
+/** @brief Compare 16 bytes, returns mask having bit set for equal bytes. */
+template<bool bThreeWay>
+static inline __m128i equal16(const unsigned char *a, const unsigned char *b, const unsigned char *c)
+{
+	const __m128i vb = _mm_loadu_si128(reinterpret_cast<const __m128i *>(b));
+	__m128i eq = _mm_cmpeq_epi8(_mm_loadu_si128(reinterpret_cast<const __m128i *>(a)), vb);
+	if (bThreeWay)
+		eq = _mm_and_si128(eq, _mm_cmpeq_epi8(vb, _mm_loadu_si128(reinterpret_cast<const __m128i *>(c))));
+	return eq;
+}
+
+/**
+ * @brief Find first mismatching byte using SSE2.
+ * Compares 64 bytes of every file per iteration; the middle file is loaded
+ * only once for 3-way compare.
+ */
+template<bool bThreeWay>
+static size_t find_mismatch_sse2(const unsigned char *a, const unsigned char *b, const unsigned char *c, size_t len)
+{
+	size_t i = 0;
+	for (; i + 64 <= len; i += 64)
+	{
+		const __m128i eq = _mm_and_si128(
+			_mm_and_si128(equal16<bThreeWay>(a + i, b + i, c + i), equal16<bThreeWay>(a + i + 16, b + i + 16, c + i + 16)),
+			_mm_and_si128(equal16<bThreeWay>(a + i + 32, b + i + 32, c + i + 32), equal16<bThreeWay>(a + i + 48, b + i + 48, c + i + 48)));
+		if (_mm_movemask_epi8(eq) != 0xFFFF)
+			break;
+	}
+	for (; i + 16 <= len; i += 16)
+	{
+		const unsigned mask = _mm_movemask_epi8(equal16<bThreeWay>(a + i, b + i, c + i)) ^ 0xFFFF;
+		if (mask != 0)
+			return i + lowest_bit_index(mask);
+	}
+	for (; i < len; ++i)
+	{
+		if (a[i] != b[i] || (bThreeWay && b[i] != c[i]))
+			return i;
+	}
+	return len;
+}
+
+#endif
+
+/**
+ * @brief Find offset of first byte differing between buffers.
+ * @param [in] buf Buffers to compare (2 or 3).
+ * @param [in] nfiles Number of buffers.
+ * @param [in] len Length of each buffer.
+ * @return Offset of first difference, @p len if buffers are identical.
+ */
+static size_t find_mismatch(const unsigned char *const buf[], int nfiles, size_t len)
+{
+#ifdef BINARYCOMPARE_SSE2
+	if (HasSSE2())
+	{
+		if (nfiles > 2)
+			return find_mismatch_sse2<true>(buf[0], buf[1], buf[2], len);
+		return find_mismatch_sse2<false>(buf[0], buf[1], buf[1], len);
+	}
+#endif
+	return find_mismatch_generic(buf, nfiles, len);
+}
+
+#ifdef _WIN32
+
+/**
+ * @brief Find first difference in mapped views.
+ * Reading a view may fail (eg. when file is on a network drive which
+ * is disconnected, or the file was truncated after it was mapped) which
+ * is reported as an exception.
+ * @return Offset of first difference, -1 if reading failed.
+ */
+static int64_t find_mismatch_mapped(const unsigned char *const buf[], int nfiles, size_t len)
+{
+	__try
+	{
+		return static_cast<int64_t>(find_mismatch(buf, nfiles, len));
+	}
+	__except (GetExceptionCode() == EXCEPTION_IN_PAGE_ERROR ?
+		EXCEPTION_EXECUTE_HANDLER : EXCEPTION_CONTINUE_SEARCH)
+	{
+		return -1;
+	}
+}
+
+/**
+ * @brief Feed mapped views to digests.
+ * @return false if reading failed.
+ */
+static bool digest_mapped(ContentDigest *pDigests, const unsigned char *const buf[], int nfiles, size_t len)
+{
+	__try
+	{
+		for (int i = 0; i < nfiles; ++i)
+			pDigests[i].Update(buf[i], len);
+		return true;
+	}
+	__except (GetExceptionCode() == EXCEPTION_IN_PAGE_ERROR ?
+		EXCEPTION_EXECUTE_HANDLER : EXCEPTION_CONTINUE_SEARCH)
+	{
+		return false;
+	}
+}
+
+/**
+ * @brief Compare files by mapping them to memory.
+ * @param [in] nWindowSize Size of the view mapped at once per file.
+ * @param [out] nFirstDiffOffset Offset of first differing byte.
+ * @param [in, out] pDigests Digests fed with identical views, or NULL.
+ * @return DIFFCODE, or MAPPING_FAILED if some file could not be mapped.
+ */
+static int compare_files_mapped(const String files[], int nfiles, size_t nWindowSize, int64_t& nFirstDiffOffset,
+	ContentDigest *pDigests)
+{
+	MappedFile mapped[3];
+	int64_t minsize = -1;
+	bool bSameSize = true;
+	for (int i = 0; i < nfiles; ++i)
+	{
+		if (!mapped[i].Open(files[i]))
+			return MAPPING_FAILED;
+		if (i > 0 && mapped[i].GetSize() != minsize)
+			bSameSize = false;
+		if (minsize < 0 || mapped[i].GetSize() < minsize)
+			minsize = mapped[i].GetSize();
+	}
+
+	for (int64_t offset = 0; offset < minsize; offset += nWindowSize)
+	{
+		const size_t len = static_cast<size_t>((std::min)(static_cast<int64_t>(nWindowSize), minsize - offset));
+		const unsigned char *buf[3];
+		for (int i = 0; i < nfiles; ++i)
+		{
+			buf[i] = mapped[i].Map(offset, len);
+			if (buf[i] == NULL)
+				return MAPPING_FAILED;
+		}
+		const int64_t pos = find_mismatch_mapped(buf, nfiles, len);
+		if (pos < 0)
+			return DIFFCODE::CMPERR;
+		if (pos < static_cast<int64_t>(len))
+		{
+			nFirstDiffOffset = offset + pos;
+			return DIFFCODE::DIFF;
+		}
+		if (pDigests && !digest_mapped(pDigests, buf, nfiles, len))
+			return DIFFCODE::CMPERR;
+	}
+	if (!bSameSize)
+	{
+		nFirstDiffOffset = minsize;
+		return DIFFCODE::DIFF;
+	}
+	return DIFFCODE::SAME;
+}
+
+#else
+
+static int compare_files_mapped(const String files[], int nfiles, size_t nWindowSize, int64_t& nFirstDiffOffset,
+	ContentDigest *pDigests)
+{
+	return MAPPING_FAILED;
+}
+
+#endif
+
+/**
+ * @brief Read until buffer is full or end of file is reached.
+ * @return Number of bytes read, -1 on error.
+ */
+static int read_full(int fd, unsigned char *buf, size_t bufsize)
+{
+	size_t total = 0;
+	while (total < bufsize)
+	{
+		int size = read(fd, buf + total, static_cast<unsigned>(bufsize - total));
+		if (size < 0)
+			return -1;
+		if (size == 0)
+			break;
+		total += size;
+	}
+	return static_cast<int>(total);
+}
+
+/**
+ * @brief Compare files by reading them to buffers.
+ * All files are read in a single pass.
+ * @param [out] nFirstDiffOffset Offset of first differing byte.
+ * @param [in, out] pDigests Digests fed with identical buffers, or NULL.
+ * @return DIFFCODE
+ */
+static int compare_files_read(const String files[], int nfiles, int64_t& nFirstDiffOffset, ContentDigest *pDigests)
+{
+	int code = DIFFCODE::SAME;
+	int fd[3] = { -1, -1, -1 };
+	for (int i = 0; i < nfiles; ++i)
+	{
+		fd[i] = _wopen(files[i].c_str(), O_BINARY | O_RDONLY);
+		if (fd[i] == -1)
+			code = DIFFCODE::CMPERR;
+	}
+
+	if (code == DIFFCODE::SAME)
+	{
+		std::vector<unsigned char> buffer(ReadBufferSize * nfiles);
+		int64_t offset = 0;
 		for (;;)
 		{
-			char buf1[bufsize];
-			char buf2[bufsize];
-			int size1 = read(fd1, buf1, sizeof(buf1));
-			int size2 = read(fd2, buf2, sizeof(buf2));
-			if (size1 <= 0 || size2 <= 0)
+			const unsigned char *buf[3];
+			int minsize = -1;
+			bool bSameSize = true;
+			for (int i = 0; i < nfiles; ++i)
 			{
-				if (size1 < 0 || size2 < 0)
+				unsigned char *p = &buffer[ReadBufferSize * i];
+				int size = read_full(fd[i], p, ReadBufferSize);
+				if (size < 0)
+				{
 					code = DIFFCODE::CMPERR;
-				else
-					code = DIFFCODE::SAME;
-				break;
+					break;
+				}
+				if (i > 0 && size != minsize)
+					bSameSize = false;
+				if (minsize < 0 || size < minsize)
+					minsize = size;
+				buf[i] = p;
 			}
-			if (size1 != size2 || memcmp(buf1, buf2, size1) != 0)
+			if (code == DIFFCODE::CMPERR)
+				break;
+			const size_t pos = find_mismatch(buf, nfiles, minsize);
+			if (pos < static_cast<size_t>(minsize) || !bSameSize)
 			{
+				nFirstDiffOffset = offset + pos;
 				code = DIFFCODE::DIFF;
 				break;
 			}
+			if (minsize == 0)
+				break;
+			if (pDigests)
+			{
+				for (int i = 0; i < nfiles; ++i)
+					pDigests[i].Update(buf[i], minsize);
+			}
+			offset += minsize;
 		}
 	}
-	else
+
+	for (int i = 0; i < nfiles; ++i)
 	{
-		code = DIFFCODE::CMPERR;
+		if (fd[i] != -1)
+			close(fd[i]);
 	}
-	if (fd1 != -1)
-		close(fd1);
-	if (fd2 != -1)
-		close(fd2);
 
 	return code;
 }
 
+}
+
+BinaryCompare::BinaryCompare()
+: m_bUseMapping(true)
+, m_nMapMinSize(MapMinSizeDefault)
+, m_nMapWindowSize(MapWindowSizeDefault)
+{
+}
+
+BinaryCompare::~BinaryCompare()
+{
+}
+
 /**
- * @brief Compare two specified files, byte-by-byte
+ * @brief Compare two or three specified files, byte-by-byte
  * @param [in] di Diffitem info.
+ * @param [out] pFirstDiffOffset Offset of first differing byte, -1 if
+ *   files are identical or the offset is not known. Can be NULL.
+ * @param [in, out] pDigests Digests, one for each file, fed with the files
+ *   as far as they are identical. Can be NULL.
  * @return DIFFCODE
  */
-int BinaryCompare::CompareFiles(const PathContext& files, const DIFFITEM &di) const
+int BinaryCompare::CompareFiles(const PathContext& files, const DIFFITEM &di, int64_t *pFirstDiffOffset,
+	ContentDigest *pDigests) const
 {
-	unsigned code = DIFFCODE::DIFF;
-	if (files.GetSize() == 2 && di.diffFileInfo[0].size == di.diffFileInfo[1].size)
+	int64_t nFirstDiffOffset = -1;
+	int code = DIFFCODE::DIFF;
+	const int nfiles = files.GetSize();
+	bool bSameSize = (nfiles == 2 || nfiles == 3);
+	for (int i = 1; i < nfiles && bSameSize; ++i)
 	{
-		code = compare_files(files[0], files[1]);
+		if (di.diffFileInfo[i - 1].size != di.diffFileInfo[i].size)
+			bSameSize = false;
 	}
-	else if (files.GetSize() == 3 && 
-		di.diffFileInfo[0].size == di.diffFileInfo[1].size &&
-		di.diffFileInfo[1].size == di.diffFileInfo[2].size)
+	if (bSameSize)
 	{
-		code = compare_files(files[0], files[1]);
-		if (code == DIFFCODE::SAME)
-			code = compare_files(files[1], files[2]);
+		String paths[3];
+		for (int i = 0; i < nfiles; ++i)
+			paths[i] = files[i];
+		code = MAPPING_FAILED;
+		if (m_bUseMapping && di.diffFileInfo[0].size >= m_nMapMinSize)
+			code = compare_files_mapped(paths, nfiles, m_nMapWindowSize, nFirstDiffOffset, pDigests);
+		if (code == MAPPING_FAILED)
+		{
+			if (pDigests)
+			{
+				for (int i = 0; i < nfiles; ++i)
+					pDigests[i].Reset();
+			}
+			code = compare_files_read(paths, nfiles, nFirstDiffOffset, pDigests);
+		}
 	}
+	if (pFirstDiffOffset != nullptr)
+		*pFirstDiffOffset = nFirstDiffOffset;
 	return code;
 }
 
@@ -5,22 +5,47 @@
  */
 #pragma once
 
+#include <cstddef>
+#include <cstdint>
+
 struct DIFFITEM;
 class PathContext;
+class ContentDigest;
 
 namespace CompareEngines
 {
 
 /**
- * @brief A time/size compare class.
- * This compare method compares files by their times and sizes.
+ * @brief A binary compare class.
+ * This compare method compares files byte-by-byte. Large files are
+ * memory-mapped in windows and all files (two or three) are compared in a
+ * single pass. Small files, and files that cannot be mapped, are read with
+ * plain file reads instead.
  */
 class BinaryCompare
 {
 public:
 	BinaryCompare();
 	~BinaryCompare();
-	int CompareFiles(const PathContext& files, const DIFFITEM &di) const;
+	int CompareFiles(const PathContext& files, const DIFFITEM &di, int64_t *pFirstDiffOffset = nullptr,
+		ContentDigest *pDigests = nullptr) const;
+
+	/** @brief Enable or disable memory-mapping (enabled by default). */
+	void SetUseMapping(bool bUseMapping) { m_bUseMapping = bUseMapping; }
+	bool GetUseMapping() const { return m_bUseMapping; }
+
+	/** @brief Set size from which files are memory-mapped instead of read. */
+	void SetMapMinSize(int64_t nMapMinSize) { m_nMapMinSize = nMapMinSize; }
+	int64_t GetMapMinSize() const { return m_nMapMinSize; }
+
+	/** @brief Set size of the view mapped at once per file. */
+	void SetMapWindowSize(size_t nMapWindowSize) { m_nMapWindowSize = nMapWindowSize; }
+	size_t GetMapWindowSize() const { return m_nMapWindowSize; }
+
+private:
+	bool m_bUseMapping; /**< Compare memory-mapped files? */
+	int64_t m_nMapMinSize; /**< Smaller files are read, not mapped */
+	size_t m_nMapWindowSize; /**< Size of view mapped at once */
 };
 
 } // namespace CompareEngines
@@ -7,9 +7,17 @@
 #include "ByteComparator.h"
 #include <cassert>
 #include <cstdint>
+#include <algorithm>
 #include "UnicodeString.h"
 #include "FileTextStats.h"
 #include "CompareOptions.h"
+#if defined(_M_X64) || defined(_M_IX86) || defined(__SSE2__)
+# define BYTECOMPARATOR_SSE2
+# include <emmintrin.h>
+# if !defined(_M_X64) && !defined(__SSE2__)
+#  include <windows.h>
+# endif
+#endif
 
 /**
  * @brief Returns if given char is EOL byte.
@@ -32,6 +40,120 @@ static inline bool iswsch(TCHAR ch)
 	return ch == ' ' || ch == '\t';
 }
 
+#ifdef BYTECOMPARATOR_SSE2
+
+/**
+ * @brief Returns if SSE2 instructions can be used.
+ * Only 32-bit x86 builds need to check it at runtime.
+ */
+static bool HasSSE2()
+{
+#if defined(_M_X64) || defined(__SSE2__)
+	return true;
+#else
+	static const bool bSSE2 = !!IsProcessorFeaturePresent(PF_XMMI64_INSTRUCTIONS_AVAILABLE);
+	return bSSE2;
+#endif
+}
+
+static inline unsigned LowestBitIndex(unsigned mask)
+{
+	unsigned n = 0;
+	while (!(mask & 1))
+	{
+		mask >>= 1;
+		++n;
+	}
+	return n;
+}
+
+static inline __m128i Load16(const char *p)
+{
+	return _mm_loadu_si128(reinterpret_cast<const __m128i *>(p));
+}
+
+/**
+ * @brief Returns mask of bytes TextScan() must look at (0, CR and LF).
+ */
+static inline unsigned TextScanMask(__m128i v)
+{
+	const __m128i special = _mm_or_si128(
+		_mm_cmpeq_epi8(v, _mm_setzero_si128()),
+		_mm_or_si128(_mm_cmpeq_epi8(v, _mm_set1_epi8('\r')), _mm_cmpeq_epi8(v, _mm_set1_epi8('\n'))));
+	return _mm_movemask_epi8(special);
+}
+
+/** @brief Returns mask of bytes differing between the buffers. */
+static inline unsigned MismatchMask(const char *ptr0, const char *ptr1)
+{
+	return _mm_movemask_epi8(_mm_cmpeq_epi8(Load16(ptr0), Load16(ptr1))) ^ 0xFFFF;
+}
+
+#endif
+
+/**
+ * @brief Skip over bytes not counted by TextScan().
+ * @param [in] ptr Pointer to begin of the buffer.
+ * @param [in] end Pointer to end of buffer.
+ * @return Pointer to first 0, CR or LF byte, or @p end.
+ */
+static inline const char *SkipTextBytes(const char *ptr, const char *end)
+{
+#ifdef BYTECOMPARATOR_SSE2
+	if (HasSSE2())
+	{
+		for (; end - ptr >= 64; ptr += 64)
+		{
+			const __m128i v0 = Load16(ptr), v1 = Load16(ptr + 16);
+			const __m128i v2 = Load16(ptr + 32), v3 = Load16(ptr + 48);
+			if (TextScanMask(v0) | TextScanMask(v1) | TextScanMask(v2) | TextScanMask(v3))
+				break;
+		}
+		for (; end - ptr >= 16; ptr += 16)
+		{
+			const unsigned mask = TextScanMask(Load16(ptr));
+			if (mask != 0)
+				return ptr + LowestBitIndex(mask);
+		}
+	}
+#endif
+	while (ptr < end && *ptr != 0 && !iseolch(*ptr))
+		++ptr;
+	return ptr;
+}
+
+/**
+ * @brief Count bytes identical in both buffers.
+ * @param [in] ptr0 Pointer to the first buffer.
+ * @param [in] ptr1 Pointer to the second buffer.
+ * @param [in] len Number of bytes available in both buffers.
+ * @return Length of the run of identical bytes.
+ */
+static size_t IdenticalRunLength(const char *ptr0, const char *ptr1, size_t len)
+{
+	size_t i = 0;
+#ifdef BYTECOMPARATOR_SSE2
+	if (HasSSE2())
+	{
+		for (; i + 64 <= len; i += 64)
+		{
+			if (MismatchMask(ptr0 + i, ptr1 + i) | MismatchMask(ptr0 + i + 16, ptr1 + i + 16) |
+				MismatchMask(ptr0 + i + 32, ptr1 + i + 32) | MismatchMask(ptr0 + i + 48, ptr1 + i + 48))
+				break;
+		}
+		for (; i + 16 <= len; i += 16)
+		{
+			const unsigned mask = MismatchMask(ptr0 + i, ptr1 + i);
+			if (mask != 0)
+				return i + LowestBitIndex(mask);
+		}
+	}
+#endif
+	while (i < len && ptr0[i] == ptr1[i])
+		++i;
+	return i;
+}
+
 /**
  * @brief Calculates statistics from given buffer.
  * This function calculates EOL byte and zero-byte statistics from given
@@ -42,9 +164,10 @@ static inline bool iswsch(TCHAR ch)
  * @param [in] eof Is buffer end also end of file?
  * @param [in] crflag Did previous scan end to CR?
  * @param [in] offset Byte offset in whole file (among several buffers).
+ * @param [in] vectorize Skip over uninteresting bytes in bulk?
  */
 static void TextScan(FileTextStats & stats, const char *ptr, const char *end, bool eof,
-		bool crflag, int64_t offset)
+		bool crflag, int64_t offset, bool vectorize)
 {
 	// Handle any crs left from last buffer
 	if (crflag)
@@ -61,6 +184,12 @@ static void TextScan(FileTextStats & stats, const char *ptr, const char *end, bo
 	}
 	for (; ptr < end; ++ptr)
 	{
+		if (vectorize)
+		{
+			ptr = SkipTextBytes(ptr, end);
+			if (ptr == end)
+				break;
+		}
 		char ch = *ptr;
 		if (ch == 0)
 		{
@@ -110,6 +239,7 @@ ByteComparator::ByteComparator(const QuickCompareOptions * options)
 		: m_ignore_case(options->m_bIgnoreCase)
 		, m_ignore_eol_diff(options->m_bIgnoreEOLDifference)
 		, m_ignore_blank_lines(options->m_bIgnoreBlankLines)
+		, m_vectorize(true)
 // state
 		, m_wsflag(false)
 		, m_eol0(false)
@@ -159,8 +289,13 @@ ByteComparator::COMP_RESULT ByteComparator::CompareBuffers(
 
 	// First, update file text statistics by doing a full scan
 	// for 0s and all types of line delimiters
-	TextScan(stats0, ptr0, end0, eof0, m_cr0, offset0);
-	TextScan(stats1, ptr1, end1, eof1, m_cr1, offset1);
+	TextScan(stats0, ptr0, end0, eof0, m_cr0, offset0, m_vectorize);
+	TextScan(stats1, ptr1, end1, eof1, m_cr1, offset1, m_vectorize);
+
+	// Whitespace and EOL bytes need the compare loop only if options
+	// make them special
+	const bool wsSpecial = m_ignore_all_space || m_ignore_space_change;
+	const bool eolSpecial = m_ignore_eol_diff || m_ignore_blank_lines;
 
 	const char *orig0 = ptr0;
 	const char *orig1 = ptr1;
@@ -392,6 +527,27 @@ ByteComparator::COMP_RESULT ByteComparator::CompareBuffers(
 			}
 		}
 
+		if (m_vectorize)
+		{
+			// Skip identical bytes in bulk. Options skip whitespace and EOL
+			// bytes equally on both sides when the sides are identical, so
+			// state is the same as after comparing them one by one. But the
+			// run must not end within a whitespace or EOL sequence, as the
+			// loop has to see the whole sequence on both sides.
+			const size_t len = (std::min)(end0 - ptr0, end1 - ptr1);
+			size_t run = IdenticalRunLength(ptr0, ptr1, len);
+			while (run > 0 && ((wsSpecial && iswsch(ptr0[run - 1])) || (eolSpecial && iseolch(ptr0[run - 1]))))
+				--run;
+			if (run > 0)
+			{
+				ptr0 += run;
+				ptr1 += run;
+				m_bol0 = iseolch(ptr0[-1]);
+				m_bol1 = iseolch(ptr1[-1]);
+				continue;
+			}
+		}
+
 		TCHAR c0 = *ptr0, c1 = *ptr1;
 		if (m_ignore_case)
 		{
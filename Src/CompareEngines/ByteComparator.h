@@ -42,6 +42,9 @@ public:
 			const char* &ptr0, const char* &ptr1, const char* end0, const char* end1,
 			bool eof0, bool eof1, int64_t offset0, int64_t offset1);
 
+	/** @brief Enable or disable skipping identical bytes in bulk (enabled by default). */
+	void SetVectorize(bool vectorize) { m_vectorize = vectorize; }
+
 protected:
 	void HandleSide0Eol(char **ptr, const char *end, bool eof);
 	void HandleSide1Eol(char **ptr, const char *end, bool eof);
@@ -53,6 +56,7 @@ private:
 	bool m_ignore_all_space; /**< Ignore all whitespace changes */
 	bool m_ignore_eol_diff; /**< Ignore differences in EOL bytes */
 	bool m_ignore_blank_lines; /**< Ignore blank lines */
+	bool m_vectorize; /**< Skip identical bytes in bulk */
 	// state
 	bool m_wsflag; /**< ignore_space_change & in a whitespace area */
 	bool m_eol0; /**< 0-side has an eol */
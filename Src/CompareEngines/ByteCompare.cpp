@@ -20,6 +20,7 @@
 #include "DiffContext.h"
 #include "diff.h"
 #include "ByteComparator.h"
+#include "ContentDigest.h"
 
 namespace CompareEngines
 {
@@ -38,6 +39,7 @@ ByteCompare::ByteCompare()
 		: m_pOptions(nullptr)
 		, m_piAbortable(nullptr)
 		, m_inf(nullptr)
+		, m_pDigests(nullptr)
 {
 }
 
@@ -92,6 +94,15 @@ void ByteCompare::SetFileData(int items, file_data *data)
 	m_inf = data;
 }
 
+/**
+ * @brief Set digests to feed with the contents of the files.
+ * @param [in] digests Digests of both files, NULL to not digest.
+ */
+void ByteCompare::SetDigests(ContentDigest *digests)
+{
+	m_pDigests = digests;
+}
+
 
 /**
  * @brief Compare two specified files, byte-by-byte
@@ -151,9 +162,13 @@ int ByteCompare::CompareFiles(FileLocation *location)
 					return DIFFCODE::CMPERR;
 				if (rtn < space)
 					eof[i] = true;
+				if (m_pDigests)
+					m_pDigests[i].Update(&buff[i][bfend[i]], rtn);
 				bfend[i] += rtn;
 				if (m_inf[0].desc == m_inf[1].desc)
 				{
+					if (m_pDigests)
+						m_pDigests[1].Update(&buff[0][bfend[0] - rtn], rtn);
 					bfstart[1] = bfstart[0];
 					bfend[1] = bfend[0];
 					eof[1] = eof[0];
@@ -11,6 +11,7 @@
 class CompareOptions;
 class QuickCompareOptions;
 class IAbortable;
+class ContentDigest;
 struct FileLocation;
 struct file_data;
 
@@ -32,6 +33,7 @@ public:
 	void SetAdditionalOptions(bool stopAfterFirstDiff);
 	void SetAbortable(const IAbortable * piAbortable);
 	void SetFileData(int items, file_data *data);
+	void SetDigests(ContentDigest *digests);
 	int CompareFiles(FileLocation *location);
 	void GetTextStats(int side, FileTextStats *stats) const;
 
@@ -39,6 +41,7 @@ private:
 	std::unique_ptr<QuickCompareOptions> m_pOptions; /**< Compare options for diffutils. */
 	IAbortable * m_piAbortable;
 	file_data * m_inf; /**< Compared files data (for diffutils). */
+	ContentDigest * m_pDigests; /**< Digests fed with the files read, or NULL. */
 	FileTextStats m_textStats[2];
 
 };
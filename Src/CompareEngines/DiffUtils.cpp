@@ -36,6 +36,7 @@ DiffUtils::DiffUtils()
 		, m_ndiffs(0)
 		, m_ntrivialdiffs(0)
 		, m_codepage(0)
+		, m_pDiffList(nullptr)
 {
 }
 
@@ -123,6 +124,7 @@ int DiffUtils::diffutils_compare_files()
 	if (script)
 	{
 		struct change *next = script;
+		FilterMatchCache filterCache;
 
 		String asLwrCaseExt;
 		String LowerCaseExt = ucr::toTString(m_inf[0].name);
@@ -133,6 +135,8 @@ int DiffUtils::diffutils_compare_files()
 			std::transform(LowerCaseExt.begin(), LowerCaseExt.end(), LowerCaseExt.begin(), ::tolower);
 			asLwrCaseExt = LowerCaseExt;
 		}
+		if (m_pOptions->m_filterCommentsLines)
+			m_pDiffWrapper->ClassifyCommentLines(m_inf, asLwrCaseExt);
 
 		while (next)
 		{
@@ -177,6 +181,7 @@ int DiffUtils::diffutils_compare_files()
 						options.bFilterCommentsLines = m_pOptions->m_filterCommentsLines;
 						options.bIgnoreCase = m_pOptions->m_bIgnoreCase;
 						options.bIgnoreEol = m_pOptions->m_bIgnoreEOLDifference;
+						options.nDiffAlgorithm = m_pOptions->m_diffAlgorithm;
 						m_pDiffWrapper->SetOptions(&options);
   						m_pDiffWrapper->PostFilter(thisob->line0, QtyLinesLeft+1, thisob->line1, QtyLinesRight+1, op, asLwrCaseExt);
 						if(op == OP_TRIVIAL)
@@ -191,13 +196,16 @@ int DiffUtils::diffutils_compare_files()
 					if(m_pFilterList && m_pFilterList->HasRegExps())
 					{
 						bool match2 = false;
-						bool match1 = RegExpFilter(thisob->line0, thisob->line0 + QtyLinesLeft, 0);
+						bool match1 = RegExpFilter(thisob->line0, thisob->line0 + QtyLinesLeft, 0, filterCache);
 						if (match1)
-							match2 = RegExpFilter(thisob->line1, thisob->line1 + QtyLinesRight, 1);
+							match2 = RegExpFilter(thisob->line1, thisob->line1 + QtyLinesRight, 1, filterCache);
 						if (match1 && match2)
 							thisob->trivial = 1;
 					}
 
+					if (m_pDiffList)
+						m_pDiffWrapper->AddDiffRange(m_pDiffList, trans_a0 - 1, trans_b0 - 1,
+								trans_a1 - 1, trans_b1 - 1, thisob->trivial ? OP_TRIVIAL : OP_DIFF);
 				}
 				/* Reconnect the script so it will all be freed properly.  */
 				end->link = next;
@@ -268,9 +276,10 @@ int DiffUtils::diffutils_compare_files()
  * @param [in] StartPos First line of the difference.
  * @param [in] endPos Last line of the difference.
  * @param [in] FileNo File to match.
+ * @param [in,out] cache Results of lines already matched in this diff.
  * return true if any of the expressions matches.
  */
-bool DiffUtils::RegExpFilter(int StartPos, int EndPos, int FileNo) const
+bool DiffUtils::RegExpFilter(int StartPos, int EndPos, int FileNo, FilterMatchCache & cache) const
 {
 	if (m_pFilterList == NULL)
 	{
@@ -287,7 +296,10 @@ bool DiffUtils::RegExpFilter(int StartPos, int EndPos, int FileNo) const
 		size_t len = files[FileNo].linbuf[line + 1] - files[FileNo].linbuf[line];
 		const char *string = files[FileNo].linbuf[line];
 		size_t stringlen = linelen(string, len);
-		if (!m_pFilterList->Match(std::string(string, stringlen), m_codepage))
+		// Lines of same equivalence class are mostly same text, match them once
+		int eqclass = (files[FileNo].equivs && line < files[FileNo].buffered_lines) ?
+			files[FileNo].equivs[line] : -1;
+		if (!cache.Match(*m_pFilterList, eqclass, string, stringlen, m_codepage))
 		{
 			linesMatch = false;
 		}
@@ -9,11 +9,13 @@
 
 class CompareOptions;
 class FilterList;
+class FilterMatchCache;
 class DiffutilsOptions;
 struct file_data;
 struct FileTextStats;
 class FilterCommentsManager;
 class CDiffWrapper;
+class DiffList;
 
 namespace CompareEngines
 {
@@ -36,8 +38,9 @@ public:
 	void SetFilterCommentsManager(const FilterCommentsManager *pFilterCommentsManager);
 	void ClearFilterList();
 	void SetFileData(int items, file_data *data);
+	void SetDiffList(DiffList *pDiffList) { m_pDiffList = pDiffList; }
 	int diffutils_compare_files();
-	bool RegExpFilter(int StartPos, int EndPos, int FileNo) const;
+	bool RegExpFilter(int StartPos, int EndPos, int FileNo, FilterMatchCache & cache) const;
 	void GetDiffCounts(int & diffs, int & trivialDiffs) const;
 	void GetTextStats(int side, FileTextStats *stats) const;
 	bool Diff2Files(struct change ** diffs, int depth,
@@ -52,6 +55,7 @@ private:
 	int m_ntrivialdiffs; /**< Ignored diffs found. */
 	int m_codepage; /**< Codepage used in line filter */
 	std::unique_ptr<CDiffWrapper> m_pDiffWrapper;
+	DiffList * m_pDiffList; /**< Differences are added here too if not NULL. */
 };
 
 
@@ -0,0 +1,544 @@
+/**
+ * @file  StreamDiff.cpp
+ *
+ * @brief Implementation file for StreamDiff class.
+ */
+
+#include "diff.h"
+#include "StreamDiff.h"
+#include <algorithm>
+#include <cassert>
+#include <climits>
+#include <cstdint>
+#include <cstring>
+#ifdef _WIN32
+#include <io.h>
+#else
+#include <sys/types.h>
+#include <unistd.h>
+#endif
+#include "IAbortable.h"
+#include "DiffItem.h"
+#include "DiffList.h"
+#include "ContentDigest.h"
+
+namespace CompareEngines
+{
+
+static const size_t Mega = 1024 * 1024;
+
+/** @brief Smallest window read from a file. */
+static const size_t MinWindowSize = 1 * Mega;
+
+/**
+ * @brief Room after the text of a window for the newline and sentinel
+ * diffutils put there.
+ */
+static const size_t WindowSlack = 16;
+
+/**
+ * @brief Bytes at the start of file checked for binary content.
+ * This is the block diffutils checks when reading a whole file.
+ */
+static const size_t BinaryTestSize = 8 * 1024;
+
+namespace
+{
+	/** @brief Hash of a line, and its index in the window. */
+	struct LineKey
+	{
+		uint64_t hash;
+		size_t index;
+		bool operator<(const LineKey & other) const
+		{
+			return hash < other.hash || (hash == other.hash && index < other.index);
+		}
+	};
+
+	/** @brief Return length of a line without its EOL. */
+	size_t LineLength(const char *line, size_t len)
+	{
+		while (len > 0 && (line[len - 1] == '\n' || line[len - 1] == '\r'))
+			--len;
+		return len;
+	}
+
+	/** @brief Return FNV-1a hash of a line. */
+	uint64_t HashLine(const char *line, size_t len)
+	{
+		uint64_t hash = 14695981039346656037ULL;
+		for (size_t i = 0; i < len; ++i)
+		{
+			hash ^= static_cast<unsigned char>(line[i]);
+			hash *= 1099511628211ULL;
+		}
+		return hash;
+	}
+
+	/**
+	 * @brief Return end of the last line ending in the text.
+	 * A CR at the end of text may be the first half of a CR-LF pair, so it
+	 * doesn't end a line yet.
+	 */
+	size_t EndOfLastLine(const char *text, size_t size)
+	{
+		size_t end = size;
+		if (end > 0 && text[end - 1] == '\r')
+			--end;
+		while (end > 0 && text[end - 1] != '\n' && text[end - 1] != '\r')
+			--end;
+		return end;
+	}
+}
+
+/**
+ * @brief Default constructor.
+ */
+StreamDiff::StreamDiff()
+		: m_piAbortable(nullptr)
+		, m_inf(nullptr)
+		, m_pDigests(nullptr)
+		, m_windowSize(0)
+		, m_ndiffs(0)
+		, m_ntrivialdiffs(0)
+		, m_bDiffAtCut(false)
+		, m_bTrivialAtCut(false)
+{
+	SetMemoryLimit(256 * Mega);
+}
+
+/**
+ * @brief Default destructor.
+ */
+StreamDiff::~StreamDiff()
+{
+}
+
+/**
+ * @brief Set compare options from general compare options.
+ * @param [in ]options General compare options.
+ * @return true if succeeded, false otherwise.
+ */
+bool StreamDiff::SetCompareOptions(const CompareOptions & options)
+{
+	return m_diffUtils.SetCompareOptions(options);
+}
+
+/**
+ * @brief Set line filters list to use.
+ * @param [in] list List of line filters.
+ */
+void StreamDiff::SetFilterList(FilterList * list)
+{
+	m_diffUtils.SetFilterList(list);
+}
+
+void StreamDiff::SetFilterCommentsManager(const FilterCommentsManager *pFilterCommentsManager)
+{
+	m_diffUtils.SetFilterCommentsManager(pFilterCommentsManager);
+}
+
+/**
+ * @brief Clear current filters list.
+ */
+void StreamDiff::ClearFilterList()
+{
+	m_diffUtils.ClearFilterList();
+}
+
+/**
+ * @brief Set Abortable-interface.
+ * @param [in] piAbortable Pointer to abortable interface.
+ */
+void StreamDiff::SetAbortable(const IAbortable * piAbortable)
+{
+	m_piAbortable = const_cast<IAbortable*>(piAbortable);
+}
+
+/**
+ * @brief Set memory the compare may use.
+ * Diffutils needs roughly twice the size of the text for its line tables,
+ * so the window read from each file is a sixth of the limit. Lines longer
+ * than the window are still read whole.
+ * @param [in] memoryLimit Memory limit in bytes.
+ */
+void StreamDiff::SetMemoryLimit(size_t memoryLimit)
+{
+	m_windowSize = (std::max)(memoryLimit / 6, MinWindowSize);
+}
+
+/**
+ * @brief Set filedata.
+ * @param [in] items Count of filedata items to set.
+ * @param [in] data File data, with files opened.
+ */
+void StreamDiff::SetFileData(int items, file_data *data)
+{
+	// We support only two files currently!
+	assert(items == 2);
+	m_inf = data;
+}
+
+/**
+ * @brief Set digests to feed with the contents of the files.
+ * Binary files are rewound for another compare, and their digests reset.
+ * @param [in] digests Digests of both files, NULL to not digest.
+ */
+void StreamDiff::SetDigests(ContentDigest *digests)
+{
+	m_pDigests = digests;
+}
+
+/**
+ * @brief Compare two files (as earlier specified) a window at a time.
+ * Binary files are not compared. Then the files are rewound and the code
+ * has no compare result, so the caller can compare them some other way.
+ * @param [out] pDiffList Differences of the files are added here, if not NULL.
+ * @return DIFFCODE as a result of compare.
+ */
+int StreamDiff::CompareFiles(DiffList *pDiffList)
+{
+	m_ndiffs = 0;
+	m_ntrivialdiffs = 0;
+	m_bDiffAtCut = false;
+	m_bTrivialAtCut = false;
+	m_textStats[0].clear();
+	m_textStats[1].clear();
+
+	// Comparing file to itself
+	if (m_inf[0].desc == m_inf[1].desc)
+		return DIFFCODE::FILE | DIFFCODE::TEXT | DIFFCODE::SAME;
+
+	int i;
+	for (i = 0; i < 2; ++i)
+	{
+		m_window[i].size = 0;
+		m_window[i].complete = 0;
+		m_window[i].line = 0;
+		m_window[i].eof = false;
+		if (!ReadWindow(i))
+			return DIFFCODE::FILE | DIFFCODE::TEXT | DIFFCODE::CMPERR;
+	}
+
+	for (i = 0; i < 2; ++i)
+	{
+		size_t size = (std::min)(m_window[i].size, BinaryTestSize);
+		if (memchr(&m_window[i].text[0], '\0', size) != NULL)
+		{
+			lseek(m_inf[0].desc, 0, SEEK_SET);
+			lseek(m_inf[1].desc, 0, SEEK_SET);
+			if (m_pDigests)
+			{
+				m_pDigests[0].Reset();
+				m_pDigests[1].Reset();
+			}
+			return DIFFCODE::FILE | DIFFCODE::BIN;
+		}
+	}
+
+	unsigned code = DIFFCODE::FILE | DIFFCODE::TEXT | DIFFCODE::SAME;
+	std::vector<size_t> lines[2];
+	for (;;)
+	{
+		if (m_piAbortable && m_piAbortable->ShouldAbort())
+			return DIFFCODE::CMPABORT;
+
+		// Diff the rest of both files, or cut the windows after an anchor.
+		// Without an anchor, all complete lines are diffed. Then a
+		// difference at the cut is joined with the next window's.
+		size_t cut[2];
+		int cutLines[2];
+		bool bLast = m_window[0].eof && m_window[1].eof;
+		size_t anchor0 = 0, anchor1 = 0;
+		for (i = 0; i < 2; ++i)
+		{
+			cut[i] = bLast ? m_window[i].size : m_window[i].complete;
+			cutLines[i] = bLast ? 0 : static_cast<int>(FindLines(i, lines[i]));
+		}
+		if (!bLast && FindAnchor(lines, anchor0, anchor1))
+		{
+			size_t anchor[2] = { anchor0, anchor1 };
+			for (i = 0; i < 2; ++i)
+			{
+				if (anchor[i] + 1 < lines[i].size())
+					cut[i] = lines[i][anchor[i] + 1];
+				cutLines[i] = static_cast<int>(anchor[i] + 1);
+			}
+		}
+
+		unsigned windowCode = DiffWindows(cut, cutLines, bLast, pDiffList);
+		if (DIFFCODE::isResultError(windowCode))
+			return windowCode;
+		if ((windowCode & DIFFCODE::COMPAREFLAGS) == DIFFCODE::DIFF)
+			code = DIFFCODE::FILE | DIFFCODE::TEXT | DIFFCODE::DIFF;
+		if (bLast)
+			break;
+
+		for (i = 0; i < 2; ++i)
+		{
+			Window & window = m_window[i];
+			memmove(&window.text[0], &window.text[cut[i]], window.size - cut[i]);
+			window.size -= cut[i];
+			window.line += cutLines[i];
+			if (!ReadWindow(i))
+				return DIFFCODE::FILE | DIFFCODE::TEXT | DIFFCODE::CMPERR;
+		}
+	}
+	return code;
+}
+
+/**
+ * @brief Fill the window of a file.
+ * The window is grown if it has no complete line, until it has one or
+ * the end of file is reached.
+ * @param [in] side Index of the file.
+ * @return false if reading failed.
+ */
+bool StreamDiff::ReadWindow(int side)
+{
+	Window & window = m_window[side];
+	size_t windowSize = m_windowSize;
+	for (;;)
+	{
+		if (window.text.size() < windowSize + WindowSlack)
+			window.text.resize(windowSize + WindowSlack);
+		while (!window.eof && window.size < windowSize)
+		{
+			unsigned count = static_cast<unsigned>((std::min)(windowSize - window.size, static_cast<size_t>(INT_MAX)));
+			int cc = read(m_inf[side].desc, &window.text[window.size], count);
+			if (cc < 0)
+				return false;
+			if (cc == 0)
+				window.eof = true;
+			if (m_pDigests)
+				m_pDigests[side].Update(&window.text[window.size], cc);
+			window.size += cc;
+		}
+		window.complete = window.eof ? window.size : EndOfLastLine(&window.text[0], window.size);
+		if (window.complete > 0 || window.eof)
+			return true;
+		windowSize *= 2;
+	}
+}
+
+/**
+ * @brief Find complete lines of the window of a file.
+ * @param [in] side Index of the file.
+ * @param [out] lines Offsets of the lines in the window.
+ * @return Number of lines found.
+ */
+size_t StreamDiff::FindLines(int side, std::vector<size_t> & lines) const
+{
+	const Window & window = m_window[side];
+	const char *text = window.text.empty() ? NULL : &window.text[0];
+	lines.clear();
+	size_t pos = 0;
+	while (pos < window.complete)
+	{
+		lines.push_back(pos);
+		while (pos < window.complete && text[pos] != '\n' && text[pos] != '\r')
+			++pos;
+		if (pos < window.complete && text[pos] == '\r' &&
+				pos + 1 < window.complete && text[pos + 1] == '\n')
+			++pos;
+		++pos;
+	}
+	return lines.size();
+}
+
+/**
+ * @brief Find the line to cut the windows after.
+ * Candidates are lines occurring once in both windows. The one leaving the
+ * least text of either window to the next round is chosen.
+ * @param [in] lines Offsets of the lines in both windows.
+ * @param [out] anchor0 Index of the line in the first window.
+ * @param [out] anchor1 Index of the line in the second window.
+ * @return true if an anchor was found.
+ */
+bool StreamDiff::FindAnchor(const std::vector<size_t> lines[2], size_t & anchor0, size_t & anchor1) const
+{
+	std::vector<LineKey> unique[2];
+	for (int i = 0; i < 2; ++i)
+	{
+		const Window & window = m_window[i];
+		std::vector<LineKey> keys(lines[i].size());
+		for (size_t j = 0; j < lines[i].size(); ++j)
+		{
+			size_t end = j + 1 < lines[i].size() ? lines[i][j + 1] : window.complete;
+			const char *line = &window.text[lines[i][j]];
+			keys[j].hash = HashLine(line, LineLength(line, end - lines[i][j]));
+			keys[j].index = j;
+		}
+		std::sort(keys.begin(), keys.end());
+		for (size_t j = 0; j < keys.size(); )
+		{
+			size_t k = j + 1;
+			while (k < keys.size() && keys[k].hash == keys[j].hash)
+				++k;
+			if (k == j + 1)
+				unique[i].push_back(keys[j]);
+			j = k;
+		}
+	}
+
+	bool found = false;
+	size_t best = 0;
+	std::vector<LineKey>::const_iterator it0 = unique[0].begin(), it1 = unique[1].begin();
+	while (it0 != unique[0].end() && it1 != unique[1].end())
+	{
+		if (it0->hash < it1->hash)
+			++it0;
+		else if (it1->hash < it0->hash)
+			++it1;
+		else
+		{
+			size_t index[2] = { it0->index, it1->index };
+			size_t len[2];
+			const char *line[2];
+			for (int i = 0; i < 2; ++i)
+			{
+				size_t end = index[i] + 1 < lines[i].size() ? lines[i][index[i] + 1] : m_window[i].complete;
+				line[i] = &m_window[i].text[lines[i][index[i]]];
+				len[i] = LineLength(line[i], end - lines[i][index[i]]);
+			}
+			size_t score = (std::min)(index[0], index[1]) + 1;
+			if (len[0] == len[1] && memcmp(line[0], line[1], len[0]) == 0 &&
+				(!found || score > best))
+			{
+				found = true;
+				best = score;
+				anchor0 = index[0];
+				anchor1 = index[1];
+			}
+			++it0;
+			++it1;
+		}
+	}
+	return found;
+}
+
+/**
+ * @brief Diff the text of both windows before the cuts.
+ * A diff starting the windows is joined with the last diff of previous
+ * windows if that ended at the cut, as diffutils would have found one diff
+ * there diffing the files whole.
+ * @param [in] cut Bytes of text to diff in each window.
+ * @param [in] cutLines Lines of text to diff in each window.
+ * @param [in] bLast Is the rest of both files diffed?
+ * @param [out] pDiffList Differences are added here, if not NULL.
+ * @return DIFFCODE as a result of compare.
+ */
+int StreamDiff::DiffWindows(const size_t cut[2], const int cutLines[2], bool bLast, DiffList *pDiffList)
+{
+	// Diffutils puts a newline and sentinel after the text,
+	// keep what is there for the next window.
+	char saved[2][WindowSlack];
+	file_data inf[2];
+	memset(inf, 0, sizeof(inf));
+	int i;
+	for (i = 0; i < 2; ++i)
+	{
+		Window & window = m_window[i];
+		memcpy(saved[i], &window.text[cut[i]], WindowSlack);
+		inf[i].desc = m_inf[i].desc;
+		inf[i].name = m_inf[i].name;
+		inf[i].stat = m_inf[i].stat;
+		inf[i].buffer = &window.text[0];
+		inf[i].bufsize = cut[i] + WindowSlack;
+		inf[i].buffered_chars = cut[i];
+		inf[i].preloaded = 1;
+	}
+
+	DiffList diffList;
+	m_diffUtils.SetDiffList(&diffList);
+	m_diffUtils.SetFileData(2, inf);
+	int code = m_diffUtils.diffutils_compare_files();
+
+	int ndiffs = 0, ntrivialdiffs = 0;
+	m_diffUtils.GetDiffCounts(ndiffs, ntrivialdiffs);
+	const int nDiffs = diffList.GetSize();
+	int nFirst = 0;
+	bool bLastTrivial = false;
+	const DIFFRANGE *pFirst = nDiffs > 0 ? diffList.DiffRangeAt(0) : NULL;
+	if (m_bDiffAtCut && pFirst && pFirst->begin[0] == 0 && pFirst->begin[1] == 0)
+	{
+		// Count the joined diff once, and as real unless both halves are ignored
+		const bool bTrivial = pFirst->op == OP_TRIVIAL;
+		if (bTrivial || m_bTrivialAtCut)
+			--ntrivialdiffs;
+		else
+			--ndiffs;
+		if (pDiffList)
+		{
+			DIFFRANGE dr;
+			const int nLast = pDiffList->GetSize() - 1;
+			pDiffList->GetDiff(nLast, dr);
+			for (i = 0; i < 2; ++i)
+				dr.end[i] = m_window[i].line + pFirst->end[i];
+			dr.op = bTrivial && m_bTrivialAtCut ? OP_TRIVIAL : OP_DIFF;
+			pDiffList->SetDiff(nLast, dr);
+		}
+		bLastTrivial = bTrivial && m_bTrivialAtCut;
+		nFirst = 1;
+	}
+	m_ndiffs += ndiffs;
+	m_ntrivialdiffs += ntrivialdiffs;
+	for (int nDiff = nFirst; nDiff < nDiffs; ++nDiff)
+	{
+		DIFFRANGE dr = *diffList.DiffRangeAt(nDiff);
+		for (i = 0; i < 2; ++i)
+		{
+			dr.begin[i] += m_window[i].line;
+			dr.end[i] += m_window[i].line;
+		}
+		if (pDiffList)
+			pDiffList->AddDiff(dr);
+		bLastTrivial = dr.op == OP_TRIVIAL;
+	}
+	const DIFFRANGE *pLast = nDiffs > 0 ? diffList.DiffRangeAt(nDiffs - 1) : NULL;
+	m_bDiffAtCut = !bLast && pLast &&
+		pLast->end[0] + 1 == cutLines[0] && pLast->end[1] + 1 == cutLines[1];
+	m_bTrivialAtCut = bLastTrivial;
+	for (i = 0; i < 2; ++i)
+	{
+		FileTextStats stats;
+		m_diffUtils.GetTextStats(i, &stats);
+		m_textStats[i].ncrs += stats.ncrs;
+		m_textStats[i].nlfs += stats.nlfs;
+		m_textStats[i].ncrlfs += stats.ncrlfs;
+	}
+
+	// The buffers belong to the windows
+	for (i = 0; i < 2; ++i)
+	{
+		inf[i].buffer = NULL;
+		memcpy(&m_window[i].text[cut[i]], saved[i], WindowSlack);
+	}
+	cleanup_file_buffers(inf);
+	m_diffUtils.SetDiffList(NULL);
+	m_diffUtils.SetFileData(2, m_inf);
+	return code;
+}
+
+/**
+ * @brief Return diff counts for last compare.
+ * @param [out] diffs Count of real differences.
+ * @param [out] trivialDiffs Count of ignored differences.
+ */
+void StreamDiff::GetDiffCounts(int & diffs, int & trivialDiffs) const
+{
+	diffs = m_ndiffs;
+	trivialDiffs = m_ntrivialdiffs;
+}
+
+/**
+ * @brief Return text statistics for last compare.
+ * @param [in] side For which file to return statistics.
+ * @param [out] stats Stats as asked.
+ */
+void StreamDiff::GetTextStats(int side, FileTextStats *stats) const
+{
+	*stats = m_textStats[side];
+}
+
+} // namespace CompareEngines
@@ -0,0 +1,83 @@
+/**
+ * @file  StreamDiff.h
+ *
+ * @brief Declaration of StreamDiff class.
+ */
+#pragma once
+
+#include <vector>
+#include "DiffUtils.h"
+#include "FileTextStats.h"
+
+class CompareOptions;
+class FilterList;
+class FilterCommentsManager;
+class IAbortable;
+class DiffList;
+class ContentDigest;
+struct file_data;
+
+namespace CompareEngines
+{
+
+/**
+ * @brief Diffs files too big for diffutils in windows of bounded size.
+ *
+ * Both files are read a window at a time. Each pair of windows is cut after
+ * a line that occurs once in both windows (an anchor), and the text before
+ * the cut is diffed with diffutils while the rest is carried to the next
+ * window. Differences of all windows are stitched together, so the memory
+ * used depends on the window size and not on the file sizes.
+ *
+ * When the windows have no common unique line, all complete lines are
+ * diffed. A difference reaching such a cut is joined with a difference
+ * starting the next window, so it is counted once.
+ */
+class StreamDiff
+{
+public:
+	StreamDiff();
+	~StreamDiff();
+	bool SetCompareOptions(const CompareOptions & options);
+	void SetFilterList(FilterList * list);
+	void SetFilterCommentsManager(const FilterCommentsManager *pFilterCommentsManager);
+	void ClearFilterList();
+	void SetCodepage(int codepage) { m_diffUtils.SetCodepage(codepage); }
+	void SetAbortable(const IAbortable * piAbortable);
+	void SetMemoryLimit(size_t memoryLimit);
+	void SetFileData(int items, file_data *data);
+	void SetDigests(ContentDigest *digests);
+	int CompareFiles(DiffList *pDiffList = NULL);
+	void GetDiffCounts(int & diffs, int & trivialDiffs) const;
+	void GetTextStats(int side, FileTextStats *stats) const;
+
+private:
+	/** @brief Text of one file not diffed yet. */
+	struct Window
+	{
+		std::vector<char> text; /**< Text read, with room for diffutils' sentinels. */
+		size_t size; /**< Bytes of text in the window. */
+		size_t complete; /**< Bytes of complete lines in the window. */
+		int line; /**< Number of lines before the window. */
+		bool eof; /**< Is the rest of the file in the window? */
+	};
+
+	bool ReadWindow(int side);
+	size_t FindLines(int side, std::vector<size_t> & lines) const;
+	bool FindAnchor(const std::vector<size_t> lines[2], size_t & anchor0, size_t & anchor1) const;
+	int DiffWindows(const size_t cut[2], const int cutLines[2], bool bLast, DiffList *pDiffList);
+
+	DiffUtils m_diffUtils; /**< Diffs the windows. */
+	IAbortable * m_piAbortable;
+	file_data * m_inf; /**< Compared files data (for diffutils). */
+	ContentDigest * m_pDigests; /**< Digests fed with the files read, or NULL. */
+	size_t m_windowSize; /**< Bytes read from a file at a time. */
+	Window m_window[2];
+	int m_ndiffs; /**< Real diffs found. */
+	int m_ntrivialdiffs; /**< Ignored diffs found. */
+	bool m_bDiffAtCut; /**< Does the last diff of previous windows end at the cut? */
+	bool m_bTrivialAtCut; /**< Is that diff ignored? */
+	FileTextStats m_textStats[2];
+};
+
+} // namespace CompareEngines
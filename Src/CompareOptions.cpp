@@ -47,6 +47,7 @@ DiffutilsOptions::DiffutilsOptions(const DiffutilsOptions& options)
 	m_ignoreWhitespace = options.m_ignoreWhitespace;
 	m_outputStyle = options.m_outputStyle;
 	m_bIgnoreEOLDifference = options.m_bIgnoreEOLDifference;
+	m_diffAlgorithm = options.m_diffAlgorithm;
 }
 
 /**
@@ -91,6 +92,7 @@ DiffutilsOptions::DiffutilsOptions()
 : m_outputStyle(DIFF_OUTPUT_NORMAL)
 , m_contextLines(0)
 , m_filterCommentsLines(false)
+, m_diffAlgorithm(DIFF_ALGORITHM_DEFAULT)
 {
 }
 
@@ -103,6 +105,7 @@ DiffutilsOptions::DiffutilsOptions(const CompareOptions& options)
 , m_outputStyle(DIFF_OUTPUT_NORMAL)
 , m_contextLines(0)
 , m_filterCommentsLines(false)
+, m_diffAlgorithm(DIFF_ALGORITHM_DEFAULT)
 {
 }
 
@@ -114,6 +117,18 @@ void DiffutilsOptions::SetFromDiffOptions(const DIFFOPTIONS & options)
 {
 	CompareOptions::SetFromDiffOptions(options);
 	m_filterCommentsLines = options.bFilterCommentsLines;
+	switch (options.nDiffAlgorithm)
+	{
+	case 0:
+		m_diffAlgorithm = DIFF_ALGORITHM_DEFAULT;
+		break;
+	case 1:
+		m_diffAlgorithm = DIFF_ALGORITHM_HISTOGRAM;
+		break;
+	default:
+		throw "Unknown diff algorithm value!";
+		break;
+	}
 }
 
 /**
@@ -182,6 +197,11 @@ void DiffutilsOptions::SetToDiffUtils()
 	else
 		length_varies = 0;
 
+	if (m_diffAlgorithm == DIFF_ALGORITHM_HISTOGRAM)
+		diff_algorithm = ALGORITHM_HISTOGRAM;
+	else
+		diff_algorithm = ALGORITHM_MYERS;
+
 	// We have no interest changing these values, hard-code them.
 	always_text_flag = 0; // diffutils needs to detect binary files
 	horizon_lines = 0;
@@ -199,6 +219,7 @@ void DiffutilsOptions::GetAsDiffOptions(DIFFOPTIONS &options) const
 	options.bIgnoreBlankLines = m_bIgnoreBlankLines;
 	options.bIgnoreCase = m_bIgnoreCase;
 	options.bIgnoreEol = m_bIgnoreEOLDifference;
+	options.nDiffAlgorithm = m_diffAlgorithm;
 	
 	switch (m_ignoreWhitespace)
 	{
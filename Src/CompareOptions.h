@@ -60,6 +60,20 @@ enum DiffOutputType
 #endif
 };
 
+/**
+ * @brief Algorithms for finding differing lines.
+ *
+ * Myers' algorithm finds a minimal (or nearly minimal) set of differences.
+ * Histogram diff aligns files on lines that occur rarely in them, which
+ * is faster and gives more natural results for files with many repeated
+ * lines, like generated files.
+ */
+enum DiffAlgorithm
+{
+	DIFF_ALGORITHM_DEFAULT = 0, /**< Myers' algorithm */
+	DIFF_ALGORITHM_HISTOGRAM,   /**< Histogram diff */
+};
+
 /**
  * @brief Diffutils options.
  */
@@ -70,6 +84,7 @@ struct DIFFOPTIONS
 	bool bIgnoreBlankLines; /**< Ignore blank lines -option. */
 	bool bIgnoreEol; /**< Ignore EOL differences -option. */
 	bool bFilterCommentsLines; /**< Ignore Multiline comments differences -option. */
+	int nDiffAlgorithm; /**< Diff algorithm -option. */
 };
 
 /**
@@ -109,6 +124,7 @@ public:
 	enum DiffOutputType m_outputStyle; /**< Output style (for patch files) */
 	int m_contextLines; /**< Number of context lines (for patch files) */
 	bool m_filterCommentsLines;/**< Ignore Multiline comments differences.*/
+	enum DiffAlgorithm m_diffAlgorithm; /**< Algorithm finding differing lines */
 };
 
 /**
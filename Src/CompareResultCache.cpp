@@ -0,0 +1,494 @@
+/**
+ * @file  CompareResultCache.cpp
+ *
+ * @brief Implementation file for CompareResultCache
+ */
+
+#include "CompareResultCache.h"
+#include <cstring>
+#include <vector>
+#include <algorithm>
+#include <Poco/FileStream.h>
+#include <Poco/BinaryReader.h>
+#include <Poco/BinaryWriter.h>
+#include <Poco/ScopedLock.h>
+#include <Poco/Exception.h>
+#include <windows.h>
+#include "DiffContext.h"
+#include "DiffItem.h"
+#include "PathContext.h"
+#include "CompareOptions.h"
+#include "FilterList.h"
+#include "FilterCommentsManager.h"
+#include "DiffWrapper.h"
+#include "TFile.h"
+#include "paths.h"
+#include "unicoder.h"
+
+using Poco::FastMutex;
+using Poco::Int64;
+using Poco::UInt64;
+using Poco::UInt32;
+
+namespace
+{
+
+const UInt32 CacheFileMagic = 0x43434d57; /**< "WMCC" */
+const UInt32 CacheFileVersion = 3;
+const size_t MaxEntriesDefault = 100000; /**< Default limit of entries saved */
+
+/** @brief FNV-1a hash, used for hashing compare options. */
+void HashBytes(uint64_t &hash, const void *data, size_t len)
+{
+	const unsigned char *p = static_cast<const unsigned char *>(data);
+	for (size_t i = 0; i < len; ++i)
+	{
+		hash ^= p[i];
+		hash *= 0x100000001b3ULL;
+	}
+}
+
+template<class T>
+void HashValue(uint64_t &hash, const T &value)
+{
+	HashBytes(hash, &value, sizeof(value));
+}
+
+}
+
+/**
+ * @brief Constructor.
+ * @param [in] sCacheFile Path to file where cache is stored.
+ */
+CompareResultCache::CompareResultCache(const String& sCacheFile)
+: m_sCacheFile(sCacheFile)
+, m_bModified(false)
+, m_nVerifyRate(0)
+, m_nMaxEntries(MaxEntriesDefault)
+, m_nUseCount(0)
+{
+}
+
+CompareResultCache::~CompareResultCache()
+{
+}
+
+/**
+ * @brief Load cache entries from cache file.
+ * A missing, truncated or old version cache file leaves the cache empty.
+ * @return true if cache file was loaded.
+ */
+bool CompareResultCache::Load()
+{
+	FastMutex::ScopedLock lock(m_mutex);
+	m_entries.clear();
+	m_bModified = false;
+	m_nUseCount = 0;
+	try
+	{
+		if (!TFile(m_sCacheFile).exists())
+			return false;
+		Poco::FileInputStream in(ucr::toUTF8(m_sCacheFile));
+		Poco::BinaryReader reader(in, Poco::BinaryReader::LITTLE_ENDIAN_BYTE_ORDER);
+		UInt32 magic = 0, version = 0, count = 0;
+		UInt64 useCount = 0;
+		reader >> magic >> version >> count >> useCount;
+		if (!reader.good() || magic != CacheFileMagic || version != CacheFileVersion)
+			return false;
+		m_nUseCount = useCount;
+		for (UInt32 i = 0; i < count && reader.good(); ++i)
+		{
+			std::string key;
+			Entry entry;
+			UInt64 optionsHash, lastUse;
+			reader >> key >> optionsHash >> lastUse;
+			entry.optionsHash = optionsHash;
+			entry.lastUse = lastUse;
+			for (int nIndex = 0; nIndex < 2; ++nIndex)
+			{
+				FileState &state = entry.file[nIndex];
+				Int64 size, mtime;
+				UInt64 fileId;
+				reader >> size >> mtime >> fileId;
+				state.size = size;
+				state.mtime = mtime;
+				state.fileId = fileId;
+			}
+			Result &result = entry.result;
+			Int64 nFirstDiffOffset;
+			reader >> result.code >> result.ndiffs >> result.ntrivialdiffs >> nFirstDiffOffset;
+			result.nFirstDiffOffset = nFirstDiffOffset;
+			for (int nIndex = 0; nIndex < 2; ++nIndex)
+			{
+				FileTextStats &stats = result.textStats[nIndex];
+				FileTextEncoding &encoding = result.encoding[nIndex];
+				char unicoding;
+				reader >> stats.ncrs >> stats.nlfs >> stats.ncrlfs >> stats.nzeros;
+				reader >> encoding.m_codepage >> unicoding >> encoding.m_bom;
+				reader >> result.digest[nIndex];
+				encoding.m_unicoding = static_cast<ucr::UNICODESET>(unicoding);
+			}
+			if (reader.good())
+				m_entries[ucr::toTString(key)] = entry;
+		}
+	}
+	catch (Poco::Exception&)
+	{
+		m_entries.clear();
+		return false;
+	}
+	return true;
+}
+
+/**
+ * @brief Save cache entries to cache file.
+ * Least recently used entries over the entry limit are dropped first.
+ * Nothing is written if the cache has not changed since loading.
+ * @return true if cache file is up to date.
+ */
+bool CompareResultCache::Save()
+{
+	FastMutex::ScopedLock lock(m_mutex);
+	Evict();
+	if (!m_bModified)
+		return true;
+	try
+	{
+		paths_CreateIfNeeded(paths_GetParentPath(m_sCacheFile));
+		Poco::FileOutputStream out(ucr::toUTF8(m_sCacheFile));
+		Poco::BinaryWriter writer(out, Poco::BinaryWriter::LITTLE_ENDIAN_BYTE_ORDER);
+		writer << CacheFileMagic << CacheFileVersion << static_cast<UInt32>(m_entries.size())
+			<< static_cast<UInt64>(m_nUseCount);
+		for (EntryMap::const_iterator it = m_entries.begin(); it != m_entries.end(); ++it)
+		{
+			const Entry &entry = it->second;
+			writer << ucr::toUTF8(it->first) << static_cast<UInt64>(entry.optionsHash)
+				<< static_cast<UInt64>(entry.lastUse);
+			for (int nIndex = 0; nIndex < 2; ++nIndex)
+			{
+				const FileState &state = entry.file[nIndex];
+				writer << static_cast<Int64>(state.size) << static_cast<Int64>(state.mtime)
+					<< static_cast<UInt64>(state.fileId);
+			}
+			const Result &result = entry.result;
+			writer << result.code << result.ndiffs << result.ntrivialdiffs
+				<< static_cast<Int64>(result.nFirstDiffOffset);
+			for (int nIndex = 0; nIndex < 2; ++nIndex)
+			{
+				const FileTextStats &stats = result.textStats[nIndex];
+				const FileTextEncoding &encoding = result.encoding[nIndex];
+				writer << stats.ncrs << stats.nlfs << stats.ncrlfs << stats.nzeros;
+				writer << encoding.m_codepage << static_cast<char>(encoding.m_unicoding) << encoding.m_bom;
+				writer << result.digest[nIndex];
+			}
+		}
+		writer.flush();
+		if (!writer.good())
+			return false;
+	}
+	catch (Poco::Exception&)
+	{
+		return false;
+	}
+	m_bModified = false;
+	return true;
+}
+
+/**
+ * @brief Remove all entries from the cache.
+ */
+void CompareResultCache::Clear()
+{
+	FastMutex::ScopedLock lock(m_mutex);
+	m_bModified = !m_entries.empty();
+	m_entries.clear();
+}
+
+/**
+ * @brief Get number of entries in the cache.
+ */
+size_t CompareResultCache::GetEntryCount() const
+{
+	FastMutex::ScopedLock lock(m_mutex);
+	return m_entries.size();
+}
+
+/**
+ * @brief Drop least recently used entries over the entry limit.
+ * Called with m_mutex locked.
+ */
+void CompareResultCache::Evict()
+{
+	if (m_entries.size() <= m_nMaxEntries)
+		return;
+	std::vector<uint64_t> uses;
+	uses.reserve(m_entries.size());
+	for (EntryMap::const_iterator it = m_entries.begin(); it != m_entries.end(); ++it)
+		uses.push_back(it->second.lastUse);
+	const size_t nEvict = m_entries.size() - m_nMaxEntries;
+	std::nth_element(uses.begin(), uses.begin() + (nEvict - 1), uses.end());
+	const uint64_t lastEvicted = uses[nEvict - 1];
+	for (EntryMap::iterator it = m_entries.begin(); it != m_entries.end();)
+	{
+		if (it->second.lastUse <= lastEvicted)
+			it = m_entries.erase(it);
+		else
+			++it;
+	}
+	m_bModified = true;
+}
+
+/**
+ * @brief Check if result of compared item can be cached.
+ * Only file pairs existing in both sides of a two-way content compare are
+ * cached. Unique files are compared only to detect encoding and results of
+ * plugins depend on more than file content.
+ * @param [in] pCtxt Compare context.
+ * @param [in] di Item to compare.
+ * @return true if result can be cached.
+ */
+bool CompareResultCache::IsCacheable(const CDiffContext * pCtxt, const DIFFITEM &di)
+{
+	int nCompMethod = pCtxt->GetCompareMethod();
+	if (nCompMethod != CMP_CONTENT && nCompMethod != CMP_QUICK_CONTENT &&
+		nCompMethod != CMP_BINARY_CONTENT)
+		return false;
+	return pCtxt->GetCompareDirs() == 2 && di.diffcode.isSideBoth() &&
+		!pCtxt->m_bPluginsEnabled;
+}
+
+/**
+ * @brief Calculate hash of all options affecting file compare results.
+ * Cached results are used only if the hash matches the hash stored
+ * with the result.
+ * @param [in] pCtxt Compare context with options set.
+ * @return Hash of options.
+ */
+uint64_t CompareResultCache::HashCompareOptions(CDiffContext * pCtxt)
+{
+	uint64_t hash = 0xcbf29ce484222325ULL;
+	int nCompMethod = pCtxt->GetCompareMethod();
+	HashValue(hash, nCompMethod);
+	if (nCompMethod == CMP_CONTENT || nCompMethod == CMP_QUICK_CONTENT)
+	{
+		CompareOptions *pOptions = pCtxt->GetCompareOptions(nCompMethod);
+		if (pOptions)
+		{
+			HashValue(hash, static_cast<int>(pOptions->m_ignoreWhitespace));
+			HashValue(hash, pOptions->m_bIgnoreBlankLines);
+			HashValue(hash, pOptions->m_bIgnoreCase);
+			HashValue(hash, pOptions->m_bIgnoreEOLDifference);
+			if (DiffutilsOptions *pDiffutilsOptions = dynamic_cast<DiffutilsOptions *>(pOptions))
+			{
+				HashValue(hash, pDiffutilsOptions->m_filterCommentsLines);
+				HashValue(hash, static_cast<int>(pDiffutilsOptions->m_diffAlgorithm));
+			}
+		}
+		HashValue(hash, pCtxt->m_bStopAfterFirstDiff);
+		HashValue(hash, pCtxt->m_nQuickCompareLimit);
+		HashValue(hash, pCtxt->m_nStreamingDiffMemory);
+		HashValue(hash, pCtxt->m_bIgnoreCodepage);
+		HashValue(hash, pCtxt->m_iGuessEncodingType);
+		// Files without a detected encoding are read in the default codepage
+		HashValue(hash, ucr::getDefaultCodepage());
+		if (pCtxt->m_pFilterList)
+		{
+			std::string filters = pCtxt->m_pFilterList->GetAsString();
+			HashBytes(hash, filters.data(), filters.size());
+		}
+		DiffutilsOptions *pDiffutilsOptions = dynamic_cast<DiffutilsOptions *>(pOptions);
+		if (pDiffutilsOptions && pDiffutilsOptions->m_filterCommentsLines &&
+			pCtxt->m_pFilterCommentsManager)
+		{
+			std::string markers = pCtxt->m_pFilterCommentsManager->GetAsString();
+			HashBytes(hash, markers.data(), markers.size());
+		}
+	}
+	return hash;
+}
+
+/**
+ * @brief Check if two compare results are the same.
+ * Used to verify a cached result against the result of a new compare.
+ * Digests are compared when both results have them.
+ */
+bool CompareResultCache::IsSameResult(const Result &result1, const Result &result2)
+{
+	if (result1.code != result2.code || result1.ndiffs != result2.ndiffs ||
+		result1.ntrivialdiffs != result2.ntrivialdiffs ||
+		result1.nFirstDiffOffset != result2.nFirstDiffOffset)
+		return false;
+	for (int nIndex = 0; nIndex < 2; ++nIndex)
+	{
+		const FileTextStats &stats1 = result1.textStats[nIndex];
+		const FileTextStats &stats2 = result2.textStats[nIndex];
+		if (stats1.ncrs != stats2.ncrs || stats1.nlfs != stats2.nlfs ||
+			stats1.ncrlfs != stats2.ncrlfs || stats1.nzeros != stats2.nzeros)
+			return false;
+		const std::string &digest1 = result1.digest[nIndex];
+		const std::string &digest2 = result2.digest[nIndex];
+		if (!digest1.empty() && !digest2.empty() && digest1 != digest2)
+			return false;
+	}
+	return true;
+}
+
+/**
+ * @brief Find cached result for file pair.
+ * The result is returned only if both files have the same size,
+ * modification time and file id as when the result was stored.
+ * Hits selected for verification are reported as not found.
+ * @param [in] files Paths of compared files.
+ * @param [in] di Item to compare.
+ * @param [in] optionsHash Hash of current compare options.
+ * @param [out] result Cached result.
+ * @param [in, out] stats Statistics of the compare.
+ * @return true if cached result was found.
+ */
+bool CompareResultCache::Lookup(const PathContext& files, const DIFFITEM &di, uint64_t optionsHash, Result &result, Stats &stats)
+{
+	String key = MakeKey(files);
+	FileState state[2];
+	for (int nIndex = 0; nIndex < 2; ++nIndex)
+	{
+		if (!GetFileState(files[nIndex], di, nIndex, state[nIndex]))
+		{
+			++stats.nMisses;
+			return false;
+		}
+	}
+
+	Result cached;
+	{
+		FastMutex::ScopedLock lock(m_mutex);
+		EntryMap::iterator it = m_entries.find(key);
+		if (it == m_entries.end() || !IsSameState(it->second, optionsHash, state))
+		{
+			++stats.nMisses;
+			return false;
+		}
+		it->second.lastUse = ++m_nUseCount;
+		m_bModified = true;
+		cached = it->second.result;
+	}
+
+	if (ShouldVerify(key, m_nVerifyRate, stats.nHits.value()))
+	{
+		// Let the caller compare the files, Store() checks the result
+		++stats.nVerified;
+		return false;
+	}
+
+	++stats.nHits;
+	result = cached;
+	return true;
+}
+
+/**
+ * @brief Store compare result of file pair.
+ * If an entry with the same options and file metadata already exists, the
+ * pair was a hit selected for verification and the cached result, with
+ * the digests of the files, is checked against the new one.
+ * @param [in] files Paths of compared files.
+ * @param [in] di Compared item.
+ * @param [in] optionsHash Hash of compare options used.
+ * @param [in] result Compare result.
+ * @param [in, out] stats Statistics of the compare.
+ */
+void CompareResultCache::Store(const PathContext& files, const DIFFITEM &di, uint64_t optionsHash, const Result &result, Stats &stats)
+{
+	Entry entry;
+	entry.optionsHash = optionsHash;
+	entry.result = result;
+	for (int nIndex = 0; nIndex < 2; ++nIndex)
+	{
+		if (!GetFileState(files[nIndex], di, nIndex, entry.file[nIndex]))
+			return;
+	}
+
+	String key = MakeKey(files);
+	FastMutex::ScopedLock lock(m_mutex);
+	EntryMap::const_iterator it = m_entries.find(key);
+	if (it != m_entries.end() && IsSameState(it->second, optionsHash, entry.file) &&
+		!IsSameResult(it->second.result, result))
+		++stats.nVerifyFailures;
+	entry.lastUse = ++m_nUseCount;
+	m_entries[key] = entry;
+	m_bModified = true;
+}
+
+/**
+ * @brief Check if entry was stored with given options and file metadata.
+ */
+bool CompareResultCache::IsSameState(const Entry &entry, uint64_t optionsHash, const FileState state[2])
+{
+	if (entry.optionsHash != optionsHash)
+		return false;
+	for (int nIndex = 0; nIndex < 2; ++nIndex)
+	{
+		if (entry.file[nIndex].size != state[nIndex].size ||
+			entry.file[nIndex].mtime != state[nIndex].mtime ||
+			entry.file[nIndex].fileId != state[nIndex].fileId)
+			return false;
+	}
+	return true;
+}
+
+/**
+ * @brief Make cache key from paths of compared files.
+ */
+String CompareResultCache::MakeKey(const PathContext& files)
+{
+	return string_makelower(files[0]) + _T("|") + string_makelower(files[1]);
+}
+
+/**
+ * @brief Get metadata of a file used to detect changes.
+ * Size and modification time are taken from the compared item, file id
+ * is read from the file system without opening the file for reading.
+ * @param [in] path Path to file.
+ * @param [in] di Compared item.
+ * @param [in] nIndex Side of the file in the item.
+ * @param [out] state File metadata.
+ * @return true if file id could be read.
+ */
+bool CompareResultCache::GetFileState(const String& path, const DIFFITEM &di, int nIndex, FileState &state)
+{
+	state.size = di.diffFileInfo[nIndex].size;
+	state.mtime = di.diffFileInfo[nIndex].mtime.epochMicroseconds();
+	state.fileId = 0;
+
+	HANDLE hFile = CreateFile(path.c_str(), FILE_READ_ATTRIBUTES,
+		FILE_SHARE_READ | FILE_SHARE_WRITE | FILE_SHARE_DELETE, NULL,
+		OPEN_EXISTING, FILE_FLAG_BACKUP_SEMANTICS, NULL);
+	if (hFile == INVALID_HANDLE_VALUE)
+		return false;
+	BY_HANDLE_FILE_INFORMATION fi;
+	bool bSucceeded = !!GetFileInformationByHandle(hFile, &fi);
+	CloseHandle(hFile);
+	if (!bSucceeded)
+		return false;
+	state.fileId = (static_cast<uint64_t>(fi.dwVolumeSerialNumber) << 48) ^
+		(static_cast<uint64_t>(fi.nFileIndexHigh) << 32) ^ fi.nFileIndexLow;
+	return true;
+}
+
+/**
+ * @brief Decide if this cache hit is verified by comparing again.
+ * Selection is spread evenly over hits by hashing the cache key
+ * together with the running hit count.
+ * @param [in] key Cache key of the hit.
+ * @param [in] nRate Percentage of hits to verify.
+ * @param [in] nHits Hits so far in this compare.
+ */
+bool CompareResultCache::ShouldVerify(const String& key, int nRate, int nHits)
+{
+	if (nRate <= 0)
+		return false;
+	if (nRate >= 100)
+		return true;
+	uint64_t hash = 0xcbf29ce484222325ULL;
+	HashBytes(hash, key.data(), key.size() * sizeof(TCHAR));
+	HashValue(hash, nHits);
+	return static_cast<int>(hash % 100) < nRate;
+}
@@ -0,0 +1,126 @@
+/**
+ * @file  CompareResultCache.h
+ *
+ * @brief Declaration file for CompareResultCache
+ */
+#pragma once
+
+#include <unordered_map>
+#include <string>
+#include <cstdint>
+#define POCO_NO_UNWINDOWS 1
+#include <Poco/Mutex.h>
+#include <Poco/AtomicCounter.h>
+#include "UnicodeString.h"
+#include "FileTextStats.h"
+#include "FileTextEncoding.h"
+
+class CDiffContext;
+class PathContext;
+struct DIFFITEM;
+
+/**
+ * @brief Persistent cache of file compare results for folder compare.
+ *
+ * Results of compared file pairs are stored together with the metadata
+ * (size, modification time and file id) of both files. When a pair is
+ * compared again with the same compare options and neither file has changed
+ * since, the stored result is returned without opening the files. The cache
+ * is saved to disk so it is kept between sessions.
+ *
+ * Optionally a percentage of cache hits can be verified. A verified hit is
+ * not returned from Lookup() so the files are compared normally, and
+ * Store() then checks the new result against the cached one. Results carry
+ * a digest of each file's content, taken while the compare reads the file,
+ * so a file changed without changing its metadata is found even if the
+ * compare result stays the same. Files are read only once, by the compare
+ * itself.
+ *
+ * The least recently used entries are dropped when the cache is saved with
+ * more entries than its limit.
+ */
+class CompareResultCache
+{
+public:
+	/** @brief Compare result stored for a file pair. */
+	struct Result
+	{
+		unsigned code; /**< DIFFCODE from the compare */
+		int ndiffs; /**< Amount of non-ignored differences */
+		int ntrivialdiffs; /**< Amount of ignored differences */
+		FileTextStats textStats[2]; /**< EOL, zero-byte etc counts */
+		FileTextEncoding encoding[2]; /**< Detected encodings */
+		int64_t nFirstDiffOffset; /**< Offset of first differing byte, -1 if not known */
+		std::string digest[2]; /**< SHA-1 of file contents, empty if not read whole */
+		Result() : code(0), ndiffs(-1), ntrivialdiffs(-1), nFirstDiffOffset(-1) { }
+	};
+
+	/** @brief Cache statistics of one folder compare. */
+	struct Stats
+	{
+		Poco::AtomicCounter nHits;
+		Poco::AtomicCounter nMisses;
+		Poco::AtomicCounter nVerified; /**< Hits compared again */
+		Poco::AtomicCounter nVerifyFailures; /**< Verified hits with another result */
+		void Reset() { nHits = 0; nMisses = 0; nVerified = 0; nVerifyFailures = 0; }
+	};
+
+	explicit CompareResultCache(const String& sCacheFile);
+	~CompareResultCache();
+
+	bool Load();
+	bool Save();
+	void Clear();
+
+	/**
+	 * @brief Set the percentage of cache hits verified by comparing again.
+	 * @param [in] nPercent 0 disables verification, 100 verifies every hit.
+	 */
+	void SetVerifyRate(int nPercent) { m_nVerifyRate = nPercent; }
+	int GetVerifyRate() const { return m_nVerifyRate; }
+
+	/** @brief Set the number of entries kept when the cache is saved. */
+	void SetMaxEntries(size_t nMaxEntries) { m_nMaxEntries = nMaxEntries; }
+	size_t GetMaxEntries() const { return m_nMaxEntries; }
+	size_t GetEntryCount() const;
+
+	static bool IsCacheable(const CDiffContext * pCtxt, const DIFFITEM &di);
+	static uint64_t HashCompareOptions(CDiffContext * pCtxt);
+	static bool IsSameResult(const Result &result1, const Result &result2);
+
+	bool Lookup(const PathContext& files, const DIFFITEM &di, uint64_t optionsHash, Result &result, Stats &stats);
+	void Store(const PathContext& files, const DIFFITEM &di, uint64_t optionsHash, const Result &result, Stats &stats);
+
+private:
+	/** @brief Identity of one compared file. */
+	struct FileState
+	{
+		int64_t size; /**< File size in bytes */
+		int64_t mtime; /**< Modification time in microseconds */
+		uint64_t fileId; /**< Volume and file index, 0 if unknown */
+	};
+
+	struct Entry
+	{
+		uint64_t optionsHash; /**< Hash of compare options used */
+		FileState file[2]; /**< Left and right file */
+		Result result; /**< Compare result */
+		uint64_t lastUse; /**< Value of use counter when entry was last used */
+	};
+
+	typedef std::unordered_map<String, Entry> EntryMap;
+
+	static String MakeKey(const PathContext& files);
+	static bool GetFileState(const String& path, const DIFFITEM &di, int nIndex, FileState &state);
+	static bool IsSameState(const Entry &entry, uint64_t optionsHash, const FileState state[2]);
+	static bool ShouldVerify(const String& key, int nRate, int nHits);
+	void Evict();
+
+	String m_sCacheFile; /**< Path to cache file */
+	EntryMap m_entries;
+	bool m_bModified; /**< Are there unsaved changes? */
+	int m_nVerifyRate; /**< Percentage of hits to verify */
+	size_t m_nMaxEntries; /**< Entries kept when saving */
+	uint64_t m_nUseCount; /**< Counts lookups and stores, orders entries by use */
+	mutable Poco::FastMutex m_mutex; /**< Protects m_entries and m_nUseCount */
+};
@@ -0,0 +1,61 @@
+/**
+ * @file  ContentDigest.h
+ *
+ * @brief Declaration file for ContentDigest
+ */
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <climits>
+#include <string>
+#define POCO_NO_UNWINDOWS 1
+#include <Poco/SHA1Engine.h>
+
+/**
+ * @brief SHA-1 digest of a file's content, fed by a compare reading the file.
+ * Compare engines feed the bytes they read, in file order and each byte
+ * once. Engines stopping at the first difference leave the digest partial,
+ * so the digest is known only if as many bytes as the file has were fed.
+ */
+class ContentDigest
+{
+public:
+	ContentDigest() : m_nBytes(0) { }
+
+	void Reset()
+	{
+		m_engine.reset();
+		m_nBytes = 0;
+	}
+
+	void Update(const void *data, size_t len)
+	{
+		m_nBytes += len;
+		const char *p = static_cast<const char *>(data);
+		for (; len > UINT_MAX; len -= UINT_MAX, p += UINT_MAX)
+			m_engine.update(p, UINT_MAX);
+		m_engine.update(p, static_cast<unsigned>(len));
+	}
+
+	/**
+	 * @brief Get digest of the whole file, and start over.
+	 * @param [in] nFileSize Size of the file.
+	 * @return Digest bytes, empty if not all of the file was fed.
+	 */
+	std::string GetDigest(int64_t nFileSize)
+	{
+		std::string digest;
+		if (static_cast<int64_t>(m_nBytes) == nFileSize)
+		{
+			const Poco::DigestEngine::Digest &bytes = m_engine.digest();
+			digest.assign(bytes.begin(), bytes.end());
+		}
+		Reset();
+		return digest;
+	}
+
+private:
+	Poco::SHA1Engine m_engine;
+	uint64_t m_nBytes; /**< Bytes fed so far */
+};
@@ -0,0 +1,137 @@
+/////////////////////////////////////////////////////////////////////////////
+//    License (GPLv2+):
+//    This program is free software; you can redistribute it and/or modify
+//    it under the terms of the GNU General Public License as published by
+//    the Free Software Foundation; either version 2 of the License, or (at
+//    your option) any later version.
+//
+//    This program is distributed in the hope that it will be useful, but
+//    WITHOUT ANY WARRANTY; without even the implied warranty of
+//    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+//    GNU General Public License for more details.
+//
+//    You should have received a copy of the GNU General Public License
+//    along with this program; if not, write to the Free Software
+//    Foundation, Inc., 675 Mass Ave, Cambridge, MA 02139, USA.
+/////////////////////////////////////////////////////////////////////////////
+/**
+ * @file  Diff3Pairs.cpp
+ *
+ * @brief Diffing both pairs of files of a 3-way compare at the same time.
+ */
+
+#include "Diff3Pairs.h"
+#include <Poco/Thread.h>
+#include <Poco/Runnable.h>
+#include <Poco/Exception.h>
+#include "diff.h"
+#include "CompareOptions.h"
+#include "Exceptions.h"
+
+namespace
+{
+
+/**
+ * @brief Diff one pair of files, trapping diffutils errors.
+ * @return true when compare succeeds, false if error happened during compare.
+ */
+bool DiffPair(file_data *inf, bool bMovedBlocks, struct change **script, int *bin_status)
+{
+	bool bRet = true;
+	SE_Handler seh;
+	try
+	{
+		*script = diff_2_files(inf, 0, bin_status, bMovedBlocks, NULL);
+	}
+	catch (SE_Exception&)
+	{
+		*script = NULL;
+		bRet = false;
+	}
+	// The other pair must not wait for lines this one will never share
+	publish_shared_lines(inf[0].shared);
+	return bRet;
+}
+
+/** @brief Diffs the second pair of files in a thread of its own. */
+class PairDiffer : public Poco::Runnable
+{
+public:
+	PairDiffer(const DiffutilsOptions & options, bool bMovedBlocks, file_data *inf)
+		: m_options(options), m_bMovedBlocks(bMovedBlocks), m_inf(inf)
+		, m_script(NULL), m_bin_status(0), m_bSuccess(false)
+	{
+	}
+
+	virtual void run()
+	{
+		// Diffutils options are thread local
+		m_options.SetToDiffUtils();
+		m_bSuccess = DiffPair(m_inf, m_bMovedBlocks, &m_script, &m_bin_status);
+	}
+
+	DiffutilsOptions m_options;
+	bool m_bMovedBlocks;
+	file_data *m_inf;
+	struct change *m_script; /**< Differences found. */
+	int m_bin_status; /**< Binary status, see diff_2_files(). */
+	bool m_bSuccess; /**< Did diffutils succeed? */
+};
+
+}
+
+/**
+ * @brief Diff the middle file with the left and the right file at once.
+ *
+ * The middle-to-left pair is diffed in the calling thread and the
+ * middle-to-right pair in a thread of its own. The lines of the middle file
+ * are found, hashed and put in classes of equal lines once for both pairs
+ * (see struct shared_lines). Both pairs must have their own copy of the
+ * middle file: diffutils writes sentinels to the text.
+ * @param [in] options Compare options, set to diffutils in the calling thread.
+ * @param [in] bMovedBlocks Are moved blocks analyzed?
+ * @param [in] inf10 Middle and left file (for diffutils).
+ * @param [in] inf12 Middle and right file (for diffutils).
+ * @param [out] script10 Differences of the middle and the left file.
+ * @param [out] script12 Differences of the middle and the right file.
+ * @param [out] bin_status10 Binary status of the middle and the left file.
+ * @param [out] bin_status12 Binary status of the middle and the right file.
+ * @return true when both compares succeed, false if error happened.
+ */
+bool Diff3Pairs(const DiffutilsOptions & options, bool bMovedBlocks,
+	file_data *inf10, file_data *inf12,
+	struct change **script10, struct change **script12,
+	int *bin_status10, int *bin_status12)
+{
+	struct shared_lines shared;
+	init_shared_lines(&shared);
+	inf10[0].shared = &shared;
+	inf12[0].shared = &shared;
+
+	PairDiffer differ(options, bMovedBlocks, inf12);
+	Poco::Thread thread;
+	bool bThreaded = true;
+	try
+	{
+		thread.start(differ);
+	}
+	catch (Poco::SystemException&)
+	{
+		// Could not start a thread, diff the pairs one after the other
+		bThreaded = false;
+	}
+
+	bool bRet = DiffPair(inf10, bMovedBlocks, script10, bin_status10);
+	if (bThreaded)
+		thread.join();
+	else
+		differ.run();
+
+	inf10[0].shared = NULL;
+	inf12[0].shared = NULL;
+	free_shared_lines(&shared);
+
+	*script12 = differ.m_script;
+	*bin_status12 = differ.m_bin_status;
+	return bRet && differ.m_bSuccess;
+}
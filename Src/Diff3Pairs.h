@@ -0,0 +1,15 @@
+/**
+ * @file  Diff3Pairs.h
+ *
+ * @brief Declaration of Diff3Pairs().
+ */
+#pragma once
+
+class DiffutilsOptions;
+struct file_data;
+struct change;
+
+bool Diff3Pairs(const DiffutilsOptions & options, bool bMovedBlocks,
+	file_data *inf10, file_data *inf12,
+	struct change **script10, struct change **script12,
+	int *bin_status10, int *bin_status12);
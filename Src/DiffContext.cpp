@@ -27,6 +27,7 @@
 #include "DiffContext.h"
 #include <Poco/ScopedLock.h>
 #include <cstring>
+#include <cassert>
 #include <algorithm>
 #include "CompareOptions.h"
 #include "version.h"
@@ -64,12 +65,23 @@ CDiffContext::CDiffContext(const PathContext & paths, int compareMethod)
 , m_pOptions(nullptr)
 , m_bPluginsEnabled(false)
 , m_bRecursive(false)
+, m_bPipelinedCollect(false)
+, m_nCpuCompareThreads(0)
+, m_nIoCompareThreads(0)
+, m_nMaxLocalVolumeReads(0)
+, m_nMaxRemoteVolumeReads(4)
+, m_nLargeFileLimit(64 * 1024 * 1024)
+, m_nMaxLargeFileCompares(0)
 , m_bWalkUniques(true)
 , m_bIgnoreReparsePoints(false)
 , m_bIgnoreCodepage(false)
 , m_iGuessEncodingType(0)
 , m_nQuickCompareLimit(0)
+, m_nStreamingDiffMemory(0)
 , m_pFilterCommentsManager(nullptr)
+, m_pCompareResultCache(nullptr)
+, m_nCompareOptionsHash(0)
+, m_pReportWriter(nullptr)
 {
 	int index;
 	for (index = 0; index < paths.GetSize(); index++)
@@ -93,7 +105,7 @@ CDiffContext::~CDiffContext()
 void CDiffContext::UpdateStatusFromDisk(uintptr_t diffpos, int nIndex)
 {
 	DIFFITEM &di = GetDiffRefAt(diffpos);
-	di.diffFileInfo[nIndex].ClearPartial();
+	di.ClearPartial(nIndex);
 	if (di.diffcode.exists(nIndex))
 		UpdateInfoFromDiskHalf(di, nIndex);
 }
@@ -109,11 +121,11 @@ void CDiffContext::UpdateStatusFromDisk(uintptr_t diffpos, int nIndex)
 bool CDiffContext::UpdateInfoFromDiskHalf(DIFFITEM & di, int nIndex)
 {
 	String filepath = paths_ConcatPath(paths_ConcatPath(m_paths[nIndex], di.diffFileInfo[nIndex].path), di.diffFileInfo[nIndex].filename);
-	DiffFileInfo & dfi = di.diffFileInfo[nIndex];
+	DirItem & dfi = di.diffFileInfo[nIndex];
 	if (!dfi.Update(filepath))
 		return false;
 	UpdateVersion(di, nIndex);
-	dfi.encoding = GuessCodepageEncoding(filepath, m_iGuessEncodingType);
+	di.SetEncoding(nIndex, GuessCodepageEncoding(filepath, m_iGuessEncodingType));
 	return true;
 }
 
@@ -142,15 +154,13 @@ static bool CheckFileForVersion(const String& ext)
  * Update fileversion for given item and side from disk. Note that versions
  * are read from only some filetypes. See CheckFileForVersion() function
  * for list of files to check versions.
+ * Items of other filetypes are left without version, so they do not
+ * allocate details, and checking them again is cheap.
  * @param [in,out] di DIFFITEM to update.
  * @param [in] bLeft If true left-side file is updated, right-side otherwise.
  */
 void CDiffContext::UpdateVersion(DIFFITEM & di, int nIndex) const
 {
-	DiffFileInfo & dfi = di.diffFileInfo[nIndex];
-	// Check only binary files
-	dfi.version.SetFileVersionNone();
-
 	if (di.diffcode.isDirectory())
 		return;
 	
@@ -164,11 +174,14 @@ void CDiffContext::UpdateVersion(DIFFITEM & di, int nIndex) const
 	spath = paths_ConcatPath(spath, di.diffFileInfo[nIndex].filename);
 	
 	// Get version info if it exists
+	FileVersion version;
+	version.SetFileVersionNone();
 	CVersionInfo ver(spath.c_str());
 	unsigned verMS = 0;
 	unsigned verLS = 0;
 	if (ver.GetFixedFileVersion(verMS, verLS))
-		dfi.version.SetFileVersion(verMS, verLS);
+		version.SetFileVersion(verMS, verLS);
+	di.SetVersion(nIndex, version);
 }
 
 /**
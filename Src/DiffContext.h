@@ -13,6 +13,7 @@
 #include "PathContext.h"
 #include "DiffFileInfo.h"
 #include "DiffItemList.h"
+#include "CompareResultCache.h"
 
 class PackingInfo;
 class PrediffingInfo;
@@ -25,6 +26,7 @@ class FilterList;
 class CompareOptions;
 struct DIFFOPTIONS;
 class FilterCommentsManager;
+class DirReportWriter;
 
 /** Interface to a provider of plugin info */
 class IPluginInfos
@@ -176,6 +178,13 @@ public:
 	 */
 	int m_nQuickCompareLimit;
 
+	/**
+	 * Memory for diffing files bigger than the quick compare limit.
+	 * If not zero, such text files are diffed a window at a time using
+	 * at most about this many bytes, instead of using Quick compare.
+	 */
+	unsigned m_nStreamingDiffMemory;
+
 	/**
 	 * Walk into unique folders and add contents.
 	 * This enables/disables walking into unique folders. If we don't walk into
@@ -190,9 +199,35 @@ public:
 	bool m_bIgnoreCodepage;
 
 	bool m_bRecursive; /**< Do we include subfolders to compare? */
+	/**
+	 * Collect folders in parallel and compare items while collecting.
+	 * Folders are collected by a pool of threads, and items of a folder
+	 * are compared as soon as the folder has been collected. Results are
+	 * the same as with the default two-phase compare.
+	 */
+	bool m_bPipelinedCollect;
+	/**
+	 * @name Compare thread scheduling.
+	 * Content compares with diffutils are CPU bound and are run in their own
+	 * threads, separate from I/O bound quick and binary compares. Number of
+	 * files read at once from one volume can be limited, and big files are
+	 * compared in their own lane so they don't hold up small files.
+	 */
+	//@{
+	unsigned m_nCpuCompareThreads; /**< Threads for diffutils compares, 0 = number of processors */
+	unsigned m_nIoCompareThreads; /**< Threads for quick and binary compares, 0 = number of processors */
+	unsigned m_nMaxLocalVolumeReads; /**< Max files read at once from a local volume, 0 = no limit */
+	unsigned m_nMaxRemoteVolumeReads; /**< Max files read at once from a network volume, 0 = no limit */
+	int64_t m_nLargeFileLimit; /**< Files bigger than this are large files, 0 = no large file lane */
+	unsigned m_nMaxLargeFileCompares; /**< Threads comparing large files at once, 0 = half of threads */
+	//@}
 	bool m_bPluginsEnabled; /**< Are plugins enabled? */
 	std::unique_ptr<FilterList> m_pFilterList; /**< Filter list for line filters */
 	FilterCommentsManager *m_pFilterCommentsManager;
+	CompareResultCache *m_pCompareResultCache; /**< Persistent compare result cache, or NULL */
+	uint64_t m_nCompareOptionsHash; /**< Hash of options for m_pCompareResultCache */
+	CompareResultCache::Stats m_compareResultCacheStats; /**< Cache hits and misses of this compare */
+	DirReportWriter *m_pReportWriter; /**< Writes items to report as they are compared, or NULL */
 
 private:
 	/**
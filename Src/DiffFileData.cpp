@@ -8,6 +8,7 @@
 
 #include "DiffFileData.h"
 #include <vector>
+#include <cassert>
 #ifdef _WIN32
 #include <io.h>
 #else
@@ -53,6 +54,42 @@ bool DiffFileData::OpenFiles(const String& szFilepath1, const String& szFilepath
 	return b;
 }
 
+/**
+ * @brief Let diffutils use texts in memory instead of reading files.
+ * The texts are not copied, so they must outlive the diffing. Each of them
+ * ends with TextSlack chars of room which diffutils may overwrite.
+ * @param [in,out] text1 Text of first file and room after it.
+ * @param [in,out] text2 Text of second file and room after it.
+ * @return false if failure.
+ */
+bool DiffFileData::OpenTexts(std::string & text1, std::string & text2)
+{
+	Reset();
+
+	std::string * texts[2] = { &text1, &text2 };
+	for (int i = 0; i < 2; ++i)
+	{
+		assert(texts[i]->size() >= TextSlack);
+		m_inf[i].name = strdup(ucr::toSystemCP(m_sDisplayFilepath[i]).c_str());
+		if (m_inf[i].name == NULL)
+		{
+			Reset();
+			return false;
+		}
+
+		// Nothing is read from the descriptors, but they must differ
+		// or diffutils thinks a file is compared to itself
+		m_inf[i].desc = -1 - i;
+		m_inf[i].buffer = &(*texts[i])[0];
+		m_inf[i].bufsize = texts[i]->size();
+		m_inf[i].buffered_chars = texts[i]->size() - TextSlack;
+		m_inf[i].preloaded = 1;
+	}
+
+	m_used = true;
+	return true;
+}
+
 /** @brief stash away true names for display, before opening files */
 void DiffFileData::SetDisplayFilepaths(const String& szTrueFilepath1, const String& szTrueFilepath2)
 {
@@ -119,6 +156,12 @@ void DiffFileData::Reset()
 	// If diffutils put data in, have it cleanup
 	if (m_used)
 	{
+		// Texts in memory belong to the caller
+		for (int i = 0; i < 2; ++i)
+		{
+			if (m_inf[i].preloaded)
+				m_inf[i].buffer = NULL;
+		}
 		cleanup_file_buffers(m_inf);
 		m_used = false;
 	}
@@ -7,6 +7,7 @@
  */
 #pragma once
 
+#include <string>
 #include "FileLocation.h"
 #include "FileTextStats.h"
 
@@ -28,6 +29,7 @@ struct DiffFileData
 	~DiffFileData();
 
 	bool OpenFiles(const String& szFilepath1, const String& szFilepath2);
+	bool OpenTexts(std::string & text1, std::string & text2);
 	void Reset();
 	void Close() { Reset(); }
 	void SetDisplayFilepaths(const String& szTrueFilepath1, const String& szTrueFilepath2);
@@ -43,6 +45,9 @@ struct DiffFileData
 
 	String m_sDisplayFilepath[2];
 
+	/** @brief Room diffutils needs after a text in memory for a newline and sentinels. */
+	static const size_t TextSlack = 16;
+
 private:
 	bool DoOpenFiles();
 };
@@ -28,6 +28,7 @@
 void DiffFileInfo::ClearPartial()
 {
 	DirItem::ClearPartial();
+	version.Clear();
 	encoding.Clear();
 	m_textStats.clear();
 }
@@ -22,18 +22,20 @@
 #pragma once
 
 #include "DirItem.h"
+#include "FileVersion.h"
 #include "FileTextEncoding.h"
 #include "FileTextStats.h"
 
 /**
  * @brief Information for file.
- * This class expands DirItem class with encoding information and
- * text stats information.
+ * This class expands DirItem class with version, encoding information
+ * and text stats information.
  * @sa DirItem.
  */
 struct DiffFileInfo : public DirItem
 {
 // data
+	FileVersion version; /**< string of fixed file version, eg, 1.2.3.4 */
 	FileTextEncoding encoding; /**< unicode or codepage info */
 	FileTextStats m_textStats; /**< EOL, zero-byte etc counts */
 
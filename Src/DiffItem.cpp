@@ -9,11 +9,8 @@
 
 DIFFITEM DIFFITEM::emptyitem;
 
-/** @brief DIFFITEM's destructor */
-DIFFITEM::~DIFFITEM()
-{
-	RemoveChildren();
-}
+/** @brief Details of items which have none allocated. */
+static const DiffItemDetails EmptyDetails;
 
 /** @brief Return path to left/right file, including all but file name */
 String DIFFITEM::getFilepath(int nIndex, const String &sRoot) const
@@ -25,54 +22,93 @@ String DIFFITEM::getFilepath(int nIndex, const String &sRoot) const
 	return _T("");
 }
 
-/** @brief Return depth of path */
-int DIFFITEM::GetDepth() const
+void DIFFITEM::Swap(int idx1, int idx2)
 {
-	const DIFFITEM *cur;
-	int depth;
-	for (depth = 0, cur = parent; cur; depth++, cur = cur->parent)
-		;
-	return depth;
+	std::swap(diffFileInfo[idx1], diffFileInfo[idx2]);
+	diffcode.swap(idx1, idx2);
+	if (m_pDetails)
+	{
+		std::swap(m_pDetails->version[idx1], m_pDetails->version[idx2]);
+		std::swap(m_pDetails->encoding[idx1], m_pDetails->encoding[idx2]);
+		std::swap(m_pDetails->textStats[idx1], m_pDetails->textStats[idx2]);
+	}
 }
 
 /**
- * @brief Return whether the specified item is an ancestor of the current item
+ * @brief Clear file information of one side except path and filename.
  */
-bool DIFFITEM::IsAncestor(const DIFFITEM *pdi) const
+void DIFFITEM::ClearPartial(int nIndex)
 {
-	const DIFFITEM *cur;
-	for (cur = this; cur; cur = cur->parent)
+	diffFileInfo[nIndex].ClearPartial();
+	if (m_pDetails)
 	{
-		if (cur->parent == pdi)
-			return true;
+		m_pDetails->version[nIndex].Clear();
+		m_pDetails->encoding[nIndex].Clear();
+		m_pDetails->textStats[nIndex].clear();
 	}
-	return false;
 }
 
-/** @brief Return whether the current item has children */
-bool DIFFITEM::HasChildren() const
+DiffItemDetails& DIFFITEM::GetDetails()
 {
-	DIFFITEM *p = static_cast<DIFFITEM *>(children.IsSibling(children.Flink));
-	return p ? true : false;
+	if (!m_pDetails)
+		m_pDetails.reset(new DiffItemDetails);
+	return *m_pDetails;
 }
 
-void DIFFITEM::RemoveChildren()
+const FileVersion& DIFFITEM::GetVersion(int nIndex) const
 {
-	while (HasChildren())
-	{
-		DIFFITEM *p = static_cast<DIFFITEM *>(children.Flink);
-		p->RemoveSelf();
-		delete p;
-	}
+	return (m_pDetails ? *m_pDetails : EmptyDetails).version[nIndex];
 }
 
-void DIFFITEM::Swap(int idx1, int idx2)
+void DIFFITEM::SetVersion(int nIndex, const FileVersion& version)
 {
-	std::swap(diffFileInfo[idx1], diffFileInfo[idx2]);
-	diffcode.swap(idx1, idx2);
-	if (HasChildren())
-	{
-		for (ListEntry *p = children.IsSibling(children.Flink); p; p = children.IsSibling(p->Flink))
-			static_cast<DIFFITEM *>(p)->Swap(idx1, idx2);
-	}
+	GetDetails().version[nIndex] = version;
+}
+
+const FileTextEncoding& DIFFITEM::GetEncoding(int nIndex) const
+{
+	return (m_pDetails ? *m_pDetails : EmptyDetails).encoding[nIndex];
+}
+
+/**
+ * @brief Set encoding of one side.
+ * Unknown encoding is not stored, so items compared by date or size only
+ * do not allocate details.
+ */
+void DIFFITEM::SetEncoding(int nIndex, const FileTextEncoding& encoding)
+{
+	const FileTextEncoding &current = GetEncoding(nIndex);
+	if (encoding.m_codepage == current.m_codepage && encoding.m_unicoding == current.m_unicoding &&
+		encoding.m_bom == current.m_bom)
+		return;
+	GetDetails().encoding[nIndex] = encoding;
+}
+
+const FileTextStats& DIFFITEM::GetTextStats(int nIndex) const
+{
+	return (m_pDetails ? *m_pDetails : EmptyDetails).textStats[nIndex];
+}
+
+/**
+ * @brief Set text statistics of one side.
+ * Empty statistics are not stored, see SetEncoding().
+ */
+void DIFFITEM::SetTextStats(int nIndex, const FileTextStats& stats)
+{
+	const FileTextStats &current = GetTextStats(nIndex);
+	if (stats.ncrs == current.ncrs && stats.nlfs == current.nlfs &&
+		stats.ncrlfs == current.ncrlfs && stats.nzeros == current.nzeros)
+		return;
+	GetDetails().textStats[nIndex] = stats;
+}
+
+int64_t DIFFITEM::GetFirstDiffOffset() const
+{
+	return m_pDetails ? m_pDetails->nFirstDiffOffset : -1;
+}
+
+void DIFFITEM::SetFirstDiffOffset(int64_t nOffset)
+{
+	if (nOffset != GetFirstDiffOffset())
+		GetDetails().nFirstDiffOffset = nOffset;
 }
@@ -5,7 +5,8 @@
  */
 #pragma once
 
-#include "ListEntry.h"
+#include <cstdint>
+#include <memory>
 #include "DiffFileInfo.h"
 
 /**
@@ -174,6 +175,22 @@ public:
 	}
 };
 
+/**
+ * @brief Information of a DIFFITEM that is not needed for every item.
+ * File versions are read only when a version column is shown, and
+ * encodings and text statistics are only known after content compare, so
+ * DIFFITEM allocates this when one of them is set the first time.
+ */
+struct DiffItemDetails
+{
+	FileVersion version[3]; /**< File versions for left/middle/right file */
+	FileTextEncoding encoding[3]; /**< unicode or codepage info */
+	FileTextStats textStats[3]; /**< EOL, zero-byte etc counts */
+	int64_t nFirstDiffOffset; /**< Offset of first differing byte in binary compare, -1 if not known */
+
+	DiffItemDetails() : nFirstDiffOffset(-1) { }
+};
+
 /**
  * @brief information about one file/folder item.
  * This class holds information about one compared item in the folder compare.
@@ -184,13 +201,15 @@ public:
  * This class is for backend differences processing, presenting physical
  * files and folders. This class is not for GUI data like selection or
  * visibility statuses. So do not include any GUI-dependent data here. 
+ *
+ * Items are allocated by DiffItemList, which links them into a tree by
+ * their 32-bit indexes in the list. Fields needed for every item (names,
+ * sizes, times, attributes and compare results) are stored in the item,
+ * the rest in DiffItemDetails allocated on demand.
  */
-struct DIFFITEM : ListEntry
+struct DIFFITEM
 {
-	DIFFITEM *parent; /**< Parent of current item */
-	ListEntry children; /**< Head of doubly linked list for chldren */
-
-	DiffFileInfo diffFileInfo[3]; /**< Fileinfo for left/middle/right file */
+	DirItem diffFileInfo[3]; /**< Fileinfo for left/middle/right file */
 	int	nsdiffs; /**< Amount of non-ignored differences */
 	int nidiffs; /**< Amount of ignored differences */
 	unsigned customFlags1; /**< Custom flags set 1 */
@@ -198,16 +217,42 @@ struct DIFFITEM : ListEntry
 
 	static DIFFITEM emptyitem; /**< singleton to represent a diffitem that doesn't have any data */
 
-	DIFFITEM() : parent(NULL), nidiffs(-1), nsdiffs(-1), customFlags1(0) { }
-	~DIFFITEM();
+	DIFFITEM() : nidiffs(-1), nsdiffs(-1), customFlags1(0),
+		m_nIndex(0), m_nParent(0), m_nNext(0), m_nPrev(0), m_nFirstChild(0), m_nLastChild(0) { }
 
 	bool isEmpty() const { return this == &emptyitem; }
 	String getFilepath(int nIndex, const String &sRoot) const;
 	String getLeftFilepath(const String &sLeftRoot) const;
 	String getRightFilepath(const String &sRightRoot) const;
-	int GetDepth() const;
-	bool IsAncestor(const DIFFITEM *pdi) const;
-	bool HasChildren() const;
-	void RemoveChildren();
+	bool HasChildren() const { return m_nFirstChild != 0; }
 	void Swap(int idx1, int idx2);
+	void ClearPartial(int nIndex);
+
+	const FileVersion& GetVersion(int nIndex) const;
+	void SetVersion(int nIndex, const FileVersion& version);
+	const FileTextEncoding& GetEncoding(int nIndex) const;
+	void SetEncoding(int nIndex, const FileTextEncoding& encoding);
+	bool IsEditableEncoding(int nIndex) const { return !GetEncoding(nIndex).m_bom; }
+	const FileTextStats& GetTextStats(int nIndex) const;
+	void SetTextStats(int nIndex, const FileTextStats& stats);
+	int64_t GetFirstDiffOffset() const;
+	void SetFirstDiffOffset(int64_t nOffset);
+	/** @brief Are DiffItemDetails allocated for the item? */
+	bool HasDetails() const { return !!m_pDetails; }
+
+private:
+	friend class DiffItemList;
+
+	DiffItemDetails& GetDetails();
+
+	uint32_t m_nIndex; /**< Index of this item in DiffItemList, 0 if not in list */
+	uint32_t m_nParent; /**< Index of parent item, 0 for top level items */
+	uint32_t m_nNext; /**< Index of next sibling, or next free item in DiffItemList */
+	uint32_t m_nPrev; /**< Index of previous sibling */
+	uint32_t m_nFirstChild; /**< Index of first child item */
+	uint32_t m_nLastChild; /**< Index of last child item */
+	std::unique_ptr<DiffItemDetails> m_pDetails; /**< Allocated when first set */
+
+	DIFFITEM(const DIFFITEM &); // disallow copy construction
+	void operator=(const DIFFITEM &); // disallow assignment
 };
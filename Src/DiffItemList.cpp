@@ -5,13 +5,23 @@
  */ 
 
 #include "DiffItemList.h"
+#include <algorithm>
+#include <new>
 #include <cassert>
 
+using Poco::FastMutex;
+
 /**
  * @brief Constructor
  */
 DiffItemList::DiffItemList()
+: m_nFirst(0)
+, m_nLast(0)
+, m_nUnused(1) // 0 means no item
+, m_nFree(0)
+, m_nItems(0)
 {
+	std::fill(m_pBlocks, m_pBlocks + MaxBlocks, static_cast<DIFFITEM **>(NULL));
 }
 
 /**
@@ -22,6 +32,76 @@ DiffItemList::~DiffItemList()
 	RemoveAll();
 }
 
+/**
+ * @brief Allocate and construct new item.
+ * Removed items are reused first, then unused items of the last chunk.
+ */
+DIFFITEM *DiffItemList::AllocateItem()
+{
+	FastMutex::ScopedLock lock(m_mutex);
+	uint32_t index = m_nFree;
+	if (index)
+	{
+		m_nFree = ItemAt(index)->m_nNext;
+	}
+	else
+	{
+		if (m_nUnused == 0)
+			throw std::bad_alloc(); // All 32-bit indexes used
+		index = m_nUnused++;
+		const unsigned nBlock = index >> (ChunkItemBits + BlockChunkBits);
+		const unsigned nChunk = (index >> ChunkItemBits) & ((1u << BlockChunkBits) - 1);
+		if (!m_pBlocks[nBlock])
+		{
+			m_pBlocks[nBlock] = new DIFFITEM *[1u << BlockChunkBits];
+			std::fill(m_pBlocks[nBlock], m_pBlocks[nBlock] + (1u << BlockChunkBits), static_cast<DIFFITEM *>(NULL));
+		}
+		if (!m_pBlocks[nBlock][nChunk])
+			m_pBlocks[nBlock][nChunk] = static_cast<DIFFITEM *>(::operator new(sizeof(DIFFITEM) << ChunkItemBits));
+	}
+	DIFFITEM *p = new (ItemAt(index)) DIFFITEM;
+	p->m_nIndex = index;
+	++m_nItems;
+	return p;
+}
+
+/**
+ * @brief Destroy item and its children, and put them to free list.
+ * The item must already be unlinked from its parent.
+ */
+void DiffItemList::FreeItems(DIFFITEM *p)
+{
+	while (p->m_nFirstChild)
+	{
+		DIFFITEM *pChild = ItemAt(p->m_nFirstChild);
+		p->m_nFirstChild = pChild->m_nNext;
+		FreeItems(pChild);
+	}
+	const uint32_t index = p->m_nIndex;
+	p->~DIFFITEM();
+	FastMutex::ScopedLock lock(m_mutex);
+	p->m_nNext = m_nFree;
+	m_nFree = index;
+	--m_nItems;
+}
+
+/**
+ * @brief Release memory of all chunks.
+ * All items must be freed before.
+ */
+void DiffItemList::ReleaseChunks()
+{
+	for (unsigned nBlock = 0; nBlock < MaxBlocks && m_pBlocks[nBlock]; ++nBlock)
+	{
+		for (unsigned nChunk = 0; nChunk < (1u << BlockChunkBits) && m_pBlocks[nBlock][nChunk]; ++nChunk)
+			::operator delete(m_pBlocks[nBlock][nChunk]);
+		delete [] m_pBlocks[nBlock];
+		m_pBlocks[nBlock] = NULL;
+	}
+	m_nUnused = 1;
+	m_nFree = 0;
+}
+
 /**
  * @brief Add new diffitem to structured DIFFITEM tree.
  * @param [in] parent Parent item, or NULL if no parent.
@@ -29,12 +109,16 @@ DiffItemList::~DiffItemList()
  */
 DIFFITEM* DiffItemList::AddDiff(DIFFITEM *parent)
 {
-	DIFFITEM *p = new DIFFITEM;
-	if (parent)
-		parent->children.Append(p);
+	DIFFITEM *p = AllocateItem();
+	uint32_t &nFirst = parent ? parent->m_nFirstChild : m_nFirst;
+	uint32_t &nLast = parent ? parent->m_nLastChild : m_nLast;
+	p->m_nParent = parent ? parent->m_nIndex : 0;
+	p->m_nPrev = nLast;
+	if (nLast)
+		ItemAt(nLast)->m_nNext = p->m_nIndex;
 	else
-		m_root.Append(p);
-	p->parent = parent;
+		nFirst = p->m_nIndex;
+	nLast = p->m_nIndex;
 	return p;
 }
 
@@ -45,8 +129,29 @@ DIFFITEM* DiffItemList::AddDiff(DIFFITEM *parent)
 void DiffItemList::RemoveDiff(uintptr_t diffpos)
 {
 	DIFFITEM *p = reinterpret_cast<DIFFITEM *>(diffpos);
-	p->RemoveSelf();
-	delete p;
+	DIFFITEM *parent = GetParentDiff(*p);
+	uint32_t &nFirst = parent ? parent->m_nFirstChild : m_nFirst;
+	uint32_t &nLast = parent ? parent->m_nLastChild : m_nLast;
+	if (p->m_nPrev)
+		ItemAt(p->m_nPrev)->m_nNext = p->m_nNext;
+	else
+		nFirst = p->m_nNext;
+	if (p->m_nNext)
+		ItemAt(p->m_nNext)->m_nPrev = p->m_nPrev;
+	else
+		nLast = p->m_nPrev;
+	FreeItems(p);
+}
+
+/**
+ * @brief Remove child items of item.
+ * @param diffpos position of parent item
+ */
+void DiffItemList::RemoveChildDiffs(uintptr_t diffpos)
+{
+	DIFFITEM *p = reinterpret_cast<DIFFITEM *>(diffpos);
+	while (p->m_nFirstChild)
+		RemoveDiff(reinterpret_cast<uintptr_t>(ItemAt(p->m_nFirstChild)));
 }
 
 /**
@@ -54,8 +159,9 @@ void DiffItemList::RemoveDiff(uintptr_t diffpos)
  */
 void DiffItemList::RemoveAll()
 {
-	while (m_root.IsSibling(m_root.Flink))
-		RemoveDiff((uintptr_t)m_root.Flink);
+	while (m_nFirst)
+		RemoveDiff(reinterpret_cast<uintptr_t>(ItemAt(m_nFirst)));
+	ReleaseChunks();
 }
 
 /**
@@ -63,7 +169,7 @@ void DiffItemList::RemoveAll()
  */
 uintptr_t DiffItemList::GetFirstDiffPosition() const
 {
-	return (uintptr_t)m_root.IsSibling(m_root.Flink);
+	return m_nFirst ? reinterpret_cast<uintptr_t>(ItemAt(m_nFirst)) : 0;
 }
 
 /**
@@ -74,10 +180,8 @@ uintptr_t DiffItemList::GetFirstDiffPosition() const
 uintptr_t DiffItemList::GetFirstChildDiffPosition(uintptr_t parentdiffpos) const
 {
 	DIFFITEM *parent = reinterpret_cast<DIFFITEM *>(parentdiffpos);
-	if (parent)
-		return (uintptr_t)parent->children.IsSibling(parent->children.Flink);
-	else
-		return (uintptr_t)m_root.IsSibling(m_root.Flink);
+	const uint32_t nFirst = parent ? parent->m_nFirstChild : m_nFirst;
+	return nFirst ? reinterpret_cast<uintptr_t>(ItemAt(nFirst)) : 0;
 }
 
 /**
@@ -88,21 +192,16 @@ uintptr_t DiffItemList::GetFirstChildDiffPosition(uintptr_t parentdiffpos) const
 const DIFFITEM &DiffItemList::GetNextDiffPosition(uintptr_t & diffpos) const
 {
 	DIFFITEM *p = reinterpret_cast<DIFFITEM *>(diffpos);
-	if (p->HasChildren())
+	if (p->m_nFirstChild)
 	{
-		diffpos = GetFirstChildDiffPosition(diffpos);
+		diffpos = reinterpret_cast<uintptr_t>(ItemAt(p->m_nFirstChild));
 	}
 	else
 	{
-		DIFFITEM *cur = p;
-		do
-		{
-			if (cur->parent)
-				diffpos = (uintptr_t)cur->parent->children.IsSibling(cur->Flink);
-			else
-				diffpos = (uintptr_t)m_root.IsSibling(cur->Flink);
-			cur = cur->parent;
-		} while (!diffpos && cur);
+		const DIFFITEM *cur = p;
+		while (!cur->m_nNext && cur->m_nParent)
+			cur = ItemAt(cur->m_nParent);
+		diffpos = cur->m_nNext ? reinterpret_cast<uintptr_t>(ItemAt(cur->m_nNext)) : 0;
 	}
 	return *p;
 }
@@ -125,10 +224,7 @@ DIFFITEM &DiffItemList::GetNextDiffRefPosition(uintptr_t & diffpos)
 const DIFFITEM &DiffItemList::GetNextSiblingDiffPosition(uintptr_t & diffpos) const
 {
 	DIFFITEM *p = reinterpret_cast<DIFFITEM *>(diffpos);
-	if (p->parent)
-		diffpos = (uintptr_t)p->parent->children.IsSibling(p->Flink);
-	else
-		diffpos = (uintptr_t)m_root.IsSibling(p->Flink);
+	diffpos = p->m_nNext ? reinterpret_cast<uintptr_t>(ItemAt(p->m_nNext)) : 0;
 	return *p;
 }
 
@@ -142,6 +238,32 @@ DIFFITEM &DiffItemList::GetNextSiblingDiffRefPosition(uintptr_t & diffpos)
 	return (DIFFITEM &)GetNextSiblingDiffPosition(diffpos);
 }
 
+/** @brief Return depth of item, 0 for top level items */
+int DiffItemList::GetDiffDepth(const DIFFITEM &di) const
+{
+	int depth = 0;
+	for (uint32_t index = di.m_nParent; index; index = ItemAt(index)->m_nParent)
+		++depth;
+	return depth;
+}
+
+/**
+ * @brief Return whether the specified item is an ancestor of the item.
+ * @param [in] di Item to check.
+ * @param [in] pdi Possible ancestor, NULL (the root) is ancestor of all items.
+ */
+bool DiffItemList::IsAncestorDiff(const DIFFITEM &di, const DIFFITEM *pdi) const
+{
+	if (!pdi)
+		return true;
+	for (uint32_t index = di.m_nParent; index; index = ItemAt(index)->m_nParent)
+	{
+		if (index == pdi->m_nIndex)
+			return true;
+	}
+	return false;
+}
+
 /**
  * @brief Alter some bit flags of the diffcode.
  *
@@ -201,6 +323,31 @@ void DiffItemList::SetCustomFlags1(uintptr_t diffpos, unsigned flag)
 
 void DiffItemList::Swap(int idx1, int idx2)
 {
-	for (ListEntry *p = m_root.IsSibling(m_root.Flink); p; p = m_root.IsSibling(p->Flink))
-		static_cast<DIFFITEM *>(p)->Swap(idx1, idx2);
+	uintptr_t diffpos = GetFirstDiffPosition();
+	while (diffpos)
+		GetNextDiffRefPosition(diffpos).Swap(idx1, idx2);
+}
+
+/**
+ * @brief Return bytes allocated for the items.
+ * Includes all allocated chunks, also unused items in them, and details
+ * allocated for items, but not strings in the string pool.
+ */
+size_t DiffItemList::GetAllocatedSize() const
+{
+	FastMutex::ScopedLock lock(m_mutex);
+	size_t size = 0;
+	for (unsigned nBlock = 0; nBlock < MaxBlocks && m_pBlocks[nBlock]; ++nBlock)
+	{
+		size += sizeof(DIFFITEM *) << BlockChunkBits;
+		for (unsigned nChunk = 0; nChunk < (1u << BlockChunkBits) && m_pBlocks[nBlock][nChunk]; ++nChunk)
+			size += sizeof(DIFFITEM) << ChunkItemBits;
+	}
+	uintptr_t diffpos = GetFirstDiffPosition();
+	while (diffpos)
+	{
+		if (GetNextDiffPosition(diffpos).HasDetails())
+			size += sizeof(DiffItemDetails);
+	}
+	return size;
 }
@@ -7,6 +7,8 @@
 
 #include "DiffItem.h"
 #include <cstdint>
+#define POCO_NO_UNWINDOWS 1
+#include <Poco/Mutex.h>
 
 /**
  * @brief List of DIFFITEMs in folder compare.
@@ -14,6 +16,15 @@
  * we have a linked list of DIFFITEMs. But there is a structure that follows
  * the actual folder structure. Each DIFFITEM can have a parent folder and
  * another list of child items. Parent DIFFITEM is always a folder item.
+ *
+ * Items are allocated from chunks owned by the list, so a compare of
+ * millions of files does not make millions of heap allocations, and all
+ * memory of the compare is released with the list. Items are linked by
+ * 32-bit indexes instead of pointers. Chunks never move, so positions
+ * (addresses of items) stay valid until the item is removed.
+ *
+ * Items can be added from several threads at once, as long as only one
+ * thread adds children to the same parent.
  */
 class DiffItemList
 {
@@ -23,6 +34,7 @@ public:
 	// add & remove differences
 	DIFFITEM *AddDiff(DIFFITEM *parent);
 	void RemoveDiff(uintptr_t diffpos);
+	void RemoveChildDiffs(uintptr_t diffpos);
 	void RemoveAll();
 
 	// to iterate over all differences on list
@@ -35,6 +47,11 @@ public:
 	const DIFFITEM & GetDiffAt(uintptr_t diffpos) const;
 	DIFFITEM & GetDiffRefAt(uintptr_t diffpos);
 
+	// tree structure
+	DIFFITEM *GetParentDiff(const DIFFITEM &di) const;
+	int GetDiffDepth(const DIFFITEM &di) const;
+	bool IsAncestorDiff(const DIFFITEM &di, const DIFFITEM *pdi) const;
+
 	void SetDiffStatusCode(uintptr_t diffpos, unsigned diffcode, unsigned mask);
 	void SetDiffCounts(uintptr_t diffpos, unsigned diffs, unsigned ignored);
 	unsigned GetCustomFlags1(uintptr_t diffpos) const;
@@ -42,10 +59,44 @@ public:
 
 	void Swap(int idx1, int idx2);
 
-protected:
-	ListEntry m_root; /**< Root of list of diffitems */
+	size_t GetAllocatedSize() const;
+
+private:
+	/** @brief log2 of items in one chunk */
+	static const unsigned ChunkItemBits = 10;
+	/** @brief log2 of chunks in one block of chunk pointers */
+	static const unsigned BlockChunkBits = 12;
+	/** @brief Number of blocks needed to address items by 32-bit index */
+	static const unsigned MaxBlocks = 1u << (32 - ChunkItemBits - BlockChunkBits);
+
+	DIFFITEM *ItemAt(uint32_t index) const;
+	DIFFITEM *AllocateItem();
+	void FreeItems(DIFFITEM *p);
+	void ReleaseChunks();
+
+	DIFFITEM **m_pBlocks[MaxBlocks]; /**< Blocks of pointers to chunks of items */
+	uint32_t m_nFirst; /**< Index of first top level item */
+	uint32_t m_nLast; /**< Index of last top level item */
+	uint32_t m_nUnused; /**< Index of first never used item */
+	uint32_t m_nFree; /**< Index of first removed item, linked by m_nNext */
+	size_t m_nItems; /**< Number of items in list */
+	mutable Poco::FastMutex m_mutex; /**< Protects allocation of items */
+
+	DiffItemList(const DiffItemList &); // disallow copy construction
+	void operator=(const DiffItemList &); // disallow assignment
 };
 
+/**
+ * @brief Get item by its index.
+ * @param index Index of item, must not be 0.
+ */
+inline DIFFITEM *DiffItemList::ItemAt(uint32_t index) const
+{
+	return &m_pBlocks[index >> (ChunkItemBits + BlockChunkBits)]
+		[(index >> ChunkItemBits) & ((1u << BlockChunkBits) - 1)]
+		[index & ((1u << ChunkItemBits) - 1)];
+}
+
 /**
  * @brief Get copy of Diff Item at given position in difflist.
  * @param diffpos position of item to return
@@ -63,3 +114,12 @@ inline DIFFITEM & DiffItemList::GetDiffRefAt(uintptr_t diffpos)
 {
 	return *reinterpret_cast<DIFFITEM *>(diffpos);
 }
+
+/**
+ * @brief Get parent folder item of item.
+ * @return Parent item, NULL for top level items.
+ */
+inline DIFFITEM *DiffItemList::GetParentDiff(const DIFFITEM &di) const
+{
+	return di.m_nParent ? ItemAt(di.m_nParent) : NULL;
+}
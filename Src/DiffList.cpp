@@ -22,6 +22,7 @@
 
 #include "DiffList.h"
 #include <cassert>
+#include <climits>
 #include <string>
 #include <sstream>
 #include <algorithm>
@@ -946,6 +947,117 @@ void DiffList::AppendDiffList(const DiffList& list, int offset[], int doffset)
 	}
 }
 
+/**
+ * @brief Replace diffs of some lines with diffs found rediffing them.
+ * Diffs after the replaced ones are moved by the change of line counts.
+ * Their synchronised lines are only moved, and those of the inserted diffs
+ * are left for the caller to set.
+ * @param [in] nDiff Index of first diff to replace.
+ * @param [in] nCount Number of diffs to replace.
+ * @param [in] list Diffs to insert, with lines relative to rediffed lines.
+ * @param [in] offset First rediffed line in original files.
+ * @param [in] delta Change of line counts of original files.
+ * @param [in] ddelta Change of synchronised line count.
+ */
+void DiffList::ReplaceDiffs(int nDiff, int nCount, const DiffList& list, const int offset[],
+	const int delta[], int ddelta)
+{
+	std::vector<DiffRangeInfo>::iterator it = m_diffs.erase(m_diffs.begin() + nDiff, m_diffs.begin() + nDiff + nCount);
+	it = m_diffs.insert(it, list.m_diffs.begin(), list.m_diffs.end());
+	int file;
+	for (size_t i = 0; i < list.m_diffs.size(); ++i, ++it)
+	{
+		for (file = 0; file < 3; ++file)
+		{
+			it->begin[file] += offset[file];
+			it->end[file] += offset[file];
+		}
+	}
+	for (; it != m_diffs.end(); ++it)
+	{
+		for (file = 0; file < 3; ++file)
+		{
+			it->begin[file] += delta[file];
+			it->end[file] += delta[file];
+			if (it->blank[file] >= 0)
+				it->blank[file] += ddelta;
+		}
+		it->dbegin += ddelta;
+		it->dend += ddelta;
+	}
+}
+
+/**
+ * @brief Widen synchronised lines to whole diffs and find the diffs in them.
+ * The lines just before and after the widened lines are in no diff.
+ * @param [in,out] nBegin First line.
+ * @param [in,out] nEnd Line after the last line.
+ * @param [out] nFirstDiff Index of first diff in the lines.
+ * @param [out] nDiffs Number of diffs in the lines.
+ */
+void DiffList::WidenToDiffs(int & nBegin, int & nEnd, int & nFirstDiff, int & nDiffs) const
+{
+	int nDiff;
+	while (nBegin > 0 && (nDiff = LineToDiff(nBegin - 1)) != -1)
+		nBegin = DiffRangeAt(nDiff)->dbegin;
+	while ((nDiff = LineToDiff(nEnd)) != -1)
+		nEnd = DiffRangeAt(nDiff)->dend + 1;
+
+	const int nDiffCount = GetSize();
+	for (nFirstDiff = 0; nFirstDiff < nDiffCount; nFirstDiff++)
+	{
+		if (DiffRangeAt(nFirstDiff)->dbegin >= nBegin)
+			break;
+	}
+	for (nDiffs = 0; nFirstDiff + nDiffs < nDiffCount; nDiffs++)
+	{
+		if (DiffRangeAt(nFirstDiff + nDiffs)->dbegin >= nEnd)
+			break;
+	}
+}
+
+/**
+ * @brief Find synchronised lines to rediff after edits since last rescan.
+ * Lines before the first line edited in any file and lines after the last
+ * one are as they were at last rescan, and so are their diffs. The lines
+ * between are widened to whole diffs, see WidenToDiffs().
+ * @param [in] nFiles Number of files.
+ * @param [in] nFirstEdited First line edited in each file, INT_MAX if none.
+ * @param [in] nLinesAfterEdited Lines after last line edited in each file.
+ * @param [in] nRescannedLines Line count of each file at last rescan.
+ * @param [in] nLines Line count of each file now.
+ * @param [out] nBegin First line to rediff, same in all files.
+ * @param [out] nEnd Line after the last line to rediff, for each file.
+ * @param [out] nFirstDiff Index of first diff in lines to rediff.
+ * @param [out] nDiffs Number of diffs in lines to rediff.
+ * @return false if no file was edited.
+ */
+bool DiffList::GetEditedRange(int nFiles, const int nFirstEdited[], const int nLinesAfterEdited[],
+	const int nRescannedLines[], const int nLines[], int & nBegin, int nEnd[],
+	int & nFirstDiff, int & nDiffs) const
+{
+	// Lines are counted as they were at last rescan, when they were
+	// synchronised in all files
+	int nLineEnd = 0;
+	int file;
+	nBegin = INT_MAX;
+	for (file = 0; file < nFiles; file++)
+	{
+		nBegin = (std::min)(nBegin, nFirstEdited[file]);
+		nLineEnd = (std::max)(nLineEnd, nRescannedLines[file] -
+			(std::min)(nLinesAfterEdited[file], nRescannedLines[file]));
+	}
+	if (nBegin == INT_MAX)
+		return false;
+	nLineEnd = (std::max)(nLineEnd, nBegin);
+
+	WidenToDiffs(nBegin, nLineEnd, nFirstDiff, nDiffs);
+
+	for (file = 0; file < nFiles; file++)
+		nEnd[file] = nLineEnd + nLines[file] - nRescannedLines[file];
+	return true;
+}
+
 int DiffList::GetMergeableSrcIndex(int nDiff, int nDestIndex) const
 {
 	const DIFFRANGE *pdr = DiffRangeAt(nDiff);
@@ -172,6 +172,12 @@ public:
 	std::vector<DiffRangeInfo>& GetDiffRangeInfoVector() { return m_diffs; }
 
 	void AppendDiffList(const DiffList& list, int offset[] = NULL, int doffset = 0);
+	void ReplaceDiffs(int nDiff, int nCount, const DiffList& list, const int offset[],
+		const int delta[], int ddelta);
+	void WidenToDiffs(int & nBegin, int & nEnd, int & nFirstDiff, int & nDiffs) const;
+	bool GetEditedRange(int nFiles, const int nFirstEdited[], const int nLinesAfterEdited[],
+		const int nRescannedLines[], const int nLines[], int & nBegin, int nEnd[],
+		int & nFirstDiff, int & nDiffs) const;
 
 private:
 	std::vector<DiffRangeInfo> m_diffs; /**< Difference list. */
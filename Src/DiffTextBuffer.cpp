@@ -8,6 +8,7 @@
 #include "StdAfx.h"
 #include "DiffTextBuffer.h"
 #include <cstdint>
+#include <climits>
 #include <Poco/Exception.h>
 #include "UniFile.h"
 #include "files.h"
@@ -135,6 +136,10 @@ CDiffTextBuffer::CDiffTextBuffer(CMergeDoc * pDoc, int pane)
 , m_nThisPane(pane)
 , m_unpackerSubcode(0)
 , m_bMixedEOL(false)
+, m_nFirstEditedLine(0)
+, m_nLinesAfterEdited(0)
+, m_nRescannedLines(0)
+, m_nRescannedRealLines(0)
 {
 }
 
@@ -234,6 +239,71 @@ void CDiffTextBuffer::prepareForRescan()
 	}
 }
 
+/**
+ * @brief Prepare lines for rescanning only them.
+ * Like prepareForRescan(), but for a range of lines: ghost lines are
+ * removed from the range and flags of its lines are cleared.
+ * @param [in] nStartLine First line to rescan.
+ * @param [in] nLines Number of lines to rescan.
+ */
+void CDiffTextBuffer::prepareForRescan(int nStartLine, int nLines)
+{
+	int nLineCount = GetLineCount();
+	RemoveGhostLines(nStartLine, nLines);
+	nLines -= nLineCount - GetLineCount();
+	for (int ct = nStartLine + nLines - 1; ct >= nStartLine; --ct)
+	{
+		SetLineFlag(ct, 
+			LF_INVISIBLE | LF_DIFF | LF_TRIVIAL | LF_MOVED | LF_SNP,
+			false, false, false);
+	}
+}
+
+/**
+ * @brief Remember lines edited after rescan.
+ * Only the first line edited and the number of lines after the last line
+ * edited are kept: lines before and after them are as they were at last
+ * rescan, so only lines between need to be rescanned.
+ * @param [in] nStartLine First line edited.
+ * @param [in] nEndLine Last line edited.
+ */
+void CDiffTextBuffer::MarkEditedLines(int nStartLine, int nEndLine)
+{
+	m_nFirstEditedLine = min(m_nFirstEditedLine, nStartLine);
+	m_nLinesAfterEdited = min(m_nLinesAfterEdited, max(GetLineCount() - 1 - nEndLine, 0));
+}
+
+/**
+ * @brief Mark all lines edited, so that all lines are rescanned.
+ */
+void CDiffTextBuffer::MarkAllLinesEdited()
+{
+	m_nFirstEditedLine = 0;
+	m_nLinesAfterEdited = 0;
+}
+
+/**
+ * @brief Forget edited lines after rescan.
+ * Line counts are kept to locate unedited lines at the end of the
+ * buffer at next rescan.
+ */
+void CDiffTextBuffer::ClearEditedLines()
+{
+	m_nFirstEditedLine = INT_MAX;
+	m_nLinesAfterEdited = INT_MAX;
+	m_nRescannedLines = GetLineCount();
+	m_nRescannedRealLines = GetRealLineCount();
+}
+
+/**
+ * @brief Get number of real (not ghost) lines in the buffer.
+ */
+int CDiffTextBuffer::GetRealLineCount() const
+{
+	int nLastRealLine = ApparentLastRealLine();
+	return (nLastRealLine >= 0) ? ComputeRealLine(nLastRealLine) + 1 : 0;
+}
+
 /** 
  * @brief Called when line has been edited.
  * After editing a line, we don't know if there is a diff or not.
@@ -248,6 +318,7 @@ void CDiffTextBuffer::OnNotifyLineHasBeenEdited(int nLine)
 	SetLineFlag(nLine, LF_TRIVIAL, false, false, false);
 	SetLineFlag(nLine, LF_MOVED, false, false, false);
 	SetLineFlag(nLine, LF_SNP, false, false, false);
+	MarkEditedLines(nLine, nLine);
 	CGhostTextBuffer::OnNotifyLineHasBeenEdited(nLine);
 }
 
@@ -425,6 +496,7 @@ int CDiffTextBuffer::LoadFromFile(LPCTSTR pszFileNameInit,
 		m_ptLastChange.x = m_ptLastChange.y = -1;
 		
 		FinishLoading();
+		MarkAllLinesEdited();
 		// flags don't need initialization because 0 is the default value
 
 		// Set the return value : OK + info if the file is impure
@@ -667,6 +739,88 @@ int CDiffTextBuffer::SaveToFile (const String& pszFileName,
 		return SAVE_FAILED;
 }
 
+/**
+ * @brief Saves text from buffer to memory for diff-engine.
+ * The text is the same SaveToFile() writes to a working-temp-file, but it
+ * is converted in memory and nothing is written to disk.
+ * @param [out] text Text in the encoding of the buffer, which must be
+ * UTF-8 or an 8-bit codepage.
+ * @param [in] nCrlfStyle EOL style of the text.
+ * @param [in] nStartLine First line of the text.
+ * @param [in] nLines Count of lines in the text, -1 for lines up to the end.
+ */
+void CDiffTextBuffer::SaveToString(std::string & text, CRLFSTYLE nCrlfStyle /*= CRLF_STYLE_AUTOMATIC*/,
+		int nStartLine /*= 0*/, int nLines /*= -1*/)
+{
+	ASSERT (nCrlfStyle == CRLF_STYLE_AUTOMATIC || nCrlfStyle == CRLF_STYLE_DOS ||
+		nCrlfStyle == CRLF_STYLE_UNIX || nCrlfStyle == CRLF_STYLE_MAC);
+	ASSERT (m_bInit);
+	ASSERT (m_encoding.m_unicoding == ucr::NONE || m_encoding.m_unicoding == ucr::UTF8);
+
+	if (nLines == -1)
+		nLines = static_cast<int>(m_aLines.size() - nStartLine);
+
+	if (nCrlfStyle == CRLF_STYLE_AUTOMATIC &&
+		!GetOptionsMgr()->GetBool(OPT_ALLOW_MIXED_EOL))
+	{
+			// get the default nCrlfStyle of the CDiffTextBuffer
+		nCrlfStyle = GetCRLFMode();
+		ASSERT(nCrlfStyle >= 0 && nCrlfStyle <= 3);
+	}
+
+	text.clear();
+	if (m_encoding.m_unicoding == ucr::UTF8 && m_encoding.m_bom && nStartLine == 0)
+		text = "\xEF\xBB\xBF";
+
+	ucr::UNICODESET unicoding = ucr::NONE;
+	int codepage = 0;
+	ucr::getInternalEncoding(&unicoding, &codepage); // What String & TCHARs represent
+	ucr::buffer converted(128);
+
+	// Lines are converted a chunk at a time, which is faster
+	// than converting them one by one.
+	const size_t nChunkChars = 64 * 1024;
+	String sChunk;
+	sChunk.reserve(nChunkChars + 256);
+	String sLine;
+	String sEol = GetStringEol(nCrlfStyle);
+	int lastRealLine = ApparentLastRealLine();
+	for (int line = nStartLine; line < nStartLine + nLines; ++line)
+	{
+		if (GetLineFlags(line) & LF_GHOST)
+			continue;
+
+		// get the characters of the line (excluding EOL)
+		if (GetLineLength(line) > 0)
+			sLine.assign(GetLineChars(line), GetLineLength(line));
+		else
+			sLine.clear();
+		EscapeControlChars(sLine);
+		sChunk += sLine;
+
+		// last real line is never EOL terminated
+		if (line == lastRealLine || lastRealLine == -1)
+			break;
+
+		// normal real line : append an EOL
+		if (nCrlfStyle == CRLF_STYLE_AUTOMATIC || nCrlfStyle == CRLF_STYLE_MIXED)
+			sChunk += GetLineEol(line);
+		else
+			sChunk += sEol;
+
+		if (sChunk.length() >= nChunkChars)
+		{
+			ucr::convert(unicoding, codepage, reinterpret_cast<const unsigned char *>(sChunk.c_str()),
+				sChunk.length() * sizeof(TCHAR), m_encoding.m_unicoding, m_encoding.m_codepage, &converted);
+			text.append(reinterpret_cast<const char *>(converted.ptr), converted.size);
+			sChunk.clear();
+		}
+	}
+	ucr::convert(unicoding, codepage, reinterpret_cast<const unsigned char *>(sChunk.c_str()),
+		sChunk.length() * sizeof(TCHAR), m_encoding.m_unicoding, m_encoding.m_codepage, &converted);
+	text.append(reinterpret_cast<const char *>(converted.ptr), converted.size);
+}
+
 /// Replace line (removing any eol, and only including one if in strText)
 void CDiffTextBuffer::ReplaceFullLines(CDiffTextBuffer& dbuf, CDiffTextBuffer& sbuf, CCrystalTextView * pSource, int nLineBegin, int nLineEnd, int nAction /*=CE_ACTION_UNKNOWN*/)
 {
@@ -696,10 +850,30 @@ bool CDiffTextBuffer::curUndoGroup()
 	return (m_aUndoBuf.size() != 0 && m_aUndoBuf[0].m_dwFlags&UNDO_BEGINGROUP);
 }
 
+/**
+ * @brief Insert text to the buffer and remember inserted lines as edited.
+ * Lines are marked once ghost lines replaced by the text have been
+ * deleted, so lines after them are counted right.
+ */
+bool CDiffTextBuffer::
+InsertText(CCrystalTextView * pSource, int nLine, int nPos,
+	LPCTSTR pszText, int cchText, int &nEndLine, int &nEndChar,
+	int nAction, bool bHistory /*=true*/)
+{
+	if (!CGhostTextBuffer::InsertText(pSource, nLine, nPos, pszText, cchText,
+		nEndLine, nEndChar, nAction, bHistory))
+	{
+		return false;
+	}
+	MarkEditedLines(nLine, nEndLine);
+	return true;
+}
+
 bool CDiffTextBuffer::
 DeleteText2(CCrystalTextView * pSource, int nStartLine, int nStartChar,
 	int nEndLine, int nEndChar, int nAction, bool bHistory /*=true*/)
 {
+	MarkEditedLines(nStartLine, nEndLine);
 	for (auto syncpnt : m_pOwnerDoc->GetSyncPointList())
 	{
 		const int nLineSyncPoint = syncpnt[m_nThisPane];
@@ -24,6 +24,10 @@ private :
 	String m_strTempPath; /**< Temporary files folder. */
 	int m_unpackerSubcode; /**< Plugin information. */
 	bool m_bMixedEOL; /**< EOL style of this buffer is mixed? */
+	int m_nFirstEditedLine; /**< First line edited after rescan, INT_MAX if none. */
+	int m_nLinesAfterEdited; /**< Lines after last line edited after rescan, INT_MAX if none. */
+	int m_nRescannedLines; /**< Line count at last rescan. */
+	int m_nRescannedRealLines; /**< Real line count at last rescan. */
 
 	/** 
 	 * @brief Unicode encoding from ucr::UNICODESET.
@@ -42,6 +46,9 @@ public :
 	CDiffTextBuffer(CMergeDoc * pDoc, int pane);
 
 	void SetTempPath(const String &path);
+	virtual bool InsertText (CCrystalTextView * pSource, int nLine, int nPos,
+		LPCTSTR pszText, int cchText, int &nEndLine, int &nEndChar,
+		int nAction = CE_ACTION_UNKNOWN, bool bHistory =true);
 	virtual void AddUndoRecord (bool bInsert, const CPoint & ptStartPos,
 		const CPoint & ptEndPos, LPCTSTR pszText, int cchText,
 		int nActionType = CE_ACTION_UNKNOWN,
@@ -55,6 +62,8 @@ public :
 	int SaveToFile (const String& pszFileName, bool bTempFile, String & sError,
 		PackingInfo * infoUnpacker = NULL, CRLFSTYLE nCrlfStyle = CRLF_STYLE_AUTOMATIC,
 		bool bClearModifiedFlag = TRUE, int nStartLine = 0, int nLines = -1);
+	void SaveToString(std::string & text, CRLFSTYLE nCrlfStyle = CRLF_STYLE_AUTOMATIC,
+		int nStartLine = 0, int nLines = -1);
 	ucr::UNICODESET getUnicoding() const { return m_encoding.m_unicoding; }
 	void setUnicoding(ucr::UNICODESET value) { m_encoding.m_unicoding = value; }
 	int getCodepage() const { return m_encoding.m_codepage; }
@@ -74,6 +83,19 @@ public :
 
 	virtual void SetModified (bool bModified = TRUE);
 	void prepareForRescan();
+	void prepareForRescan(int nStartLine, int nLines);
+	void MarkEditedLines(int nStartLine, int nEndLine);
+	void MarkAllLinesEdited();
+	void ClearEditedLines();
+	/** @brief Get first line edited after rescan, INT_MAX if none. */
+	int GetFirstEditedLine() const { return m_nFirstEditedLine; }
+	/** @brief Get number of lines after last line edited after rescan, INT_MAX if none. */
+	int GetLinesAfterEdited() const { return m_nLinesAfterEdited; }
+	/** @brief Get line count at last rescan. */
+	int GetRescannedLineCount() const { return m_nRescannedLines; }
+	/** @brief Get real line count at last rescan. */
+	int GetRescannedRealLineCount() const { return m_nRescannedRealLines; }
+	int GetRealLineCount() const;
 	virtual void OnNotifyLineHasBeenEdited(int nLine);
 	bool IsInitialized() const;
 	virtual bool DeleteText2 (CCrystalTextView * pSource, int nStartLine,
@@ -32,6 +32,7 @@
 #include "PathContext.h"
 #include "CompareStats.h"
 #include "IAbortable.h"
+#include "DirReportWriter.h"
 
 using Poco::Thread;
 using Poco::Semaphore;
@@ -110,9 +111,16 @@ unsigned CDiffThread::CompareDirectories()
 	m_pDiffParm->context->m_pCompareStats->SetCompareState(CompareStats::STATE_START);
 
 	if (m_bOnlyRequested == false)
-		m_threads[0].start(DiffThreadCollect, m_pDiffParm.get());
+	{
+		// In pipelined mode the compare thread collects items too
+		if (!m_pDiffContext->m_bPipelinedCollect)
+			m_threads[0].start(DiffThreadCollect, m_pDiffParm.get());
+	}
 	else
 	{
+		for (size_t i = 0; i < m_changedFolders.size(); ++i)
+			DirScan_CollectNewItems(m_pDiffParm.get(), m_changedFolders[i]);
+		m_changedFolders.clear();
 		int nItems = DirScan_UpdateMarkedItems(m_pDiffParm.get(), 0);
 		// Send message to UI to update
 		int event = CDiffThread::EVENT_COLLECT_COMPLETED;
@@ -198,11 +206,20 @@ static void DiffThreadCompare(void *pParam)
 	// Now do all pending file comparisons
 	if (myStruct->bOnlyRequested)
 		DirScan_CompareRequestedItems(myStruct, 0);
+	else if (myStruct->context->m_bPipelinedCollect)
+		DirScan_CollectAndCompareItems(myStruct);
 	else
 		DirScan_CompareItems(myStruct, 0);
 
 	myStruct->context->m_pCompareStats->SetCompareState(CompareStats::STATE_IDLE);
 
+	// Report is complete before UI (or batch job) hears about it
+	if (myStruct->context->m_pReportWriter)
+	{
+		myStruct->context->m_pReportWriter->Close();
+		myStruct->context->m_pReportWriter = NULL;
+	}
+
 	// Send message to UI to update
 	myStruct->nThreadState = CDiffThread::THREAD_COMPLETED;
 	int event = CDiffThread::EVENT_COMPARE_COMPLETED;
@@ -22,6 +22,7 @@
 #pragma once
 
 #include <memory>
+#include <vector>
 #define POCO_NO_UNWINDOWS 1
 #include <Poco/Thread.h>
 #include <Poco/BasicEvent.h>
@@ -63,6 +64,9 @@ struct DiffFuncStruct
  * - first thread collects items to compare to compare-time list
  *   (m_diffList).
  * - second threads compares items in the list.
+ * If CDiffContext::m_bPipelinedCollect is set, folders are instead collected
+ * by a pool of threads and items are compared as soon as their folder
+ * has been collected (see DirScan_CollectAndCompareItems()).
  */
 class CDiffThread
 {
@@ -96,6 +100,8 @@ public:
 		m_pDiffParm->m_listeners -= Poco::delegate(pObj, pMethod);
 	}
 	void SetCompareSelected(bool bSelected = false);
+	/** @brief Set folders to look for new items in next compare of selected items. */
+	void SetChangedFolders(const std::vector<uintptr_t>& folders) { m_changedFolders = folders; }
 
 // runtime interface for main thread, called on main thread
 	unsigned GetThreadState() const;
@@ -112,4 +118,5 @@ private:
 	std::unique_ptr<DiffThreadAbortable> m_pAbortgate;
 	bool m_bAborting; /**< Is compare aborting? */
 	bool m_bOnlyRequested; /**< Are we comparing only requested items (Update?) */
+	std::vector<uintptr_t> m_changedFolders; /**< Folders where new items may have appeared */
 };
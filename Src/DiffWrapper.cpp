@@ -32,7 +32,6 @@
 #include <cassert>
 #include <exception>
 #include <vector>
-#include <list>
 #include <Poco/Format.h>
 #include <Poco/Debugger.h>
 #include <Poco/StringTokenizer.h>
@@ -44,12 +43,14 @@
 #include "FilterList.h"
 #include "diff.h"
 #include "Diff3.h"
+#include "Diff3Pairs.h"
 #include "FileTransform.h"
 #include "paths.h"
 #include "CompareOptions.h"
 #include "FileTextStats.h"
 #include "FolderCmp.h"
 #include "FilterCommentsManager.h"
+#include "CommentLines.h"
 #include "Environment.h"
 #include "PatchHTML.h"
 #include "UnicodeString.h"
@@ -85,6 +86,7 @@ CDiffWrapper::CDiffWrapper()
 , m_infoPrediffer(nullptr)
 , m_pDiffList(nullptr)
 , m_bPathsAreTemp(false)
+, m_pTexts(nullptr)
 , m_pFilterList(nullptr)
 , m_bPluginsEnabled(false)
 {
@@ -254,242 +256,38 @@ void CDiffWrapper::SetDetectMovedBlocks(bool bDetectMovedBlocks)
 }
 
 /**
- * @brief Test for trivial only characters in string
- * @param [in] Start				- Start position in string
- * @param [in] End					- One character pass the end position of the string
- * @param [in] filtercommentsset	- For future use to determine trivial bytes
- * @return Returns true if all characters are trivial
- */
-bool CDiffWrapper::IsTrivialBytes(const char* Start, const char* End,
-	const FilterCommentsSet& filtercommentsset) const
-{
-	std::string testdata(Start, End);
-	//@TODO: Need to replace the following trivial string with a user specified string
-	size_t pos = testdata.find_first_not_of(" \t\r\n");
-	return (pos == std::string::npos);
-}
-
-/**
- * @brief Test for a line of trivial data
- * @param [in] Line					- String to test for
- * @param [in] StartOfComment		- 
- * @param [in] EndOfComment			- 
- * @param [in] InLineComment		- 
- * @param [in] filtercommentsset	- Comment marker set used to indicate comment blocks.
- * @return Returns true if entire line is trivial
- */
-bool CDiffWrapper::IsTrivialLine(const std::string &Line, 
-				   const char * StartOfComment,	
-				   const char * EndOfComment,	
-				   const char * InLineComment,	
-				   const FilterCommentsSet& filtercommentsset) const
-{
-	//Do easy test first
-	if ((!StartOfComment || !EndOfComment) && !InLineComment)
-		return false;//In no Start and End pair, and no single in-line set, then it's not trivial
-
-	if (StartOfComment == Line.c_str() &&
-		((EndOfComment + filtercommentsset.EndMarker.size()) - StartOfComment) == Line.size())
-	{//If entire line is blocked by End and Start markers, then entire line is trivial
-		return true;
-	}
-
-	if (InLineComment && InLineComment < StartOfComment)
-	{
-		if (InLineComment == Line.c_str())
-			return true;//If line starts with InLineComment marker, then entire line is trivial
-
-		//Other wise, check if data before InLineComment marker is trivial
-		return IsTrivialBytes(Line.c_str(), InLineComment, filtercommentsset);
-	}
-
-	//Done with easy test, so now do more complex test
-	if (StartOfComment && 
-		EndOfComment && 
-		StartOfComment < EndOfComment &&
-		IsTrivialBytes(Line.c_str(), StartOfComment, filtercommentsset) &&
-		IsTrivialBytes(EndOfComment + filtercommentsset.EndMarker.size(),
-			Line.c_str()+Line.size(), filtercommentsset))
-	{
-		return true;
-	}
-
-	return false;
-}
-
-/**
- * @brief Find comment marker in string, excluding portions enclosed in quotation marks or apostrophes
- * @param [in] target				- string to search
- * @param [in] marker				- marker to search for
- * @return Returns position of marker, or NULL if none is present
- */
-static const char *FindCommentMarker(const char *target, const char *marker)
+@brief Classifies lines of both files for post-filtering, in one pass over each file.
+See ::ClassifyCommentLines(). PostFilter() then only looks up the classes.
+@param [in,out]  inf				- Compared files data, classes are freed with the other buffers.
+@param [in]  FileNameExt			- The file name extension.  Needs to be lower case string ("cpp", "java", "c")
+*/
+void CDiffWrapper::ClassifyCommentLines(file_data * inf, const String& FileNameExt) const
 {
-	char prev = '\0';
-	char quote = '\0';
-	size_t marker_len = strlen(marker);
-	while (char c = *target)
-	{
-		if (quote == '\0' && strncmp(target, marker, marker_len) == 0)
-			return target;
-		if ((prev != '\\') &&
-			(c == '"' || c == '\'') &&
-			(quote == '\0' || quote == c))
-		{
-			quote ^= c;
-		}
-		prev = c;
-		++target;
-	}
-	return NULL;
-}
+	if (!m_pFilterCommentsManager)
+		return;
 
-/**
- * @brief Replace spaces in a string
- * @param [in] str - String to search
- * @param [in] rep - String to replace
- */
-static void ReplaceSpaces(std::string & str, const char *rep)
-{
-	std::string::size_type pos = 0;
-	size_t replen = strlen(rep);
-	while ((pos = str.find_first_of(" \t", pos)) != std::string::npos)
+	FilterCommentsSet filtercommentsset = m_pFilterCommentsManager->GetSetForFileType(FileNameExt);
+	if (filtercommentsset.StartMarker.empty() && 
+		filtercommentsset.EndMarker.empty() &&
+		filtercommentsset.InlineMarker.empty())
 	{
-		std::string::size_type posend = str.find_first_not_of(" \t", pos);
-		if (posend != std::string::npos)
-			str.replace(pos, posend - pos, rep);
-		else
-			str.replace(pos, 1, rep);
-		pos += replen;
+		return;
 	}
-}
-
-/**
-	@brief Performs post-filtering, by setting comment blocks to trivial
-	@param [in]  StartPos			- First line number to read
-	@param [in]  EndPos				- The line number PASS the last line number to read
-	@param [in]  QtyLinesInBlock		- Number of lines in diff block.  Not needed in backward direction.
-	@param [in]  Direction			- This should be 1 or -1, to indicate which direction to read (backward or forward)
-	@param [in,out]  Op				- This variable is set to trivial if block should be ignored.
-	@param [in]  FileNo				- Should be 0 or 1, to indicate left or right file.
-	@param [in]  filtercommentsset	- Comment marker set used to indicate comment blocks.
-	@return		Always returns true in reverse direction.
-				In forward direction, returns false if none trivial data is found within QtyLinesInBlock
-*/
-bool CDiffWrapper::PostFilter(int StartPos, int EndPos, int Direction,
-	int QtyLinesInBlock, OP_TYPE &Op, int FileNo,
-	FilterCommentsSet& filtercommentsset) const
-{
-	if (Op == OP_TRIVIAL) //If already set to trivial, then exit.
-		return true;
-	bool OpShouldBeTrivial = false;
-	int QtyTrivialLines = 0;
-	for(int i = StartPos + ((Direction == -1)?-1:0); i != EndPos;i += Direction)
-	{
-		if ((i - StartPos) == QtyLinesInBlock && 
-			QtyLinesInBlock == QtyTrivialLines)
-		{
-			OpShouldBeTrivial = true;
-			break;
-		}
-		size_t len = files[FileNo].linbuf[i + 1] - files[FileNo].linbuf[i];
-		const char *LineStr = files[FileNo].linbuf[i];
-		std::string LineData(LineStr, linelen(LineStr, len));
-
-		const char * StartOfComment		= FindCommentMarker(LineData.c_str(), filtercommentsset.StartMarker.c_str());
-		const char * EndOfComment		= FindCommentMarker(LineData.c_str(), filtercommentsset.EndMarker.c_str());
-		const char * InLineComment		= FindCommentMarker(LineData.c_str(), filtercommentsset.InlineMarker.c_str());
-		//The following logic determines if the entire block is a comment block, and only marks it as trivial
-		//if all the changes are within a comment block.
-		if (Direction == -1)
-		{
-			if (!StartOfComment && EndOfComment)
-				break;
-			
-			if (StartOfComment && (!EndOfComment || EndOfComment < StartOfComment) && (!InLineComment || InLineComment > StartOfComment))
-			{
-				OpShouldBeTrivial = true;
-				break;
-			}
-		}
-		else if (Direction == 1)
-		{
-			if (IsTrivialBytes(LineData.c_str(), LineData.c_str()+LineData.size(), filtercommentsset) || 
-				IsTrivialLine(LineData, StartOfComment,	EndOfComment, InLineComment, filtercommentsset))
-			{
-				++QtyTrivialLines;
-			}
-
-			if (!EndOfComment && StartOfComment)
-			{
-				if (i == (StartPos + QtyTrivialLines) )
-				{
-					if (StartOfComment == LineData.c_str())
-					{//If this is at the beginning of the first line, then lets continue
-						continue;
-					}
-					if (IsTrivialBytes(LineData.c_str(), StartOfComment, filtercommentsset))
-					{//If only trivial bytes before comment marker, then continue
-						continue;
-					}
-					break;
-				}
-				//If this is not the first line, then assume
-				//previous lines are non-trivial, and return true.
-				return false;
-			}
-
-			if (EndOfComment && 
-				(!StartOfComment || StartOfComment > EndOfComment) && 
-				(!InLineComment || InLineComment > EndOfComment) )
-			{
-				if (!IsTrivialBytes(EndOfComment+filtercommentsset.EndMarker.size(), LineData.c_str()+LineData.size(), filtercommentsset))
-				{
-					return false;
-				}
 
-				if ((i - StartPos) >=  (QtyLinesInBlock-1))
-				{
-					OpShouldBeTrivial = true;
-					break;
-				}
-
-				//Lets check if the remaining lines only contain trivial data
-				bool AllRemainingLinesContainTrivialData = true;
-				int TrivLinePos = i+1;
-				for(; TrivLinePos != (StartPos + QtyLinesInBlock);++TrivLinePos)
-				{
-					size_t len = files[FileNo].linbuf[TrivLinePos + 1] - files[FileNo].linbuf[TrivLinePos];
-					const char *LineStrTrvCk = files[FileNo].linbuf[TrivLinePos];
-					std::string LineDataTrvCk(LineStrTrvCk, linelen(LineStrTrvCk, len));
-					if (LineDataTrvCk.size() &&
-						!IsTrivialBytes(LineDataTrvCk.c_str(), LineDataTrvCk.c_str() + LineDataTrvCk.size(), filtercommentsset))
-					{
-						AllRemainingLinesContainTrivialData = false;
-						break;
-					}
-				}
-				if (AllRemainingLinesContainTrivialData)
-				{
-					OpShouldBeTrivial = true;
-					break;
-				}
-				if (TrivLinePos != (StartPos + QtyLinesInBlock) )
-				{
-					return PostFilter(TrivLinePos, EndPos, Direction, QtyLinesInBlock - (TrivLinePos - StartPos), Op, FileNo, filtercommentsset);
-				}
-			}
-		}
-	}
-	if (OpShouldBeTrivial)
+	for (int FileNo = 0; FileNo < 2; ++FileNo)
 	{
-		Op = OP_TRIVIAL;
+		file_data &data = inf[FileNo];
+		if (data.line_classes == NULL && data.linbuf != NULL)
+			::ClassifyCommentLines(data, filtercommentsset);
+		// PostFilter() reads the copy diff_2_files() made of the file data
+		if (&files[FileNo] != &data)
+			files[FileNo].line_classes = data.line_classes;
 	}
-	return true;
 }
 
 /**
 @brief The main entry for post filtering.  Performs post-filtering, by setting comment blocks to trivial
+Lines must be classified by ClassifyCommentLines() first.
 @param [in]  LineNumberLeft		- First line number to read from left file
 @param [in]  QtyLinesLeft		- Number of lines in the block for left file
 @param [in]  LineNumberRight		- First line number to read from right file
@@ -502,143 +300,17 @@ void CDiffWrapper::PostFilter(int LineNumberLeft, int QtyLinesLeft, int LineNumb
 {
 	if (Op == OP_TRIVIAL || !m_pFilterCommentsManager)
 		return;
-	
-	//First we need to get lowercase file name extension
-	FilterCommentsSet filtercommentsset = m_pFilterCommentsManager->GetSetForFileType(FileNameExt);
-	if (filtercommentsset.StartMarker.empty() && 
-		filtercommentsset.EndMarker.empty() &&
-		filtercommentsset.InlineMarker.empty())
-	{
-		return;
-	}
+	if (!files[0].line_classes || !files[1].line_classes)
+		return;//No comment markers for this file type
 
-	OP_TYPE LeftOp = OP_NONE;
-	OP_TYPE RightOp = OP_NONE;
-
-	if (QtyLinesRight == 0)
-	{	//Only check left side
-		if (PostFilter(LineNumberLeft, files[0].valid_lines, 1, QtyLinesLeft, LeftOp, 0, filtercommentsset))
-			PostFilter(LineNumberLeft, -1, -1, QtyLinesLeft, LeftOp, 0, filtercommentsset);
-	}
-	else if (QtyLinesLeft == 0)
-	{	//Only check right side
-		if (PostFilter(LineNumberRight, files[1].valid_lines, 1, QtyLinesRight, RightOp, 1, filtercommentsset))
-			PostFilter(LineNumberRight, -1, -1, QtyLinesRight, RightOp, 1, filtercommentsset);
-	}
-	else
-	{
-		if (PostFilter(LineNumberLeft, files[0].valid_lines, 1, QtyLinesLeft, LeftOp, 0, filtercommentsset))
-			PostFilter(LineNumberLeft, -1, -1, QtyLinesLeft, LeftOp, 0, filtercommentsset);
-
-		if (PostFilter(LineNumberRight, files[1].valid_lines, 1, QtyLinesRight, RightOp, 1, filtercommentsset))
-			PostFilter(LineNumberRight, -1, -1, QtyLinesRight, RightOp, 1, filtercommentsset);
-	}
-
-	std::list<std::string> LeftLines, RightLines;
-	for (int i = 0; (i < QtyLinesLeft) || (i < QtyLinesRight); i++)
+	const int LineNumber[2] = { LineNumberLeft, LineNumberRight };
+	const int QtyLines[2] = { QtyLinesLeft, QtyLinesRight };
+	FilterCommentsSet filtercommentsset = m_pFilterCommentsManager->GetSetForFileType(FileNameExt);
+	if (IsCommentChangeOnly(files, LineNumber, QtyLines, filtercommentsset,
+		m_options.m_ignoreWhitespace, m_options.m_bIgnoreCase))
 	{
-		//Lets test  all lines if only a comment is different.
-		const char *	LineStrLeft = "";
-		const char *	EndLineLeft = LineStrLeft;
-		const char *	LineStrRight = "";
-		const char *	EndLineRight = LineStrRight;
-		if(i < QtyLinesLeft)
-		{
-			LineStrLeft = files[0].linbuf[LineNumberLeft + i];
-			EndLineLeft = files[0].linbuf[LineNumberLeft + i + 1];
-		}
-		if(i < QtyLinesRight)
-		{
-			LineStrRight = files[1].linbuf[LineNumberRight + i];
-			EndLineRight = files[1].linbuf[LineNumberRight + i + 1];
-		}
-			
-		if (EndLineLeft && EndLineRight)
-		{	
-			std::string LineDataLeft(LineStrLeft, EndLineLeft);
-			std::string LineDataRight(LineStrRight, EndLineRight);
-
-			if (!filtercommentsset.StartMarker.empty() && !filtercommentsset.EndMarker.empty())
-			{
-				const char * CommentStrLeftStart;
-				const char * CommentStrLeftEnd;
-				const char * CommentStrRightStart;
-				const char * CommentStrRightEnd;
-
-				bool bFirstLoop = true;
-				do {
-					//Lets remove block comments, and see if lines are equal
-					CommentStrLeftStart = FindCommentMarker(LineDataLeft.c_str(), filtercommentsset.StartMarker.c_str());
-					CommentStrLeftEnd = FindCommentMarker(LineDataLeft.c_str(), filtercommentsset.EndMarker.c_str());
-					CommentStrRightStart = FindCommentMarker(LineDataRight.c_str(), filtercommentsset.StartMarker.c_str());
-					CommentStrRightEnd = FindCommentMarker(LineDataRight.c_str(), filtercommentsset.EndMarker.c_str());
-					
-					if (CommentStrLeftStart != NULL && CommentStrLeftEnd != NULL && CommentStrLeftStart < CommentStrLeftEnd)
-						LineDataLeft.erase(CommentStrLeftStart - LineDataLeft.c_str(), CommentStrLeftEnd + filtercommentsset.EndMarker.size() - CommentStrLeftStart);
-					else if (CommentStrLeftEnd != NULL)
-						LineDataLeft.erase(0, CommentStrLeftEnd + filtercommentsset.EndMarker.size() - LineDataLeft.c_str());
-					else if (CommentStrLeftStart != NULL)
-						LineDataLeft.erase(CommentStrLeftStart - LineDataLeft.c_str());
-					else if(LeftOp == OP_TRIVIAL && bFirstLoop)
-						LineDataLeft.erase(0);  //This line is all in block comments
-
-					if (CommentStrRightStart != NULL && CommentStrRightEnd != NULL && CommentStrRightStart < CommentStrRightEnd)
-						LineDataRight.erase(CommentStrRightStart - LineDataRight.c_str(), CommentStrRightEnd + filtercommentsset.EndMarker.size() - CommentStrRightStart);
-					else if (CommentStrRightEnd != NULL)
-						LineDataRight.erase(0, CommentStrRightEnd + filtercommentsset.EndMarker.size() - LineDataRight.c_str());
-					else if (CommentStrRightStart != NULL)
-						LineDataRight.erase(CommentStrRightStart - LineDataRight.c_str());
-					else if(RightOp == OP_TRIVIAL && bFirstLoop)
-						LineDataRight.erase(0);  //This line is all in block comments
-
-					bFirstLoop = false;
-
-				} while (CommentStrLeftStart != NULL || CommentStrLeftEnd != NULL
-					|| CommentStrRightStart != NULL || CommentStrRightEnd != NULL); //Loops until all blockcomments are lost
-			}
-
-			if (!filtercommentsset.InlineMarker.empty())
-			{
-				//Lets remove line comments
-				const char * CommentStrLeft = FindCommentMarker(LineDataLeft.c_str(), filtercommentsset.InlineMarker.c_str());
-				const char * CommentStrRight = FindCommentMarker(LineDataRight.c_str(), filtercommentsset.InlineMarker.c_str());
-
-				if (CommentStrLeft != NULL)
-					LineDataLeft.erase(CommentStrLeft - LineDataLeft.c_str());
-				if (CommentStrRight != NULL)
-					LineDataRight.erase(CommentStrRight - LineDataRight.c_str());
-			}
-
-		if (m_options.m_ignoreWhitespace == WHITESPACE_IGNORE_ALL)
-			{
-				//Ignore character case
-				ReplaceSpaces(LineDataLeft, "");
-				ReplaceSpaces(LineDataRight, "");
-			}
-			else if (m_options.m_ignoreWhitespace == WHITESPACE_IGNORE_CHANGE)
-			{
-				//Ignore change in whitespace char count
-				ReplaceSpaces(LineDataLeft, " ");
-				ReplaceSpaces(LineDataRight, " ");
-			}
-
-			if (m_options.m_bIgnoreCase)
-			{
-				//ignore case
-				std::transform(LineDataLeft.begin(),  LineDataLeft.end(),  LineDataLeft.begin(),  ::toupper);
-				std::transform(LineDataRight.begin(), LineDataRight.end(), LineDataRight.begin(), ::toupper);
-			}
-
-			if (!LineDataLeft.empty())
-				LeftLines.push_back(LineDataLeft);
-			if (!LineDataRight.empty())
-				RightLines.push_back(LineDataRight);
-		}
+		Op = OP_TRIVIAL;
 	}
-	if (LeftLines != RightLines)
-		return;
-	//only difference is trival
-	Op = OP_TRIVIAL;
 }
 
 /**
@@ -679,6 +351,31 @@ void CDiffWrapper::SetAlternativePaths(const PathContext &altPaths)
 	m_alternativePaths = altPaths;
 }
 
+/**
+ * @brief Set texts to diff in memory instead of reading the files.
+ * The paths set with SetPaths() are then only names for diffutils. Texts
+ * are in the codepage set with SetCodepage() or in UTF-8, and each of them
+ * ends with DiffFileData::TextSlack chars of room for diffutils. Prediffer
+ * plugins work on files, so texts can be used only if CanDiffTexts().
+ * @param [in] texts Texts of the files, or NULL to diff the files again.
+ */
+void CDiffWrapper::SetTexts(std::string * texts)
+{
+	assert(texts == NULL || CanDiffTexts());
+	m_pTexts = texts;
+}
+
+/**
+ * @brief Can files be diffed from texts in memory?
+ * @return false if a prediffer plugin may need the files.
+ */
+bool CDiffWrapper::CanDiffTexts() const
+{
+	if (!m_bPluginsEnabled || !m_infoPrediffer)
+		return true;
+	return !m_infoPrediffer->bToBeScanned && m_infoPrediffer->pluginName.empty();
+}
+
 /**
  * @brief Runs diff-engine.
  */
@@ -700,7 +397,7 @@ bool CDiffWrapper::RunFileDiff()
 
 	for (file = 0; file < files.GetSize(); file++)
 	{
-		if (m_bPluginsEnabled)
+		if (m_bPluginsEnabled && !m_pTexts)
 		{
 			// Do the preprocessing now, overwrite the temp files
 			// NOTE: FileTransform_UCS2ToUTF8() may create new temp
@@ -732,13 +429,15 @@ bool CDiffWrapper::RunFileDiff()
 	struct change *script10 = NULL;
 	struct change *script12 = NULL;
 	DiffFileData diffdata, diffdata10, diffdata12;
+	std::string middleText;
 	int bin_flag = 0, bin_flag10 = 0, bin_flag12 = 0;
 
 	if (files.GetSize() == 2)
 	{
 		diffdata.SetDisplayFilepaths(files[0], files[1]); // store true names for diff utils patch file
 		// This opens & fstats both files (if it succeeds)
-		if (!diffdata.OpenFiles(strFileTemp[0], strFileTemp[1]))
+		if (m_pTexts ? !diffdata.OpenTexts(m_pTexts[0], m_pTexts[1]) :
+			!diffdata.OpenFiles(strFileTemp[0], strFileTemp[1]))
 		{
 			return false;
 		}
@@ -772,19 +471,28 @@ bool CDiffWrapper::RunFileDiff()
 		diffdata10.SetDisplayFilepaths(files[1], files[0]); // store true names for diff utils patch file
 		diffdata12.SetDisplayFilepaths(files[1], files[2]); // store true names for diff utils patch file
 
-		if (!diffdata10.OpenFiles(strFileTemp[1], strFileTemp[0]))
+		// Both pairs are diffed at the same time, and diffutils writes to
+		// the texts, so the second pair gets a copy of the middle text
+		if (m_pTexts)
+			middleText = m_pTexts[1];
+
+		if (m_pTexts ? !diffdata10.OpenTexts(m_pTexts[1], m_pTexts[0]) :
+			!diffdata10.OpenFiles(strFileTemp[1], strFileTemp[0]))
 		{
 			return false;
 		}
 
-		bRet = Diff2Files(&script10, &diffdata10, &bin_flag10, NULL);
-
-		if (!diffdata12.OpenFiles(strFileTemp[1], strFileTemp[2]))
+		if (m_pTexts ? !diffdata12.OpenTexts(middleText, m_pTexts[2]) :
+			!diffdata12.OpenFiles(strFileTemp[1], strFileTemp[2]))
 		{
 			return false;
 		}
 
-		bRet = Diff2Files(&script12, &diffdata12, &bin_flag12, NULL);
+		bRet = Diff3Pairs(m_options, (m_pMovedLines[0] != NULL),
+				diffdata10.m_inf, diffdata12.m_inf, &script10, &script12,
+				&bin_flag10, &bin_flag12);
+		CopyDiffutilTextStats(diffdata10.m_inf, &diffdata10);
+		CopyDiffutilTextStats(diffdata12.m_inf, &diffdata12);
 	}
 
 	// First determine what happened during comparison
@@ -1148,9 +856,10 @@ CDiffWrapper::FreeDiffUtilsScript3(struct change * & script10, struct change * &
  * @param [in] StartPos First line of the difference.
  * @param [in] endPos Last line of the difference.
  * @param [in] FileNo File to match.
+ * @param [in,out] cache Results of lines already matched in this diff.
  * return true if any of the expressions matches.
  */
-bool CDiffWrapper::RegExpFilter(int StartPos, int EndPos, int FileNo) const
+bool CDiffWrapper::RegExpFilter(int StartPos, int EndPos, int FileNo, FilterMatchCache & cache) const
 {
 	if (m_pFilterList == NULL)
 	{	
@@ -1167,7 +876,10 @@ bool CDiffWrapper::RegExpFilter(int StartPos, int EndPos, int FileNo) const
 		size_t len = files[FileNo].linbuf[line + 1] - files[FileNo].linbuf[line];
 		const char *string = files[FileNo].linbuf[line];
 		size_t stringlen = linelen(string, len);
-		if (!m_pFilterList->Match(std::string(string, stringlen), m_codepage))
+		// Lines of same equivalence class are mostly same text, match them once
+		int eqclass = (files[FileNo].equivs && line < files[FileNo].buffered_lines) ?
+			files[FileNo].equivs[line] : -1;
+		if (!cache.Match(*m_pFilterList, eqclass, string, stringlen, m_codepage))
 
 		{
 			linesMatch = false;
@@ -1181,7 +893,7 @@ bool CDiffWrapper::RegExpFilter(int StartPos, int EndPos, int FileNo) const
  * @brief Walk the diff utils change script, building the WinMerge list of diff blocks
  */
 void
-CDiffWrapper::LoadWinMergeDiffsFromDiffUtilsScript(struct change * script, const file_data * inf)
+CDiffWrapper::LoadWinMergeDiffsFromDiffUtilsScript(struct change * script, file_data * inf)
 {
 	//Logic needed for Ignore comment option
 	DIFFOPTIONS options;
@@ -1197,9 +909,11 @@ CDiffWrapper::LoadWinMergeDiffsFromDiffUtilsScript(struct change * script, const
 			std::transform(LowerCaseExt.begin(), LowerCaseExt.end(), LowerCaseExt.begin(), ::tolower);
 			asLwrCaseExt = LowerCaseExt;
 		}
+		ClassifyCommentLines(inf, asLwrCaseExt);
 	}
 
 	struct change *next = script;
+	FilterMatchCache filterCache;
 	
 	while (next)
 	{
@@ -1278,9 +992,9 @@ CDiffWrapper::LoadWinMergeDiffsFromDiffUtilsScript(struct change * script, const
 					// Our strategy is that every line in both sides must
 					// match regexp before we mark difference as ignored.
 					bool match2 = false;
-					bool match1 = RegExpFilter(thisob->line0, thisob->line0 + QtyLinesLeft, 0);
+					bool match1 = RegExpFilter(thisob->line0, thisob->line0 + QtyLinesLeft, 0, filterCache);
 					if (match1)
-						match2 = RegExpFilter(thisob->line1, thisob->line1 + QtyLinesRight, 1);
+						match2 = RegExpFilter(thisob->line1, thisob->line1 + QtyLinesRight, 1, filterCache);
 					if (match1 && match2)
 						op = OP_TRIVIAL;
 				}
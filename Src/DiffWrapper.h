@@ -38,9 +38,9 @@ struct DiffFileData;
 class PathContext;
 struct file_data;
 class FilterCommentsManager;
-struct FilterCommentsSet;
 class MovedLines;
 class FilterList;
+class FilterMatchCache;
 
 /** @enum COMPARE_TYPE
  * @brief Different foldercompare methods.
@@ -183,6 +183,8 @@ public:
 	void SetPaths(const PathContext &files, bool tempPaths);
 	void SetAlternativePaths(const PathContext &altPaths);
 	void SetCodepage(int codepage) { m_codepage = codepage; }
+	void SetTexts(std::string * texts);
+	bool CanDiffTexts() const;
 	bool RunFileDiff();
 	void GetDiffStatus(DIFFSTATUS *status) const;
 	void AddDiffRange(DiffList *pDiffList, unsigned begin0, unsigned end0, unsigned begin1, unsigned end1, OP_TYPE op);
@@ -195,14 +197,7 @@ public:
 	void SetFilterList(const String& filterStr);
 	void SetFilterCommentsManager(const FilterCommentsManager *pFilterCommentsManager) { m_pFilterCommentsManager = pFilterCommentsManager; };
 	void EnablePlugins(bool enable);
-	bool IsTrivialBytes(const char* Start, const char* End,
-		const FilterCommentsSet& filtercommentsset) const;
-	bool IsTrivialLine(const std::string &Line, const char * StartOfComment,
-	   const char * EndOfComment, const char * InLineComment,
-	   const FilterCommentsSet& filtercommentsset) const;
-	bool PostFilter(int StartPos, int EndPos, int Direction,
-		int QtyLinesInBlock, OP_TYPE &Op, int FileNo,
-		FilterCommentsSet& filtercommentsset) const;
+	void ClassifyCommentLines(file_data * inf, const String& FileNameExt) const;
 	void PostFilter(int LineNumberLeft, int QtyLinesLeft, int LineNumberRight,
 		int QtyLinesRight, OP_TYPE &Op, const String& FileNameExt) const;
 
@@ -210,14 +205,14 @@ protected:
 	String FormatSwitchString() const;
 	bool Diff2Files(struct change ** diffs, DiffFileData *diffData,
 		int * bin_status, int * bin_file) const;
-	void LoadWinMergeDiffsFromDiffUtilsScript(struct change * script, const file_data * inf);
+	void LoadWinMergeDiffsFromDiffUtilsScript(struct change * script, file_data * inf);
 	void WritePatchFile(struct change * script, file_data * inf);
 public:
 	void LoadWinMergeDiffsFromDiffUtilsScript3(
 		struct change * script10, struct change * script12,
 		const file_data * inf10, const file_data * inf12);
 	void FreeDiffUtilsScript3(struct change * & script10, struct change * & script12);
-	bool RegExpFilter(int StartPos, int EndPos, int FileNo) const;
+	bool RegExpFilter(int StartPos, int EndPos, int FileNo, FilterMatchCache & cache) const;
 
 private:
 	DiffutilsOptions m_options;
@@ -229,6 +224,7 @@ private:
 
 	String m_sPatchFile; /**< Full path to created patch file. */
 	bool m_bPathsAreTemp; /**< Are compared paths temporary? */
+	std::string * m_pTexts; /**< Texts diffed instead of the files, or NULL. */
 	/// prediffer info are stored only for MergeDoc
 	std::unique_ptr<PrediffingInfo> m_infoPrediffer;
 	/// prediffer info are stored only for MergeDoc
@@ -14,6 +14,7 @@
 //
 
 #include "DirActions.h"
+#include <cassert>
 #include "MergeApp.h"
 #include "UnicodeString.h"
 #include "7zCommon.h"
@@ -1254,7 +1255,7 @@ void ExpandSubdirs(CDiffContext& ctxt, DIFFITEM& dip)
 	while (diffpos)
 	{
 		DIFFITEM &di = ctxt.GetNextDiffRefPosition(diffpos);
-		if (!di.IsAncestor(&dip))
+		if (!ctxt.IsAncestorDiff(di, &dip))
 			break;
 		if (di.HasChildren())
 			di.customFlags1 |= ViewCustomFlags::EXPANDED;
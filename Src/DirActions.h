@@ -311,7 +311,7 @@ struct DirActions
 	bool IsItemEditableEncoding(const DIFFITEM& di) const
 	{
 		const int index = SideToIndex(m_ctxt, src);
-		return (di.diffcode.diffcode != 0 && di.diffcode.exists(index) && di.diffFileInfo[index].IsEditableEncoding());
+		return (di.diffcode.diffcode != 0 && di.diffcode.exists(index) && di.IsEditableEncoding(index));
 	}
 
 	bool IsItemNavigableDiff(const DIFFITEM& di) const
@@ -711,7 +711,7 @@ IntToIntMap CountCodepages(const InputIterator& begin, const InputIterator& end,
 		for (int i = 0; i < ctxt.GetCompareDirs(); ++i)
 		{
 			if (di.diffcode.diffcode != 0 && di.diffcode.exists(i))
-				map.Increment(di.diffFileInfo[i].encoding.m_codepage);
+				map.Increment(di.GetEncoding(i).m_codepage);
 		}
 	}
 	return map;
@@ -731,9 +731,11 @@ void ApplyCodepage(const InputIterator& begin, const InputIterator& end, CDiffCo
 		for (int i = 0; i < ctxt.GetCompareDirs(); ++i)
 		{
 			// Does it exist on left? (ie, right or both)
-			if (affect[i] && di.diffcode.exists(i) && di.diffFileInfo[i].IsEditableEncoding())
+			if (affect[i] && di.diffcode.exists(i) && di.IsEditableEncoding(i))
 			{
-				di.diffFileInfo[i].encoding.SetCodepage(nCodepage);
+				FileTextEncoding encoding = di.GetEncoding(i);
+				encoding.SetCodepage(nCodepage);
+				di.SetEncoding(i, encoding);
 			}
 		}
 	}
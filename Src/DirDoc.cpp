@@ -49,6 +49,10 @@
 #include "FileFilterHelper.h"
 #include "unicoder.h"
 #include "DirActions.h"
+#include "CompareResultCache.h"
+#include "DirWatcher.h"
+#include "DirReportWriter.h"
+#include "DirScan.h"
 
 #ifdef _DEBUG
 #define new DEBUG_NEW
@@ -89,6 +93,7 @@ CDirDoc::CDirDoc()
  */
 CDirDoc::~CDirDoc()
 {
+	m_pDirWatcher.reset();
 	// Inform all of our merge docs that we're closing
 	for (auto pMergeDoc : m_MergeDocs)
 		pMergeDoc->DirDocClosing(this);
@@ -152,6 +157,8 @@ void CDirDoc::InitCompare(const PathContext & paths, bool bRecursive, CTempPathC
 		m_diffThread.Abort();
 		Sleep(50);
 	}
+	m_pDirWatcher.reset();
+	m_pReportWriter.reset();
 
 	m_pDirView->DeleteAllDisplayItems();
 	// Anything that can go wrong here will yield an exception.
@@ -214,6 +221,11 @@ void CDirDoc::DiffThreadCallback(int& state)
 	PostMessage(m_pDirView->GetSafeHwnd(), MSG_UI_UPDATE, state, false);
 }
 
+void CDirDoc::DirWatcherCallback(int& state)
+{
+	PostMessage(m_pDirView->GetSafeHwnd(), MSG_DIR_CHANGED, state, false);
+}
+
 /**
  * @brief Perform directory comparison again from scratch
  */
@@ -250,10 +262,18 @@ void CDirDoc::Rescan()
 	m_pCtxt->m_bIgnoreSmallTimeDiff = GetOptionsMgr()->GetBool(OPT_IGNORE_SMALL_FILETIME);
 	m_pCtxt->m_bStopAfterFirstDiff = GetOptionsMgr()->GetBool(OPT_CMP_STOP_AFTER_FIRST);
 	m_pCtxt->m_nQuickCompareLimit = GetOptionsMgr()->GetInt(OPT_CMP_QUICK_LIMIT);
+	m_pCtxt->m_nStreamingDiffMemory = GetOptionsMgr()->GetInt(OPT_CMP_STREAMING_DIFF_MEMORY);
 	m_pCtxt->m_bPluginsEnabled = GetOptionsMgr()->GetBool(OPT_PLUGINS_ENABLED);
 	m_pCtxt->m_bWalkUniques = GetOptionsMgr()->GetBool(OPT_CMP_WALK_UNIQUE_DIRS);
 	m_pCtxt->m_bIgnoreReparsePoints = GetOptionsMgr()->GetBool(OPT_CMP_IGNORE_REPARSE_POINTS);
 	m_pCtxt->m_bIgnoreCodepage = GetOptionsMgr()->GetBool(OPT_CMP_IGNORE_CODEPAGE);
+	m_pCtxt->m_bPipelinedCollect = GetOptionsMgr()->GetBool(OPT_CMP_PIPELINED_COLLECT);
+	m_pCtxt->m_nCpuCompareThreads = GetOptionsMgr()->GetInt(OPT_CMP_CPU_THREADS);
+	m_pCtxt->m_nIoCompareThreads = GetOptionsMgr()->GetInt(OPT_CMP_IO_THREADS);
+	m_pCtxt->m_nMaxLocalVolumeReads = GetOptionsMgr()->GetInt(OPT_CMP_MAX_LOCAL_VOLUME_READS);
+	m_pCtxt->m_nMaxRemoteVolumeReads = GetOptionsMgr()->GetInt(OPT_CMP_MAX_REMOTE_VOLUME_READS);
+	m_pCtxt->m_nLargeFileLimit = static_cast<int64_t>(GetOptionsMgr()->GetInt(OPT_CMP_LARGE_FILE_LIMIT_MB)) * 1024 * 1024;
+	m_pCtxt->m_nMaxLargeFileCompares = GetOptionsMgr()->GetInt(OPT_CMP_MAX_LARGE_FILE_COMPARES);
 	m_pCtxt->m_pCompareStats = m_pCompareStats.get();
 
 	// Set total items count since we don't collect items
@@ -275,10 +295,54 @@ void CDirDoc::Rescan()
 	
 	m_pCtxt->m_pFilterCommentsManager = theApp.m_pFilterCommentsManager.get();
 
+	// Unchanged file pairs are answered from result cache
+	m_pCtxt->m_pCompareResultCache = theApp.GetCompareResultCache();
+	if (m_pCtxt->m_pCompareResultCache)
+	{
+		m_pCtxt->m_nCompareOptionsHash = CompareResultCache::HashCompareOptions(m_pCtxt.get());
+		m_pCtxt->m_compareResultCacheStats.Reset();
+	}
+
 	// Show current compare method name and active filter name in statusbar
 	pf->SetFilterStatusDisplay(theApp.m_pGlobalFileFilter->GetFilterNameOrMask().c_str());
 	pf->SetCompareMethodStatusDisplay(m_pCtxt->GetCompareMethod());
 
+	// Keep results up to date with changes in compared folders
+	if (!m_bMarkedRescan)
+	{
+		if (GetOptionsMgr()->GetBool(OPT_CMP_WATCH_FOLDERS))
+		{
+			if (!m_pDirWatcher)
+			{
+				m_pDirWatcher.reset(new DirWatcher());
+				m_pDirWatcher->AddListener(this, &CDirDoc::DirWatcherCallback);
+			}
+			m_pDirWatcher->Start(m_pCtxt->GetNormalizedPaths(), GetOptionsMgr()->GetInt(OPT_CMP_WATCH_POLL_INTERVAL));
+		}
+		else
+			m_pDirWatcher.reset();
+	}
+
+	// CSV, XML and JSON Lines reports of batch jobs (and JSON Lines reports
+	// always) are written by the compare thread as items are compared,
+	// without filling the view
+	m_pCtxt->m_pReportWriter = NULL;
+	m_pReportWriter.reset();
+	DirReportWriter::Format format;
+	if (!m_bMarkedRescan && !m_sReportFile.empty() &&
+		DirReportWriter::GetFormatFromFilename(m_sReportFile, format) &&
+		(format == DirReportWriter::FORMAT_JSONL || theApp.m_bNonInteractive))
+	{
+		m_pReportWriter.reset(new DirReportWriter());
+		if (m_pReportWriter->Open(m_sReportFile, format, m_pCtxt.get()))
+		{
+			m_pCtxt->m_pReportWriter = m_pReportWriter.get();
+			m_sReportFile.clear();
+		}
+		else
+			m_pReportWriter.reset();
+	}
+
 	// Folder names to compare are in the compare context
 	m_diffThread.SetContext(m_pCtxt.get());
 	m_diffThread.RemoveListener(this, &CDirDoc::DiffThreadCallback);
@@ -288,6 +352,53 @@ void CDirDoc::Rescan()
 	m_bMarkedRescan = FALSE;
 }
 
+/**
+ * @brief Rescan items changed in compared folders.
+ * Items changed since the previous compare, as noticed by the folder
+ * watcher, are marked and compared again in the compare thread, and
+ * folder results are updated. If changes were lost (too many at once),
+ * whole compare is done again.
+ * @return true if rescan was started.
+ */
+bool CDirDoc::RescanChangedItems()
+{
+	if (!m_pCtxt || !m_pDirWatcher)
+		return false;
+	// Changes are kept until current compare is ready
+	if (m_diffThread.GetThreadState() == CDiffThread::THREAD_COMPARING)
+		return false;
+
+	std::vector<String> changes[3];
+	bool bOverflow = false;
+	if (!m_pDirWatcher->GetChanges(changes, bOverflow))
+		return false;
+	if (bOverflow)
+	{
+		Rescan();
+		return true;
+	}
+
+	std::vector<uintptr_t> folders;
+	int nItems = 0;
+	for (int nIndex = 0; nIndex < m_nDirs; ++nIndex)
+		nItems += DirScan_MarkChangedItems(m_pCtxt.get(), nIndex, changes[nIndex], folders);
+	if (nItems == 0 && folders.empty())
+		return false;
+
+	m_diffThread.SetChangedFolders(folders);
+	SetMarkedRescan();
+	Rescan();
+	return true;
+}
+
+/**
+ * @brief Has folder watcher noticed changes not rescanned yet?
+ */
+bool CDirDoc::HasChangedItems() const
+{
+	return m_pDirWatcher && m_pDirWatcher->HasChanges();
+}
+
 /**
  * @brief Empty & reload listview (of files & columns) with comparison results
  * @todo Better solution for special items ("..")?
@@ -454,6 +565,9 @@ void CDirDoc::UpdateChangedItem(PathContext &paths,
  */
 void CDirDoc::CompareReady()
 {
+	m_pReportWriter.reset();
+	if (m_pCtxt && m_pCtxt->m_pCompareResultCache)
+		m_pCtxt->m_pCompareResultCache->Save();
 }
 
 /**
@@ -31,6 +31,8 @@
 #include "PluginManager.h"
 
 class CDirView;
+class DirWatcher;
+class DirReportWriter;
 struct IMergeDoc;
 typedef CTypedPtrList<CPtrList, IMergeDoc *> MergeDocPtrList;
 class DirDocFilterGlobal;
@@ -81,7 +83,10 @@ public:
 public:
 	void InitCompare(const PathContext & paths, bool bRecursive, CTempPathContext *);
 	void DiffThreadCallback(int& state);
+	void DirWatcherCallback(int& state);
 	void Rescan();
+	bool RescanChangedItems();
+	bool HasChangedItems() const;
 	bool GetReadOnly(int nIndex) const;
 	const bool *GetReadOnly(void) const;
 	void SetReadOnly(int nIndex, bool bReadOnly);
@@ -136,6 +141,8 @@ private:
 	String m_sReportFile;
 	PluginManager m_pluginman;
 	bool m_bMarkedRescan; /**< If TRUE next rescan scans only marked items */
+	std::unique_ptr<DirWatcher> m_pDirWatcher; /**< Watches compared folders for changes, or NULL */
+	std::unique_ptr<DirReportWriter> m_pReportWriter; /**< Writes report while comparing, or NULL */
 };
 
 //{{AFX_INSERT_LOCATION}}
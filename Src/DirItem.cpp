@@ -136,6 +136,5 @@ void DirItem::ClearPartial()
 	ctime = 0;
 	mtime = 0;
 	size = -1;
-	version.Clear();
 	flags.reset();
 }
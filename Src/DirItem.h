@@ -21,16 +21,11 @@
  */
 #pragma once
 
-#ifdef _MSC_VER
-#pragma warning(disable: 4520)
-#endif
-
 #define POCO_NO_UNWINDOWS 1
 #include <Poco/File.h>
 #include <Poco/Timestamp.h>
-#include <boost/flyweight.hpp>
 #include "UnicodeString.h"
-#include "FileVersion.h"
+#include "PooledString.h"
 
 /**
  * @brief Class for fileflags.
@@ -47,7 +42,6 @@ struct FileFlags
  * @brief Information for file.
  * This class stores basic information from a file or folder.
  * Information consists of item name, times, size and attributes.
- * Also version info can be get for files supporting it.
  *
  * @note times in are seconds since January 1, 1970.
  * See Dirscan.cpp/fentry and Dirscan.cpp/LoadFiles()
@@ -57,9 +51,8 @@ struct DirItem
 	Poco::Timestamp ctime; /**< time of creation */
 	Poco::Timestamp mtime; /**< time of last modify */
 	Poco::File::FileSize size; /**< file size in bytes, -1 means file does not exist*/
-	boost::flyweight<String> filename; /**< filename for this item */
-	boost::flyweight<String> path; /**< full path (excluding filename) for the item */
-	FileVersion version; /**< string of fixed file version, eg, 1.2.3.4 */
+	PooledString filename; /**< filename for this item */
+	PooledPath path; /**< full path (excluding filename) for the item */
 	FileFlags flags; /**< file attributes */
 
 	DirItem() : ctime(0), mtime(0), size(-1) { }
@@ -0,0 +1,421 @@
+/**
+ * @file  DirReportWriter.cpp
+ *
+ * @brief Implementation file for DirReportWriter
+ */
+
+#include "DirReportWriter.h"
+#include <cstdio>
+#include <Poco/DateTime.h>
+#include <Poco/Exception.h>
+#include "DiffContext.h"
+#include "DiffItem.h"
+#include "paths.h"
+#include "unicoder.h"
+
+static const char *const SideNames[2][3] =
+{
+	{ "left", "right", NULL },
+	{ "left", "middle", "right" },
+};
+
+static const char *const SizeFields[2][3] =
+{
+	{ "left_size", "right_size", NULL },
+	{ "left_size", "middle_size", "right_size" },
+};
+
+static const char *const TimeFields[2][3] =
+{
+	{ "left_mtime", "right_mtime", NULL },
+	{ "left_mtime", "middle_mtime", "right_mtime" },
+};
+
+/**
+ * @brief Return result of item as written to report.
+ * Checks are in the same order as in the Result column of the folder
+ * compare view.
+ */
+static const TCHAR *GetResultName(const DIFFCODE& diffcode, int nDirs)
+{
+	if (diffcode.isResultError())
+		return _T("error");
+	if (diffcode.isResultAbort())
+		return _T("aborted");
+	if (diffcode.isResultFiltered())
+		return _T("skipped");
+	if (!diffcode.existAll(nDirs))
+		return _T("unique");
+	if (diffcode.isResultSame())
+		return _T("identical");
+	if (diffcode.isResultDiff())
+		return _T("different");
+	return _T("notcompared");
+}
+
+DirReportWriter::DirReportWriter()
+: m_format(FORMAT_CSV)
+, m_pCtxt(NULL)
+, m_nItems(0)
+, m_bFirstField(true)
+, m_nUsed(0)
+{
+}
+
+DirReportWriter::~DirReportWriter()
+{
+	Close();
+}
+
+/**
+ * @brief Get report format from extension of report file.
+ * @param [in] sReportFile Path to report file.
+ * @param [out] format Format for .csv, .xml or .jsonl file.
+ * @return false if extension is not one of the supported formats.
+ */
+bool DirReportWriter::GetFormatFromFilename(const String& sReportFile, Format& format)
+{
+	String ext = string_makelower(paths_FindExtension(sReportFile));
+	if (ext == _T(".csv"))
+		format = FORMAT_CSV;
+	else if (ext == _T(".xml"))
+		format = FORMAT_XML;
+	else if (ext == _T(".jsonl"))
+		format = FORMAT_JSONL;
+	else
+		return false;
+	return true;
+}
+
+/**
+ * @brief Create report file and write its header.
+ * @param [in] sReportFile Path to report file, existing file is overwritten.
+ * @param [in] format Format of the report.
+ * @param [in] pCtxt Compare context of items written to report.
+ * @return false if file could not be created.
+ */
+bool DirReportWriter::Open(const String& sReportFile, Format format, const CDiffContext *pCtxt)
+{
+	Close();
+	try
+	{
+		paths_CreateIfNeeded(paths_GetParentPath(sReportFile));
+		m_pStream.reset(new Poco::FileOutputStream(ucr::toUTF8(sReportFile),
+			std::ios::out | std::ios::binary | std::ios::trunc));
+	}
+	catch (Poco::Exception&)
+	{
+		m_pStream.reset();
+		return false;
+	}
+	m_format = format;
+	m_pCtxt = pCtxt;
+	m_nItems = 0;
+	m_nUsed = 0;
+	WriteHeader();
+	return true;
+}
+
+/**
+ * @brief Write footer and close report file.
+ * @return false if writing to file failed.
+ */
+bool DirReportWriter::Close()
+{
+	if (!m_pStream)
+		return true;
+	WriteFooter();
+	Flush();
+	m_pStream->close();
+	bool bSucceeded = m_pStream->good();
+	m_pStream.reset();
+	return bSucceeded;
+}
+
+/**
+ * @brief Write one compared item to report.
+ * @param [in] di Item, its result must not change any more.
+ */
+void DirReportWriter::WriteItem(const DIFFITEM& di)
+{
+	const int nDirs = m_pCtxt->GetCompareDirs();
+	const int nTable = nDirs - 2;
+	int nIndex = 0;
+	while (nIndex < nDirs - 1 && !di.diffcode.exists(nIndex))
+		++nIndex;
+	const DirItem& dfi = di.diffFileInfo[nIndex];
+
+	m_bFirstField = true;
+	if (m_format == FORMAT_XML)
+		Put("<item");
+	else if (m_format == FORMAT_JSONL)
+		Put('{');
+
+	BeginField("path");
+	PutText(dfi.path.get().empty() ? dfi.filename.get() : paths_ConcatPath(dfi.path, dfi.filename));
+	EndField();
+	BeginField("type");
+	PutText(di.diffcode.isDirectory() ? _T("folder") : _T("file"));
+	EndField();
+	BeginField("result");
+	PutText(GetResultName(di.diffcode, nDirs));
+	EndField();
+	if (di.nsdiffs >= 0 || m_format == FORMAT_CSV)
+	{
+		BeginField("differences");
+		if (di.nsdiffs >= 0)
+			PutNumber(di.nsdiffs);
+		EndField();
+	}
+	if (di.nidiffs >= 0 || m_format == FORMAT_CSV)
+	{
+		BeginField("ignored");
+		if (di.nidiffs >= 0)
+			PutNumber(di.nidiffs);
+		EndField();
+	}
+	for (nIndex = 0; nIndex < nDirs; ++nIndex)
+	{
+		const DirItem& side = di.diffFileInfo[nIndex];
+		bool bExists = di.diffcode.exists(nIndex);
+		bool bSize = bExists && !di.diffcode.isDirectory();
+		bool bTime = bExists && side.mtime != 0;
+		if (bSize || m_format == FORMAT_CSV)
+		{
+			BeginField(SizeFields[nTable][nIndex]);
+			if (bSize)
+				PutNumber(static_cast<int64_t>(side.size));
+			EndField();
+		}
+		if (bTime || m_format == FORMAT_CSV)
+		{
+			BeginField(TimeFields[nTable][nIndex]);
+			if (bTime)
+				PutTime(side.mtime.epochMicroseconds());
+			EndField();
+		}
+	}
+
+	if (m_format == FORMAT_XML)
+		Put("/>\n");
+	else if (m_format == FORMAT_JSONL)
+		Put("}\n");
+	else
+		Put("\r\n");
+	++m_nItems;
+}
+
+/**
+ * @brief Write all items of compare context to report.
+ */
+void DirReportWriter::WriteAll()
+{
+	uintptr_t pos = m_pCtxt->GetFirstDiffPosition();
+	while (pos)
+		WriteItem(m_pCtxt->GetNextDiffPosition(pos));
+}
+
+void DirReportWriter::WriteHeader()
+{
+	const int nDirs = m_pCtxt->GetCompareDirs();
+	if (m_format == FORMAT_CSV)
+	{
+		Put("path,type,result,differences,ignored");
+		for (int nIndex = 0; nIndex < nDirs; ++nIndex)
+		{
+			Put(',');
+			Put(SizeFields[nDirs - 2][nIndex]);
+			Put(',');
+			Put(TimeFields[nDirs - 2][nIndex]);
+		}
+		Put("\r\n");
+	}
+	else if (m_format == FORMAT_XML)
+	{
+		Put("<?xml version=\"1.0\" encoding=\"UTF-8\"?>\n<WinMergeFolderCompare");
+		for (int nIndex = 0; nIndex < nDirs; ++nIndex)
+		{
+			BeginField(SideNames[nDirs - 2][nIndex]);
+			PutText(m_pCtxt->GetNormalizedPath(nIndex));
+			EndField();
+		}
+		Put(">\n");
+	}
+}
+
+void DirReportWriter::WriteFooter()
+{
+	if (m_format == FORMAT_XML)
+		Put("</WinMergeFolderCompare>\n");
+}
+
+/**
+ * @brief Write buffered output to file.
+ */
+void DirReportWriter::Flush()
+{
+	if (m_nUsed > 0)
+		m_pStream->write(m_buffer, m_nUsed);
+	m_nUsed = 0;
+}
+
+void DirReportWriter::Put(const char *psz)
+{
+	while (*psz)
+		Put(*psz++);
+}
+
+/**
+ * @brief Write field name, or separator in CSV.
+ */
+void DirReportWriter::BeginField(const char *pszName)
+{
+	switch (m_format)
+	{
+	case FORMAT_CSV:
+		if (!m_bFirstField)
+			Put(',');
+		break;
+	case FORMAT_XML:
+		Put(' ');
+		Put(pszName);
+		Put("=\"");
+		break;
+	case FORMAT_JSONL:
+		if (!m_bFirstField)
+			Put(',');
+		Put('"');
+		Put(pszName);
+		Put("\":");
+		break;
+	}
+	m_bFirstField = false;
+}
+
+void DirReportWriter::EndField()
+{
+	if (m_format == FORMAT_XML)
+		Put('"');
+}
+
+/**
+ * @brief Write string value as UTF-8, quoted and escaped as the format needs.
+ * Characters that cannot be written are replaced with U+FFFD: unpaired
+ * surrogates in all formats and control characters other than tab, CR
+ * and LF in XML, where they are not allowed even as references.
+ * The ANSI build writes '?' for the control characters instead.
+ */
+void DirReportWriter::PutText(const String& str)
+{
+	bool bQuote = false;
+	if (m_format == FORMAT_JSONL)
+		bQuote = true;
+	else if (m_format == FORMAT_CSV)
+		bQuote = str.find_first_of(_T(",\"\r\n")) != String::npos;
+	if (bQuote)
+		Put('"');
+
+	const TCHAR *p = str.c_str();
+	const TCHAR *pEnd = p + str.length();
+	while (p < pEnd)
+	{
+		unsigned ch = static_cast<unsigned>(*p++);
+#ifdef _UNICODE
+		ch &= 0xffff;
+		if (ch >= 0xd800 && ch < 0xdc00 && p < pEnd && (*p & 0xfc00) == 0xdc00)
+			ch = 0x10000 + ((ch - 0xd800) << 10) + (*p++ & 0x3ff);
+		else if (ch >= 0xd800 && ch < 0xe000)
+			ch = 0xfffd;
+#else
+		ch &= 0xff; // Already UTF-8
+#endif
+		switch (ch)
+		{
+		case '"':
+			if (m_format == FORMAT_CSV)
+				Put("\"\"");
+			else if (m_format == FORMAT_XML)
+				Put("&quot;");
+			else
+				Put("\\\"");
+			continue;
+		case '&':
+			Put(m_format == FORMAT_XML ? "&amp;" : "&");
+			continue;
+		case '<':
+			Put(m_format == FORMAT_XML ? "&lt;" : "<");
+			continue;
+		case '>':
+			Put(m_format == FORMAT_XML ? "&gt;" : ">");
+			continue;
+		case '\\':
+			Put(m_format == FORMAT_JSONL ? "\\\\" : "\\");
+			continue;
+		}
+		if (ch < 0x20 && m_format == FORMAT_XML && ch != '\t' && ch != '\r' && ch != '\n')
+		{
+#ifdef _UNICODE
+			ch = 0xfffd;
+#else
+			ch = '?';
+#endif
+		}
+		if (ch < 0x20 && m_format != FORMAT_CSV)
+		{
+			char buf[8];
+			sprintf(buf, m_format == FORMAT_XML ? "&#%u;" : "\\u%04x", ch);
+			Put(buf);
+		}
+#ifdef _UNICODE
+		else if (ch < 0x80)
+			Put(static_cast<char>(ch));
+		else if (ch < 0x800)
+		{
+			Put(static_cast<char>(0xc0 | (ch >> 6)));
+			Put(static_cast<char>(0x80 | (ch & 0x3f)));
+		}
+		else if (ch < 0x10000)
+		{
+			Put(static_cast<char>(0xe0 | (ch >> 12)));
+			Put(static_cast<char>(0x80 | ((ch >> 6) & 0x3f)));
+			Put(static_cast<char>(0x80 | (ch & 0x3f)));
+		}
+		else
+		{
+			Put(static_cast<char>(0xf0 | (ch >> 18)));
+			Put(static_cast<char>(0x80 | ((ch >> 12) & 0x3f)));
+			Put(static_cast<char>(0x80 | ((ch >> 6) & 0x3f)));
+			Put(static_cast<char>(0x80 | (ch & 0x3f)));
+		}
+#else
+		else
+			Put(static_cast<char>(ch));
+#endif
+	}
+
+	if (bQuote)
+		Put('"');
+}
+
+void DirReportWriter::PutNumber(int64_t n)
+{
+	char buf[24];
+	sprintf(buf, "%lld", static_cast<long long>(n));
+	Put(buf);
+}
+
+/**
+ * @brief Write time as ISO 8601 UTC time, e.g. 2016-05-08T12:30:00Z.
+ */
+void DirReportWriter::PutTime(int64_t nMicroseconds)
+{
+	Poco::DateTime dt((Poco::Timestamp(nMicroseconds)));
+	char buf[32];
+	sprintf(buf, "%04d-%02d-%02dT%02d:%02d:%02dZ", dt.year(), dt.month(), dt.day(),
+		dt.hour(), dt.minute(), dt.second());
+	if (m_format == FORMAT_JSONL)
+		Put('"');
+	Put(buf);
+	if (m_format == FORMAT_JSONL)
+		Put('"');
+}
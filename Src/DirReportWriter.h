@@ -0,0 +1,84 @@
+/**
+ * @file  DirReportWriter.h
+ *
+ * @brief Declaration file for DirReportWriter
+ */
+#pragma once
+
+#include <memory>
+#include <cstdint>
+#define POCO_NO_UNWINDOWS 1
+#include <Poco/FileStream.h>
+#include "UnicodeString.h"
+
+class CDiffContext;
+struct DIFFITEM;
+
+/**
+ * @brief Writes folder compare results to a report file as they complete.
+ *
+ * Unlike DirCmpReport, which reads the folder compare view after the
+ * compare, rows are written straight from compare context items and the
+ * GUI is not needed. Items are encoded as UTF-8 into a fixed size buffer
+ * which is written to the file whenever it fills up, so memory use does
+ * not depend on the number of items.
+ *
+ * Every row has the relative path, type and compare result of the item,
+ * the difference counts of text files and the size and modification time
+ * (UTC) on each side. Formats are CSV with a header row, XML with one
+ * element per item and JSON Lines with one object per line.
+ *
+ * Items must be written from one thread at a time.
+ */
+class DirReportWriter
+{
+public:
+	enum Format
+	{
+		FORMAT_CSV,
+		FORMAT_XML,
+		FORMAT_JSONL,
+	};
+
+	DirReportWriter();
+	~DirReportWriter();
+
+	static bool GetFormatFromFilename(const String& sReportFile, Format& format);
+
+	bool Open(const String& sReportFile, Format format, const CDiffContext *pCtxt);
+	void WriteItem(const DIFFITEM& di);
+	void WriteAll();
+	bool Close();
+	bool IsOpen() const { return !!m_pStream; }
+	int64_t GetItemCount() const { return m_nItems; }
+
+private:
+	DirReportWriter(const DirReportWriter&);
+	DirReportWriter& operator=(const DirReportWriter&);
+
+	enum { BUFFER_SIZE = 64 * 1024 };
+
+	void WriteHeader();
+	void WriteFooter();
+	void Flush();
+	void Put(char c)
+	{
+		if (m_nUsed == BUFFER_SIZE)
+			Flush();
+		m_buffer[m_nUsed++] = c;
+	}
+	void Put(const char *psz);
+	void PutText(const String& str);
+	void PutNumber(int64_t n);
+	void PutTime(int64_t nMicroseconds);
+	void BeginField(const char *pszName);
+	void EndField();
+
+	std::unique_ptr<Poco::FileOutputStream> m_pStream;
+	Format m_format;
+	const CDiffContext *m_pCtxt;
+	int64_t m_nItems; /**< Items written */
+	bool m_bFirstField; /**< No fields written to current row yet */
+	size_t m_nUsed; /**< Bytes used in buffer */
+	char m_buffer[BUFFER_SIZE];
+};
@@ -8,8 +8,17 @@
 #include <cassert>
 #include <memory>
 #include <cstdint>
+#include <climits>
+#include <deque>
+#include <vector>
+#include <unordered_map>
+#include <set>
+#include <atomic>
+#include <algorithm>
 #define POCO_NO_UNWINDOWS 1
 #include <Poco/Semaphore.h>
+#include <Poco/Event.h>
+#include <Poco/Condition.h>
 #include <Poco/Notification.h>
 #include <Poco/NotificationQueue.h>
 #include <Poco/Environment.h>
@@ -31,9 +40,11 @@
 #include "FolderCmp.h"
 #include "DirItem.h"
 #include "DirTravel.h"
+#include "DirReportWriter.h"
 #include "paths.h"
 #include "Plugins.h"
 #include "MergeApp.h"
+#include "BoundedMPMCQueue.h"
 
 using Poco::NotificationQueue;
 using Poco::Notification;
@@ -43,43 +54,496 @@ using Poco::ThreadPool;
 using Poco::Runnable;
 using Poco::Environment;
 using Poco::Stopwatch;
+using Poco::FastMutex;
+using Poco::Semaphore;
+using Poco::Event;
+using Poco::Condition;
+
+struct DirScanTask;
 
 // Static functions (ie, functions only used locally)
 void CompareDiffItem(DIFFITEM &di, CDiffContext * pCtxt);
 static void StoreDiffData(DIFFITEM &di, CDiffContext * pCtxt,
 		const FolderCmp * pCmpData);
-static DIFFITEM *AddToList(const String& sLeftDir, const String& sRightDir, const DirItem * lent, const DirItem * rent,
+static DIFFITEM *AddToList(const PooledPath& sLeftDir, const PooledPath& sRightDir, const DirItem * lent, const DirItem * rent,
 	unsigned code, DiffFuncStruct *myStruct, DIFFITEM *parent);
-static DIFFITEM *AddToList(const String& sLeftDir, const String& sMiddleDir, const String& sRightDir, const DirItem * lent, const DirItem * ment, const DirItem * rent,
+static DIFFITEM *AddToList(const PooledPath& sLeftDir, const PooledPath& sMiddleDir, const PooledPath& sRightDir, const DirItem * lent, const DirItem * ment, const DirItem * rent,
 	unsigned code, DiffFuncStruct *myStruct, DIFFITEM *parent);
 static void UpdateDiffItem(DIFFITEM & di, bool & bExists, CDiffContext *pCtxt);
-static int CompareItems(NotificationQueue& queue, DiffFuncStruct *myStruct, uintptr_t parentdiffpos);
+class CompareScheduler;
+static int CompareItems(CompareScheduler& scheduler, DiffFuncStruct *myStruct, uintptr_t parentdiffpos);
+static int CollectItems(const PathContext &paths, const String subdir[], DiffFuncStruct *myStruct,
+	bool casesensitive, int depth, DIFFITEM *parent, bool bUniques, std::vector<DirScanTask *> *pDeferred);
+
+class CompareResultSink;
 
-class WorkNotification: public Poco::Notification
+/**
+ * @brief Items queued to compare threads together.
+ * All items of a batch have the same parent folder and the same lane.
+ */
+struct CompareBatch
+{
+	enum { MAX_ITEMS = 64 };
+	DIFFITEM *items[MAX_ITEMS];
+	DIFFITEM *parent; /**< Parent folder of all items, NULL for roots */
+	unsigned count;
+	unsigned lane; /**< Lane of the batch, see CompareScheduler */
+	CompareResultSink *pSink; /**< Receives result of the batch */
+};
+
+/**
+ * @brief Receives results of compared batches.
+ * batchCompleted() is called from compare threads.
+ */
+class CompareResultSink
 {
 public:
-	WorkNotification(DIFFITEM& di, NotificationQueue& queueResult): m_di(di), m_queueResult(queueResult) {}
-	DIFFITEM& data() const { return m_di; }
-	NotificationQueue& queueResult() const { return m_queueResult; }
+	virtual ~CompareResultSink() {}
+	virtual void batchQueued(const CompareBatch& batch) {}
+	virtual void batchCompleted(const CompareBatch& batch, int ndiff) = 0;
+};
+
+/**
+ * @brief Schedules item batches to compare threads.
+ *
+ * There are two pools of compare threads: CPU bound content compares with
+ * diffutils run in one, and I/O bound quick and binary compares (and
+ * compares not reading files at all) in another. Items are queued to lanes
+ * by pool, by the sides the files are read from, by size and by
+ * priority. A compare thread takes a batch only when the volume of each
+ * side of the lane has a free read slot for it, so a slow network share is
+ * not read by more threads than configured while the other threads go on
+ * with items on other volumes. Two sides on the same volume take two
+ * slots. Files bigger than CDiffContext::m_nLargeFileLimit are queued one
+ * per batch to lanes of their own, and only part of the threads compare
+ * large files at once, so small files are not held up.
+ * Items existing on all sides are taken first.
+ *
+ * Batches are passed by value through lock-free ring buffers, so queuing
+ * does not allocate. The semaphores count queued batches of each pool and
+ * let idle threads sleep. A thread that must wait for a busy volume or a
+ * full lane sleeps on a condition signalled when batches are pushed,
+ * popped or released.
+ */
+class CompareScheduler
+{
+public:
+	enum
+	{
+		POOL_IO, /**< Quick, binary, date and size compares */
+		POOL_CPU, /**< Content compares with diffutils */
+		POOL_COUNT
+	};
+	enum
+	{
+		MAX_SIDES = 3,
+		MAX_VOLUMES = MAX_SIDES,
+		NLANES = (1 << MAX_SIDES) * POOL_COUNT * 4,
+	};
+
+	explicit CompareScheduler(CDiffContext *pCtxt)
+		: m_nDirs(pCtxt->GetCompareDirs())
+		, m_compareMethod(pCtxt->GetCompareMethod())
+		, m_nQuickCompareLimit(pCtxt->m_nQuickCompareLimit)
+		, m_nLargeFileLimit(pCtxt->m_nLargeFileLimit)
+		, m_bReadsFiles(false)
+		, m_nwaiters(0)
+		, m_bStop(false)
+	{
+		const unsigned nprocessors = Environment::processorCount();
+		switch (m_compareMethod)
+		{
+		case CMP_CONTENT:
+			m_nthreads[POOL_CPU] = pCtxt->m_nCpuCompareThreads ? pCtxt->m_nCpuCompareThreads : nprocessors;
+			m_nthreads[POOL_IO] = pCtxt->m_nIoCompareThreads ? pCtxt->m_nIoCompareThreads : nprocessors;
+			m_bReadsFiles = true;
+			break;
+		case CMP_QUICK_CONTENT:
+		case CMP_BINARY_CONTENT:
+			m_nthreads[POOL_CPU] = 0;
+			m_nthreads[POOL_IO] = pCtxt->m_nIoCompareThreads ? pCtxt->m_nIoCompareThreads : nprocessors;
+			m_bReadsFiles = true;
+			break;
+		default:
+			// Date and size compares don't read files
+			m_nthreads[POOL_CPU] = 0;
+			m_nthreads[POOL_IO] = 1;
+			break;
+		}
+		for (int pool = 0; pool < POOL_COUNT; ++pool)
+		{
+			m_available[pool].reset(new Semaphore(0, INT_MAX));
+			const unsigned nlarge = pCtxt->m_nMaxLargeFileCompares ?
+				pCtxt->m_nMaxLargeFileCompares : (std::max)(m_nthreads[pool] / 2, 1u);
+			m_largeSlots[pool].store(static_cast<int>(nlarge));
+		}
+
+		// Sides on the same volume share the read slots of the volume
+		String volumePaths[MAX_VOLUMES];
+		unsigned nsidesOfVolume[MAX_VOLUMES] = {0};
+		int nvolumes = 0;
+		for (int i = 0; i < m_nDirs; ++i)
+		{
+			bool bRemote = false;
+			String volumePath = paths_GetVolumePath(pCtxt->GetNormalizedPath(i), &bRemote);
+			int vol;
+			for (vol = 0; vol < nvolumes; ++vol)
+			{
+				if (!volumePath.empty() && string_compare_nocase(volumePath, volumePaths[vol]) == 0)
+					break;
+			}
+			if (vol == nvolumes)
+			{
+				const unsigned nreads = bRemote ? pCtxt->m_nMaxRemoteVolumeReads : pCtxt->m_nMaxLocalVolumeReads;
+				volumePaths[nvolumes++] = volumePath;
+				m_volumeSlots[vol].store(nreads ? static_cast<int>(nreads) : INT_MAX);
+			}
+			m_volumeOfSide[i] = vol;
+			// Files of all sides of an item must fit in the slots at once
+			if (++nsidesOfVolume[vol] > static_cast<unsigned>(m_volumeSlots[vol].load()))
+				m_volumeSlots[vol].store(static_cast<int>(nsidesOfVolume[vol]));
+		}
+
+		// Create only lanes that can get items
+		const unsigned allSides = (1 << m_nDirs) - 1;
+		for (unsigned lane = 0; lane < NLANES; ++lane)
+		{
+			if ((LaneSides(lane) & ~allSides) == 0 && m_nthreads[LanePool(lane)] > 0)
+				m_lanes[lane].reset(new BoundedMPMCQueue<CompareBatch>(LANE_SIZE));
+		}
+	}
+
+	unsigned GetThreadCount(int pool) const { return m_nthreads[pool]; }
+	unsigned GetThreadCount() const { return m_nthreads[POOL_IO] + m_nthreads[POOL_CPU]; }
+
+	/**
+	 * @brief Get lane for the item.
+	 * @param [in] di Item to compare.
+	 * @param [in] bUrgent Is item to be compared before other items?
+	 */
+	unsigned GetLane(const DIFFITEM &di, bool bUrgent) const
+	{
+		int pool = POOL_IO;
+		bool bLarge = false;
+		unsigned sides = 0;
+		if (m_bReadsFiles && !di.diffcode.isDirectory())
+		{
+			bool bOverQuickLimit = false;
+			for (int i = 0; i < m_nDirs; ++i)
+			{
+				if (!di.diffcode.exists(i))
+					continue;
+				const int64_t size = static_cast<int64_t>(di.diffFileInfo[i].size);
+				sides |= 1 << i;
+				if (size > m_nQuickCompareLimit)
+					bOverQuickLimit = true;
+				if (m_nLargeFileLimit > 0 && size > m_nLargeFileLimit)
+					bLarge = true;
+			}
+			// FolderCmp switches to quick compare for files over the limit
+			if (m_compareMethod == CMP_CONTENT && !bOverQuickLimit)
+				pool = POOL_CPU;
+		}
+		return LaneIndex(pool, bLarge, bUrgent, sides);
+	}
+
+	/// Max number of items in batch of the lane
+	static unsigned GetMaxItems(unsigned lane)
+	{
+		return LaneIsLarge(lane) ? 1 : CompareBatch::MAX_ITEMS;
+	}
+
+	static bool LaneIsUrgent(unsigned lane) { return (lane & 1) != 0; }
+
+	void push(const CompareBatch& batch)
+	{
+		BoundedMPMCQueue<CompareBatch>& queue = *m_lanes[batch.lane];
+		// Lane is full only when compare threads are far behind
+		waitUntil([&]() { return queue.tryPush(batch); });
+		m_available[LanePool(batch.lane)]->set();
+		notify();
+	}
+
+	/// Wait for next batch of the pool, returns false when scheduler is stopped
+	bool waitPop(int pool, CompareBatch& batch)
+	{
+		m_available[pool]->wait();
+		// Batch waits for a busy volume, or is still being written
+		if (!waitUntil([&]() { return tryPop(pool, batch); }))
+			return false;
+		notify();
+		return true;
+	}
+
+	/// Release read slots taken by batch returned by waitPop()
+	void release(const CompareBatch& batch)
+	{
+		if (LaneIsLarge(batch.lane))
+			++m_largeSlots[LanePool(batch.lane)];
+		releaseSides(LaneSides(batch.lane));
+		notify();
+	}
+
+	void stop()
+	{
+		m_bStop = true;
+		{
+			FastMutex::ScopedLock lock(m_mutex);
+			m_changed.broadcast();
+		}
+		for (int pool = 0; pool < POOL_COUNT; ++pool)
+		{
+			for (unsigned i = 0; i < m_nthreads[pool]; ++i)
+				m_available[pool]->set();
+		}
+	}
+
 private:
-	DIFFITEM& m_di;
-	NotificationQueue& m_queueResult;
+	enum { LANE_SIZE = 32 };
+
+	static unsigned LaneIndex(int pool, bool bLarge, bool bUrgent, unsigned sides)
+	{
+		return ((sides * POOL_COUNT + pool) * 2 + (bLarge ? 1 : 0)) * 2 + (bUrgent ? 1 : 0);
+	}
+	static bool LaneIsLarge(unsigned lane) { return (lane & 2) != 0; }
+	static int LanePool(unsigned lane) { return (lane >> 2) % POOL_COUNT; }
+	static unsigned LaneSides(unsigned lane) { return lane / (POOL_COUNT * 4); }
+
+	/**
+	 * @brief Wait until @p tryFunc succeeds, returns false if stopped first.
+	 * The waiter count is raised before @p tryFunc is retried under the
+	 * mutex, so notify() either sees the waiter or the waiter sees the change.
+	 */
+	template<class TryFunc>
+	bool waitUntil(TryFunc tryFunc)
+	{
+		if (tryFunc())
+			return true;
+		FastMutex::ScopedLock lock(m_mutex);
+		++m_nwaiters;
+		for (;;)
+		{
+			std::atomic_thread_fence(std::memory_order_seq_cst);
+			if (tryFunc())
+				break;
+			if (m_bStop)
+			{
+				--m_nwaiters;
+				return false;
+			}
+			m_changed.wait(m_mutex);
+		}
+		--m_nwaiters;
+		return true;
+	}
+
+	/// Wake threads waiting in waitUntil() after a lane or slot changed
+	void notify()
+	{
+		std::atomic_thread_fence(std::memory_order_seq_cst);
+		if (m_nwaiters.load() == 0)
+			return;
+		FastMutex::ScopedLock lock(m_mutex);
+		m_changed.broadcast();
+	}
+
+	static bool TryAcquire(std::atomic<int>& slots)
+	{
+		int n = slots.load();
+		while (n > 0)
+		{
+			if (slots.compare_exchange_weak(n, n - 1))
+				return true;
+		}
+		return false;
+	}
+
+	/// Take a read slot of the volume of each side
+	bool acquireSides(unsigned sides)
+	{
+		for (int i = 0; i < MAX_SIDES; ++i)
+		{
+			if ((sides & (1 << i)) && !TryAcquire(m_volumeSlots[m_volumeOfSide[i]]))
+			{
+				releaseSides(sides & ((1 << i) - 1));
+				return false;
+			}
+		}
+		return true;
+	}
+
+	void releaseSides(unsigned sides)
+	{
+		for (int i = 0; i < MAX_SIDES; ++i)
+		{
+			if (sides & (1 << i))
+				++m_volumeSlots[m_volumeOfSide[i]];
+		}
+	}
+
+	bool tryPop(int pool, CompareBatch& batch)
+	{
+		for (int urgent = 1; urgent >= 0; --urgent)
+		{
+			for (int large = 0; large <= 1; ++large)
+			{
+				if (large && !TryAcquire(m_largeSlots[pool]))
+					continue;
+				for (unsigned sides = 0; sides < (1 << MAX_SIDES); ++sides)
+				{
+					const unsigned lane = LaneIndex(pool, large != 0, urgent != 0, sides);
+					if (!m_lanes[lane] || !acquireSides(sides))
+						continue;
+					if (m_lanes[lane]->tryPop(batch))
+						return true;
+					releaseSides(sides);
+				}
+				if (large)
+					++m_largeSlots[pool];
+			}
+		}
+		return false;
+	}
+
+	int m_nDirs;
+	int m_compareMethod;
+	int64_t m_nQuickCompareLimit;
+	int64_t m_nLargeFileLimit;
+	bool m_bReadsFiles; /**< Are files read when compared? */
+	unsigned m_nthreads[POOL_COUNT];
+	std::unique_ptr<Semaphore> m_available[POOL_COUNT];
+	std::atomic<int> m_largeSlots[POOL_COUNT]; /**< Threads that may start comparing large files */
+	int m_volumeOfSide[MAX_SIDES];
+	std::atomic<int> m_volumeSlots[MAX_VOLUMES]; /**< Free read slots of volumes */
+	std::unique_ptr<BoundedMPMCQueue<CompareBatch>> m_lanes[NLANES];
+	FastMutex m_mutex; /**< Protects waiting on m_changed */
+	Condition m_changed; /**< Signalled when lanes or read slots change */
+	std::atomic<int> m_nwaiters; /**< Threads waiting on m_changed */
+	std::atomic<bool> m_bStop;
 };
 
-class WorkCompletedNotification: public Poco::Notification
+/**
+ * @brief Returns if compared item counts as a difference in its parent folder.
+ */
+static bool IsDiffInParent(const DIFFITEM &di, const CDiffContext *pCtxt)
+{
+	bool existsalldirs = di.diffcode.existAll(pCtxt->GetCompareDirs());
+	return di.diffcode.isResultDiff() ||
+		(!existsalldirs && !di.diffcode.isResultFiltered());
+}
+
+/**
+ * @brief Collects items to batches and queues them to compare threads.
+ * Every lane of the scheduler has its own batch being filled. A batch is
+ * queued when it is full, when an item of another folder is added to the
+ * lane, or when flush() is called.
+ */
+class CompareBatcher
 {
 public:
-	explicit WorkCompletedNotification(DIFFITEM& di): m_di(di) {}
-	DIFFITEM& data() const { return m_di; }
+	CompareBatcher(CompareScheduler& scheduler, CDiffContext *pCtxt, CompareResultSink *pSink)
+		: m_scheduler(scheduler), m_pCtxt(pCtxt), m_pSink(pSink), m_nqueued(0)
+	{
+		for (unsigned lane = 0; lane < CompareScheduler::NLANES; ++lane)
+			m_batches[lane].count = 0;
+	}
+
+	~CompareBatcher()
+	{
+		flush();
+	}
+
+	void add(DIFFITEM &di)
+	{
+		const bool bUrgent = di.diffcode.existAll(m_pCtxt->GetCompareDirs());
+		const unsigned lane = m_scheduler.GetLane(di, bUrgent);
+		CompareBatch& batch = m_batches[lane];
+		DIFFITEM *parent = m_pCtxt->GetParentDiff(di);
+		if (batch.count > 0 && batch.parent != parent)
+			flush(lane);
+		batch.parent = parent;
+		batch.items[batch.count++] = &di;
+		++m_nqueued;
+		if (batch.count == CompareScheduler::GetMaxItems(lane))
+			flush(lane);
+	}
+
+	void flush()
+	{
+		if (m_nqueued == 0)
+			return;
+		for (int urgent = 1; urgent >= 0; --urgent)
+		{
+			for (unsigned lane = 0; lane < CompareScheduler::NLANES; ++lane)
+			{
+				if (CompareScheduler::LaneIsUrgent(lane) == (urgent != 0))
+					flush(lane);
+			}
+		}
+	}
+
+private:
+	void flush(unsigned lane)
+	{
+		CompareBatch& batch = m_batches[lane];
+		if (batch.count == 0)
+			return;
+		batch.lane = lane;
+		batch.pSink = m_pSink;
+		m_pSink->batchQueued(batch);
+		m_scheduler.push(batch);
+		m_nqueued -= batch.count;
+		batch.count = 0;
+	}
+
+	CompareScheduler& m_scheduler;
+	CDiffContext *m_pCtxt;
+	CompareResultSink *m_pSink;
+	unsigned m_nqueued; /**< Items in batches being filled */
+	CompareBatch m_batches[CompareScheduler::NLANES]; /**< Batch being filled for each lane */
+};
+
+/**
+ * @brief Waits for items of one folder queued by CompareItems().
+ * Differences are counted with atomic counters by the compare threads,
+ * and the event is set when the last queued item has been compared.
+ */
+class FolderCompareGroup: public CompareResultSink
+{
+public:
+	FolderCompareGroup() : m_npending(1), m_ndiff(0) {}
+
+	void batchQueued(const CompareBatch& batch)
+	{
+		m_npending += batch.count;
+	}
+
+	void batchCompleted(const CompareBatch& batch, int ndiff)
+	{
+		m_ndiff += ndiff;
+		if ((m_npending -= batch.count) == 0)
+			m_done.set();
+	}
+
+	/// Wait for all queued items, returns number of differences in them
+	int wait()
+	{
+		if (--m_npending != 0)
+			m_done.wait();
+		return m_ndiff;
+	}
+
 private:
-	DIFFITEM& m_di;
+	std::atomic<int> m_npending; /**< Items queued but not compared, plus one until wait() */
+	std::atomic<int> m_ndiff; /**< Differences in compared items */
+	Event m_done;
 };
 
 class DiffWorker: public Runnable
 {
 public:
-	DiffWorker(NotificationQueue& queue, CDiffContext *pCtxt, int id):
-	  m_queue(queue), m_pCtxt(pCtxt), m_id(id) {}
+	DiffWorker(CompareScheduler& scheduler, int pool, CDiffContext *pCtxt, int id):
+	  m_scheduler(scheduler), m_pool(pool), m_pCtxt(pCtxt), m_id(id) {}
 
 	void run()
 	{
@@ -87,28 +551,237 @@ public:
 		// when we exit the thread, we delete this and release the scripts
 		CAssureScriptsForThread scriptsForRescan;
 
-		AutoPtr<Notification> pNf(m_queue.waitDequeueNotification());
-		while (pNf)
+		CompareBatch batch;
+		while (m_scheduler.waitPop(m_pool, batch))
 		{
-			WorkNotification* pWorkNf = dynamic_cast<WorkNotification*>(pNf.get());
-			if (pWorkNf) {
-				m_pCtxt->m_pCompareStats->BeginCompare(&pWorkNf->data(), m_id);
+			int ndiff = 0;
+			for (unsigned i = 0; i < batch.count; ++i)
+			{
+				DIFFITEM &di = *batch.items[i];
+				m_pCtxt->m_pCompareStats->BeginCompare(&di, m_id);
 				if (!m_pCtxt->ShouldAbort())
-					CompareDiffItem(pWorkNf->data(), m_pCtxt);
-				pWorkNf->queueResult().enqueueNotification(new WorkCompletedNotification(pWorkNf->data()));
+					CompareDiffItem(di, m_pCtxt);
+				if (IsDiffInParent(di, m_pCtxt))
+					++ndiff;
 			}
-			pNf = m_queue.waitDequeueNotification();
+			m_scheduler.release(batch);
+			batch.pSink->batchCompleted(batch, ndiff);
 		}
 	}
 
 private:
-	NotificationQueue& m_queue;
+	CompareScheduler& m_scheduler;
+	int m_pool; /**< Pool of compare threads this thread belongs to */
 	CDiffContext *m_pCtxt;
 	int m_id;
 };
 
 typedef std::shared_ptr<DiffWorker> DiffWorkerPtr;
 
+/**
+ * @brief Start compare threads of all pools of the scheduler.
+ */
+static void StartCompareThreads(CompareScheduler& scheduler, CDiffContext *pCtxt,
+	ThreadPool& threadPool, std::vector<DiffWorkerPtr>& workers)
+{
+	pCtxt->m_pCompareStats->SetCompareThreadCount(scheduler.GetThreadCount());
+	for (int pool = 0; pool < CompareScheduler::POOL_COUNT; ++pool)
+	{
+		for (unsigned i = 0; i < scheduler.GetThreadCount(pool); ++i)
+		{
+			DiffWorkerPtr worker(new DiffWorker(scheduler, pool, pCtxt, static_cast<int>(workers.size())));
+			workers.push_back(worker);
+			threadPool.start(*worker);
+		}
+	}
+}
+
+/**
+ * @brief One folder to be collected by the folder scanning threads.
+ */
+struct DirScanTask
+{
+	DirScanTask(const String subdir_[], int depth_, DIFFITEM *parent_)
+		: depth(depth_), parent(parent_)
+	{
+		std::copy(subdir_, subdir_ + 3, subdir);
+	}
+	String subdir[3]; /**< Subfolders under the root paths */
+	int depth; /**< Levels of subdirectories to scan, -1 scans all */
+	DIFFITEM *parent; /**< Folder item to add found items to, NULL for roots */
+};
+
+class ScanCompletedNotification: public Poco::Notification
+{
+public:
+	ScanCompletedNotification(DIFFITEM *parent, const std::vector<DirScanTask *>& subdirs)
+		: m_parent(parent)
+	{
+		for (size_t i = 0; i < subdirs.size(); ++i)
+			m_subdirs.push_back(subdirs[i]->parent);
+	}
+	DIFFITEM *parent() const { return m_parent; }
+	const std::vector<DIFFITEM *>& subdirs() const { return m_subdirs; }
+private:
+	DIFFITEM *m_parent;
+	std::vector<DIFFITEM *> m_subdirs; /**< Subfolders which are scanned next */
+};
+
+class BatchCompletedNotification: public Poco::Notification
+{
+public:
+	BatchCompletedNotification(const CompareBatch& batch, int ndiff)
+		: m_batch(batch), m_ndiff(ndiff) {}
+	DIFFITEM *parent() const { return m_batch.parent; }
+	const CompareBatch& batch() const { return m_batch; }
+	int completed() const { return m_batch.count; }
+	int diffs() const { return m_ndiff; }
+private:
+	CompareBatch m_batch; /**< Compared items */
+	int m_ndiff; /**< Number of them counting as differences */
+};
+
+/**
+ * @brief Reports compared batches to the result queue of pipelined compare.
+ */
+class NotifyingResultSink: public CompareResultSink
+{
+public:
+	explicit NotifyingResultSink(NotificationQueue& queueResult) : m_queueResult(queueResult) {}
+
+	void batchCompleted(const CompareBatch& batch, int ndiff)
+	{
+		m_queueResult.enqueueNotification(
+			new BatchCompletedNotification(batch, ndiff));
+	}
+
+private:
+	NotificationQueue& m_queueResult;
+};
+
+/**
+ * @brief Work-stealing queue of folders to scan.
+ * Every scanning thread has its own deque of tasks. A thread pushes the
+ * subfolders it finds to the back of its own deque and takes work from
+ * there, so a subtree is mostly walked by one thread. An idle thread
+ * steals from the front of the other deques, i.e. the biggest pending
+ * subtrees.
+ */
+class DirScanQueue
+{
+public:
+	explicit DirScanQueue(unsigned nthreads)
+		: m_queues(nthreads), m_mutexes(nthreads), m_available(0, INT_MAX), m_bStop(false)
+	{
+		for (unsigned i = 0; i < nthreads; ++i)
+			m_mutexes[i].reset(new FastMutex);
+	}
+
+	~DirScanQueue()
+	{
+		for (size_t i = 0; i < m_queues.size(); ++i)
+			for (size_t j = 0; j < m_queues[i].size(); ++j)
+				delete m_queues[i][j];
+	}
+
+	void push(unsigned id, DirScanTask *pTask)
+	{
+		{
+			FastMutex::ScopedLock lock(*m_mutexes[id]);
+			m_queues[id].push_back(pTask);
+		}
+		m_available.set();
+	}
+
+	/// Wait for next task, returns NULL when queue is stopped
+	DirScanTask *waitPop(unsigned id)
+	{
+		m_available.wait();
+		if (m_bStop)
+			return NULL;
+		// Semaphore count matches number of queued tasks, so some deque
+		// must have a task for us.
+		for (;;)
+		{
+			{
+				FastMutex::ScopedLock lock(*m_mutexes[id]);
+				if (!m_queues[id].empty())
+				{
+					DirScanTask *pTask = m_queues[id].back();
+					m_queues[id].pop_back();
+					return pTask;
+				}
+			}
+			for (unsigned i = 1; i < m_queues.size(); ++i)
+			{
+				unsigned victim = (id + i) % m_queues.size();
+				FastMutex::ScopedLock lock(*m_mutexes[victim]);
+				if (!m_queues[victim].empty())
+				{
+					DirScanTask *pTask = m_queues[victim].front();
+					m_queues[victim].pop_front();
+					return pTask;
+				}
+			}
+		}
+	}
+
+	void stop()
+	{
+		m_bStop = true;
+		for (size_t i = 0; i < m_queues.size(); ++i)
+			m_available.set();
+	}
+
+private:
+	std::vector<std::deque<DirScanTask *> > m_queues;
+	std::vector<std::unique_ptr<FastMutex> > m_mutexes;
+	Semaphore m_available;
+	std::atomic<bool> m_bStop;
+};
+
+class DirScanWorker: public Runnable
+{
+public:
+	DirScanWorker(DirScanQueue& queue, NotificationQueue& queueResult, const PathContext& paths,
+		DiffFuncStruct *myStruct, int id):
+	  m_queue(queue), m_queueResult(queueResult), m_paths(paths), m_myStruct(myStruct), m_id(id) {}
+
+	void run()
+	{
+		CDiffContext *pCtxt = m_myStruct->context;
+		DirScanTask *pTask;
+		while ((pTask = m_queue.waitPop(m_id)) != NULL)
+		{
+			std::vector<DirScanTask *> subdirs;
+			if (!pCtxt->ShouldAbort())
+				CollectItems(m_paths, pTask->subdir, m_myStruct, false, pTask->depth,
+					pTask->parent, pCtxt->m_bWalkUniques, &subdirs);
+			if (pCtxt->ShouldAbort())
+			{
+				for (size_t i = 0; i < subdirs.size(); ++i)
+					delete subdirs[i];
+				subdirs.clear();
+			}
+			// Report the folder before queuing its subfolders so that the
+			// result thread always sees a parent before its children.
+			m_queueResult.enqueueNotification(new ScanCompletedNotification(pTask->parent, subdirs));
+			for (size_t i = 0; i < subdirs.size(); ++i)
+				m_queue.push(m_id, subdirs[i]);
+			delete pTask;
+		}
+	}
+
+private:
+	DirScanQueue& m_queue;
+	NotificationQueue& m_queueResult;
+	const PathContext& m_paths;
+	DiffFuncStruct *m_myStruct;
+	int m_id;
+};
+
+typedef std::shared_ptr<DirScanWorker> DirScanWorkerPtr;
+
 /**
  * @brief Collect file- and folder-names to list.
  * This function walks given folders and adds found subfolders and files into
@@ -136,6 +809,22 @@ int DirScan_GetItems(const PathContext &paths, const String subdir[],
 		DiffFuncStruct *myStruct,
 		bool casesensitive, int depth, DIFFITEM *parent,
 		bool bUniques)
+{
+	return CollectItems(paths, subdir, myStruct, casesensitive, depth, parent, bUniques, NULL);
+}
+
+/**
+ * @brief Collect file- and folder-names of one folder to list.
+ * Works like DirScan_GetItems(), but when @p pDeferred is given, subfolders
+ * are not walked into. Instead a scan task for each subfolder which
+ * DirScan_GetItems() would have walked into is added to @p pDeferred.
+ * @param [out] pDeferred Subfolder scan tasks, or NULL to walk recursively.
+ * @return 1 normally, -1 if compare was aborted
+ */
+static int CollectItems(const PathContext &paths, const String subdir[],
+		DiffFuncStruct *myStruct,
+		bool casesensitive, int depth, DIFFITEM *parent,
+		bool bUniques, std::vector<DirScanTask *> *pDeferred)
 {
 	static const TCHAR backslash[] = _T("\\");
 	int nDirs = paths.GetSize();
@@ -172,6 +861,11 @@ int DirScan_GetItems(const PathContext &paths, const String subdir[],
 	if (nIndex == nDirs)
 		return 0;
 
+	// All items of the folder share its path
+	PooledPath subpath[3];
+	for (nIndex = 0; nIndex < nDirs; nIndex++)
+		subpath[nIndex] = subdir[nIndex];
+
 	DirItemArray::size_type i=0, j=0, k=0;
 	while (1)
 	{
@@ -274,12 +968,12 @@ int DirScan_GetItems(const PathContext &paths, const String subdir[],
 		if (!depth)
 		{
 			if (nDirs < 3)
-				AddToList(subdir[0], subdir[1], 
+				AddToList(subpath[0], subpath[1], 
 					nDiffCode & DIFFCODE::FIRST  ? &dirs[0][i] : NULL, 
 					nDiffCode & DIFFCODE::SECOND ? &dirs[1][j] : NULL,
 					nDiffCode, myStruct, parent);
 			else
-				AddToList(subdir[0], subdir[1], subdir[2], 
+				AddToList(subpath[0], subpath[1], subpath[2], 
 					nDiffCode & DIFFCODE::FIRST  ? &dirs[0][i] : NULL,
 					nDiffCode & DIFFCODE::SECOND ? &dirs[1][j] : NULL,
 					nDiffCode & DIFFCODE::THIRD  ? &dirs[2][k] : NULL,
@@ -290,7 +984,7 @@ int DirScan_GetItems(const PathContext &paths, const String subdir[],
 			// Recursive compare
 			if (nDirs < 3)
 			{
-				DIFFITEM *me = AddToList(subdir[0], subdir[1], 
+				DIFFITEM *me = AddToList(subpath[0], subpath[1], 
 					nDiffCode & DIFFCODE::FIRST  ? &dirs[0][i] : NULL, 
 					nDiffCode & DIFFCODE::SECOND ? &dirs[1][j] : NULL,
 					nDiffCode, myStruct, parent);
@@ -298,15 +992,22 @@ int DirScan_GetItems(const PathContext &paths, const String subdir[],
 				{
 					// Scan recursively all subdirectories too, we are not adding folders
 					String newsubdir[3] = {leftnewsub, rightnewsub};
-					int result = DirScan_GetItems(paths, newsubdir, myStruct, casesensitive,
-							depth - 1, me, bUniques);
-					if (result == -1)
-						return -1;
+					if (pDeferred)
+					{
+						pDeferred->push_back(new DirScanTask(newsubdir, depth - 1, me));
+					}
+					else
+					{
+						int result = CollectItems(paths, newsubdir, myStruct, casesensitive,
+								depth - 1, me, bUniques, NULL);
+						if (result == -1)
+							return -1;
+					}
 				}
 			}
 			else
 			{
-				DIFFITEM *me = AddToList(subdir[0], subdir[1], subdir[2], 
+				DIFFITEM *me = AddToList(subpath[0], subpath[1], subpath[2], 
 					nDiffCode & DIFFCODE::FIRST  ? &dirs[0][i] : NULL,
 					nDiffCode & DIFFCODE::SECOND ? &dirs[1][j] : NULL,
 					nDiffCode & DIFFCODE::THIRD  ? &dirs[2][k] : NULL,
@@ -315,10 +1016,17 @@ int DirScan_GetItems(const PathContext &paths, const String subdir[],
 				{
 					// Scan recursively all subdirectories too, we are not adding folders
 					String newsubdir[3] = {leftnewsub, middlenewsub, rightnewsub};
-					int result = DirScan_GetItems(paths, newsubdir, myStruct, casesensitive,
-							depth - 1, me, bUniques);
-					if (result == -1)
-						return -1;
+					if (pDeferred)
+					{
+						pDeferred->push_back(new DirScanTask(newsubdir, depth - 1, me));
+					}
+					else
+					{
+						int result = CollectItems(paths, newsubdir, myStruct, casesensitive,
+								depth - 1, me, bUniques, NULL);
+						if (result == -1)
+							return -1;
+					}
 				}
 			}
 		}
@@ -348,12 +1056,12 @@ int DirScan_GetItems(const PathContext &paths, const String subdir[],
 			if (nDirs < 3)
 			{
 				const unsigned nDiffCode = DIFFCODE::FIRST | DIFFCODE::FILE;
-				AddToList(subdir[0], subdir[1], &files[0][i], 0, nDiffCode, myStruct, parent);
+				AddToList(subpath[0], subpath[1], &files[0][i], 0, nDiffCode, myStruct, parent);
 			}
 			else
 			{
 				const unsigned nDiffCode = DIFFCODE::FIRST | DIFFCODE::FILE;
-				AddToList(subdir[0], subdir[1], subdir[2], &files[0][i], 0, 0, nDiffCode, myStruct, parent);
+				AddToList(subpath[0], subpath[1], subpath[2], &files[0][i], 0, 0, nDiffCode, myStruct, parent);
 			}
 			// Advance left pointer over left-only entry, and then retest with new pointers
 			++i;
@@ -366,9 +1074,9 @@ int DirScan_GetItems(const PathContext &paths, const String subdir[],
 		{
 			const unsigned nDiffCode = DIFFCODE::SECOND | DIFFCODE::FILE;
 			if (nDirs < 3)
-				AddToList(subdir[0], subdir[1], 0, &files[1][j], nDiffCode, myStruct, parent);
+				AddToList(subpath[0], subpath[1], 0, &files[1][j], nDiffCode, myStruct, parent);
 			else
-				AddToList(subdir[0], subdir[1], subdir[2], 0, &files[1][j], 0, nDiffCode, myStruct, parent);
+				AddToList(subpath[0], subpath[1], subpath[2], 0, &files[1][j], 0, nDiffCode, myStruct, parent);
 			// Advance right pointer over right-only entry, and then retest with new pointers
 			++j;
 			continue;
@@ -380,7 +1088,7 @@ int DirScan_GetItems(const PathContext &paths, const String subdir[],
 				&& (j==files[1].size() || collstr(files[2][k].filename, files[1][j].filename, casesensitive)<0) )
 			{
 				const unsigned nDiffCode = DIFFCODE::THIRD | DIFFCODE::FILE;
-				AddToList(subdir[0], subdir[1], subdir[2], 0, 0, &files[2][k], nDiffCode, myStruct, parent);
+				AddToList(subpath[0], subpath[1], subpath[2], 0, 0, &files[2][k], nDiffCode, myStruct, parent);
 				++k;
 				// Advance right pointer over right-only entry, and then retest with new pointers
 				continue;
@@ -390,7 +1098,7 @@ int DirScan_GetItems(const PathContext &paths, const String subdir[],
 			    && (k==files[2].size() || collstr(files[0][i].filename, files[2][k].filename, casesensitive) != 0))
 			{
 				const unsigned nDiffCode = DIFFCODE::FIRST | DIFFCODE::SECOND | DIFFCODE::FILE;
-				AddToList(subdir[0], subdir[1], subdir[2], &files[0][i], &files[1][j], 0, nDiffCode, myStruct, parent);
+				AddToList(subpath[0], subpath[1], subpath[2], &files[0][i], &files[1][j], 0, nDiffCode, myStruct, parent);
 				++i;
 				++j;
 				continue;
@@ -399,7 +1107,7 @@ int DirScan_GetItems(const PathContext &paths, const String subdir[],
 			    && (j==files[1].size() || collstr(files[1][j].filename, files[2][k].filename, casesensitive) != 0))
 			{
 				const unsigned nDiffCode = DIFFCODE::FIRST | DIFFCODE::THIRD | DIFFCODE::FILE;
-				AddToList(subdir[0], subdir[1], subdir[2], &files[0][i], 0, &files[2][k], nDiffCode, myStruct, parent);
+				AddToList(subpath[0], subpath[1], subpath[2], &files[0][i], 0, &files[2][k], nDiffCode, myStruct, parent);
 				++i;
 				++k;
 				continue;
@@ -408,7 +1116,7 @@ int DirScan_GetItems(const PathContext &paths, const String subdir[],
 			    && (i==files[0].size() || collstr(files[0][i].filename, files[1][j].filename, casesensitive) != 0))
 			{
 				const unsigned nDiffCode = DIFFCODE::SECOND | DIFFCODE::THIRD | DIFFCODE::FILE;
-				AddToList(subdir[0], subdir[1], subdir[2], 0, &files[1][j], &files[2][k], nDiffCode, myStruct, parent);
+				AddToList(subpath[0], subpath[1], subpath[2], 0, &files[1][j], &files[2][k], nDiffCode, myStruct, parent);
 				++j;
 				++k;
 				continue;
@@ -420,7 +1128,7 @@ int DirScan_GetItems(const PathContext &paths, const String subdir[],
 			{
 				assert(j<files[1].size());
 				const unsigned nDiffCode = DIFFCODE::BOTH | DIFFCODE::FILE;
-				AddToList(subdir[0], subdir[1], &files[0][i], &files[1][j], nDiffCode, myStruct, parent);
+				AddToList(subpath[0], subpath[1], &files[0][i], &files[1][j], nDiffCode, myStruct, parent);
 				++i;
 				++j;
 				continue;
@@ -430,7 +1138,7 @@ int DirScan_GetItems(const PathContext &paths, const String subdir[],
 				assert(j<files[1].size());
 				assert(k<files[2].size());
 				const unsigned nDiffCode = DIFFCODE::ALL | DIFFCODE::FILE;
-				AddToList(subdir[0], subdir[1], subdir[2], &files[0][i], &files[1][j], &files[2][k], nDiffCode, myStruct, parent);
+				AddToList(subpath[0], subpath[1], subpath[2], &files[0][i], &files[1][j], &files[2][k], nDiffCode, myStruct, parent);
 				++i;
 				++j;
 				++k;
@@ -451,35 +1159,26 @@ int DirScan_GetItems(const PathContext &paths, const String subdir[],
  */
 int DirScan_CompareItems(DiffFuncStruct *myStruct, uintptr_t parentdiffpos)
 {
-	ThreadPool threadPool;
+	CompareScheduler scheduler(myStruct->context);
+	ThreadPool threadPool(1, scheduler.GetThreadCount());
 	std::vector<DiffWorkerPtr> workers;
-	const int compareMethod = myStruct->context->GetCompareMethod();
-	unsigned nworkers = (compareMethod == CMP_CONTENT || compareMethod == CMP_QUICK_CONTENT) ? Environment::processorCount() : 1;
-	NotificationQueue queue;
-
-	myStruct->context->m_pCompareStats->SetCompareThreadCount(nworkers);
-	for (unsigned i = 0; i < nworkers; ++i)
-	{
-		workers.push_back(DiffWorkerPtr(new DiffWorker(queue, myStruct->context, i)));
-		threadPool.start(*workers[i]);
-	}
+	StartCompareThreads(scheduler, myStruct->context, threadPool, workers);
 
-	int res = CompareItems(queue, myStruct, parentdiffpos);
+	int res = CompareItems(scheduler, myStruct, parentdiffpos);
 
-	Thread::sleep(100);
-	queue.wakeUpAll();
+	scheduler.stop();
 	threadPool.joinAll();
 
 	return res;
 }
 
-static int CompareItems(NotificationQueue& queue, DiffFuncStruct *myStruct, uintptr_t parentdiffpos)
+static int CompareItems(CompareScheduler& scheduler, DiffFuncStruct *myStruct, uintptr_t parentdiffpos)
 {
-	NotificationQueue queueResult;
 	Stopwatch stopwatch;
 	CDiffContext *pCtxt = myStruct->context;
+	FolderCompareGroup group;
+	CompareBatcher batcher(scheduler, pCtxt, &group);
 	int res = 0;
-	int count = 0;
 	if (!parentdiffpos)
 		myStruct->pSemaphore->wait();
 	stopwatch.start();
@@ -501,8 +1200,10 @@ static int CompareItems(NotificationQueue& queue, DiffFuncStruct *myStruct, uint
 		bool existsalldirs = ((pCtxt->GetCompareDirs() == 2 && di.diffcode.isSideBoth()) || (pCtxt->GetCompareDirs() == 3 && di.diffcode.isSideAll()));
 		if (di.diffcode.isDirectory() && pCtxt->m_bRecursive)
 		{
+			// Keep compare threads busy while the subfolder is compared
+			batcher.flush();
 			di.diffcode.diffcode &= ~(DIFFCODE::DIFF | DIFFCODE::SAME);
-			int ndiff = CompareItems(queue, myStruct, curpos);
+			int ndiff = CompareItems(scheduler, myStruct, curpos);
 			if (ndiff > 0)
 			{
 				if (existsalldirs)
@@ -515,31 +1216,195 @@ static int CompareItems(NotificationQueue& queue, DiffFuncStruct *myStruct, uint
 					di.diffcode.diffcode |= DIFFCODE::SAME;
 			}
 		}
-		if (existsalldirs)
-			queue.enqueueUrgentNotification(new WorkNotification(di, queueResult));
-		else
-			queue.enqueueNotification(new WorkNotification(di, queueResult));
-		++count;
+		batcher.add(di);
 		pos = curpos;
 		pCtxt->GetNextSiblingDiffRefPosition(pos);
 	}
 
-	while (count > 0)
+	batcher.flush();
+	res += group.wait();
+
+	// Results of items in this folder are final now
+	if (pCtxt->m_pReportWriter && !pCtxt->ShouldAbort())
+	{
+		pos = pCtxt->GetFirstChildDiffPosition(parentdiffpos);
+		while (pos)
+			pCtxt->m_pReportWriter->WriteItem(pCtxt->GetNextSiblingDiffPosition(pos));
+	}
+
+	return pCtxt->ShouldAbort() ? -1 : res;
+}
+
+/**
+ * @brief Pending state of a folder in pipelined collect and compare.
+ */
+struct PendingFolder
+{
+	PendingFolder() : npending(0), ndiff(0) {}
+	int npending; /**< Scan and child compares not yet completed */
+	int ndiff; /**< Same as return value of CompareItems() for the folder */
+};
+
+typedef std::unordered_map<DIFFITEM *, PendingFolder> PendingFolderMap;
+
+/**
+ * @brief Collect and compare items in one pass.
+ *
+ * Folders are collected by a pool of scanning threads, one task per folder.
+ * As soon as a folder has been collected its items are queued to the
+ * compare threads, so collecting and comparing overlap. This thread
+ * tracks folders still pending and sets folder results (DIFF/SAME) when
+ * all children are compared, exactly like CompareItems() does.
+ *
+ * @param myStruct [in] A structure containing compare-related data.
+ * @return >= 0 number of diff items, -1 if compare was aborted
+ */
+int DirScan_CollectAndCompareItems(DiffFuncStruct *myStruct)
+{
+	CDiffContext *pCtxt = myStruct->context;
+	const unsigned nscanners = Environment::processorCount();
+	const PathContext paths = pCtxt->GetNormalizedPaths();
+	CompareScheduler scheduler(pCtxt);
+	NotificationQueue queueResult;
+	NotifyingResultSink resultSink(queueResult);
+	CompareBatcher batcher(scheduler, pCtxt, &resultSink);
+	DirScanQueue scanQueue(nscanners);
+	ThreadPool threadPool(2, nscanners + scheduler.GetThreadCount() + 2);
+	std::vector<DiffWorkerPtr> workers;
+	std::vector<DirScanWorkerPtr> scanners;
+
+	StartCompareThreads(scheduler, pCtxt, threadPool, workers);
+	for (unsigned i = 0; i < nscanners; ++i)
+	{
+		scanners.push_back(DirScanWorkerPtr(new DirScanWorker(scanQueue, queueResult, paths, myStruct, i)));
+		threadPool.start(*scanners[i]);
+	}
+
+	PendingFolderMap folders;
+	String subdir[3]; // blank to start at roots specified in diff context
+	folders[NULL].npending = 1;
+	scanQueue.push(0, new DirScanTask(subdir, pCtxt->m_bRecursive ? -1 : 0, NULL));
+	int nscans = 1;
+	int ncompares = 0;
+	int res = 0;
+	bool bCollectCompleted = false;
+	Stopwatch stopwatch;
+	stopwatch.start();
+
+	// Called when all children of folder are compared: set folder result
+	// and queue folder itself.
+	auto folderCompleted = [&](DIFFITEM *pdi)
+	{
+		PendingFolderMap::iterator it = folders.find(pdi);
+		int ndiff = it->second.ndiff;
+		folders.erase(it);
+		if (!pdi)
+		{
+			res = ndiff;
+			return;
+		}
+		bool existsalldirs = pdi->diffcode.existAll(pCtxt->GetCompareDirs());
+		if (ndiff > 0)
+		{
+			if (existsalldirs)
+				pdi->diffcode.diffcode |= DIFFCODE::DIFF;
+			folders[pCtxt->GetParentDiff(*pdi)].ndiff += ndiff;
+		}
+		else if (ndiff == 0)
+		{
+			if (existsalldirs)
+				pdi->diffcode.diffcode |= DIFFCODE::SAME;
+		}
+		batcher.add(*pdi);
+		++ncompares;
+	};
+
+	while (nscans > 0 || ncompares > 0)
 	{
-		AutoPtr<Notification> pNf(queueResult.waitDequeueNotification());
+		if (stopwatch.elapsed() > 2000000)
+		{
+			int event = CDiffThread::EVENT_COMPARE_PROGRESSED;
+			myStruct->m_listeners.notify(myStruct, event);
+			stopwatch.restart();
+		}
+
+		AutoPtr<Notification> pNf(queueResult.waitDequeueNotification(500));
 		if (!pNf)
-			break;
-		WorkCompletedNotification* pWorkCompletedNf = dynamic_cast<WorkCompletedNotification*>(pNf.get());
-		if (pWorkCompletedNf) {
-			DIFFITEM &di = pWorkCompletedNf->data();
-			bool existsalldirs = ((pCtxt->GetCompareDirs() == 2 && di.diffcode.isSideBoth()) || (pCtxt->GetCompareDirs() == 3 && di.diffcode.isSideAll()));
-			if (di.diffcode.isResultDiff() ||
-				(!existsalldirs && !di.diffcode.isResultFiltered()))
-				res++;
+			continue;
+		bool bAborting = pCtxt->ShouldAbort();
+		if (ScanCompletedNotification* pScanNf = dynamic_cast<ScanCompletedNotification*>(pNf.get()))
+		{
+			--nscans;
+			DIFFITEM *parent = pScanNf->parent();
+			PendingFolder &folder = folders[parent];
+			const std::vector<DIFFITEM *>& subdirs = pScanNf->subdirs();
+			std::vector<DIFFITEM *>::const_iterator itSubdir = subdirs.begin();
+			uintptr_t pos = pCtxt->GetFirstChildDiffPosition(reinterpret_cast<uintptr_t>(parent));
+			while (pos && !bAborting)
+			{
+				DIFFITEM &di = pCtxt->GetNextSiblingDiffRefPosition(pos);
+				++folder.npending;
+				if (di.diffcode.isDirectory() && pCtxt->m_bRecursive)
+				{
+					di.diffcode.diffcode &= ~(DIFFCODE::DIFF | DIFFCODE::SAME);
+					PendingFolder &subfolder = folders[&di];
+					if (itSubdir != subdirs.end() && *itSubdir == &di)
+					{
+						// Subfolder is being scanned by scanning threads
+						subfolder.npending = 1;
+						++nscans;
+						++itSubdir;
+					}
+					else
+					{
+						folderCompleted(&di);
+					}
+				}
+				else
+				{
+					batcher.add(di);
+					++ncompares;
+				}
+			}
+			// Folder scan itself is done
+			if (--folder.npending == 0)
+				folderCompleted(parent);
+			if (nscans == 0 && !bCollectCompleted)
+			{
+				bCollectCompleted = true;
+				int event = CDiffThread::EVENT_COLLECT_COMPLETED;
+				myStruct->m_listeners.notify(myStruct, event);
+			}
 		}
-		--count;
+		else if (BatchCompletedNotification* pBatchNf = dynamic_cast<BatchCompletedNotification*>(pNf.get()))
+		{
+			if (pCtxt->m_pReportWriter)
+			{
+				const CompareBatch& batch = pBatchNf->batch();
+				for (unsigned i = 0; i < batch.count; ++i)
+					pCtxt->m_pReportWriter->WriteItem(*batch.items[i]);
+			}
+			ncompares -= pBatchNf->completed();
+			PendingFolder &folder = folders[pBatchNf->parent()];
+			folder.ndiff += pBatchNf->diffs();
+			folder.npending -= pBatchNf->completed();
+			if (folder.npending == 0 && !bAborting)
+				folderCompleted(pBatchNf->parent());
+		}
+		// Items are queued in batches, don't keep compare threads waiting
+		batcher.flush();
+	}
+
+	if (!bCollectCompleted)
+	{
+		int event = CDiffThread::EVENT_COLLECT_COMPLETED;
+		myStruct->m_listeners.notify(myStruct, event);
 	}
 
+	scanQueue.stop();
+	scheduler.stop();
+	threadPool.joinAll();
+
 	return pCtxt->ShouldAbort() ? -1 : res;
 }
 
@@ -617,6 +1482,155 @@ static int markChildrenForRescan(CDiffContext *pCtxt, uintptr_t parentdiffpos)
 	return ncount;
 }
 
+/**
+ * @brief Find child item of folder by name on given side.
+ * @return Position of the item, 0 if not found.
+ */
+static uintptr_t FindChildItem(CDiffContext *pCtxt, uintptr_t parentdiffpos, int nIndex, const String& name)
+{
+	uintptr_t pos = pCtxt->GetFirstChildDiffPosition(parentdiffpos);
+	while (pos != NULL)
+	{
+		uintptr_t curpos = pos;
+		const DIFFITEM &di = pCtxt->GetNextSiblingDiffRefPosition(pos);
+		if (string_compare_nocase(di.diffFileInfo[nIndex].filename, name) == 0)
+			return curpos;
+	}
+	return 0;
+}
+
+/**
+ * @brief Mark items affected by changed paths for rescan.
+ *
+ * Changed files are marked for rescan, as are folders which have appeared
+ * or disappeared on the side; their contents are collected again. Other
+ * changes of folders are ignored, changed children are reported by
+ * themselves. For paths not in the results, the nearest folder in the
+ * results is added to @p folders for DirScan_CollectNewItems().
+ * @param [in] pCtxt Compare context.
+ * @param [in] nIndex Side of changed paths.
+ * @param [in] changes Changed paths relative to root folder of the side.
+ * @param [in,out] folders Folders to look for new items from, 0 is root.
+ * @return Number of items marked for rescan.
+ */
+int DirScan_MarkChangedItems(CDiffContext *pCtxt, int nIndex, const std::vector<String>& changes,
+	std::vector<uintptr_t>& folders)
+{
+	int ncount = 0;
+	const String root = pCtxt->GetNormalizedPath(nIndex);
+	for (std::vector<String>::const_iterator it = changes.begin(); it != changes.end(); ++it)
+	{
+		std::vector<String> names;
+		size_t start = 0;
+		while (start < it->length())
+		{
+			size_t end = it->find_first_of(_T("\\/"), start);
+			if (end == String::npos)
+				end = it->length();
+			if (end > start)
+				names.push_back(it->substr(start, end - start));
+			start = end + 1;
+		}
+		if (names.empty())
+			continue;
+
+		uintptr_t parentpos = 0;
+		uintptr_t pos = 0;
+		size_t i;
+		for (i = 0; i < names.size(); ++i)
+		{
+			pos = FindChildItem(pCtxt, parentpos, nIndex, names[i]);
+			if (!pos || (i + 1 < names.size() && !pCtxt->GetDiffAt(pos).diffcode.isDirectory()))
+				break;
+			parentpos = pos;
+		}
+		if (i < names.size())
+		{
+			if (std::find(folders.begin(), folders.end(), parentpos) == folders.end())
+				folders.push_back(parentpos);
+			continue;
+		}
+
+		DIFFITEM &di = pCtxt->GetDiffRefAt(pos);
+		if (di.diffcode.isScanNeeded())
+			continue;
+		if (di.diffcode.isDirectory())
+		{
+			bool bExists = paths_DoesPathExist(paths_ConcatPath(root, di.diffFileInfo[nIndex].GetFile())) == IS_EXISTING_DIR;
+			if (bExists == di.diffcode.exists(nIndex))
+				continue;
+		}
+		di.diffcode.diffcode &= ~(DIFFCODE::TEXTFLAGS | DIFFCODE::SIDEFLAGS | DIFFCODE::COMPAREFLAGS);
+		di.diffcode.diffcode |= DIFFCODE::NEEDSCAN;
+		++ncount;
+	}
+	return ncount;
+}
+
+/**
+ * @brief Add items which have appeared in folder after it was collected.
+ * New items are marked for rescan, existing items are left as they are.
+ * @param [in] myStruct A structure containing compare-related data.
+ * @param [in] parentdiffpos Folder to look for new items from, 0 is root.
+ * @return Number of new items.
+ */
+int DirScan_CollectNewItems(DiffFuncStruct *myStruct, uintptr_t parentdiffpos)
+{
+	CDiffContext *pCtxt = myStruct->context;
+	const int nDirs = pCtxt->GetCompareDirs();
+	DIFFITEM *parent = reinterpret_cast<DIFFITEM *>(parentdiffpos);
+	// Contents of marked folders are collected again anyway
+	if (parent && (parent->diffcode.isScanNeeded() || parent->diffcode.isResultFiltered()))
+		return 0;
+
+	std::set<String> existing;
+	size_t nexisting = 0;
+	uintptr_t pos = pCtxt->GetFirstChildDiffPosition(parentdiffpos);
+	while (pos != NULL)
+	{
+		const DIFFITEM &di = pCtxt->GetNextSiblingDiffRefPosition(pos);
+		for (int i = 0; i < nDirs; ++i)
+			existing.insert((di.diffcode.isDirectory() ? _T("D") : _T("F")) + string_makelower(di.diffFileInfo[i].filename));
+		++nexisting;
+	}
+
+	// Collected items are added after existing items
+	String subdir[3];
+	if (parent)
+	{
+		for (int i = 0; i < nDirs; ++i)
+			subdir[i] = parent->diffFileInfo[i].GetFile();
+	}
+	DirScan_GetItems(pCtxt->GetNormalizedPaths(), subdir, myStruct, false, 0, parent, pCtxt->m_bWalkUniques);
+
+	int nnew = 0;
+	pos = pCtxt->GetFirstChildDiffPosition(parentdiffpos);
+	for (size_t n = 0; n < nexisting && pos != NULL; ++n)
+		pCtxt->GetNextSiblingDiffRefPosition(pos);
+	while (pos != NULL)
+	{
+		uintptr_t curpos = pos;
+		DIFFITEM &di = pCtxt->GetNextSiblingDiffRefPosition(pos);
+		bool bExisting = false;
+		for (int i = 0; i < nDirs && !bExisting; ++i)
+		{
+			if (di.diffcode.exists(i))
+				bExisting = existing.find((di.diffcode.isDirectory() ? _T("D") : _T("F")) + string_makelower(di.diffFileInfo[i].filename)) != existing.end();
+		}
+		if (bExisting)
+		{
+			pCtxt->RemoveDiff(curpos);
+			continue;
+		}
+		// Contents of new folders are collected by DirScan_UpdateMarkedItems()
+		if (!di.diffcode.isDirectory() ||
+			(!di.diffcode.isResultFiltered() && (di.diffcode.existAll(nDirs) || pCtxt->m_bWalkUniques)))
+			di.diffcode.diffcode |= DIFFCODE::NEEDSCAN;
+		++nnew;
+	}
+	return nnew;
+}
+
 int DirScan_UpdateMarkedItems(DiffFuncStruct *myStruct, uintptr_t parentdiffpos)
 {
 	CDiffContext *pCtxt = myStruct->context;
@@ -634,7 +1648,7 @@ int DirScan_UpdateMarkedItems(DiffFuncStruct *myStruct, uintptr_t parentdiffpos)
 		{
 			UpdateDiffItem(di, bItemsExist, pCtxt);
 			if (!bItemsExist)
-				di.RemoveSelf();
+				pCtxt->RemoveDiff(curpos);
 			else if (!di.diffcode.isDirectory())
 				++ncount;
 		}
@@ -642,7 +1656,7 @@ int DirScan_UpdateMarkedItems(DiffFuncStruct *myStruct, uintptr_t parentdiffpos)
 		{
 			if (di.diffcode.isScanNeeded() && !di.diffcode.isResultFiltered())
 			{
-				di.RemoveChildren();
+				pCtxt->RemoveChildDiffs(curpos);
 				di.diffcode.diffcode &= ~DIFFCODE::NEEDSCAN;
 
 				bool casesensitive = false;
@@ -683,7 +1697,7 @@ static void UpdateDiffItem(DIFFITEM & di, bool & bExists, CDiffContext *pCtxt)
 	di.diffcode.setSideNone();
 	for (int i = 0; i < pCtxt->GetCompareDirs(); ++i)
 	{
-		di.diffFileInfo[i].ClearPartial();
+		di.ClearPartial(i);
 		if (pCtxt->UpdateInfoFromDiskHalf(di, i))
 		{
 			di.diffcode.diffcode |= DIFFCODE::FIRST << i;
@@ -780,21 +1794,22 @@ static void StoreDiffData(DIFFITEM &di, CDiffContext * pCtxt,
 	{
 		// Set text statistics
 		if (di.diffcode.isSideLeftOnlyOrBoth())
-			di.diffFileInfo[0].m_textStats = pCmpData->m_diffFileData.m_textStats[0];
+			di.SetTextStats(0, pCmpData->m_diffFileData.m_textStats[0]);
 		if (di.diffcode.isSideRightOnlyOrBoth())
-			di.diffFileInfo[1].m_textStats = pCmpData->m_diffFileData.m_textStats[1];
+			di.SetTextStats(1, pCmpData->m_diffFileData.m_textStats[1]);
 
 		di.nsdiffs = pCmpData->m_ndiffs;
 		di.nidiffs = pCmpData->m_ntrivialdiffs;
+		di.SetFirstDiffOffset(pCmpData->m_nFirstDiffOffset);
 
 		if (!di.diffcode.isSideFirstOnly())
 		{
-			di.diffFileInfo[1].encoding = pCmpData->m_diffFileData.m_FileLocation[1].encoding;
+			di.SetEncoding(1, pCmpData->m_diffFileData.m_FileLocation[1].encoding);
 		}
 		
 		if (!di.diffcode.isSideSecondOnly())
 		{
-			di.diffFileInfo[0].encoding = pCmpData->m_diffFileData.m_FileLocation[0].encoding;
+			di.SetEncoding(0, pCmpData->m_diffFileData.m_FileLocation[0].encoding);
 		}
 	}
 
@@ -811,7 +1826,7 @@ static void StoreDiffData(DIFFITEM &di, CDiffContext * pCtxt,
  * @param [in] pCtxt Compare context.
  * @param [in] parent Parent of item to be added
  */
-static DIFFITEM *AddToList(const String& sLeftDir, const String& sRightDir,
+static DIFFITEM *AddToList(const PooledPath& sLeftDir, const PooledPath& sRightDir,
 	const DirItem * lent, const DirItem * rent,
 	unsigned code, DiffFuncStruct *myStruct, DIFFITEM *parent)
 {
@@ -821,7 +1836,7 @@ static DIFFITEM *AddToList(const String& sLeftDir, const String& sRightDir,
 /**
  * @brief Add one compare item to list.
  */
-static DIFFITEM *AddToList(const String& sLeftDir, const String& sMiddleDir, const String& sRightDir,
+static DIFFITEM *AddToList(const PooledPath& sLeftDir, const PooledPath& sMiddleDir, const PooledPath& sRightDir,
 	const DirItem * lent, const DirItem * ment, const DirItem * rent,
 	unsigned code, DiffFuncStruct *myStruct, DIFFITEM *parent)
 {
@@ -830,7 +1845,6 @@ static DIFFITEM *AddToList(const String& sLeftDir, const String& sMiddleDir, con
 	// change to identical
 	DIFFITEM *di = myStruct->context->AddDiff(parent);
 
-	di->parent = parent;
 	di->diffFileInfo[0].path = sLeftDir;
 	di->diffFileInfo[1].path = sMiddleDir;
 	di->diffFileInfo[2].path = sRightDir;
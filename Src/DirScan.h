@@ -7,6 +7,7 @@
 
 #include "UnicodeString.h"
 #include <cstdint>
+#include <vector>
 
 class CDiffContext;
 class DiffItemList;
@@ -18,6 +19,10 @@ struct DiffFuncStruct;
 int DirScan_GetItems(const PathContext &paths, const String subdir[], DiffFuncStruct *myStruct,
 		bool casesensitive, int depth, DIFFITEM *parent, bool bUniques);
 int DirScan_UpdateMarkedItems(DiffFuncStruct *myStruct, uintptr_t parentdiffpos);
+int DirScan_MarkChangedItems(CDiffContext *pCtxt, int nIndex, const std::vector<String>& changes,
+		std::vector<uintptr_t>& folders);
+int DirScan_CollectNewItems(DiffFuncStruct *myStruct, uintptr_t parentdiffpos);
 
 int DirScan_CompareItems(DiffFuncStruct *, uintptr_t parentdiffpos);
 int DirScan_CompareRequestedItems(DiffFuncStruct *, uintptr_t parentdiffpos);
+int DirScan_CollectAndCompareItems(DiffFuncStruct *);
@@ -60,6 +60,7 @@
 #include "FileOrFolderSelect.h"
 #include "IntToIntMap.h"
 #include "PatchTool.h"
+#include "CompareResultCache.h"
 #include <numeric>
 #include <functional>
 
@@ -204,6 +205,7 @@ BEGIN_MESSAGE_MAP(CDirView, CListView)
 	ON_UPDATE_COMMAND_UI(ID_CURDIFF, OnUpdateCurdiff)
 	ON_UPDATE_COMMAND_UI(ID_FILE_SAVE, OnUpdateSave)
 	ON_MESSAGE(MSG_UI_UPDATE, OnUpdateUIMessage)
+	ON_MESSAGE(MSG_DIR_CHANGED, OnDirChangedMessage)
 	ON_COMMAND(ID_REFRESH, OnRefresh)
 	ON_UPDATE_COMMAND_UI(ID_REFRESH, OnUpdateRefresh)
 	ON_WM_TIMER()
@@ -1136,7 +1138,7 @@ void CDirView::CollapseSubdir(int sel)
 	for (int i = sel + 1; i < count; i++)
 	{
 		const DIFFITEM& di = GetDiffItem(i);
-		if (!di.IsAncestor(&dip))
+		if (!GetDiffContext().IsAncestorDiff(di, &dip))
 			break;
 		m_pList->DeleteItem(i--);
 		count--;
@@ -1166,7 +1168,7 @@ void CDirView::ExpandSubdir(int sel, bool bRecursive)
 	uintptr_t diffpos = ctxt.GetFirstChildDiffPosition(GetItemKey(sel));
 	UINT indext = sel + 1;
 	int alldiffs;
-	RedisplayChildren(diffpos, dip.GetDepth() + 1, indext, alldiffs);
+	RedisplayChildren(diffpos, ctxt.GetDiffDepth(dip) + 1, indext, alldiffs);
 
 	SortColumnsAppropriately();
 
@@ -1378,7 +1380,7 @@ void CDirView::OpenSelection(SELECTIONTYPE selectionType /*= SELECTIONTYPE_NORMA
 		for (int nIndex = 0; nIndex < paths.GetSize(); nIndex++)
 		{
 			fileloc[nIndex].setPath(paths[nIndex]);
-			fileloc[nIndex].encoding = pdi[nIndex]->diffFileInfo[nPane[nIndex]].encoding;
+			fileloc[nIndex].encoding = pdi[nIndex]->GetEncoding(nPane[nIndex]);
 		}
 		GetMainFrame()->ShowAutoMergeDoc(pDoc, paths.GetSize(), fileloc,
 			dwFlags, strDesc, _T(""), infoUnpacker);
@@ -1991,9 +1993,9 @@ BOOL CDirView::PreTranslateMessage(MSG* pMsg)
 				else if (m_bTreeMode && sel >= 0)
 				{
 					const DIFFITEM& di = GetDiffItem(sel);
-					if (di.parent != NULL)
+					if (DIFFITEM *pdiParent = GetDiffContext().GetParentDiff(di))
 					{
-						int i = GetItemIndex((uintptr_t)di.parent);
+						int i = GetItemIndex((uintptr_t)pdiParent);
 						if (i >= 0)
 							MoveFocus(sel, i, GetSelectedCount());
 					}
@@ -2097,12 +2099,22 @@ LRESULT CDirView::OnUpdateUIMessage(WPARAM wParam, LPARAM lParam)
 
 		// If compare took more than TimeToSignalCompare seconds, notify user
 		clock_t elapsed = clock() - m_compareStart;
-		GetParentFrame()->SetMessageText(
-			string_format(_("Elapsed time: %ld ms").c_str(), elapsed).c_str()
-		);
+		String sMessage = string_format(_("Elapsed time: %ld ms").c_str(), elapsed);
+		const CDiffContext &ctxt = GetDiffContext();
+		if (ctxt.m_pCompareResultCache)
+		{
+			const CompareResultCache::Stats &stats = ctxt.m_compareResultCacheStats;
+			sMessage += string_format(_(", cache: %d hits, %d misses, %d verified (%d failed)").c_str(),
+				stats.nHits.value(), stats.nMisses.value(), stats.nVerified.value(), stats.nVerifyFailures.value());
+		}
+		GetParentFrame()->SetMessageText(sMessage.c_str());
 		if (elapsed > TimeToSignalCompare * CLOCKS_PER_SEC)
 			MessageBeep(IDOK);
 		GetMainFrame()->StartFlashing();
+
+		// Folders changed during compare
+		if (pDoc->HasChangedItems())
+			PostMessage(MSG_DIR_CHANGED);
 	}
 	else if (wParam == CDiffThread::EVENT_COMPARE_PROGRESSED)
 	{
@@ -2128,6 +2140,24 @@ LRESULT CDirView::OnUpdateUIMessage(WPARAM wParam, LPARAM lParam)
 	return 0; // return value unused
 }
 
+/**
+ * @brief Called when folder watcher has noticed changes in compared folders.
+ * Changed items are compared again, keeping the tree state.
+ */
+LRESULT CDirView::OnDirChangedMessage(WPARAM wParam, LPARAM lParam)
+{
+	UNREFERENCED_PARAMETER(wParam);
+	UNREFERENCED_PARAMETER(lParam);
+
+	CDirDoc * pDoc = GetDocument();
+	if (pDoc->m_diffThread.GetThreadState() == CDiffThread::THREAD_COMPARING)
+		return 0; // Posted again when compare is ready
+
+	m_pSavedTreeState.reset(SaveTreeState(GetDiffContext()));
+	if (!pDoc->RescanChangedItems())
+		m_pSavedTreeState.reset();
+	return 0;
+}
 
 BOOL CDirView::OnNotify(WPARAM wParam, LPARAM lParam, LRESULT* pResult)
 {
@@ -3539,9 +3569,10 @@ void CDirView::OnSearch()
 				if (!ufile.OpenReadOnly(paths[i]))
 					continue;
 
-				ufile.SetUnicoding(di.diffFileInfo[i].encoding.m_unicoding);
-				ufile.SetBom(di.diffFileInfo[i].encoding.m_bom);
-				ufile.SetCodepage(di.diffFileInfo[i].encoding.m_codepage);
+				const FileTextEncoding &encoding = di.GetEncoding(i);
+				ufile.SetUnicoding(encoding.m_unicoding);
+				ufile.SetBom(encoding.m_bom);
+				ufile.SetCodepage(encoding.m_codepage);
 
 				ufile.ReadBom();
 
@@ -274,6 +274,7 @@ protected:
 	afx_msg void OnUpdateCurdiff(CCmdUI* pCmdUI);
 	afx_msg void OnUpdateSave(CCmdUI* pCmdUI);
 	afx_msg LRESULT OnUpdateUIMessage(WPARAM wParam, LPARAM lParam);
+	afx_msg LRESULT OnDirChangedMessage(WPARAM wParam, LPARAM lParam);
 	afx_msg void OnRefresh();
 	afx_msg void OnUpdateRefresh(CCmdUI* pCmdUI);
 	afx_msg void OnTimer(UINT_PTR nIDEvent);
@@ -7,6 +7,7 @@
  */
 #include "DirViewColItems.h"
 #include <cstdint>
+#include <cassert>
 #include <Poco/Timestamp.h>
 #include <Shlwapi.h>
 #include "UnicodeString.h"
@@ -23,7 +24,6 @@ using Poco::Timestamp;
 #endif
 
 using std::swap;
-using boost::int64_t;
 
 namespace
 {
@@ -179,8 +179,8 @@ static String MakeShortSize(int64_t size)
 template<class Type>
 static Type ColFileNameGet(const CDiffContext *, const void *p) //sfilename
 {
-	const boost::flyweight<String> &lfilename = static_cast<const DIFFITEM*>(p)->diffFileInfo[0].filename;
-	const boost::flyweight<String> &rfilename = static_cast<const DIFFITEM*>(p)->diffFileInfo[1].filename;
+	const PooledString &lfilename = static_cast<const DIFFITEM*>(p)->diffFileInfo[0].filename;
+	const PooledString &rfilename = static_cast<const DIFFITEM*>(p)->diffFileInfo[1].filename;
 	if (lfilename.get().empty())
 		return rfilename;
 	else if (rfilename.get().empty() || lfilename == rfilename)
@@ -477,12 +477,11 @@ static String ColNewerGet(const CDiffContext *pCtxt, const void *p)
 static String GetVersion(const CDiffContext * pCtxt, const DIFFITEM * pdi, int nIndex)
 {
 	DIFFITEM & di = const_cast<DIFFITEM &>(*pdi);
-	DiffFileInfo & dfi = di.diffFileInfo[nIndex];
-	if (dfi.version.IsCleared())
+	if (di.GetVersion(nIndex).IsCleared())
 	{
 		pCtxt->UpdateVersion(di, nIndex);
 	}
-	return dfi.version.GetFileVersionString();
+	return di.GetVersion(nIndex).GetFileVersionString();
 }
 
 /**
@@ -604,14 +603,37 @@ static String ColAttrGet(const CDiffContext *, const void *p)
 }
 
 /**
- * @brief Format File Encoding column data.
- * @param [in] p Pointer to file information.
+ * @brief Format File Encoding column data (for left-side file).
+ * @param [in] p Pointer to DIFFITEM.
+ * @return String to show in the column.
+ */
+static String ColLEncodingGet(const CDiffContext *, const void *p)
+{
+	const DIFFITEM &di = *static_cast<const DIFFITEM *>(p);
+	return di.GetEncoding(0).GetName();
+}
+
+/**
+ * @brief Format File Encoding column data (for middle-side file).
+ * @param [in] p Pointer to DIFFITEM.
+ * @return String to show in the column.
+ */
+static String ColMEncodingGet(const CDiffContext *, const void *p)
+{
+	const DIFFITEM &di = *static_cast<const DIFFITEM *>(p);
+	return di.GetEncoding(1).GetName();
+}
+
+/**
+ * @brief Format File Encoding column data (for right-side file).
+ * @param [in] pCtxt Pointer to compare context.
+ * @param [in] p Pointer to DIFFITEM.
  * @return String to show in the column.
  */
-static String ColEncodingGet(const CDiffContext *, const void *p)
+static String ColREncodingGet(const CDiffContext * pCtxt, const void *p)
 {
-	const DiffFileInfo &r = *static_cast<const DiffFileInfo *>(p);
-	return r.encoding.GetName();
+	const DIFFITEM &di = *static_cast<const DIFFITEM *>(p);
+	return di.GetEncoding(pCtxt->GetCompareDirs() < 3 ? 1 : 2).GetName();
 }
 
 /**
@@ -623,8 +645,7 @@ static String ColEncodingGet(const CDiffContext *, const void *p)
 static String GetEOLType(const CDiffContext *, const void *p, int index)
 {
 	const DIFFITEM &di = *static_cast<const DIFFITEM *>(p);
-	const DiffFileInfo & dfi = di.diffFileInfo[index];
-	const FileTextStats &stats = dfi.m_textStats;
+	const FileTextStats &stats = di.GetTextStats(index);
 
 	if (stats.ncrlfs == 0 && stats.ncrs == 0 && stats.nlfs == 0)
 	{
@@ -717,7 +738,7 @@ static int ColFileNameSort(const CDiffContext *pCtxt, const void *p, const void
 		return -1;
 	if (!ldi.diffcode.isDirectory() && rdi.diffcode.isDirectory())
 		return 1;
-	return string_compare_nocase(ColFileNameGet<boost::flyweight<String> >(pCtxt, p), ColFileNameGet<boost::flyweight<String> >(pCtxt, q));
+	return string_compare_nocase(ColFileNameGet<PooledString>(pCtxt, p), ColFileNameGet<PooledString>(pCtxt, q));
 }
 
 /**
@@ -879,16 +900,41 @@ static int ColAttrSort(const CDiffContext *, const void *p, const void *q)
 }
 
 /**
- * @brief Compare file encodings.
- * @param [in] p Pointer to first structure to compare.
- * @param [in] q Pointer to second structure to compare.
+ * @brief Compare file encodings of one side.
+ * @param [in] p Pointer to first DIFFITEM to compare.
+ * @param [in] q Pointer to second DIFFITEM to compare.
+ * @param [in] index Index of side to compare.
  * @return Compare result.
  */
-static int ColEncodingSort(const CDiffContext *, const void *p, const void *q)
+static int EncodingSort(const void *p, const void *q, int index)
+{
+	const DIFFITEM &r = *static_cast<const DIFFITEM *>(p);
+	const DIFFITEM &s = *static_cast<const DIFFITEM *>(q);
+	return FileTextEncoding::Collate(r.GetEncoding(index), s.GetEncoding(index));
+}
+
+/**
+ * @brief Compare file encodings (for left-side files).
+ */
+static int ColLEncodingSort(const CDiffContext *, const void *p, const void *q)
+{
+	return EncodingSort(p, q, 0);
+}
+
+/**
+ * @brief Compare file encodings (for middle-side files).
+ */
+static int ColMEncodingSort(const CDiffContext *, const void *p, const void *q)
+{
+	return EncodingSort(p, q, 1);
+}
+
+/**
+ * @brief Compare file encodings (for right-side files).
+ */
+static int ColREncodingSort(const CDiffContext * pCtxt, const void *p, const void *q)
 {
-	const DiffFileInfo &r = *static_cast<const DiffFileInfo *>(p);
-	const DiffFileInfo &s = *static_cast<const DiffFileInfo *>(q);
-	return FileTextEncoding::Collate(r.encoding, s.encoding);
+	return EncodingSort(p, q, pCtxt->GetCompareDirs() < 3 ? 1 : 2);
 }
 /* @} */
 
@@ -928,8 +974,8 @@ static DirColInfo f_cols[] =
 	{ _T("Binary"), COLHDR_BINARY, COLDESC_BINARY, &ColBinGet, &ColBinSort, 0, -1, true, DirColInfo::ALIGN_LEFT },
 	{ _T("Lattr"), COLHDR_LATTRIBUTES, COLDESC_LATTRIBUTES, &ColAttrGet, &ColAttrSort, FIELD_OFFSET(DIFFITEM, diffFileInfo[0].flags), -1, true, DirColInfo::ALIGN_LEFT },
 	{ _T("Rattr"), COLHDR_RATTRIBUTES, COLDESC_RATTRIBUTES, &ColAttrGet, &ColAttrSort, FIELD_OFFSET(DIFFITEM, diffFileInfo[1].flags), -1, true, DirColInfo::ALIGN_LEFT },
-	{ _T("Lencoding"), COLHDR_LENCODING, COLDESC_LENCODING, &ColEncodingGet, &ColEncodingSort, FIELD_OFFSET(DIFFITEM, diffFileInfo[0]), -1, true, DirColInfo::ALIGN_LEFT },
-	{ _T("Rencoding"), COLHDR_RENCODING, COLDESC_RENCODING, &ColEncodingGet, &ColEncodingSort, FIELD_OFFSET(DIFFITEM, diffFileInfo[1]), -1, true, DirColInfo::ALIGN_LEFT },
+	{ _T("Lencoding"), COLHDR_LENCODING, COLDESC_LENCODING, &ColLEncodingGet, &ColLEncodingSort, 0, -1, true, DirColInfo::ALIGN_LEFT },
+	{ _T("Rencoding"), COLHDR_RENCODING, COLDESC_RENCODING, &ColREncodingGet, &ColREncodingSort, 0, -1, true, DirColInfo::ALIGN_LEFT },
 	{ _T("Snsdiffs"), COLHDR_NSDIFFS, COLDESC_NSDIFFS, ColDiffsGet, ColDiffsSort, FIELD_OFFSET(DIFFITEM, nsdiffs), -1, false, DirColInfo::ALIGN_RIGHT },
 	{ _T("Snidiffs"), COLHDR_NIDIFFS, COLDESC_NIDIFFS, ColDiffsGet, ColDiffsSort, FIELD_OFFSET(DIFFITEM, nidiffs), -1, false, DirColInfo::ALIGN_RIGHT },
 	{ _T("Leoltype"), COLHDR_LEOL_TYPE, COLDESC_LEOL_TYPE, &ColLEOLTypeGet, 0, 0, -1, true, DirColInfo::ALIGN_LEFT },
@@ -962,9 +1008,9 @@ static DirColInfo f_cols3[] =
 	{ _T("Lattr"), COLHDR_LATTRIBUTES, COLDESC_LATTRIBUTES, &ColAttrGet, &ColAttrSort, FIELD_OFFSET(DIFFITEM, diffFileInfo[0].flags), -1, true, DirColInfo::ALIGN_LEFT },
 	{ _T("Mattr"), COLHDR_MATTRIBUTES, COLDESC_MATTRIBUTES, &ColAttrGet, &ColAttrSort, FIELD_OFFSET(DIFFITEM, diffFileInfo[1].flags), -1, true, DirColInfo::ALIGN_LEFT },
 	{ _T("Rattr"), COLHDR_RATTRIBUTES, COLDESC_RATTRIBUTES, &ColAttrGet, &ColAttrSort, FIELD_OFFSET(DIFFITEM, diffFileInfo[2].flags), -1, true, DirColInfo::ALIGN_LEFT },
-	{ _T("Lencoding"), COLHDR_LENCODING, COLDESC_LENCODING, &ColEncodingGet, &ColEncodingSort, FIELD_OFFSET(DIFFITEM, diffFileInfo[0]), -1, true, DirColInfo::ALIGN_LEFT },
-	{ _T("Mencoding"), COLHDR_MENCODING, COLDESC_MENCODING, &ColEncodingGet, &ColEncodingSort, FIELD_OFFSET(DIFFITEM, diffFileInfo[1]), -1, true, DirColInfo::ALIGN_LEFT },
-	{ _T("Rencoding"), COLHDR_RENCODING, COLDESC_RENCODING, &ColEncodingGet, &ColEncodingSort, FIELD_OFFSET(DIFFITEM, diffFileInfo[2]), -1, true, DirColInfo::ALIGN_LEFT },
+	{ _T("Lencoding"), COLHDR_LENCODING, COLDESC_LENCODING, &ColLEncodingGet, &ColLEncodingSort, 0, -1, true, DirColInfo::ALIGN_LEFT },
+	{ _T("Mencoding"), COLHDR_MENCODING, COLDESC_MENCODING, &ColMEncodingGet, &ColMEncodingSort, 0, -1, true, DirColInfo::ALIGN_LEFT },
+	{ _T("Rencoding"), COLHDR_RENCODING, COLDESC_RENCODING, &ColREncodingGet, &ColREncodingSort, 0, -1, true, DirColInfo::ALIGN_LEFT },
 	{ _T("Snsdiffs"), COLHDR_NSDIFFS, COLDESC_NSDIFFS, ColDiffsGet, ColDiffsSort, FIELD_OFFSET(DIFFITEM, nsdiffs), -1, false, DirColInfo::ALIGN_RIGHT },
 	{ _T("Snidiffs"), COLHDR_NIDIFFS, COLDESC_NIDIFFS, ColDiffsGet, ColDiffsSort, FIELD_OFFSET(DIFFITEM, nidiffs), -1, false, DirColInfo::ALIGN_RIGHT },
 	{ _T("Leoltype"), COLHDR_LEOL_TYPE, COLDESC_LEOL_TYPE, &ColLEOLTypeGet, &ColAttrSort, 0, -1, true, DirColInfo::ALIGN_LEFT },
@@ -1248,23 +1294,23 @@ DirViewColItems::ColSort(const CDiffContext *pCtxt, int col, const DIFFITEM & ld
 	const void * arg2;
 	if (bTreeMode)
 	{
-		int lLevel = ldi.GetDepth();
-		int rLevel = rdi.GetDepth();
+		int lLevel = pCtxt->GetDiffDepth(ldi);
+		int rLevel = pCtxt->GetDiffDepth(rdi);
 		const DIFFITEM *lcur = &ldi, *rcur = &rdi;
 		if (lLevel < rLevel)
 		{
 			for (; lLevel != rLevel; rLevel--)
-				rcur = rcur->parent;
+				rcur = pCtxt->GetParentDiff(*rcur);
 		}
 		else if (rLevel < lLevel)
 		{
 			for (; lLevel != rLevel; lLevel--)
-				lcur = lcur->parent;
+				lcur = pCtxt->GetParentDiff(*lcur);
 		}
-		while (lcur->parent != rcur->parent)
+		while (pCtxt->GetParentDiff(*lcur) != pCtxt->GetParentDiff(*rcur))
 		{
-			lcur = lcur->parent;
-			rcur = rcur->parent;
+			lcur = pCtxt->GetParentDiff(*lcur);
+			rcur = pCtxt->GetParentDiff(*rcur);
 		}
 		arg1 = reinterpret_cast<const char *>(lcur) + offset;
 		arg2 = reinterpret_cast<const char *>(rcur) + offset;
@@ -0,0 +1,334 @@
+/**
+ * @file  DirWatcher.cpp
+ *
+ * @brief Implementation of DirWatcher class
+ */
+
+#include "DirWatcher.h"
+#include <map>
+#include <cstdint>
+#include <Poco/Thread.h>
+#include <Poco/Runnable.h>
+#include <Poco/ScopedLock.h>
+#include <windows.h>
+#include "PathContext.h"
+#include "DirItem.h"
+#include "DirTravel.h"
+#include "paths.h"
+#include "unicoder.h"
+
+using Poco::FastMutex;
+
+/**
+ * @brief Watches one root folder in its own thread.
+ */
+class DirWatcher::RootWatcher: public Poco::Runnable
+{
+public:
+	RootWatcher(DirWatcher *pOwner, int nIndex, const String& root, int nPollInterval, bool bForcePolling)
+		: m_pOwner(pOwner), m_nIndex(nIndex), m_root(root), m_nPollInterval(nPollInterval)
+		, m_bForcePolling(bForcePolling)
+		, m_hStop(CreateEvent(NULL, TRUE, FALSE, NULL))
+	{
+	}
+
+	~RootWatcher()
+	{
+		CloseHandle(m_hStop);
+	}
+
+	void start() { m_thread.start(*this); }
+
+	void stop()
+	{
+		SetEvent(m_hStop);
+		m_thread.join();
+	}
+
+	void run()
+	{
+		if (m_bForcePolling || !watchChanges())
+			pollChanges();
+	}
+
+private:
+	enum
+	{
+		BUFFER_SIZE = 64 * 1024, /**< Max for ReadDirectoryChangesW() on network drives */
+		SETTLE_TIME = 300, /**< Milliseconds without changes before listeners are notified */
+	};
+
+	/** @brief Modification time and size of a file or folder. */
+	typedef std::pair<int64_t, int64_t> FileStamp;
+	typedef std::map<String, FileStamp> Snapshot;
+
+	bool watchChanges();
+	void pollChanges();
+	void takeSnapshot(const String& subdir, Snapshot& snapshot) const;
+	bool compareSnapshots(const Snapshot& previous, const Snapshot& current) const;
+
+	DirWatcher *m_pOwner;
+	int m_nIndex; /**< Side of the root folder */
+	String m_root;
+	int m_nPollInterval; /**< Milliseconds between folder listings when polling */
+	bool m_bForcePolling; /**< Poll even if change notifications are supported */
+	HANDLE m_hStop; /**< Set when thread must exit */
+	Poco::Thread m_thread;
+};
+
+/**
+ * @brief Watch root folder with change notifications.
+ * @return false if the file system doesn't support change notifications.
+ */
+bool DirWatcher::RootWatcher::watchChanges()
+{
+	HANDLE hDir = CreateFile(m_root.c_str(), FILE_LIST_DIRECTORY,
+		FILE_SHARE_READ | FILE_SHARE_WRITE | FILE_SHARE_DELETE, NULL,
+		OPEN_EXISTING, FILE_FLAG_BACKUP_SEMANTICS | FILE_FLAG_OVERLAPPED, NULL);
+	if (hDir == INVALID_HANDLE_VALUE)
+		return false;
+
+	const DWORD dwFilter = FILE_NOTIFY_CHANGE_FILE_NAME | FILE_NOTIFY_CHANGE_DIR_NAME |
+		FILE_NOTIFY_CHANGE_SIZE | FILE_NOTIFY_CHANGE_LAST_WRITE | FILE_NOTIFY_CHANGE_ATTRIBUTES;
+	std::vector<DWORD> buffer(BUFFER_SIZE / sizeof(DWORD)); // Must be DWORD-aligned
+	OVERLAPPED ov = {0};
+	ov.hEvent = CreateEvent(NULL, TRUE, FALSE, NULL);
+	HANDLE handles[2] = { ov.hEvent, m_hStop };
+	bool bSupported = true;
+	bool bFirst = true;
+	bool bPending = false; // Changes not notified to listeners yet
+
+	for (;;)
+	{
+		ResetEvent(ov.hEvent);
+		if (!ReadDirectoryChangesW(hDir, &buffer[0], BUFFER_SIZE, TRUE, dwFilter, NULL, &ov, NULL))
+		{
+			if (bFirst)
+				bSupported = false;
+			else
+				m_pOwner->SetOverflow();
+			break;
+		}
+		bFirst = false;
+
+		DWORD dwWait;
+		while ((dwWait = WaitForMultipleObjects(2, handles, FALSE, bPending ? SETTLE_TIME : INFINITE)) == WAIT_TIMEOUT)
+		{
+			m_pOwner->NotifyChanges();
+			bPending = false;
+		}
+		DWORD dwBytes = 0;
+		if (dwWait != WAIT_OBJECT_0)
+		{
+			CancelIo(hDir);
+			GetOverlappedResult(hDir, &ov, &dwBytes, TRUE);
+			break;
+		}
+		if (!GetOverlappedResult(hDir, &ov, &dwBytes, FALSE) || dwBytes == 0)
+		{
+			// Too many changes for the buffer, they are lost
+			m_pOwner->SetOverflow();
+		}
+		else
+		{
+			const BYTE *p = reinterpret_cast<const BYTE *>(&buffer[0]);
+			for (;;)
+			{
+				const FILE_NOTIFY_INFORMATION *pInfo = reinterpret_cast<const FILE_NOTIFY_INFORMATION *>(p);
+				std::wstring name(pInfo->FileName, pInfo->FileNameLength / sizeof(WCHAR));
+				m_pOwner->AddChange(m_nIndex, ucr::toTString(name));
+				if (pInfo->NextEntryOffset == 0)
+					break;
+				p += pInfo->NextEntryOffset;
+			}
+		}
+		bPending = true;
+	}
+	if (bPending)
+		m_pOwner->NotifyChanges();
+
+	CloseHandle(ov.hEvent);
+	CloseHandle(hDir);
+	return bSupported;
+}
+
+/**
+ * @brief Watch root folder by comparing folder listings.
+ * Used when change notifications are not supported.
+ */
+void DirWatcher::RootWatcher::pollChanges()
+{
+	Snapshot previous;
+	takeSnapshot(_T(""), previous);
+	while (WaitForSingleObject(m_hStop, m_nPollInterval) == WAIT_TIMEOUT)
+	{
+		Snapshot current;
+		takeSnapshot(_T(""), current);
+		if (compareSnapshots(previous, current))
+			m_pOwner->NotifyChanges();
+		previous.swap(current);
+	}
+}
+
+/**
+ * @brief Add times and sizes of all files and folders under subfolder.
+ */
+void DirWatcher::RootWatcher::takeSnapshot(const String& subdir, Snapshot& snapshot) const
+{
+	DirItemArray dirs, files;
+	LoadAndSortFiles(subdir.empty() ? m_root : paths_ConcatPath(m_root, subdir), &dirs, &files, false);
+	for (DirItemArray::const_iterator it = files.begin(); it != files.end(); ++it)
+	{
+		const String& filename = it->filename;
+		snapshot[subdir.empty() ? filename : paths_ConcatPath(subdir, filename)] =
+			FileStamp(it->mtime.epochMicroseconds(), static_cast<int64_t>(it->size));
+	}
+	for (DirItemArray::const_iterator it = dirs.begin(); it != dirs.end(); ++it)
+	{
+		if (WaitForSingleObject(m_hStop, 0) == WAIT_OBJECT_0)
+			return;
+		const String& filename = it->filename;
+		String path = subdir.empty() ? filename : paths_ConcatPath(subdir, filename);
+		snapshot[path] = FileStamp(-1, -1);
+		takeSnapshot(path, snapshot);
+	}
+}
+
+/**
+ * @brief Report paths added, removed or changed between snapshots.
+ * @return true if there were changes.
+ */
+bool DirWatcher::RootWatcher::compareSnapshots(const Snapshot& previous, const Snapshot& current) const
+{
+	bool bChanged = false;
+	Snapshot::const_iterator itPrev = previous.begin();
+	Snapshot::const_iterator itCur = current.begin();
+	while (itPrev != previous.end() || itCur != current.end())
+	{
+		if (itCur == current.end() || (itPrev != previous.end() && itPrev->first < itCur->first))
+		{
+			m_pOwner->AddChange(m_nIndex, itPrev->first);
+			++itPrev;
+			bChanged = true;
+		}
+		else if (itPrev == previous.end() || itCur->first < itPrev->first)
+		{
+			m_pOwner->AddChange(m_nIndex, itCur->first);
+			++itCur;
+			bChanged = true;
+		}
+		else
+		{
+			if (itPrev->second != itCur->second)
+			{
+				m_pOwner->AddChange(m_nIndex, itCur->first);
+				bChanged = true;
+			}
+			++itPrev;
+			++itCur;
+		}
+	}
+	return bChanged;
+}
+
+DirWatcher::DirWatcher()
+	: m_bOverflow(false)
+	, m_bNotified(false)
+	, m_bForcePolling(false)
+{
+}
+
+DirWatcher::~DirWatcher()
+{
+	Stop();
+}
+
+/**
+ * @brief Start watching root folders.
+ * @param [in] paths Root folders to watch, including subfolders.
+ * @param [in] nPollInterval Milliseconds between folder listings for
+ * folders not supporting change notifications.
+ */
+void DirWatcher::Start(const PathContext& paths, int nPollInterval)
+{
+	Stop();
+	for (int nIndex = 0; nIndex < paths.GetSize(); ++nIndex)
+	{
+		std::shared_ptr<RootWatcher> pWatcher(new RootWatcher(this, nIndex, paths[nIndex], nPollInterval, m_bForcePolling));
+		m_watchers.push_back(pWatcher);
+		pWatcher->start();
+	}
+}
+
+/**
+ * @brief Stop watching and forget collected changes.
+ */
+void DirWatcher::Stop()
+{
+	for (size_t i = 0; i < m_watchers.size(); ++i)
+		m_watchers[i]->stop();
+	m_watchers.clear();
+
+	FastMutex::ScopedLock lock(m_mutex);
+	for (int nIndex = 0; nIndex < 3; ++nIndex)
+		m_changes[nIndex].clear();
+	m_bOverflow = false;
+	m_bNotified = false;
+}
+
+bool DirWatcher::HasChanges() const
+{
+	FastMutex::ScopedLock lock(m_mutex);
+	return m_bOverflow || !m_changes[0].empty() || !m_changes[1].empty() || !m_changes[2].empty();
+}
+
+/**
+ * @brief Take changes collected since previous call.
+ * @param [out] changes Changed paths relative to root folders, per side.
+ * Same path can appear many times.
+ * @param [out] bOverflow Set to true if some changes were lost.
+ * @return true if there were changes.
+ */
+bool DirWatcher::GetChanges(std::vector<String> changes[3], bool& bOverflow)
+{
+	FastMutex::ScopedLock lock(m_mutex);
+	bool bChanged = m_bOverflow;
+	for (int nIndex = 0; nIndex < 3; ++nIndex)
+	{
+		changes[nIndex].clear();
+		changes[nIndex].swap(m_changes[nIndex]);
+		if (!changes[nIndex].empty())
+			bChanged = true;
+	}
+	bOverflow = m_bOverflow;
+	m_bOverflow = false;
+	m_bNotified = false;
+	return bChanged;
+}
+
+void DirWatcher::AddChange(int nIndex, const String& path)
+{
+	FastMutex::ScopedLock lock(m_mutex);
+	m_changes[nIndex].push_back(path);
+}
+
+void DirWatcher::SetOverflow()
+{
+	FastMutex::ScopedLock lock(m_mutex);
+	m_bOverflow = true;
+}
+
+/**
+ * @brief Notify listeners, once until changes are taken with GetChanges().
+ */
+void DirWatcher::NotifyChanges()
+{
+	{
+		FastMutex::ScopedLock lock(m_mutex);
+		if (m_bNotified)
+			return;
+		m_bNotified = true;
+	}
+	int event = 0;
+	m_listeners.notify(this, event);
+}
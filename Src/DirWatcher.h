@@ -0,0 +1,68 @@
+/**
+ * @file  DirWatcher.h
+ *
+ * @brief Declaration of DirWatcher class
+ */
+#pragma once
+
+#include <vector>
+#include <memory>
+#define POCO_NO_UNWINDOWS 1
+#include <Poco/Mutex.h>
+#include <Poco/BasicEvent.h>
+#include <Poco/Delegate.h>
+#include "UnicodeString.h"
+
+class PathContext;
+
+/**
+ * @brief Watches compared folders for changes.
+ *
+ * Every compared root folder is watched with its own thread, with
+ * ReadDirectoryChangesW() when the file system supports it and by polling
+ * folder listings otherwise (e.g. some network shares). Changed paths are
+ * collected until GetChanges() is called. Listeners are notified from the
+ * watcher threads once changes have settled, not for every change.
+ */
+class DirWatcher
+{
+public:
+	DirWatcher();
+	~DirWatcher();
+
+	void Start(const PathContext& paths, int nPollInterval);
+	void Stop();
+	bool IsStarted() const { return !m_watchers.empty(); }
+	/** @brief Poll folder listings even if change notifications are supported. */
+	void SetForcePolling(bool bForcePolling) { m_bForcePolling = bForcePolling; }
+	bool HasChanges() const;
+	bool GetChanges(std::vector<String> changes[3], bool& bOverflow);
+
+	template<class T>
+	void AddListener(T *pObj, void (T::*pMethod)(int& state)) {
+		m_listeners += Poco::delegate(pObj, pMethod);
+	}
+	template<class T>
+	void RemoveListener(T *pObj, void (T::*pMethod)(int& state)) {
+		m_listeners -= Poco::delegate(pObj, pMethod);
+	}
+
+	class RootWatcher;
+
+private:
+	DirWatcher(const DirWatcher&);
+	DirWatcher& operator=(const DirWatcher&);
+
+	friend class RootWatcher;
+	void AddChange(int nIndex, const String& path);
+	void SetOverflow();
+	void NotifyChanges();
+
+	std::vector<std::shared_ptr<RootWatcher>> m_watchers;
+	mutable Poco::FastMutex m_mutex;
+	std::vector<String> m_changes[3]; /**< Changed paths relative to roots */
+	bool m_bOverflow; /**< Changes were lost, everything must be rescanned */
+	bool m_bNotified; /**< Listeners notified of changes not yet taken */
+	bool m_bForcePolling; /**< Don't use change notifications */
+	Poco::BasicEvent<int> m_listeners; /**< Change listeners */
+};
@@ -106,6 +106,26 @@ FilterCommentsSet FilterCommentsManager::GetSetForFileType(const String& FileTyp
 	return pSet->second;
 }
 
+/**
+	@brief Get all file types and their comment markers as one string.
+		One line per file type, with type and markers separated by tabs.
+		Used to detect changes in the markers.
+*/
+std::string FilterCommentsManager::GetAsString() const
+{
+	std::string str;
+	std::map <String, FilterCommentsSet> :: const_iterator pSet;
+	for (pSet = m_FilterCommentsSetByFileType.begin(); pSet != m_FilterCommentsSetByFileType.end(); ++pSet)
+	{
+		str += ucr::toUTF8(pSet->first);
+		str += '\t' + pSet->second.StartMarker;
+		str += '\t' + pSet->second.EndMarker;
+		str += '\t' + pSet->second.InlineMarker;
+		str += '\n';
+	}
+	return str;
+}
+
 void FilterCommentsManager::CreateDefaultMarkers()
 {
 	FilterCommentsSet filtercommentsset[2];
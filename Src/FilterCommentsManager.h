@@ -63,6 +63,7 @@ class FilterCommentsManager
 public:
 	explicit FilterCommentsManager(const String &IniFileName = _T(""));
 	FilterCommentsSet GetSetForFileType(const String& FileTypeName) const;
+	std::string GetAsString() const;
 
 private:
 	FilterCommentsManager(const FilterCommentsManager&); //Don't allow copy
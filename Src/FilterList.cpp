@@ -6,11 +6,71 @@
 
 #include "FilterList.h"
 #include <vector>
+#include <cstring>
 #include <Poco/RegularExpression.h>
 #include "unicoder.h"
 
 using Poco::RegularExpression;
 
+/**
+ * @brief Most expressions compiled into one alternation.
+ * Poco reports at most 84 groups set, one per alternative.
+ */
+static const size_t MaxGroupItems = 64;
+
+/**
+ * @brief Can the expression be one alternative of a combined expression?
+ * Expressions referring to groups, naming groups, or using verbs, quoting
+ * or comments that could reach past their alternative, are matched alone.
+ * @param [in] expression Regular expression string.
+ * @return true if the expression can be combined with others.
+ */
+static bool IsCombinable(const std::string& expression)
+{
+	const size_t length = expression.length();
+	for (size_t i = 0; i + 1 < length; ++i)
+	{
+		const char c = expression[i];
+		const char next = expression[i + 1];
+		if (c == '\\')
+		{
+			if ((next >= '1' && next <= '9') || next == 'g' || next == 'k' || next == 'Q')
+				return false;
+			++i;
+		}
+		else if (c == '(' && next == '*')
+		{
+			return false;
+		}
+		else if (c == '(' && next == '?' && i + 2 < length)
+		{
+			const char kind = expression[i + 2];
+			if (kind == '<')
+			{
+				// Lookbehind (?<= or (?<! is fine, named group is not
+				if (i + 3 >= length || (expression[i + 3] != '=' && expression[i + 3] != '!'))
+					return false;
+			}
+			else if (kind == '\'' || kind == 'P' || kind == 'R' || kind == '&' || kind == '+' ||
+				(kind >= '0' && kind <= '9'))
+			{
+				return false;
+			}
+			else if ((kind >= 'a' && kind <= 'z') || (kind >= 'A' && kind <= 'Z') || kind == '-')
+			{
+				// Option settings, reject extended mode for its comments
+				for (size_t j = i + 2; j < length && expression[j] != ':' && expression[j] != ')'; ++j)
+				{
+					if (expression[j] == 'x' || (expression[j] == '-' && j + 1 < length &&
+						expression[j + 1] >= '0' && expression[j + 1] <= '9'))
+						return false;
+				}
+			}
+		}
+	}
+	return true;
+}
+
 /** 
  * @brief Constructor.
  */
@@ -36,14 +96,52 @@ FilterList::~FilterList()
  */
 void FilterList::AddRegExp(const std::string& regularExpression)
 {
+	filter_item_ptr item;
 	try
 	{
-		m_list.push_back(filter_item_ptr(new filter_item(regularExpression, RegularExpression::RE_UTF8)));
+		item.reset(new filter_item(regularExpression, RegularExpression::RE_UTF8));
 	}
 	catch (...)
 	{
 		// TODO:
+		return;
 	}
+	m_list.push_back(item);
+	if (!IsCombinable(regularExpression) || !AddToGroup(item.get()))
+		m_separate.push_back(item.get());
+}
+
+/**
+ * @brief Add expression as an alternative of the last group.
+ * The alternation of the group is compiled again with the new expression.
+ * @param [in] item Item of the expression.
+ * @return true if the alternation compiled, false if it didn't and the
+ * expression must be matched alone.
+ */
+bool FilterList::AddToGroup(const filter_item *item)
+{
+	if (m_groups.empty() || m_groups.back()->items.size() >= MaxGroupItems)
+		m_groups.push_back(filter_group_ptr(new filter_group));
+	filter_group& group = *m_groups.back();
+
+	std::string pattern = group.pattern;
+	if (!pattern.empty())
+		pattern += '|';
+	pattern += "(?:" + item->filterAsString + ")(?<f" + std::to_string(group.items.size() + 1) + ">)";
+	try
+	{
+		group.regexp.reset(new RegularExpression(pattern,
+			RegularExpression::RE_UTF8 | RegularExpression::RE_NO_AUTO_CAPTURE));
+	}
+	catch (...)
+	{
+		if (group.items.empty())
+			m_groups.pop_back();
+		return false;
+	}
+	group.pattern.swap(pattern);
+	group.items.push_back(item);
+	return true;
 }
 
 /** 
@@ -52,6 +150,8 @@ void FilterList::AddRegExp(const std::string& regularExpression)
 void FilterList::RemoveAllFilters()
 {
 	m_list.clear();
+	m_groups.clear();
+	m_separate.clear();
 }
 
 /** 
@@ -63,6 +163,21 @@ bool FilterList::HasRegExps() const
 	return !m_list.empty();
 }
 
+/**
+ * @brief Get all expressions in the list as one string.
+ * @return Expressions separated by newlines.
+ */
+std::string FilterList::GetAsString() const
+{
+	std::string str;
+	for (std::vector<filter_item_ptr>::const_iterator it = m_list.begin(); it != m_list.end(); ++it)
+	{
+		str += (*it)->filterAsString;
+		str += '\n';
+	}
+	return str;
+}
+
 /** 
  * @brief Match string against list of expressions.
  * This function matches given @p string against the list of regular
@@ -74,28 +189,45 @@ bool FilterList::HasRegExps() const
  */
 bool FilterList::Match(const std::string& string, int codepage/*=CP_UTF8*/)
 {
-	bool retval = false;
-	const size_t count = m_list.size();
+	return Match(string.c_str(), string.length(), codepage);
+}
 
-	// convert string into UTF-8
-	ucr::buffer buf(string.length() * 2);
+/** 
+ * @brief Match string against list of expressions.
+ * The alternations of the combined expressions are matched first, then
+ * the expressions that could not be combined.
+ * @param [in] string string to match, need not be zero-terminated.
+ * @param [in] length length of string in bytes.
+ * @param [in] codepage codepage of string.
+ * @return true if any of the expressions did match the string.
+ */
+bool FilterList::Match(const char *string, size_t length, int codepage/*=CP_UTF8*/)
+{
+	// Poco matches std::strings only, so reuse one per thread
+	static thread_local std::string subject;
 
+	// convert string into UTF-8
 	if (codepage != CP_UTF8)
-			ucr::convert(ucr::NONE, codepage, reinterpret_cast<const unsigned char *>(string.c_str()), 
-					string.length(), ucr::UTF8, CP_UTF8, &buf);
+	{
+		ucr::buffer buf(length * 2);
+		ucr::convert(ucr::NONE, codepage, reinterpret_cast<const unsigned char *>(string), 
+				length, ucr::UTF8, CP_UTF8, &buf);
+		if (buf.size > 0)
+			subject.assign(reinterpret_cast<const char *>(buf.ptr), buf.size);
+		else
+			subject.assign(string, length);
+	}
+	else
+		subject.assign(string, length);
 
-	unsigned i = 0;
-	while (i < count && retval == false)
+	for (std::vector<filter_group_ptr>::const_iterator it = m_groups.begin(); it != m_groups.end(); ++it)
 	{
-		const filter_item_ptr& item = m_list[i];
+		const filter_group& group = **it;
 		int result = 0;
 		RegularExpression::Match match;
 		try
 		{
-			if (buf.size > 0)
-				result = item->regexp.match(std::string(reinterpret_cast<const char *>(buf.ptr), buf.size), 0, match);
-			else
-				result = item->regexp.match(string, 0, match);
+			result = group.regexp->match(subject, 0, match);
 		}
 		catch (...)
 		{
@@ -103,14 +235,33 @@ bool FilterList::Match(const std::string& string, int codepage/*=CP_UTF8*/)
 		}
 		if (result > 0)
 		{
-			m_lastMatchExpression = &item->filterAsString;
-			retval = true;
+			// Group of alternative N is number N, result is one more
+			const size_t i = result > 1 ? result - 2 : 0;
+			m_lastMatchExpression = &group.items[i < group.items.size() ? i : 0]->filterAsString;
+			return true;
+		}
+	}
+
+	for (std::vector<const filter_item *>::const_iterator it = m_separate.begin(); it != m_separate.end(); ++it)
+	{
+		int result = 0;
+		RegularExpression::Match match;
+		try
+		{
+			result = (*it)->regexp.match(subject, 0, match);
+		}
+		catch (...)
+		{
+			// TODO:
+		}
+		if (result > 0)
+		{
+			m_lastMatchExpression = &(*it)->filterAsString;
+			return true;
 		}
-		else
-			++i;
 	}
 
-	return retval;
+	return false;
 }
 
 /** 
@@ -122,3 +273,34 @@ const char * FilterList::GetLastMatchExpression() const
 {
 	return m_lastMatchExpression->c_str();
 }
+
+/**
+ * @brief Match line against list of expressions, once per key.
+ * @param [in] filterList Expressions to match.
+ * @param [in] key Equivalence class of the line, or negative if none.
+ * @param [in] string Line to match.
+ * @param [in] length Length of the line in bytes.
+ * @param [in] codepage Codepage of the line.
+ * @return true if any of the expressions did match the line.
+ */
+bool FilterMatchCache::Match(FilterList& filterList, int key, const char *string, size_t length, int codepage)
+{
+	if (key < 0)
+		return filterList.Match(string, length, codepage);
+	if (static_cast<size_t>(key) >= m_results.size())
+	{
+		Result none = { NULL, 0, false };
+		m_results.resize(key + 1, none);
+	}
+	Result& result = m_results[key];
+	if (result.string == NULL)
+	{
+		result.string = string;
+		result.length = length;
+		result.match = filterList.Match(string, length, codepage);
+		return result.match;
+	}
+	if (result.length == length && (result.string == string || memcmp(result.string, string, length) == 0))
+		return result.match;
+	return filterList.Match(string, length, codepage);
+}
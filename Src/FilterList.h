@@ -27,11 +27,26 @@ struct filter_item
 
 typedef std::shared_ptr<filter_item> filter_item_ptr;
 
+/**
+ * @brief Expressions of several filter items compiled as one alternation.
+ * Each alternative ends with an empty group, and plain parentheses don't
+ * capture, so the number of the last group set tells which item matched.
+ */
+struct filter_group
+{
+	std::string pattern; /**< Alternation of the expressions */
+	std::unique_ptr<Poco::RegularExpression> regexp; /**< Compiled alternation */
+	std::vector<const filter_item *> items; /**< Items of the alternatives, in order */
+};
+
+typedef std::shared_ptr<filter_group> filter_group_ptr;
+
 /**
  * @brief Regular expression list.
  * This class holds a list of regular expressions for matching strings.
  * The class also provides simple function for matching and remembers the
- * last matched expression.
+ * last matched expression. Expressions are compiled into few alternations
+ * so a string is matched against all of them at once.
  */
 class FilterList
 {
@@ -43,10 +58,39 @@ public:
 	void RemoveAllFilters();
 	bool HasRegExps() const;
 	bool Match(const std::string& string, int codepage = CP_UTF8);
+	bool Match(const char *string, size_t length, int codepage = CP_UTF8);
+	std::string GetAsString() const;
 	const char * GetLastMatchExpression() const;
 
 private:
+	bool AddToGroup(const filter_item *item);
+
 	std::vector <filter_item_ptr> m_list;
+	std::vector <filter_group_ptr> m_groups; /**< Alternations of combinable items */
+	std::vector <const filter_item *> m_separate; /**< Items matched one by one */
 	const std::string *m_lastMatchExpression;
 
 };
+
+/**
+ * @brief Results of matching lines against a FilterList.
+ * A line is matched once per key, its equivalence class in diffutils.
+ * Lines of one class can differ when whitespace or case is ignored, so
+ * a result is only reused for the same text.
+ */
+class FilterMatchCache
+{
+public:
+	bool Match(FilterList& filterList, int key, const char *string, size_t length, int codepage);
+
+private:
+	/** @brief Result of the first line matched for a key. */
+	struct Result
+	{
+		const char *string; /**< Line matched, NULL if none yet */
+		size_t length; /**< Length of the line */
+		bool match; /**< Did the line match? */
+	};
+
+	std::vector<Result> m_results; /**< Results indexed by key */
+};
@@ -14,6 +14,7 @@
 #include "DiffContext.h"
 #include "DiffList.h"
 #include "DiffWrapper.h"
+#include "Diff3Pairs.h"
 #include "FileTransform.h"
 #include "IAbortable.h"
 #include "ByteComparator.h"
@@ -22,20 +23,24 @@
 #include "BinaryCompare.h"
 #include "TimeSizeCompare.h"
 #include "TFile.h"
+#include "CompareResultCache.h"
 
 using CompareEngines::ByteCompare;
 using CompareEngines::BinaryCompare;
 using CompareEngines::TimeSizeCompare;
 
 static void GetComparePaths(CDiffContext * pCtxt, const DIFFITEM &di, PathContext & files);
+static void DigestFileBuffers(const file_data inf[2], ContentDigest digests[2]);
 
 FolderCmp::FolderCmp()
 : m_pDiffUtilsEngine(nullptr)
+, m_pStreamDiff(nullptr)
 , m_pByteCompare(nullptr)
 , m_pBinaryCompare(nullptr)
 , m_pTimeSizeCompare(nullptr)
 , m_ndiffs(CDiffContext::DIFFS_UNKNOWN)
 , m_ntrivialdiffs(CDiffContext::DIFFS_UNKNOWN)
+, m_nFirstDiffOffset(-1)
 {
 }
 
@@ -57,16 +62,74 @@ void FolderCmp::CleanupAfterPlugins(PluginsContext *plugCtxt)
  * @brief Prepare files (run plugins) & compare them, and return diffcode.
  * This is function to compare two files in folder compare. It is not used in
  * file compare.
+ *
+ * If the compare context has a result cache, unchanged file pairs are
+ * answered from the cache without opening the files. Other pairs are
+ * digested while compared, for verifying the stored result later.
  * @param [in] pCtxt Pointer to compare context.
  * @param [in, out] di Compared files with associated data.
  * @return Compare result code.
  */
 int FolderCmp::prepAndCompareFiles(CDiffContext * pCtxt, DIFFITEM &di)
+{
+	CompareResultCache *pCache = pCtxt->m_pCompareResultCache;
+	if (!pCache || !CompareResultCache::IsCacheable(pCtxt, di))
+		return compareFiles(pCtxt, di, NULL);
+
+	PathContext files;
+	GetComparePaths(pCtxt, di, files);
+	CompareResultCache::Result result;
+	if (pCache->Lookup(files, di, pCtxt->m_nCompareOptionsHash, result, pCtxt->m_compareResultCacheStats))
+	{
+		m_ndiffs = result.ndiffs;
+		m_ntrivialdiffs = result.ntrivialdiffs;
+		m_nFirstDiffOffset = result.nFirstDiffOffset;
+		for (int nIndex = 0; nIndex < 2; nIndex++)
+		{
+			m_diffFileData.m_textStats[nIndex] = result.textStats[nIndex];
+			m_diffFileData.m_FileLocation[nIndex].encoding = result.encoding[nIndex];
+		}
+		return result.code;
+	}
+
+	unsigned code = compareFiles(pCtxt, di, m_digests);
+	if (!DIFFCODE::isResultError(code) && !DIFFCODE::isResultAbort(code) && !pCtxt->ShouldAbort())
+	{
+		result.code = code;
+		result.ndiffs = m_ndiffs;
+		result.ntrivialdiffs = m_ntrivialdiffs;
+		result.nFirstDiffOffset = m_nFirstDiffOffset;
+		for (int nIndex = 0; nIndex < 2; nIndex++)
+		{
+			result.textStats[nIndex] = m_diffFileData.m_textStats[nIndex];
+			result.encoding[nIndex] = m_diffFileData.m_FileLocation[nIndex].encoding;
+			result.digest[nIndex] = m_digests[nIndex].GetDigest(di.diffFileInfo[nIndex].size);
+		}
+		pCache->Store(files, di, pCtxt->m_nCompareOptionsHash, result, pCtxt->m_compareResultCacheStats);
+	}
+	return code;
+}
+
+/**
+ * @brief Compare files of the item, and return diffcode.
+ * @param [in] pCtxt Pointer to compare context.
+ * @param [in, out] di Compared files with associated data.
+ * @param [out] pDigests Digests of both files, fed as far as the compare
+ *   reads them. NULL if not needed, and always for three files.
+ * @return Compare result code.
+ */
+int FolderCmp::compareFiles(CDiffContext * pCtxt, DIFFITEM &di, ContentDigest *pDigests)
 {
 	int nIndex;
 	int nCompMethod = pCtxt->GetCompareMethod();
 
 	unsigned code = DIFFCODE::FILE | DIFFCODE::CMPERR;
+	m_nFirstDiffOffset = -1;
+	if (pDigests)
+	{
+		pDigests[0].Reset();
+		pDigests[1].Reset();
+	}
 
 	if (nCompMethod == CMP_CONTENT ||
 		nCompMethod == CMP_QUICK_CONTENT)
@@ -169,14 +232,54 @@ int FolderCmp::prepAndCompareFiles(CDiffContext * pCtxt, DIFFITEM &di)
 
 		// If either file is larger than limit compare files by quick contents
 		// This allows us to (faster) compare big binary files
+		bool bStreamed = false;
 		if (nCompMethod == CMP_CONTENT && 
 			(di.diffFileInfo[0].size > pCtxt->m_nQuickCompareLimit ||
 			di.diffFileInfo[1].size > pCtxt->m_nQuickCompareLimit))
 		{
-			nCompMethod = CMP_QUICK_CONTENT;
+			// Big text files can be diffed a window at a time instead
+			if (pCtxt->m_nStreamingDiffMemory > 0 && files.GetSize() == 2)
+			{
+				if (m_pStreamDiff == NULL)
+					m_pStreamDiff.reset(new CompareEngines::StreamDiff());
+				m_pStreamDiff->SetMemoryLimit(pCtxt->m_nStreamingDiffMemory);
+				m_pStreamDiff->SetCodepage(codepage);
+				bool success = m_pStreamDiff->SetCompareOptions(
+						*pCtxt->GetCompareOptions(CMP_CONTENT));
+				if (success)
+				{
+					if (pCtxt->m_pFilterList != NULL)
+						m_pStreamDiff->SetFilterList(pCtxt->m_pFilterList.get());
+					else
+						m_pStreamDiff->ClearFilterList();
+					m_pStreamDiff->SetFilterCommentsManager(pCtxt->m_pFilterCommentsManager);
+					m_pStreamDiff->SetAbortable(pCtxt->GetAbortable());
+					m_pStreamDiff->SetFileData(2, m_diffFileData.m_inf);
+					m_pStreamDiff->SetDigests(pDigests);
+					code = m_pStreamDiff->CompareFiles();
+					m_pStreamDiff->GetDiffCounts(m_ndiffs, m_ntrivialdiffs);
+					m_pStreamDiff->GetTextStats(0, &m_diffFileData.m_textStats[0]);
+					m_pStreamDiff->GetTextStats(1, &m_diffFileData.m_textStats[1]);
+				}
+				else
+					code = DIFFCODE::FILE | DIFFCODE::TEXT | DIFFCODE::CMPERR;
+
+				// Binary files are left for quick compare
+				bStreamed = (code & DIFFCODE::COMPAREFLAGS) != DIFFCODE::NOCMP;
+
+				// If unique item, it was being compared to itself to determine encoding
+				// and the #diffs is invalid
+				if (bStreamed && (di.diffcode.isSideSecondOnly() || di.diffcode.isSideFirstOnly()))
+				{
+					m_ndiffs = CDiffContext::DIFFS_UNKNOWN;
+					m_ntrivialdiffs = CDiffContext::DIFFS_UNKNOWN;
+				}
+			}
+			if (!bStreamed)
+				nCompMethod = CMP_QUICK_CONTENT;
 		}
 
-		if (nCompMethod == CMP_CONTENT)
+		if (nCompMethod == CMP_CONTENT && !bStreamed)
 		{
 			if (files.GetSize() == 2)
 			{
@@ -194,6 +297,8 @@ int FolderCmp::prepAndCompareFiles(CDiffContext * pCtxt, DIFFITEM &di)
 					m_pDiffUtilsEngine->SetFilterCommentsManager(pCtxt->m_pFilterCommentsManager);
 					m_pDiffUtilsEngine->SetFileData(2, m_diffFileData.m_inf);
 					code = m_pDiffUtilsEngine->diffutils_compare_files();
+					if (pDigests)
+						DigestFileBuffers(m_diffFileData.m_inf, pDigests);
 					m_pDiffUtilsEngine->GetDiffCounts(m_ndiffs, m_ntrivialdiffs);
 					m_pDiffUtilsEngine->GetTextStats(0, &m_diffFileData.m_textStats[0]);
 					m_pDiffUtilsEngine->GetTextStats(1, &m_diffFileData.m_textStats[1]);
@@ -227,10 +332,11 @@ int FolderCmp::prepAndCompareFiles(CDiffContext * pCtxt, DIFFITEM &di)
 					bool bRet;
 					int bin_flag = 0, bin_flag10 = 0, bin_flag12 = 0;
 
-					m_pDiffUtilsEngine->SetFileData(2, diffdata10.m_diffFileData.m_inf);
-					bRet = m_pDiffUtilsEngine->Diff2Files(&script10, 0, &bin_flag10, false, NULL);
-					m_pDiffUtilsEngine->SetFileData(2, diffdata12.m_diffFileData.m_inf);
-					bRet = m_pDiffUtilsEngine->Diff2Files(&script12, 0, &bin_flag12, false, NULL);
+					// Diff middle to left and middle to right at the same time
+					bRet = Diff3Pairs(
+						*static_cast<DiffutilsOptions *>(pCtxt->GetCompareOptions(CMP_CONTENT)), false,
+						diffdata10.m_diffFileData.m_inf, diffdata12.m_diffFileData.m_inf,
+						&script10, &script12, &bin_flag10, &bin_flag12);
 					code = DIFFCODE::FILE;
 
 					CDiffWrapper dw;
@@ -284,6 +390,7 @@ int FolderCmp::prepAndCompareFiles(CDiffContext * pCtxt, DIFFITEM &di)
 					m_pByteCompare->SetAdditionalOptions(pCtxt->m_bStopAfterFirstDiff);
 					m_pByteCompare->SetAbortable(pCtxt->GetAbortable());
 					m_pByteCompare->SetFileData(2, m_diffFileData.m_inf);
+					m_pByteCompare->SetDigests(pDigests);
 	
 					// use our own byte-by-byte compare
 					code = m_pByteCompare->CompareFiles(m_diffFileData.m_FileLocation);
@@ -298,8 +405,8 @@ int FolderCmp::prepAndCompareFiles(CDiffContext * pCtxt, DIFFITEM &di)
 				// Set to special value to indicate invalid
 				m_ndiffs = CDiffContext::DIFFS_UNKNOWN_QUICKCOMPARE;
 				m_ntrivialdiffs = CDiffContext::DIFFS_UNKNOWN_QUICKCOMPARE;
-				di.diffFileInfo[0].m_textStats = m_diffFileData.m_textStats[0];
-				di.diffFileInfo[1].m_textStats = m_diffFileData.m_textStats[1];	
+				di.SetTextStats(0, m_diffFileData.m_textStats[0]);
+				di.SetTextStats(1, m_diffFileData.m_textStats[1]);	
 			}
 			else
 			{
@@ -313,6 +420,7 @@ int FolderCmp::prepAndCompareFiles(CDiffContext * pCtxt, DIFFITEM &di)
 					/* r */
 					m_pByteCompare->SetAdditionalOptions(pCtxt->m_bStopAfterFirstDiff);
 					m_pByteCompare->SetAbortable(pCtxt->GetAbortable());
+					m_pByteCompare->SetDigests(NULL);
 
 					// 10
 					m_pByteCompare->SetFileData(2, diffdata10.m_diffFileData.m_inf);
@@ -352,9 +460,9 @@ int FolderCmp::prepAndCompareFiles(CDiffContext * pCtxt, DIFFITEM &di)
 				m_ndiffs = CDiffContext::DIFFS_UNKNOWN_QUICKCOMPARE;
 				m_ntrivialdiffs = CDiffContext::DIFFS_UNKNOWN_QUICKCOMPARE;
 				// FIXME:
-				di.diffFileInfo[0].m_textStats = diffdata10.m_diffFileData.m_textStats[1];
-				di.diffFileInfo[1].m_textStats = diffdata10.m_diffFileData.m_textStats[0];	
-				di.diffFileInfo[2].m_textStats = diffdata12.m_diffFileData.m_textStats[1];	
+				di.SetTextStats(0, diffdata10.m_diffFileData.m_textStats[1]);
+				di.SetTextStats(1, diffdata10.m_diffFileData.m_textStats[0]);	
+				di.SetTextStats(2, diffdata12.m_diffFileData.m_textStats[1]);	
 			}
 		}
 exitPrepAndCompare:
@@ -388,7 +496,7 @@ exitPrepAndCompare:
 
 		PathContext files;
 		GetComparePaths(pCtxt, di, files);
-		code = m_pBinaryCompare->CompareFiles(files, di);
+		code = m_pBinaryCompare->CompareFiles(files, di, &m_nFirstDiffOffset, pDigests);
 	}
 	else if (nCompMethod == CMP_DATE || nCompMethod == CMP_DATE_SIZE || nCompMethod == CMP_SIZE)
 	{
@@ -407,6 +515,22 @@ exitPrepAndCompare:
 	return code;
 }
 
+/**
+ * @brief Digest files diffutils has read whole to memory.
+ * Binary files bigger than a buffer are compared a buffer at a time, and
+ * files converted from UCS-2 or given a final newline by diffutils have
+ * another size in memory. Those are left undigested.
+ */
+static void DigestFileBuffers(const file_data inf[2], ContentDigest digests[2])
+{
+	for (int nIndex = 0; nIndex < 2; nIndex++)
+	{
+		if (inf[nIndex].buffer &&
+			static_cast<int64_t>(inf[nIndex].buffered_chars) == static_cast<int64_t>(inf[nIndex].stat.st_size))
+			digests[nIndex].Update(inf[nIndex].buffer, inf[nIndex].buffered_chars);
+	}
+}
+
 /**
  * @brief Get actual compared paths from DIFFITEM.
  * @param [in] pCtx Pointer to compare context.
@@ -8,10 +8,12 @@
 #include <memory>
 #include "DiffFileData.h"
 #include "DiffUtils.h"
+#include "StreamDiff.h"
 #include "ByteCompare.h"
 #include "BinaryCompare.h"
 #include "TimeSizeCompare.h"
 #include "PathContext.h"
+#include "ContentDigest.h"
 
 class CDiffContext;
 class PackingInfo;
@@ -46,11 +48,17 @@ public:
 
 	int m_ndiffs;
 	int m_ntrivialdiffs;
+	int64_t m_nFirstDiffOffset; /**< Offset of first differing byte in binary compare, -1 if not known */
 
 	DiffFileData m_diffFileData;
 
 private:
+	int compareFiles(CDiffContext * pCtxt, DIFFITEM &di, ContentDigest *pDigests);
+
+	ContentDigest m_digests[2]; /**< Digests of files compared for the result cache */
+
 	std::unique_ptr<CompareEngines::DiffUtils> m_pDiffUtilsEngine;
+	std::unique_ptr<CompareEngines::StreamDiff> m_pStreamDiff;
 	std::unique_ptr<CompareEngines::ByteCompare> m_pByteCompare;
 	std::unique_ptr<CompareEngines::BinaryCompare> m_pBinaryCompare;
 	std::unique_ptr<CompareEngines::TimeSizeCompare> m_pTimeSizeCompare;
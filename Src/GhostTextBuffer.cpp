@@ -452,6 +452,31 @@ void CGhostTextBuffer::RemoveAllGhostLines()
 	RecomputeRealityMapping();
 }
 
+/**
+ * @brief Remove the ghost lines in a range of lines from the buffer.
+ * @param [in] nStartLine First line of the range.
+ * @param [in] nLines Number of lines in the range.
+ */
+void CGhostTextBuffer::RemoveGhostLines(int nStartLine, int nLines)
+{
+	int nEndLine = nStartLine + nLines;
+	int newnl = nStartLine;
+	int ct;
+	// Free the buffer of ghost lines and compact non-ghost lines
+	// (we copy the buffer address, so the buffer don't move and we don't free it)
+	for(ct = nStartLine; ct < nEndLine; ct++)
+	{
+		if (GetLineFlags(ct) & LF_GHOST)
+			m_aLines[ct].FreeBuffer();
+		else
+			m_aLines[newnl++] = m_aLines[ct];
+	}
+
+	// Discard unused entries in one shot
+	m_aLines.erase(m_aLines.begin() + newnl, m_aLines.begin() + nEndLine);
+	RecomputeRealityMapping();
+}
+
 ////////////////////////////////////////////////////////////////////////////
 // apparent <-> real line conversion
 
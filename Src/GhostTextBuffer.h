@@ -115,6 +115,8 @@ public:
 	void FinishLoading();
 	/** for saving file */ 
 	void RemoveAllGhostLines();
+	/** for rescanning some lines */
+	void RemoveGhostLines(int nStartLine, int nLines);
 
 
 private:
@@ -0,0 +1,210 @@
+/////////////////////////////////////////////////////////////////////////////
+//    License (GPLv2+):
+//    This program is free software; you can redistribute it and/or modify
+//    it under the terms of the GNU General Public License as published by
+//    the Free Software Foundation; either version 2 of the License, or (at
+//    your option) any later version.
+//
+//    This program is distributed in the hope that it will be useful, but
+//    WITHOUT ANY WARRANTY; without even the implied warranty of
+//    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+//    GNU General Public License for more details.
+//
+//    You should have received a copy of the GNU General Public License
+//    along with this program; if not, write to the Free Software
+//    Foundation, Inc., 675 Mass Ave, Cambridge, MA 02139, USA.
+/////////////////////////////////////////////////////////////////////////////
+/**
+ * @file  HashChunks.cpp
+ *
+ * @brief Hashing lines of compared files in several threads.
+ */
+
+#include <vector>
+#include <memory>
+#include <atomic>
+#include <cstring>
+#include <Poco/Thread.h>
+#include <Poco/Runnable.h>
+#include <Poco/Environment.h>
+#include <Poco/Exception.h>
+#include <Poco/Mutex.h>
+#include <Poco/Event.h>
+#include "diff.h"
+
+namespace
+{
+
+/** @brief Smallest piece of a file worth hashing in a thread of its own. */
+const size_t HashChunkMinDefault = 4 * 1024 * 1024;
+
+/** @brief Smallest piece of a file hashed in a thread of its own. */
+std::atomic<size_t> g_hashChunkMin(HashChunkMinDefault);
+
+/** @brief Hashes lines of one piece of a file in a thread of its own. */
+class ChunkHasher : public Poco::Runnable
+{
+public:
+	explicit ChunkHasher(struct hash_chunk *chunk) : m_chunk(chunk) {}
+	virtual void run() { hash_chunk_lines(m_chunk); }
+
+private:
+	struct hash_chunk *m_chunk;
+};
+
+/** @brief Lets one comparison wait for lines shared by another. */
+struct SharedLinesSync
+{
+	SharedLinesSync() : claimed(false), published(false), event(false) {}
+	Poco::FastMutex mutex;
+	bool claimed; /**< Is a comparison finding the lines? */
+	bool published; /**< Are the lines found, or will they never be? */
+	Poco::Event event; /**< Set when published. */
+};
+
+SharedLinesSync *GetSync(struct shared_lines *shared)
+{
+	return static_cast<SharedLinesSync *>(shared->sync);
+}
+
+}
+
+/**
+ * @brief Return the most pieces one file is split into for hashing.
+ */
+extern "C" int hash_thread_count(void)
+{
+	static const int nthreads = static_cast<int>(Poco::Environment::processorCount());
+	return nthreads;
+}
+
+/**
+ * @brief Return the smallest piece of a file hashed in a thread of its own.
+ * Less than a quarter of it, in all pieces together, is hashed in the
+ * comparing thread only.
+ */
+extern "C" size_t hash_chunk_min(void)
+{
+	return g_hashChunkMin;
+}
+
+/**
+ * @brief Set the smallest piece of a file hashed in a thread of its own.
+ * Only for testing: small files are hashed in pieces like big ones then.
+ * @param [in] size Size in bytes, 0 for the default.
+ */
+extern "C" void set_hash_chunk_min(size_t size)
+{
+	g_hashChunkMin = size ? size : HashChunkMinDefault;
+}
+
+/**
+ * @brief Find and hash lines of pieces of the compared files.
+ * The first piece is hashed in the calling thread and the others in threads
+ * started for them, unless there is too little text to make that pay off.
+ * @param [in,out] chunks Pieces of files, see hash_chunk_lines().
+ * @param [in] nchunks Number of pieces.
+ */
+extern "C" void hash_chunks(struct hash_chunk *chunks, int nchunks)
+{
+	size_t size = 0;
+	for (int i = 0; i < nchunks; ++i)
+	{
+		if (chunks[i].begin < chunks[i].end)
+			size += chunks[i].end - chunks[i].begin;
+	}
+
+	std::vector<std::unique_ptr<ChunkHasher>> hashers;
+	std::vector<std::unique_ptr<Poco::Thread>> threads;
+	if (size >= hash_chunk_min() / 4)
+	{
+		for (int i = 1; i < nchunks; ++i)
+		{
+			hashers.emplace_back(new ChunkHasher(&chunks[i]));
+			threads.emplace_back(new Poco::Thread());
+			try
+			{
+				threads.back()->start(*hashers.back());
+			}
+			catch (Poco::SystemException&)
+			{
+				// Could not start a thread, hash the rest here
+				hashers.pop_back();
+				threads.pop_back();
+				break;
+			}
+		}
+	}
+
+	hash_chunk_lines(&chunks[0]);
+	for (int i = static_cast<int>(threads.size()) + 1; i < nchunks; ++i)
+		hash_chunk_lines(&chunks[i]);
+	for (size_t i = 0; i < threads.size(); ++i)
+		threads[i]->join();
+}
+
+/**
+ * @brief Prepare to share lines of a file between two comparisons.
+ * @param [out] shared Lines to share, none yet.
+ */
+extern "C" void init_shared_lines(struct shared_lines *shared)
+{
+	memset(shared, 0, sizeof(*shared));
+	shared->sync = new SharedLinesSync();
+}
+
+/**
+ * @brief Free lines shared by comparisons that are both done.
+ * @param [in,out] shared Lines to free.
+ */
+extern "C" void free_shared_lines(struct shared_lines *shared)
+{
+	free(shared->linbuf);
+	free(shared->hashes);
+	free(shared->classes);
+	delete GetSync(shared);
+	memset(shared, 0, sizeof(*shared));
+}
+
+/**
+ * @brief Let a comparison find the shared lines if no other does.
+ * @param [in,out] shared Lines to share.
+ * @return Nonzero if the caller must find the lines and publish them,
+ * zero if another comparison finds them or they were published already.
+ */
+extern "C" int claim_shared_lines(struct shared_lines *shared)
+{
+	SharedLinesSync *sync = GetSync(shared);
+	Poco::FastMutex::ScopedLock lock(sync->mutex);
+	if (sync->claimed || sync->published)
+		return 0;
+	sync->claimed = true;
+	return 1;
+}
+
+/**
+ * @brief Let comparisons waiting for shared lines go on.
+ * This is also called for each comparison when it is done, however it
+ * ended, so no comparison waits for lines that will never be found. Then
+ * shared->text is null unless the lines were found.
+ * @param [in,out] shared Lines found, or not.
+ */
+extern "C" void publish_shared_lines(struct shared_lines *shared)
+{
+	SharedLinesSync *sync = GetSync(shared);
+	Poco::FastMutex::ScopedLock lock(sync->mutex);
+	if (!sync->published)
+	{
+		sync->published = true;
+		sync->event.set();
+	}
+}
+
+/**
+ * @brief Wait until shared lines are published.
+ * @param [in] shared Lines to wait for.
+ */
+extern "C" void wait_shared_lines(struct shared_lines *shared)
+{
+	GetSync(shared)->event.wait();
+}
@@ -64,8 +64,7 @@ static void UpdateDiffItem(int nBuffers, DIFFITEM &di, CDiffContext *pCtxt)
 	di.diffcode.diffcode |= DIFFCODE::SIDEFLAGS;
 	for (int nBuffer = 0; nBuffer < nBuffers; nBuffer++)
 	{
-		di.diffFileInfo[nBuffer].ClearPartial();
-		di.diffFileInfo[nBuffer].ClearPartial();
+		di.ClearPartial(nBuffer);
 		if (!pCtxt->UpdateInfoFromDiskHalf(di, nBuffer))
 		{
 			if (nBuffer == 0)
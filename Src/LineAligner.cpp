@@ -0,0 +1,374 @@
+/**
+ * @file  LineAligner.cpp
+ *
+ * @brief Implementation of LineAligner class.
+ */
+
+#include "LineAligner.h"
+#include <tchar.h>
+#include <algorithm>
+#include <climits>
+
+namespace
+{
+
+/** @brief Number of minimum hashes in a sketch of a line. */
+const int SketchSize = 16;
+
+/** @brief Number of characters in a trigram. */
+const int GramSize = 3;
+
+/** @brief Number of hashes in key of a bucket of similar lines. */
+const int BucketHashes = 2;
+
+/** @brief Most lines of a bucket looked at, bigger buckets hold common lines. */
+const size_t MaxBucketSize = 8;
+
+/** @brief Fewest equal hashes of lines counted as similar. */
+const int SimilarHashes = SketchSize / 4;
+
+/** @brief Fewest equal hashes of lines to anchor alignment at. */
+const int AnchorHashes = SketchSize / 2;
+
+/** @brief Lines the band of alignment extends to on both sides of anchors. */
+const int BandWidth = 32;
+
+/** @brief Narrowest band, used for huge blocks. */
+const int MinBandWidth = 4;
+
+/** @brief Most steps of alignment kept in memory, narrowing band of huge blocks. */
+const size_t MaxBandCells = 16 * 1024 * 1024;
+
+/** @brief Seeds of hash functions of a sketch. */
+const uint64_t Seeds[SketchSize] =
+{
+	0xb9096a04e7d80068ULL,
+	0xc963cfe0afae5a3bULL,
+	0xe1454c40c439f34aULL,
+	0x26b563b1e794ee14ULL,
+	0xac8be7d742840d2bULL,
+	0xd96e5adfa2beee31ULL,
+	0x19fcfc64e7aa8576ULL,
+	0x53d23c0bdf43efb2ULL,
+	0xe7ca430e92ac3d42ULL,
+	0x06e82a012b5c5cd1ULL,
+	0x6820212c69599354ULL,
+	0x1333bc1cfe6c2b03ULL,
+	0x20050ed31a6e72b9ULL,
+	0x7972a36d51b31a6cULL,
+	0x94a67f00f335c357ULL,
+	0x6977a41b730bed9cULL
+};
+
+/** @brief Steps of alignment. */
+enum
+{
+	StepMatch, /**< Lines of both sides are matched. */
+	StepSkip0, /**< Line of first side is not matched. */
+	StepSkip1, /**< Line of second side is not matched. */
+};
+
+inline uint64_t Mix(uint64_t h)
+{
+	h ^= h >> 33;
+	h *= 0xff51afd7ed558ccdULL;
+	h ^= h >> 33;
+	h *= 0xc4ceb9fe1a85ec53ULL;
+	h ^= h >> 33;
+	return h;
+}
+
+/**
+ * @brief Add a trigram to a sketch, keeping the minimum of each hash.
+ */
+inline void AddGram(uint32_t *sketch, uint64_t gram)
+{
+	for (int k = 0; k < SketchSize; ++k)
+	{
+		const uint32_t h = static_cast<uint32_t>(Mix(gram ^ Seeds[k]) >> 32);
+		if (h < sketch[k])
+			sketch[k] = h;
+	}
+}
+
+inline uint64_t BucketKey(const uint32_t *sketch, int bucket)
+{
+	const uint32_t *hash = sketch + bucket * BucketHashes;
+	return (static_cast<uint64_t>(hash[0]) << 32) | hash[1];
+}
+
+/** @brief Order bucket entries by key. */
+struct KeyLess
+{
+	bool operator()(const std::pair<uint64_t, int> & a, const std::pair<uint64_t, int> & b) const { return a.first < b.first; }
+};
+
+}
+
+const int LineAligner::Unmatched;
+
+/**
+ * @brief Constructor.
+ * @param [in] bIgnoreCase Are lines differing in case only the same?
+ */
+LineAligner::LineAligner(bool bIgnoreCase)
+: m_bIgnoreCase(bIgnoreCase)
+{
+}
+
+/**
+ * @brief Add next line of a side.
+ * The text is not referred to after the call.
+ * @param [in] side Side of the line, 0 or 1.
+ * @param [in] line Text of the line, without EOL.
+ * @param [in] length Length of the text.
+ */
+void LineAligner::AddLine(int side, const TCHAR *line, size_t length)
+{
+	std::vector<uint32_t> & sketches = m_sketches[side];
+	const size_t base = sketches.size();
+	sketches.resize(base + SketchSize, UINT_MAX);
+	uint32_t *sketch = &sketches[base];
+
+	// Whitespace is left out, so reindented and rewrapped lines stay similar
+	uint64_t gram = 0;
+	int count = 0;
+	for (size_t i = 0; i < length; ++i)
+	{
+		TCHAR ch = line[i];
+		if (_istspace(ch))
+			continue;
+		if (m_bIgnoreCase)
+			ch = static_cast<TCHAR>(_totlower(ch));
+		gram = ((gram << 21) | static_cast<uint64_t>(ch & 0x1fffff)) & ((1ULL << 63) - 1);
+		if (++count >= GramSize)
+			AddGram(sketch, gram);
+	}
+	if (count > 0 && count < GramSize)
+		AddGram(sketch, gram);
+}
+
+/**
+ * @brief Align lines added to both sides.
+ * @param [out] map Line of second side matched to each line of first
+ *  side, or Unmatched. Matched lines are in increasing order.
+ */
+void LineAligner::Align(std::vector<int> & map) const
+{
+	const int nLines0 = GetLineCount(0);
+	const int nLines1 = GetLineCount(1);
+	map.assign(nLines0, Unmatched);
+	if (nLines0 == 0 || nLines1 == 0)
+		return;
+
+	std::vector<LinePair> anchors;
+	FindAnchors(anchors);
+
+	const int width = (std::max)(MinBandWidth,
+		static_cast<int>((std::min)(static_cast<size_t>(BandWidth), MaxBandCells / nLines0 / 2)));
+	std::vector<int> lo, hi;
+	GetBand(anchors, width, lo, hi);
+
+	std::vector<size_t> rowStart(nLines0 + 2);
+	for (int i = 0; i <= nLines0; ++i)
+		rowStart[i + 1] = rowStart[i] + (hi[i] - lo[i] + 1);
+	std::vector<unsigned char> steps(rowStart[nLines0 + 1]);
+
+	// Similarity of matched lines counts most, then number of matched lines
+	const int64_t similarityUnit = static_cast<int64_t>(nLines0) + 1;
+	std::vector<int64_t> prevRow, row(hi[0] - lo[0] + 1, 0);
+	for (int j = lo[0]; j <= hi[0]; ++j)
+		steps[j - lo[0]] = StepSkip1;
+	for (int i = 1; i <= nLines0; ++i)
+	{
+		prevRow.swap(row);
+		row.resize(hi[i] - lo[i] + 1);
+		unsigned char *rowSteps = &steps[rowStart[i]];
+		for (int j = lo[i]; j <= hi[i]; ++j)
+		{
+			int64_t best = LLONG_MIN;
+			unsigned char step = StepSkip0;
+			if (j >= 1 && j - 1 >= lo[i - 1] && j - 1 <= hi[i - 1])
+			{
+				const int similarity = Similarity(i - 1, j - 1);
+				best = prevRow[j - 1 - lo[i - 1]] + 1 +
+					(similarity >= SimilarHashes ? similarity * similarityUnit : 0);
+				step = StepMatch;
+			}
+			if (j <= hi[i - 1] && prevRow[j - lo[i - 1]] > best)
+			{
+				best = prevRow[j - lo[i - 1]];
+				step = StepSkip0;
+			}
+			if (j > lo[i] && row[j - 1 - lo[i]] > best)
+			{
+				best = row[j - 1 - lo[i]];
+				step = StepSkip1;
+			}
+			row[j - lo[i]] = best;
+			rowSteps[j - lo[i]] = step;
+		}
+	}
+
+	// Follow steps back from the end
+	int i = nLines0, j = nLines1;
+	while (i > 0 || j > 0)
+	{
+		switch (steps[rowStart[i] + j - lo[i]])
+		{
+		case StepMatch:
+			map[--i] = --j;
+			break;
+		case StepSkip0:
+			--i;
+			break;
+		default:
+			--j;
+			break;
+		}
+	}
+}
+
+int LineAligner::GetLineCount(int side) const
+{
+	return static_cast<int>(m_sketches[side].size() / SketchSize);
+}
+
+const uint32_t * LineAligner::GetSketch(int side, int line) const
+{
+	return &m_sketches[side][static_cast<size_t>(line) * SketchSize];
+}
+
+/**
+ * @brief Estimate similarity of lines of both sides.
+ * @return Number of equal hashes of sketches of the lines.
+ */
+int LineAligner::Similarity(int line0, int line1) const
+{
+	const uint32_t *sketch0 = GetSketch(0, line0);
+	const uint32_t *sketch1 = GetSketch(1, line1);
+	int count = 0;
+	for (int k = 0; k < SketchSize; ++k)
+		count += (sketch0[k] == sketch1[k]);
+	return count;
+}
+
+/**
+ * @brief Find pairs of lines to align other lines around.
+ * Lines sharing a bucket of sketches are compared, and a pair of lines
+ * which are each other's best match is a candidate. The longest chain of
+ * candidates in increasing order on both sides is returned.
+ * @param [out] anchors Pairs of lines, in increasing order.
+ */
+void LineAligner::FindAnchors(std::vector<LinePair> & anchors) const
+{
+	const int nLines0 = GetLineCount(0);
+	const int nLines1 = GetLineCount(1);
+	std::vector<int> best0(nLines0, Unmatched), similarity0(nLines0, 0);
+	std::vector<int> best1(nLines1, Unmatched), similarity1(nLines1, 0);
+	std::vector<std::pair<uint64_t, int> > buckets(nLines1);
+	for (int bucket = 0; bucket < SketchSize / BucketHashes; ++bucket)
+	{
+		for (int j = 0; j < nLines1; ++j)
+			buckets[j] = std::make_pair(BucketKey(GetSketch(1, j), bucket), j);
+		std::sort(buckets.begin(), buckets.end());
+		for (int i = 0; i < nLines0; ++i)
+		{
+			const std::pair<uint64_t, int> key(BucketKey(GetSketch(0, i), bucket), 0);
+			std::pair<std::vector<std::pair<uint64_t, int> >::const_iterator,
+				std::vector<std::pair<uint64_t, int> >::const_iterator> range =
+				std::equal_range(buckets.begin(), buckets.end(), key, KeyLess());
+			if (static_cast<size_t>(range.second - range.first) > MaxBucketSize)
+				continue;
+			for (; range.first != range.second; ++range.first)
+			{
+				const int j = range.first->second;
+				const int similarity = Similarity(i, j);
+				if (similarity > similarity0[i])
+				{
+					similarity0[i] = similarity;
+					best0[i] = j;
+				}
+				if (similarity > similarity1[j])
+				{
+					similarity1[j] = similarity;
+					best1[j] = i;
+				}
+			}
+		}
+	}
+
+	// Longest chain of candidates, increasing on second side too
+	std::vector<LinePair> candidates;
+	for (int i = 0; i < nLines0; ++i)
+	{
+		// Empty lines (no hash set) match each other anywhere
+		if (similarity0[i] >= AnchorHashes && best1[best0[i]] == i && GetSketch(0, i)[0] != UINT_MAX)
+			candidates.push_back(LinePair(i, best0[i]));
+	}
+	std::vector<int> tails; // last candidate of best chain of each length
+	std::vector<int> prev(candidates.size(), -1);
+	for (int c = 0; c < static_cast<int>(candidates.size()); ++c)
+	{
+		int low = 0, high = static_cast<int>(tails.size());
+		while (low < high)
+		{
+			const int mid = (low + high) / 2;
+			if (candidates[tails[mid]].second < candidates[c].second)
+				low = mid + 1;
+			else
+				high = mid;
+		}
+		if (low > 0)
+			prev[c] = tails[low - 1];
+		if (low == static_cast<int>(tails.size()))
+			tails.push_back(c);
+		else
+			tails[low] = c;
+	}
+	anchors.clear();
+	for (int c = tails.empty() ? -1 : tails.back(); c != -1; c = prev[c])
+		anchors.push_back(candidates[c]);
+	std::reverse(anchors.begin(), anchors.end());
+}
+
+/**
+ * @brief Get lines of second side each line of first side may be aligned to.
+ * The band follows straight lines between anchors, and is widened where
+ * needed to stay connected.
+ * @param [in] anchors Pairs of lines, in increasing order.
+ * @param [in] width Lines to extend band with on both sides.
+ * @param [out] lo, hi First and last line boundary of second side, for each
+ *  line boundary of first side.
+ */
+void LineAligner::GetBand(const std::vector<LinePair> & anchors, int width,
+	std::vector<int> & lo, std::vector<int> & hi) const
+{
+	const int nLines0 = GetLineCount(0);
+	const int nLines1 = GetLineCount(1);
+	std::vector<LinePair> points;
+	points.reserve(anchors.size() + 2);
+	points.push_back(LinePair(0, 0));
+	points.insert(points.end(), anchors.begin(), anchors.end());
+	points.push_back(LinePair(nLines0, nLines1));
+
+	lo.resize(nLines0 + 1);
+	hi.resize(nLines0 + 1);
+	for (size_t p = 0; p + 1 < points.size(); ++p)
+	{
+		const LinePair & from = points[p];
+		const LinePair & to = points[p + 1];
+		for (int i = from.first; i < to.first; ++i)
+		{
+			const int center = from.second + static_cast<int>(
+				static_cast<int64_t>(i - from.first) * (to.second - from.second) / (to.first - from.first));
+			lo[i] = (std::max)(center - width, 0);
+			hi[i] = (std::min)(center + width, nLines1);
+		}
+	}
+	lo[0] = 0;
+	lo[nLines0] = (std::max)(nLines1 - width, 0);
+	hi[nLines0] = nLines1;
+	for (int i = nLines0 - 1; i >= 0; --i)
+		hi[i] = (std::max)(hi[i], lo[i + 1]);
+}
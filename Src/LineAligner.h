@@ -0,0 +1,49 @@
+/**
+ * @file  LineAligner.h
+ *
+ * @brief Declaration of LineAligner class.
+ */
+#pragma once
+
+#include <vector>
+#include <utility>
+#include <cstdint>
+#include "UnicodeString.h"
+
+/**
+ * @brief Lines up similar lines of two sides of a diff block.
+ *
+ * Each line is reduced to a sketch of its character trigrams (minimum
+ * hashes), so similarity of two lines is estimated in constant time.
+ * Lines whose sketches share a bucket and are each other's best match
+ * become anchors, and lines are aligned by dynamic programming in a band
+ * following the longest chain of anchors. Time and memory grow linearly
+ * with the number of lines.
+ *
+ * The aligner does not refer to the texts after adding lines, so lines
+ * can be added in one thread and aligned in another.
+ */
+class LineAligner
+{
+public:
+	/** @brief Map entry of a line not matched to any line. */
+	static const int Unmatched = -1;
+
+	explicit LineAligner(bool bIgnoreCase = false);
+
+	void AddLine(int side, const TCHAR *line, size_t length);
+	void Align(std::vector<int> & map) const;
+
+private:
+	typedef std::pair<int, int> LinePair;
+
+	int GetLineCount(int side) const;
+	const uint32_t * GetSketch(int side, int line) const;
+	int Similarity(int line0, int line1) const;
+	void FindAnchors(std::vector<LinePair> & anchors) const;
+	void GetBand(const std::vector<LinePair> & anchors, int width,
+		std::vector<int> & lo, std::vector<int> & hi) const;
+
+	bool m_bIgnoreCase;
+	std::vector<uint32_t> m_sketches[2]; /**< Sketches of lines of both sides, one after another. */
+};
@@ -0,0 +1,241 @@
+/////////////////////////////////////////////////////////////////////////////
+//    License (GPLv2+):
+//    This program is free software; you can redistribute it and/or modify
+//    it under the terms of the GNU General Public License as published by
+//    the Free Software Foundation; either version 2 of the License, or (at
+//    your option) any later version.
+//
+//    This program is distributed in the hope that it will be useful, but
+//    WITHOUT ANY WARRANTY; without even the implied warranty of
+//    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+//    GNU General Public License for more details.
+//
+//    You should have received a copy of the GNU General Public License
+//    along with this program; if not, write to the Free Software
+//    Foundation, Inc., 675 Mass Ave, Cambridge, MA 02139, USA.
+/////////////////////////////////////////////////////////////////////////////
+/**
+ * @file  MapFileBuffer.cpp
+ *
+ * @brief Mapping compared files to memory for diffutils.
+ */
+
+#include <climits>
+#include <cstdint>
+#include <string>
+#include <vector>
+#ifdef _WIN32
+#define NOMINMAX
+#include <windows.h>
+#include <io.h>
+#endif
+#include "diff.h"
+
+#ifdef _WIN32
+
+namespace
+{
+
+/** @brief Smaller files are read, which is cheaper than mapping them. */
+const uint64_t MapFileMin = 1024 * 1024;
+
+/** @brief Times to look for address space for a file on Windows. */
+const int MapTries = 8;
+
+/**
+ * @brief Return the unit the mapped part of a file is a multiple of.
+ * The tail of the file is read right after it, so this is the allocation
+ * granularity and not the page size.
+ */
+size_t MapGranularity()
+{
+	SYSTEM_INFO si;
+	GetSystemInfo(&si);
+	return si.dwAllocationGranularity;
+}
+
+typedef DWORD (WINAPI *GetFinalPathNameByHandleFunc)(HANDLE, LPWSTR, DWORD, DWORD);
+
+/**
+ * @brief Tell if a file can be mapped without risk of in-page errors.
+ * Diffutils reads the buffer without guards, also in the hash worker
+ * threads, so an EXCEPTION_IN_PAGE_ERROR raised by reading a view would
+ * end the process where read() just returned short. Views of files on
+ * network shares and removable media raise it when the volume goes away,
+ * and views of files truncated by another process when reading past the
+ * new end. So only files on fixed local volumes that no other process has
+ * open for writing are mapped. Such a file cannot be truncated while it
+ * is mapped (SetEndOfFile() fails for it), and growing it after it was
+ * mapped does not touch the views.
+ * Files are never mapped in Windows versions not having
+ * GetFinalPathNameByHandle() (Vista and later).
+ * @param [in] hFile Handle of the file.
+ * @return true if the file can be mapped.
+ */
+bool IsSafeToMap(HANDLE hFile)
+{
+	static GetFinalPathNameByHandleFunc pfnGetFinalPathNameByHandle =
+		reinterpret_cast<GetFinalPathNameByHandleFunc>(
+			GetProcAddress(GetModuleHandleW(L"kernel32.dll"), "GetFinalPathNameByHandleW"));
+	if (pfnGetFinalPathNameByHandle == NULL)
+		return false;
+
+	// Files on network shares have no volume GUID path
+	const DWORD VolumeNameGuid = 0x1; // VOLUME_NAME_GUID
+	DWORD len = pfnGetFinalPathNameByHandle(hFile, NULL, 0, VolumeNameGuid);
+	if (len == 0)
+		return false;
+	std::vector<wchar_t> path(len + 1);
+	len = pfnGetFinalPathNameByHandle(hFile, &path[0], len + 1, VolumeNameGuid);
+	if (len == 0 || len > path.size() - 1)
+		return false;
+
+	// Path is \\?\Volume{GUID}\folder\file, the root ends at the fourth backslash
+	const std::wstring finalPath(&path[0], len);
+	const size_t rootEnd = finalPath.find(L'\\', 4);
+	if (rootEnd == std::wstring::npos)
+		return false;
+	const UINT type = GetDriveTypeW(finalPath.substr(0, rootEnd + 1).c_str());
+	if (type != DRIVE_FIXED && type != DRIVE_RAMDISK)
+		return false;
+
+	// Opening without sharing write access fails if the file is open for writing
+	HANDLE hOther = CreateFileW(finalPath.c_str(), GENERIC_READ, FILE_SHARE_READ, NULL,
+		OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, NULL);
+	if (hOther == INVALID_HANDLE_VALUE)
+		return false;
+	CloseHandle(hOther);
+	return true;
+}
+
+/**
+ * @brief Unmap the head of a file and free the tail after it.
+ */
+void UnmapBuffer(char *base, size_t head)
+{
+	UnmapViewOfFile(base);
+	VirtualFree(base + head, 0, MEM_RELEASE);
+}
+
+/**
+ * @brief Map the head of a file with writable memory right after it.
+ * @param [in] desc File descriptor.
+ * @param [in] head Bytes to map from the start of the file.
+ * @param [in] size Bytes to reserve in all.
+ * @return Address of the mapping, or NULL.
+ */
+char *MapBuffer(int desc, size_t head, size_t size)
+{
+	HANDLE hFile = reinterpret_cast<HANDLE>(_get_osfhandle(desc));
+	if (hFile == INVALID_HANDLE_VALUE || !IsSafeToMap(hFile))
+		return NULL;
+	HANDLE hMapping = CreateFileMapping(hFile, NULL, PAGE_READONLY, 0, 0, NULL);
+	if (hMapping == NULL)
+		return NULL;
+	char *base = NULL;
+	for (int i = 0; i < MapTries && base == NULL; ++i)
+	{
+		// Find free address space for both parts. Another thread may
+		// take it before the view is mapped there, then look again.
+		void *room = VirtualAlloc(NULL, size, MEM_RESERVE, PAGE_NOACCESS);
+		if (room == NULL)
+			break;
+		VirtualFree(room, 0, MEM_RELEASE);
+		char *view = static_cast<char *>(MapViewOfFileEx(hMapping, FILE_MAP_READ, 0, 0, head, room));
+		if (view == NULL)
+			continue;
+		if (VirtualAlloc(view + head, size - head, MEM_RESERVE | MEM_COMMIT, PAGE_READWRITE) == NULL)
+		{
+			UnmapViewOfFile(view);
+			continue;
+		}
+		base = view;
+	}
+	CloseHandle(hMapping);
+	return base;
+}
+
+/**
+ * @brief Read the tail of a file after its mapped head.
+ * @return Bytes read, or -1 if reading failed.
+ */
+int64_t ReadTail(int desc, size_t head, char *buffer, size_t size)
+{
+	if (_lseeki64(desc, head, SEEK_SET) < 0)
+		return -1;
+	size_t count = 0;
+	while (count < size)
+	{
+		int cc = read(desc, buffer + count, static_cast<unsigned>(size - count));
+		if (cc < 0)
+			return -1;
+		if (cc == 0)
+			break;
+		count += cc;
+	}
+	return count;
+}
+
+}
+
+#endif
+
+/**
+ * @brief Map a big file to memory instead of reading it.
+ * Only files safe to map are mapped, see IsSafeToMap().
+ * Diffutils only writes after the text: a newline, if the file has none
+ * at its end, and sentinels. So the file is mapped read only except for
+ * the last partial page, which is read to writable memory right after the
+ * mapping along with room for those. The first block read by sip() is left
+ * to the caller to free.
+ * @param [in,out] current File to map. Its buffer is replaced if mapped.
+ * @param [in] slack Bytes needed after the text.
+ * @return Nonzero if the file was mapped.
+ */
+extern "C" int map_file_buffer(struct file_data *current, size_t slack)
+{
+#ifdef _WIN32
+	if (current->desc < 0 || !S_ISREG(current->stat.st_mode))
+		return 0;
+	const uint64_t fileSize = current->stat.st_size;
+	if (fileSize < MapFileMin || fileSize > SIZE_MAX - slack)
+		return 0;
+
+	const size_t granularity = MapGranularity();
+	const size_t head = static_cast<size_t>(fileSize - fileSize % granularity);
+	const size_t tail = static_cast<size_t>(fileSize - head);
+	const size_t size = head + tail + slack;
+	char *base = MapBuffer(current->desc, head, size);
+	if (base == NULL)
+		return 0;
+	int64_t count = ReadTail(current->desc, head, base + head, tail);
+	if (count < 0)
+	{
+		UnmapBuffer(base, head);
+		return 0;
+	}
+
+	current->buffer = base;
+	current->bufsize = size;
+	current->buffered_chars = head + static_cast<size_t>(count);
+	current->mapped_chars = head;
+	return 1;
+#else
+	// Reading a view of a file truncated by another process raises
+	// SIGBUS, which cannot be recovered from, so files are always read.
+	return 0;
+#endif
+}
+
+/**
+ * @brief Release a buffer mapped by map_file_buffer().
+ * @param [in,out] current File whose buffer to release.
+ */
+extern "C" void unmap_file_buffer(struct file_data *current)
+{
+#ifdef _WIN32
+	UnmapBuffer(current->buffer, current->mapped_chars);
+#endif
+	current->buffer = NULL;
+	current->mapped_chars = 0;
+}
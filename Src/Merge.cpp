@@ -68,6 +68,7 @@
 #include "stringdiffs.h"
 #include "TFile.h"
 #include "SourceControl.h"
+#include "CompareResultCache.h"
 #include "paths.h"
 #include "Constants.h"
 
@@ -496,6 +497,14 @@ BOOL CMergeApp::InitInstance()
 
 	if (m_bNonInteractive)
 	{
+		// Folder compares write their reports in compare threads
+		DirDocList &dirDocs = pMainFrame->GetAllDirDocs();
+		for (POSITION pos = dirDocs.GetHeadPosition(); pos; )
+		{
+			CDirDoc *pDirDoc = dirDocs.GetNext(pos);
+			while (pDirDoc->m_diffThread.GetThreadState() == CDiffThread::THREAD_COMPARING)
+				Sleep(50);
+		}
 		bContinue = FALSE;
 	}
 
@@ -538,6 +547,9 @@ int CMergeApp::ExitInstance()
 	//  Save registry keys if existing WinMerge.reg
 	env_SaveRegistryToFile(paths_ConcatPath(env_GetProgPath(), _T("WinMerge.reg")), RegDir);
 
+	if (m_pCompareResultCache)
+		m_pCompareResultCache->Save();
+
 	// Remove tempfolder
 	const String temp = env_GetTempPath();
 	ClearTempfolder(temp);
@@ -620,6 +632,27 @@ void CMergeApp::InitializeFileFilters()
 	m_pGlobalFileFilter->LoadAllFileFilters();
 }
 
+/**
+ * @brief Get folder compare result cache.
+ * The cache is loaded from the user's WinMerge documents folder when
+ * first needed, and saved when the application exits.
+ * @return Result cache, or NULL if the cache is disabled.
+ */
+CompareResultCache * CMergeApp::GetCompareResultCache()
+{
+	if (!GetOptionsMgr()->GetBool(OPT_CMP_RESULT_CACHE))
+		return NULL;
+	if (!m_pCompareResultCache)
+	{
+		String sCacheFile = paths_ConcatPath(env_GetMyDocuments(), WinMergeDocumentsFolder);
+		sCacheFile = paths_ConcatPath(sCacheFile, _T("CompareResultCache.dat"));
+		m_pCompareResultCache.reset(new CompareResultCache(sCacheFile));
+		m_pCompareResultCache->Load();
+	}
+	m_pCompareResultCache->SetVerifyRate(GetOptionsMgr()->GetInt(OPT_CMP_RESULT_CACHE_VERIFY_RATE));
+	return m_pCompareResultCache.get();
+}
+
 /** @brief Read command line arguments and open files for comparison.
  *
  * The name of the function is a legacy code from the time that this function
@@ -43,6 +43,7 @@ class ProjectFile;
 class COptionsMgr;
 class LineFiltersList;
 class SyntaxColors;
+class CompareResultCache;
 class SourceControl;
 class FilterCommentsManager;
 
@@ -75,6 +76,7 @@ public:
 	MergeCmdLineInfo::ExitNoDiff m_bExitIfNoDiff; /**< Exit if files are identical? */
 	std::unique_ptr<LineFiltersList> m_pLineFilters; /**< List of linefilters */
 	std::unique_ptr<FilterCommentsManager> m_pFilterCommentsManager;
+	std::unique_ptr<CompareResultCache> m_pCompareResultCache; /**< Folder compare result cache, loaded on first use */
 
 	WORD GetLangId() const;
 	void SetIndicators(CStatusBar &, const UINT *, int) const;
@@ -94,6 +96,7 @@ public:
 
 	COptionsMgr * GetMergeOptionsMgr() { return static_cast<COptionsMgr *> (m_pOptions.get()); }
 	FileFilterHelper * GetGlobalFileFilter() { return m_pGlobalFileFilter.get(); }
+	CompareResultCache * GetCompareResultCache();
 	void SetFontDefaults();
 	void ShowHelp(LPCTSTR helpLocation = NULL);
 	void OpenFileToExternalEditor(const String& file, int nLineNumber = 1);
@@ -28,6 +28,7 @@
 #include "StdAfx.h"
 #include "MergeDoc.h"
 #include <cstdint>
+#include <climits>
 #include <shlwapi.h>		// PathCompactPathEx()
 #include <io.h>
 #include <Poco/Timestamp.h>
@@ -50,6 +51,7 @@
 #include "DiffFileInfo.h"
 #include "SaveClosingDlg.h"
 #include "DiffList.h"
+#include "DiffFileData.h"
 #include "codepage.h"
 #include "paths.h"
 #include "OptionsMgr.h"
@@ -73,7 +75,6 @@
 #endif
 
 using std::swap;
-using boost::int64_t;
 
 /** @brief Max len of path in caption. */
 static const UINT CAPTION_PATH_MAX = 50;
@@ -88,7 +89,7 @@ static LPCTSTR crlfs[] =
 	_T ("\x0d")      //  Macintosh style
 };
 
-static void SaveBuffForDiff(CDiffTextBuffer & buf, const String& filepath, bool bForceUTF8, int nStartLine = 0, int nLines = -1);
+static void SaveBuffForDiff(CDiffTextBuffer & buf, const String& filepath, std::string * pText, bool bForceUTF8, int nStartLine = 0, int nLines = -1);
 
 /////////////////////////////////////////////////////////////////////////////
 // CMergeDoc
@@ -300,9 +301,12 @@ void CMergeDoc::Serialize(CArchive& ar)
  * original file is Unicode (UCS2-LE, UCS2-BE, UTF-8) :
  *   buffer  -> save as UTF-8 -> Unicode plugins -> convert to UTF-8 -> diffutils
  * (the plugins are optional, not the conversion)
+ *
+ * When @p pText is not NULL, the text is kept there in memory instead,
+ * with room after it for the diff-engine (no plugins then).
  * @todo Show SaveToFile() errors?
  */
-static void SaveBuffForDiff(CDiffTextBuffer & buf, const String& filepath, bool bForceUTF8, int nStartLine, int nLines)
+static void SaveBuffForDiff(CDiffTextBuffer & buf, const String& filepath, std::string * pText, bool bForceUTF8, int nStartLine, int nLines)
 {
 	ASSERT(buf.m_nSourceEncoding == buf.m_nDefaultEncoding);  
 	int orig_codepage = buf.getCodepage();
@@ -321,10 +325,19 @@ static void SaveBuffForDiff(CDiffTextBuffer & buf, const String& filepath, bool
 	// and we don't repack the file
 	PackingInfo * tempPacker = NULL;
 
-	// write buffer out to temporary file
-	String sError;
-	int retVal = buf.SaveToFile(filepath, true, sError, tempPacker,
-		CRLF_STYLE_AUTOMATIC, false, nStartLine, nLines);
+	if (pText)
+	{
+		// convert buffer in memory
+		buf.SaveToString(*pText, CRLF_STYLE_AUTOMATIC, nStartLine, nLines);
+		pText->append(DiffFileData::TextSlack, '\0');
+	}
+	else
+	{
+		// write buffer out to temporary file
+		String sError;
+		int retVal = buf.SaveToFile(filepath, true, sError, tempPacker,
+			CRLF_STYLE_AUTOMATIC, false, nStartLine, nLines);
+	}
 
 	// restore memory of encoding of original file
 	buf.setUnicoding(orig_unicoding);
@@ -333,7 +346,46 @@ static void SaveBuffForDiff(CDiffTextBuffer & buf, const String& filepath, bool
 }
 
 /**
- * @brief Save files to temp files & compare again.
+ * @brief Return which files are identical as told by their diffs.
+ * This is what diffutils tells comparing the files, for a diff list whose
+ * diffs were not all found by the last compare. Which of the compared
+ * pairs an ignored diff of three files is in is not known, so it counts
+ * for both pairs.
+ * @param [in] list Diffs of all lines of the files.
+ * @param [in] nFiles Number of files.
+ */
+static IDENTLEVEL GetIdenticalLevel(const DiffList & list, int nFiles)
+{
+	if (list.GetSize() == 0)
+		return IDENTLEVEL_ALL;
+	if (nFiles < 3)
+		return IDENTLEVEL_NONE;
+	bool bDiff10 = false; // middle and left differ
+	bool bDiff12 = false; // middle and right differ
+	for (int nDiff = 0; nDiff < list.GetSize(); nDiff++)
+	{
+		switch (list.DiffRangeAt(nDiff)->op)
+		{
+		case OP_1STONLY:
+			bDiff10 = true;
+			break;
+		case OP_3RDONLY:
+			bDiff12 = true;
+			break;
+		default:
+			bDiff10 = bDiff12 = true;
+			break;
+		}
+	}
+	if (!bDiff10)
+		return IDENTLEVEL_EXCEPTRIGHT;
+	if (!bDiff12)
+		return IDENTLEVEL_EXCEPTLEFT;
+	return IDENTLEVEL_EXCEPTMIDDLE;
+}
+
+/**
+ * @brief Save files to memory or temp files & compare again.
  *
  * @param bBinary [in,out] [in] If true, compare two binary files
  * [out] If true binary file was detected.
@@ -344,8 +396,11 @@ static void SaveBuffForDiff(CDiffTextBuffer & buf, const String& filepath, bool
  * error happened
  * If this code is OK, Rescan has detached the views temporarily
  * (positions of cursors have been lost)
- * @note Rescan() ALWAYS compares temp files. Actual user files are not
+ * @note Rescan() ALWAYS compares copies of the buffers, in memory or in
+ * temp files if prediffer plugins need them. Actual user files are not
  * touched by Rescan().
+ * @note Unless forced, only lines edited after last rescan are compared
+ * again when diffs of other lines can't change.
  * @sa CDiffWrapper::RunFileDiff()
  */
 int CMergeDoc::Rescan(bool &bBinary, IDENTLEVEL &identical,
@@ -427,16 +482,6 @@ int CMergeDoc::Rescan(bool &bBinary, IDENTLEVEL &identical,
 	else
 		bForceUTF8 = true;
 
-	// Clear diff list
-	m_diffList.Clear();
-	m_nCurDiff = -1;
-	// Clear moved lines lists
-	if (m_diffWrapper.GetDetectMovedBlocks())
-	{
-		for (nBuffer = 0; nBuffer < m_nBuffers; nBuffer++)
-			m_diffWrapper.GetMovedLines(nBuffer)->Clear();
-	}
-
 	// Set paths for diffing and run diff
 	m_diffWrapper.EnablePlugins(GetOptionsMgr()->GetBool(OPT_PLUGINS_ENABLED));
 	if (m_nBuffers < 3)
@@ -448,15 +493,69 @@ int CMergeDoc::Rescan(bool &bBinary, IDENTLEVEL &identical,
 	m_diffWrapper.SetCodepage(m_ptBuf[0]->m_encoding.m_unicoding ?
 			CP_UTF8 : m_ptBuf[0]->m_encoding.m_codepage);
 
+	// Diff texts of buffers in memory, unless prediffer plugins need files
+	std::string texts[3];
+	std::string * pTexts = m_diffWrapper.CanDiffTexts() ? texts : NULL;
+	m_diffWrapper.SetTexts(pTexts);
+
+	// After edits, rediff only edited lines if diffs of other lines
+	// can't change: diffs which depend on other lines, like moved
+	// blocks, need all lines rediffed.
+	int nEditedBegin = 0;
+	int nEditedEnd[3] = {0};
+	int nEditedFirstDiff = 0;
+	int nEditedDiffs = 0;
+	bool bEditedOnly = !bForced && pTexts && !HasSyncPoints() &&
+		!m_diffWrapper.GetDetectMovedBlocks() &&
+		!(GetOptionsMgr()->GetBool(OPT_CMP_MATCH_SIMILAR_LINES) && m_nBuffers < 3) &&
+		!diffOptions.bFilterCommentsLines &&
+		GetEditedRange(nEditedBegin, nEditedEnd, nEditedFirstDiff, nEditedDiffs);
+	DiffList editedList;
+
+	if (!bEditedOnly)
+	{
+		// Clear diff list
+		m_diffList.Clear();
+		m_nCurDiff = -1;
+		// Clear moved lines lists
+		if (m_diffWrapper.GetDetectMovedBlocks())
+		{
+			for (nBuffer = 0; nBuffer < m_nBuffers; nBuffer++)
+				m_diffWrapper.GetMovedLines(nBuffer)->Clear();
+		}
+		// Rediff all lines at next rescan unless this one succeeds
+		for (nBuffer = 0; nBuffer < m_nBuffers; nBuffer++)
+			m_ptBuf[nBuffer]->MarkAllLinesEdited();
+	}
+
 	DIFFSTATUS status;
 
-	if (!HasSyncPoints())
+	if (bEditedOnly)
+	{
+		// Save edited lines to memory
+		for (nBuffer = 0; nBuffer < m_nBuffers; nBuffer++)
+		{
+			SaveBuffForDiff(*m_ptBuf[nBuffer], m_tempFiles[nBuffer].GetPath(),
+				&pTexts[nBuffer], bForceUTF8, nEditedBegin, nEditedEnd[nBuffer] - nEditedBegin);
+		}
+
+		m_diffWrapper.SetCreateDiffList(&editedList);
+		diffSuccess = !!m_diffWrapper.RunFileDiff();
+		m_diffWrapper.SetCreateDiffList(&m_diffList);
+
+		// Read diff-status
+		m_diffWrapper.GetDiffStatus(&status);
+		if (bBinary) // believe caller if we were told these are binaries
+			status.bBinaries = true;
+	}
+	else if (!HasSyncPoints())
 	{
 		// Save text buffer to file
 		for (nBuffer = 0; nBuffer < m_nBuffers; nBuffer++)
 		{
 			m_ptBuf[nBuffer]->SetTempPath(tempPath);
-			SaveBuffForDiff(*m_ptBuf[nBuffer], m_tempFiles[nBuffer].GetPath(), bForceUTF8);
+			SaveBuffForDiff(*m_ptBuf[nBuffer], m_tempFiles[nBuffer].GetPath(),
+				pTexts ? &pTexts[nBuffer] : NULL, bForceUTF8);
 		}
 
 		m_diffWrapper.SetCreateDiffList(&m_diffList);
@@ -479,8 +578,8 @@ int CMergeDoc::Rescan(bool &bBinary, IDENTLEVEL &identical,
 			{
 				nLines[nBuffer] = (i >= syncpoints.size()) ? -1 : syncpoints[i][nBuffer] - nStartLine[nBuffer];
 				m_ptBuf[nBuffer]->SetTempPath(tempPath);
-				SaveBuffForDiff(*m_ptBuf[nBuffer], m_tempFiles[nBuffer].GetPath(), bForceUTF8,
-					nStartLine[nBuffer], nLines[nBuffer]);
+				SaveBuffForDiff(*m_ptBuf[nBuffer], m_tempFiles[nBuffer].GetPath(),
+					pTexts ? &pTexts[nBuffer] : NULL, bForceUTF8, nStartLine[nBuffer], nLines[nBuffer]);
 			}
 			DiffList templist;
 			templist.Clear();
@@ -501,6 +600,7 @@ int CMergeDoc::Rescan(bool &bBinary, IDENTLEVEL &identical,
 		}
 		m_diffWrapper.SetCreateDiffList(&m_diffList);
 	}
+	m_diffWrapper.SetTexts(NULL);
 
 	// If comparing whitespaces and
 	// other file has EOL before EOF and other not...
@@ -518,7 +618,8 @@ int CMergeDoc::Rescan(bool &bBinary, IDENTLEVEL &identical,
 	}
 
 	// set identical/diff result as recorded by diffutils
-	identical = status.Identical;
+	// (for edited lines only, the whole diff list decides below)
+	identical = bEditedOnly ? IDENTLEVEL_NONE : status.Identical;
 
 	// Determine errors and binary file compares
 	if (!diffSuccess)
@@ -541,18 +642,28 @@ int CMergeDoc::Rescan(bool &bBinary, IDENTLEVEL &identical,
 			m_pDetailView[nBuffer]->DetachFromBuffer();
 		}
 
-		// Remove blank lines and clear winmerge flags
-		// this operation does not change the modified flag
-		for (nBuffer = 0; nBuffer < m_nBuffers; nBuffer++)
-			m_ptBuf[nBuffer]->prepareForRescan();
+		if (bEditedOnly)
+		{
+			// Replace diffs and blank lines of edited lines only
+			// this operation does not change the modified flag
+			PrimeEditedLines(editedList, nEditedBegin, nEditedEnd, nEditedFirstDiff, nEditedDiffs);
+			identical = GetIdenticalLevel(m_diffList, m_nBuffers);
+		}
+		else
+		{
+			// Remove blank lines and clear winmerge flags
+			// this operation does not change the modified flag
+			for (nBuffer = 0; nBuffer < m_nBuffers; nBuffer++)
+				m_ptBuf[nBuffer]->prepareForRescan();
 
-		// Divide diff blocks to match lines.
-		if (GetOptionsMgr()->GetBool(OPT_CMP_MATCH_SIMILAR_LINES) && m_nBuffers < 3)
-			AdjustDiffBlocks();
+			// Divide diff blocks to match lines.
+			if (GetOptionsMgr()->GetBool(OPT_CMP_MATCH_SIMILAR_LINES) && m_nBuffers < 3)
+				AdjustDiffBlocks();
 
-		// Analyse diff-list (updating real line-numbers)
-		// this operation does not change the modified flag
-		PrimeTextBuffers();
+			// Analyse diff-list (updating real line-numbers)
+			// this operation does not change the modified flag
+			PrimeTextBuffers();
+		}
 
 		// Hide identical lines if diff-context is not 'All'
 		HideLines();
@@ -579,7 +690,11 @@ int CMergeDoc::Rescan(bool &bBinary, IDENTLEVEL &identical,
 			m_pDetailView[nBuffer]->ReAttachToBuffer();
 
 			m_bEditAfterRescan[nBuffer] = false;
+			m_ptBuf[nBuffer]->ClearEditedLines();
 		}
+
+		// Word diff the diffs in background before their lines are painted
+		PrecomputeWordDiffs();
 	}
 
 	if (!GetOptionsMgr()->GetBool(OPT_CMP_IGNORE_CODEPAGE) &&
@@ -1932,8 +2047,6 @@ void CMergeDoc::PrimeTextBuffers()
 {
 	SetCurrentDiff(-1);
 	m_nTrivialDiffs = 0;
-	int nDiff;
-	int nDiffCount = m_diffList.GetSize();
 	int file;
 
 	// walk the diff list and calculate numbers of extra lines to add
@@ -1943,6 +2056,7 @@ void CMergeDoc::PrimeTextBuffers()
 	// resize m_aLines once for each view
 	UINT lcount[3];
 	UINT lcountnew[3];
+	int shift[3] = {0};
 	
 	for (file = 0; file < m_nBuffers; file++)
 	{
@@ -1953,9 +2067,39 @@ void CMergeDoc::PrimeTextBuffers()
 // this ASSERT may be false because of empty last line (see function's note)
 //	ASSERT(lcount0new == lcount1new);
 
+	PrimeDiffRanges(0, m_diffList.GetSize(), lcount, lcountnew, shift);
+
+	m_diffList.ConstructSignificantChain();
+
+	// Used to strip trivial diffs out of the diff chain
+	// if m_nTrivialDiffs
+	// via copying them all to a new chain, then copying only non-trivials back
+	// but now we keep all diffs, including trivial diffs
+
+
+	for (file = 0; file < m_nBuffers; file++)
+		m_ptBuf[file]->FinishLoading();
+}
+
+/**
+ * @brief Move lines of diffs to their place, add ghost lines and set flags.
+ * Lines are moved backward from the last diff, to the place left for ghost
+ * lines after them.
+ * @param [in] nFirstDiff First diff to lay out.
+ * @param [in] nDiffCount Number of diffs to lay out.
+ * @param [in,out] lcount Line after the lines to lay out, for each file.
+ * @param [in,out] lcountnew Line after the lines once laid out, for each file.
+ * @param [in] shift Line of real line 0 for each file, real lines are not
+ * moved yet.
+ */
+void CMergeDoc::PrimeDiffRanges(int nFirstDiff, int nDiffCount, UINT lcount[], UINT lcountnew[], const int shift[])
+{
+	int nDiff;
+	int file;
+
 	// walk the diff list backward, move existing lines to proper place,
 	// add ghost lines, and set flags
-	for (nDiff = nDiffCount - 1; nDiff >= 0; nDiff --)
+	for (nDiff = nFirstDiff + nDiffCount - 1; nDiff >= nFirstDiff; nDiff --)
 	{
 		DIFFRANGE curDiff;
 		VERIFY(m_diffList.GetDiff(nDiff, curDiff));
@@ -1963,10 +2107,10 @@ void CMergeDoc::PrimeTextBuffers()
 		// move matched lines after curDiff
 		int nline[3] = { 0 };
 		for (file = 0; file < m_nBuffers; file++)
-			nline[file] = lcount[file] - curDiff.end[file] - 1; // #lines on left/middle/right after current diff
+			nline[file] = lcount[file] - (curDiff.end[file] + shift[file]) - 1; // #lines on left/middle/right after current diff
 		// Matched lines should really match...
 		// But matched lines after last diff may differ because of empty last line (see function's note)
-		if (nDiff < nDiffCount - 1)
+		if (nDiff < nFirstDiff + nDiffCount - 1)
 			ASSERT(nline[0] == nline[1]);
 
 		int nmaxline = 0;
@@ -1974,7 +2118,7 @@ void CMergeDoc::PrimeTextBuffers()
 		{
 			// Move all lines after current diff down as far as needed
 			// for any ghost lines we're about to insert
-			m_ptBuf[file]->MoveLine(curDiff.end[file]+1, lcount[file]-1, lcountnew[file]-nline[file]);
+			m_ptBuf[file]->MoveLine(curDiff.end[file] + shift[file] + 1, lcount[file]-1, lcountnew[file]-nline[file]);
 			lcountnew[file] -= nline[file];
 			lcount[file] -= nline[file];
 			// move unmatched lines and add ghost lines
@@ -1984,7 +2128,7 @@ void CMergeDoc::PrimeTextBuffers()
 
 		for (file = 0; file < m_nBuffers; file++)
 		{
-			m_ptBuf[file]->MoveLine(curDiff.begin[file], curDiff.end[file], lcountnew[file]-nmaxline);
+			m_ptBuf[file]->MoveLine(curDiff.begin[file] + shift[file], curDiff.end[file] + shift[file], lcountnew[file]-nmaxline);
 			int nextra = nmaxline - nline[file];
 			if (nextra > 0)
 			{
@@ -2057,14 +2201,98 @@ m_ptBuf[file]->SetLineFlag(i, LF_INVISIBLE, false, false, false);
 		}           // switch (curDiff.op)
 		VERIFY(m_diffList.SetDiff(nDiff, curDiff));
 	}             // for (nDiff = nDiffCount; nDiff-- > 0; )
+}
 
-	m_diffList.ConstructSignificantChain();
+/**
+ * @brief Find lines to rediff after edits done since last rescan.
+ * See DiffList::GetEditedRange() for the lines found.
+ * @param [out] nBegin First (apparent) line to rediff, same in all panes.
+ * @param [out] nEnd Line after the last line to rediff, for each pane.
+ * @param [out] nFirstDiff Index of first diff in lines to rediff.
+ * @param [out] nDiffs Number of diffs in lines to rediff.
+ * @return true if rediffing these lines is enough, false if all lines
+ * must be rediffed.
+ */
+bool CMergeDoc::GetEditedRange(int & nBegin, int nEnd[], int & nFirstDiff, int & nDiffs) const
+{
+	int nFirstEdited[3], nLinesAfterEdited[3], nRescannedLines[3], nLines[3];
+	int nBuffer;
+	for (nBuffer = 0; nBuffer < m_nBuffers; nBuffer++)
+	{
+		const CDiffTextBuffer & buf = *m_ptBuf[nBuffer];
+		nFirstEdited[nBuffer] = buf.GetFirstEditedLine();
+		nLinesAfterEdited[nBuffer] = buf.GetLinesAfterEdited();
+		nRescannedLines[nBuffer] = buf.GetRescannedLineCount();
+		nLines[nBuffer] = buf.GetLineCount();
+	}
+	// Nothing edited, so changed options or such need all lines rediffed
+	if (!m_diffList.GetEditedRange(m_nBuffers, nFirstEdited, nLinesAfterEdited,
+			nRescannedLines, nLines, nBegin, nEnd, nFirstDiff, nDiffs))
+		return false;
 
-	// Used to strip trivial diffs out of the diff chain
-	// if m_nTrivialDiffs
-	// via copying them all to a new chain, then copying only non-trivials back
-	// but now we keep all diffs, including trivial diffs
+	for (nBuffer = 0; nBuffer < m_nBuffers; nBuffer++)
+	{
+		// Lines after the edited lines must end with the last line,
+		// whose missing EOL and such are handled for whole files only
+		if (nEnd[nBuffer] > m_ptBuf[nBuffer]->ApparentLastRealLine())
+			return false;
+	}
+	return true;
+}
+
+/**
+ * @brief Put diffs of rediffed lines in the diff list and lay out the lines.
+ * Ghost lines of rediffed lines are removed and added again for their new
+ * diffs, which replace their old diffs in the diff list. Lines and diffs
+ * after them are moved by the change of line counts.
+ * @param [in] list Diffs of rediffed lines, numbered from first rediffed line.
+ * @param [in] nBegin First (apparent) line rediffed, same in all panes.
+ * @param [in] nEnd Line after the last line rediffed, for each pane.
+ * @param [in] nFirstDiff Index of first old diff of rediffed lines.
+ * @param [in] nDiffs Number of old diffs of rediffed lines.
+ * @sa CMergeDoc::GetEditedRange()
+ */
+void CMergeDoc::PrimeEditedLines(DiffList & list, int nBegin, const int nEnd[], int nFirstDiff, int nDiffs)
+{
+	SetCurrentDiff(-1);
+	int file;
 
+	int extras[3]={0};   // extra lines added to each view
+	list.GetExtraLinesCounts(m_nBuffers, extras);
+
+	UINT lcount[3];
+	UINT lcountnew[3];
+	int shift[3] = {0};
+	int offset[3] = {0};
+	int delta[3] = {0};
+	int ddelta = 0;
+	for (file = 0; file < m_nBuffers; file++)
+	{
+		CDiffTextBuffer & buf = *m_ptBuf[file];
+		offset[file] = (nBegin > 0) ? buf.ComputeRealLine(nBegin - 1) + 1 : 0;
+		const int nRealLines = buf.ComputeRealLine(nEnd[file]) - offset[file];
+		delta[file] = buf.GetRealLineCount() - buf.GetRescannedRealLineCount();
+		shift[file] = nBegin - offset[file];
+
+		// Remove ghost lines and clear flags of rediffed lines,
+		// then make room for their new ghost lines
+		buf.prepareForRescan(nBegin, nEnd[file] - nBegin);
+		lcount[file] = nBegin + nRealLines;
+		lcountnew[file] = lcount[file] + extras[file];
+		buf.m_aLines.insert(buf.m_aLines.begin() + lcount[file], extras[file], LineInfo());
+		if (file == 0)
+			ddelta = buf.GetLineCount() - buf.GetRescannedLineCount();
+	}
+
+	for (int nDiff = nFirstDiff; nDiff < nFirstDiff + nDiffs; nDiff++)
+	{
+		if (m_diffList.DiffRangeAt(nDiff)->op == OP_TRIVIAL)
+			--m_nTrivialDiffs;
+	}
+	m_diffList.ReplaceDiffs(nFirstDiff, nDiffs, list, offset, delta, ddelta);
+	PrimeDiffRanges(nFirstDiff, list.GetSize(), lcount, lcountnew, shift);
+
+	m_diffList.ConstructSignificantChain();
 
 	for (file = 0; file < m_nBuffers; file++)
 		m_ptBuf[file]->FinishLoading();
@@ -34,6 +34,7 @@
 #include "PathContext.h"
 #include "DiffFileInfo.h"
 #include "IMergeDoc.h"
+#include "WordDiffCache.h"
 
 /**
  * @brief Additional action codes for WinMerge.
@@ -243,11 +244,20 @@ public:
 public:
 	typedef enum { BYTEDIFF, WORDDIFF } DIFFLEVEL;
 	void Showlinediff(CMergeEditView *pView, bool bReversed = false);
-	void GetWordDiffArray(int nLineIndex, std::vector<WordDiff> *pWordDiffs);
+	bool GetWordDiffArray(int nLineIndex, std::vector<WordDiff> *pWordDiffs, bool bWait = true);
 	void ClearWordDiffCache(int nDiff = -1);
+	void PrecomputeWordDiffs();
+	bool HasPendingWordDiffs() const { return !m_wordDiffCache.IsIdle(); }
+	unsigned GetWordDiffVersion() const { return m_wordDiffCache.GetVersion(); }
 private:
 	void Computelinediff(CMergeEditView *pView, CRect rc[], bool bReversed);
-	std::map<int, std::vector<WordDiff> > m_cacheWordDiffs;
+	void GetWordDiffOptions(WordDiffCache::Options & options) const;
+	void GetWordDiffJob(int nLineBegin, int nLineEnd, const WordDiffCache::Options & options, WordDiffCache::Job & job) const;
+	WordDiffCache::Key * FindWordDiffKey(int nDiff, int nLine);
+	WordDiffCache m_wordDiffCache; /**< Word diffs of texts of diffs */
+	WordDiffCache::Options m_wordDiffOptions; /**< Options word diffs were precomputed with */
+	std::vector<size_t> m_wordDiffKeyIndex; /**< Index of first key of each diff in m_wordDiffKeys */
+	std::vector<WordDiffCache::Key> m_wordDiffKeys; /**< Keys of texts of diffs, of each line for long diffs */
 // End MergeDocLineDiffs.cpp
 
 // Implementation in MergeDocEncoding.cpp
@@ -352,6 +362,9 @@ protected:
 	DECLARE_MESSAGE_MAP()
 private:
 	void PrimeTextBuffers();
+	void PrimeDiffRanges(int nFirstDiff, int nDiffCount, UINT lcount[], UINT lcountnew[], const int shift[]);
+	bool GetEditedRange(int & nBegin, int nEnd[], int & nFirstDiff, int & nDiffs) const;
+	void PrimeEditedLines(DiffList & list, int nBegin, const int nEnd[], int nFirstDiff, int nDiffs);
 	void HideLines();
 	void AdjustDiffBlocks();
 	void AdjustDiffBlock(DiffMap & diffmap, const DIFFRANGE & diffrange, int lo0, int hi0, int lo1, int hi1);
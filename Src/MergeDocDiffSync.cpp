@@ -12,6 +12,7 @@
 #include "Merge.h"
 #include "DiffList.h"
 #include "stringdiffs.h"
+#include "LineAligner.h"
 
 #ifdef _DEBUG
 #define new DEBUG_NEW
@@ -57,8 +58,8 @@ void CMergeDoc::AdjustDiffBlocks()
 				{
 					for (lineend0 = line0; lineend0 < nlines0; lineend0++)
 					{
-						if (map_line0 != DiffMap::GHOST_MAP_ENTRY &&
-								map_line0 != DiffMap::BAD_MAP_ENTRY)
+						if (diffmap.m_map[lineend0] != DiffMap::GHOST_MAP_ENTRY &&
+								diffmap.m_map[lineend0] != DiffMap::BAD_MAP_ENTRY)
 							break;
 					}
 					dr.begin[0]  = diffrange.begin[0] + line0;
@@ -135,10 +136,6 @@ int CMergeDoc::GetMatchCost(const String &sLine0, const String &sLine1)
 	DIFFOPTIONS diffOptions = {0};
 	m_diffWrapper.GetOptions(&diffOptions);
 
-	String str[2];
-	str[0] = sLine0;
-	str[1] = sLine1;
-
 	// Options that affect comparison
 	bool casitive = !diffOptions.bIgnoreCase;
 	int xwhite = diffOptions.nIgnoreWhitespace;
@@ -146,7 +143,7 @@ int CMergeDoc::GetMatchCost(const String &sLine0, const String &sLine1)
 	bool byteColoring = GetByteColoringOption();
 
 	std::vector<wdiff> worddiffs;
-	sd_ComputeWordDiffs(2, str, casitive, xwhite, breakType, byteColoring, &worddiffs);
+	sd_ComputeWordDiffs(sLine0, sLine1, casitive, xwhite, breakType, byteColoring, &worddiffs);
 
 	int nDiffLenSum = 0;
 	for (std::vector<wdiff>::const_iterator it = worddiffs.begin(); it != worddiffs.end(); ++it)
@@ -164,7 +161,9 @@ int CMergeDoc::GetMatchCost(const String &sLine0, const String &sLine1)
  *
  * Algorithm:
  * Find best match, and use that to split problem into two parts (above & below match)
- * and call ourselves recursively to solve each smaller problem
+ * and call ourselves recursively to solve each smaller problem.
+ * Large ranges are aligned by LineAligner instead, as finding the best match
+ * diffs every pair of lines.
  */
 void CMergeDoc::AdjustDiffBlock(DiffMap & diffMap, const DIFFRANGE & diffrange, int lo0, int hi0, int lo1, int hi1)
 {
@@ -187,33 +186,26 @@ void CMergeDoc::AdjustDiffBlock(DiffMap & diffMap, const DIFFRANGE & diffrange,
 		return;
 	}
 
-	// Bail out if range is large
+	// Align large range by similarity of lines
 	if (lines0 > 15 || lines1 > 15)
 	{
-		// Do simple 1:1 mapping
-		// but try to stay within original block
-		// Cannot be outside both sides, so just test for outside one side
-		int tlo=0, thi=0;
-		if (lo1 < 0)
-		{
-			// right side is off the bottom
-			// so put it as close to bottom as possible
-			tlo = hi1 - (hi0-lo0);
-			thi = hi1;
-		}
-		else
-		{
-			// put it as close to top as possible
-			tlo = lo1;
-			thi = lo1 + (hi0-lo0);
-		}
+		DIFFOPTIONS diffOptions = {0};
+		m_diffWrapper.GetOptions(&diffOptions);
+
+		LineAligner aligner(!!diffOptions.bIgnoreCase);
+		for (int i = lo0; i <= hi0; ++i)
+			aligner.AddLine(0, m_ptBuf[0]->GetLineChars(offset0 + i), m_ptBuf[0]->GetLineLength(offset0 + i));
+		for (int j = lo1; j <= hi1; ++j)
+			aligner.AddLine(1, m_ptBuf[1]->GetLineChars(offset1 + j), m_ptBuf[1]->GetLineLength(offset1 + j));
 
-		for (int w=0; w<lines0; ++w)
+		vector<int> map;
+		aligner.Align(map);
+		for (int w = 0; w < lines0; ++w)
 		{
-			if (w < lines1)
-				diffMap.m_map[w] = w + tlo;
+			if (map[w] == LineAligner::Unmatched)
+				diffMap.m_map[lo0 + w] = DiffMap::GHOST_MAP_ENTRY;
 			else
-				diffMap.m_map[w] = DiffMap::GHOST_MAP_ENTRY;
+				diffMap.m_map[lo0 + w] = lo1 + map[w];
 		}
 		return;
 	}
@@ -124,26 +124,146 @@ void CMergeDoc::Computelinediff(CMergeEditView *pView, CRect rc[], bool bReverse
 	}
 }
 
+/** @brief Most lines of a diff diffed as a whole, longer diffs are diffed per line. */
+static const int WordDiffLineLimit = 20;
+
+/**
+ * @brief Most characters of diffs to diff in the background after a rescan.
+ * Their texts are copied and hashed in this thread, so this is about what
+ * a few screens show. Diffs after them are diffed when first painted.
+ */
+static const size_t WordDiffPrecomputeLimit = 256 * 1024;
+
+/**
+ * @brief Forget word diffs of diffs (all by default).
+ * Word diffs of texts are kept, and found again for unchanged texts.
+ */
 void CMergeDoc::ClearWordDiffCache(int nDiff/* = -1 */)
 {
 	if (nDiff == -1)
 	{
-		m_cacheWordDiffs.clear();
+		m_wordDiffKeyIndex.clear();
+		m_wordDiffKeys.clear();
 	}
-	else
+	else if (nDiff + 1 < static_cast<int>(m_wordDiffKeyIndex.size()))
 	{
-		std::map<int, std::vector<WordDiff> >::iterator it = m_cacheWordDiffs.find(nDiff);
-		if (it != m_cacheWordDiffs.end())
-			m_cacheWordDiffs.erase(it);
+		std::fill(m_wordDiffKeys.begin() + m_wordDiffKeyIndex[nDiff],
+			m_wordDiffKeys.begin() + m_wordDiffKeyIndex[nDiff + 1], 0);
 	}
 }
 
+/**
+ * @brief Get options affecting word diffs.
+ */
+void CMergeDoc::GetWordDiffOptions(WordDiffCache::Options & options) const
+{
+	DIFFOPTIONS diffOptions = {0};
+	m_diffWrapper.GetOptions(&diffOptions);
+	options.casitive = !diffOptions.bIgnoreCase;
+	options.xwhite = diffOptions.nIgnoreWhitespace;
+	options.breakType = GetBreakType(); // whitespace only or include punctuation
+	options.byteColoring = GetByteColoringOption();
+	if (options.breakType == 1)
+		options.breakChars = sd_GetBreakChars();
+}
+
+/**
+ * @brief Get texts of lines of all files to word diff.
+ */
+void CMergeDoc::GetWordDiffJob(int nLineBegin, int nLineEnd,
+	const WordDiffCache::Options & options, WordDiffCache::Job & job) const
+{
+	job.options = options;
+	job.nFiles = m_nBuffers;
+	for (int file = 0; file < m_nBuffers; file++)
+	{
+		CString strText;
+		if (nLineBegin != nLineEnd || m_ptBuf[file]->GetLineLength(nLineEnd) > 0)
+			m_ptBuf[file]->GetTextWithoutEmptys(nLineBegin, 0, nLineEnd, m_ptBuf[file]->GetLineLength(nLineEnd), strText);
+		strText += m_ptBuf[file]->GetLineEol(nLineEnd);
+		job.str[file] = strText;
+	}
+	job.MakeKey();
+}
+
+/**
+ * @brief Find key of texts of a diff, or of a line of a long diff.
+ * @param [in] nDiff Index of the diff.
+ * @param [in] nLine Line in the diff, 0 for diffs diffed as a whole.
+ * @return Key, 0 if not known yet, or NULL if there is no room for it.
+ */
+WordDiffCache::Key * CMergeDoc::FindWordDiffKey(int nDiff, int nLine)
+{
+	if (nDiff + 1 >= static_cast<int>(m_wordDiffKeyIndex.size()))
+		return NULL;
+	const size_t index = m_wordDiffKeyIndex[nDiff] + nLine;
+	if (index >= m_wordDiffKeyIndex[nDiff + 1])
+		return NULL;
+	return &m_wordDiffKeys[index];
+}
+
+/**
+ * @brief Word diff all diffs in worker threads.
+ * Called after a rescan, so word diffs are ready when lines are painted.
+ * Texts of diffs not changed since an earlier rescan are not diffed again.
+ */
+void CMergeDoc::PrecomputeWordDiffs()
+{
+	ClearWordDiffCache();
+	if (!GetOptionsMgr()->GetBool(OPT_WORDDIFF_HIGHLIGHT))
+		return;
+
+	GetWordDiffOptions(m_wordDiffOptions);
+	const int nDiffs = m_diffList.GetSize();
+	m_wordDiffKeyIndex.reserve(nDiffs + 1);
+	std::vector<WordDiffCache::Job> jobs;
+	size_t nChars = 0;
+	for (int nDiff = 0; nDiff < nDiffs; nDiff++)
+	{
+		m_wordDiffKeyIndex.push_back(m_wordDiffKeys.size());
+		DIFFRANGE cd;
+		m_diffList.GetDiff(nDiff, cd);
+		const bool diffPerLine = (cd.dend - cd.dbegin > WordDiffLineLimit);
+		const int nKeys = diffPerLine ? cd.dend - cd.dbegin + 1 : 1;
+		m_wordDiffKeys.resize(m_wordDiffKeys.size() + nKeys, 0);
+
+		// Lines of diffs with text on one side only are not word diffed
+		int unemptyLineCount = 0;
+		for (int file = 0; file < m_nBuffers; file++)
+		{
+			if (cd.begin[file] != cd.end[file] + 1)
+				unemptyLineCount++;
+		}
+		if (unemptyLineCount < 2 || nChars > WordDiffPrecomputeLimit)
+			continue;
+
+		for (int i = 0; i < nKeys; i++)
+		{
+			const int nLineBegin = diffPerLine ? cd.dbegin + i : cd.dbegin;
+			const int nLineEnd = diffPerLine ? cd.dbegin + i : cd.dend;
+			WordDiffCache::Job job;
+			GetWordDiffJob(nLineBegin, nLineEnd, m_wordDiffOptions, job);
+			for (int file = 0; file < m_nBuffers; file++)
+				nChars += job.str[file].length();
+			m_wordDiffKeys[m_wordDiffKeys.size() - nKeys + i] = job.key;
+			jobs.push_back(std::move(job));
+		}
+	}
+	m_wordDiffKeyIndex.push_back(m_wordDiffKeys.size());
+	m_wordDiffCache.Precompute(jobs);
+}
+
 /**
  * @brief Return array of differences in specified line
  * This is used by algorithm for line diff coloring
  * (Line diff coloring is distinct from the selection highlight code)
+ * @param [in] nLineIndex Line to get differences of.
+ * @param [out] pWordDiffs Differences found.
+ * @param [in] bWait Diff now if differences are not ready? If not, they are
+ *  diffed in a worker thread.
+ * @return false if differences are not ready.
  */
-void CMergeDoc::GetWordDiffArray(int nLineIndex, vector<WordDiff> *pWordDiffs)
+bool CMergeDoc::GetWordDiffArray(int nLineIndex, vector<WordDiff> *pWordDiffs, bool bWait/* = true*/)
 {
 	int file;
 	DIFFRANGE cd;
@@ -151,28 +271,16 @@ void CMergeDoc::GetWordDiffArray(int nLineIndex, vector<WordDiff> *pWordDiffs)
 	for (file = 0; file < m_nBuffers; file++)
 	{
 		if (nLineIndex >= m_ptBuf[file]->GetLineCount())
-			return;
+			return true;
 	}
 
 	int nDiff = m_diffList.LineToDiff(nLineIndex);
 	if (nDiff == -1)
-		return;
-	std::map<int, std::vector<WordDiff> >::iterator itmap = m_cacheWordDiffs.find(nDiff);
-	if (itmap != m_cacheWordDiffs.end())
-	{
-		pWordDiffs->resize((*itmap).second.size());
-		std::copy((*itmap).second.begin(), (*itmap).second.end(), pWordDiffs->begin());
-		return;
-	}
+		return true;
 
 	m_diffList.GetDiff(nDiff, cd);
 
-	DIFFOPTIONS diffOptions = {0};
-	m_diffWrapper.GetOptions(&diffOptions);
-	String str[3];
-	std::unique_ptr<int[]> nOffsets[3];
-	const int LineLimit = 20;
-	bool diffPerLine = (cd.dend - cd.dbegin > LineLimit) ? true : false;
+	bool diffPerLine = (cd.dend - cd.dbegin > WordDiffLineLimit) ? true : false;
 
 	int nLineBegin, nLineEnd;
 	if (!diffPerLine)
@@ -185,30 +293,46 @@ void CMergeDoc::GetWordDiffArray(int nLineIndex, vector<WordDiff> *pWordDiffs)
 		nLineBegin = nLineEnd = nLineIndex;
 	}
 
+	// Options that affect comparison
+	WordDiffCache::Options options;
+	GetWordDiffOptions(options);
+
+	// Keys of precomputed diffs are only good for the options they were
+	// precomputed with
+	WordDiffCache::Key *pKey = NULL;
+	if (options == m_wordDiffOptions)
+		pKey = FindWordDiffKey(nDiff, diffPerLine ? nLineIndex - cd.dbegin : 0);
+	if (pKey && *pKey && !bWait && m_wordDiffCache.IsPending(*pKey))
+		return false;
+
+	std::vector<wdiff> worddiffs;
+	if (!pKey || !*pKey || !m_wordDiffCache.Lookup(*pKey, &worddiffs))
+	{
+		WordDiffCache::Job job;
+		GetWordDiffJob(nLineBegin, nLineEnd, options, job);
+		if (pKey)
+			*pKey = job.key;
+		if (!m_wordDiffCache.Lookup(job.key, &worddiffs))
+		{
+			if (!bWait)
+			{
+				m_wordDiffCache.Queue(job);
+				return false;
+			}
+			// Make the call to stringdiffs, which does all the hard & tedious computations
+			m_wordDiffCache.Compute(job, &worddiffs);
+		}
+	}
+
+	std::unique_ptr<int[]> nOffsets[3];
 	for (file = 0; file < m_nBuffers; file++)
 	{
 		nOffsets[file].reset(new int[nLineEnd - nLineBegin + 1]);
-		CString strText;
-		if (nLineBegin != nLineEnd || m_ptBuf[file]->GetLineLength(nLineEnd) > 0)
-			m_ptBuf[file]->GetTextWithoutEmptys(nLineBegin, 0, nLineEnd, m_ptBuf[file]->GetLineLength(nLineEnd), strText);
-		strText += m_ptBuf[file]->GetLineEol(nLineEnd);
-		str[file] = strText;
-
 		nOffsets[file][0] = 0;
 		for (int nLine = nLineBegin; nLine < nLineEnd; nLine++)
 			nOffsets[file][nLine-nLineBegin+1] = nOffsets[file][nLine-nLineBegin] + m_ptBuf[file]->GetFullLineLength(nLine);
 	}
 
-	// Options that affect comparison
-	bool casitive = !diffOptions.bIgnoreCase;
-	int xwhite = diffOptions.nIgnoreWhitespace;
-	int breakType = GetBreakType(); // whitespace only or include punctuation
-	bool byteColoring = GetByteColoringOption();
-
-	std::vector<wdiff> worddiffs;
-	// Make the call to stringdiffs, which does all the hard & tedious computations
-	sd_ComputeWordDiffs(m_nBuffers, str, casitive, xwhite, breakType, byteColoring, &worddiffs);
-
 	int i;
 	std::vector<wdiff>::iterator it;
 	for (i = 0, it = worddiffs.begin(); it != worddiffs.end(); i++, it++)
@@ -242,12 +366,5 @@ void CMergeDoc::GetWordDiffArray(int nLineIndex, vector<WordDiff> *pWordDiffs)
 		pWordDiffs->push_back(wd);
 	}
 
-	if (!diffPerLine)
-	{
-		m_cacheWordDiffs[nDiff].resize(pWordDiffs->size());
-		std::copy(pWordDiffs->begin(), pWordDiffs->end(), m_cacheWordDiffs[nDiff].begin());
-	}
-
-	return;
+	return true;
 }
-
@@ -53,6 +53,10 @@ using std::vector;
 const UINT IDT_RESCAN = 2;
 /** @brief Timer timeout for delayed rescan. */
 const UINT RESCAN_TIMEOUT = 1000;
+/** @brief Timer ID for repainting lines when their word diffs are ready. */
+const UINT IDT_WORDDIFFS = 3;
+/** @brief Timer timeout for checking if word diffs are ready. */
+const UINT WORDDIFFS_TIMEOUT = 200;
 
 /** @brief Location for file compare specific help to open. */
 static TCHAR MergeViewHelpLocation[] = _T("::/htmlhelp/Compare_files.html");
@@ -69,6 +73,8 @@ CMergeEditView::CMergeEditView()
 , m_piMergeEditStatus(0)
 , m_bAutomaticRescan(false)
 , fTimerWaitingForIdle(0)
+, m_bWordDiffsPending(false)
+, m_nWordDiffVersion(0)
 , m_lineBegin(0)
 , m_lineEnd(-1)
 , m_CurrentPredifferID(0)
@@ -405,7 +411,16 @@ int CMergeEditView::GetAdditionalTextBlocks (int nLineIndex, TEXTBLOCK *&pBuf)
 	if (unemptyLineCount < 2)
 		return 0;
 
-	pDoc->GetWordDiffArray(nLineIndex, &worddiffs);
+	if (!pDoc->GetWordDiffArray(nLineIndex, &worddiffs, false))
+	{
+		// Highlight whole line until word diffs are ready, and repaint then
+		if (!m_bWordDiffsPending && SetTimer(IDT_WORDDIFFS, WORDDIFFS_TIMEOUT, NULL))
+		{
+			m_bWordDiffsPending = true;
+			m_nWordDiffVersion = pDoc->GetWordDiffVersion();
+		}
+		return 0;
+	}
 	size_t nWordDiffs = worddiffs.size();
 
 	bool lineInCurrentDiff = IsLineInCurrentDiff(nLineIndex);
@@ -2134,6 +2149,22 @@ void CMergeEditView::OnTimer(UINT_PTR nIDEvent)
 		theApp.SetNeedIdleTimer();
 	}
 
+	if (nIDEvent == IDT_WORDDIFFS)
+	{
+		CMergeDoc *pDoc = GetDocument();
+		if (!pDoc->HasPendingWordDiffs())
+		{
+			KillTimer(IDT_WORDDIFFS);
+			m_bWordDiffsPending = false;
+		}
+		unsigned nVersion = pDoc->GetWordDiffVersion();
+		if (nVersion != m_nWordDiffVersion || !m_bWordDiffsPending)
+		{
+			m_nWordDiffVersion = nVersion;
+			Invalidate();
+		}
+	}
+
 	if (nIDEvent == IDLE_TIMER)
 	{
 		// not a real timer, just come back after OnIdle
@@ -100,6 +100,8 @@ private:
 	to wait for theApp::OnIdle before processing it 
 	*/
 	bool fTimerWaitingForIdle;
+	bool m_bWordDiffsPending; /**< Were lines painted before their word diffs were ready? */
+	unsigned m_nWordDiffVersion; /**< Word diffs of document when view was last repainted for them */
 	COLORSETTINGS m_cachedColors; /**< Cached color settings */
 
 	/// active prediffer ID : helper to check the radio button
@@ -20,333 +20,347 @@
  * @brief Moved block detection code.
  */
 
-#include <map>
+#include <vector>
 #include <cassert>
 #include "diff.h"
 
-class IntSet
+namespace
 {
-public:
-	void Add(int val) { m_map[val] = 1; }
-	void Remove(int val) { m_map.erase(val); }
-	size_t count() const { return m_map.size(); }
-	bool isPresent(int val) const { m_map.find(val) != m_map.end(); }
-	int getSingle() const { return m_map.begin()->first; }
-private:
-	std::map<int, int> m_map;
-};
 
-/** 
- * @brief  Set of equivalent lines
+/** @brief Lines hashed together to find blocks moved with small edits. */
+const int ShingleLines = 3;
+
+/** @brief Most edited lines skipped on a side inside a moved block. */
+const int MaxEditedLines = 2;
+
+/**
+ * @brief Changed lines of one side, in order of the script.
  * This uses diffutils line numbers, which are counted from the prefix
  */
-struct EqGroup
+struct ChangedLines
 {
-	IntSet m_lines0; // equivalent lines on side#0
-	IntSet m_lines1; // equivalent lines on side#1
+	std::vector<int> line; /**< Line number. */
+	std::vector<int> equiv; /**< Equivalency code of the line. */
+	std::vector<int> moved; /**< Index of matching line on other side, or -1. */
 
-	bool isPerfectMatch() const { return m_lines0.count()==1 && m_lines1.count()==1; }
-};
+	int size() const { return static_cast<int>(line.size()); }
 
+	/** @brief Are changed lines at k and k + n consecutive lines of the file? */
+	bool IsContiguous(int k, int n) const
+	{
+		return k >= 0 && k + n < size() && line[k + n] - line[k] == n;
+	}
 
-/** @brief  Maps equivalency code to equivalency group */
-class CodeToGroupMap
-{
-public:
-	std::map<int, EqGroup *> m_map;
-	/** @brief Add a line to the appropriate equivalency group */
-	void Add(int lineno, int eqcode, int nside)
+	/** @brief Are n changed lines next to k in direction dir consecutive with it and not moved yet? */
+	bool IsFree(int k, int dir, int n) const
 	{
-		EqGroup *pgroup = find(eqcode);
-		if (pgroup == NULL)
+		if (!IsContiguous(dir > 0 ? k : k - n, n))
+			return false;
+		for (int i = 1; i <= n; ++i)
 		{
-			pgroup = new EqGroup;
-			m_map[eqcode] = pgroup;
+			if (moved[k + dir * i] >= 0)
+				return false;
 		}
-		if (nside)
-			pgroup->m_lines1.Add(lineno);
-		else
-			pgroup->m_lines0.Add(lineno);
+		return true;
 	}
+};
 
-	/** @brief Return the appropriate equivalency group */
-	EqGroup * find(int eqcode)
+/** @brief Are n lines from k0 on side#0 equivalent to n lines from k1 on side#1? */
+bool IsEqual(const ChangedLines side[2], int k0, int k1, int n)
+{
+	for (int i = 0; i < n; ++i)
 	{
-		std::map<int, EqGroup *>::const_iterator it = m_map.find(eqcode);
-		return it != m_map.end() ? it->second : NULL;
+		if (side[0].equiv[k0 + i] != side[1].equiv[k1 + i])
+			return false;
 	}
+	return true;
+}
 
-	~CodeToGroupMap()
+/** @brief Pair n lines from k0 on side#0 with n lines from k1 on side#1 as moved. */
+void Pair(ChangedLines side[2], int k0, int k1, int n)
+{
+	for (int i = 0; i < n; ++i)
 	{
-		std::map<int, EqGroup *>::const_iterator pos = m_map.begin();
-		while (pos != m_map.end())
-			delete pos++->second;
+		side[0].moved[k0 + i] = k1 + i;
+		side[1].moved[k1 + i] = k0 + i;
 	}
-};
-
-/*
- WinMerge moved block code
- This is called by diffutils code, by diff_2_files routine (in ANALYZE.C)
- read_files earlier computed the hash chains ("equivs" file variable) and freed them,
- but the equivs numerics are still available in each line
+}
 
- match1 set by scan from line0 to deleted
- match0 set by scan from line1 to inserted
+/** @brief Shingle (run of consecutive changed lines) in the hash table. */
+struct Shingle
+{
+	unsigned hash;
+	int count[2]; /**< Occurrences on each side, counted up to 2. */
+	int pos[2]; /**< Index of first line of an occurrence on each side. */
+};
 
-*/
-extern "C" void moved_block_analysis(struct change ** pscript, struct file_data fd[])
+unsigned HashShingle(const ChangedLines & lines, int k, int n)
 {
-	// Hash all altered lines
-	CodeToGroupMap map;
+	unsigned h = 0;
+	for (int i = 0; i < n; ++i)
+		h = (h + static_cast<unsigned>(lines.equiv[k + i])) * 2654435761U;
+	return h ^ (h >> 16);
+}
 
-	struct change * script = *pscript;
-	struct change *p,*e;
-	for (e = script; e; e = p)
+/**
+ * @brief Find shingles of n lines occurring once on each side.
+ * Shingles are kept in an open addressing table, so this takes time
+ * linear in the number of changed lines.
+ * @return For each changed line on side#0 starting such a shingle, the
+ * index of its match on side#1, else -1.
+ */
+std::vector<int> FindAnchors(const ChangedLines side[2], int n)
+{
+	size_t capacity = 16;
+	while (capacity < 2 * (side[0].line.size() + side[1].line.size()))
+		capacity *= 2;
+	std::vector<Shingle> table(capacity);
+	for (int s = 0; s < 2; ++s)
 	{
-		p = e->link;
-		int i=0;
-		for (i=e->line0; i-(e->line0) < (e->deleted); ++i)
-			map.Add(i, fd[0].equivs[i], 0);
-		for (i=e->line1; i-(e->line1) < (e->inserted); ++i)
-			map.Add(i, fd[1].equivs[i], 1);
+		for (int k = 0; k + n <= side[s].size(); ++k)
+		{
+			if (!side[s].IsContiguous(k, n - 1))
+				continue;
+			const unsigned hash = HashShingle(side[s], k, n);
+			for (size_t slot = hash & (capacity - 1); ; slot = (slot + 1) & (capacity - 1))
+			{
+				Shingle & entry = table[slot];
+				if (entry.count[0] + entry.count[1] == 0)
+				{
+					entry.hash = hash;
+					entry.count[s] = 1;
+					entry.pos[s] = k;
+					break;
+				}
+				if (entry.hash == hash)
+				{
+					const int t = entry.count[0] ? 0 : 1;
+					if (t == 0 ? IsEqual(side, entry.pos[0], k, n) : IsEqual(side, k, entry.pos[1], n))
+					{
+						if (entry.count[s] < 2)
+							++entry.count[s];
+						entry.pos[s] = k;
+						break;
+					}
+				}
+			}
+		}
 	}
 
+	std::vector<int> anchors(side[0].line.size(), -1);
+	for (size_t slot = 0; slot < capacity; ++slot)
+	{
+		if (table[slot].count[0] == 1 && table[slot].count[1] == 1)
+			anchors[table[slot].pos[0]] = table[slot].pos[1];
+	}
+	return anchors;
+}
 
-	// Scan through diff blocks, finding moved sections from left side
-	// and splitting them out
-	// That is, we actually fragment diff blocks as we find moved sections
-	for (e = script; e; e = p)
+/**
+ * @brief Extend moved block from its end lines k0, k1 in direction dir.
+ * Equivalent lines are added one by one. Past differing lines the block
+ * goes on if a shingle follows within MaxEditedLines lines on each side,
+ * so blocks moved and edited a bit are found whole. If as many lines were
+ * skipped on both sides they are taken as edited lines of the block.
+ */
+void Extend(ChangedLines side[2], int k0, int k1, int dir)
+{
+	for (;;)
 	{
-		// scan down block for a match
-		p = e->link;
-		EqGroup * pgroup = 0;
-		int i=0;
-		for (i=e->line0; i-(e->line0) < (e->deleted); ++i)
+		if (side[0].IsFree(k0, dir, 1) && side[1].IsFree(k1, dir, 1) &&
+			side[0].equiv[k0 + dir] == side[1].equiv[k1 + dir])
+		{
+			k0 += dir;
+			k1 += dir;
+			Pair(side, k0, k1, 1);
+			continue;
+		}
+
+		bool bridged = false;
+		for (int gap = 1; gap <= 2 * MaxEditedLines && !bridged; ++gap)
 		{
-			EqGroup * tempgroup = map.find(fd[0].equivs[i]);
-			if (tempgroup->isPerfectMatch())
+			for (int gap0 = 0; gap0 <= gap && !bridged; ++gap0)
 			{
-				pgroup = tempgroup;
-				break;
+				const int gap1 = gap - gap0;
+				if (gap0 > MaxEditedLines || gap1 > MaxEditedLines)
+					continue;
+				if (!side[0].IsFree(k0, dir, gap0 + ShingleLines) || !side[1].IsFree(k1, dir, gap1 + ShingleLines))
+					continue;
+				const int next0 = dir > 0 ? k0 + gap0 + 1 : k0 - gap0 - ShingleLines;
+				const int next1 = dir > 0 ? k1 + gap1 + 1 : k1 - gap1 - ShingleLines;
+				if (!IsEqual(side, next0, next1, ShingleLines))
+					continue;
+				if (gap0 == gap1)
+					Pair(side, dir > 0 ? k0 + 1 : next0, dir > 0 ? k1 + 1 : next1, gap0 + ShingleLines);
+				else
+					Pair(side, next0, next1, ShingleLines);
+				k0 += dir * (gap0 + ShingleLines);
+				k1 += dir * (gap1 + ShingleLines);
+				bridged = true;
 			}
 		}
+		if (!bridged)
+			break;
+	}
+}
 
-		// if no match, go to next diff block
-		if (!pgroup)
+/**
+ * @brief Pair lines of unique shingles of n lines and grow them to blocks.
+ */
+void FindMovedBlocks(ChangedLines side[2], int n)
+{
+	const std::vector<int> anchors = FindAnchors(side, n);
+	for (int k0 = 0; k0 < side[0].size(); ++k0)
+	{
+		const int k1 = anchors[k0];
+		if (k1 < 0)
 			continue;
+		bool unmoved = true;
+		for (int i = 0; i < n && unmoved; ++i)
+			unmoved = side[0].moved[k0 + i] < 0 && side[1].moved[k1 + i] < 0;
+		if (!unmoved)
+			continue;
+		Pair(side, k0, k1, n);
+		Extend(side, k0, k1, -1);
+		Extend(side, k0 + n - 1, k1 + n - 1, 1);
+	}
+}
 
-		// found a match
-		int j = pgroup->m_lines1.getSingle();
-		// Ok, now our moved block is the single line i,j
+/** @brief Run of changed lines of a side in a change. */
+struct Segment
+{
+	int line; /**< First line. */
+	int count; /**< Number of lines. */
+	int match; /**< Line on other side the first line matches, or -1. */
+};
 
-		// extend moved block upward as far as possible
-		int i1 = i-1;
-		int j1 = j-1;
-		for ( ; i1>=e->line0; --i1, --j1)
+/**
+ * @brief Cut n changed lines from k into runs moved to consecutive lines.
+ */
+void GetSegments(const ChangedLines & lines, const ChangedLines & other, int k, int n, std::vector<Segment> & segments)
+{
+	segments.clear();
+	for (int i = k; i < k + n; ++i)
+	{
+		const int m = lines.moved[i];
+		if (!segments.empty())
 		{
-			EqGroup * pgroup0 = map.find(fd[0].equivs[i1]);
-			EqGroup * pgroup1 = map.find(fd[1].equivs[j1]);
-			if (pgroup0 != pgroup1)
-				break;
-			pgroup0->m_lines0.Remove(i1);
-			pgroup1->m_lines1.Remove(j1);
+			Segment & last = segments.back();
+			const int prev = lines.moved[i - 1];
+			if (m < 0 ? prev < 0 : (prev >= 0 && m == prev + 1 && other.line[m] == other.line[prev] + 1))
+			{
+				++last.count;
+				continue;
+			}
 		}
-		++i1;
-		++j1;
-		// Ok, now our moved block is i1->i, j1->j
+		Segment segment = { lines.line[i], 1, m < 0 ? -1 : other.line[m] };
+		segments.push_back(segment);
+	}
+}
 
-		// extend moved block downward as far as possible
-		int i2 = i+1;
-		int j2 = j+1;
-		for ( ; i2-(e->line0) < (e->deleted); ++i2,++j2)
-		{
-			EqGroup * pgroup0 = map.find(fd[0].equivs[i2]);
-			EqGroup * pgroup1 = map.find(fd[1].equivs[j2]);
-			if (pgroup0 != pgroup1)
-				break;
-			pgroup0->m_lines0.Remove(i2);
-			pgroup1->m_lines1.Remove(j2);
-		}
-		--i2;
-		--j2;
-		// Ok, now our moved block is i1->i2,j1->j2
+/** @brief Add piece of change after e in script and return it. */
+struct change * AddPiece(struct change * e, struct change * last, int line0, int deleted, int line1, int inserted)
+{
+	struct change *newob = last;
+	if (newob != e || e->deleted + e->inserted != 0)
+	{
+		newob = (struct change *) xmalloc (sizeof (struct change));
+		*newob = *e;
+		newob->link = last->link;
+		last->link = newob;
+	}
+	newob->line0 = line0;
+	newob->deleted = deleted;
+	newob->line1 = line1;
+	newob->inserted = inserted;
+	newob->match0 = -1;
+	newob->match1 = -1;
+	return newob;
+}
 
-		assert(i2-i1 >= 0);
-		assert(i2-i1 == j2-j1);
+}
 
-		int prefix = i1 - (e->line0);
-		if (prefix)
-		{
-			// break e (current change) into two pieces
-			// first part is the prefix, before the moved part
-			// that stays in e
-			// second part is the moved part & anything after it
-			// that goes in newob
-			// leave the right side (e->inserted) on e
-			// so no right side on newob
-			// newob will be the moved part only, later after we split off any suffix from it
-			struct change *newob = (struct change *) xmalloc (sizeof (struct change));
-			memset(newob, 0, sizeof(*newob));
+/*
+ WinMerge moved block code
+ This is called by diffutils code, by diff_2_files routine (in ANALYZE.C)
+ read_files earlier computed the hash chains ("equivs" file variable) and freed them,
+ but the equivs numerics are still available in each line
 
-			newob->line0 = i1;
-			newob->line1 = e->line1 + e->inserted;
-			newob->inserted = 0;
-			newob->deleted = e->deleted - prefix;
-			newob->link = e->link;
-			newob->match0 = -1;
-			newob->match1 = -1;
+ Blocks are found from shingles of ShingleLines lines occurring once in
+ the changed lines of each side, then from single lines occurring once,
+ and grown over small edits. Changes holding moved lines are split so
+ each moved run of lines is a change of its own.
 
-			e->deleted = prefix;
-			e->link = newob;
+ match1 set by scan from line0 to deleted
+ match0 set by scan from line1 to inserted
 
-			// now make e point to the moved part (& any suffix)
-			e = newob;
+*/
+extern "C" void moved_block_analysis(struct change ** pscript, struct file_data fd[])
+{
+	// Collect all altered lines
+	ChangedLines side[2];
+	struct change * script = *pscript;
+	struct change *p,*e;
+	for (e = script; e; e = e->link)
+	{
+		int i;
+		for (i = e->line0; i - e->line0 < e->deleted; ++i)
+		{
+			side[0].line.push_back(i);
+			side[0].equiv.push_back(fd[0].equivs[i]);
 		}
-		// now e points to a moved diff chunk with no prefix, but maybe a suffix
-
-		e->match1 = j1;
-
-		int suffix = (e->deleted) - (i2-(e->line0)) - 1;
-		if (suffix)
+		for (i = e->line1; i - e->line1 < e->inserted; ++i)
 		{
-			// break off any suffix from e
-			// newob will be the suffix, and will get all the right side
-			struct change *newob = (struct change *) xmalloc (sizeof (struct change));
-			memset(newob, 0, sizeof(*newob));
-
-			newob->line0 = i2+1;
-			newob->line1 = e->line1;
-			newob->inserted = e->inserted;
-			newob->deleted = suffix;
-			newob->link = e->link;
-			newob->match0 = -1;
-			newob->match1 = -1;
-
-			e->inserted = 0;
-			e->deleted -= suffix;
-			e->link = newob;
-
-			p = newob; // next block to scan
+			side[1].line.push_back(i);
+			side[1].equiv.push_back(fd[1].equivs[i]);
 		}
 	}
+	side[0].moved.assign(side[0].line.size(), -1);
+	side[1].moved.assign(side[1].line.size(), -1);
+
+	FindMovedBlocks(side, ShingleLines);
+	FindMovedBlocks(side, 1);
 
-	// Scan through diff blocks, finding moved sections from right side
-	// and splitting them out
-	// That is, we actually fragment diff blocks as we find moved sections
+	// Split diff blocks holding moved lines: deleted runs first, then
+	// inserted runs, keeping unmoved lines of both sides together
+	// when they meet.
+	std::vector<Segment> deleted, inserted;
+	int k0 = 0, k1 = 0;
 	for (e = script; e; e = p)
 	{
-		// scan down block for a match
 		p = e->link;
-		EqGroup * pgroup = 0;
-		int j=0;
-		for (j=e->line1; j-(e->line1) < (e->inserted); ++j)
-		{
-			EqGroup * tempgroup = map.find(fd[1].equivs[j]);
-			if (tempgroup->isPerfectMatch())
-			{
-				pgroup = tempgroup;
-				break;
-			}
-		}
-
-		// if no match, go to next diff block
-		if (!pgroup)
+		GetSegments(side[0], side[1], k0, e->deleted, deleted);
+		GetSegments(side[1], side[0], k1, e->inserted, inserted);
+		k0 += e->deleted;
+		k1 += e->inserted;
+		if ((deleted.empty() || (deleted.size() == 1 && deleted[0].match < 0)) &&
+			(inserted.empty() || (inserted.size() == 1 && inserted[0].match < 0)))
 			continue;
 
-		// found a match
-		int i = pgroup->m_lines0.getSingle();
-		// Ok, now our moved block is the single line i,j
-
-		// extend moved block upward as far as possible
-		int i1 = i-1;
-		int j1 = j-1;
-		for ( ; j1>=e->line1; --i1, --j1)
-		{
-			EqGroup * pgroup0 = map.find(fd[0].equivs[i1]);
-			EqGroup * pgroup1 = map.find(fd[1].equivs[j1]);
-			if (pgroup0 != pgroup1)
-				break;
-			pgroup0->m_lines0.Remove(i1);
-			pgroup1->m_lines1.Remove(j1);
-		}
-		++i1;
-		++j1;
-		// Ok, now our moved block is i1->i, j1->j
-
-		// extend moved block downward as far as possible
-		int i2 = i+1;
-		int j2 = j+1;
-		for ( ; j2-(e->line1) < (e->inserted); ++i2,++j2)
+		const int line0 = e->line0, line1 = e->line1;
+		const int end0 = line0 + e->deleted;
+		const bool merge = !deleted.empty() && deleted.back().match < 0 &&
+			!inserted.empty() && inserted.front().match < 0;
+		e->deleted = e->inserted = 0;
+		struct change *last = e;
+		size_t i;
+		for (i = 0; i < deleted.size(); ++i)
 		{
-			EqGroup * pgroup0 = map.find(fd[0].equivs[i2]);
-			EqGroup * pgroup1 = map.find(fd[1].equivs[j2]);
-			if (pgroup0 != pgroup1)
+			if (merge && i == deleted.size() - 1)
 				break;
-			pgroup0->m_lines0.Remove(i2);
-			pgroup1->m_lines1.Remove(j2);
+			last = AddPiece(e, last, deleted[i].line, deleted[i].count, line1, 0);
+			last->match1 = deleted[i].match;
 		}
-		--i2;
-		--j2;
-		// Ok, now our moved block is i1->i2,j1->j2
-
-		assert(i2-i1 >= 0);
-		assert(i2-i1 == j2-j1);
-
-		int prefix = j1 - (e->line1);
-		if (prefix)
+		for (i = 0; i < inserted.size(); ++i)
 		{
-			// break e (current change) into two pieces
-			// first part is the prefix, before the moved part
-			// that stays in e
-			// second part is the moved part & anything after it
-			// that goes in newob
-			// leave the left side (e->deleted) on e
-			// so no right side on newob
-			// newob will be the moved part only, later after we split off any suffix from it
-			struct change *newob = (struct change *) xmalloc (sizeof (struct change));
-			memset(newob, 0, sizeof(*newob));
-
-			newob->line0 = e->line0 + e->deleted;
-			newob->line1 = j1;
-			newob->inserted = e->inserted - prefix;
-			newob->deleted = 0;
-			newob->link = e->link;
-			newob->match0 = -1;
-			newob->match1 = -1;
-
-			e->inserted = prefix;
-			e->link = newob;
-
-			// now make e point to the moved part (& any suffix)
-			e = newob;
-		}
-		// now e points to a moved diff chunk with no prefix, but maybe a suffix
-
-		e->match0 = i1;
-
-		int suffix = (e->inserted) - (j2-(e->line1)) - 1;
-		if (suffix)
-		{
-			// break off any suffix from e
-			// newob will be the suffix, and will get all the left side
-			struct change *newob = (struct change *) xmalloc (sizeof (struct change));
-			memset(newob, 0, sizeof(*newob));
-
-			newob->line0 = e->line0;
-			newob->line1 = j2+1;
-			newob->inserted = suffix;
-			newob->deleted = e->deleted;
-			newob->link = e->link;
-			newob->match0 = -1;
-			newob->match1 = e->match1;
-
-			e->inserted -= suffix;
-			e->deleted = 0;
-			e->match1 = -1;
-			e->link = newob;
-
-			p = newob; // next block to scan
+			if (merge && i == 0)
+			{
+				last = AddPiece(e, last, deleted.back().line, deleted.back().count, line1, inserted[0].count);
+				continue;
+			}
+			last = AddPiece(e, last, end0, 0, inserted[i].line, inserted[i].count);
+			last->match0 = inserted[i].match;
 		}
+		assert(last->link == p);
 	}
-
 }
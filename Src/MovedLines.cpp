@@ -1,10 +1,25 @@
-/** 
+/**
  * @file  MovedLines.cpp
  *
  * @brief Implementation of MovedLines class.
  */
 
 #include "MovedLines.h"
+#include <algorithm>
+
+namespace
+{
+
+/** @brief Order blocks by their first line. */
+struct LineLess
+{
+	template <typename Block>
+	bool operator()(int line, const Block & block) const { return line < block.line; }
+	template <typename Block>
+	bool operator()(const Block & block, int line) const { return block.line < line; }
+};
+
+}
 
 /**
  * @brief clear the lists of moved blocks.
@@ -16,57 +31,87 @@ void MovedLines::Clear()
 }
 
 /**
- * @brief Add moved block to the list.
+ * @brief Add moved line to the list.
+ * Lines are added in increasing order by the diff code, so a line
+ * usually extends the last block or starts a new one at the end.
  * @param [in] side1 First side we are mapping.
  * @param [in] line1 Linenumber in side first side.
  * @param [in] line2 Linenumber in second side.
  */
 void MovedLines::Add(ML_SIDE side1, unsigned line1,	unsigned line2)
 {
-	MovedLinesMap *list;
+	MovedBlocks *list;
 	if (side1 == SIDE_LEFT)
 		list = &m_moved0;
 	else
 		list = &m_moved1;
 
-	(*list)[line1] = line2;
+	const int line = static_cast<int>(line1);
+	const int other = static_cast<int>(line2);
+	if (!list->empty())
+	{
+		Block & last = list->back();
+		if (line == last.line + last.count && other == last.other + last.count)
+		{
+			++last.count;
+			return;
+		}
+		if (line < last.line + last.count)
+		{
+			// Out of order: split the block holding the line, if any, and
+			// put the line in a block of its own.
+			MovedBlocks::iterator it = std::upper_bound(list->begin(), list->end(), line, LineLess());
+			if (it != list->begin())
+			{
+				Block & prev = *(it - 1);
+				const int offset = line - prev.line;
+				if (offset < prev.count)
+				{
+					if (prev.other + offset == other)
+						return;
+					Block tail = { line + 1, prev.count - offset - 1, prev.other + offset + 1 };
+					prev.count = offset;
+					if (offset == 0)
+						it = list->erase(it - 1);
+					if (tail.count > 0)
+						it = list->insert(it, tail);
+				}
+			}
+			Block block = { line, 1, other };
+			list->insert(it, block);
+			return;
+		}
+	}
+	Block block = { line, 1, other };
+	list->push_back(block);
 }
 
 /**
  * @brief Check if line is in moved block.
  * @param [in] line Linenumber to check.
  * @param [in] side Side of the linenumber.
+ * @return Matching line on other side, or -1 if line is not moved.
  */
 int MovedLines::LineInBlock(unsigned line, ML_SIDE side) const
 {
 	if (side == SIDE_LEFT)
-		return SecondSideInMovedBlock(line);
+		return FindLine(m_moved0, static_cast<int>(line));
 	else
-		return FirstSideInMovedBlock(line);
+		return FindLine(m_moved1, static_cast<int>(line));
 }
 
 /**
- * @brief Get right->left info for a moved line (real line number)
+ * @brief Find line matching given line in sorted blocks.
+ * @param [in] blocks Blocks of a side.
+ * @param [in] line Linenumber (real line number) to look for.
+ * @return Matching line on other side, or -1 if line is not in a block.
  */
-int MovedLines::FirstSideInMovedBlock(unsigned secondSideLine) const
+int MovedLines::FindLine(const MovedBlocks & blocks, int line)
 {
-	MovedLinesMap::const_iterator iter;
-	iter = m_moved1.find(secondSideLine);
-	if (iter != m_moved1.end())
-		return iter->second;
-	else
-		return -1;
-}
-
-/**
- * @brief Get left->right info for a moved line (real line number)
- */
-int MovedLines::SecondSideInMovedBlock(unsigned firstSideLine) const
-{
-	MovedLinesMap::const_iterator iter;
-	iter = m_moved0.find(firstSideLine);
-	if (iter != m_moved0.end())
-		return iter->second;
-	else
+	MovedBlocks::const_iterator it = std::upper_bound(blocks.begin(), blocks.end(), line, LineLess());
+	if (it == blocks.begin())
 		return -1;
+	--it;
+	const int offset = line - it->line;
+	return offset < it->count ? it->other + offset : -1;
 }
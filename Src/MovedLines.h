@@ -1,16 +1,17 @@
-/** 
+/**
  * @file  MovedLines.h
  *
  * @brief Declaration of MovedLines class
  */
 #pragma once
 
-#include <map>
+#include <vector>
 
 /**
  * @brief Container class for moved lines/blocks.
  * This class contains list of moved blocs/lines we detect
- * when comparing files.
+ * when comparing files. Moved lines are kept as sorted runs of
+ * consecutive lines, so a lookup is a binary search in a flat array.
  */
 class MovedLines
 {
@@ -26,12 +27,18 @@ public:
 	void Add(ML_SIDE side1, unsigned line1, unsigned line2);
 	int LineInBlock(unsigned line, ML_SIDE side) const;
 
-protected:
-	int FirstSideInMovedBlock(unsigned secondSideLine) const;
-	int SecondSideInMovedBlock(unsigned firstSideLine) const;
-
 private:
-	typedef std::map<int, int> MovedLinesMap;
-	MovedLinesMap m_moved0; /**< Moved lines map for first side */
-	MovedLinesMap m_moved1; /**< Moved lines map for second side */
+	/** @brief Run of moved lines matching consecutive lines of other side. */
+	struct Block
+	{
+		int line; /**< First line of the run. */
+		int count; /**< Number of lines in the run. */
+		int other; /**< Line the first line matches on other side. */
+	};
+	typedef std::vector<Block> MovedBlocks;
+
+	static int FindLine(const MovedBlocks & blocks, int line);
+
+	MovedBlocks m_moved0; /**< Moved blocks for first side */
+	MovedBlocks m_moved1; /**< Moved blocks for second side */
 };
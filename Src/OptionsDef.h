@@ -151,15 +151,28 @@ extern const String OPT_CMP_IGNORE_BLANKLINES OP("Settings/IgnoreBlankLines");
 extern const String OPT_CMP_FILTER_COMMENTLINES OP("Settings/FilterCommentsLines");
 extern const String OPT_CMP_IGNORE_CASE OP("Settings/IgnoreCase");
 extern const String OPT_CMP_IGNORE_EOL OP("Settings/IgnoreEol");
+extern const String OPT_CMP_DIFF_ALGORITHM OP("Settings/DiffAlgorithm");
 extern const String OPT_CMP_IGNORE_CODEPAGE OP("Settings/IgnoreCodepage");
 extern const String OPT_CMP_METHOD OP("Settings/CompMethod2");
 extern const String OPT_CMP_MOVED_BLOCKS OP("Settings/MovedBlocks");
 extern const String OPT_CMP_MATCH_SIMILAR_LINES OP("Settings/MatchSimilarLines");
 extern const String OPT_CMP_STOP_AFTER_FIRST OP("Settings/StopAfterFirst");
 extern const String OPT_CMP_QUICK_LIMIT OP("Settings/QuickMethodLimit");
+extern const String OPT_CMP_STREAMING_DIFF_MEMORY OP("Settings/StreamingDiffMemory");
 extern const String OPT_CMP_WALK_UNIQUE_DIRS OP("Settings/ScanUnpairedDir");
 extern const String OPT_CMP_IGNORE_REPARSE_POINTS OP("Settings/IgnoreReparsePoints");
 extern const String OPT_CMP_INCLUDE_SUBDIRS OP("Settings/Recurse");
+extern const String OPT_CMP_PIPELINED_COLLECT OP("Settings/PipelinedCollect");
+extern const String OPT_CMP_CPU_THREADS OP("Settings/CompareCpuThreads");
+extern const String OPT_CMP_IO_THREADS OP("Settings/CompareIoThreads");
+extern const String OPT_CMP_MAX_LOCAL_VOLUME_READS OP("Settings/MaxLocalVolumeReads");
+extern const String OPT_CMP_MAX_REMOTE_VOLUME_READS OP("Settings/MaxRemoteVolumeReads");
+extern const String OPT_CMP_LARGE_FILE_LIMIT_MB OP("Settings/LargeFileLimitMB");
+extern const String OPT_CMP_MAX_LARGE_FILE_COMPARES OP("Settings/MaxLargeFileCompares");
+extern const String OPT_CMP_WATCH_FOLDERS OP("Settings/WatchFolders");
+extern const String OPT_CMP_WATCH_POLL_INTERVAL OP("Settings/WatchPollInterval");
+extern const String OPT_CMP_RESULT_CACHE OP("Settings/CompareResultCache");
+extern const String OPT_CMP_RESULT_CACHE_VERIFY_RATE OP("Settings/CompareResultCacheVerifyRate");
 
 // Image Compare options
 extern const String OPT_CMP_IMG_FILEPATTERNS OP("Settings/ImageFilePatterns");
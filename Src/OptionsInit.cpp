@@ -123,10 +123,22 @@ void Init(COptionsMgr *pOptions)
 	pOptions->InitOption(OPT_CMP_MATCH_SIMILAR_LINES, false);
 	pOptions->InitOption(OPT_CMP_STOP_AFTER_FIRST, false);
 	pOptions->InitOption(OPT_CMP_QUICK_LIMIT, 4 * 1024 * 1024); // 4 Megs
+	pOptions->InitOption(OPT_CMP_STREAMING_DIFF_MEMORY, 0); // 0 = quick compare big files
 	pOptions->InitOption(OPT_CMP_WALK_UNIQUE_DIRS, false);
 	pOptions->InitOption(OPT_CMP_IGNORE_REPARSE_POINTS, false);
 	pOptions->InitOption(OPT_CMP_IGNORE_CODEPAGE, true);
 	pOptions->InitOption(OPT_CMP_INCLUDE_SUBDIRS, true);
+	pOptions->InitOption(OPT_CMP_PIPELINED_COLLECT, false);
+	pOptions->InitOption(OPT_CMP_CPU_THREADS, 0); // number of processors
+	pOptions->InitOption(OPT_CMP_IO_THREADS, 0); // number of processors
+	pOptions->InitOption(OPT_CMP_MAX_LOCAL_VOLUME_READS, 0); // no limit
+	pOptions->InitOption(OPT_CMP_MAX_REMOTE_VOLUME_READS, 4);
+	pOptions->InitOption(OPT_CMP_LARGE_FILE_LIMIT_MB, 64); // 64 Megs
+	pOptions->InitOption(OPT_CMP_MAX_LARGE_FILE_COMPARES, 0); // half of compare threads
+	pOptions->InitOption(OPT_CMP_WATCH_FOLDERS, false);
+	pOptions->InitOption(OPT_CMP_WATCH_POLL_INTERVAL, 5000); // milliseconds
+	pOptions->InitOption(OPT_CMP_RESULT_CACHE, false);
+	pOptions->InitOption(OPT_CMP_RESULT_CACHE_VERIFY_RATE, 0);
 
 	pOptions->InitOption(OPT_CMP_BIN_FILEPATTERNS, _T("*.bin;*.frx"));
 
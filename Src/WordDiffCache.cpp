@@ -0,0 +1,305 @@
+/**
+ * @file  WordDiffCache.cpp
+ *
+ * @brief Implementation of WordDiffCache class.
+ */
+
+#include "WordDiffCache.h"
+#include <algorithm>
+#include <Poco/Runnable.h>
+#include <Poco/Environment.h>
+#include <Poco/Exception.h>
+
+using Poco::FastMutex;
+
+namespace
+{
+
+/** @brief Most worker threads diffing at once. */
+const int MaxWorkers = 4;
+
+/** @brief Diffs kept at least before unused ones are dropped. */
+const size_t MinCompactSize = 64 * 1024;
+
+const uint64_t FnvOffsetBasis = 14695981039346656037ULL;
+const uint64_t FnvPrime = 1099511628211ULL;
+
+uint64_t HashBytes(uint64_t h, const void *data, size_t size)
+{
+	const unsigned char *p = static_cast<const unsigned char *>(data);
+	for (size_t i = 0; i < size; ++i)
+		h = (h ^ p[i]) * FnvPrime;
+	return h;
+}
+
+}
+
+/** @brief Diffs texts of queued jobs until no jobs are left. */
+class WordDiffCache::Worker : public Poco::Runnable
+{
+public:
+	explicit Worker(WordDiffCache & cache) : m_cache(cache) {}
+
+	virtual void run()
+	{
+		Job job;
+		while (m_cache.NextJob(job))
+		{
+			std::vector<wdiff> diffs;
+			try
+			{
+				sd_ComputeWordDiffs(job.nFiles, job.str, job.options.casitive, job.options.xwhite,
+					job.options.breakType, job.options.breakChars, job.options.byteColoring, &diffs);
+			}
+			catch (std::exception&)
+			{
+				m_cache.Store(job.key, NULL);
+				continue;
+			}
+			m_cache.Store(job.key, &diffs);
+		}
+	}
+
+private:
+	WordDiffCache & m_cache;
+};
+
+/**
+ * @brief Compute key of texts and options of the job.
+ */
+void WordDiffCache::Job::MakeKey()
+{
+	uint64_t h = FnvOffsetBasis;
+	const int opts[] = { nFiles, options.casitive, options.xwhite, options.breakType, options.byteColoring };
+	h = HashBytes(h, opts, sizeof(opts));
+	const size_t breakCharsLength = options.breakChars.length();
+	h = HashBytes(h, &breakCharsLength, sizeof(breakCharsLength));
+	h = HashBytes(h, options.breakChars.c_str(), breakCharsLength * sizeof(TCHAR));
+	for (int file = 0; file < nFiles; ++file)
+	{
+		const size_t length = str[file].length();
+		h = HashBytes(h, &length, sizeof(length));
+		h = HashBytes(h, str[file].c_str(), length * sizeof(TCHAR));
+	}
+	key = h ? h : 1;
+}
+
+WordDiffCache::WordDiffCache()
+: m_generation(0)
+, m_version(0)
+, m_nRunning(0)
+, m_nWorkers((std::min)((std::max)(static_cast<int>(Poco::Environment::processorCount()) - 1, 1), MaxWorkers))
+, m_pWorker(new Worker(*this))
+, m_pool(1, 2 * MaxWorkers)
+{
+}
+
+WordDiffCache::~WordDiffCache()
+{
+	{
+		FastMutex::ScopedLock lock(m_mutex);
+		m_jobs.clear();
+	}
+	m_pool.joinAll();
+}
+
+/**
+ * @brief Get diffs of a key.
+ * @param [in] key Key of texts and options.
+ * @param [out] pDiffs Diffs of the texts.
+ * @return true if the diffs are known, false if not (yet).
+ */
+bool WordDiffCache::Lookup(Key key, std::vector<wdiff> *pDiffs)
+{
+	FastMutex::ScopedLock lock(m_mutex);
+	std::unordered_map<Key, Entry>::iterator it = m_entries.find(key);
+	if (it == m_entries.end())
+		return false;
+	it->second.generation = m_generation;
+	pDiffs->assign(m_diffs.begin() + it->second.begin,
+		m_diffs.begin() + it->second.begin + it->second.count);
+	return true;
+}
+
+/**
+ * @brief Diff texts of a job in this thread and store the diffs.
+ */
+void WordDiffCache::Compute(const Job & job, std::vector<wdiff> *pDiffs)
+{
+	pDiffs->clear();
+	sd_ComputeWordDiffs(job.nFiles, job.str, job.options.casitive, job.options.xwhite,
+		job.options.breakType, job.options.breakChars, job.options.byteColoring, pDiffs);
+	Store(job.key, pDiffs);
+}
+
+/**
+ * @brief Diff texts of jobs in worker threads.
+ * Jobs queued earlier and not started yet are dropped, as are diffs not
+ * used since the previous precompute. Jobs whose diffs are known already
+ * only keep their diffs.
+ * @param [in,out] jobs Jobs to do, texts are moved out of them.
+ */
+void WordDiffCache::Precompute(std::vector<Job> & jobs)
+{
+	FastMutex::ScopedLock lock(m_mutex);
+	++m_generation;
+	for (std::deque<Job>::const_iterator it = m_jobs.begin(); it != m_jobs.end(); ++it)
+		m_pending.erase(it->key);
+	m_jobs.clear();
+	for (std::vector<Job>::iterator it = jobs.begin(); it != jobs.end(); ++it)
+	{
+		std::unordered_map<Key, Entry>::iterator itEntry = m_entries.find(it->key);
+		if (itEntry != m_entries.end())
+			itEntry->second.generation = m_generation;
+		else if (m_pending.insert(it->key).second)
+			m_jobs.push_back(std::move(*it));
+	}
+	Compact();
+	StartWorkers();
+}
+
+/**
+ * @brief Diff texts of a job in a worker thread, unless known or pending.
+ * @param [in,out] job Job to do, texts are moved out of it.
+ */
+void WordDiffCache::Queue(Job & job)
+{
+	FastMutex::ScopedLock lock(m_mutex);
+	if (m_entries.find(job.key) != m_entries.end() || !m_pending.insert(job.key).second)
+		return;
+	m_jobs.push_back(std::move(job));
+	StartWorkers();
+}
+
+/**
+ * @brief Is a key queued or being diffed?
+ */
+bool WordDiffCache::IsPending(Key key) const
+{
+	FastMutex::ScopedLock lock(m_mutex);
+	return m_pending.find(key) != m_pending.end();
+}
+
+/**
+ * @brief Are no jobs queued or being diffed?
+ */
+bool WordDiffCache::IsIdle() const
+{
+	FastMutex::ScopedLock lock(m_mutex);
+	return m_pending.empty();
+}
+
+/**
+ * @brief Return number of keys diffed so far, to find when diffs were added.
+ */
+unsigned WordDiffCache::GetVersion() const
+{
+	FastMutex::ScopedLock lock(m_mutex);
+	return m_version;
+}
+
+/**
+ * @brief Drop queued jobs and all diffs.
+ */
+void WordDiffCache::Clear()
+{
+	FastMutex::ScopedLock lock(m_mutex);
+	for (std::deque<Job>::const_iterator it = m_jobs.begin(); it != m_jobs.end(); ++it)
+		m_pending.erase(it->key);
+	m_jobs.clear();
+	m_entries.clear();
+	m_diffs.clear();
+}
+
+/**
+ * @brief Store diffs of a key diffed by a worker.
+ * @param [in] key Key of texts and options.
+ * @param [in] pDiffs Diffs of the texts, NULL if diffing failed.
+ */
+void WordDiffCache::Store(Key key, const std::vector<wdiff> * pDiffs)
+{
+	FastMutex::ScopedLock lock(m_mutex);
+	m_pending.erase(key);
+	if (pDiffs == NULL || m_entries.find(key) != m_entries.end())
+		return;
+	Entry entry;
+	entry.begin = static_cast<uint32_t>(m_diffs.size());
+	entry.count = static_cast<uint32_t>(pDiffs->size());
+	entry.generation = m_generation;
+	m_diffs.insert(m_diffs.end(), pDiffs->begin(), pDiffs->end());
+	m_entries[key] = entry;
+	++m_version;
+}
+
+/**
+ * @brief Drop diffs not used in this or the previous precompute.
+ * The array is rebuilt only when at least half of it would be dropped.
+ */
+void WordDiffCache::Compact()
+{
+	if (m_diffs.size() < MinCompactSize)
+		return;
+	size_t used = 0;
+	for (std::unordered_map<Key, Entry>::const_iterator it = m_entries.begin(); it != m_entries.end(); ++it)
+	{
+		if (it->second.generation + 1 >= m_generation)
+			used += it->second.count;
+	}
+	if (used * 2 > m_diffs.size())
+		return;
+
+	std::vector<wdiff> diffs;
+	diffs.reserve(used);
+	for (std::unordered_map<Key, Entry>::iterator it = m_entries.begin(); it != m_entries.end(); )
+	{
+		if (it->second.generation + 1 >= m_generation)
+		{
+			const uint32_t begin = static_cast<uint32_t>(diffs.size());
+			diffs.insert(diffs.end(), m_diffs.begin() + it->second.begin,
+				m_diffs.begin() + it->second.begin + it->second.count);
+			it->second.begin = begin;
+			++it;
+		}
+		else
+			it = m_entries.erase(it);
+	}
+	m_diffs.swap(diffs);
+}
+
+/**
+ * @brief Start workers for queued jobs, up to the number allowed.
+ */
+void WordDiffCache::StartWorkers()
+{
+	while (m_nRunning < m_nWorkers && m_nRunning < static_cast<int>(m_jobs.size()))
+	{
+		try
+		{
+			m_pool.start(*m_pWorker);
+		}
+		catch (Poco::Exception&)
+		{
+			// No thread available now, running workers take the jobs
+			// or the next call starts them
+			break;
+		}
+		++m_nRunning;
+	}
+}
+
+/**
+ * @brief Take next queued job for a worker.
+ * @return false if there are no jobs left and the worker ends.
+ */
+bool WordDiffCache::NextJob(Job & job)
+{
+	FastMutex::ScopedLock lock(m_mutex);
+	if (m_jobs.empty())
+	{
+		--m_nRunning;
+		return false;
+	}
+	job = std::move(m_jobs.front());
+	m_jobs.pop_front();
+	return true;
+}
@@ -0,0 +1,101 @@
+/**
+ * @file  WordDiffCache.h
+ *
+ * @brief Declaration of WordDiffCache class.
+ */
+#pragma once
+
+#include <vector>
+#include <deque>
+#include <memory>
+#include <unordered_map>
+#include <unordered_set>
+#include <cstdint>
+#include <Poco/Mutex.h>
+#include <Poco/ThreadPool.h>
+#include "UnicodeString.h"
+#include "stringdiffs.h"
+
+/**
+ * @brief Word diffs of texts, computed in worker threads.
+ *
+ * Word diffs are keyed by a hash of the diffed texts and of the options
+ * they were diffed with, so diffs of lines not changed by an edit are
+ * found again after a rescan. Diffs of all keys are stored one after
+ * another in a single array.
+ */
+class WordDiffCache
+{
+public:
+	/** @brief Hash of texts and options, 0 for none. */
+	typedef uint64_t Key;
+
+	/** @brief Options affecting word diffs. */
+	struct Options
+	{
+		bool casitive; /**< Is case significant? */
+		int xwhite; /**< Whitespace ignore mode. */
+		int breakType; /**< Break on whitespace only or punctuation too. */
+		bool byteColoring; /**< Diff at byte level? */
+		String breakChars; /**< Punctuation words break at, when breakType is 1. */
+
+		Options() : casitive(true), xwhite(0), breakType(0), byteColoring(false) {}
+		bool operator==(const Options & other) const
+		{
+			return casitive == other.casitive && xwhite == other.xwhite &&
+				breakType == other.breakType && byteColoring == other.byteColoring &&
+				breakChars == other.breakChars;
+		}
+	};
+
+	/** @brief Texts to diff. */
+	struct Job
+	{
+		Key key; /**< Set by MakeKey(). */
+		Options options;
+		int nFiles;
+		String str[3];
+
+		void MakeKey();
+	};
+
+	WordDiffCache();
+	~WordDiffCache();
+
+	bool Lookup(Key key, std::vector<wdiff> *pDiffs);
+	void Compute(const Job & job, std::vector<wdiff> *pDiffs);
+	void Precompute(std::vector<Job> & jobs);
+	void Queue(Job & job);
+	bool IsPending(Key key) const;
+	bool IsIdle() const;
+	unsigned GetVersion() const;
+	void Clear();
+
+private:
+	/** @brief Diffs of a key in the array. */
+	struct Entry
+	{
+		uint32_t begin; /**< Index of first diff. */
+		uint32_t count; /**< Number of diffs. */
+		unsigned generation; /**< Precompute the diffs were last used in. */
+	};
+
+	class Worker;
+
+	void Store(Key key, const std::vector<wdiff> * pDiffs);
+	void Compact();
+	void StartWorkers();
+	bool NextJob(Job & job);
+
+	mutable Poco::FastMutex m_mutex; /**< Guards the members below. */
+	std::vector<wdiff> m_diffs; /**< Diffs of all keys, one key after another. */
+	std::unordered_map<Key, Entry> m_entries;
+	std::deque<Job> m_jobs; /**< Texts waiting for a worker. */
+	std::unordered_set<Key> m_pending; /**< Keys queued or being diffed. */
+	unsigned m_generation; /**< Number of precomputes so far. */
+	unsigned m_version; /**< Number of keys diffed so far. */
+	int m_nRunning; /**< Workers running. */
+	int m_nWorkers; /**< Most workers to run at once. */
+	std::unique_ptr<Worker> m_pWorker;
+	Poco::ThreadPool m_pool;
+};
@@ -47,6 +47,17 @@ static DECL_TLS int *bdiag;		/* Vector, indexed by diagonal, containing
 				   search of the edit matrix. */
 static DECL_TLS int too_expensive;	/* Edit scripts longer than this are too
 				   expensive to compute.  */
+static DECL_TLS int *hist_count;	/* Vector, indexed by equivalence class,
+				   containing the number of lines of that
+				   class in the part of file 0 being
+				   compared by histogram_seq. */
+static DECL_TLS int *hist_head;	/* Vector, indexed by equivalence class,
+				   containing the last such line, or -1. */
+static DECL_TLS int *hist_prev;	/* Vector, indexed by line of file 0,
+				   containing the previous line of the same
+				   class in that part, or -1. */
+static DECL_TLS long long hist_budget;	/* Lines histogram_seq may still scan
+				   before leaving the rest to compareseq. */
 
 #define SNAKE_LIMIT 20	/* Snakes bigger than this are considered `big'.  */
 
@@ -63,6 +74,8 @@ static struct change *build_reverse_script PARAMS((struct file_data const[]));
 static struct change *build_script PARAMS((struct file_data const[]));
 static void briefly_report PARAMS((int, struct file_data const[]));
 static void compareseq PARAMS((int, int, int, int, int));
+static void histogram_seq PARAMS((int, int, int, int, int));
+static void histogram_diff PARAMS((struct file_data const[]));
 static void discard_confusing_lines PARAMS((struct file_data[]));
 static void shift_boundaries PARAMS((struct file_data[]));
 
@@ -392,6 +405,173 @@ compareseq (xoff, xlim, yoff, ylim, minimal)
     }
 }
 
+/* Histogram diff, used instead of compareseq when diff_algorithm is
+   ALGORITHM_HISTOGRAM.  Like patience diff it anchors the comparison on
+   rare lines: in the subsequences [XOFF, XLIM) and [YOFF, YLIM) it finds
+   the longest run of matching lines whose rarest line occurs least often
+   in file 0, keeps it, and does the same before and after the run.
+   Lines repeated many times, as in generated files, cannot mislead it
+   into a poor alignment, and no diagonal search is needed.
+
+   A subsequence where every line occurring in both files occurs more
+   than HISTOGRAM_MAX_CHAIN times in file 0 has nothing to anchor on, and
+   is left to compareseq.  So is everything once HISTOGRAM_BUDGET times the
+   lines of both files have been scanned or compared while extending runs,
+   because files where every run splits off only a few lines, or where
+   many long runs of repeated lines are tried, would take quadratic time.  */
+
+#define HISTOGRAM_MAX_CHAIN 64
+#define HISTOGRAM_BUDGET 32
+
+static void
+histogram_seq (xoff, xlim, yoff, ylim, minimal)
+     int xoff, xlim, yoff, ylim, minimal;
+{
+  int * const xv = xvec; /* Help the compiler.  */
+  int * const yv = yvec;
+  int * const count = hist_count;
+  int * const head = hist_head;
+  int * const prev = hist_prev;
+
+  for (;;)
+    {
+      int i, y;
+      int common = 0;
+      int best_x = 0, best_y = 0, best_len = 0;
+      int best_count = HISTOGRAM_MAX_CHAIN + 1;
+
+      /* Slide down the bottom initial diagonal. */
+      while (xoff < xlim && yoff < ylim && xv[xoff] == yv[yoff])
+        ++xoff, ++yoff;
+      /* Slide up the top initial diagonal. */
+      while (xlim > xoff && ylim > yoff && xv[xlim - 1] == yv[ylim - 1])
+        --xlim, --ylim;
+
+      if (xoff == xlim || yoff == ylim || hist_budget < 0)
+        {
+          compareseq (xoff, xlim, yoff, ylim, minimal);
+          return;
+        }
+      hist_budget -= (xlim - xoff) + (ylim - yoff);
+
+      /* Count the lines of each equivalence class in file 0, and chain
+         together the lines of the same class.  */
+      for (i = xoff; i < xlim; i++)
+        {
+          prev[i] = head[xv[i]];
+          head[xv[i]] = i;
+          count[xv[i]]++;
+        }
+
+      /* Try each line of file 1 that is not rarer in file 0 than the best
+         run so far as the start of a run, and extend the run both ways.  */
+      for (y = yoff; y < ylim && hist_budget >= 0; )
+        {
+          int ynext = y + 1;
+          int n = count[yv[y]];
+          if (n)
+            common = 1;
+          if (n && n <= best_count)
+            for (i = head[yv[y]]; i >= 0; i = prev[i])
+              {
+                int xs = i, ys = y, xe = i + 1, ye = y + 1;
+                int run_count = n;
+                while (xs > xoff && ys > yoff && xv[xs - 1] == yv[ys - 1])
+                  {
+                    --xs, --ys;
+                    if (run_count > count[xv[xs]])
+                      run_count = count[xv[xs]];
+                  }
+                while (xe < xlim && ye < ylim && xv[xe] == yv[ye])
+                  {
+                    if (run_count > count[xv[xe]])
+                      run_count = count[xv[xe]];
+                    ++xe, ++ye;
+                  }
+                hist_budget -= xe - xs;
+                /* Lines of file 1 in this run will not start a better one.  */
+                if (ynext < ye)
+                  ynext = ye;
+                if (best_len < xe - xs || run_count < best_count)
+                  {
+                    best_x = xs;
+                    best_y = ys;
+                    best_len = xe - xs;
+                    best_count = run_count;
+                  }
+              }
+          y = ynext;
+        }
+
+      for (i = xoff; i < xlim; i++)
+        {
+          head[xv[i]] = -1;
+          count[xv[i]] = 0;
+        }
+
+      if (hist_budget < 0)
+        {
+          compareseq (xoff, xlim, yoff, ylim, minimal);
+          return;
+        }
+      if (!common)
+        {
+          /* Nothing matches, every line is an insertion or deletion.  */
+          while (xoff < xlim)
+            files[0].changed_flag[files[0].realindexes[xoff++]] = 1;
+          while (yoff < ylim)
+            files[1].changed_flag[files[1].realindexes[yoff++]] = 1;
+          return;
+        }
+      if (!best_len)
+        {
+          compareseq (xoff, xlim, yoff, ylim, minimal);
+          return;
+        }
+
+      /* Recurse into the smaller side of the run and loop on the larger,
+         so the recursion stays shallow.  */
+      if (best_x - xoff + best_y - yoff < xlim - best_x + ylim - best_y)
+        {
+          histogram_seq (xoff, best_x, yoff, best_y, minimal);
+          xoff = best_x + best_len;
+          yoff = best_y + best_len;
+        }
+      else
+        {
+          histogram_seq (best_x + best_len, xlim, best_y + best_len, ylim, minimal);
+          xlim = best_x;
+          ylim = best_y;
+        }
+    }
+}
+
+/* Compare the undiscarded lines of FILEVEC with histogram_seq.  */
+
+static void
+histogram_diff (filevec)
+     struct file_data const filevec[];
+{
+  int i;
+  int nclasses = filevec[0].equiv_max;
+
+  hist_count = (int *) xmalloc (nclasses * sizeof (*hist_count));
+  hist_head = (int *) xmalloc (nclasses * sizeof (*hist_head));
+  hist_prev = (int *) xmalloc ((filevec[0].nondiscarded_lines + 1) * sizeof (*hist_prev));
+  bzero (hist_count, nclasses * sizeof (*hist_count));
+  for (i = 0; i < nclasses; i++)
+    hist_head[i] = -1;
+  hist_budget = HISTOGRAM_BUDGET
+    * ((long long) filevec[0].nondiscarded_lines + filevec[1].nondiscarded_lines);
+
+  histogram_seq (0, filevec[0].nondiscarded_lines,
+                 0, filevec[1].nondiscarded_lines, no_discards);
+
+  free (hist_count);
+  free (hist_head);
+  free (hist_prev);
+}
+
 /* Discard lines from one file that have no matches in the other file.
 
    A line which is discarded will not be considered by the actual
@@ -953,8 +1133,11 @@ struct change * diff_2_files (struct file_data filevec[], int depth, int * bin_s
 		files[0] = filevec[0];
 		files[1] = filevec[1];
 		
-		compareseq (0, filevec[0].nondiscarded_lines,
-		  0, filevec[1].nondiscarded_lines, no_discards);
+		if (diff_algorithm == ALGORITHM_HISTOGRAM)
+			histogram_diff (filevec);
+		else
+			compareseq (0, filevec[0].nondiscarded_lines,
+			  0, filevec[1].nondiscarded_lines, no_discards);
 		
 		free (fdiag - (filevec[1].nondiscarded_lines + 1));
 		
@@ -1116,10 +1299,19 @@ void cleanup_file_buffers(struct file_data fd[])
 	for (i = 1; i >= 0; --i)
 		free (fd[i].equivs);
 	
+	for (i = 0; i < 2; ++i)
+		free (fd[i].line_classes);
+
 	for (i = 0; i < 2; ++i)
 		free ((void *)(fd[i].linbuf + fd[i].linbuf_base));
 
-	if (fd[0].buffer != fd[1].buffer)
-		free (fd[0].buffer);
-	free (fd[1].buffer);
+	for (i = 0; i < 2; ++i)
+	{
+		if (i == 0 && fd[0].buffer == fd[1].buffer)
+			continue;
+		if (fd[i].mapped_chars)
+			unmap_file_buffer (&fd[i]);
+		else
+			free (fd[i].buffer);
+	}
 }
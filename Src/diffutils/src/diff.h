@@ -196,6 +196,16 @@ EXTERN char *	switch_string;
 /* Nonzero means use heuristics for better speed.  */
 EXTERN int	heuristic;
 
+enum diff_algorithm {
+  /* Myers' algorithm with diagonal heuristics (compareseq).  */
+  ALGORITHM_MYERS,
+  /* Histogram diff anchored on rare lines (histogram_seq).  */
+  ALGORITHM_HISTOGRAM
+};
+
+/* Algorithm finding the differences between lines of the two files.  */
+EXTERN int	diff_algorithm;
+
 /* Name of program the user invoked (for error messages).  */
 EXTERN char *	program;
 
@@ -243,6 +253,19 @@ struct file_data {
     FSIZE	    bufsize;
     /* Number of valid characters now in the buffer. */
     FSIZE	    buffered_chars;
+    /* WinMerge: nonzero if the caller filled buffer with a piece of the
+       file, so desc is not read.  bufsize must leave room for a newline
+       and a sentinel.  See StreamDiff.cpp.  */
+    int		    preloaded;
+    /* WinMerge: number of characters at the start of buffer mapped from
+       the file, or 0 if buffer was allocated.  See MapFileBuffer.cpp.  */
+    FSIZE	    mapped_chars;
+    /* WinMerge: start of the text after prepare_text_end, which is past
+       the BOM if there is one.  */
+    char const HUGE *text_begin;
+    /* WinMerge: lines of this file shared with another comparison running
+       at the same time, or null.  See struct shared_lines.  */
+    struct shared_lines *shared;
 
     /* Array of pointers to lines in the file.  */
     char const HUGE **linbuf;
@@ -287,6 +310,11 @@ struct file_data {
     /* 1 if file ends in a line with no final newline. */
     int		    missing_newline;
 
+    /* WinMerge: LINE_* flags of each line for filtering comments, two bits
+       per line and four lines per byte, or null if not classified.  See
+       CDiffWrapper::ClassifyCommentLines.  */
+    unsigned char  *line_classes;
+
     /* 1 more than the maximum equivalence value used for this or its
        sibling file. */
     int equiv_max;
@@ -295,6 +323,72 @@ struct file_data {
     int count_crlfs, count_crs, count_lfs;
 };
 
+/* Flags of a line in line_classes of struct file_data.  */
+#define LINE_HAS_CODE 1		/* Other than whitespace outside comments.  */
+#define LINE_IN_COMMENT 2	/* Line starts inside a block comment.  */
+
+/* Options that change the hash of a line, for struct hash_chunk.  */
+#define HASH_IGNORE_CASE 1
+#define HASH_IGNORE_SPACE_CHANGE 2
+#define HASH_IGNORE_ALL_SPACE 4
+#define HASH_IGNORE_EOL 8
+
+/* A piece of a file whose lines are found and hashed by hash_chunk_lines.
+   Pieces of both files are hashed at the same time in different threads,
+   so everything hash_chunk_lines needs is here and not in the thread local
+   option variables.  */
+
+struct hash_chunk {
+    /* Start of the first line of the piece.  */
+    char const HUGE *begin;
+    /* Lines starting before this belong to the piece.  */
+    char const HUGE *end;
+    /* HASH_IGNORE_* flags.  */
+    int flags;
+
+    /* Start and 64-bit hash of each line found, and their number.  */
+    char const HUGE **linbuf;
+    unsigned long long *hashes;
+    int lines, alloc_lines;
+    /* Start of the line after the last line found.  */
+    char const HUGE *next;
+    /* Nonzero if memory for linbuf or hashes could not be allocated.  */
+    int failed;
+    /* WinMerge: class of each line among all lines of the file, from 1 to
+       nclasses - 1, if the lines were taken from struct shared_lines and
+       not hashed, or null.  Not owned by the piece.  */
+    int const *classes;
+    int nclasses;
+};
+
+/* WinMerge: a 3-way compare diffs the middle file with each of the other
+   two files in two threads at the same time.  The first of them to get to
+   hashing finds and hashes all lines of the middle file and puts them in
+   classes of equal lines, and both take the lines between their identical
+   prefix and suffix from here.  Both threads have their own copy of the
+   text, so lines are found at the same offset from the start of the text.
+   See Diff3Pairs.cpp.  */
+
+struct shared_lines {
+    /* Text the lines were found in and its end, in the thread that found
+       them.  Null if the lines could not be shared after all.  */
+    char const HUGE *text;
+    char const HUGE *text_end;
+    /* HASH_IGNORE_* flags the lines were hashed with.  */
+    int flags;
+    /* Start, hash and class of each line, and their number.  linbuf[lines]
+       is the start of the line after the last.  Classes are numbered from
+       1 in the order of their first line, like equivalence classes.  */
+    char const HUGE **linbuf;
+    unsigned long long *hashes;
+    int *classes;
+    int lines;
+    /* 1 more than the highest class.  */
+    int nclasses;
+    /* Lets one thread wait for the other, see HashChunks.cpp.  */
+    void *sync;
+};
+
 /* Describe the two files currently being compared.  */
 
 EXTERN struct file_data files[2];
@@ -332,6 +426,22 @@ void print_ifdef_script PARAMS((struct change *));
 int read_files PARAMS((struct file_data[], int, int *));
 int sip PARAMS((struct file_data *, int));
 void slurp PARAMS((struct file_data *));
+void hash_chunk_lines PARAMS((struct hash_chunk *));
+
+/* HashChunks.cpp */
+int hash_thread_count PARAMS((void));
+size_t hash_chunk_min PARAMS((void));
+void set_hash_chunk_min PARAMS((size_t));
+void hash_chunks PARAMS((struct hash_chunk *, int));
+void init_shared_lines PARAMS((struct shared_lines *));
+void free_shared_lines PARAMS((struct shared_lines *));
+int claim_shared_lines PARAMS((struct shared_lines *));
+void publish_shared_lines PARAMS((struct shared_lines *));
+void wait_shared_lines PARAMS((struct shared_lines *));
+
+/* MapFileBuffer.cpp */
+int map_file_buffer PARAMS((struct file_data *, size_t));
+void unmap_file_buffer PARAMS((struct file_data *));
 
 /* normal.c */
 void print_normal_script PARAMS((struct change *));
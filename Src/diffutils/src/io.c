@@ -19,12 +19,12 @@ the Free Software Foundation, 675 Mass Ave, Cambridge, MA 02139, USA.  */
 
 #include "diff.h"
 
-/* Rotate a value n bits to the left. */
-#define UINT_BIT (sizeof (unsigned) * CHAR_BIT)
-#define ROL(v, n) ((v) << (n) | (v) >> (UINT_BIT - (n)))
+/* Given a 64-bit hash value and a new character, return a new hash value
+   (FNV-1a).  */
+#define HASH(h, c) (((h) ^ (unsigned char) (c)) * 0x100000001B3ULL)
 
-/* Given a hash value and a new character, return a new hash value. */
-#define HASH(h, c) ((c) + ROL (h, 7))
+/* Map a 64-bit hash value to one of 2**BITS slots (Fibonacci hashing).  */
+#define HASH_SLOT(h, bits) ((size_t) (((h) * 0x9E3779B97F4A7C15ULL) >> (64 - (bits))))
 
 /* Guess remaining number of lines from number N of lines so far,
    size S so far, and total size T.  */
@@ -50,30 +50,37 @@ enum UNICODESET
    Afterward, each class is represented by a number.  */
 struct equivclass
 {
-  int next;	/* Next item in this bucket. */
-  unsigned hash;	/* Hash of lines in this class.  */
   char const HUGE *line;	/* A line that fits this class. */
   size_t length;	/* The length of that line.  */
 };
 
-/* Hash-table: array of buckets, each being a chain of equivalence classes.  */
-static DECL_TLS int *buckets;
-  
-/* Number of buckets in the hash table array. */
-static DECL_TLS int nbuckets;
+/* A slot of the hash table of equivalence classes.  */
+struct equivslot
+{
+  unsigned long long hash;	/* Hash of lines in the class.  */
+  int eqclass;	/* Number of the class, or 0 if the slot is free.  */
+};
+
+/* Hash-table: open addressing with linear probing.  It has half again as
+   many slots as both files have lines or more, so it never fills up, and
+   lines are only compared when their 64-bit hashes are equal.  */
+static DECL_TLS struct equivslot *slots;
+
+/* Base 2 logarithm of the number of slots in the hash table. */
+static DECL_TLS int slot_bits;
 
 /* Array in which the equivalence classes are allocated.
-   The bucket-chains go through the elements in this array.
    The number of an equivalence class is its index in this array.  */
 static DECL_TLS struct equivclass HUGE *equivs;
 
 /* Index of first free element in the array `equivs'.  */
 static DECL_TLS int equivs_index;
 
-/* Number of elements allocated in the array `equivs'.  */
-static DECL_TLS int equivs_alloc;
-
-static void find_and_hash_each_line PARAMS((struct file_data *));
+static void find_and_hash_each_line PARAMS((struct file_data *, struct hash_chunk *, int));
+static int hash_flags PARAMS((void));
+static int split_hash_chunks PARAMS((char const HUGE *, char const HUGE *, struct hash_chunk *, int));
+static void share_lines PARAMS((struct file_data const *, struct shared_lines *, struct hash_chunk *, int));
+static int take_shared_lines PARAMS((struct file_data const *, struct shared_lines const *, struct hash_chunk *));
 static void find_identical_ends PARAMS((struct file_data[]));
 static char *prepare_text_end PARAMS((struct file_data *));
 static enum UNICODESET get_unicode_signature(struct file_data *);
@@ -92,6 +99,9 @@ static enum UNICODESET get_unicode_signature(struct file_data *current)
   unsigned long sig = 0x3F3F3F3F;
   // copy at most 4 bytes from buffer
   memcpy(&sig, current->buffer, min(current->buffered_chars, 4));
+  // a preloaded piece of a file has no room for transcoding
+  if (current->preloaded && (sig & 0xFFFFFF) != 0xBFBBEF)
+    return NONE;
   // check for the two possible 4 bytes signatures
   if (sig == 0x0000FEFF)
     return UCS4LE;
@@ -121,6 +131,9 @@ sip (current, skip_test)
      int skip_test;
 {
   int isbinary;
+  /* A preloaded piece of a file was checked by the caller.  */
+  if (current->preloaded)
+    return 0;
   /* If we have a nonexistent file at this stage, treat it as empty.  */
   if (current->desc < 0)
     {
@@ -170,8 +183,8 @@ slurp (current)
 {
   size_t cc;
 
-  if (current->desc < 0)
-    /* The file is nonexistent.  */
+  if (current->desc < 0 || current->preloaded)
+    /* The file is nonexistent, or its text is in the buffer already.  */
     ;
   else if (always_text_flag || current->buffered_chars != 0)
     {
@@ -182,6 +195,18 @@ slurp (current)
           ? ~0U	// yes, allocate extra room for transcoding
           : 0U;	// no, allocate no extra room for transcoding
 
+      /* WinMerge: map a big file needing no transcoding instead of
+         copying it to the heap.  */
+      if (!alloc_extra)
+        {
+          char HUGE *block = current->buffer;
+          if (map_file_buffer (current, sizeof (word) + 1))
+            {
+              free (block);
+              return;
+            }
+        }
+
       for (;;)
         {
           if (current->buffered_chars == current->bufsize)
@@ -234,38 +259,119 @@ ISWSPACE (char ch)
   return ch==' ' || ch=='\t';
 }
 
-/* Split the file into lines, simultaneously computing the equivalence class for
-   each line. */
-static void
-find_and_hash_each_line (current)
-     struct file_data *current;
+/* Find the first '\n' or '\r' at or after P for the loop in hash_chunk_lines
+   that hashes lines without ignoring case or white space.  prepare_text_end
+   made sure the text ends in a newline, so there is always one.  */
+
+#if defined (_M_X64) || (defined (_M_IX86_FP) && _M_IX86_FP >= 2) || defined (__SSE2__)
+#include <emmintrin.h>
+#ifdef _MSC_VER
+#include <intrin.h>
+static int
+first_bit (unsigned mask)
 {
-  unsigned h;
-  unsigned char const HUGE *p = (unsigned char const HUGE *) current->prefix_end;
-  unsigned char c;
-  int i, *bucket;
-  size_t length;
+  unsigned long index;
+  _BitScanForward (&index, mask);
+  return (int) index;
+}
+#else
+#define first_bit(mask) __builtin_ctz (mask)
+#endif
 
-  /* Cache often-used quantities in local variables to help the compiler.  */
-  char const HUGE **linbuf = current->linbuf;
-  int alloc_lines = current->alloc_lines;
+static char const HUGE *
+find_eol_char (p)
+     char const HUGE *p;
+{
+  __m128i const lf = _mm_set1_epi8 ('\n');
+  __m128i const cr = _mm_set1_epi8 ('\r');
+  unsigned offset = (unsigned) ((size_t) p & 15);
+  __m128i const *q = (__m128i const *) (p - offset);
+  __m128i v;
+  unsigned mask;
+
+  /* Check 16 characters at a time.  Aligned loads never cross a page
+     boundary, so loading the whole block around either end of the
+     buffer cannot fault.  */
+  v = _mm_load_si128 (q);
+  mask = (unsigned) _mm_movemask_epi8 (_mm_or_si128 (_mm_cmpeq_epi8 (v, lf),
+                                                     _mm_cmpeq_epi8 (v, cr)));
+  mask >>= offset;
+  if (mask)
+    return p + first_bit (mask);
+  for (;;)
+    {
+      v = _mm_load_si128 (++q);
+      mask = (unsigned) _mm_movemask_epi8 (_mm_or_si128 (_mm_cmpeq_epi8 (v, lf),
+                                                         _mm_cmpeq_epi8 (v, cr)));
+      if (mask)
+        return (char const HUGE *) q + first_bit (mask);
+    }
+}
+#else
+static char const HUGE *
+find_eol_char (p)
+     char const HUGE *p;
+{
+  while (*p != '\n' && *p != '\r')
+    p++;
+  return p;
+}
+#endif
+
+/* Hash LENGTH characters at S, a word at a time.  This is only used when
+   lines are equal exactly when their characters are, so it need not agree
+   with HASH.  */
+
+static unsigned long long
+hash_chars (s, length)
+     char const HUGE *s;
+     size_t length;
+{
+  unsigned long long const k = 0x9E3779B97F4A7C15ULL;
+  unsigned long long h = length * k;
+  unsigned long long w;
+
+  for (;  length >= sizeof (w);  length -= sizeof (w), s += sizeof (w))
+    {
+      memcpy (&w, s, sizeof (w));
+      h = (h ^ w) * k;
+      h ^= h >> 29;
+    }
+  if (length)
+    {
+      w = 0;
+      memcpy (&w, s, length);
+      h = (h ^ w) * k;
+      h ^= h >> 29;
+    }
+  return h;
+}
+
+/* Find the lines of a piece of a file and compute the hash of each line.
+   Lines equal as line_cmp sees them get the same hash.  This uses nothing
+   but CHUNK and the text, so it can run in any thread.  */
+
+void
+hash_chunk_lines (chunk)
+     struct hash_chunk *chunk;
+{
+  unsigned long long h;
+  unsigned char const HUGE *p = (unsigned char const HUGE *) chunk->begin;
+  unsigned char c;
+  char const HUGE *end = chunk->end;
+  int ignore_case = chunk->flags & HASH_IGNORE_CASE;
+  int ignore_space_change = chunk->flags & HASH_IGNORE_SPACE_CHANGE;
+  int ignore_all_space = chunk->flags & HASH_IGNORE_ALL_SPACE;
+  int ignore_eol = chunk->flags & HASH_IGNORE_EOL;
+  char const HUGE **linbuf = chunk->linbuf;
+  unsigned long long *hashes = chunk->hashes;
+  int alloc_lines = chunk->alloc_lines;
   int line = 0;
-  int linbuf_base = current->linbuf_base;
-  int *cureqs = (int *) xmalloc (alloc_lines * sizeof (int));
-  struct equivclass HUGE *eqs = equivs;
-  int eqs_index = equivs_index;
-  int eqs_alloc = equivs_alloc;
-  char const HUGE *suffix_begin = current->suffix_begin;
-  char const HUGE *bufend = current->buffer + current->buffered_chars;
-  char const HUGE *incomplete_tail
-    = current->missing_newline && ROBUST_OUTPUT_STYLE (output_style)
-      ? bufend : (char const HUGE *) 0;
-  int varies = length_varies;
 
   /* prepare_text_end put a zero word at the end of the buffer, 
   so we're not in danger of overrunning the end of the file */
 
-  while ((char const HUGE *) p < suffix_begin)
+  while ((char const HUGE *) p < end)
     {
       char const HUGE *ip = (char const HUGE *) p;
 
@@ -278,27 +384,27 @@ find_and_hash_each_line (current)
      loops advance pointer to eol (end of line)
      respecting UNIX (\r), MS-DOS/Windows (\r\n), and MAC (\r) eols
      Normally eol characters are hashed
-     If ignore_eol_diff option is set, eol characters are not hashed
+     If ignore_eol option is set, eol characters are not hashed
      and the eol characters are removed from line as well, in code
-     further down (after hashing_done label)
+     further down (in find_and_hash_each_line)
       */
 
       /* Hash this line until we find a newline. */
-      if (ignore_case_flag)
+      if (ignore_case)
         {
-          if (ignore_all_space_flag)
+          if (ignore_all_space)
             while ((c = *p++) != '\n' && (c != '\r' || *p == '\n'))
               {
-                if (ignore_eol_diff && (c=='\r' || c=='\n'))
+                if (ignore_eol && (c=='\r' || c=='\n'))
                   continue;
                 if (! ISWSPACE (c))
                   h = HASH (h, isupper (c) ? tolower (c) : c);
               }
-          else if (ignore_space_change_flag)
-            /* Note that \r must be hashed (if !ignore_eol_diff) */
+          else if (ignore_space_change)
+            /* Note that \r must be hashed (if !ignore_eol) */
             while ((c = *p++) != '\n' && (c != '\r' || *p == '\n'))
               {
-                if (ignore_eol_diff && (c=='\r' || c=='\n'))
+                if (ignore_eol && (c=='\r' || c=='\n'))
                   continue;
                 if (ISWSPACE (c))
                   {
@@ -312,12 +418,12 @@ find_and_hash_each_line (current)
                     else if (c == '\r')
                       {
                         /*
-                            \r must be hashed if !ignore_eol_diff
+                            \r must be hashed if !ignore_eol
                             Also, we must always advance to end of line
                             which means we can only stop on \r if not
                             followed by \n
                         */
-                        if (ignore_eol_diff)
+                        if (ignore_eol)
                           {
                             if (*p == '\n') /* continue to LF after CR */
                               continue;
@@ -332,7 +438,7 @@ find_and_hash_each_line (current)
                       }
                   }
                 /* c is now the first non-space.  */
-                /* c can be a \r (CR) if !ignore_eol_diff */
+                /* c can be a \r (CR) if !ignore_eol */
                 h = HASH (h, isupper (c) ? tolower (c) : c);
                 if (c == '\r' && *p != '\n')
                   goto hashing_done;
@@ -340,26 +446,26 @@ find_and_hash_each_line (current)
           else
             while ((c = *p++) != '\n' && (c != '\r' || *p == '\n'))
               {
-                if (ignore_eol_diff && (c=='\r' || c=='\n'))
+                if (ignore_eol && (c=='\r' || c=='\n'))
                   continue;
                 h = HASH (h, isupper (c) ? tolower (c) : c);
               }
         }
       else
         {
-          if (ignore_all_space_flag)
+          if (ignore_all_space)
             while ((c = *p++) != '\n' && (c != '\r' || *p == '\n'))
               {
-                if (ignore_eol_diff && (c=='\r' || c=='\n'))
+                if (ignore_eol && (c=='\r' || c=='\n'))
                   continue;
                 if (! ISWSPACE (c))
                   h = HASH (h, c);
               }
-          else if (ignore_space_change_flag)
-            /* Note that \r must be hashed (if !ignore_eol_diff) */
+          else if (ignore_space_change)
+            /* Note that \r must be hashed (if !ignore_eol) */
             while ((c = *p++) != '\n' && (c != '\r' || *p == '\n'))
               {
-                if (ignore_eol_diff && (c=='\r' || c=='\n'))
+                if (ignore_eol && (c=='\r' || c=='\n'))
                   continue;
                 if (ISWSPACE (c))
                   {
@@ -373,12 +479,12 @@ find_and_hash_each_line (current)
                     else if (c == '\r')
                       {
                         /*
-                            \r must be hashed if !ignore_eol_diff
+                            \r must be hashed if !ignore_eol
                             Also, we must always advance to end of line
                             which means we can only stop on \r if not
                             followed by \n
                         */
-                        if (ignore_eol_diff)
+                        if (ignore_eol)
                           {
                             if (*p == '\n') /* continue to LF after CR */
                               continue;
@@ -393,23 +499,349 @@ find_and_hash_each_line (current)
                       }
                   }
                 /* c is now the first non-space.  */
-                /* c can be a \r (CR) if !ignore_eol_diff */
+                /* c can be a \r (CR) if !ignore_eol */
                 h = HASH (h, c);
                 if (c == '\r' && *p != '\n')
                   goto hashing_done;
               }
           else
-            while ((c = *p++) != '\n' && (c != '\r' || *p == '\n'))
-              {
-                if (ignore_eol_diff && (c=='\r' || c=='\n'))
-                  continue;
-                h = HASH (h, c);
-              }
+            {
+              /* Lines are compared exactly, except maybe for the eol,
+                 so find the eol quickly and hash the same characters
+                 as the loops above would.  */
+              char const HUGE *eol = find_eol_char (ip);
+              p = (unsigned char const HUGE *) eol + 1;
+              if (*eol == '\r' && *p == '\n')
+                {
+                  if (!ignore_eol)
+                    eol++;
+                  p++;
+                }
+              h = hash_chars (ip, eol - ip);
+            }
         }
 hashing_done:;
 
-      bucket = &buckets[h % nbuckets];
-      length = (char const HUGE *) p - ip - ((char const HUGE *) p == incomplete_tail);
+      /* Maybe increase the size of the line table. */
+      if (line == alloc_lines)
+        {
+          char const HUGE **new_linbuf;
+          unsigned long long *new_hashes;
+          alloc_lines = 2 * alloc_lines + 1;
+          new_linbuf = (char const HUGE **) realloc ((void *) linbuf, alloc_lines * sizeof (*linbuf));
+          if (new_linbuf)
+            linbuf = new_linbuf;
+          new_hashes = (unsigned long long *) realloc (hashes, alloc_lines * sizeof (*hashes));
+          if (new_hashes)
+            hashes = new_hashes;
+          if (!new_linbuf || !new_hashes)
+            {
+              /* Leave it to the comparing thread to fail.  */
+              chunk->failed = 1;
+              break;
+            }
+        }
+      linbuf[line] = ip;
+      hashes[line] = h;
+      ++line;
+    }
+
+  chunk->linbuf = linbuf;
+  chunk->hashes = hashes;
+  chunk->alloc_lines = alloc_lines;
+  chunk->lines = line;
+  chunk->next = (char const HUGE *) p;
+}
+
+/* Return the HASH_IGNORE_* flags for the options of this thread.  */
+
+static int
+hash_flags ()
+{
+  int flags = 0;
+
+  if (ignore_case_flag)
+    flags |= HASH_IGNORE_CASE;
+  if (ignore_space_change_flag)
+    flags |= HASH_IGNORE_SPACE_CHANGE;
+  if (ignore_all_space_flag)
+    flags |= HASH_IGNORE_ALL_SPACE;
+  if (ignore_eol_diff)
+    flags |= HASH_IGNORE_EOL;
+  return flags;
+}
+
+/* Split the lines of a file from BEGIN to END, usually its identical
+   prefix and suffix, into at most MAX_CHUNKS pieces at line boundaries,
+   and store them in CHUNKS.  Return the number of pieces.  */
+
+static int
+split_hash_chunks (begin, end, chunks, max_chunks)
+     char const HUGE *begin;
+     char const HUGE *end;
+     struct hash_chunk *chunks;
+     int max_chunks;
+{
+  size_t size = begin < end ? end - begin : 0;
+  size_t chunk_min = hash_chunk_min ();
+  int flags = hash_flags ();
+  int nchunks = 1;
+  int i;
+
+  if (size / chunk_min > 1)
+    nchunks = (int) min (size / chunk_min, (size_t) max_chunks);
+
+  for (i = 0;  i < nchunks;  i++)
+    {
+      char const HUGE *chunk_begin = i ? chunks[i - 1].end : begin;
+      char const HUGE *chunk_end = end;
+      if (i < nchunks - 1)
+        {
+          /* Move the split point forward to the start of a line.  */
+          chunk_end = max (begin + size / nchunks * (i + 1), chunk_begin);
+          while (chunk_end < end
+                 && chunk_end[-1] != '\n'
+                 && (chunk_end[-1] != '\r' || chunk_end[0] == '\n'))
+            chunk_end++;
+        }
+      chunks[i].begin = chunk_begin;
+      chunks[i].end = chunk_end;
+      chunks[i].flags = flags;
+      chunks[i].alloc_lines
+        = chunk_begin < chunk_end ? GUESS_LINES (0, 0, chunk_end - chunk_begin) : 1;
+      chunks[i].linbuf = (char const HUGE **) xmalloc (chunks[i].alloc_lines * sizeof (*chunks[i].linbuf));
+      chunks[i].hashes = (unsigned long long *) xmalloc (chunks[i].alloc_lines * sizeof (*chunks[i].hashes));
+      chunks[i].lines = 0;
+      chunks[i].next = chunk_begin;
+      chunks[i].failed = 0;
+      chunks[i].classes = 0;
+      chunks[i].nclasses = 0;
+    }
+  return nchunks;
+}
+
+/* Put all lines of CURRENT, hashed by hash_chunk_lines in CHUNKS, into
+   classes of equal lines, and keep them in SHARED for the comparisons of
+   CURRENT with two other files.  This is find_and_hash_each_line for the
+   whole file and without the line table.  */
+
+static void
+share_lines (current, shared, chunks, nchunks)
+     struct file_data const *current;
+     struct shared_lines *shared;
+     struct hash_chunk *chunks;
+     int nchunks;
+{
+  char const HUGE *text_end = current->buffer + current->buffered_chars;
+  char const HUGE *incomplete_tail
+    = current->missing_newline && ROBUST_OUTPUT_STYLE (output_style)
+      ? text_end : (char const HUGE *) 0;
+  char const HUGE *p = current->text_begin;
+  struct equivclass HUGE *eqs;
+  struct equivslot *eqslots;
+  int eqs_index = 1;
+  int bits;
+  size_t slot_mask, s, length;
+  int i, j, k;
+  int line = 0;
+  size_t lines = 0;
+
+  for (j = 0;  j < nchunks;  j++)
+    {
+      if (chunks[j].failed)
+        fatal ("virtual memory exhausted");
+      lines += chunks[j].lines;
+    }
+
+  shared->linbuf = (char const HUGE **) xmalloc ((lines + 1) * sizeof (*shared->linbuf));
+  shared->hashes = (unsigned long long *) xmalloc ((lines + 1) * sizeof (*shared->hashes));
+  shared->classes = (int *) xmalloc ((lines + 1) * sizeof (*shared->classes));
+  eqs = (struct equivclass HUGE *) xmalloc ((lines + 1) * sizeof (*eqs));
+  for (bits = 6;  ((size_t) 1 << bits) < lines + lines / 2 + 1;  bits++)
+    ;
+  slot_mask = ((size_t) 1 << bits) - 1;
+  eqslots = (struct equivslot *) xmalloc (sizeof (*eqslots) << bits);
+  bzero (eqslots, sizeof (*eqslots) << bits);
+
+  for (j = 0;  j < nchunks;  j++)
+    {
+      struct hash_chunk *chunk = &chunks[j];
+
+      for (k = 0;  k < chunk->lines;  k++)
+        {
+          char const HUGE *ip = chunk->linbuf[k];
+          unsigned long long h = chunk->hashes[k];
+          p = k + 1 < chunk->lines ? chunk->linbuf[k + 1] : chunk->next;
+
+          length = p - ip - (p == incomplete_tail);
+          if (ignore_eol_diff)
+            {
+              if (length>1 && p[-2]=='\r' && p[-1]=='\n')
+                length -= 2;
+              else if (p[-1] == '\n' || p[-1] == '\r')
+                --length;
+            }
+          for (s = HASH_SLOT (h, bits);  ;  s = (s + 1) & slot_mask)
+            {
+              i = eqslots[s].eqclass;
+              if (!i)
+                {
+                  i = eqs_index++;
+                  eqs[i].line = ip;
+                  eqs[i].length = length;
+                  eqslots[s].hash = h;
+                  eqslots[s].eqclass = i;
+                  break;
+                }
+              if (eqslots[s].hash == h
+                  && (eqs[i].length == length || length_varies)
+                  && ! line_cmp (eqs[i].line, eqs[i].length, ip, length))
+                break;
+            }
+
+          shared->linbuf[line] = ip;
+          shared->hashes[line] = h;
+          shared->classes[line] = i;
+          ++line;
+        }
+
+      free ((void *) chunk->linbuf);
+      free (chunk->hashes);
+      chunk->linbuf = 0;
+      chunk->hashes = 0;
+    }
+  shared->linbuf[line] = p;
+
+  free (eqslots);
+  free (eqs);
+
+  shared->text = current->text_begin;
+  shared->text_end = text_end;
+  shared->flags = chunks[0].flags;
+  shared->lines = line;
+  shared->nclasses = eqs_index;
+}
+
+/* Take the lines of CURRENT between its identical prefix and suffix from
+   SHARED and put them in CHUNK as if hash_chunk_lines had found them.
+   Return 0 if the lines are not shared or if they were not found in the
+   same text or with the same options, or if the prefix or the suffix do
+   not start at one of them.  Then the lines must be hashed after all.  */
+
+static int
+take_shared_lines (current, shared, chunk)
+     struct file_data const *current;
+     struct shared_lines const *shared;
+     struct hash_chunk *chunk;
+{
+  char const HUGE *text = current->text_begin;
+  char const HUGE *text_end = current->buffer + current->buffered_chars;
+  FSIZE begin, end;
+  int lo, hi, first, last, k;
+  int flags = hash_flags ();
+
+  if (!shared->text || shared->flags != flags
+      || shared->text_end - shared->text != text_end - text)
+    return 0;
+
+  /* Find the first line of the prefix and the suffix by their offset.  */
+  begin = current->prefix_end - text;
+  end = current->suffix_begin - text;
+  for (lo = 0, hi = shared->lines;  lo < hi;  )
+    {
+      int mid = lo + (hi - lo) / 2;
+      if ((FSIZE) (shared->linbuf[mid] - shared->text) < begin)
+        lo = mid + 1;
+      else
+        hi = mid;
+    }
+  first = lo;
+  for (hi = shared->lines;  lo < hi;  )
+    {
+      int mid = lo + (hi - lo) / 2;
+      if ((FSIZE) (shared->linbuf[mid] - shared->text) < end)
+        lo = mid + 1;
+      else
+        hi = mid;
+    }
+  last = lo;
+  if ((FSIZE) (shared->linbuf[first] - shared->text) != begin
+      || (FSIZE) (shared->linbuf[last] - shared->text) != end)
+    return 0;
+
+  chunk->begin = current->prefix_end;
+  chunk->end = current->suffix_begin;
+  chunk->flags = flags;
+  chunk->lines = last - first;
+  chunk->alloc_lines = chunk->lines ? chunk->lines : 1;
+  chunk->linbuf = (char const HUGE **) xmalloc (chunk->alloc_lines * sizeof (*chunk->linbuf));
+  chunk->hashes = (unsigned long long *) xmalloc (chunk->alloc_lines * sizeof (*chunk->hashes));
+  for (k = 0;  k < chunk->lines;  k++)
+    chunk->linbuf[k] = shared->linbuf[first + k] - shared->text + text;
+  memcpy (chunk->hashes, shared->hashes + first, chunk->lines * sizeof (*chunk->hashes));
+  chunk->next = current->suffix_begin;
+  chunk->failed = 0;
+  chunk->classes = shared->classes + first;
+  chunk->nclasses = shared->nclasses;
+  return 1;
+}
+
+/* Put the lines hashed by hash_chunk_lines in CHUNKS into the line table
+   of CURRENT, simultaneously computing the equivalence class for each
+   line.  Lines taken from shared lines already have a class among all
+   lines of the file, and only the first line of each such class is looked
+   up in the table.  */
+static void
+find_and_hash_each_line (current, chunks, nchunks)
+     struct file_data *current;
+     struct hash_chunk *chunks;
+     int nchunks;
+{
+  unsigned long long h;
+  char const HUGE *p = current->prefix_end;
+  int i, j;
+  size_t s, length;
+
+  /* Cache often-used quantities in local variables to help the compiler.  */
+  char const HUGE **linbuf = current->linbuf;
+  int alloc_lines = current->alloc_lines;
+  int line = 0;
+  int linbuf_base = current->linbuf_base;
+  int *cureqs = (int *) xmalloc (alloc_lines * sizeof (int));
+  struct equivclass HUGE *eqs = equivs;
+  int eqs_index = equivs_index;
+  struct equivslot *eqslots = slots;
+  int bits = slot_bits;
+  size_t slot_mask = ((size_t) 1 << bits) - 1;
+  char const HUGE *bufend = current->buffer + current->buffered_chars;
+  char const HUGE *incomplete_tail
+    = current->missing_newline && ROBUST_OUTPUT_STYLE (output_style)
+      ? bufend : (char const HUGE *) 0;
+  int varies = length_varies;
+  int *class_map = 0;
+
+  for (j = 0;  j < nchunks;  j++)
+    {
+      struct hash_chunk *chunk = &chunks[j];
+      int k;
+
+      if (chunk->failed)
+        fatal ("virtual memory exhausted");
+
+      /* Map shared classes to equivalence classes.  */
+      if (chunk->classes && !class_map)
+        {
+          class_map = (int *) xmalloc (chunk->nclasses * sizeof (*class_map));
+          bzero (class_map, chunk->nclasses * sizeof (*class_map));
+        }
+
+      for (k = 0;  k < chunk->lines;  k++)
+    {
+      char const HUGE *ip = chunk->linbuf[k];
+      p = k + 1 < chunk->lines ? chunk->linbuf[k + 1] : chunk->next;
+      h = chunk->hashes[k];
+
+      length = p - ip - (p == incomplete_tail);
       if (ignore_eol_diff)
         {
           /* Remove all eols characters and adjust line length */
@@ -429,32 +861,31 @@ hashing_done:;
               --length;
             }
         }
-      for (i = *bucket;  ;  i = eqs[i].next)
-        if (!i)
+      /* A line of a shared class has the class of its first line.  */
+      i = chunk->classes ? class_map[chunk->classes[k]] : 0;
+      if (!i)
+        for (s = HASH_SLOT (h, bits);  ;  s = (s + 1) & slot_mask)
           {
-            /* Create a new equivalence class in this bucket. */
-            i = eqs_index++;
-            if (i == eqs_alloc)
-#ifdef __MSDOS__
-              if ((eqs = (struct equivclass HUGE *) farrealloc (eqs, (long) (eqs_alloc*=2) * sizeof(*eqs))) == NULL)
-                fatal ("far memory exhausted");
-#else
-              eqs = (struct equivclass *)
-                xrealloc (eqs, (eqs_alloc*=2) * sizeof(*eqs));
-#endif /*__MSDOS__*/
-            eqs[i].next = *bucket;
-            eqs[i].hash = h;
-            eqs[i].line = ip;
-            eqs[i].length = length;
-            *bucket = i;
-            break;
+            i = eqslots[s].eqclass;
+            if (!i)
+              {
+                /* Create a new equivalence class in this slot. */
+                i = eqs_index++;
+                eqs[i].line = ip;
+                eqs[i].length = length;
+                eqslots[s].hash = h;
+                eqslots[s].eqclass = i;
+                break;
+              }
+            /* "line_cmp" changed to "lines_differ" by diffutils 2.8.1 */
+            if (eqslots[s].hash == h
+                && (eqs[i].length == length || varies)
+                && ! line_cmp (eqs[i].line, eqs[i].length, ip, length))
+              /* Reuse existing equivalence class.  */
+              break;
           }
-        /* "line_cmp" changed to "lines_differ" by diffutils 2.8.1 */
-        else if (eqs[i].hash == h
-           && (eqs[i].length == length || varies)
-           && ! line_cmp (eqs[i].line, eqs[i].length, ip, length))
-          /* Reuse existing equivalence class.  */
-            break;
+      if (chunk->classes)
+        class_map[chunk->classes[k]] = i;
 
       /* Maybe increase the size of the line table. */
       if (line == alloc_lines)
@@ -472,6 +903,13 @@ hashing_done:;
       ++line;
     }
 
+      free ((void *) chunk->linbuf);
+      free (chunk->hashes);
+      chunk->linbuf = 0;
+      chunk->hashes = 0;
+    }
+  free (class_map);
+
   current->buffered_lines = line;
 
   for (i = 0;  ;  i++)
@@ -511,8 +949,6 @@ hashing_done:;
   current->valid_lines = line;
   current->alloc_lines = alloc_lines;
   current->equivs = cureqs;
-  equivs = eqs;
-  equivs_alloc = eqs_alloc;
   equivs_index = eqs_index;
 }
 
@@ -748,6 +1184,8 @@ find_identical_ends (filevec)
       filevec[1].buffered_chars = filevec[0].buffered_chars;
       buffer1 = buffer0;
     }
+  filevec[0].text_begin = buffer0;
+  filevec[1].text_begin = buffer1;
 
   /* Find identical prefix.  */
 
@@ -954,39 +1392,6 @@ find_identical_ends (filevec)
   filevec[0].prefix_lines = filevec[1].prefix_lines = lines;
 }
 
-/* Largest primes less than some power of two, for nbuckets.  Values range
-   from useful to preposterous.  If one of these numbers isn't prime
-   after all, don't blame it on me, blame it on primes (6) . . . */
-static int const primes[] =
-{
-  509,
-  1021,
-  2039,
-  4093,
-  8191,
-  16381,
-  32749,
-#if 32767 < INT_MAX
-  65521,
-  131071,
-  262139,
-  524287,
-  1048573,
-  2097143,
-  4194301,
-  8388593,
-  16777213,
-  33554393,
-  67108859,     /* Preposterously large . . . */
-  134217689,
-  268435399,
-  536870909,
-  1073741789,
-  2147483647,
-#endif
-  0
-};
-
 /* Given a vector of two file_data objects, read the file associated
    with each one, and build the table of equivalence classes.
    Return 1 if either file appears to be a binary file.
@@ -1002,6 +1407,10 @@ read_files (filevec, pretend_binary, bin_file)
 {
   int i;
   int skip_test = always_text_flag | pretend_binary;
+  int max_chunks, nchunks0, nchunks1;
+  size_t lines;
+  struct hash_chunk *chunks, *chunks1;
+  struct shared_lines *shared;
   int appears_binary = 0;
 
   if (bin_file)
@@ -1038,32 +1447,95 @@ read_files (filevec, pretend_binary, bin_file)
 
   find_identical_ends (filevec);
 
-  equivs_alloc = filevec[0].alloc_lines + filevec[1].alloc_lines + 1;
+  /* Find and hash the lines of both files at the same time, large files
+     in several pieces, then put them in equivalence classes in order.
+     The lines of the first file in CHUNKS are followed by those of the
+     second file in CHUNKS1.  Room is left after the first max_chunks
+     pieces for all lines of a shared first file.  */
+  max_chunks = hash_thread_count ();
+  chunks = (struct hash_chunk *) xmalloc (3 * max_chunks * sizeof (*chunks));
+  shared = filevec[0].shared;
+  if (shared && claim_shared_lines (shared))
+    {
+      /* This is the first comparison of the shared file to get here.
+         Hash all of its lines for both comparisons, unless this one
+         needs less than half of them: then the lines of the other
+         comparison likely are not worth waiting for either.  */
+      FSIZE size = filevec[0].buffer + filevec[0].buffered_chars - filevec[0].text_begin;
+      if ((FSIZE) (filevec[0].suffix_begin - filevec[0].prefix_end) >= size / 2)
+        {
+          int nshared = split_hash_chunks (filevec[0].text_begin,
+                                           filevec[0].text_begin + size,
+                                           chunks + max_chunks, max_chunks);
+          chunks1 = chunks + max_chunks + nshared;
+          nchunks1 = split_hash_chunks (filevec[1].prefix_end, filevec[1].suffix_begin,
+                                        chunks1, max_chunks);
+          hash_chunks (chunks + max_chunks, nshared + nchunks1);
+          share_lines (&filevec[0], shared, chunks + max_chunks, nshared);
+        }
+      else
+        shared = 0;
+      publish_shared_lines (filevec[0].shared);
+    }
+  else if (shared)
+    {
+      /* The other comparison is hashing the lines of the shared file,
+         so hash those of the second file and then wait for it.  */
+      chunks1 = chunks + max_chunks;
+      nchunks1 = split_hash_chunks (filevec[1].prefix_end, filevec[1].suffix_begin,
+                                    chunks1, max_chunks);
+      hash_chunks (chunks1, nchunks1);
+      wait_shared_lines (shared);
+    }
+
+  if (shared && take_shared_lines (&filevec[0], shared, chunks))
+    nchunks0 = 1;
+  else if (shared)
+    {
+      nchunks0 = split_hash_chunks (filevec[0].prefix_end, filevec[0].suffix_begin,
+                                    chunks, max_chunks);
+      hash_chunks (chunks, nchunks0);
+    }
+  else
+    {
+      nchunks0 = split_hash_chunks (filevec[0].prefix_end, filevec[0].suffix_begin,
+                                    chunks, max_chunks);
+      chunks1 = chunks + nchunks0;
+      nchunks1 = split_hash_chunks (filevec[1].prefix_end, filevec[1].suffix_begin,
+                                    chunks1, max_chunks);
+      hash_chunks (chunks, nchunks0 + nchunks1);
+    }
+
+  /* Now the number of lines is known, there can be no more classes.  */
+  lines = 0;
+  for (i = 0;  i < nchunks0;  i++)
+    lines += chunks[i].lines;
+  for (i = 0;  i < nchunks1;  i++)
+    lines += chunks1[i].lines;
 #ifdef __MSDOS__
-  if ((equivs = (struct equivclass HUGE *) farmalloc ((long) equivs_alloc * sizeof(struct equivclass))) == NULL)
+  if ((equivs = (struct equivclass HUGE *) farmalloc ((long) (lines + 1) * sizeof(struct equivclass))) == NULL)
     fatal ("far memory exhausted");
 #else
-  equivs = (struct equivclass *) xmalloc (equivs_alloc * sizeof (struct equivclass));
+  equivs = (struct equivclass *) xmalloc ((lines + 1) * sizeof (struct equivclass));
 #endif /*__MSDOS__*/
   /* Equivalence class 0 is permanently safe for lines that were not
      hashed.  Real equivalence classes start at 1. */
   equivs_index = 1;
 
-  for (i = 0;  primes[i] < equivs_alloc / 3;  i++)
-    if (! primes[i])
-      abort ();
-  nbuckets = primes[i];
-
-  buckets = (int *) xmalloc (nbuckets * sizeof (*buckets));
-  bzero (buckets, nbuckets * sizeof (*buckets));
+  /* Keep the table at most two thirds full.  */
+  for (slot_bits = 6;  ((size_t) 1 << slot_bits) < lines + lines / 2 + 1;  slot_bits++)
+    ;
+  slots = (struct equivslot *) xmalloc (sizeof (*slots) << slot_bits);
+  bzero (slots, sizeof (*slots) << slot_bits);
 
-  for (i = 0; i < 2; ++i)
-    find_and_hash_each_line (&filevec[i]);
+  find_and_hash_each_line (&filevec[0], chunks, nchunks0);
+  find_and_hash_each_line (&filevec[1], chunks1, nchunks1);
+  free (chunks);
 
   filevec[0].equiv_max = filevec[1].equiv_max = equivs_index;
 
   free (equivs);
-  free (buckets);
+  free (slots);
 
   return 0;
 }
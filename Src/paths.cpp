@@ -761,3 +761,22 @@ bool paths_IsDecendant(const String& path, const String& ancestor)
 	return path.length() > ancestor.length() && 
 		   string_compare_nocase(String(path.c_str(), path.c_str() + ancestor.length()), ancestor) == 0;
 }
+
+/**
+ * @brief Get root folder of the volume the path is on.
+ * For example C:\ or \\server\share\. Paths on the same volume
+ * return the same root, except for volumes mounted into folders.
+ * @param [in] path Path to check.
+ * @param [out] pbRemote Set to true if the volume is a network drive.
+ * @return Volume root, or empty string if it could not be determined.
+ */
+String paths_GetVolumePath(const String& path, bool *pbRemote)
+{
+	TCHAR szVolume[MAX_PATH] = {0};
+	if (!GetVolumePathName(path.c_str(), szVolume, MAX_PATH))
+		szVolume[0] = 0;
+	if (pbRemote)
+		*pbRemote = (szVolume[0] == '\\' && szVolume[1] == '\\') ||
+			(szVolume[0] != 0 && GetDriveType(szVolume) == DRIVE_REMOTE);
+	return szVolume;
+}
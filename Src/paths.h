@@ -41,4 +41,5 @@ void paths_SplitViewName(const TCHAR *s, String * path, String * name, String *
 String paths_GetPathOnly(const String& fullpath);
 bool paths_IsURLorCLSID(const String& path);
 bool paths_IsDecendant(const String& path, const String& ancestor);
+String paths_GetVolumePath(const String& path, bool *pbRemote = NULL);
 inline String paths_AddTrailingSlash(const String& path) { return !paths_EndsWithSlash(path) ? path + _T("\\") : path; }
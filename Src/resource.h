@@ -800,6 +800,7 @@
 #define IDS_ELAPSED_TIME                17881
 #define IDS_STATUS_SELITEM1             17882
 #define IDS_STATUS_SELITEMS             17883
+#define IDS_COMPARE_RESULT_CACHE_STATS  17884
 #define IDS_COLDESC_FILENAME            17901
 #define IDS_COLDESC_DIR                 17902
 #define IDS_COLDESC_RESULT              17903
@@ -11,47 +11,143 @@
 #include <tchar.h>
 #include <cassert>
 #include <climits>
+#include <algorithm>
 #include <mbctype.h>
+#include <Poco/Mutex.h>
+#if defined(_M_IX86) || defined(_M_X64) || defined(__SSE2__)
+#include <emmintrin.h>
+#define STRINGDIFFS_SSE2
+#endif
 #include "CompareOptions.h"
 #include "stringdiffsi.h"
 #include "Diff3.h"
 
 using std::vector;
 
+/** @brief Most elements a buffer of a workspace keeps between diffs. */
+static const size_t MaxWorkspaceCapacity = 64 * 1024;
+
+/** @brief Most words of a line diffed word by word. */
+#ifdef _WIN64
+static const size_t MaxWords = 20480;
+#else
+static const size_t MaxWords = 2048;
+#endif
+
+/** @brief Most steps of the edit path search of a line, 12 bytes each. */
+static const size_t MaxDiffNodes = 2 * 1024 * 1024;
+
+/** @brief Most steps of the edit path search of a region of a long line. */
+static const size_t MaxRefineNodes = 256 * 1024;
+
+/**
+ * @brief Most steps and compared words of the edit path searches of a line
+ * before highlighting gets coarser. It is not a time, so a line always gets
+ * the same diffs.
+ */
+static const size_t DiffWorkBudget = 16 * 1024 * 1024;
+
+/** @brief Characters after the common beginning from which a line is diffed by chunks. */
+static const int LongLineLength = 64 * 1024;
+
+/**
+ * @brief Smallest and largest average number of characters in a chunk.
+ * Chunks have at least a quarter of it, so at least 32 characters.
+ */
+static const int SmallestChunkSize = 128;
+static const int LargestChunkSize = 16 * 1024;
+
+/** @brief Most chunks of a line, for choosing the chunk size. */
+static const int MaxChunks = 256 * 1024;
+
+/** @brief Longest region of differing chunks diffed word by word. */
+static const int RefineLength = 4096;
+
+/** @brief Most characters a chunk boundary is moved to reach a word boundary. */
+static const int SnapLength = 16;
+
 static bool Initialized;
-static bool CustomChars;
-static TCHAR *BreakChars;
-static TCHAR BreakCharDefaults[] = _T(",.;:");
+static Poco::FastMutex BreakCharsMutex; /**< Guards BreakChars, diffs take a copy. */
+static String BreakChars;
+static const TCHAR BreakCharDefaults[] = _T(",.;:");
 
 static bool isSafeWhitespace(TCHAR ch);
-static bool isWordBreak(int breakType, const TCHAR *str, int index);
+static bool isWordBreak(int breakType, const String & breakChars, const TCHAR *str, int index);
+static int CommonSuffixLength(const TCHAR *p1, const TCHAR *p2, int len);
+static void ComputeByteDiff(LPCTSTR pbeg1, int len1, LPCTSTR pbeg2, int len2,
+	bool casitive, int xwhite, int begin[2], int end[2], bool equal);
+
+/**
+ * @brief Get buffers of word diffs for this thread.
+ */
+static stringdiffs::Workspace & GetWorkspace()
+{
+	static thread_local stringdiffs::Workspace workspace;
+	return workspace;
+}
+
+/**
+ * @brief Get buffers for diffing regions of a long line in this thread.
+ */
+static stringdiffs::Workspace & GetRefineWorkspace()
+{
+	static thread_local stringdiffs::Workspace workspace;
+	return workspace;
+}
+
+/**
+ * @brief Diff two strings, using buffers of this thread.
+ */
+static void
+ComputeWordDiffs(const String& str1, const String& str2,
+	bool case_sensitive, int whitespace, int breakType, const String& breakChars, bool byte_level,
+	std::vector<wdiff> * pDiffs)
+{
+	stringdiffs sdiffs(str1, str2, case_sensitive, whitespace, breakType, breakChars, pDiffs, GetWorkspace());
+	// Hash all words in both lines and then compare them word by word
+	// storing differences into m_wdiffs
+	sdiffs.BuildWordDiffList();
+
+	if (byte_level)
+		sdiffs.wordLevelToByteLevel();
+
+	// Now copy m_wdiffs into caller-supplied m_pDiffs (coalescing adjacents if possible)
+	sdiffs.PopulateDiffs();
+}
 
 void sd_Init()
 {
-	BreakChars = &BreakCharDefaults[0];
+	Poco::FastMutex::ScopedLock lock(BreakCharsMutex);
+	BreakChars = BreakCharDefaults;
 	Initialized = true;
 }
 
 void sd_Close()
 {
-	if (CustomChars)
-	{
-		free(BreakChars);
-		BreakChars = NULL;
-		CustomChars = false;
-	}
+	Poco::FastMutex::ScopedLock lock(BreakCharsMutex);
+	BreakChars.clear();
 	Initialized = false;
 }
 
+/**
+ * @brief Set punctuation words break at.
+ * Diffs already running, maybe in other threads, keep the ones they started with.
+ */
 void sd_SetBreakChars(const TCHAR *breakChars)
 {
 	assert(Initialized);
 
-	if (CustomChars)
-		free(BreakChars);
+	Poco::FastMutex::ScopedLock lock(BreakCharsMutex);
+	BreakChars = breakChars;
+}
 
-	CustomChars = true;
-	BreakChars = _tcsdup(breakChars);
+/**
+ * @brief Get punctuation words break at.
+ */
+String sd_GetBreakChars()
+{
+	Poco::FastMutex::ScopedLock lock(BreakCharsMutex);
+	return BreakChars;
 }
 
 void
@@ -59,8 +155,7 @@ sd_ComputeWordDiffs(const String& str1, const String& str2,
 	bool case_sensitive, int whitespace, int breakType, bool byte_level,
 	std::vector<wdiff> * pDiffs)
 {
-	String strs[3] = {str1, str2, _T("")};
-	sd_ComputeWordDiffs(2, strs, case_sensitive, whitespace, breakType, byte_level, pDiffs);
+	ComputeWordDiffs(str1, str2, case_sensitive, whitespace, breakType, sd_GetBreakChars(), byte_level, pDiffs);
 }
 
 struct Comp02Functor
@@ -91,37 +186,33 @@ struct Comp02Functor
 	bool case_sensitive_;
 };
 
+void
+sd_ComputeWordDiffs(int nFiles, const String str[3],
+	bool case_sensitive, int whitespace, int breakType, bool byte_level,
+	std::vector<wdiff> * pDiffs)
+{
+	sd_ComputeWordDiffs(nFiles, str, case_sensitive, whitespace, breakType, sd_GetBreakChars(), byte_level, pDiffs);
+}
+
 /**
  * @brief Construct our worker object and tell it to do the work
+ * @param [in] breakChars Punctuation words break at, for diffs not using
+ * the ones set by sd_SetBreakChars() when they are done.
  */
 void
 sd_ComputeWordDiffs(int nFiles, const String str[3],
-	bool case_sensitive, int whitespace, int breakType, bool byte_level,
+	bool case_sensitive, int whitespace, int breakType, const String& breakChars, bool byte_level,
 	std::vector<wdiff> * pDiffs)
 {
 	if (nFiles == 2)
 	{
-		stringdiffs sdiffs(str[0], str[1], case_sensitive, whitespace, breakType, pDiffs);
-		// Hash all words in both lines and then compare them word by word
-		// storing differences into m_wdiffs
-		sdiffs.BuildWordDiffList();
-
-		if (byte_level)
-			sdiffs.wordLevelToByteLevel();
-
-		// Now copy m_wdiffs into caller-supplied m_pDiffs (coalescing adjacents if possible)
-		sdiffs.PopulateDiffs();
-
+		ComputeWordDiffs(str[0], str[1], case_sensitive, whitespace, breakType, breakChars, byte_level, pDiffs);
 	}
 	else
 	{
 		if (str[0].empty())
 		{
-			stringdiffs sdiffs(str[1], str[2], case_sensitive, whitespace, breakType, pDiffs);
-			sdiffs.BuildWordDiffList();
-			if (byte_level)
-				sdiffs.wordLevelToByteLevel();
-			sdiffs.PopulateDiffs();
+			ComputeWordDiffs(str[1], str[2], case_sensitive, whitespace, breakType, breakChars, byte_level, pDiffs);
 			for (size_t i = 0; i < pDiffs->size(); i++)
 			{
 				wdiff& diff = (*pDiffs)[i];
@@ -135,11 +226,7 @@ sd_ComputeWordDiffs(int nFiles, const String str[3],
 		}
 		else if (str[1].empty())
 		{
-			stringdiffs sdiffs(str[0], str[2], case_sensitive, whitespace, breakType, pDiffs);
-			sdiffs.BuildWordDiffList();
-			if (byte_level)
-				sdiffs.wordLevelToByteLevel();
-			sdiffs.PopulateDiffs();
+			ComputeWordDiffs(str[0], str[2], case_sensitive, whitespace, breakType, breakChars, byte_level, pDiffs);
 			for (size_t i = 0; i < pDiffs->size(); i++)
 			{
 				wdiff& diff = (*pDiffs)[i];
@@ -153,11 +240,7 @@ sd_ComputeWordDiffs(int nFiles, const String str[3],
 		}
 		else if (str[2].empty())
 		{
-			stringdiffs sdiffs(str[0], str[1], case_sensitive, whitespace, breakType, pDiffs);
-			sdiffs.BuildWordDiffList();
-			if (byte_level)
-				sdiffs.wordLevelToByteLevel();
-			sdiffs.PopulateDiffs();
+			ComputeWordDiffs(str[0], str[1], case_sensitive, whitespace, breakType, breakChars, byte_level, pDiffs);
 			for (size_t i = 0; i < pDiffs->size(); i++)
 			{
 				wdiff& diff = (*pDiffs)[i];
@@ -172,20 +255,9 @@ sd_ComputeWordDiffs(int nFiles, const String str[3],
 		else
 		{
 			std::vector<wdiff> diffs10, diffs12;
-			stringdiffs sdiffs10(str[1], str[0], case_sensitive, whitespace, breakType, &diffs10);
-			stringdiffs sdiffs12(str[1], str[2], case_sensitive, whitespace, breakType, &diffs12);
-			// Hash all words in both lines and then compare them word by word
-			// storing differences into m_wdiffs
-			sdiffs10.BuildWordDiffList();
-			sdiffs12.BuildWordDiffList();
-			if (byte_level)
-			{
-				sdiffs10.wordLevelToByteLevel();
-				sdiffs12.wordLevelToByteLevel();
-			}
-			// Now copy m_wdiffs into caller-supplied m_pDiffs (coalescing adjacents if possible)
-			sdiffs10.PopulateDiffs();
-			sdiffs12.PopulateDiffs();
+			// Diffs are done one after another, as they share buffers of the thread
+			ComputeWordDiffs(str[1], str[0], case_sensitive, whitespace, breakType, breakChars, byte_level, &diffs10);
+			ComputeWordDiffs(str[1], str[2], case_sensitive, whitespace, breakType, breakChars, byte_level, &diffs12);
 
 			Make3wayDiff(*pDiffs, diffs10, diffs12, 
 				Comp02Functor(str, case_sensitive), false);
@@ -195,26 +267,55 @@ sd_ComputeWordDiffs(int nFiles, const String str[3],
 
 /**
  * @brief stringdiffs constructor simply loads all members from arguments
+ * Only one stringdiffs object may use a workspace at a time.
  */
 stringdiffs::stringdiffs(const String & str1, const String & str2,
-	bool case_sensitive, int whitespace, int breakType,
-	std::vector<wdiff> * pDiffs)
+	bool case_sensitive, int whitespace, int breakType, const String & breakChars,
+	std::vector<wdiff> * pDiffs, Workspace & workspace)
 : m_str1(str1)
 , m_str2(str2)
 , m_case_sensitive(case_sensitive)
 , m_whitespace(whitespace)
 , m_breakType(breakType)
+, m_breakChars(breakChars)
 , m_pDiffs(pDiffs)
 , m_matchblock(true) // Change to false to get word to word compare
+, m_refining(false)
+, m_maxNodes(MaxDiffNodes)
+, m_work(0)
+, m_pWork(&m_work)
+, m_workspace(workspace)
+, m_words1(workspace.words1)
+, m_words2(workspace.words2)
+, m_wdiffs(workspace.wdiffs)
 {
+	m_words1.clear();
+	m_words2.clear();
+	m_wdiffs.clear();
+}
+
+template <typename T>
+static void ReleaseIfLarge(std::vector<T> & v)
+{
+	if (v.capacity() > MaxWorkspaceCapacity)
+		std::vector<T>().swap(v);
 }
 
 /**
  * @brief Destructor.
- * The destructor frees all diffs added to the vectors.
+ * The destructor frees buffers of the workspace grown large by long lines,
+ * so a thread does not keep them after diffing those lines.
  */
 stringdiffs::~stringdiffs()
 {
+	ReleaseIfLarge(m_workspace.words1);
+	ReleaseIfLarge(m_workspace.words2);
+	ReleaseIfLarge(m_workspace.wdiffs);
+	ReleaseIfLarge(m_workspace.fp);
+	ReleaseIfLarge(m_workspace.path);
+	ReleaseIfLarge(m_workspace.nodes);
+	ReleaseIfLarge(m_workspace.ses);
+	ReleaseIfLarge(m_workspace.edscript);
 }
 
 #ifdef STRINGDIFF_LOGGING
@@ -254,11 +355,12 @@ stringdiffs::debugoutput()
 bool
 stringdiffs::BuildWordDiffList_DP()
 {
-	std::vector<char> edscript;
+	std::vector<char> & edscript = m_workspace.edscript;
 
 	//if (dp(edscript) <= 0)
 	//	return false;
-	onp(edscript);
+	if (onp(edscript) < 0)
+		return false;
 
 	int i = 1, j = 1;
 	for (size_t k = 0; k < edscript.size(); k++)
@@ -335,40 +437,312 @@ stringdiffs::BuildWordDiffList_DP()
 void
 stringdiffs::BuildWordDiffList()
 {
-	BuildWordsArray(m_str1, m_words1);
-	BuildWordsArray(m_str2, m_words2);
+	// Words of common beginning of the strings are equal, so only words
+	// after it are compared. Common end is compared, as which ones of
+	// equal words are matched depends on words after them.
+	const int prefix = FindCommonPrefix();
+	const int len1 = static_cast<int>(m_str1.length());
+	const int len2 = static_cast<int>(m_str2.length());
+	if (prefix == len1 && prefix == len2)
+		return;
 
-#ifdef _WIN64
-	if (m_words1.size() > 20480 || m_words2.size() > 20480)
-#else
-	if (m_words1.size() > 2048 || m_words2.size() > 2048)
-#endif
+	// Words of long lines would take too much memory and time
+	if (!m_refining && (len1 - prefix > LongLineLength || len2 - prefix > LongLineLength))
 	{
-		int s1 = m_words1[0].start;
-		int e1 = m_words1[m_words1.size() - 1].end;
-		int s2 = m_words2[0].start;
-		int e2 = m_words2[m_words2.size() - 1].end;
-		m_wdiffs.push_back(wdiff(s1, e1, s2, e2));		
+		BuildChunkDiffList(prefix);
 		return;
 	}
 
-	BuildWordDiffList_DP();
+	BuildWordsArray(m_str1, prefix, m_words1);
+	BuildWordsArray(m_str2, prefix, m_words2);
+
+	if (m_words1.size() > MaxWords || m_words2.size() > MaxWords || !BuildWordDiffList_DP())
+	{
+		m_wdiffs.clear();
+		if (m_refining)
+			AddWholeDiff(prefix);
+		else
+			BuildChunkDiffList(prefix);
+	}
+}
+
+/**
+ * @brief Add differences of long lines, found by diffing chunks of them.
+ * Differing chunks are diffed word by word afterwards. When diffing the
+ * chunks takes too much memory or work, chunks are made larger, and at
+ * last the whole lines are one diff.
+ * @param [in] prefix Length of common beginning of the lines.
+ */
+void
+stringdiffs::BuildChunkDiffList(int prefix)
+{
+	// Unlike words, chunks of the common end are not diffed, as which
+	// equal chunks are matched does not matter
+	const int len1 = static_cast<int>(m_str1.length());
+	const int len2 = static_cast<int>(m_str2.length());
+	int suffix = CommonSuffixLength(m_str1.c_str() + len1, m_str2.c_str() + len2,
+		(std::min)(len1, len2) - prefix);
+	while (suffix > 0 && !(IsWordBoundary(m_str1, len1 - suffix) && IsWordBoundary(m_str2, len2 - suffix)))
+		--suffix;
+
+	const int length = (std::max)(len1, len2) - suffix - prefix;
+	int chunkSize = SmallestChunkSize;
+	while (chunkSize < LargestChunkSize && length / chunkSize > MaxChunks)
+		chunkSize *= 2;
+	for (; chunkSize <= LargestChunkSize; chunkSize *= 16)
+	{
+		m_words1.clear();
+		m_words2.clear();
+		m_wdiffs.clear();
+		BuildChunksArray(m_str1, prefix, len1 - suffix, chunkSize, m_words1);
+		BuildChunksArray(m_str2, prefix, len2 - suffix, chunkSize, m_words2);
+		if (BuildWordDiffList_DP())
+		{
+			RefineChunkDiffs();
+			return;
+		}
+		if (IsOutOfWork())
+			break;
+	}
+	AddWholeDiff(prefix);
+}
+
+/**
+ * @brief Diff regions of differing chunks word by word.
+ * Regions too long to diff, and regions left when the work budget of the
+ * line is used up, stay as one diff.
+ */
+void
+stringdiffs::RefineChunkDiffs()
+{
+	std::vector<wdiff> chunkdiffs;
+	chunkdiffs.swap(m_wdiffs);
+	for (size_t i = 0; i < chunkdiffs.size(); ++i)
+	{
+		// Diffs of adjacent chunks are one region
+		wdiff diff = chunkdiffs[i];
+		while (i + 1 < chunkdiffs.size() && diff.end[0] + 1 == chunkdiffs[i + 1].begin[0]
+			&& diff.end[1] + 1 == chunkdiffs[i + 1].begin[1])
+		{
+			++i;
+			diff.end[0] = chunkdiffs[i].end[0];
+			diff.end[1] = chunkdiffs[i].end[1];
+		}
+		const int len1 = diff.end[0] - diff.begin[0] + 1;
+		const int len2 = diff.end[1] - diff.begin[1] + 1;
+		if (len1 == 0 || len2 == 0 || len1 > RefineLength || len2 > RefineLength || IsOutOfWork())
+		{
+			TrimDiff(diff);
+			m_wdiffs.push_back(diff);
+			continue;
+		}
+
+		const String str1(m_str1, diff.begin[0], len1);
+		const String str2(m_str2, diff.begin[1], len2);
+		std::vector<wdiff> diffs;
+		stringdiffs refine(str1, str2, m_case_sensitive, m_whitespace, m_breakType,
+			m_breakChars, &diffs, GetRefineWorkspace());
+		refine.m_refining = true;
+		refine.m_maxNodes = MaxRefineNodes;
+		refine.m_pWork = m_pWork;
+		refine.BuildWordDiffList();
+		refine.PopulateDiffs();
+		for (size_t j = 0; j < diffs.size(); ++j)
+		{
+			wdiff & refined = diffs[j];
+			for (int file = 0; file < 2; ++file)
+			{
+				refined.begin[file] += diff.begin[file];
+				refined.end[file] += diff.begin[file];
+			}
+			m_wdiffs.push_back(refined);
+		}
+	}
+}
+
+/**
+ * @brief Add one diff from the common beginning to the common end of the lines.
+ * @param [in] prefix Length of common beginning of the lines.
+ */
+void
+stringdiffs::AddWholeDiff(int prefix)
+{
+	wdiff diff(prefix, static_cast<int>(m_str1.length()) - 1, prefix, static_cast<int>(m_str2.length()) - 1);
+	TrimDiff(diff);
+	m_words1.clear();
+	m_words2.clear();
+	m_wdiffs.clear();
+	m_wdiffs.push_back(diff);
+}
+
+/**
+ * @brief Leave equal characters at the beginning and end out of a diff.
+ * The diff still begins and ends at word boundaries.
+ */
+void
+stringdiffs::TrimDiff(wdiff & diff) const
+{
+	int maxLength = (std::min)(diff.end[0] - diff.begin[0], diff.end[1] - diff.begin[1]) + 1;
+	int prefix = 0;
+	while (prefix < maxLength && caseMatch(m_str1[diff.begin[0] + prefix], m_str2[diff.begin[1] + prefix]))
+		++prefix;
+	while (prefix > 0 && !(IsWordBoundary(m_str1, diff.begin[0] + prefix) && IsWordBoundary(m_str2, diff.begin[1] + prefix)))
+		--prefix;
+	diff.begin[0] += prefix;
+	diff.begin[1] += prefix;
+
+	maxLength -= prefix;
+	int suffix = 0;
+	while (suffix < maxLength && caseMatch(m_str1[diff.end[0] - suffix], m_str2[diff.end[1] - suffix]))
+		++suffix;
+	while (suffix > 0 && !(IsWordBoundary(m_str1, diff.end[0] + 1 - suffix) && IsWordBoundary(m_str2, diff.end[1] + 1 - suffix)))
+		--suffix;
+	diff.end[0] -= suffix;
+	diff.end[1] -= suffix;
+}
+
+/**
+ * @brief Is the work budget of the line used up?
+ */
+bool
+stringdiffs::IsOutOfWork() const
+{
+	return *m_pWork > DiffWorkBudget;
+}
+
+/**
+ * @brief Has the edit path search taken too much memory or work?
+ */
+bool
+stringdiffs::IsOverBudget() const
+{
+	return m_workspace.nodes.size() > m_maxNodes || IsOutOfWork();
+}
+
+#ifdef STRINGDIFFS_SSE2
+/**
+ * @brief Return number of bytes equal at the beginning of two arrays,
+ * rounded down to a multiple of 16 bytes.
+ */
+static size_t
+EqualBlocksForward(const char *p1, const char *p2, size_t size)
+{
+	size_t i = 0;
+	for (; i + sizeof(__m128i) <= size; i += sizeof(__m128i))
+	{
+		__m128i a = _mm_loadu_si128(reinterpret_cast<const __m128i *>(p1 + i));
+		__m128i b = _mm_loadu_si128(reinterpret_cast<const __m128i *>(p2 + i));
+		if (_mm_movemask_epi8(_mm_cmpeq_epi8(a, b)) != 0xffff)
+			break;
+	}
+	return i;
+}
+#endif
+
+#ifdef STRINGDIFFS_SSE2
+/**
+ * @brief Return number of bytes equal at the end of two arrays,
+ * rounded down to a multiple of 16 bytes.
+ * @param [in] p1, p2 Ends of the arrays.
+ */
+static size_t
+EqualBlocksBackward(const char *p1, const char *p2, size_t size)
+{
+	size_t i = 0;
+	for (; i + sizeof(__m128i) <= size; i += sizeof(__m128i))
+	{
+		__m128i a = _mm_loadu_si128(reinterpret_cast<const __m128i *>(p1 - i - sizeof(__m128i)));
+		__m128i b = _mm_loadu_si128(reinterpret_cast<const __m128i *>(p2 - i - sizeof(__m128i)));
+		if (_mm_movemask_epi8(_mm_cmpeq_epi8(a, b)) != 0xffff)
+			break;
+	}
+	return i;
+}
+#endif
+
+/**
+ * @brief Return length of common end of two strings.
+ * @param [in] p1, p2 Ends of the strings.
+ * @param [in] len Length of the shorter string.
+ */
+static int
+CommonSuffixLength(const TCHAR *p1, const TCHAR *p2, int len)
+{
+	int i = 0;
+#ifdef STRINGDIFFS_SSE2
+	i = static_cast<int>(EqualBlocksBackward(reinterpret_cast<const char *>(p1),
+		reinterpret_cast<const char *>(p2), len * sizeof(TCHAR)) / sizeof(TCHAR));
+#endif
+	while (i < len && p1[-1 - i] == p2[-1 - i])
+		++i;
+	return i;
+}
+
+/**
+ * @brief Return length of common beginning of two strings.
+ */
+static int
+CommonPrefixLength(const TCHAR *p1, const TCHAR *p2, int len)
+{
+	int i = 0;
+#ifdef STRINGDIFFS_SSE2
+	// Compare 16 bytes at once, last different block is compared per character
+	i = static_cast<int>(EqualBlocksForward(reinterpret_cast<const char *>(p1),
+		reinterpret_cast<const char *>(p2), len * sizeof(TCHAR)) / sizeof(TCHAR));
+#endif
+	while (i < len && p1[i] == p2[i])
+		++i;
+	return i;
+}
+
+/**
+ * @brief Return length of common beginning of the strings, ending at a word boundary.
+ */
+int
+stringdiffs::FindCommonPrefix() const
+{
+	const int len = static_cast<int>((std::min)(m_str1.length(), m_str2.length()));
+	int prefix = CommonPrefixLength(m_str1.c_str(), m_str2.c_str(), len);
+	while (prefix > 0 && !(IsWordBoundary(m_str1, prefix) && IsWordBoundary(m_str2, prefix)))
+		--prefix;
+	return prefix;
+}
+
+/**
+ * @brief Does a word end before the index of the string, and another start at it?
+ */
+bool
+stringdiffs::IsWordBoundary(const String & str, int index) const
+{
+	if (index == 0 || index == static_cast<int>(str.length()))
+		return true;
+	const bool space0 = isSafeWhitespace(str[index - 1]);
+	const bool space1 = isSafeWhitespace(str[index]);
+	if (space0 != space1)
+		return true;
+	// Each word break character is a word of its own
+	return (!space0 && isWordBreak(m_breakType, m_breakChars, str.c_str(), index - 1)) ||
+		(!space1 && isWordBreak(m_breakType, m_breakChars, str.c_str(), index));
 }
 
 /**
  * @brief Break line into constituent words
+ * @param [in] str Line to break.
+ * @param [in] begin Index to start at, at a word boundary.
+ * @param [out] words Words from the index, after a dummy empty word.
  */
 void
-stringdiffs::BuildWordsArray(const String & str, std::vector<word>& words)
+stringdiffs::BuildWordsArray(const String & str, int begin, std::vector<word>& words)
 {
-	int i=0, begin=0;
+	int i=begin;
+	const int end = static_cast<int>(str.length());
 
 	// dummy;
-	words.push_back(word(0, -1, 0, 0));
+	words.push_back(word(begin, begin - 1, 0, 0));
 
 	// state when we are looking for next word
 inspace:
-	if (isSafeWhitespace(str[i])) 
+	if (i < end && isSafeWhitespace(str[i]))
 	{
 		++i;
 		goto inspace;
@@ -381,7 +755,7 @@ inspace:
 
 		words.push_back(word(begin, e, dlspace, Hash(str, begin, e, 0)));
 	}
-	if (i == str.length())
+	if (i == end)
 		return;
 	begin = i;
 	goto inword;
@@ -389,7 +763,7 @@ inspace:
 	// state when we are inside a word
 inword:
 	bool atspace=false;
-	if (i == str.length() || ((atspace = isSafeWhitespace(str[i])) != 0) || isWordBreak(m_breakType, str.c_str(), i))
+	if (i == end || ((atspace = isSafeWhitespace(str[i])) != 0) || isWordBreak(m_breakType, m_breakChars, str.c_str(), i))
 	{
 		if (begin<i)
 		{
@@ -399,7 +773,7 @@ inword:
 			
 			words.push_back(word(begin, e, dlword, Hash(str, begin, e, 0)));
 		}
-		if (i == str.length())
+		if (i == end)
 		{
 			return;
 		}
@@ -491,6 +865,8 @@ stringdiffs::Hash(const String & str, int begin, int end, unsigned h) const
 bool
 stringdiffs::AreWordsSame(const word & word1, const word & word2) const
 {
+	if (IsChunk(word1))
+		return AreChunksSame(word1, word2);
 	if (this->m_whitespace != WHITESPACE_COMPARE_ALL)
 	{
 		if (IsSpace(word1) && IsSpace(word2))
@@ -520,8 +896,148 @@ stringdiffs::caseMatch(TCHAR ch1, TCHAR ch2) const
 		return _totupper(ch1)==_totupper(ch2);
 }
 
+/**
+ * @brief Get character as compared with the whitespace and case options.
+ * @param [in,out] ch Character, changed to the character compared.
+ * @param [in,out] inSpace Is the character after whitespace, set for next character.
+ * @return false if the character is ignored.
+ */
+bool
+stringdiffs::NormalizeChar(TCHAR & ch, bool & inSpace) const
+{
+	// Printable ASCII characters are never whitespace
+	if ((ch <= _T(' ') || ch >= 0x7f) && isSafeWhitespace(ch))
+	{
+		const bool ignore = m_whitespace == WHITESPACE_IGNORE_ALL ||
+			(m_whitespace == WHITESPACE_IGNORE_CHANGE && inSpace);
+		inSpace = true;
+		if (m_whitespace == WHITESPACE_IGNORE_CHANGE)
+			ch = _T(' ');
+		return !ignore;
+	}
+	inSpace = false;
+	if (!m_case_sensitive)
+		ch = static_cast<TCHAR>(_totupper(ch));
+	return true;
+}
+
+/**
+ * @brief Cut long line into chunks at boundaries found from its contents
+ * @param [in] str Line to cut.
+ * @param [in] begin Index to start at, at a word boundary.
+ * @param [in] end Index to end before, at a word boundary.
+ * @param [in] chunkSize Average number of non-whitespace characters in a chunk.
+ * @param [out] chunks Chunks from the index, after a dummy empty chunk.
+ *
+ * A chunk ends where a rolling hash of the last 32 non-whitespace characters
+ * has its top bits zero, or at a word boundary soon after. So chunk
+ * boundaries do not depend on text before them, and equal parts of two
+ * lines are cut the same way even if they are at different positions.
+ */
+void
+stringdiffs::BuildChunksArray(const String & str, int begin, int end, int chunkSize, std::vector<word>& chunks) const
+{
+	int bits = 0;
+	while ((1 << bits) < chunkSize)
+		++bits;
+	const int minCount = chunkSize / 4;
+	const int maxCount = chunkSize * 8;
+	// Characters are compared as they are, with no options to apply
+	const bool exact = m_whitespace == WHITESPACE_COMPARE_ALL && m_case_sensitive;
+
+	// dummy;
+	chunks.push_back(word(begin, begin - 1, 0, 0));
+
+	const TCHAR *const p = str.c_str();
+	unsigned gear = 0; // rolling hash, a character drops out of it after 32 others
+	unsigned h = 0; // hash of the chunk
+	bool inSpace = false;
+	// Adds character to the hashes, returns false for whitespace
+	auto addChar = [&](TCHAR ch) -> bool
+	{
+		if (exact)
+		{
+			// Printable ASCII characters are never whitespace
+			if ((ch <= _T(' ') || ch >= 0x7f) && isSafeWhitespace(ch))
+				return false;
+		}
+		else
+		{
+			if (!NormalizeChar(ch, inSpace))
+				return false;
+			h += HASH(h, static_cast<unsigned>(ch));
+			if (inSpace)
+				return false;
+		}
+		// Multiplying spreads bits of the character to the top bits
+		gear = (gear << 1) + static_cast<unsigned>(ch) * 0x9e3779b1u;
+		return true;
+	};
+
+	for (int i = begin; i < end; )
+	{
+		const int start = i;
+		int count = 0; // non-whitespace characters in the chunk
+		while (i < end && (count < minCount || (gear >> (32 - bits)) != 0) && count < maxCount)
+		{
+			if (addChar(p[i++]))
+				++count;
+		}
+		const int cut = (std::min)(i + SnapLength, end);
+		while (i < cut && !IsWordBoundary(str, i))
+			addChar(p[i++]);
+
+		// Rolling hash covers only characters of the chunk by now, so it
+		// is the hash of the chunk when characters are compared as they are
+		if (exact)
+			h = gear + (i - start);
+		chunks.push_back(word(start, i - 1, dlchunk, static_cast<int>(h)));
+		h = 0;
+		inSpace = false;
+	}
+}
+
+/**
+ * @brief Compare two chunks, with the whitespace and case options
+ */
+bool
+stringdiffs::AreChunksSame(const word & chunk1, const word & chunk2) const
+{
+	if (chunk1.hash != chunk2.hash)
+		return false;
+	if (m_whitespace == WHITESPACE_COMPARE_ALL && m_case_sensitive)
+	{
+		return chunk1.length() == chunk2.length() &&
+			memcmp(&m_str1[chunk1.start], &m_str2[chunk2.start], chunk1.length() * sizeof(TCHAR)) == 0;
+	}
+	int i = chunk1.start, j = chunk2.start;
+	bool inSpace1 = false, inSpace2 = false;
+	for (;;)
+	{
+		TCHAR ch1 = 0, ch2 = 0;
+		bool more1 = false, more2 = false;
+		while (!more1 && i <= chunk1.end)
+		{
+			ch1 = m_str1[i++];
+			more1 = NormalizeChar(ch1, inSpace1);
+		}
+		while (!more2 && j <= chunk2.end)
+		{
+			ch2 = m_str2[j++];
+			more2 = NormalizeChar(ch2, inSpace2);
+		}
+		if (more1 != more2)
+			return false;
+		if (!more1)
+			return true;
+		if (ch1 != ch2)
+			return false;
+	}
+}
+
 /**
  * @ brief An O(NP) Sequence Comparison Algorithm. Sun Wu, Udi Manber, Gene Myers
+ * @return Number of edits, -1 if the search took too much memory or work.
  */
 int
 stringdiffs::onp(std::vector<char> &edscript)
@@ -535,42 +1051,43 @@ stringdiffs::onp(std::vector<char> &edscript)
 		N = m_words1.size() - 1;
 		exchanged = true;
 	}
-	int *fp = (new int[(M+1) + 1 + (N+1)]) + (M+1);
-	std::vector<char> *es = (new std::vector<char>[(M+1) + 1 + (N+1)]) + (M+1);
+	// Furthest points and last steps of paths, per diagonal
+	m_workspace.fp.assign((M+1) + 1 + (N+1), -1);
+	m_workspace.path.assign((M+1) + 1 + (N+1), -1);
+	m_workspace.nodes.clear();
+	int *fp = &m_workspace.fp[0] + (M+1);
+	int *path = &m_workspace.path[0] + (M+1);
 	int DELTA = N - M;
 	
 	int k;
-	for (k = -(M+1); k <= (N+1); k++)
-		fp[k] = -1; 
 	int p = -1;
 	do
 	{
 		p = p + 1;
 		for (k = -p; k <= DELTA-1; k++)
-		{
-			fp[k] = snake(k, std::max(fp[k-1] + 1, fp[k+1]), exchanged);
-	
-			es[k] = fp[k-1] + 1 > fp[k+1] ? es[k-1] : es[k+1];
-			es[k].push_back(fp[k-1] + 1 > fp[k+1] ? '+' : '-');
-			es[k].resize(es[k].size() + fp[k] - std::max(fp[k-1] + 1, fp[k+1]), '=');
-		}
+			fp[k] = onpstep(fp, path, k, exchanged);
 		for (k = DELTA + p; k >= DELTA+1; k--)
-		{
-			fp[k] = snake(k, std::max(fp[k-1] + 1, fp[k+1]), exchanged);
-	
-			es[k] = fp[k-1] + 1 > fp[k+1] ? es[k-1] : es[k+1];
-			es[k].push_back(fp[k-1] + 1 > fp[k+1] ? '+' : '-');
-			es[k].resize(es[k].size() + fp[k] - std::max(fp[k-1] + 1, fp[k+1]), '=');
-		}
+			fp[k] = onpstep(fp, path, k, exchanged);
 		k = DELTA;
-		fp[k] = snake(k, std::max(fp[k-1] + 1, fp[k+1]), exchanged);
-	
-		es[k] = fp[k-1] + 1 > fp[k+1] ? es[k-1] : es[k+1];
-		es[k].push_back(fp[k-1] + 1 > fp[k+1] ? '+' : '-');
-		es[k].resize(es[k].size() + fp[k] - std::max(fp[k-1] + 1, fp[k+1]), '=');
+		fp[k] = onpstep(fp, path, k, exchanged);
+		if (fp[k] != N && IsOverBudget())
+			return -1;
 	} while (fp[k] != N);
 
-	std::vector<char> &ses = es[DELTA]; // Shortest edit script
+	// Shortest edit script, from steps of the path reaching the end
+	std::vector<char> &ses = m_workspace.ses;
+	ses.clear();
+	int last = path[DELTA];
+	for (int node = last; node != -1; node = m_workspace.nodes[node].prev)
+		ses.resize(ses.size() + 1 + m_workspace.nodes[node].equal);
+	size_t pos = ses.size();
+	for (int node = last; node != -1; node = m_workspace.nodes[node].prev)
+	{
+		const pathnode & step = m_workspace.nodes[node];
+		pos -= 1 + step.equal;
+		ses[pos] = step.op;
+		std::fill(ses.begin() + pos + 1, ses.begin() + pos + 1 + step.equal, '=');
+	}
 	edscript.clear();
 
 	int D = 0;
@@ -608,13 +1125,31 @@ stringdiffs::onp(std::vector<char> &edscript)
 			edscript.push_back('=');
 		}
 	}
-		
-	delete [] (es - (M+1));
-	delete [] (fp - (M+1));
 
 	return D;
 }
 
+/**
+ * @brief Extend furthest path on a diagonal by one step and following equal words.
+ * @return Furthest point reached on the diagonal.
+ */
+int
+stringdiffs::onpstep(int *fp, int *path, int k, bool exchanged)
+{
+	const bool down = fp[k-1] + 1 > fp[k+1];
+	const int y = down ? fp[k-1] + 1 : fp[k+1];
+	const int yend = snake(k, y, exchanged);
+
+	pathnode node;
+	node.prev = down ? path[k-1] : path[k+1];
+	node.equal = yend - y;
+	node.op = down ? '+' : '-';
+	*m_pWork += 1 + node.equal;
+	path[k] = static_cast<int>(m_workspace.nodes.size());
+	m_workspace.nodes.push_back(node);
+	return yend;
+}
+
 int
 stringdiffs::snake(int k, int y, bool exchanged)
 {
@@ -666,7 +1201,7 @@ isSafeWhitespace(TCHAR ch)
  * @brief Is it a non-whitespace wordbreak character (ie, punctuation)?
  */
 static bool
-isWordBreak(int breakType, const TCHAR *str, int index)
+isWordBreak(int breakType, const String & breakChars, const TCHAR *str, int index)
 {
 	TCHAR ch = str[index];
 	// breakType==1 means break also on punctuation
@@ -677,7 +1212,7 @@ isWordBreak(int breakType, const TCHAR *str, int index)
 		// breakType==0 means whitespace only
 		if (!breakType)
 			return false;
-		return _tcschr(BreakChars, ch) != 0;
+		return _tcschr(breakChars.c_str(), ch) != 0;
 	}
 	else 
 	{
@@ -702,7 +1237,7 @@ isWordBreak(int breakType, const TCHAR *str, int index)
 	// breakType==0 means whitespace only
 	if (!breakType)
 		return false;
-	return _tcschr(BreakChars, ch) != 0;
+	return _tcschr(breakChars.c_str(), ch) != 0;
 #endif
 }
 
@@ -717,6 +1252,9 @@ LastChar(LPCTSTR psz, int len)
 {
 	if (!len) return psz;
 
+#ifdef _UNICODE
+	return psz+len-1;
+#else
 	if (!_getmbcp()) return psz+len-1;
 
 	LPCTSTR lastValid = psz+len-1;
@@ -733,6 +1271,7 @@ LastChar(LPCTSTR psz, int len)
 		return psz;
 	else // last character was multibyte or broken multibyte
 		return prev;
+#endif
 }
 
 /**
@@ -760,7 +1299,22 @@ AdvanceOverWhitespace(LPCTSTR * pcurrent, LPCTSTR end)
  * Assumes whitespace is never leadbyte or trailbyte!
  */
 void
-sd_ComputeByteDiff(String & str1, String & str2, 
+sd_ComputeByteDiff(const String & str1, const String & str2, 
+		   bool casitive, int xwhite, 
+		   int begin[2], int end[2], bool equal)
+{
+	ComputeByteDiff(str1.c_str(), static_cast<int>(str1.length()),
+		str2.c_str(), static_cast<int>(str2.length()), casitive, xwhite, begin, end, equal);
+}
+
+/**
+ * @brief Compute byte difference between parts of strings
+ * @param [in] pbeg1, pbeg2 Beginnings of the parts.
+ * @param [in] len1, len2 Lengths of the parts.
+ * See sd_ComputeByteDiff() for the other parameters.
+ */
+static void
+ComputeByteDiff(LPCTSTR pbeg1, int len1, LPCTSTR pbeg2, int len2,
 		   bool casitive, int xwhite, 
 		   int begin[2], int end[2], bool equal)
 {
@@ -768,12 +1322,6 @@ sd_ComputeByteDiff(String & str1, String & str2,
 	// Also this way can distinguish if we set begin[0] to -1 for no diff in line
 	begin[0] = end[0] = begin[1] = end[1] = 0;
 
-	int len1 = str1.length();
-	int len2 = str2.length();
-
-	LPCTSTR pbeg1 = str1.c_str();
-	LPCTSTR pbeg2 = str2.c_str();
-
 	if (len1 == 0 || len2 == 0)
 	{
 		if (len1 == len2)
@@ -1007,10 +1555,10 @@ void stringdiffs::wordLevelToByteLevel()
 	{
 		int begin[3], end[3];
 		wdiff& diff = m_wdiffs[i];
-		String str1_2, str2_2;
-		str1_2 = m_str1.substr(diff.begin[0], diff.end[0] - diff.begin[0] + 1);
-		str2_2 = m_str2.substr(diff.begin[1], diff.end[1] - diff.begin[1] + 1);
-		sd_ComputeByteDiff(str1_2, str2_2, m_case_sensitive, m_whitespace, begin, end, false);
+		// Diffed in place, as diffs of long lines can be long too
+		ComputeByteDiff(m_str1.c_str() + diff.begin[0], diff.end[0] - diff.begin[0] + 1,
+			m_str2.c_str() + diff.begin[1], diff.end[1] - diff.begin[1] + 1,
+			m_case_sensitive, m_whitespace, begin, end, false);
 		if (begin[0] == -1)
 		{
 			// no visible diff on side1
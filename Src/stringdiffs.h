@@ -42,6 +42,7 @@ void sd_Init();
 void sd_Close();
 
 void sd_SetBreakChars(const TCHAR *breakChars);
+String sd_GetBreakChars();
 
 void sd_ComputeWordDiffs(const String& str1, const String& str2,
 	bool case_sensitive, int whitespace, int breakType, bool byte_level,
@@ -49,6 +50,9 @@ void sd_ComputeWordDiffs(const String& str1, const String& str2,
 void sd_ComputeWordDiffs(int nStrings, const String str[3], 
                    bool case_sensitive, int whitespace, int breakType, bool byte_level,
 				   std::vector<wdiff> * pDiffs);
+void sd_ComputeWordDiffs(int nStrings, const String str[3],
+	bool case_sensitive, int whitespace, int breakType, const String& breakChars, bool byte_level,
+	std::vector<wdiff> * pDiffs);
 
 void sd_ComputeByteDiff(const String& str1, const String& str2,
 			bool casitive, int xwhite, 
@@ -21,6 +21,7 @@ enum
 	dlspace,
 	dlbreak, 
 	dlinsert,
+	dlchunk,
 };
 /**
  * @brief kind of synchronaction
@@ -41,9 +42,11 @@ struct wdiff;
 class stringdiffs
 {
 public:
+	struct Workspace;
+
 	stringdiffs(const String & str1, const String & str2,
-		bool case_sensitive, int whitespace, int breakType,
-		std::vector<wdiff> * pDiffs);
+		bool case_sensitive, int whitespace, int breakType, const String & breakChars,
+		std::vector<wdiff> * pDiffs, Workspace & workspace);
 
 	~stringdiffs();
 
@@ -61,11 +64,46 @@ private:
 		word(int s = 0, int e = 0, int b = 0, int h = 0) : start(s), end(e), bBreak(b),hash(h) { }
 		int length() const { return end+1-start; }
 	};
+	/**
+	 * @brief Step of an edit path, followed by a run of equal words.
+	 */
+	struct pathnode {
+		int prev; // index of previous step, -1 for none
+		int equal; // number of equal words after the step
+		char op; // '+' or '-'
+	};
+
+public:
+	/**
+	 * @brief Buffers of a diff, kept for the next diff in the same thread
+	 * so diffing a line does not allocate memory once buffers have grown.
+	 */
+	struct Workspace {
+		std::vector<word> words1;
+		std::vector<word> words2;
+		std::vector<wdiff> wdiffs;
+		std::vector<int> fp;
+		std::vector<int> path;
+		std::vector<pathnode> nodes;
+		std::vector<char> ses;
+		std::vector<char> edscript;
+	};
 
 // Implementation methods
 private:
 
-	void BuildWordsArray(const String & str, std::vector<word>& words);
+	int FindCommonPrefix() const;
+	bool IsWordBoundary(const String & str, int index) const;
+	void BuildWordsArray(const String & str, int begin, std::vector<word>& words);
+	void BuildChunkDiffList(int prefix);
+	void BuildChunksArray(const String & str, int begin, int end, int chunkSize, std::vector<word>& chunks) const;
+	void RefineChunkDiffs();
+	void AddWholeDiff(int prefix);
+	void TrimDiff(wdiff & diff) const;
+	bool NormalizeChar(TCHAR & ch, bool & inSpace) const;
+	bool AreChunksSame(const word & chunk1, const word & chunk2) const;
+	bool IsOutOfWork() const;
+	bool IsOverBudget() const;
 	unsigned Hash(const String & str, int begin, int end, unsigned h ) const;
 	bool AreWordsSame(const word & word1, const word & word2) const;
 	bool IsWord(const word & word1) const;
@@ -90,10 +128,18 @@ private:
 	{
 		return (word1.bBreak == dlinsert);
 	}
+	/**
+	 * @brief Is this block a chunk of a long line?
+	 */
+	inline bool IsChunk(const word & word1) const
+	{
+		return (word1.bBreak == dlchunk);
+	}
 	bool caseMatch(TCHAR ch1, TCHAR ch2) const;
 	bool BuildWordDiffList_DP();
 	int dp(std::vector<char> & edscript);
 	int onp(std::vector<char> & edscript);
+	int onpstep(int *fp, int *path, int k, bool exchanged);
 	int snake(int k, int y, bool exchanged);
 #ifdef STRINGDIFF_LOGGING
 	void debugoutput();
@@ -106,9 +152,15 @@ private:
 	bool m_case_sensitive;
 	int m_whitespace;
 	int m_breakType;
+	const String & m_breakChars; /**< Punctuation words break at. */
 	bool m_matchblock;
+	bool m_refining; /**< Diffing a region of a long line? */
+	size_t m_maxNodes; /**< Most steps of the edit path search. */
+	size_t m_work; /**< Steps and compared words of searches of the line so far. */
+	size_t *m_pWork; /**< Work of the line, shared with diffs of its regions. */
 	std::vector<wdiff> * m_pDiffs;
-	std::vector<word> m_words1;
-	std::vector<word> m_words2;
-	std::vector<wdiff> m_wdiffs;
+	Workspace & m_workspace;
+	std::vector<word> & m_words1;
+	std::vector<word> & m_words2;
+	std::vector<wdiff> & m_wdiffs;
 };
@@ -3,6 +3,10 @@
 #include "PathContext.h"
 #include "CompareEngines/BinaryCompare.h"
 #include <fstream>
+#include <vector>
+#include <chrono>
+#include <cstdlib>
+#include <cstdio>
 
 namespace
 {
@@ -199,4 +203,235 @@ namespace
 		EXPECT_EQ(DIFFCODE::CMPERR, bc.CompareFiles(files, di));
 	}
 
+	TEST_F(BinaryCompareTest, DiffAtBufferBoundaries)
+	{
+		// Files span several read buffers so that the difference is
+		// not within the first buffer
+		const size_t size = 1024 * 1024 + 123;
+		std::vector<char> data(size);
+		for (size_t i = 0; i < size; ++i)
+			data[i] = static_cast<char>(rand());
+
+		for (int mapping = 0; mapping < 2; ++mapping)
+		{
+			CompareEngines::BinaryCompare bc;
+			bc.SetUseMapping(mapping != 0);
+			bc.SetMapMinSize(0);
+			DIFFITEM di;
+			di.diffFileInfo[0].size = size;
+			di.diffFileInfo[1].size = size;
+			di.diffFileInfo[2].size = size;
+
+			const size_t positions[] = { 0, 15, 16, 63, 64, 256 * 1024 - 1, 256 * 1024, size - 1 };
+			for (size_t pos : positions)
+			{
+				std::vector<char> changed(data);
+				changed[pos] ^= 1;
+
+				TempFile l1("A", &data[0], size);
+				TempFile r1("B", &changed[0], size);
+				PathContext files;
+				files.SetLeft(_T("A"));
+				files.SetRight(_T("B"));
+				EXPECT_EQ(DIFFCODE::DIFF, bc.CompareFiles(files, di));
+
+				// Difference only in the right file of 3 files
+				TempFile m1("C", &data[0], size);
+				PathContext files3;
+				files3.SetLeft(_T("A"));
+				files3.SetMiddle(_T("C"));
+				files3.SetRight(_T("B"));
+				EXPECT_EQ(DIFFCODE::DIFF, bc.CompareFiles(files3, di));
+
+				files3.SetLeft(_T("A"));
+				files3.SetMiddle(_T("C"));
+				files3.SetRight(_T("A"));
+				EXPECT_EQ(DIFFCODE::SAME, bc.CompareFiles(files3, di));
+			}
+		}
+	}
+
+	TEST_F(BinaryCompareTest, FirstDiffOffset)
+	{
+		// Differences around the boundaries of read buffers (256 KB) and of
+		// mapped views, which are made small so that files span several views
+		const size_t windowSize = 64 * 1024;
+		const size_t size = 1024 * 1024 + 123;
+		std::vector<char> data(size);
+		for (size_t i = 0; i < size; ++i)
+			data[i] = static_cast<char>(rand());
+
+		for (int mapping = 0; mapping < 2; ++mapping)
+		{
+			CompareEngines::BinaryCompare bc;
+			bc.SetUseMapping(mapping != 0);
+			bc.SetMapMinSize(0);
+			bc.SetMapWindowSize(windowSize);
+			DIFFITEM di;
+			di.diffFileInfo[0].size = size;
+			di.diffFileInfo[1].size = size;
+			di.diffFileInfo[2].size = size;
+
+			const size_t positions[] = {
+				0, windowSize - 1, windowSize, 3 * windowSize + 1,
+				256 * 1024 - 1, 256 * 1024, 256 * 1024 + 1, 512 * 1024, size - 1 };
+			for (size_t pos : positions)
+			{
+				std::vector<char> changed(data);
+				changed[pos] ^= 1;
+				// Differences after the first one must not move the offset
+				if (pos + windowSize < size)
+					changed[pos + windowSize] ^= 1;
+
+				TempFile l1("A", &data[0], size);
+				TempFile r1("B", &changed[0], size);
+				TempFile m1("C", &data[0], size);
+				int64_t offset = -2;
+				PathContext files;
+				files.SetLeft(_T("A"));
+				files.SetRight(_T("B"));
+				EXPECT_EQ(DIFFCODE::DIFF, bc.CompareFiles(files, di, &offset));
+				EXPECT_EQ(static_cast<int64_t>(pos), offset);
+
+				offset = -2;
+				PathContext files3;
+				files3.SetLeft(_T("A"));
+				files3.SetMiddle(_T("C"));
+				files3.SetRight(_T("B"));
+				EXPECT_EQ(DIFFCODE::DIFF, bc.CompareFiles(files3, di, &offset));
+				EXPECT_EQ(static_cast<int64_t>(pos), offset);
+
+				offset = -2;
+				files3.SetLeft(_T("A"));
+				files3.SetMiddle(_T("C"));
+				files3.SetRight(_T("A"));
+				EXPECT_EQ(DIFFCODE::SAME, bc.CompareFiles(files3, di, &offset));
+				EXPECT_EQ(-1, offset);
+			}
+
+			// A file truncated after it was scanned differs where it ends
+			const size_t truncated[] = { windowSize, 256 * 1024 };
+			for (size_t len : truncated)
+			{
+				TempFile l1("A", &data[0], size);
+				TempFile r1("B", &data[0], len);
+				PathContext files;
+				files.SetLeft(_T("A"));
+				files.SetRight(_T("B"));
+				int64_t offset = -2;
+				EXPECT_EQ(DIFFCODE::DIFF, bc.CompareFiles(files, di, &offset));
+				EXPECT_EQ(static_cast<int64_t>(len), offset);
+			}
+		}
+
+		// Not known when sizes already differ
+		{
+			CompareEngines::BinaryCompare bc;
+			DIFFITEM di;
+			PathContext files;
+			files.SetLeft(_T("A"));
+			files.SetRight(_T("B"));
+			di.diffFileInfo[0].size = 1;
+			di.diffFileInfo[1].size = 2;
+			int64_t offset = -2;
+			EXPECT_EQ(DIFFCODE::DIFF, bc.CompareFiles(files, di, &offset));
+			EXPECT_EQ(-1, offset);
+		}
+	}
+
+	TEST_F(BinaryCompareTest, NoMapping)
+	{
+		CompareEngines::BinaryCompare bc;
+		bc.SetUseMapping(false);
+		DIFFITEM di;
+		PathContext files;
+
+		{
+			TempFile l1("A", "12", 2);
+			TempFile r1("B", "12", 2);
+			files.SetLeft(_T("A"));
+			files.SetRight(_T("B"));
+			di.diffFileInfo[0].size = 2;
+			di.diffFileInfo[1].size = 2;
+			EXPECT_EQ(DIFFCODE::SAME, bc.CompareFiles(files, di));
+		}
+
+		{
+			TempFile l1("A", "", 0);
+			TempFile r1("B", "", 0);
+			files.SetLeft(_T("A"));
+			files.SetRight(_T("B"));
+			di.diffFileInfo[0].size = 0;
+			di.diffFileInfo[1].size = 0;
+			EXPECT_EQ(DIFFCODE::SAME, bc.CompareFiles(files, di));
+		}
+
+		files.SetLeft(_T("/1>"));
+		files.SetRight(_T("B"));
+		di.diffFileInfo[0].size = 1;
+		di.diffFileInfo[1].size = 1;
+		EXPECT_EQ(DIFFCODE::CMPERR, bc.CompareFiles(files, di));
+	}
+
+	TEST_F(BinaryCompareTest, EmptyFiles)
+	{
+		CompareEngines::BinaryCompare bc;
+		DIFFITEM di;
+		PathContext files;
+
+		TempFile l1("A", "", 0);
+		TempFile m1("B", "", 0);
+		TempFile r1("C", "", 0);
+		files.SetLeft(_T("A"));
+		files.SetMiddle(_T("B"));
+		files.SetRight(_T("C"));
+		di.diffFileInfo[0].size = 0;
+		di.diffFileInfo[1].size = 0;
+		di.diffFileInfo[2].size = 0;
+		EXPECT_EQ(DIFFCODE::SAME, bc.CompareFiles(files, di));
+	}
+
+	// Throughput of mapped compare against plain reads. Disabled by default
+	// as it writes large files, run with --gtest_also_run_disabled_tests.
+	TEST_F(BinaryCompareTest, DISABLED_Throughput)
+	{
+		const size_t size = 256 * 1024 * 1024;
+		{
+			std::vector<char> data(1024 * 1024);
+			for (size_t i = 0; i < data.size(); ++i)
+				data[i] = static_cast<char>(rand());
+			const char *names[] = { "A", "B", "C" };
+			for (const char *name : names)
+			{
+				std::ofstream ostr(name, std::ios::out|std::ios::binary|std::ios::trunc);
+				for (size_t written = 0; written < size; written += data.size())
+					ostr.write(&data[0], data.size());
+			}
+		}
+
+		DIFFITEM di;
+		PathContext files;
+		files.SetLeft(_T("A"));
+		files.SetMiddle(_T("B"));
+		files.SetRight(_T("C"));
+		di.diffFileInfo[0].size = size;
+		di.diffFileInfo[1].size = size;
+		di.diffFileInfo[2].size = size;
+
+		for (int mapping = 0; mapping < 2; ++mapping)
+		{
+			CompareEngines::BinaryCompare bc;
+			bc.SetUseMapping(mapping != 0);
+			bc.SetMapMinSize(0);
+			auto start = std::chrono::steady_clock::now();
+			EXPECT_EQ(DIFFCODE::SAME, bc.CompareFiles(files, di));
+			double secs = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+			printf("%s: %.1f MB/s\n", mapping ? "mapped" : "read", 3.0 * size / (1024 * 1024) / secs);
+		}
+
+		remove("A");
+		remove("B");
+		remove("C");
+	}
+
 }  // namespace
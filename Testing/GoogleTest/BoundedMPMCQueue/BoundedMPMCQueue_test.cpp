@@ -0,0 +1,215 @@
+#include <gtest/gtest.h>
+#include "BoundedMPMCQueue.h"
+#include <thread>
+#include <vector>
+#include <atomic>
+#include <chrono>
+#include <cstdio>
+#include <Poco/Notification.h>
+#include <Poco/NotificationQueue.h>
+#include <Poco/AutoPtr.h>
+
+namespace
+{
+	// The fixture for testing BoundedMPMCQueue.
+	class BoundedMPMCQueueTest : public testing::Test
+	{
+	protected:
+		BoundedMPMCQueueTest()
+		{
+		}
+
+		virtual ~BoundedMPMCQueueTest()
+		{
+		}
+
+		virtual void SetUp()
+		{
+		}
+
+		virtual void TearDown()
+		{
+		}
+	};
+
+	TEST_F(BoundedMPMCQueueTest, SingleThread)
+	{
+		BoundedMPMCQueue<int> queue(8);
+		int value = -1;
+		EXPECT_EQ(8u, queue.capacity());
+		EXPECT_FALSE(queue.tryPop(value));
+
+		for (int i = 0; i < 8; ++i)
+			EXPECT_TRUE(queue.tryPush(i));
+		EXPECT_FALSE(queue.tryPush(8));
+
+		for (int i = 0; i < 8; ++i)
+		{
+			EXPECT_TRUE(queue.tryPop(value));
+			EXPECT_EQ(i, value);
+		}
+		EXPECT_FALSE(queue.tryPop(value));
+
+		// Wrap around the ring several times
+		for (int i = 0; i < 100; ++i)
+		{
+			EXPECT_TRUE(queue.tryPush(i));
+			EXPECT_TRUE(queue.tryPush(i + 1000));
+			EXPECT_TRUE(queue.tryPop(value));
+			EXPECT_EQ(i, value);
+			EXPECT_TRUE(queue.tryPop(value));
+			EXPECT_EQ(i + 1000, value);
+		}
+	}
+
+	TEST_F(BoundedMPMCQueueTest, MultiThread)
+	{
+		const int nproducers = 4;
+		const int nconsumers = 4;
+		const int nitems = 100000;
+		BoundedMPMCQueue<int> queue(64);
+		std::atomic<long long> sum(0);
+		std::atomic<int> popped(0);
+		std::vector<std::thread> threads;
+
+		for (int i = 0; i < nproducers; ++i)
+		{
+			threads.push_back(std::thread([&]() {
+				for (int j = 1; j <= nitems; ++j)
+				{
+					while (!queue.tryPush(j))
+						std::this_thread::yield();
+				}
+			}));
+		}
+		for (int i = 0; i < nconsumers; ++i)
+		{
+			threads.push_back(std::thread([&]() {
+				int value;
+				while (popped < nproducers * nitems)
+				{
+					if (queue.tryPop(value))
+					{
+						sum += value;
+						++popped;
+					}
+					else
+						std::this_thread::yield();
+				}
+			}));
+		}
+		for (size_t i = 0; i < threads.size(); ++i)
+			threads[i].join();
+
+		EXPECT_EQ(nproducers * nitems, popped.load());
+		EXPECT_EQ(static_cast<long long>(nproducers) * nitems * (nitems + 1) / 2, sum.load());
+	}
+
+	class ItemNotification: public Poco::Notification
+	{
+	public:
+		explicit ItemNotification(int item) : m_item(item) {}
+		int item() const { return m_item; }
+	private:
+		int m_item;
+	};
+
+	struct Batch
+	{
+		enum { MAX_ITEMS = 64 };
+		int items[MAX_ITEMS];
+		unsigned count;
+	};
+
+	// Per-item overhead of passing work to compare threads and results back:
+	// one notification per item and per result through Poco::NotificationQueue
+	// against batches through BoundedMPMCQueue with atomic result counters.
+	// Disabled by default, run with --gtest_also_run_disabled_tests.
+	TEST_F(BoundedMPMCQueueTest, DISABLED_PerItemOverhead)
+	{
+		const int nitems = 1000000;
+		const unsigned nworkers = std::thread::hardware_concurrency();
+
+		{
+			Poco::NotificationQueue queue;
+			Poco::NotificationQueue queueResult;
+			std::vector<std::thread> workers;
+			auto start = std::chrono::steady_clock::now();
+			for (unsigned i = 0; i < nworkers; ++i)
+			{
+				workers.push_back(std::thread([&]() {
+					Poco::AutoPtr<Poco::Notification> pNf(queue.waitDequeueNotification());
+					while (pNf)
+					{
+						ItemNotification *pItemNf = dynamic_cast<ItemNotification *>(pNf.get());
+						queueResult.enqueueNotification(new ItemNotification(pItemNf->item()));
+						pNf = queue.waitDequeueNotification();
+					}
+				}));
+			}
+			for (int i = 0; i < nitems; ++i)
+				queue.enqueueNotification(new ItemNotification(i));
+			long long sum = 0;
+			for (int i = 0; i < nitems; ++i)
+			{
+				Poco::AutoPtr<Poco::Notification> pNf(queueResult.waitDequeueNotification());
+				sum += dynamic_cast<ItemNotification *>(pNf.get())->item();
+			}
+			double secs = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+			queue.wakeUpAll();
+			for (size_t i = 0; i < workers.size(); ++i)
+				workers[i].join();
+			EXPECT_EQ(static_cast<long long>(nitems) * (nitems - 1) / 2, sum);
+			printf("NotificationQueue: %.1f ns/item\n", secs * 1e9 / nitems);
+		}
+
+		{
+			BoundedMPMCQueue<Batch> queue(1024);
+			std::atomic<int> pending(nitems);
+			std::atomic<long long> sum(0);
+			std::atomic<bool> stop(false);
+			std::vector<std::thread> workers;
+			auto start = std::chrono::steady_clock::now();
+			for (unsigned i = 0; i < nworkers; ++i)
+			{
+				workers.push_back(std::thread([&]() {
+					Batch batch;
+					while (!stop)
+					{
+						if (!queue.tryPop(batch))
+						{
+							std::this_thread::yield();
+							continue;
+						}
+						long long batchsum = 0;
+						for (unsigned j = 0; j < batch.count; ++j)
+							batchsum += batch.items[j];
+						sum += batchsum;
+						pending -= batch.count;
+					}
+				}));
+			}
+			Batch batch;
+			batch.count = 0;
+			for (int i = 0; i < nitems; ++i)
+			{
+				batch.items[batch.count++] = i;
+				if (batch.count == Batch::MAX_ITEMS || i == nitems - 1)
+				{
+					while (!queue.tryPush(batch))
+						std::this_thread::yield();
+					batch.count = 0;
+				}
+			}
+			while (pending > 0)
+				std::this_thread::yield();
+			double secs = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+			stop = true;
+			for (size_t i = 0; i < workers.size(); ++i)
+				workers[i].join();
+			EXPECT_EQ(static_cast<long long>(nitems) * (nitems - 1) / 2, sum.load());
+			printf("BoundedMPMCQueue batches: %.1f ns/item\n", secs * 1e9 / nitems);
+		}
+	}
+
+}  // namespace
@@ -1,6 +1,8 @@
 #include <gtest/gtest.h>
 #include "diff.h"
 #include "CompareEngines/ByteCompare.h"
+#include "CompareEngines/ByteComparator.h"
+#include "FileTextStats.h"
 #include "CompareOptions.h"
 #include "FileLocation.h"
 #include "DiffItem.h"
@@ -8,6 +10,11 @@
 #include <sys/stat.h>
 #include <fcntl.h>
 #include <fstream>
+#include <string>
+#include <vector>
+#include <cstdlib>
+#include <cctype>
+#include <algorithm>
 
 namespace
 {
@@ -538,4 +545,135 @@ namespace
 
 	}
 
+	/**
+	 * @brief Compare buffers in chunks like ByteCompare does.
+	 * Returns final result, records result and positions of every call to @p trace.
+	 */
+	int CompareInChunks(CompareEngines::ByteComparator& comparator, const std::string& data0,
+		const std::string& data1, size_t chunk, FileTextStats stats[2], std::vector<int64_t>& trace)
+	{
+		const char *base[2] = { data0.c_str(), data1.c_str() };
+		const size_t size[2] = { data0.size(), data1.size() };
+		size_t start[2] = { 0, 0 };
+		size_t end[2] = { (std::min)(chunk, size[0]), (std::min)(chunk, size[1]) };
+		for (;;)
+		{
+			const char *ptr0 = base[0] + start[0];
+			const char *ptr1 = base[1] + start[1];
+			int result = comparator.CompareBuffers(stats[0], stats[1], ptr0, ptr1,
+				base[0] + end[0], base[1] + end[1], end[0] == size[0], end[1] == size[1], 0, 0);
+			trace.push_back(result);
+			trace.push_back(ptr0 - base[0]);
+			trace.push_back(ptr1 - base[1]);
+			if (result == CompareEngines::ByteComparator::RESULT_DIFF ||
+				result == CompareEngines::ByteComparator::RESULT_SAME)
+				return result;
+			start[0] = ptr0 - base[0];
+			start[1] = ptr1 - base[1];
+			if (result != CompareEngines::ByteComparator::NEED_MORE_1)
+				end[0] = (std::min)(end[0] + chunk, size[0]);
+			if (result != CompareEngines::ByteComparator::NEED_MORE_0)
+				end[1] = (std::min)(end[1] + chunk, size[1]);
+		}
+	}
+
+	std::string RandomText(size_t len)
+	{
+		static const char chars[] = "aAbBxyz0;(){}  \t\t\r\n\n";
+		std::string text(len, ' ');
+		for (size_t i = 0; i < len; ++i)
+			text[i] = chars[rand() % (sizeof(chars) - 1)];
+		return text;
+	}
+
+	/** @brief Make small changes: whitespace, EOL, case and other bytes. */
+	std::string MutateText(std::string text)
+	{
+		static const char chars[] = "aA \t\r\n";
+		const int changes = rand() % 6;
+		for (int i = 0; i < changes && !text.empty(); ++i)
+		{
+			const size_t pos = rand() % text.size();
+			switch (rand() % 5)
+			{
+			case 0: text[pos] = chars[rand() % (sizeof(chars) - 1)]; break;
+			case 1: text.insert(pos, 1, chars[rand() % (sizeof(chars) - 1)]); break;
+			case 2: text.erase(pos, 1); break;
+			case 3: text.insert(pos, "\r\n"); break;
+			case 4: text[pos] = static_cast<char>(toupper(text[pos])); break;
+			}
+		}
+		return text;
+	}
+
+	/**
+	 * Skipping identical bytes in bulk must give same result, same buffer
+	 * positions and same text statistics as comparing byte by byte.
+	 */
+	TEST_F(ByteCompareTest, VectorizedEquivalence)
+	{
+		srand(1);
+		for (int i = 0; i < 20000; ++i)
+		{
+			QuickCompareOptions option;
+			option.m_bIgnoreCase = (rand() % 2) != 0;
+			option.m_bIgnoreEOLDifference = (rand() % 2) != 0;
+			option.m_bIgnoreBlankLines = (rand() % 2) != 0;
+			option.m_ignoreWhitespace = static_cast<WhitespaceIgnoreChoices>(rand() % 3);
+
+			const std::string data0 = RandomText(rand() % 1000);
+			const std::string data1 = MutateText(data0);
+			const size_t chunk = 1 + rand() % 200;
+
+			CompareEngines::ByteComparator vectorized(&option);
+			CompareEngines::ByteComparator scalar(&option);
+			scalar.SetVectorize(false);
+			FileTextStats stats_vectorized[2], stats_scalar[2];
+			std::vector<int64_t> trace_vectorized, trace_scalar;
+			const int result_vectorized = CompareInChunks(vectorized, data0, data1, chunk, stats_vectorized, trace_vectorized);
+			const int result_scalar = CompareInChunks(scalar, data0, data1, chunk, stats_scalar, trace_scalar);
+
+			ASSERT_EQ(result_scalar, result_vectorized) << "iteration " << i;
+			ASSERT_TRUE(trace_scalar == trace_vectorized) << "iteration " << i;
+			for (int j = 0; j < 2; ++j)
+			{
+				ASSERT_EQ(stats_scalar[j].ncrs, stats_vectorized[j].ncrs) << "iteration " << i;
+				ASSERT_EQ(stats_scalar[j].nlfs, stats_vectorized[j].nlfs) << "iteration " << i;
+				ASSERT_EQ(stats_scalar[j].ncrlfs, stats_vectorized[j].ncrlfs) << "iteration " << i;
+				ASSERT_EQ(stats_scalar[j].nzeros, stats_vectorized[j].nzeros) << "iteration " << i;
+			}
+		}
+	}
+
+	TEST_F(ByteCompareTest, VectorizedTextStats)
+	{
+		QuickCompareOptions option;
+		option.m_ignoreWhitespace = WHITESPACE_IGNORE_ALL;
+		option.m_bIgnoreEOLDifference = true;
+		CompareEngines::ByteComparator comparator(&option);
+
+		// Special bytes in different positions within 16 and 64 byte blocks
+		std::string data(1000, 'A');
+		data[0] = '\0';
+		data[15] = '\r';
+		data[16] = '\n';
+		data[63] = '\r';
+		data[64] = '\r';
+		data[100] = '\n';
+		data[998] = '\0';
+		data[999] = '\r';
+
+		FileTextStats stats[2];
+		std::vector<int64_t> trace;
+		EXPECT_EQ(CompareEngines::ByteComparator::RESULT_SAME,
+			CompareInChunks(comparator, data, data, data.size(), stats, trace));
+		for (int i = 0; i < 2; ++i)
+		{
+			EXPECT_EQ(2, stats[i].nzeros);
+			EXPECT_EQ(1, stats[i].ncrlfs);
+			EXPECT_EQ(1, stats[i].nlfs);
+			EXPECT_EQ(3, stats[i].ncrs);
+		}
+	}
+
 }  // namespace
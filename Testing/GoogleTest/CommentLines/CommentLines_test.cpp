@@ -0,0 +1,242 @@
+#include <gtest/gtest.h>
+#include <io.h>
+#include <sys/stat.h>
+#include <fcntl.h>
+#include <fstream>
+#include <string>
+#include <vector>
+#include <cstdio>
+#include <cstring>
+#include "diff.h"
+#include "CompareOptions.h"
+#include "FilterCommentsManager.h"
+#include "CommentLines.h"
+
+namespace
+{
+	struct TempFile
+	{
+		TempFile(const std::string& filename, const std::string& text) : m_filename(filename)
+		{
+			std::ofstream ostr(filename.c_str(), std::ios::out|std::ios::binary|std::ios::trunc);
+			ostr << text;
+		}
+		~TempFile()
+		{
+			remove(m_filename.c_str());
+		}
+		std::string m_filename;
+	};
+
+	/**
+	 * @brief Get LINE_* flags of a line of a file.
+	 */
+	int GetLineClass(const file_data& data, int line)
+	{
+		return (data.line_classes[line >> 2] >> ((line & 3) * 2)) & 3;
+	}
+
+	// The fixture for testing ClassifyCommentLines() and IsCommentChangeOnly().
+	// Texts are diffed with diffutils, and the diffs are filtered like
+	// DiffUtils::diffutils_compare_files() and CDiffWrapper::PostFilter() do.
+	// Expected results are those of the old PostFilter(), which rescanned
+	// the lines of every diff, unless a test says otherwise.
+	class CommentLinesTest : public testing::Test
+	{
+	protected:
+		CommentLinesTest()
+		{
+			m_filtercommentsset.StartMarker = "/*";
+			m_filtercommentsset.EndMarker = "*/";
+			m_filtercommentsset.InlineMarker = "//";
+		}
+
+		virtual ~CommentLinesTest()
+		{
+		}
+
+		virtual void SetUp()
+		{
+		}
+
+		virtual void TearDown()
+		{
+		}
+
+		/**
+		 * @brief Diff two texts and tell which diffs are changes of comments only.
+		 * @param [out] classes If not NULL, LINE_* flags of the lines of the first file.
+		 */
+		std::vector<bool> FindCommentChanges(const std::string& left, const std::string& right,
+			int ignoreWhitespace = WHITESPACE_COMPARE_ALL, std::vector<int> *classes = NULL)
+		{
+			TempFile leftFile("_CommentLines_left.txt", left);
+			TempFile rightFile("_CommentLines_right.txt", right);
+			DiffutilsOptions options;
+			options.m_ignoreWhitespace = static_cast<WhitespaceIgnoreChoices>(ignoreWhitespace);
+			options.SetToDiffUtils();
+
+			file_data inf[2];
+			memset(inf, 0, sizeof(inf));
+			inf[0].desc = _open(leftFile.m_filename.c_str(),  O_RDONLY | O_BINARY, _S_IREAD);
+			inf[1].desc = _open(rightFile.m_filename.c_str(), O_RDONLY | O_BINARY, _S_IREAD);
+			_fstat(inf[0].desc, &inf[0].stat);
+			_fstat(inf[1].desc, &inf[1].stat);
+
+			int bin_status = 0, bin_file = 0;
+			struct change *script = diff_2_files(inf, 0, &bin_status, false, &bin_file);
+			ClassifyCommentLines(inf[0], m_filtercommentsset);
+			ClassifyCommentLines(inf[1], m_filtercommentsset);
+			if (classes)
+			{
+				classes->clear();
+				for (int i = 0; i < inf[0].valid_lines; ++i)
+					classes->push_back(GetLineClass(inf[0], i));
+			}
+
+			std::vector<bool> commentChanges;
+			struct change *p;
+			for (struct change *e = script; e; e = p)
+			{
+				int LineNumber[2] = { e->line0, e->line1 };
+				int QtyLines[2] = { e->deleted, e->inserted };
+				commentChanges.push_back(IsCommentChangeOnly(inf, LineNumber, QtyLines,
+					m_filtercommentsset, ignoreWhitespace, false));
+				p = e->link;
+				free(e);
+			}
+			cleanup_file_buffers(inf);
+			_close(inf[0].desc);
+			_close(inf[1].desc);
+			return commentChanges;
+		}
+
+		FilterCommentsSet m_filtercommentsset;
+	};
+
+	TEST_F(CommentLinesTest, LinesAreClassified)
+	{
+		std::vector<int> classes;
+		FindCommentChanges(
+			"a;\n"
+			"/* b\n"
+			"c */ d;\n"
+			"  // e\n"
+			"\n"
+			"f; /* g\n"
+			"h */\n",
+			"", WHITESPACE_COMPARE_ALL, &classes);
+		ASSERT_EQ(7u, classes.size());
+		EXPECT_EQ(LINE_HAS_CODE, classes[0]);
+		EXPECT_EQ(0, classes[1]);
+		EXPECT_EQ(LINE_IN_COMMENT | LINE_HAS_CODE, classes[2]);
+		EXPECT_EQ(0, classes[3]);
+		EXPECT_EQ(0, classes[4]);
+		EXPECT_EQ(LINE_HAS_CODE, classes[5]);
+		EXPECT_EQ(LINE_IN_COMMENT, classes[6]);
+	}
+
+	TEST_F(CommentLinesTest, BlockCommentOpenedInUnchangedPrefix)
+	{
+		// The old PostFilter() searched the marker backward from the diff,
+		// and only found it if diffutils still had the prefix lines buffered.
+		std::vector<bool> changes = FindCommentChanges(
+			"int x;\n/* start\nsame\nfoo\n*/\n",
+			"int x;\n/* start\nsame\nbar\n*/\n");
+		ASSERT_EQ(1u, changes.size());
+		EXPECT_TRUE(changes[0]);
+
+		changes = FindCommentChanges(
+			"int x;\n/* start */\nsame;\nfoo;\n",
+			"int x;\n/* start */\nsame;\nbar;\n");
+		ASSERT_EQ(1u, changes.size());
+		EXPECT_FALSE(changes[0]);
+	}
+
+	TEST_F(CommentLinesTest, InlineTrailingComments)
+	{
+		std::vector<bool> changes = FindCommentChanges(
+			"a;\nint b; // x\nc;\n",
+			"a;\nint b; // y\nc;\n");
+		ASSERT_EQ(1u, changes.size());
+		EXPECT_TRUE(changes[0]);
+
+		changes = FindCommentChanges("int a; // x\n", "int b; // x\n");
+		ASSERT_EQ(1u, changes.size());
+		EXPECT_FALSE(changes[0]);
+
+		changes = FindCommentChanges("a = 1; /* x */ + 2;\n", "a = 1; /* y */ + 2;\n");
+		ASSERT_EQ(1u, changes.size());
+		EXPECT_TRUE(changes[0]);
+
+		// Whitespace before the comment is code, if whitespace is compared
+		changes = FindCommentChanges("int a;\n", "int a; // x\n");
+		ASSERT_EQ(1u, changes.size());
+		EXPECT_FALSE(changes[0]);
+
+		// The old PostFilter() kept the EOL of lines without comment,
+		// so these were not changes of comments only.
+		changes = FindCommentChanges("int a;\n", "int a; // x\n", WHITESPACE_IGNORE_CHANGE);
+		ASSERT_EQ(1u, changes.size());
+		EXPECT_TRUE(changes[0]);
+		changes = FindCommentChanges("int a;\n", "int a; // x\n", WHITESPACE_IGNORE_ALL);
+		ASSERT_EQ(1u, changes.size());
+		EXPECT_TRUE(changes[0]);
+	}
+
+	TEST_F(CommentLinesTest, CommentMarkersInQuotes)
+	{
+		std::vector<bool> changes = FindCommentChanges(
+			"s = \"/*\";\nfoo;\n",
+			"s = \"/*\";\nbar;\n");
+		ASSERT_EQ(1u, changes.size());
+		EXPECT_FALSE(changes[0]);
+
+		changes = FindCommentChanges("s = \"// a\";\n", "s = \"// b\";\n");
+		ASSERT_EQ(1u, changes.size());
+		EXPECT_FALSE(changes[0]);
+
+		changes = FindCommentChanges("c = '/'; // a\n", "c = '/'; // b\n");
+		ASSERT_EQ(1u, changes.size());
+		EXPECT_TRUE(changes[0]);
+
+		changes = FindCommentChanges("s = \"\\\"\"; // a\n", "s = \"\\\"\"; // b\n");
+		ASSERT_EQ(1u, changes.size());
+		EXPECT_TRUE(changes[0]);
+	}
+
+	TEST_F(CommentLinesTest, OneSidedCommentOnlyBlocks)
+	{
+		std::vector<bool> changes = FindCommentChanges("a;\n// c\n// d\nb;\n", "a;\nb;\n");
+		ASSERT_EQ(1u, changes.size());
+		EXPECT_TRUE(changes[0]);
+
+		changes = FindCommentChanges("a;\n    // c\nb;\n", "a;\nb;\n", WHITESPACE_IGNORE_ALL);
+		ASSERT_EQ(1u, changes.size());
+		EXPECT_TRUE(changes[0]);
+
+		changes = FindCommentChanges("a;\nx; // c\nb;\n", "a;\nb;\n");
+		ASSERT_EQ(1u, changes.size());
+		EXPECT_FALSE(changes[0]);
+
+		changes = FindCommentChanges("a;\nb;\n", "a;\n// c\nx;\nb;\n");
+		ASSERT_EQ(1u, changes.size());
+		EXPECT_FALSE(changes[0]);
+
+		// The old PostFilter() kept the EOL after block comments, and
+		// the whitespace of blank lines and before comments, so these
+		// were not changes of comments only.
+		changes = FindCommentChanges("a;\n/* c\nd */\nb;\n", "a;\nb;\n");
+		ASSERT_EQ(1u, changes.size());
+		EXPECT_TRUE(changes[0]);
+
+		changes = FindCommentChanges("a;\n// c\n\n/* d */\nb;\n", "a;\nb;\n");
+		ASSERT_EQ(1u, changes.size());
+		EXPECT_TRUE(changes[0]);
+
+		changes = FindCommentChanges("a;\nb;\n", "a;\n    // c\nb;\n");
+		ASSERT_EQ(1u, changes.size());
+		EXPECT_TRUE(changes[0]);
+	}
+
+}  // namespace
@@ -0,0 +1,356 @@
+#include <gtest/gtest.h>
+#include <fstream>
+#include <cstdio>
+#include "CompareResultCache.h"
+#include "ContentDigest.h"
+#include "DiffContext.h"
+#include "DiffItem.h"
+#include "PathContext.h"
+#include "CompareOptions.h"
+#include "DiffWrapper.h"
+#include "FilterList.h"
+#include "FilterCommentsManager.h"
+#include "Environment.h"
+#include "paths.h"
+#include "unicoder.h"
+
+namespace
+{
+	struct TempFile
+	{
+		TempFile(const String& filename, const std::string& data) : m_filename(filename)
+		{
+			std::ofstream ostr(ucr::toUTF8(filename).c_str(), std::ios::out|std::ios::binary|std::ios::trunc);
+			ostr.write(data.data(), data.size());
+		}
+		~TempFile()
+		{
+			remove(ucr::toUTF8(m_filename).c_str());
+		}
+		String m_filename;
+	};
+
+	// The fixture for testing class CompareResultCache.
+	class CompareResultCacheTest : public testing::Test
+	{
+	protected:
+		CompareResultCacheTest()
+		: m_sCacheFile(paths_ConcatPath(env_GetTempPath(), _T("CompareResultCache_test.dat")))
+		, m_left(paths_ConcatPath(env_GetTempPath(), _T("CompareResultCache_left.txt")), "abc\n")
+		, m_right(paths_ConcatPath(env_GetTempPath(), _T("CompareResultCache_right.txt")), "abd\n")
+		{
+		}
+
+		virtual ~CompareResultCacheTest()
+		{
+		}
+
+		virtual void SetUp()
+		{
+			m_files.SetLeft(m_left.m_filename);
+			m_files.SetRight(m_right.m_filename);
+			for (int nIndex = 0; nIndex < 2; ++nIndex)
+			{
+				m_di.diffFileInfo[nIndex].size = 4;
+				m_di.diffFileInfo[nIndex].mtime = Poco::Timestamp(1000000);
+			}
+			m_result.code = DIFFCODE::FILE | DIFFCODE::TEXT | DIFFCODE::DIFF;
+			m_result.ndiffs = 1;
+			m_result.ntrivialdiffs = 0;
+			m_result.textStats[0].nlfs = 1;
+			m_result.textStats[1].nlfs = 1;
+		}
+
+		virtual void TearDown()
+		{
+			remove(ucr::toUTF8(m_sCacheFile).c_str());
+		}
+
+		String m_sCacheFile;
+		TempFile m_left;
+		TempFile m_right;
+		PathContext m_files;
+		DIFFITEM m_di;
+		CompareResultCache::Result m_result;
+		CompareResultCache::Stats m_stats;
+	};
+
+	TEST_F(CompareResultCacheTest, Lookup)
+	{
+		CompareResultCache cache(m_sCacheFile);
+		CompareResultCache::Result result;
+		EXPECT_FALSE(cache.Lookup(m_files, m_di, 1, result, m_stats));
+		EXPECT_EQ(1, m_stats.nMisses.value());
+
+		cache.Store(m_files, m_di, 1, m_result, m_stats);
+		EXPECT_TRUE(cache.Lookup(m_files, m_di, 1, result, m_stats));
+		EXPECT_EQ(1, m_stats.nHits.value());
+		EXPECT_TRUE(CompareResultCache::IsSameResult(m_result, result));
+		EXPECT_EQ(m_result.code, result.code);
+		EXPECT_EQ(1, result.ndiffs);
+		EXPECT_EQ(0, result.ntrivialdiffs);
+
+		// Swapped sides are another pair
+		PathContext swapped;
+		swapped.SetLeft(m_files[1]);
+		swapped.SetRight(m_files[0]);
+		EXPECT_FALSE(cache.Lookup(swapped, m_di, 1, result, m_stats));
+	}
+
+	TEST_F(CompareResultCacheTest, Invalidation)
+	{
+		CompareResultCache cache(m_sCacheFile);
+		CompareResultCache::Result result;
+		cache.Store(m_files, m_di, 1, m_result, m_stats);
+
+		// Other compare options
+		EXPECT_FALSE(cache.Lookup(m_files, m_di, 2, result, m_stats));
+
+		// Changed size or modification time
+		DIFFITEM di;
+		di.diffFileInfo[0] = m_di.diffFileInfo[0];
+		di.diffFileInfo[1] = m_di.diffFileInfo[1];
+		di.diffFileInfo[1].size = 5;
+		EXPECT_FALSE(cache.Lookup(m_files, di, 1, result, m_stats));
+		di.diffFileInfo[1].size = 4;
+		di.diffFileInfo[0].mtime = Poco::Timestamp(2000000);
+		EXPECT_FALSE(cache.Lookup(m_files, di, 1, result, m_stats));
+		EXPECT_TRUE(cache.Lookup(m_files, m_di, 1, result, m_stats));
+
+		// Missing file
+		PathContext files;
+		files.SetLeft(m_files[0]);
+		files.SetRight(m_files[1] + _T(".missing"));
+		cache.Store(files, m_di, 1, m_result, m_stats);
+		EXPECT_FALSE(cache.Lookup(files, m_di, 1, result, m_stats));
+
+		cache.Clear();
+		EXPECT_FALSE(cache.Lookup(m_files, m_di, 1, result, m_stats));
+		EXPECT_EQ(1, m_stats.nHits.value());
+		EXPECT_EQ(5, m_stats.nMisses.value());
+	}
+
+	TEST_F(CompareResultCacheTest, Verify)
+	{
+		CompareResultCache cache(m_sCacheFile);
+		CompareResultCache::Result result;
+		cache.Store(m_files, m_di, 1, m_result, m_stats);
+
+		// Verified hits are compared again and checked when stored
+		cache.SetVerifyRate(100);
+		EXPECT_FALSE(cache.Lookup(m_files, m_di, 1, result, m_stats));
+		EXPECT_EQ(1, m_stats.nVerified.value());
+		cache.Store(m_files, m_di, 1, m_result, m_stats);
+		EXPECT_EQ(0, m_stats.nVerifyFailures.value());
+
+		CompareResultCache::Result changed = m_result;
+		changed.code = DIFFCODE::FILE | DIFFCODE::TEXT | DIFFCODE::SAME;
+		changed.ndiffs = 0;
+		EXPECT_FALSE(cache.Lookup(m_files, m_di, 1, result, m_stats));
+		cache.Store(m_files, m_di, 1, changed, m_stats);
+		EXPECT_EQ(2, m_stats.nVerified.value());
+		EXPECT_EQ(1, m_stats.nVerifyFailures.value());
+
+		// New result replaces the wrong one
+		cache.SetVerifyRate(0);
+		EXPECT_TRUE(cache.Lookup(m_files, m_di, 1, result, m_stats));
+		EXPECT_EQ(changed.code, result.code);
+		EXPECT_EQ(0, result.ndiffs);
+
+		// Storing after a miss is not a verification
+		m_stats.Reset();
+		cache.Store(m_files, m_di, 2, m_result, m_stats);
+		EXPECT_EQ(0, m_stats.nVerifyFailures.value());
+	}
+
+	TEST_F(CompareResultCacheTest, SaveLoad)
+	{
+		{
+			CompareResultCache cache(m_sCacheFile);
+			m_result.encoding[0].SetCodepage(65001);
+			m_result.textStats[1].ncrlfs = 3;
+			m_result.nFirstDiffOffset = 2;
+			m_result.digest[0] = std::string(20, '\x01');
+			cache.Store(m_files, m_di, 42, m_result, m_stats);
+			EXPECT_TRUE(cache.Save());
+		}
+		{
+			CompareResultCache cache(m_sCacheFile);
+			CompareResultCache::Result result;
+			EXPECT_TRUE(cache.Load());
+			EXPECT_TRUE(cache.Lookup(m_files, m_di, 42, result, m_stats));
+			EXPECT_TRUE(CompareResultCache::IsSameResult(m_result, result));
+			EXPECT_EQ(65001, result.encoding[0].m_codepage);
+			EXPECT_EQ(3u, result.textStats[1].ncrlfs);
+			EXPECT_EQ(2, result.nFirstDiffOffset);
+			EXPECT_EQ(m_result.digest[0], result.digest[0]);
+			EXPECT_EQ("", result.digest[1]);
+			EXPECT_FALSE(cache.Lookup(m_files, m_di, 43, result, m_stats));
+		}
+		{
+			// Unknown file contents leave the cache empty
+			TempFile bad(m_sCacheFile, "not a cache file");
+			CompareResultCache cache(m_sCacheFile);
+			CompareResultCache::Result result;
+			EXPECT_FALSE(cache.Load());
+			EXPECT_FALSE(cache.Lookup(m_files, m_di, 42, result, m_stats));
+		}
+	}
+
+	TEST_F(CompareResultCacheTest, HashCompareOptions)
+	{
+		DIFFOPTIONS options = {0};
+		CDiffContext ctxt(m_files, CMP_CONTENT);
+		ctxt.CreateCompareOptions(CMP_CONTENT, options);
+		uint64_t hash = CompareResultCache::HashCompareOptions(&ctxt);
+
+		CDiffContext ctxt2(m_files, CMP_CONTENT);
+		ctxt2.CreateCompareOptions(CMP_CONTENT, options);
+		EXPECT_EQ(hash, CompareResultCache::HashCompareOptions(&ctxt2));
+
+		options.bIgnoreCase = true;
+		ctxt2.CreateCompareOptions(CMP_CONTENT, options);
+		EXPECT_NE(hash, CompareResultCache::HashCompareOptions(&ctxt2));
+		options.bIgnoreCase = false;
+		ctxt2.CreateCompareOptions(CMP_CONTENT, options);
+		EXPECT_EQ(hash, CompareResultCache::HashCompareOptions(&ctxt2));
+
+		ctxt2.CreateCompareOptions(CMP_QUICK_CONTENT, options);
+		EXPECT_NE(hash, CompareResultCache::HashCompareOptions(&ctxt2));
+		ctxt2.CreateCompareOptions(CMP_CONTENT, options);
+
+		ctxt2.m_pFilterList.reset(new FilterList);
+		ctxt2.m_pFilterList->AddRegExp("^#include");
+		EXPECT_NE(hash, CompareResultCache::HashCompareOptions(&ctxt2));
+		ctxt2.m_pFilterList.reset();
+
+		ctxt2.m_nStreamingDiffMemory = 1024;
+		EXPECT_NE(hash, CompareResultCache::HashCompareOptions(&ctxt2));
+		ctxt2.m_nStreamingDiffMemory = ctxt.m_nStreamingDiffMemory;
+		EXPECT_EQ(hash, CompareResultCache::HashCompareOptions(&ctxt2));
+
+		int codepage = ucr::getDefaultCodepage();
+		ucr::setDefaultCodepage(codepage == 1252 ? 1250 : 1252);
+		EXPECT_NE(hash, CompareResultCache::HashCompareOptions(&ctxt2));
+		ucr::setDefaultCodepage(codepage);
+		EXPECT_EQ(hash, CompareResultCache::HashCompareOptions(&ctxt2));
+	}
+
+	TEST_F(CompareResultCacheTest, HashCommentMarkers)
+	{
+		String ini1 = paths_ConcatPath(env_GetTempPath(), _T("CompareResultCache_test1.ini"));
+		String ini2 = paths_ConcatPath(env_GetTempPath(), _T("CompareResultCache_test2.ini"));
+		TempFile markers1(ini1, "[set0]\nStartMarker=/*\nEndMarker=*/\nInlineMarker=//\nFileType0=cpp\n");
+		TempFile markers2(ini2, "[set0]\nStartMarker=/*\nEndMarker=*/\nInlineMarker=#\nFileType0=cpp\n");
+		FilterCommentsManager manager1(ini1);
+		FilterCommentsManager manager2(ini2);
+		EXPECT_EQ("cpp\t/*\t*/\t//\n", manager1.GetAsString());
+
+		DIFFOPTIONS options = {0};
+		CDiffContext ctxt(m_files, CMP_CONTENT);
+		ctxt.CreateCompareOptions(CMP_CONTENT, options);
+
+		// Markers matter only when comments are filtered
+		ctxt.m_pFilterCommentsManager = &manager1;
+		uint64_t hash1 = CompareResultCache::HashCompareOptions(&ctxt);
+		ctxt.m_pFilterCommentsManager = &manager2;
+		EXPECT_EQ(hash1, CompareResultCache::HashCompareOptions(&ctxt));
+
+		options.bFilterCommentsLines = true;
+		ctxt.CreateCompareOptions(CMP_CONTENT, options);
+		ctxt.m_pFilterCommentsManager = &manager1;
+		uint64_t hash2 = CompareResultCache::HashCompareOptions(&ctxt);
+		EXPECT_NE(hash1, hash2);
+		ctxt.m_pFilterCommentsManager = &manager2;
+		EXPECT_NE(hash2, CompareResultCache::HashCompareOptions(&ctxt));
+	}
+
+	TEST_F(CompareResultCacheTest, VerifyDigests)
+	{
+		CompareResultCache cache(m_sCacheFile);
+		CompareResultCache::Result result;
+		m_result.digest[0] = std::string(20, 'a');
+		m_result.digest[1] = std::string(20, 'b');
+		cache.Store(m_files, m_di, 1, m_result, m_stats);
+		cache.SetVerifyRate(100);
+
+		// A file the compare did not read whole has no digest to check
+		CompareResultCache::Result partial = m_result;
+		partial.digest[1].clear();
+		EXPECT_FALSE(cache.Lookup(m_files, m_di, 1, result, m_stats));
+		cache.Store(m_files, m_di, 1, partial, m_stats);
+		EXPECT_EQ(0, m_stats.nVerifyFailures.value());
+
+		// A file changed without changing its metadata or the result
+		cache.Store(m_files, m_di, 1, m_result, m_stats);
+		CompareResultCache::Result changed = m_result;
+		changed.digest[1] = std::string(20, 'c');
+		EXPECT_FALSE(cache.Lookup(m_files, m_di, 1, result, m_stats));
+		cache.Store(m_files, m_di, 1, changed, m_stats);
+		EXPECT_EQ(1, m_stats.nVerifyFailures.value());
+	}
+
+	TEST_F(CompareResultCacheTest, StatsArePerCompare)
+	{
+		CompareResultCache cache(m_sCacheFile);
+		CompareResultCache::Result result;
+		CompareResultCache::Stats stats;
+		cache.Store(m_files, m_di, 1, m_result, m_stats);
+		EXPECT_TRUE(cache.Lookup(m_files, m_di, 1, result, m_stats));
+		EXPECT_FALSE(cache.Lookup(m_files, m_di, 2, result, stats));
+		EXPECT_EQ(1, m_stats.nHits.value());
+		EXPECT_EQ(0, m_stats.nMisses.value());
+		EXPECT_EQ(0, stats.nHits.value());
+		EXPECT_EQ(1, stats.nMisses.value());
+	}
+
+	TEST_F(CompareResultCacheTest, LeastRecentlyUsedAreEvicted)
+	{
+		PathContext swapped, same;
+		swapped.SetLeft(m_files[1]);
+		swapped.SetRight(m_files[0]);
+		same.SetLeft(m_files[0]);
+		same.SetRight(m_files[0]);
+		CompareResultCache::Result result;
+		{
+			CompareResultCache cache(m_sCacheFile);
+			cache.Store(m_files, m_di, 1, m_result, m_stats);
+			cache.Store(swapped, m_di, 1, m_result, m_stats);
+			EXPECT_TRUE(cache.Lookup(m_files, m_di, 1, result, m_stats));
+			cache.Store(same, m_di, 1, m_result, m_stats);
+			cache.SetMaxEntries(2);
+			EXPECT_TRUE(cache.Save());
+			EXPECT_EQ(2u, cache.GetEntryCount());
+			EXPECT_FALSE(cache.Lookup(swapped, m_di, 1, result, m_stats));
+		}
+		{
+			// Order of use is kept in the cache file
+			CompareResultCache cache(m_sCacheFile);
+			EXPECT_TRUE(cache.Load());
+			EXPECT_TRUE(cache.Lookup(m_files, m_di, 1, result, m_stats));
+			cache.SetMaxEntries(1);
+			EXPECT_TRUE(cache.Save());
+			EXPECT_TRUE(cache.Lookup(m_files, m_di, 1, result, m_stats));
+			EXPECT_FALSE(cache.Lookup(same, m_di, 1, result, m_stats));
+		}
+	}
+
+	TEST_F(CompareResultCacheTest, ContentDigest)
+	{
+		ContentDigest digest1, digest2;
+		digest1.Update("abc\n", 4);
+		std::string whole = digest1.GetDigest(4);
+		EXPECT_EQ(20u, whole.size());
+
+		// Partly fed file has no digest
+		digest2.Update("ab", 2);
+		EXPECT_EQ("", digest2.GetDigest(4));
+		digest2.Update("ab", 2);
+		digest2.Update("c\n", 2);
+		EXPECT_EQ(whole, digest2.GetDigest(4));
+
+		digest1.Update("abd\n", 4);
+		EXPECT_NE(whole, digest1.GetDigest(4));
+	}
+
+}  // namespace
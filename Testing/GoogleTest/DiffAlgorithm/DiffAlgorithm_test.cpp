@@ -0,0 +1,350 @@
+#include <gtest/gtest.h>
+#include <io.h>
+#include <sys/stat.h>
+#include <fcntl.h>
+#include <fstream>
+#include <string>
+#include <vector>
+#include <random>
+#include <chrono>
+#include <cstdio>
+#include <cstring>
+#include <algorithm>
+#include "diff.h"
+#include "CompareOptions.h"
+
+namespace
+{
+	struct TempFile
+	{
+		TempFile(const std::string& filename, const std::vector<std::string>& lines) : m_filename(filename)
+		{
+			std::ofstream ostr(filename.c_str(), std::ios::out|std::ios::binary|std::ios::trunc);
+			for (size_t i = 0; i < lines.size(); ++i)
+				ostr << lines[i] << "\n";
+		}
+		~TempFile()
+		{
+			remove(m_filename.c_str());
+		}
+		std::string m_filename;
+	};
+
+	/** @brief Result of diffing two files with diffutils. */
+	struct DiffResult
+	{
+		int hunks;
+		int changed[2];
+		bool consistent;
+		double seconds;
+	};
+
+	/**
+	 * @brief Check that lines not marked as changed pair up and are equal.
+	 */
+	bool IsConsistent(struct change *script, const file_data inf[])
+	{
+		std::vector<bool> changed[2];
+		for (int i = 0; i < 2; ++i)
+			changed[i].resize(inf[i].buffered_lines);
+		for (struct change *e = script; e; e = e->link)
+		{
+			for (int j = 0; j < e->deleted; ++j)
+				changed[0][e->line0 + j] = true;
+			for (int j = 0; j < e->inserted; ++j)
+				changed[1][e->line1 + j] = true;
+		}
+		int i0 = 0, i1 = 0;
+		for (;;)
+		{
+			while (i0 < inf[0].buffered_lines && changed[0][i0])
+				++i0;
+			while (i1 < inf[1].buffered_lines && changed[1][i1])
+				++i1;
+			if (i0 == inf[0].buffered_lines || i1 == inf[1].buffered_lines)
+				return i0 == inf[0].buffered_lines && i1 == inf[1].buffered_lines;
+			size_t len0 = inf[0].linbuf[i0 + 1] - inf[0].linbuf[i0];
+			size_t len1 = inf[1].linbuf[i1 + 1] - inf[1].linbuf[i1];
+			if (len0 != len1 || memcmp(inf[0].linbuf[i0], inf[1].linbuf[i1], len0) != 0)
+				return false;
+			++i0;
+			++i1;
+		}
+	}
+
+	DiffResult DiffFiles(const std::string& left, const std::string& right, enum DiffAlgorithm algorithm)
+	{
+		DiffutilsOptions options;
+		options.m_diffAlgorithm = algorithm;
+		options.SetToDiffUtils();
+
+		file_data inf[2];
+		memset(inf, 0, sizeof(inf));
+		inf[0].desc = _open(left.c_str(),  O_RDONLY | O_BINARY, _S_IREAD);
+		inf[1].desc = _open(right.c_str(), O_RDONLY | O_BINARY, _S_IREAD);
+		_fstat(inf[0].desc, &inf[0].stat);
+		_fstat(inf[1].desc, &inf[1].stat);
+
+		DiffResult result = {0};
+		int bin_status = 0, bin_file = 0;
+		std::chrono::system_clock::time_point start = std::chrono::system_clock::now();
+		struct change *script = diff_2_files(inf, 0, &bin_status, false, &bin_file);
+		result.seconds = std::chrono::duration<double>(std::chrono::system_clock::now() - start).count();
+		result.consistent = IsConsistent(script, inf);
+
+		struct change *p;
+		for (struct change *e = script; e; e = p)
+		{
+			++result.hunks;
+			result.changed[0] += e->deleted;
+			result.changed[1] += e->inserted;
+			p = e->link;
+			free(e);
+		}
+		cleanup_file_buffers(inf);
+		_close(inf[0].desc);
+		_close(inf[1].desc);
+		return result;
+	}
+
+	/**
+	 * @brief Edit lines randomly: delete, insert from @p pool and modify lines.
+	 */
+	std::vector<std::string> Edit(const std::vector<std::string>& lines, double rate, std::mt19937& rnd, const std::vector<std::string>& pool)
+	{
+		std::uniform_real_distribution<double> dist;
+		std::vector<std::string> out;
+		for (size_t i = 0; i < lines.size(); )
+		{
+			double r = dist(rnd);
+			if (r < rate / 3)
+			{
+				i += 1 + rnd() % 5;
+				continue;
+			}
+			if (r < 2 * rate / 3)
+			{
+				for (int j = 1 + rnd() % 5; j > 0; --j)
+					out.push_back(pool[rnd() % pool.size()]);
+			}
+			else if (r < rate)
+			{
+				out.push_back(lines[i++] + " -- changed");
+				continue;
+			}
+			out.push_back(lines[i++]);
+		}
+		return out;
+	}
+
+	/**
+	 * @brief Generate a pair of files typical for one kind of text.
+	 */
+	void Generate(const std::string& kind, int n, double rate, std::vector<std::string>& a, std::vector<std::string>& b)
+	{
+		std::mt19937 rnd(1);
+		std::vector<std::string> pool;
+		char buf[256];
+		a.clear();
+		if (kind == "sql")
+		{
+			for (int i = 0; i < n / 4; ++i)
+			{
+				sprintf(buf, "INSERT INTO t VALUES (%d, '%d');", rnd() % 51, rnd() % 21);
+				a.push_back(buf);
+				a.push_back("GO");
+				a.push_back("");
+				a.push_back("END;");
+			}
+			pool.assign(a.begin(), a.begin() + (std::min)(static_cast<size_t>(200), a.size()));
+		}
+		else if (kind == "code")
+		{
+			for (int i = 0; i < n / 8; ++i)
+			{
+				sprintf(buf, "void f%d(int x)", i);
+				a.push_back(buf);
+				a.push_back("{");
+				sprintf(buf, "    if (x > %d)", rnd() % 10);
+				a.push_back(buf);
+				a.push_back("    {");
+				sprintf(buf, "        return %d;", rnd() % 4);
+				a.push_back(buf);
+				a.push_back("    }");
+				a.push_back("}");
+				a.push_back("");
+			}
+			const char *lines[] = { "{", "}", "", "    }", "    return 0;" };
+			pool.assign(lines, lines + sizeof(lines) / sizeof(lines[0]));
+		}
+		else if (kind == "log")
+		{
+			const char *msgs[] = { "INFO ok", "INFO start", "WARN slow", "INFO done", "DEBUG tick" };
+			pool.assign(msgs, msgs + sizeof(msgs) / sizeof(msgs[0]));
+			for (int i = 0; i < n; ++i)
+				a.push_back(pool[rnd() % pool.size()]);
+		}
+		else if (kind == "csv")
+		{
+			for (int i = 0; i < n; ++i)
+			{
+				sprintf(buf, "%d,%d,%c", i, rnd() % 10, "abc"[rnd() % 3]);
+				a.push_back(buf);
+			}
+			pool.push_back("x,y,z");
+		}
+		else if (kind == "moved")
+		{
+			std::vector<std::vector<std::string>> blocks(n / 23);
+			for (size_t i = 0; i < blocks.size(); ++i)
+			{
+				for (int j = 0; j < 20; ++j)
+				{
+					sprintf(buf, "block %d line %d", static_cast<int>(i), j);
+					blocks[i].push_back(buf);
+				}
+				blocks[i].push_back("}");
+				blocks[i].push_back("");
+				blocks[i].push_back("");
+				a.insert(a.end(), blocks[i].begin(), blocks[i].end());
+			}
+			std::shuffle(blocks.begin(), blocks.end(), rnd);
+			b.clear();
+			for (size_t i = 0; i < blocks.size(); ++i)
+				b.insert(b.end(), blocks[i].begin(), blocks[i].end());
+			return;
+		}
+		else if (kind == "repeated")
+		{
+			// Long runs of lines repeated all over the file, split by unique
+			// lines and by lines inserted after them, make each run tried
+			// from many lines and extended far
+			b.clear();
+			for (int i = 0; i < n / 301; ++i)
+			{
+				for (int j = 0; j < 300; ++j)
+				{
+					sprintf(buf, "line %d", j);
+					a.push_back(buf);
+					b.push_back(buf);
+				}
+				sprintf(buf, "unique %d", i);
+				a.push_back(buf);
+				b.push_back(buf);
+				sprintf(buf, "line %d", rnd() % 300);
+				b.push_back(buf);
+			}
+			return;
+		}
+		b = Edit(a, rate, rnd, pool);
+	}
+
+	// The fixture for testing diff algorithms of diffutils.
+	class DiffAlgorithmTest : public testing::Test
+	{
+	protected:
+		DiffAlgorithmTest()
+		{
+		}
+
+		virtual ~DiffAlgorithmTest()
+		{
+		}
+
+		virtual void SetUp()
+		{
+		}
+
+		virtual void TearDown()
+		{
+		}
+	};
+
+	TEST_F(DiffAlgorithmTest, SameResultForSimpleEdits)
+	{
+		std::vector<std::string> a, b;
+		for (int i = 0; i < 100; ++i)
+			a.push_back(std::to_string(i));
+		b = a;
+		b.erase(b.begin() + 10);
+		b.insert(b.begin() + 50, "inserted");
+		b[80] = "changed";
+
+		TempFile left("_DiffAlgorithm_left.txt", a);
+		TempFile right("_DiffAlgorithm_right.txt", b);
+		DiffResult myers = DiffFiles(left.m_filename, right.m_filename, DIFF_ALGORITHM_DEFAULT);
+		DiffResult histogram = DiffFiles(left.m_filename, right.m_filename, DIFF_ALGORITHM_HISTOGRAM);
+		EXPECT_TRUE(myers.consistent);
+		EXPECT_TRUE(histogram.consistent);
+		EXPECT_EQ(3, myers.hunks);
+		EXPECT_EQ(3, histogram.hunks);
+		EXPECT_EQ(2, histogram.changed[0]);
+		EXPECT_EQ(2, histogram.changed[1]);
+	}
+
+	TEST_F(DiffAlgorithmTest, AnchorsOnUniqueLines)
+	{
+		// Myers matches the braces of the moved function, histogram keeps
+		// the unique lines together
+		std::vector<std::string> a, b;
+		const char *f1[] = { "int f1()", "{", "	return 1;", "}", "" };
+		const char *f2[] = { "int f2()", "{", "	return 2;", "}", "" };
+		a.insert(a.end(), f1, f1 + 5);
+		a.insert(a.end(), f2, f2 + 5);
+		b.insert(b.end(), f2, f2 + 5);
+		b.insert(b.end(), f1, f1 + 5);
+
+		TempFile left("_DiffAlgorithm_left.txt", a);
+		TempFile right("_DiffAlgorithm_right.txt", b);
+		DiffResult myers = DiffFiles(left.m_filename, right.m_filename, DIFF_ALGORITHM_DEFAULT);
+		DiffResult histogram = DiffFiles(left.m_filename, right.m_filename, DIFF_ALGORITHM_HISTOGRAM);
+		EXPECT_TRUE(myers.consistent);
+		EXPECT_TRUE(histogram.consistent);
+		EXPECT_EQ(4, myers.hunks);
+		EXPECT_EQ(2, histogram.hunks);
+		EXPECT_EQ(5, histogram.changed[0]);
+		EXPECT_EQ(5, histogram.changed[1]);
+	}
+
+	TEST_F(DiffAlgorithmTest, ConsistentForRandomEdits)
+	{
+		const char *kinds[] = { "sql", "code", "log", "csv", "moved", "repeated" };
+		for (int k = 0; k < sizeof(kinds) / sizeof(kinds[0]); ++k)
+		{
+			std::vector<std::string> a, b;
+			Generate(kinds[k], 2000, 0.05, a, b);
+			TempFile left("_DiffAlgorithm_left.txt", a);
+			TempFile right("_DiffAlgorithm_right.txt", b);
+			EXPECT_TRUE(DiffFiles(left.m_filename, right.m_filename, DIFF_ALGORITHM_DEFAULT).consistent) << kinds[k];
+			EXPECT_TRUE(DiffFiles(left.m_filename, right.m_filename, DIFF_ALGORITHM_HISTOGRAM).consistent) << kinds[k];
+		}
+	}
+
+	TEST_F(DiffAlgorithmTest, DISABLED_Corpus)
+	{
+		struct { const char *kind; int lines; double rate; } corpus[] = {
+			{ "sql", 200000, 0.01 },
+			{ "code", 200000, 0.01 },
+			{ "code", 500000, 0.3 },
+			{ "log", 200000, 0.3 },
+			{ "csv", 500000, 0.01 },
+			{ "moved", 50000, 0 },
+			{ "repeated", 200000, 0 },
+		};
+		printf("%-6s %8s %10s %10s %10s %10s\n", "kind", "lines", "myers", "hunks", "histogram", "hunks");
+		for (int k = 0; k < sizeof(corpus) / sizeof(corpus[0]); ++k)
+		{
+			std::vector<std::string> a, b;
+			Generate(corpus[k].kind, corpus[k].lines, corpus[k].rate, a, b);
+			TempFile left("_DiffAlgorithm_left.txt", a);
+			TempFile right("_DiffAlgorithm_right.txt", b);
+			DiffResult myers = DiffFiles(left.m_filename, right.m_filename, DIFF_ALGORITHM_DEFAULT);
+			DiffResult histogram = DiffFiles(left.m_filename, right.m_filename, DIFF_ALGORITHM_HISTOGRAM);
+			EXPECT_TRUE(myers.consistent);
+			EXPECT_TRUE(histogram.consistent);
+			printf("%-6s %8d %9.3fs %10d %9.3fs %10d\n", corpus[k].kind, corpus[k].lines,
+				myers.seconds, myers.hunks, histogram.seconds, histogram.hunks);
+		}
+	}
+
+}  // namespace
@@ -0,0 +1,320 @@
+#include <gtest/gtest.h>
+#include <windows.h>
+#include <psapi.h>
+#include <tchar.h>
+#include <chrono>
+#include <cstdio>
+#include <memory>
+#include <vector>
+#include "UnicodeString.h"
+#include "DiffItemList.h"
+
+#pragma comment(lib, "psapi.lib")
+
+namespace
+{
+	// The fixture for testing DiffItemList class.
+	class DiffItemListTest : public testing::Test
+	{
+	protected:
+		DiffItemListTest()
+		{
+		}
+
+		virtual ~DiffItemListTest()
+		{
+		}
+
+		virtual void SetUp()
+		{
+		}
+
+		virtual void TearDown()
+		{
+		}
+	};
+
+	size_t GetPrivateBytes()
+	{
+		PROCESS_MEMORY_COUNTERS_EX pmc = { sizeof(pmc) };
+		GetProcessMemoryInfo(GetCurrentProcess(), reinterpret_cast<PROCESS_MEMORY_COUNTERS *>(&pmc), sizeof(pmc));
+		return pmc.PrivateUsage;
+	}
+
+	/**
+	 * @brief Layout of DIFFITEM before items were allocated by DiffItemList.
+	 * Items were allocated one by one, linked by pointers, and had version,
+	 * encoding and text stats for every side.
+	 */
+	struct OldDiffFileInfo : public DirItem
+	{
+		FileVersion version;
+		FileTextEncoding encoding;
+		FileTextStats m_textStats;
+	};
+
+	struct OldDiffItem
+	{
+		OldDiffItem *Flink, *Blink;
+		OldDiffItem *parent;
+		OldDiffItem *childFlink, *childBlink;
+		OldDiffFileInfo diffFileInfo[3];
+		int nsdiffs;
+		int nidiffs;
+		unsigned customFlags1;
+		DIFFCODE diffcode;
+	};
+
+	template <class Item>
+	void FillItem(Item *di, const PooledPath& folder, const PooledString& filename, int j)
+	{
+		for (int nIndex = 0; nIndex < 2; ++nIndex)
+		{
+			di->diffFileInfo[nIndex].path = folder;
+			di->diffFileInfo[nIndex].filename = filename;
+			di->diffFileInfo[nIndex].size = j;
+			di->diffFileInfo[nIndex].mtime = j;
+		}
+		di->diffcode.diffcode = DIFFCODE::FILE | DIFFCODE::BOTH | DIFFCODE::SAME;
+	}
+
+	TEST_F(DiffItemListTest, AddAndRemove)
+	{
+		DiffItemList list;
+		EXPECT_EQ(0, list.GetFirstDiffPosition());
+
+		DIFFITEM *folder = list.AddDiff(NULL);
+		folder->diffFileInfo[0].filename = _T("folder");
+		for (int i = 0; i < 10; ++i)
+		{
+			DIFFITEM *di = list.AddDiff(folder);
+			di->diffFileInfo[0].filename = string_format(_T("file%d"), i);
+		}
+		DIFFITEM *file = list.AddDiff(NULL);
+		file->diffFileInfo[0].filename = _T("file");
+
+		int count = 0;
+		uintptr_t pos = list.GetFirstDiffPosition();
+		while (pos)
+		{
+			const DIFFITEM& di = list.GetNextDiffPosition(pos);
+			EXPECT_FALSE(di.diffFileInfo[0].filename.get().empty());
+			++count;
+		}
+		EXPECT_EQ(12, count);
+
+		count = 0;
+		pos = list.GetFirstChildDiffPosition(reinterpret_cast<uintptr_t>(folder));
+		while (pos)
+		{
+			const DIFFITEM& di = list.GetNextSiblingDiffPosition(pos);
+			EXPECT_EQ(string_format(_T("file%d"), count), di.diffFileInfo[0].filename.get());
+			EXPECT_EQ(folder, list.GetParentDiff(di));
+			EXPECT_EQ(1, list.GetDiffDepth(di));
+			EXPECT_TRUE(list.IsAncestorDiff(di, folder));
+			EXPECT_FALSE(list.IsAncestorDiff(*folder, &di));
+			++count;
+		}
+		EXPECT_EQ(10, count);
+
+		list.RemoveDiff(reinterpret_cast<uintptr_t>(file));
+		DIFFITEM *file2 = list.AddDiff(NULL);
+
+		list.RemoveDiff(reinterpret_cast<uintptr_t>(folder));
+		pos = list.GetFirstDiffPosition();
+		EXPECT_EQ(file2, &list.GetNextDiffPosition(pos));
+		EXPECT_EQ(0, pos);
+
+		list.RemoveAll();
+		EXPECT_EQ(0, list.GetFirstDiffPosition());
+		EXPECT_EQ(0u, list.GetAllocatedSize());
+	}
+
+	TEST_F(DiffItemListTest, RemovedItemsAreReused)
+	{
+		DiffItemList list;
+		DIFFITEM *folder = list.AddDiff(NULL);
+		for (int i = 0; i < 3000; ++i)
+			list.AddDiff(folder);
+		size_t nSize = list.GetAllocatedSize();
+		EXPECT_TRUE(folder->HasChildren());
+
+		list.RemoveChildDiffs(reinterpret_cast<uintptr_t>(folder));
+		EXPECT_FALSE(folder->HasChildren());
+		EXPECT_EQ(0, list.GetFirstChildDiffPosition(reinterpret_cast<uintptr_t>(folder)));
+
+		for (int i = 0; i < 3000; ++i)
+		{
+			DIFFITEM *di = list.AddDiff(folder);
+			di->diffFileInfo[0].filename = string_format(_T("file%d"), i);
+		}
+		EXPECT_EQ(nSize, list.GetAllocatedSize());
+
+		// Siblings stay in order of adding
+		int count = 0;
+		uintptr_t pos = list.GetFirstChildDiffPosition(reinterpret_cast<uintptr_t>(folder));
+		while (pos)
+		{
+			const DIFFITEM& di = list.GetNextSiblingDiffPosition(pos);
+			EXPECT_EQ(string_format(_T("file%d"), count), di.diffFileInfo[0].filename.get());
+			++count;
+		}
+		EXPECT_EQ(3000, count);
+	}
+
+	TEST_F(DiffItemListTest, DetailsAreAllocatedOnDemand)
+	{
+		DiffItemList list;
+		DIFFITEM *di = list.AddDiff(NULL);
+		EXPECT_EQ(-1, di->GetFirstDiffOffset());
+		EXPECT_TRUE(di->GetVersion(0).IsCleared());
+
+		// Setting unknown values does not allocate
+		di->SetEncoding(0, FileTextEncoding());
+		di->SetTextStats(1, FileTextStats());
+		di->SetFirstDiffOffset(-1);
+		EXPECT_FALSE(di->HasDetails());
+		size_t nSize = list.GetAllocatedSize();
+
+		FileTextEncoding encoding;
+		encoding.SetCodepage(65001);
+		di->SetEncoding(1, encoding);
+		di->SetFirstDiffOffset(123);
+		EXPECT_TRUE(di->HasDetails());
+		EXPECT_EQ(nSize + sizeof(DiffItemDetails), list.GetAllocatedSize());
+		EXPECT_EQ(65001, di->GetEncoding(1).m_codepage);
+		EXPECT_EQ(-1, di->GetEncoding(0).m_codepage);
+		EXPECT_EQ(123, di->GetFirstDiffOffset());
+
+		list.Swap(0, 1);
+		EXPECT_EQ(65001, di->GetEncoding(0).m_codepage);
+		EXPECT_EQ(-1, di->GetEncoding(1).m_codepage);
+
+		di->ClearPartial(0);
+		EXPECT_EQ(-1, di->GetEncoding(0).m_codepage);
+	}
+
+	// Memory used by items of a tree of files compared by date and size,
+	// against items allocated one by one with the old DIFFITEM layout.
+	TEST_F(DiffItemListTest, MemorySaving)
+	{
+		const int nfolders = 200;
+		const int nfiles = 1000;
+		const size_t nItems = static_cast<size_t>(nfolders) * (nfiles + 1);
+
+		// Keep the names in the string pool, so that only items are measured
+		std::vector<PooledString> folders, filenames;
+		std::vector<PooledPath> folderPaths;
+		for (int i = 0; i < nfolders; ++i)
+		{
+			folders.push_back(string_format(_T("folder%d"), i));
+			folderPaths.push_back(folders.back().get());
+		}
+		for (int j = 0; j < nfiles; ++j)
+			filenames.push_back(string_format(_T("file%d.txt"), j));
+
+		size_t nBytesNew, nAllocated;
+		{
+			size_t nBytesBefore = GetPrivateBytes();
+			DiffItemList list;
+			for (int i = 0; i < nfolders; ++i)
+			{
+				DIFFITEM *parent = list.AddDiff(NULL);
+				parent->diffFileInfo[0].filename = parent->diffFileInfo[1].filename = folders[i];
+				parent->diffcode.diffcode = DIFFCODE::DIR | DIFFCODE::BOTH;
+				for (int j = 0; j < nfiles; ++j)
+					FillItem(list.AddDiff(parent), folderPaths[i], filenames[j], j);
+			}
+			nBytesNew = GetPrivateBytes() - nBytesBefore;
+			nAllocated = list.GetAllocatedSize();
+
+			uintptr_t pos = list.GetFirstDiffPosition();
+			while (pos)
+				EXPECT_FALSE(list.GetNextDiffPosition(pos).HasDetails());
+		}
+
+		// Measured after the new layout, so freed memory of the list can only
+		// make the old layout look smaller than it is.
+		size_t nBytesOld;
+		{
+			size_t nBytesBefore = GetPrivateBytes();
+			OldDiffItem *first = NULL;
+			for (int i = 0; i < nfolders; ++i)
+			{
+				OldDiffItem *parent = new OldDiffItem();
+				parent->Flink = first;
+				first = parent;
+				parent->diffFileInfo[0].filename = parent->diffFileInfo[1].filename = folders[i];
+				for (int j = 0; j < nfiles; ++j)
+				{
+					OldDiffItem *di = new OldDiffItem();
+					di->parent = parent;
+					di->Flink = parent->childFlink;
+					parent->childFlink = di;
+					FillItem(di, folderPaths[i], filenames[j], j);
+				}
+			}
+			nBytesOld = GetPrivateBytes() - nBytesBefore;
+			while (OldDiffItem *parent = first)
+			{
+				first = parent->Flink;
+				while (OldDiffItem *di = parent->childFlink)
+				{
+					parent->childFlink = di->Flink;
+					delete di;
+				}
+				delete parent;
+			}
+		}
+
+		printf("%u items: %.1f bytes/item (DIFFITEM %u bytes), old layout %.1f bytes/item (%u bytes)\n",
+			static_cast<unsigned>(nItems), static_cast<double>(nBytesNew) / nItems,
+			static_cast<unsigned>(sizeof(DIFFITEM)), static_cast<double>(nBytesOld) / nItems,
+			static_cast<unsigned>(sizeof(OldDiffItem)));
+		EXPECT_LT(nAllocated, (nItems + 1024) * sizeof(DIFFITEM) + 65536);
+		EXPECT_LT(nBytesNew, nBytesOld * 7 / 10);
+	}
+
+	// Memory used by the items of a synthetic tree of 5M files in 5000
+	// folders, as created by folder compare of two sides.
+	// Disabled by default, run with --gtest_also_run_disabled_tests.
+	TEST_F(DiffItemListTest, DISABLED_MemoryUsage)
+	{
+		const int nfolders = 5000;
+		const int nfiles = 1000;
+
+		size_t nBytesBefore = GetPrivateBytes();
+		auto start = std::chrono::steady_clock::now();
+		{
+			DiffItemList list;
+			for (int i = 0; i < nfolders; ++i)
+			{
+				String folder = string_format(_T("folder%d"), i);
+				DIFFITEM *parent = list.AddDiff(NULL);
+				for (int nIndex = 0; nIndex < 2; ++nIndex)
+					parent->diffFileInfo[nIndex].filename = folder;
+				parent->diffcode.diffcode = DIFFCODE::DIR | DIFFCODE::BOTH;
+				for (int j = 0; j < nfiles; ++j)
+				{
+					String filename = string_format(_T("file%d.txt"), j);
+					DIFFITEM *di = list.AddDiff(parent);
+					for (int nIndex = 0; nIndex < 2; ++nIndex)
+					{
+						di->diffFileInfo[nIndex].path = folder;
+						di->diffFileInfo[nIndex].filename = filename;
+						di->diffFileInfo[nIndex].size = j;
+						di->diffFileInfo[nIndex].mtime = j;
+					}
+					di->diffcode.diffcode = DIFFCODE::FILE | DIFFCODE::BOTH | DIFFCODE::SAME;
+				}
+			}
+			double secs = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+			size_t nBytes = GetPrivateBytes() - nBytesBefore;
+			size_t nItems = static_cast<size_t>(nfolders) * (nfiles + 1);
+			printf("%u items: %.1f MB, %.1f bytes/item (DIFFITEM %u bytes), %.2f s\n",
+				static_cast<unsigned>(nItems), nBytes / 1048576.0, static_cast<double>(nBytes) / nItems,
+				static_cast<unsigned>(sizeof(DIFFITEM)), secs);
+		}
+	}
+
+}  // namespace
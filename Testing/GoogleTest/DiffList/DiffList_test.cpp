@@ -0,0 +1,515 @@
+#include <gtest/gtest.h>
+#include <io.h>
+#include <sys/stat.h>
+#include <fcntl.h>
+#include <fstream>
+#include <string>
+#include <vector>
+#include <random>
+#include <cstdio>
+#include <cstring>
+#include <climits>
+#include <algorithm>
+#include "diff.h"
+#include "CompareOptions.h"
+#include "DiffList.h"
+
+namespace
+{
+	struct TempFile
+	{
+		TempFile(const std::string& filename, const std::vector<std::string>& lines, size_t begin, size_t end) : m_filename(filename)
+		{
+			std::ofstream ostr(filename.c_str(), std::ios::out|std::ios::binary|std::ios::trunc);
+			for (size_t i = begin; i < end; ++i)
+				ostr << lines[i] << "\n";
+		}
+		~TempFile()
+		{
+			remove(m_filename.c_str());
+		}
+		std::string m_filename;
+	};
+
+	DIFFRANGE MakeDiff(int begin0, int end0, int begin1, int end1, int dbegin, OP_TYPE op = OP_DIFF)
+	{
+		DIFFRANGE dr;
+		dr.begin[0] = begin0;
+		dr.end[0] = end0;
+		dr.begin[1] = begin1;
+		dr.end[1] = end1;
+		dr.dbegin = dbegin;
+		dr.op = op;
+		int nmaxline = (std::max)(end0 - begin0, end1 - begin1) + 1;
+		dr.dend = dbegin + nmaxline - 1;
+		if (end0 - begin0 + 1 < nmaxline)
+			dr.blank[0] = dr.dend + 1 - (nmaxline - (end0 - begin0 + 1));
+		if (end1 - begin1 + 1 < nmaxline)
+			dr.blank[1] = dr.dend + 1 - (nmaxline - (end1 - begin1 + 1));
+		return dr;
+	}
+
+	bool SameDiff(const DIFFRANGE& dr1, const DIFFRANGE& dr2)
+	{
+		for (int file = 0; file < 2; ++file)
+		{
+			if (dr1.begin[file] != dr2.begin[file] || dr1.end[file] != dr2.end[file] ||
+				dr1.blank[file] != dr2.blank[file])
+				return false;
+		}
+		return dr1.dbegin == dr2.dbegin && dr1.dend == dr2.dend && dr1.op == dr2.op;
+	}
+
+	/**
+	 * @brief Set synchronised lines of some diffs of two files.
+	 * Ghost lines are added after the shorter side of each diff, like
+	 * CMergeDoc::PrimeDiffRanges() does.
+	 * @param [in] nShift Synchronised line minus real line of the first file
+	 * before the diffs.
+	 */
+	void LayOut(DiffList& list, int nFirstDiff, int nDiffs, int nShift)
+	{
+		for (int nDiff = nFirstDiff; nDiff < nFirstDiff + nDiffs; ++nDiff)
+		{
+			DIFFRANGE dr;
+			list.GetDiff(nDiff, dr);
+			dr = MakeDiff(dr.begin[0], dr.end[0], dr.begin[1], dr.end[1], dr.begin[0] + nShift, dr.op);
+			list.SetDiff(nDiff, dr);
+			nShift = dr.dend - dr.end[0];
+		}
+	}
+
+	/**
+	 * @brief Diff lines of two files with diffutils.
+	 * @return Diffs with lines counted from the first lines diffed.
+	 */
+	DiffList DiffLines(const std::vector<std::string>& a, size_t begin0, size_t end0,
+		const std::vector<std::string>& b, size_t begin1, size_t end1)
+	{
+		TempFile left("_DiffList_left.txt", a, begin0, end0);
+		TempFile right("_DiffList_right.txt", b, begin1, end1);
+		DiffutilsOptions options;
+		options.SetToDiffUtils();
+
+		file_data inf[2];
+		memset(inf, 0, sizeof(inf));
+		inf[0].desc = _open(left.m_filename.c_str(),  O_RDONLY | O_BINARY, _S_IREAD);
+		inf[1].desc = _open(right.m_filename.c_str(), O_RDONLY | O_BINARY, _S_IREAD);
+		_fstat(inf[0].desc, &inf[0].stat);
+		_fstat(inf[1].desc, &inf[1].stat);
+
+		int bin_status = 0, bin_file = 0;
+		struct change *script = diff_2_files(inf, 0, &bin_status, false, &bin_file);
+		DiffList list;
+		struct change *p;
+		for (struct change *e = script; e; e = p)
+		{
+			// Script lines do not count the identical prefix skipped by diffutils
+			DIFFRANGE dr;
+			dr.begin[0] = e->line0 + inf[0].prefix_lines;
+			dr.end[0] = dr.begin[0] + e->deleted - 1;
+			dr.begin[1] = e->line1 + inf[1].prefix_lines;
+			dr.end[1] = dr.begin[1] + e->inserted - 1;
+			dr.op = OP_DIFF;
+			list.AddDiff(dr);
+			p = e->link;
+			free(e);
+		}
+		cleanup_file_buffers(inf);
+		_close(inf[0].desc);
+		_close(inf[1].desc);
+		return list;
+	}
+
+	/**
+	 * @brief Return synchronised line of a real line of a file.
+	 * @param [in] nRealLine Real line, or the line count.
+	 */
+	int RealToApparent(const DiffList& list, int file, int nRealLine)
+	{
+		int nShift = 0;
+		for (int nDiff = 0; nDiff < list.GetSize(); ++nDiff)
+		{
+			const DIFFRANGE *dr = list.DiffRangeAt(nDiff);
+			if (dr->begin[file] > nRealLine)
+				break;
+			if (nRealLine <= dr->end[file])
+				return dr->dbegin + nRealLine - dr->begin[file];
+			nShift = dr->dend - dr->end[file];
+		}
+		return nRealLine + nShift;
+	}
+
+	/**
+	 * @brief Return real line of a synchronised line of a file.
+	 * @param [in] nLine Synchronised line, not in a diff.
+	 */
+	int ApparentToReal(const DiffList& list, int file, int nLine)
+	{
+		int nShift = 0;
+		for (int nDiff = 0; nDiff < list.GetSize(); ++nDiff)
+		{
+			const DIFFRANGE *dr = list.DiffRangeAt(nDiff);
+			if (dr->dbegin >= nLine)
+				break;
+			nShift = dr->dend - dr->end[file];
+		}
+		return nLine - nShift;
+	}
+
+	/**
+	 * @brief Replace and insert lines at random.
+	 * New lines are found nowhere else, unless bRepeated is set: then they
+	 * are braces and blank lines, which are found all over the files.
+	 */
+	std::vector<std::string> Edit(const std::vector<std::string>& lines, size_t begin, size_t end,
+		std::mt19937& rnd, int& nNew, bool bRepeated = false)
+	{
+		static const char *const repeated[] = { "{", "}", "" };
+		char buf[32];
+		std::vector<std::string> out(lines.begin(), lines.begin() + begin);
+		for (size_t i = begin; i < end; )
+		{
+			switch (rnd() % 8)
+			{
+			case 0:
+				i = (std::min)(i + 1 + rnd() % 3, end);
+				break;
+			case 1:
+				for (int j = 1 + rnd() % 3; j > 0; --j)
+				{
+					if (bRepeated)
+					{
+						out.push_back(repeated[rnd() % 3]);
+						continue;
+					}
+					sprintf(buf, "new %d", nNew++);
+					out.push_back(buf);
+				}
+				break;
+			default:
+				out.push_back(lines[i++]);
+				break;
+			}
+		}
+		out.insert(out.end(), lines.begin() + end, lines.end());
+		return out;
+	}
+
+	/**
+	 * @brief Rediff edited lines and put their diffs in the diff list.
+	 * Lines to rediff are found by DiffList::GetEditedRange() from the
+	 * lines edited, and their diffs replace the old ones, like
+	 * CMergeDoc::GetEditedRange() and CMergeDoc::PrimeEditedLines() do for
+	 * unforced rescans. Synchronised lines are mapped to real lines by the
+	 * diffs, where CMergeDoc counts the ghost lines of its buffers.
+	 * @param [in,out] list Diffs of lines, laid out by LayOut().
+	 * @param [in] lines Lines of both files at last rescan.
+	 * @param [in] edited Lines of both files now.
+	 * @param [in] nEditBegin First real line edited in each file.
+	 * @param [in] nEditEnd Real line after the last line edited in each
+	 * file, counted as at last rescan.
+	 * @return Change of synchronised line count.
+	 */
+	int RediffEditedLines(DiffList& list, const std::vector<std::string> lines[2],
+		const std::vector<std::string> edited[2], const size_t nEditBegin[2], const size_t nEditEnd[2])
+	{
+		const int nOldLines = RealToApparent(list, 0, static_cast<int>(lines[0].size()));
+		int nFirstEdited[2], nLinesAfterEdited[2], nRescannedLines[2], nLines[2];
+		int delta[3] = { 0 };
+		for (int file = 0; file < 2; ++file)
+		{
+			delta[file] = static_cast<int>(edited[file].size()) - static_cast<int>(lines[file].size());
+			nFirstEdited[file] = INT_MAX;
+			nLinesAfterEdited[file] = INT_MAX;
+			if (edited[file] != lines[file])
+			{
+				nFirstEdited[file] = RealToApparent(list, file, static_cast<int>(nEditBegin[file]));
+				nLinesAfterEdited[file] = nOldLines - RealToApparent(list, file, static_cast<int>(nEditEnd[file]));
+			}
+			nRescannedLines[file] = nOldLines;
+			nLines[file] = nOldLines + delta[file];
+		}
+
+		int nBegin, nEnd[2], nFirstDiff, nDiffs;
+		if (!list.GetEditedRange(2, nFirstEdited, nLinesAfterEdited, nRescannedLines, nLines,
+				nBegin, nEnd, nFirstDiff, nDiffs))
+			return 0;
+		int offset[3] = { 0 }, end[2];
+		for (int file = 0; file < 2; ++file)
+		{
+			offset[file] = ApparentToReal(list, file, nBegin);
+			end[file] = ApparentToReal(list, file, nEnd[file] - delta[file]) + delta[file];
+		}
+
+		DiffList diffs = DiffLines(edited[0], offset[0], end[0], edited[1], offset[1], end[1]);
+		int extras[3] = { 0 };
+		diffs.GetExtraLinesCounts(2, extras);
+		const int ddelta = (end[0] - offset[0] + extras[0]) - (nEnd[0] - delta[0] - nBegin);
+		list.ReplaceDiffs(nFirstDiff, nDiffs, diffs, offset, delta, ddelta);
+		LayOut(list, nFirstDiff, diffs.GetSize(), nBegin - offset[0]);
+		return ddelta;
+	}
+
+	/**
+	 * @brief Check that diffs are a valid diff of two files.
+	 * Diffs are in order, with a matched line between any two of them, the
+	 * lines between them are the same in both files, and they are laid out
+	 * as if the list was laid out from scratch.
+	 */
+	void ExpectValidDiff(const DiffList& list, const std::vector<std::string>& a,
+		const std::vector<std::string>& b, int n)
+	{
+		size_t line0 = 0, line1 = 0;
+		for (int nDiff = 0; nDiff <= list.GetSize(); ++nDiff)
+		{
+			size_t begin0 = a.size(), begin1 = b.size();
+			if (nDiff < list.GetSize())
+			{
+				const DIFFRANGE *dr = list.DiffRangeAt(nDiff);
+				begin0 = dr->begin[0];
+				begin1 = dr->begin[1];
+				EXPECT_TRUE(dr->end[0] >= dr->begin[0] || dr->end[1] >= dr->begin[1]) << "files " << n << ", diff " << nDiff;
+				if (nDiff > 0)
+					EXPECT_LT(line0, begin0) << "files " << n << ", diff " << nDiff;
+			}
+			ASSERT_EQ(begin0 - line0, begin1 - line1) << "files " << n << ", diff " << nDiff;
+			for (; line0 < begin0; ++line0, ++line1)
+				EXPECT_EQ(a[line0], b[line1]) << "files " << n << ", diff " << nDiff;
+			if (nDiff < list.GetSize())
+			{
+				line0 = list.DiffRangeAt(nDiff)->end[0] + 1;
+				line1 = list.DiffRangeAt(nDiff)->end[1] + 1;
+			}
+		}
+
+		DiffList laidOut = list;
+		LayOut(laidOut, 0, laidOut.GetSize(), 0);
+		for (int nDiff = 0; nDiff < list.GetSize(); ++nDiff)
+			EXPECT_TRUE(SameDiff(*laidOut.DiffRangeAt(nDiff), *list.DiffRangeAt(nDiff))) << "files " << n << ", diff " << nDiff;
+	}
+
+	// The fixture for testing DiffList class.
+	class DiffListTest : public testing::Test
+	{
+	protected:
+		DiffListTest()
+		{
+		}
+
+		virtual ~DiffListTest()
+		{
+		}
+
+		virtual void SetUp()
+		{
+		}
+
+		virtual void TearDown()
+		{
+		}
+	};
+
+	TEST_F(DiffListTest, ReplaceDiffsMovesLaterDiffs)
+	{
+		DiffList list;
+		list.AddDiff(MakeDiff(2, 3, 2, 2, 2));
+		list.AddDiff(MakeDiff(10, 10, 9, 11, 10));
+		list.AddDiff(MakeDiff(20, 19, 21, 22, 22));
+
+		// Lines from line 8 of the first file and line 7 of the second one
+		// were rediffed, after adding a line to the first file and two lines
+		// to the second one
+		DiffList edited;
+		edited.AddDiff(MakeDiff(1, 1, 1, 3, 1, OP_TRIVIAL));
+		edited.AddDiff(MakeDiff(4, 5, 6, 5, 6));
+		const int offset[3] = { 8, 7, 0 };
+		const int delta[3] = { 1, 2, 0 };
+		list.ReplaceDiffs(1, 1, edited, offset, delta, 3);
+
+		ASSERT_EQ(4, list.GetSize());
+		EXPECT_TRUE(SameDiff(MakeDiff(2, 3, 2, 2, 2), *list.DiffRangeAt(0)));
+		// Inserted diffs are moved to their lines, and laid out by the caller
+		const DIFFRANGE *dr = list.DiffRangeAt(1);
+		EXPECT_EQ(9, dr->begin[0]);
+		EXPECT_EQ(9, dr->end[0]);
+		EXPECT_EQ(8, dr->begin[1]);
+		EXPECT_EQ(10, dr->end[1]);
+		EXPECT_EQ(OP_TRIVIAL, dr->op);
+		dr = list.DiffRangeAt(2);
+		EXPECT_EQ(12, dr->begin[0]);
+		EXPECT_EQ(13, dr->end[0]);
+		EXPECT_EQ(13, dr->begin[1]);
+		EXPECT_EQ(12, dr->end[1]);
+		// Diffs after them are moved by the change of line counts
+		EXPECT_TRUE(SameDiff(MakeDiff(21, 20, 23, 24, 25), *list.DiffRangeAt(3)));
+		EXPECT_EQ(-1, list.DiffRangeAt(3)->blank[1]);
+	}
+
+	TEST_F(DiffListTest, ReplaceDiffsInsertsAndRemoves)
+	{
+		DiffList list;
+		list.AddDiff(MakeDiff(5, 5, 5, 4, 5));
+
+		// New diffs where there were none
+		DiffList edited;
+		edited.AddDiff(MakeDiff(0, 0, 0, 0, 0));
+		const int offset[3] = { 1, 1, 0 };
+		const int delta[3] = { 0, 0, 0 };
+		list.ReplaceDiffs(0, 0, edited, offset, delta, 0);
+		ASSERT_EQ(2, list.GetSize());
+		EXPECT_EQ(1, list.DiffRangeAt(0)->begin[0]);
+		EXPECT_EQ(1, list.DiffRangeAt(0)->begin[1]);
+		EXPECT_TRUE(SameDiff(MakeDiff(5, 5, 5, 4, 5), *list.DiffRangeAt(1)));
+
+		// No diffs where there were some
+		DiffList none;
+		const int offset2[3] = { 3, 3, 0 };
+		const int delta2[3] = { -1, 0, 0 };
+		list.ReplaceDiffs(1, 1, none, offset2, delta2, -1);
+		ASSERT_EQ(1, list.GetSize());
+		EXPECT_EQ(1, list.DiffRangeAt(0)->begin[0]);
+
+		// Diffs of the last lines removed
+		list.ReplaceDiffs(0, 1, none, offset, delta, 0);
+		EXPECT_EQ(0, list.GetSize());
+	}
+
+	TEST_F(DiffListTest, WidenToDiffs)
+	{
+		DiffList list;
+		list.AddDiff(MakeDiff(2, 3, 2, 2, 2));
+		list.AddDiff(MakeDiff(10, 10, 9, 11, 10));
+		list.AddDiff(MakeDiff(14, 13, 15, 15, 16));
+
+		// Lines between diffs stay as they are
+		int nBegin = 5, nEnd = 8, nFirstDiff = -1, nDiffs = -1;
+		list.WidenToDiffs(nBegin, nEnd, nFirstDiff, nDiffs);
+		EXPECT_EQ(5, nBegin);
+		EXPECT_EQ(8, nEnd);
+		EXPECT_EQ(1, nFirstDiff);
+		EXPECT_EQ(0, nDiffs);
+
+		// Lines next to and in diffs are widened to whole diffs
+		nBegin = 4;
+		nEnd = 11;
+		list.WidenToDiffs(nBegin, nEnd, nFirstDiff, nDiffs);
+		EXPECT_EQ(2, nBegin);
+		EXPECT_EQ(13, nEnd);
+		EXPECT_EQ(0, nFirstDiff);
+		EXPECT_EQ(2, nDiffs);
+
+		// Lines just after a diff take the diff in, it may grow
+		nBegin = 17;
+		nEnd = 17;
+		list.WidenToDiffs(nBegin, nEnd, nFirstDiff, nDiffs);
+		EXPECT_EQ(16, nBegin);
+		EXPECT_EQ(17, nEnd);
+		EXPECT_EQ(2, nFirstDiff);
+		EXPECT_EQ(1, nDiffs);
+	}
+
+	/**
+	 * Edit both files, rediff only the edited lines widened to whole diffs
+	 * and put their diffs in the diff list. New lines are found nowhere else,
+	 * so there is only one longest common subsequence of old and new lines,
+	 * and the diffs must be those of all lines.
+	 */
+	TEST_F(DiffListTest, RediffEditedLinesSameAsAllLines)
+	{
+		std::mt19937 rnd(1);
+		char buf[32];
+		int nNew = 0;
+		for (int n = 0; n < 200; ++n)
+		{
+			std::vector<std::string> a;
+			for (int i = 0; i < 50 + n; ++i)
+			{
+				sprintf(buf, "line %d", i);
+				a.push_back(buf);
+			}
+			std::vector<std::string> lines[2] = { a, Edit(a, 0, a.size(), rnd, nNew) };
+			// Edits never reach the last line
+			for (int file = 0; file < 2; ++file)
+				lines[file].push_back("last");
+
+			DiffList list = DiffLines(lines[0], 0, lines[0].size(), lines[1], 0, lines[1].size());
+			LayOut(list, 0, list.GetSize(), 0);
+			const int nOldLines = RealToApparent(list, 0, static_cast<int>(lines[0].size()));
+
+			std::vector<std::string> edited[2];
+			size_t nEditBegin[2], nEditEnd[2];
+			for (int file = 0; file < 2; ++file)
+			{
+				const size_t nLines = lines[file].size() - 1;
+				nEditBegin[file] = rnd() % nLines;
+				nEditEnd[file] = nEditBegin[file] + rnd() % (nLines - nEditBegin[file]);
+				edited[file] = (file == 1 || n % 2 == 0) ?
+					Edit(lines[file], nEditBegin[file], nEditEnd[file], rnd, nNew) : lines[file];
+			}
+			const int ddelta = RediffEditedLines(list, lines, edited, nEditBegin, nEditEnd);
+
+			DiffList all = DiffLines(edited[0], 0, edited[0].size(), edited[1], 0, edited[1].size());
+			LayOut(all, 0, all.GetSize(), 0);
+			ASSERT_EQ(all.GetSize(), list.GetSize()) << "files " << n;
+			for (int nDiff = 0; nDiff < all.GetSize(); ++nDiff)
+				EXPECT_TRUE(SameDiff(*all.DiffRangeAt(nDiff), *list.DiffRangeAt(nDiff))) << "files " << n << ", diff " << nDiff;
+			EXPECT_EQ(RealToApparent(all, 0, static_cast<int>(edited[0].size())), nOldLines + ddelta) << "files " << n;
+		}
+	}
+
+	/**
+	 * Like RediffEditedLinesSameAsAllLines, but files have braces and blank
+	 * lines all over, and edits add more of them. Lines just before and after
+	 * the rediffed lines stay matched as they were, where diffing all lines
+	 * may match them to other lines of the same text, so the diffs are not
+	 * always those of all lines. They must be a valid diff of the files.
+	 */
+	TEST_F(DiffListTest, RediffEditedRepeatedLinesIsValidDiff)
+	{
+		std::mt19937 rnd(2);
+		char buf[32];
+		int nNew = 0;
+		for (int n = 0; n < 200; ++n)
+		{
+			std::vector<std::string> a;
+			for (int i = 0; i < 50 + n; ++i)
+			{
+				switch (i % 6)
+				{
+				case 2: a.push_back("{"); break;
+				case 4: a.push_back("}"); break;
+				case 5: a.push_back(""); break;
+				default:
+					sprintf(buf, "line %d", i);
+					a.push_back(buf);
+					break;
+				}
+			}
+			std::vector<std::string> lines[2] = { a, Edit(a, 0, a.size(), rnd, nNew, true) };
+			// Edits never reach the last line
+			for (int file = 0; file < 2; ++file)
+				lines[file].push_back("last");
+
+			DiffList list = DiffLines(lines[0], 0, lines[0].size(), lines[1], 0, lines[1].size());
+			LayOut(list, 0, list.GetSize(), 0);
+			const int nOldLines = RealToApparent(list, 0, static_cast<int>(lines[0].size()));
+
+			std::vector<std::string> edited[2];
+			size_t nEditBegin[2], nEditEnd[2];
+			for (int file = 0; file < 2; ++file)
+			{
+				const size_t nLines = lines[file].size() - 1;
+				nEditBegin[file] = rnd() % nLines;
+				nEditEnd[file] = nEditBegin[file] + rnd() % (nLines - nEditBegin[file]);
+				edited[file] = (file == 1 || n % 2 == 0) ?
+					Edit(lines[file], nEditBegin[file], nEditEnd[file], rnd, nNew, true) : lines[file];
+			}
+			const int ddelta = RediffEditedLines(list, lines, edited, nEditBegin, nEditEnd);
+
+			ExpectValidDiff(list, edited[0], edited[1], n);
+			EXPECT_EQ(RealToApparent(list, 0, static_cast<int>(edited[0].size())), nOldLines + ddelta) << "files " << n;
+		}
+	}
+
+}  // namespace
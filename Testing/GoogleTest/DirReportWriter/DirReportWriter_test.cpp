@@ -0,0 +1,338 @@
+#include <gtest/gtest.h>
+#include <string>
+#include <vector>
+#include <map>
+#include <cstdio>
+#include <cstdlib>
+#include <cctype>
+#include <Poco/FileStream.h>
+#include <Poco/StreamCopier.h>
+#include <Poco/DOM/DOMParser.h>
+#include <Poco/DOM/Document.h>
+#include <Poco/DOM/Element.h>
+#include <Poco/DOM/NodeList.h>
+#include <Poco/DOM/AutoPtr.h>
+#include "DirReportWriter.h"
+#include "DiffContext.h"
+#include "DiffItem.h"
+#include "DiffWrapper.h"
+#include "PathContext.h"
+#include "Environment.h"
+#include "paths.h"
+#include "unicoder.h"
+
+namespace
+{
+	/** @brief Item written to reports, with its path as read back. */
+	struct TestItem
+	{
+		const TCHAR *path;
+		const TCHAR *filename;
+		const char *expected; /**< Path in UTF-8 */
+		const char *expectedXml; /**< Path in UTF-8 where XML differs */
+	};
+
+	const TestItem TestItems[] =
+	{
+		{ _T(""), _T("plain.txt"), "plain.txt", NULL },
+		{ _T(""), _T("comma, \"quote\".txt"), "comma, \"quote\".txt", NULL },
+		{ _T(""), _T("a&b<c>'d'.txt"), "a&b<c>'d'.txt", NULL },
+		{ _T("sub"), _T("file.txt"), "sub\\file.txt", NULL },
+		{ _T(""), _T("line\r\nbreak\ttab"), "line\r\nbreak\ttab", NULL },
+		{ _T(""), _T("ctrl\x01\x1f"), "ctrl\x01\x1f", "ctrl\xEF\xBF\xBD\xEF\xBF\xBD" },
+		{ _T(""), _T("\x00e4\x20ac\xd834\xdd1e"), "\xC3\xA4\xE2\x82\xAC\xF0\x9D\x84\x9E", NULL },
+		{ _T(""), _T("bad\xd800.txt"), "bad\xEF\xBF\xBD.txt", NULL },
+	};
+	const size_t TestItemCount = sizeof(TestItems) / sizeof(TestItems[0]);
+
+	std::string ReadFile(const String& path)
+	{
+		Poco::FileInputStream in(ucr::toUTF8(path), std::ios::in | std::ios::binary);
+		std::string text;
+		Poco::StreamCopier::copyToString(in, text);
+		return text;
+	}
+
+	/** @brief Split CSV text to rows of fields as in RFC 4180. */
+	std::vector<std::vector<std::string> > ParseCsv(const std::string& text)
+	{
+		std::vector<std::vector<std::string> > rows;
+		std::vector<std::string> row;
+		std::string field;
+		bool bInQuotes = false;
+		for (size_t i = 0; i < text.length(); ++i)
+		{
+			const char c = text[i];
+			if (bInQuotes)
+			{
+				if (c != '"')
+					field += c;
+				else if (i + 1 < text.length() && text[i + 1] == '"')
+					field += text[++i];
+				else
+					bInQuotes = false;
+			}
+			else if (c == '"')
+				bInQuotes = true;
+			else if (c == ',')
+			{
+				row.push_back(field);
+				field.clear();
+			}
+			else if (c == '\r' && i + 1 < text.length() && text[i + 1] == '\n')
+			{
+				row.push_back(field);
+				rows.push_back(row);
+				row.clear();
+				field.clear();
+				++i;
+			}
+			else
+				field += c;
+		}
+		return rows;
+	}
+
+	void AppendUTF8(std::string& str, unsigned ch)
+	{
+		if (ch < 0x80)
+			str += static_cast<char>(ch);
+		else if (ch < 0x800)
+		{
+			str += static_cast<char>(0xc0 | (ch >> 6));
+			str += static_cast<char>(0x80 | (ch & 0x3f));
+		}
+		else if (ch < 0x10000)
+		{
+			str += static_cast<char>(0xe0 | (ch >> 12));
+			str += static_cast<char>(0x80 | ((ch >> 6) & 0x3f));
+			str += static_cast<char>(0x80 | (ch & 0x3f));
+		}
+		else
+		{
+			str += static_cast<char>(0xf0 | (ch >> 18));
+			str += static_cast<char>(0x80 | ((ch >> 12) & 0x3f));
+			str += static_cast<char>(0x80 | ((ch >> 6) & 0x3f));
+			str += static_cast<char>(0x80 | (ch & 0x3f));
+		}
+	}
+
+	/**
+	 * @brief Parse one JSON object of strings and numbers.
+	 * @return Values by name, strings unescaped, or empty map if the line
+	 * is not valid.
+	 */
+	std::map<std::string, std::string> ParseJsonLine(const std::string& line)
+	{
+		std::map<std::string, std::string> values;
+		size_t i = 0;
+		std::string tokens[2];
+		if (line.empty() || line[i++] != '{')
+			return values;
+		for (;;)
+		{
+			for (int t = 0; t < 2; ++t)
+			{
+				std::string& token = tokens[t];
+				token.clear();
+				if (i < line.length() && line[i] == '"')
+				{
+					for (++i; i < line.length() && line[i] != '"'; ++i)
+					{
+						if (static_cast<unsigned char>(line[i]) < 0x20)
+							return std::map<std::string, std::string>();
+						if (line[i] != '\\')
+						{
+							token += line[i];
+							continue;
+						}
+						if (++i == line.length())
+							return std::map<std::string, std::string>();
+						switch (line[i])
+						{
+						case '"': case '\\': case '/': token += line[i]; break;
+						case 'b': token += '\b'; break;
+						case 'f': token += '\f'; break;
+						case 'n': token += '\n'; break;
+						case 'r': token += '\r'; break;
+						case 't': token += '\t'; break;
+						case 'u':
+							if (i + 4 >= line.length())
+								return std::map<std::string, std::string>();
+							AppendUTF8(token, static_cast<unsigned>(strtoul(line.substr(i + 1, 4).c_str(), NULL, 16)));
+							i += 4;
+							break;
+						default:
+							return std::map<std::string, std::string>();
+						}
+					}
+					if (i++ == line.length())
+						return std::map<std::string, std::string>();
+				}
+				else if (t == 1)
+				{
+					while (i < line.length() && (isdigit(static_cast<unsigned char>(line[i])) || line[i] == '-'))
+						token += line[i++];
+					if (token.empty())
+						return std::map<std::string, std::string>();
+				}
+				else
+					return std::map<std::string, std::string>();
+				if (t == 0 && (i == line.length() || line[i++] != ':'))
+					return std::map<std::string, std::string>();
+			}
+			values[tokens[0]] = tokens[1];
+			if (i < line.length() && line[i] == ',')
+				++i;
+			else if (i + 1 == line.length() && line[i] == '}')
+				return values;
+			else
+				return std::map<std::string, std::string>();
+		}
+	}
+
+	// The fixture for testing class DirReportWriter.
+	class DirReportWriterTest : public testing::Test
+	{
+	protected:
+		DirReportWriterTest()
+		: m_ctxt(PathContext(_T("C:\\left & <dir>"), _T("C:\\right")), CMP_CONTENT)
+		{
+		}
+
+		virtual ~DirReportWriterTest()
+		{
+		}
+
+		virtual void SetUp()
+		{
+			for (size_t i = 0; i < TestItemCount; ++i)
+			{
+				DIFFITEM *di = m_ctxt.AddDiff(NULL);
+				for (int nIndex = 0; nIndex < 2; ++nIndex)
+				{
+					di->diffFileInfo[nIndex].path = TestItems[i].path;
+					di->diffFileInfo[nIndex].filename = TestItems[i].filename;
+					di->diffFileInfo[nIndex].size = 10 * i + nIndex;
+					di->diffFileInfo[nIndex].mtime = Poco::Timestamp(1462710600LL * 1000000);
+				}
+				if (i == 0)
+				{
+					di->diffcode.diffcode = DIFFCODE::FILE | DIFFCODE::TEXT | DIFFCODE::BOTH | DIFFCODE::DIFF;
+					di->nsdiffs = 2;
+					di->nidiffs = 1;
+				}
+				else
+					di->diffcode.diffcode = DIFFCODE::FILE | DIFFCODE::TEXT | DIFFCODE::BOTH | DIFFCODE::SAME;
+			}
+		}
+
+		virtual void TearDown()
+		{
+			remove(ucr::toUTF8(m_sReportFile).c_str());
+		}
+
+		std::string WriteReport(DirReportWriter::Format format, const TCHAR *pszExt)
+		{
+			m_sReportFile = paths_ConcatPath(env_GetTempPath(), String(_T("DirReportWriter_test")) + pszExt);
+			DirReportWriter writer;
+			EXPECT_TRUE(writer.Open(m_sReportFile, format, &m_ctxt));
+			writer.WriteAll();
+			EXPECT_EQ(static_cast<int64_t>(TestItemCount), writer.GetItemCount());
+			EXPECT_TRUE(writer.Close());
+			return ReadFile(m_sReportFile);
+		}
+
+		CDiffContext m_ctxt;
+		String m_sReportFile;
+	};
+
+	TEST_F(DirReportWriterTest, FormatFromFilename)
+	{
+		DirReportWriter::Format format;
+		EXPECT_TRUE(DirReportWriter::GetFormatFromFilename(_T("C:\\report.CSV"), format));
+		EXPECT_EQ(DirReportWriter::FORMAT_CSV, format);
+		EXPECT_TRUE(DirReportWriter::GetFormatFromFilename(_T("report.xml"), format));
+		EXPECT_EQ(DirReportWriter::FORMAT_XML, format);
+		EXPECT_TRUE(DirReportWriter::GetFormatFromFilename(_T("report.jsonl"), format));
+		EXPECT_EQ(DirReportWriter::FORMAT_JSONL, format);
+		EXPECT_FALSE(DirReportWriter::GetFormatFromFilename(_T("report.json"), format));
+		EXPECT_FALSE(DirReportWriter::GetFormatFromFilename(_T("report"), format));
+	}
+
+	TEST_F(DirReportWriterTest, Csv)
+	{
+		std::vector<std::vector<std::string> > rows = ParseCsv(WriteReport(DirReportWriter::FORMAT_CSV, _T(".csv")));
+		ASSERT_EQ(TestItemCount + 1, rows.size());
+		const char *header[] = { "path", "type", "result", "differences", "ignored",
+			"left_size", "left_mtime", "right_size", "right_mtime" };
+		ASSERT_EQ(9u, rows[0].size());
+		for (size_t i = 0; i < rows[0].size(); ++i)
+			EXPECT_EQ(header[i], rows[0][i]);
+
+		for (size_t i = 0; i < TestItemCount; ++i)
+		{
+			const std::vector<std::string>& row = rows[i + 1];
+			ASSERT_EQ(9u, row.size());
+			EXPECT_EQ(TestItems[i].expected, row[0]);
+			EXPECT_EQ("file", row[1]);
+			EXPECT_EQ(i == 0 ? "different" : "identical", row[2]);
+			EXPECT_EQ(i == 0 ? "2" : "", row[3]);
+			EXPECT_EQ(i == 0 ? "1" : "", row[4]);
+			EXPECT_EQ(std::to_string(10 * i), row[5]);
+			EXPECT_EQ("2016-05-08T12:30:00Z", row[6]);
+			EXPECT_EQ(std::to_string(10 * i + 1), row[7]);
+			EXPECT_EQ("2016-05-08T12:30:00Z", row[8]);
+		}
+	}
+
+	TEST_F(DirReportWriterTest, Xml)
+	{
+		std::string text = WriteReport(DirReportWriter::FORMAT_XML, _T(".xml"));
+		Poco::XML::DOMParser parser;
+		Poco::XML::AutoPtr<Poco::XML::Document> pDoc;
+		ASSERT_NO_THROW(pDoc = parser.parseString(text));
+		Poco::XML::Element *pRoot = pDoc->documentElement();
+		ASSERT_TRUE(pRoot != NULL);
+		EXPECT_EQ("WinMergeFolderCompare", pRoot->tagName());
+		EXPECT_EQ(ucr::toUTF8(m_ctxt.GetNormalizedPath(0)), pRoot->getAttribute("left"));
+		EXPECT_EQ(ucr::toUTF8(m_ctxt.GetNormalizedPath(1)), pRoot->getAttribute("right"));
+
+		Poco::XML::AutoPtr<Poco::XML::NodeList> pItems = pRoot->getElementsByTagName("item");
+		ASSERT_EQ(TestItemCount, pItems->length());
+		for (size_t i = 0; i < TestItemCount; ++i)
+		{
+			Poco::XML::Element *pItem = static_cast<Poco::XML::Element *>(pItems->item(static_cast<unsigned long>(i)));
+			EXPECT_EQ(TestItems[i].expectedXml ? TestItems[i].expectedXml : TestItems[i].expected,
+				pItem->getAttribute("path"));
+			EXPECT_EQ("file", pItem->getAttribute("type"));
+			EXPECT_EQ(i == 0 ? "different" : "identical", pItem->getAttribute("result"));
+			// Unknown counts are left out
+			EXPECT_EQ(i == 0, pItem->hasAttribute("differences"));
+			EXPECT_EQ(std::to_string(10 * i + 1), pItem->getAttribute("right_size"));
+			EXPECT_EQ("2016-05-08T12:30:00Z", pItem->getAttribute("left_mtime"));
+		}
+	}
+
+	TEST_F(DirReportWriterTest, JsonLines)
+	{
+		std::string text = WriteReport(DirReportWriter::FORMAT_JSONL, _T(".jsonl"));
+		std::vector<std::string> lines;
+		for (size_t start = 0, end; (end = text.find('\n', start)) != std::string::npos; start = end + 1)
+			lines.push_back(text.substr(start, end - start));
+		ASSERT_EQ(TestItemCount, lines.size());
+
+		for (size_t i = 0; i < TestItemCount; ++i)
+		{
+			std::map<std::string, std::string> values = ParseJsonLine(lines[i]);
+			ASSERT_FALSE(values.empty()) << lines[i];
+			EXPECT_EQ(TestItems[i].expected, values["path"]);
+			EXPECT_EQ("file", values["type"]);
+			EXPECT_EQ(i == 0 ? "different" : "identical", values["result"]);
+			EXPECT_EQ(i == 0 ? 1u : 0u, values.count("ignored"));
+			EXPECT_EQ(std::to_string(10 * i), values["left_size"]);
+			EXPECT_EQ("2016-05-08T12:30:00Z", values["right_mtime"]);
+		}
+	}
+
+}  // namespace
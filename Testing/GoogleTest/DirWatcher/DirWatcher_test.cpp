@@ -0,0 +1,175 @@
+#include <gtest/gtest.h>
+#include <atomic>
+#include <algorithm>
+#include <Poco/File.h>
+#include <Poco/FileStream.h>
+#include <Poco/Thread.h>
+#include "DirWatcher.h"
+#include "PathContext.h"
+#include "Environment.h"
+#include "paths.h"
+#include "unicoder.h"
+
+namespace
+{
+	/** @brief Counts notifications from DirWatcher. */
+	struct Listener
+	{
+		Listener() : m_count(0) {}
+		void OnChange(int& state) { ++m_count; }
+
+		/// Wait until notified @p count times, or time out
+		bool WaitFor(int count, int timeout = 5000)
+		{
+			for (int waited = 0; m_count < count && waited < timeout; waited += 10)
+				Poco::Thread::sleep(10);
+			return m_count >= count;
+		}
+
+		std::atomic<int> m_count;
+	};
+
+	bool Contains(const std::vector<String>& changes, const String& path)
+	{
+		return std::find(changes.begin(), changes.end(), path) != changes.end();
+	}
+
+	// The fixture for testing class DirWatcher.
+	class DirWatcherTest : public testing::Test
+	{
+	protected:
+		DirWatcherTest()
+		{
+		}
+
+		virtual ~DirWatcherTest()
+		{
+		}
+
+		virtual void SetUp()
+		{
+			m_root = paths_ConcatPath(env_GetTempPath(), _T("DirWatcher_test"));
+			Poco::File(ucr::toUTF8(m_root)).createDirectories();
+			Poco::File(ucr::toUTF8(paths_ConcatPath(m_root, _T("sub")))).createDirectories();
+			WriteFile(_T("a.txt"), "a");
+			m_watcher.AddListener(&m_listener, &Listener::OnChange);
+		}
+
+		virtual void TearDown()
+		{
+			m_watcher.Stop();
+			m_watcher.RemoveListener(&m_listener, &Listener::OnChange);
+			Poco::File(ucr::toUTF8(m_root)).remove(true);
+		}
+
+		void WriteFile(const String& path, const std::string& data)
+		{
+			Poco::FileOutputStream out(ucr::toUTF8(paths_ConcatPath(m_root, path)));
+			out << data;
+		}
+
+		void RemoveFile(const String& path)
+		{
+			Poco::File(ucr::toUTF8(paths_ConcatPath(m_root, path))).remove();
+		}
+
+		void Start(bool bForcePolling)
+		{
+			m_watcher.SetForcePolling(bForcePolling);
+			m_watcher.Start(PathContext(m_root), 50);
+			// Let the watcher thread take its first listing
+			Poco::Thread::sleep(300);
+		}
+
+		String m_root;
+		DirWatcher m_watcher;
+		Listener m_listener;
+	};
+
+	TEST_F(DirWatcherTest, PollingDetectsChanges)
+	{
+		Start(true);
+		std::vector<String> changes[3];
+		bool bOverflow = true;
+		EXPECT_FALSE(m_watcher.GetChanges(changes, bOverflow));
+		EXPECT_FALSE(bOverflow);
+
+		// Added file
+		WriteFile(_T("new.txt"), "new");
+		ASSERT_TRUE(m_listener.WaitFor(1));
+		EXPECT_TRUE(m_watcher.GetChanges(changes, bOverflow));
+		EXPECT_FALSE(bOverflow);
+		EXPECT_TRUE(Contains(changes[0], _T("new.txt")));
+
+		// Changed size, in a subfolder
+		WriteFile(paths_ConcatPath(_T("sub"), _T("b.txt")), "b");
+		ASSERT_TRUE(m_listener.WaitFor(2));
+		EXPECT_TRUE(m_watcher.GetChanges(changes, bOverflow));
+		EXPECT_TRUE(Contains(changes[0], paths_ConcatPath(_T("sub"), _T("b.txt"))));
+		WriteFile(_T("a.txt"), "changed");
+		ASSERT_TRUE(m_listener.WaitFor(3));
+		EXPECT_TRUE(m_watcher.GetChanges(changes, bOverflow));
+		EXPECT_TRUE(Contains(changes[0], _T("a.txt")));
+
+		// Removed file
+		RemoveFile(_T("new.txt"));
+		ASSERT_TRUE(m_listener.WaitFor(4));
+		EXPECT_TRUE(m_watcher.GetChanges(changes, bOverflow));
+		EXPECT_TRUE(Contains(changes[0], _T("new.txt")));
+		EXPECT_FALSE(Contains(changes[0], _T("a.txt")));
+	}
+
+	TEST_F(DirWatcherTest, PollingCoalescesNotifications)
+	{
+		Start(true);
+		WriteFile(_T("1.txt"), "1");
+		ASSERT_TRUE(m_listener.WaitFor(1));
+
+		// No more notifications until the changes are taken
+		WriteFile(_T("2.txt"), "2");
+		Poco::Thread::sleep(300);
+		EXPECT_TRUE(m_watcher.HasChanges());
+		EXPECT_EQ(1, m_listener.m_count);
+
+		std::vector<String> changes[3];
+		bool bOverflow;
+		EXPECT_TRUE(m_watcher.GetChanges(changes, bOverflow));
+		EXPECT_TRUE(Contains(changes[0], _T("1.txt")));
+		EXPECT_TRUE(Contains(changes[0], _T("2.txt")));
+		EXPECT_FALSE(m_watcher.HasChanges());
+
+		WriteFile(_T("3.txt"), "3");
+		ASSERT_TRUE(m_listener.WaitFor(2));
+	}
+
+	TEST_F(DirWatcherTest, NotificationsSettle)
+	{
+		Start(false);
+		// A burst of changes is notified once, after it has settled
+		for (int i = 0; i < 10; ++i)
+			WriteFile(string_format(_T("%d.txt"), i), "x");
+		ASSERT_TRUE(m_listener.WaitFor(1));
+		Poco::Thread::sleep(500);
+		EXPECT_EQ(1, m_listener.m_count);
+
+		std::vector<String> changes[3];
+		bool bOverflow;
+		EXPECT_TRUE(m_watcher.GetChanges(changes, bOverflow));
+		if (!bOverflow)
+		{
+			for (int i = 0; i < 10; ++i)
+				EXPECT_TRUE(Contains(changes[0], string_format(_T("%d.txt"), i)));
+		}
+	}
+
+	TEST_F(DirWatcherTest, StopForgetsChanges)
+	{
+		Start(true);
+		WriteFile(_T("new.txt"), "new");
+		ASSERT_TRUE(m_listener.WaitFor(1));
+		m_watcher.Stop();
+		EXPECT_FALSE(m_watcher.IsStarted());
+		EXPECT_FALSE(m_watcher.HasChanges());
+	}
+
+}  // namespace
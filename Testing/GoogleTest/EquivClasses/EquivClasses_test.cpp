@@ -0,0 +1,389 @@
+#include <gtest/gtest.h>
+#include <io.h>
+#include <sys/stat.h>
+#include <fcntl.h>
+#include <fstream>
+#include <string>
+#include <vector>
+#include <random>
+#include <cstdio>
+#include <cstring>
+#include "diff.h"
+#include "CompareOptions.h"
+
+namespace
+{
+	struct TempFile
+	{
+		TempFile(const std::string& filename, const std::string& text) : m_filename(filename)
+		{
+			std::ofstream ostr(filename.c_str(), std::ios::out|std::ios::binary|std::ios::trunc);
+			ostr << text;
+		}
+		~TempFile()
+		{
+			remove(m_filename.c_str());
+		}
+		std::string m_filename;
+	};
+
+	/**
+	 * @brief Return length of a line as diffutils puts it in a class.
+	 */
+	size_t LineLength(const file_data& inf, int line)
+	{
+		const char *p = inf.linbuf[line + 1];
+		size_t length = p - inf.linbuf[line];
+		if (ignore_eol_diff)
+		{
+			if (length > 1 && p[-2] == '\r' && p[-1] == '\n')
+				length -= 2;
+			else if (p[-1] == '\n' || p[-1] == '\r')
+				--length;
+		}
+		return length;
+	}
+
+	/**
+	 * @brief Check equivalence classes diffutils found for the lines.
+	 * Each line is compared to one line of every class found so far, in
+	 * the order the classes were found, which is what the chained hash
+	 * table diffutils used to have did. So the class numbers must be the
+	 * same too.
+	 */
+	bool HasReferenceClasses(const file_data inf[])
+	{
+		std::vector<std::pair<const char *, size_t>> classes(1);
+		for (int f = 0; f < 2; ++f)
+		{
+			for (int i = 0; i < inf[f].buffered_lines; ++i)
+			{
+				const char *line = inf[f].linbuf[i];
+				size_t length = LineLength(inf[f], i);
+				size_t c;
+				for (c = 1; c < classes.size(); ++c)
+				{
+					if ((classes[c].second == length || length_varies) &&
+						!line_cmp(classes[c].first, classes[c].second, line, length))
+						break;
+				}
+				if (c == classes.size())
+					classes.push_back(std::make_pair(line, length));
+				if (inf[f].equivs[i] != static_cast<int>(c))
+					return false;
+			}
+		}
+		return inf[0].equiv_max == static_cast<int>(classes.size());
+	}
+
+	/**
+	 * @brief Diff two files with given options and check the classes of lines.
+	 * The lines of the left file may be shared with another diff of it.
+	 */
+	bool DiffHasReferenceClasses(const std::string& left, const std::string& right, DiffutilsOptions& options, shared_lines *shared = NULL)
+	{
+		options.SetToDiffUtils();
+
+		file_data inf[2];
+		memset(inf, 0, sizeof(inf));
+		inf[0].desc = _open(left.c_str(),  O_RDONLY | O_BINARY, _S_IREAD);
+		inf[1].desc = _open(right.c_str(), O_RDONLY | O_BINARY, _S_IREAD);
+		_fstat(inf[0].desc, &inf[0].stat);
+		_fstat(inf[1].desc, &inf[1].stat);
+		inf[0].shared = shared;
+
+		int bin_status = 0, bin_file = 0;
+		struct change *script = diff_2_files(inf, 0, &bin_status, false, &bin_file);
+		bool result = HasReferenceClasses(inf);
+		if (shared)
+			publish_shared_lines(shared);
+
+		struct change *p;
+		for (struct change *e = script; e; e = p)
+		{
+			p = e->link;
+			free(e);
+		}
+		cleanup_file_buffers(inf);
+		_close(inf[0].desc);
+		_close(inf[1].desc);
+		return result;
+	}
+
+	/**
+	 * @brief Generate text of lines differing in case, white space and EOLs.
+	 * There are no lines ending in a lone CR: white space before it is not
+	 * ignored the same way by hashing and line_cmp(), so such lines may be
+	 * in different classes though line_cmp() finds them equal.
+	 */
+	std::string Generate(std::mt19937& rnd, int lines)
+	{
+		const char *words[] = { "foo", "Foo", "FOO", "bar", "x", "", " ", "\t", "a b", "a  b", "a\tb" };
+		const char *spaces[] = { "", " ", "  ", "\t" };
+		const char *eols[] = { "\n", "\r\n" };
+		std::vector<std::string> pool(5 + rnd() % 200);
+		for (size_t i = 0; i < pool.size(); ++i)
+		{
+			for (int j = rnd() % 7; j > 0; --j)
+			{
+				pool[i] += words[rnd() % (sizeof(words) / sizeof(words[0]))];
+				pool[i] += spaces[rnd() % (sizeof(spaces) / sizeof(spaces[0]))];
+			}
+		}
+		std::string text;
+		for (int i = 0; i < lines; ++i)
+		{
+			std::string line = pool[rnd() % pool.size()];
+			if (rnd() % 10 == 0)
+				line = " " + line;
+			text += line + eols[rnd() % (sizeof(eols) / sizeof(eols[0]))];
+		}
+		return text;
+	}
+
+	/**
+	 * @brief Lines, classes, EOLs and changes diffutils found in two files.
+	 */
+	struct DiffLines
+	{
+		std::vector<size_t> offsets[2];
+		std::vector<int> equivs[2];
+		int equiv_max;
+		int count_crlfs[2], count_crs[2], count_lfs[2];
+		std::vector<int> changes;
+
+		bool operator==(const DiffLines& other) const
+		{
+			for (int f = 0; f < 2; ++f)
+			{
+				if (offsets[f] != other.offsets[f] || equivs[f] != other.equivs[f] ||
+					count_crlfs[f] != other.count_crlfs[f] || count_crs[f] != other.count_crs[f] ||
+					count_lfs[f] != other.count_lfs[f])
+					return false;
+			}
+			return equiv_max == other.equiv_max && changes == other.changes;
+		}
+	};
+
+	/**
+	 * @brief Diff two files and return what was found in them.
+	 * The lines of the left file may be shared with another diff of it.
+	 */
+	DiffLines DiffFiles(const std::string& left, const std::string& right, DiffutilsOptions& options, shared_lines *shared = NULL)
+	{
+		options.SetToDiffUtils();
+
+		file_data inf[2];
+		memset(inf, 0, sizeof(inf));
+		inf[0].desc = _open(left.c_str(),  O_RDONLY | O_BINARY, _S_IREAD);
+		inf[1].desc = _open(right.c_str(), O_RDONLY | O_BINARY, _S_IREAD);
+		_fstat(inf[0].desc, &inf[0].stat);
+		_fstat(inf[1].desc, &inf[1].stat);
+		inf[0].shared = shared;
+
+		int bin_status = 0, bin_file = 0;
+		struct change *script = diff_2_files(inf, 0, &bin_status, false, &bin_file);
+		if (shared)
+			publish_shared_lines(shared);
+
+		DiffLines result;
+		for (int f = 0; f < 2; ++f)
+		{
+			for (int i = 0; i <= inf[f].buffered_lines; ++i)
+				result.offsets[f].push_back(inf[f].linbuf[i] - inf[f].buffer);
+			result.equivs[f].assign(inf[f].equivs, inf[f].equivs + inf[f].buffered_lines);
+			result.count_crlfs[f] = inf[f].count_crlfs;
+			result.count_crs[f] = inf[f].count_crs;
+			result.count_lfs[f] = inf[f].count_lfs;
+		}
+		result.equiv_max = inf[0].equiv_max;
+
+		struct change *p;
+		for (struct change *e = script; e; e = p)
+		{
+			p = e->link;
+			result.changes.push_back(e->line0);
+			result.changes.push_back(e->line1);
+			result.changes.push_back(e->deleted);
+			result.changes.push_back(e->inserted);
+			free(e);
+		}
+		cleanup_file_buffers(inf);
+		_close(inf[0].desc);
+		_close(inf[1].desc);
+		return result;
+	}
+
+	/**
+	 * @brief Generate text of short lines ending in all kinds of EOLs.
+	 * Most EOLs are CRLFs, so pieces a file is split into for hashing
+	 * often would start between the CR and the LF of one.
+	 */
+	std::string GenerateEols(std::mt19937& rnd, int lines)
+	{
+		const char *words[] = { "a", "A", "b", "", " ", "\t", "a b", "a  b" };
+		const char *eols[] = { "\r\n", "\r\n", "\r\n", "\n", "\r", "\r\r\n", "\n\r" };
+		std::string text;
+		for (int i = 0; i < lines; ++i)
+		{
+			text += words[rnd() % (sizeof(words) / sizeof(words[0]))];
+			text += eols[rnd() % (sizeof(eols) / sizeof(eols[0]))];
+		}
+		if (rnd() % 2)
+			text += words[rnd() % (sizeof(words) / sizeof(words[0]))];
+		return text;
+	}
+
+	// The fixture for testing equivalence classes of lines in diffutils.
+	class EquivClassesTest : public testing::Test
+	{
+	protected:
+		EquivClassesTest()
+		{
+		}
+
+		virtual ~EquivClassesTest()
+		{
+		}
+
+		virtual void SetUp()
+		{
+		}
+
+		virtual void TearDown()
+		{
+		}
+	};
+
+	TEST_F(EquivClassesTest, SameAsReferenceForAllIgnoreOptions)
+	{
+		const enum WhitespaceIgnoreChoices whitespace[] = {
+			WHITESPACE_COMPARE_ALL, WHITESPACE_IGNORE_CHANGE, WHITESPACE_IGNORE_ALL
+		};
+		std::mt19937 rnd(1);
+		for (int n = 0; n < 20; ++n)
+		{
+			TempFile left("_EquivClasses_left.txt", Generate(rnd, 100 * (n + 1)));
+			TempFile right("_EquivClasses_right.txt", Generate(rnd, 100 * (n + 1)));
+			for (int w = 0; w < 3; ++w)
+			{
+				for (int flags = 0; flags < 4; ++flags)
+				{
+					DiffutilsOptions options;
+					options.m_ignoreWhitespace = whitespace[w];
+					options.m_bIgnoreCase = (flags & 1) != 0;
+					options.m_bIgnoreEOLDifference = (flags & 2) != 0;
+					EXPECT_TRUE(DiffHasReferenceClasses(left.m_filename, right.m_filename, options))
+						<< "files " << n << ", whitespace " << w << ", flags " << flags;
+				}
+			}
+		}
+	}
+
+	TEST_F(EquivClassesTest, SharedLinesOfMiddleFile)
+	{
+		const enum WhitespaceIgnoreChoices whitespace[] = {
+			WHITESPACE_COMPARE_ALL, WHITESPACE_IGNORE_CHANGE, WHITESPACE_IGNORE_ALL
+		};
+		std::mt19937 rnd(2);
+		for (int n = 0; n < 10; ++n)
+		{
+			TempFile middle("_EquivClasses_middle.txt", Generate(rnd, 200 * (n + 1)));
+			TempFile left("_EquivClasses_left.txt", Generate(rnd, 200 * (n + 1)));
+			TempFile right("_EquivClasses_right.txt", Generate(rnd, 200 * (n + 1)));
+			for (int w = 0; w < 3; ++w)
+			{
+				DiffutilsOptions options;
+				options.m_ignoreWhitespace = whitespace[w];
+				options.m_bIgnoreCase = (n & 1) != 0;
+				shared_lines shared;
+				init_shared_lines(&shared);
+				// The first diff finds the lines of the middle file, the second takes them
+				EXPECT_TRUE(DiffHasReferenceClasses(middle.m_filename, left.m_filename, options, &shared))
+					<< "files " << n << ", whitespace " << w;
+				EXPECT_TRUE(shared.text != NULL);
+				EXPECT_TRUE(DiffHasReferenceClasses(middle.m_filename, right.m_filename, options, &shared))
+					<< "files " << n << ", whitespace " << w;
+				free_shared_lines(&shared);
+			}
+		}
+	}
+
+	/**
+	 * Files are split into as many pieces as there are processors for
+	 * hashing, so this needs more than one to test anything.
+	 */
+	TEST_F(EquivClassesTest, SameForAnyHashChunkSize)
+	{
+		const size_t chunkMins[] = { 1, 2, 3, 5, 8, 13, 64, 1000 };
+		std::mt19937 rnd(3);
+		for (int n = 0; n < 30; ++n)
+		{
+			TempFile left("_EquivClasses_left.txt", GenerateEols(rnd, 1 + n * 37));
+			TempFile right("_EquivClasses_right.txt", GenerateEols(rnd, 1 + n * 41));
+			for (int flags = 0; flags < 4; ++flags)
+			{
+				DiffutilsOptions options;
+				options.m_ignoreWhitespace = (flags & 1) ? WHITESPACE_IGNORE_CHANGE : WHITESPACE_COMPARE_ALL;
+				options.m_bIgnoreEOLDifference = (flags & 2) != 0;
+				set_hash_chunk_min(0);
+				DiffLines whole = DiffFiles(left.m_filename, right.m_filename, options);
+				for (size_t c = 0; c < sizeof(chunkMins) / sizeof(chunkMins[0]); ++c)
+				{
+					set_hash_chunk_min(chunkMins[c]);
+					EXPECT_TRUE(DiffFiles(left.m_filename, right.m_filename, options) == whole)
+						<< "files " << n << ", flags " << flags << ", chunk " << chunkMins[c];
+				}
+			}
+		}
+		set_hash_chunk_min(0);
+	}
+
+	TEST_F(EquivClassesTest, SharedLinesSameForAnyHashChunkSize)
+	{
+		const size_t chunkMins[] = { 1, 3, 8, 64 };
+		std::mt19937 rnd(4);
+		for (int n = 0; n < 10; ++n)
+		{
+			TempFile middle("_EquivClasses_middle.txt", GenerateEols(rnd, 1 + n * 53));
+			TempFile left("_EquivClasses_left.txt", GenerateEols(rnd, 1 + n * 47));
+			TempFile right("_EquivClasses_right.txt", GenerateEols(rnd, 1 + n * 59));
+			DiffutilsOptions options;
+			options.m_bIgnoreEOLDifference = (n & 1) != 0;
+			set_hash_chunk_min(0);
+			DiffLines wholeLeft = DiffFiles(middle.m_filename, left.m_filename, options);
+			DiffLines wholeRight = DiffFiles(middle.m_filename, right.m_filename, options);
+			for (size_t c = 0; c < sizeof(chunkMins) / sizeof(chunkMins[0]); ++c)
+			{
+				set_hash_chunk_min(chunkMins[c]);
+				shared_lines shared;
+				init_shared_lines(&shared);
+				// The first diff finds the lines of the middle file, the second takes them
+				DiffLines sharedLeft = DiffFiles(middle.m_filename, left.m_filename, options, &shared);
+				DiffLines sharedRight = DiffFiles(middle.m_filename, right.m_filename, options, &shared);
+				EXPECT_TRUE(sharedLeft == wholeLeft) << "files " << n << ", chunk " << chunkMins[c];
+				EXPECT_TRUE(sharedRight == wholeRight) << "files " << n << ", chunk " << chunkMins[c];
+				free_shared_lines(&shared);
+			}
+		}
+		set_hash_chunk_min(0);
+	}
+
+	TEST_F(EquivClassesTest, UniqueLines)
+	{
+		std::string a, b;
+		char buf[32];
+		for (int i = 0; i < 3000; ++i)
+		{
+			sprintf(buf, "line %d\n", i);
+			a += buf;
+			sprintf(buf, "line %d\n", i * 7 % 3000);
+			b += buf;
+		}
+		TempFile left("_EquivClasses_left.txt", a);
+		TempFile right("_EquivClasses_right.txt", b);
+		DiffutilsOptions options;
+		EXPECT_TRUE(DiffHasReferenceClasses(left.m_filename, right.m_filename, options));
+	}
+
+}  // namespace
@@ -0,0 +1,145 @@
+#include <gtest/gtest.h>
+#include <string>
+#include <cstring>
+#include "FilterList.h"
+
+namespace
+{
+	// The fixture for testing class FilterList.
+	class FilterListTest : public testing::Test
+	{
+	protected:
+		FilterListTest()
+		{
+		}
+
+		virtual ~FilterListTest()
+		{
+		}
+
+		virtual void SetUp()
+		{
+		}
+
+		virtual void TearDown()
+		{
+		}
+
+		FilterList m_filterList;
+	};
+
+	TEST_F(FilterListTest, MatchAny)
+	{
+		m_filterList.AddRegExp("^// ");
+		m_filterList.AddRegExp("\\$Id: .*\\$");
+		m_filterList.AddRegExp("^#include");
+		EXPECT_TRUE(m_filterList.HasRegExps());
+
+		EXPECT_TRUE(m_filterList.Match(std::string("// comment")));
+		EXPECT_STREQ("^// ", m_filterList.GetLastMatchExpression());
+		EXPECT_TRUE(m_filterList.Match(std::string(" * $Id: FilterList.cpp 42 $")));
+		EXPECT_STREQ("\\$Id: .*\\$", m_filterList.GetLastMatchExpression());
+		EXPECT_TRUE(m_filterList.Match(std::string("#include <vector>")));
+		EXPECT_STREQ("^#include", m_filterList.GetLastMatchExpression());
+		EXPECT_FALSE(m_filterList.Match(std::string("int i; // comment")));
+		EXPECT_FALSE(m_filterList.Match(std::string("")));
+	}
+
+	TEST_F(FilterListTest, ExpressionsDontMix)
+	{
+		// Options and alternatives must stay in their own expression
+		m_filterList.AddRegExp("(?i)abc");
+		m_filterList.AddRegExp("^XYZ$");
+		m_filterList.AddRegExp("foo|bar");
+		m_filterList.AddRegExp("^end$");
+
+		EXPECT_TRUE(m_filterList.Match(std::string("xABCx")));
+		EXPECT_TRUE(m_filterList.Match(std::string("XYZ")));
+		EXPECT_FALSE(m_filterList.Match(std::string("xyz")));
+		EXPECT_TRUE(m_filterList.Match(std::string("a bar")));
+		EXPECT_STREQ("foo|bar", m_filterList.GetLastMatchExpression());
+		EXPECT_TRUE(m_filterList.Match(std::string("end")));
+		EXPECT_FALSE(m_filterList.Match(std::string("the end")));
+	}
+
+	TEST_F(FilterListTest, NotCombinedExpressions)
+	{
+		m_filterList.AddRegExp("^(\\w+) \\1$");
+		m_filterList.AddRegExp("^(?<word>\\w+)=(?P=word)$");
+		m_filterList.AddRegExp("(?x) ^ a b c $ # comment");
+		m_filterList.AddRegExp("\\Q(*)");
+		m_filterList.AddRegExp("^plain$");
+
+		EXPECT_TRUE(m_filterList.Match(std::string("again again")));
+		EXPECT_FALSE(m_filterList.Match(std::string("again once")));
+		EXPECT_TRUE(m_filterList.Match(std::string("x=x")));
+		EXPECT_FALSE(m_filterList.Match(std::string("x=y")));
+		EXPECT_TRUE(m_filterList.Match(std::string("abc")));
+		EXPECT_STREQ("(?x) ^ a b c $ # comment", m_filterList.GetLastMatchExpression());
+		EXPECT_TRUE(m_filterList.Match(std::string("f(*)")));
+		EXPECT_TRUE(m_filterList.Match(std::string("plain")));
+		EXPECT_STREQ("^plain$", m_filterList.GetLastMatchExpression());
+		EXPECT_FALSE(m_filterList.Match(std::string("plain abc")));
+	}
+
+	TEST_F(FilterListTest, InvalidExpression)
+	{
+		m_filterList.AddRegExp("^a");
+		m_filterList.AddRegExp("(b");
+		m_filterList.AddRegExp("c)");
+		m_filterList.AddRegExp("^d");
+
+		EXPECT_TRUE(m_filterList.Match(std::string("a")));
+		EXPECT_FALSE(m_filterList.Match(std::string("(b")));
+		EXPECT_TRUE(m_filterList.Match(std::string("d")));
+		EXPECT_STREQ("^a\n^d\n", m_filterList.GetAsString().c_str());
+	}
+
+	TEST_F(FilterListTest, ManyExpressions)
+	{
+		for (int i = 0; i < 200; ++i)
+			m_filterList.AddRegExp("^line " + std::to_string(i) + "$");
+
+		for (int i = 0; i < 200; ++i)
+		{
+			const std::string line = "line " + std::to_string(i);
+			EXPECT_TRUE(m_filterList.Match(line.c_str(), line.length()));
+			EXPECT_EQ("^" + line + "$", m_filterList.GetLastMatchExpression());
+		}
+		EXPECT_FALSE(m_filterList.Match(std::string("line 200")));
+
+		m_filterList.RemoveAllFilters();
+		EXPECT_FALSE(m_filterList.HasRegExps());
+		EXPECT_FALSE(m_filterList.Match(std::string("line 0")));
+	}
+
+	TEST_F(FilterListTest, MatchNotTerminated)
+	{
+		m_filterList.AddRegExp("^abc$");
+		const char text[] = "abcdef";
+		EXPECT_TRUE(m_filterList.Match(text, 3));
+		EXPECT_FALSE(m_filterList.Match(text, 6));
+	}
+
+	TEST_F(FilterListTest, MatchCache)
+	{
+		m_filterList.AddRegExp("^\\s*//");
+		FilterMatchCache cache;
+		const char text[] = "// a\n  // a\nint a;\n";
+		const char *lines[] = { text, text + 5, text + 12 };
+		const size_t lengths[] = { 4, 6, 6 };
+
+		EXPECT_TRUE(cache.Match(m_filterList, 1, lines[0], lengths[0], CP_UTF8));
+		EXPECT_TRUE(cache.Match(m_filterList, 1, lines[0], lengths[0], CP_UTF8));
+		// Same class but other text, as when whitespace is ignored
+		EXPECT_TRUE(cache.Match(m_filterList, 1, lines[1], lengths[1], CP_UTF8));
+		EXPECT_FALSE(cache.Match(m_filterList, 1, lines[2], lengths[2], CP_UTF8));
+		EXPECT_FALSE(cache.Match(m_filterList, 3, lines[2], lengths[2], CP_UTF8));
+		EXPECT_FALSE(cache.Match(m_filterList, -1, lines[2], lengths[2], CP_UTF8));
+
+		// Same text in a copy
+		const std::string copy(lines[0], lengths[0]);
+		EXPECT_TRUE(cache.Match(m_filterList, 1, copy.c_str(), copy.length(), CP_UTF8));
+	}
+
+}  // namespace
@@ -0,0 +1,200 @@
+#include <gtest/gtest.h>
+#include <vector>
+#include <random>
+#include "LineAligner.h"
+
+namespace
+{
+	/**
+	 * @brief Make a line looking like source code, from random words.
+	 */
+	String MakeLine(std::mt19937& rnd)
+	{
+		static const TCHAR *const words[] =
+		{
+			_T("int"), _T("return"), _T("if"), _T("nDiff"), _T("m_ptBuf"), _T("GetLine"),
+			_T("const"), _T("String"), _T("="), _T("=="), _T("("), _T(")"), _T(";"),
+			_T("pView"), _T("nLine"), _T("+"), _T("1"), _T("0"), _T("->"), _T("std::vector")
+		};
+		const int count = sizeof(words) / sizeof(words[0]);
+		String line(rnd() % 3, '\t');
+		const int nWords = 4 + rnd() % 8;
+		for (int w = 0; w < nWords; ++w)
+		{
+			line += words[rnd() % count];
+			line += _T(" ");
+		}
+		TCHAR buf[16];
+		for (int n = 0; n < 3; ++n)
+			buf[n] = static_cast<TCHAR>('a' + rnd() % 26);
+		buf[3] = 0;
+		return line + buf;
+	}
+
+	void AddLines(LineAligner& aligner, int side, const std::vector<String>& lines)
+	{
+		for (size_t i = 0; i < lines.size(); ++i)
+			aligner.AddLine(side, lines[i].c_str(), lines[i].length());
+	}
+
+	bool IsIncreasing(const std::vector<int>& map, int nLines1)
+	{
+		int last = -1;
+		for (size_t i = 0; i < map.size(); ++i)
+		{
+			if (map[i] == LineAligner::Unmatched)
+				continue;
+			if (map[i] <= last || map[i] >= nLines1)
+				return false;
+			last = map[i];
+		}
+		return true;
+	}
+
+	// The fixture for testing alignment of lines.
+	class LineAlignerTest : public testing::Test
+	{
+	protected:
+		LineAlignerTest()
+		{
+		}
+
+		virtual ~LineAlignerTest()
+		{
+		}
+
+		virtual void SetUp()
+		{
+		}
+
+		virtual void TearDown()
+		{
+		}
+	};
+
+	TEST_F(LineAlignerTest, EmptySide)
+	{
+		LineAligner aligner;
+		aligner.AddLine(0, _T("abc"), 3);
+		aligner.AddLine(0, _T("def"), 3);
+		std::vector<int> map;
+		aligner.Align(map);
+		ASSERT_EQ(2u, map.size());
+		EXPECT_EQ(LineAligner::Unmatched, map[0]);
+		EXPECT_EQ(LineAligner::Unmatched, map[1]);
+	}
+
+	TEST_F(LineAlignerTest, DissimilarLinesMatchInOrder)
+	{
+		LineAligner aligner;
+		aligner.AddLine(0, _T("first line"), 10);
+		aligner.AddLine(0, _T("second line"), 11);
+		aligner.AddLine(1, _T("xyz"), 3);
+		aligner.AddLine(1, _T("uvw"), 3);
+		aligner.AddLine(1, _T("rst"), 3);
+		std::vector<int> map;
+		aligner.Align(map);
+		ASSERT_EQ(2u, map.size());
+		EXPECT_NE(LineAligner::Unmatched, map[0]);
+		EXPECT_NE(LineAligner::Unmatched, map[1]);
+		EXPECT_TRUE(IsIncreasing(map, 3));
+	}
+
+	TEST_F(LineAlignerTest, IgnoreCase)
+	{
+		for (int ignoreCase = 0; ignoreCase < 2; ++ignoreCase)
+		{
+			// Second line of left side is the first line of right side, except case
+			LineAligner aligner(!!ignoreCase);
+			aligner.AddLine(0, _T("abcdef"), 6);
+			aligner.AddLine(0, _T("compareitems(queue, mystruct)"), 29);
+			aligner.AddLine(1, _T("COMPAREITEMS(QUEUE, MYSTRUCT)"), 29);
+			aligner.AddLine(1, _T("ghijkl"), 6);
+			std::vector<int> map;
+			aligner.Align(map);
+			ASSERT_EQ(2u, map.size());
+			if (ignoreCase)
+			{
+				EXPECT_EQ(LineAligner::Unmatched, map[0]);
+				EXPECT_EQ(0, map[1]);
+			}
+			else
+			{
+				// Dissimilar lines are matched in order
+				EXPECT_EQ(0, map[0]);
+				EXPECT_EQ(1, map[1]);
+			}
+		}
+	}
+
+	TEST_F(LineAlignerTest, ReformattedBlock)
+	{
+		// Block of thousands of lines, reindented, with some lines edited
+		// and big chunks of lines inserted and removed
+		std::mt19937 rnd(1);
+		std::vector<String> lines0, lines1;
+		std::vector<int> expected;
+		for (int i = 0; i < 3000; ++i)
+			lines0.push_back(MakeLine(rnd));
+		for (int i = 0; i < 3000; ++i)
+		{
+			if (i == 1000)
+			{
+				for (int n = 0; n < 400; ++n)
+					lines1.push_back(String(_T("// ")) + MakeLine(rnd));
+			}
+			if (i >= 2000 && i < 2300)
+			{
+				expected.push_back(LineAligner::Unmatched);
+				continue;
+			}
+			String line = _T("    ") + lines0[i];
+			if (rnd() % 10 == 0)
+				line += _T(" + nLine");
+			expected.push_back(static_cast<int>(lines1.size()));
+			lines1.push_back(line);
+		}
+
+		LineAligner aligner;
+		AddLines(aligner, 0, lines0);
+		AddLines(aligner, 1, lines1);
+		std::vector<int> map;
+		aligner.Align(map);
+		ASSERT_EQ(lines0.size(), map.size());
+		EXPECT_TRUE(IsIncreasing(map, static_cast<int>(lines1.size())));
+		int matched = 0, moved = 0;
+		for (size_t i = 0; i < map.size(); ++i)
+		{
+			if (expected[i] != LineAligner::Unmatched)
+			{
+				++moved;
+				if (map[i] == expected[i])
+					++matched;
+			}
+		}
+		EXPECT_LE(moved * 98 / 100, matched);
+	}
+
+	TEST_F(LineAlignerTest, RandomLines)
+	{
+		std::mt19937 rnd(2);
+		for (int n = 0; n < 50; ++n)
+		{
+			std::vector<String> lines[2];
+			for (int side = 0; side < 2; ++side)
+			{
+				const int nLines = rnd() % 200;
+				for (int i = 0; i < nLines; ++i)
+					lines[side].push_back(rnd() % 4 ? MakeLine(rnd) : String());
+			}
+			LineAligner aligner;
+			AddLines(aligner, 0, lines[0]);
+			AddLines(aligner, 1, lines[1]);
+			std::vector<int> map;
+			aligner.Align(map);
+			ASSERT_EQ(lines[0].size(), map.size());
+			EXPECT_TRUE(IsIncreasing(map, static_cast<int>(lines[1].size())));
+		}
+	}
+
+}  // namespace
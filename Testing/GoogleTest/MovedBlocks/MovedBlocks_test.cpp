@@ -0,0 +1,248 @@
+#include <gtest/gtest.h>
+#include <vector>
+#include <random>
+#include <algorithm>
+#include <cstring>
+#include <cstdlib>
+#include "diff.h"
+#include "MovedLines.h"
+
+namespace
+{
+	/**
+	 * @brief Build the script of a shortest edit between two line sequences.
+	 */
+	struct change *BuildScript(const std::vector<int>& a, const std::vector<int>& b)
+	{
+		const int n = static_cast<int>(a.size()), m = static_cast<int>(b.size());
+		std::vector<std::vector<int>> common(n + 1, std::vector<int>(m + 1));
+		for (int i = n - 1; i >= 0; --i)
+			for (int j = m - 1; j >= 0; --j)
+				common[i][j] = a[i] == b[j] ? common[i + 1][j + 1] + 1 : (std::max)(common[i + 1][j], common[i][j + 1]);
+
+		struct change *script = NULL, **tail = &script;
+		int i = 0, j = 0;
+		while (i < n || j < m)
+		{
+			if (i < n && j < m && a[i] == b[j])
+			{
+				++i;
+				++j;
+				continue;
+			}
+			struct change *e = (struct change *) xmalloc(sizeof(struct change));
+			memset(e, 0, sizeof(*e));
+			e->line0 = i;
+			e->line1 = j;
+			e->match0 = e->match1 = -1;
+			while ((i < n || j < m) && !(i < n && j < m && a[i] == b[j]))
+			{
+				if (j == m || (i < n && common[i + 1][j] >= common[i][j + 1]))
+					++i, ++e->deleted;
+				else
+					++j, ++e->inserted;
+			}
+			*tail = e;
+			tail = &e->link;
+		}
+		return script;
+	}
+
+	void FreeScript(struct change *script)
+	{
+		struct change *p;
+		for (struct change *e = script; e; e = p)
+		{
+			p = e->link;
+			free(e);
+		}
+	}
+
+	/**
+	 * @brief Run moved block detection on lines given as equivalency codes.
+	 * @param [out] moved0 Matching line on side#1 for each line of side#0, or -1.
+	 * @param [out] moved1 Matching line on side#0 for each line of side#1, or -1.
+	 * @return Is the split script in order and covering the changed lines once?
+	 */
+	bool FindMovedLines(std::vector<int> a, std::vector<int> b, std::vector<int>& moved0, std::vector<int>& moved1)
+	{
+		struct change *script = BuildScript(a, b);
+		std::vector<int> changed[2] = { std::vector<int>(a.size()), std::vector<int>(b.size()) };
+		for (struct change *e = script; e; e = e->link)
+		{
+			for (int i = 0; i < e->deleted; ++i)
+				changed[0][e->line0 + i] = 1;
+			for (int i = 0; i < e->inserted; ++i)
+				changed[1][e->line1 + i] = 1;
+		}
+
+		file_data fd[2];
+		memset(fd, 0, sizeof(fd));
+		fd[0].equivs = &a[0];
+		fd[1].equivs = &b[0];
+		moved_block_analysis(&script, fd);
+
+		bool consistent = true;
+		std::vector<int> covered[2] = { std::vector<int>(a.size()), std::vector<int>(b.size()) };
+		moved0.assign(a.size(), -1);
+		moved1.assign(b.size(), -1);
+		int line0 = 0, line1 = 0;
+		for (struct change *e = script; e; e = e->link)
+		{
+			if (e->line0 < line0 || e->line1 < line1 || e->deleted + e->inserted == 0)
+				consistent = false;
+			if ((e->match1 >= 0 && e->inserted) || (e->match0 >= 0 && e->deleted))
+				consistent = false;
+			line0 = e->line0;
+			line1 = e->line1;
+			for (int i = 0; i < e->deleted; ++i)
+			{
+				++covered[0][e->line0 + i];
+				if (e->match1 >= 0)
+					moved0[e->line0 + i] = e->match1 + i;
+			}
+			for (int i = 0; i < e->inserted; ++i)
+			{
+				++covered[1][e->line1 + i];
+				if (e->match0 >= 0)
+					moved1[e->line1 + i] = e->match0 + i;
+			}
+		}
+		FreeScript(script);
+		for (size_t i = 0; i < moved0.size(); ++i)
+		{
+			if (moved0[i] >= 0 && (!changed[1][moved0[i]] || moved1[moved0[i]] != static_cast<int>(i)))
+				consistent = false;
+		}
+		return consistent && covered[0] == changed[0] && covered[1] == changed[1];
+	}
+
+	// The fixture for testing moved block detection.
+	class MovedBlocksTest : public testing::Test
+	{
+	protected:
+		MovedBlocksTest()
+		{
+		}
+
+		virtual ~MovedBlocksTest()
+		{
+		}
+
+		virtual void SetUp()
+		{
+		}
+
+		virtual void TearDown()
+		{
+		}
+	};
+
+	TEST_F(MovedBlocksTest, EditedBlockIsFoundWhole)
+	{
+		// Lines 0..29 of the left side are moved to the end with two lines edited
+		std::vector<int> a, b;
+		for (int i = 0; i < 100; ++i)
+			a.push_back(i + 1);
+		for (int i = 30; i < 100; ++i)
+			b.push_back(i + 1);
+		for (int i = 0; i < 30; ++i)
+			b.push_back(i == 10 || i == 20 ? 1000 + i : i + 1);
+
+		std::vector<int> moved0, moved1;
+		EXPECT_TRUE(FindMovedLines(a, b, moved0, moved1));
+		for (int i = 0; i < 30; ++i)
+			EXPECT_EQ(70 + i, moved0[i]) << "line " << i;
+		for (int i = 30; i < 100; ++i)
+			EXPECT_EQ(-1, moved0[i]) << "line " << i;
+	}
+
+	TEST_F(MovedBlocksTest, RepeatedLinesInShingles)
+	{
+		// No line of the moved block is unique alone, like braces and
+		// blank lines, but its runs of three lines are.
+		const int block[] = { 1, 2, 3, 1, 3, 2, 2, 1, 3, 3, 1, 2 };
+		const int count = sizeof(block) / sizeof(block[0]);
+		std::vector<int> a(block, block + count), b;
+		for (int i = 0; i < 40; ++i)
+		{
+			a.push_back(100 + i);
+			b.push_back(100 + i);
+		}
+		b.insert(b.end(), block, block + count);
+
+		std::vector<int> moved0, moved1;
+		EXPECT_TRUE(FindMovedLines(a, b, moved0, moved1));
+		for (int i = 0; i < count; ++i)
+			EXPECT_EQ(40 + i, moved0[i]) << "line " << i;
+	}
+
+	TEST_F(MovedBlocksTest, ScriptStaysConsistent)
+	{
+		std::mt19937 rnd(1);
+		for (int n = 0; n < 50; ++n)
+		{
+			std::vector<int> a, b;
+			int unique = 100;
+			for (int i = 0; i < 300; ++i)
+				a.push_back(rnd() % 2 ? rnd() % 20 : unique++);
+			std::vector<std::vector<int>> blocks;
+			for (size_t i = 0; i < a.size(); )
+			{
+				size_t count = (std::min)(a.size() - i, static_cast<size_t>(1 + rnd() % 30));
+				blocks.push_back(std::vector<int>(a.begin() + i, a.begin() + i + count));
+				i += count;
+			}
+			for (size_t k = 0; k < blocks.size() / 3; ++k)
+				std::swap(blocks[rnd() % blocks.size()], blocks[rnd() % blocks.size()]);
+			for (size_t k = 0; k < blocks.size(); ++k)
+			{
+				for (size_t i = 0; i < blocks[k].size(); ++i)
+				{
+					switch (rnd() % 20)
+					{
+					case 0: b.push_back(unique++); break;
+					case 1: break;
+					case 2: b.push_back(blocks[k][i]); b.push_back(unique++); break;
+					default: b.push_back(blocks[k][i]); break;
+					}
+				}
+			}
+
+			std::vector<int> moved0, moved1;
+			EXPECT_TRUE(FindMovedLines(a, b, moved0, moved1)) << "files " << n;
+		}
+	}
+
+	TEST_F(MovedBlocksTest, MovedLinesLookup)
+	{
+		MovedLines moved;
+		for (unsigned i = 10; i < 20; ++i)
+			moved.Add(MovedLines::SIDE_LEFT, i, i + 100);
+		for (unsigned i = 20; i < 25; ++i)
+			moved.Add(MovedLines::SIDE_LEFT, i, i + 300);
+		moved.Add(MovedLines::SIDE_RIGHT, 7, 3);
+
+		EXPECT_EQ(-1, moved.LineInBlock(9, MovedLines::SIDE_LEFT));
+		EXPECT_EQ(110, moved.LineInBlock(10, MovedLines::SIDE_LEFT));
+		EXPECT_EQ(119, moved.LineInBlock(19, MovedLines::SIDE_LEFT));
+		EXPECT_EQ(320, moved.LineInBlock(20, MovedLines::SIDE_LEFT));
+		EXPECT_EQ(324, moved.LineInBlock(24, MovedLines::SIDE_LEFT));
+		EXPECT_EQ(-1, moved.LineInBlock(25, MovedLines::SIDE_LEFT));
+		EXPECT_EQ(3, moved.LineInBlock(7, MovedLines::SIDE_RIGHT));
+		EXPECT_EQ(-1, moved.LineInBlock(10, MovedLines::SIDE_RIGHT));
+
+		// A line added again replaces its old match
+		moved.Add(MovedLines::SIDE_LEFT, 15, 5);
+		EXPECT_EQ(114, moved.LineInBlock(14, MovedLines::SIDE_LEFT));
+		EXPECT_EQ(5, moved.LineInBlock(15, MovedLines::SIDE_LEFT));
+		EXPECT_EQ(116, moved.LineInBlock(16, MovedLines::SIDE_LEFT));
+		moved.Add(MovedLines::SIDE_LEFT, 10, 6);
+		EXPECT_EQ(6, moved.LineInBlock(10, MovedLines::SIDE_LEFT));
+		EXPECT_EQ(111, moved.LineInBlock(11, MovedLines::SIDE_LEFT));
+
+		moved.Clear();
+		EXPECT_EQ(-1, moved.LineInBlock(10, MovedLines::SIDE_LEFT));
+	}
+
+}  // namespace
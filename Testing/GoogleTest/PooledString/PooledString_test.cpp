@@ -0,0 +1,308 @@
+#include <gtest/gtest.h>
+#include <windows.h>
+#include <psapi.h>
+#include <tchar.h>
+#include <thread>
+#include <vector>
+#include <chrono>
+#include <cstdio>
+#include <boost/flyweight.hpp>
+#include "UnicodeString.h"
+#include "PooledString.h"
+#include "DirItem.h"
+
+#pragma comment(lib, "psapi.lib")
+
+namespace
+{
+	// The fixture for testing PooledString class.
+	class PooledStringTest : public testing::Test
+	{
+	protected:
+		PooledStringTest()
+		{
+		}
+
+		virtual ~PooledStringTest()
+		{
+		}
+
+		virtual void SetUp()
+		{
+		}
+
+		virtual void TearDown()
+		{
+		}
+	};
+
+	TEST_F(PooledStringTest, Basic)
+	{
+		size_t nPoolSize = PooledString::GetPoolSize();
+		{
+			PooledString empty;
+			EXPECT_TRUE(empty.get().empty());
+			EXPECT_TRUE(empty == PooledString(_T("")));
+			EXPECT_EQ(nPoolSize, PooledString::GetPoolSize());
+
+			PooledString a(String(_T("file.txt")));
+			PooledString b(_T("file.txt"));
+			PooledString c(_T("File.txt"));
+			EXPECT_EQ(nPoolSize + 2, PooledString::GetPoolSize());
+			EXPECT_TRUE(a == b);
+			EXPECT_TRUE(a != c);
+			EXPECT_EQ(&a.get(), &b.get());
+			EXPECT_TRUE(a == String(_T("file.txt")));
+			EXPECT_TRUE(a == _T("file.txt"));
+			EXPECT_EQ(String(_T("File.txt")), static_cast<const String&>(c));
+
+			c = a;
+			EXPECT_TRUE(a == c);
+			EXPECT_EQ(nPoolSize + 1, PooledString::GetPoolSize());
+
+			PooledString d(std::move(c));
+			EXPECT_TRUE(c.get().empty());
+			EXPECT_TRUE(a == d);
+
+			c = _T("other");
+			d = c;
+			b = d;
+			a = b;
+			EXPECT_EQ(nPoolSize + 1, PooledString::GetPoolSize());
+			EXPECT_EQ(String(_T("other")), a.get());
+		}
+		EXPECT_EQ(nPoolSize, PooledString::GetPoolSize());
+	}
+
+	TEST_F(PooledStringTest, MultiThread)
+	{
+		const int nthreads = 8;
+		const int nnames = 10000;
+		size_t nPoolSize = PooledString::GetPoolSize();
+		std::vector<std::vector<PooledString> > names(nthreads);
+		std::vector<std::thread> threads;
+		for (int i = 0; i < nthreads; ++i)
+		{
+			threads.push_back(std::thread([&names, i]() {
+				for (int round = 0; round < 3; ++round)
+				{
+					std::vector<PooledString> v;
+					for (int j = 0; j < nnames; ++j)
+						v.push_back(string_format(_T("file%d.txt"), j));
+					names[i].swap(v);
+				}
+			}));
+		}
+		for (size_t i = 0; i < threads.size(); ++i)
+			threads[i].join();
+
+		EXPECT_EQ(nPoolSize + nnames, PooledString::GetPoolSize());
+		for (int j = 0; j < nnames; ++j)
+		{
+			for (int i = 1; i < nthreads; ++i)
+				EXPECT_TRUE(names[0][j] == names[i][j]);
+		}
+		names.clear();
+		EXPECT_EQ(nPoolSize, PooledString::GetPoolSize());
+	}
+
+	TEST_F(PooledStringTest, Path)
+	{
+		size_t nPoolSize = PooledPath::GetPoolSize();
+		{
+			PooledPath empty;
+			EXPECT_TRUE(empty.get().empty());
+			EXPECT_TRUE(empty == PooledPath(_T("")));
+			EXPECT_TRUE(empty == String());
+			EXPECT_EQ(nPoolSize, PooledPath::GetPoolSize());
+
+			const TCHAR *paths[] = { _T("a"), _T("a\\b\\c"), _T("C:\\"), _T("\\\\server\\share"),
+				_T("a\\\\b"), _T("\\"), _T("a/b\\c") };
+			for (size_t i = 0; i < sizeof(paths) / sizeof(paths[0]); ++i)
+			{
+				PooledPath path(paths[i]);
+				EXPECT_EQ(String(paths[i]), path.get());
+				EXPECT_EQ(String(paths[i]).length(), path.length());
+				EXPECT_TRUE(path == String(paths[i]));
+			}
+			EXPECT_EQ(nPoolSize, PooledPath::GetPoolSize());
+
+			// Folders share the nodes of their parents
+			PooledPath ab(_T("a\\b"));
+			PooledPath abc(String(_T("a\\b\\c")));
+			PooledPath abd(_T("a\\b\\d"));
+			EXPECT_EQ(nPoolSize + 4, PooledPath::GetPoolSize());
+			EXPECT_TRUE(abc == PooledPath(_T("a\\b\\c")));
+			EXPECT_TRUE(abc != abd);
+			EXPECT_TRUE(abc != ab);
+			EXPECT_TRUE(abc == String(_T("a\\b\\c")));
+			EXPECT_TRUE(abc != String(_T("a\\b\\d")));
+			EXPECT_TRUE(abc != String(_T("a\\b/c")));
+			EXPECT_TRUE(abc != String(_T("a\\b")));
+			EXPECT_EQ(String(_T("a\\b\\d")), static_cast<String>(abd));
+
+			// Parents stay as long as a child refers to them
+			ab = PooledPath();
+			abc = _T("x");
+			EXPECT_EQ(nPoolSize + 4, PooledPath::GetPoolSize());
+			EXPECT_EQ(String(_T("a\\b\\d")), abd.get());
+
+			PooledPath x(std::move(abc));
+			EXPECT_TRUE(abc.empty());
+			abd = x;
+			EXPECT_EQ(nPoolSize + 1, PooledPath::GetPoolSize());
+		}
+		EXPECT_EQ(nPoolSize, PooledPath::GetPoolSize());
+	}
+
+	TEST_F(PooledStringTest, PathMultiThread)
+	{
+		const int nthreads = 8;
+		const int nfolders = 1000;
+		size_t nPoolSize = PooledPath::GetPoolSize();
+		std::vector<std::vector<PooledPath> > paths(nthreads);
+		std::vector<std::thread> threads;
+		for (int i = 0; i < nthreads; ++i)
+		{
+			threads.push_back(std::thread([&paths, i]() {
+				for (int round = 0; round < 3; ++round)
+				{
+					std::vector<PooledPath> v;
+					for (int j = 0; j < nfolders; ++j)
+						v.push_back(string_format(_T("src\\dir%d\\sub%d"), j % 10, j));
+					paths[i].swap(v);
+				}
+			}));
+		}
+		for (size_t i = 0; i < threads.size(); ++i)
+			threads[i].join();
+
+		EXPECT_EQ(nPoolSize + 1 + 10 + nfolders, PooledPath::GetPoolSize());
+		for (int j = 0; j < nfolders; ++j)
+		{
+			EXPECT_EQ(string_format(_T("src\\dir%d\\sub%d"), j % 10, j), paths[0][j].get());
+			for (int i = 1; i < nthreads; ++i)
+				EXPECT_TRUE(paths[0][j] == paths[i][j]);
+		}
+		paths.clear();
+		EXPECT_EQ(nPoolSize, PooledPath::GetPoolSize());
+	}
+
+	size_t GetPrivateBytes()
+	{
+		PROCESS_MEMORY_COUNTERS_EX pmc = { sizeof(pmc) };
+		GetProcessMemoryInfo(GetCurrentProcess(), reinterpret_cast<PROCESS_MEMORY_COUNTERS *>(&pmc), sizeof(pmc));
+		return pmc.PrivateUsage;
+	}
+
+	/**
+	 * @brief Return paths of all folders of a tree.
+	 * Every folder has @p nfanout subfolders, down to @p ndepth levels.
+	 */
+	std::vector<String> MakeFolderTree(int ndepth, int nfanout)
+	{
+		std::vector<String> folders;
+		std::vector<String> level(1, _T("C:\\Users\\someone\\Projects"));
+		for (int depth = 0; depth < ndepth; ++depth)
+		{
+			std::vector<String> next;
+			for (size_t i = 0; i < level.size(); ++i)
+			{
+				for (int j = 0; j < nfanout; ++j)
+					next.push_back(level[i] + string_format(_T("\\subfolder-%02d"), j));
+			}
+			folders.insert(folders.end(), next.begin(), next.end());
+			level.swap(next);
+		}
+		return folders;
+	}
+
+	// Memory of the folder paths of items, stored whole in the string pool
+	// as DirItem did earlier, against folder nodes of the path pool.
+	// Disabled by default, run with --gtest_also_run_disabled_tests.
+	TEST_F(PooledStringTest, DISABLED_PathMemory)
+	{
+		int depths[] = { 4, 8, 16 };
+		for (size_t i = 0; i < sizeof(depths) / sizeof(depths[0]); ++i)
+		{
+			// About 100000 folders in each tree
+			int nfanout = depths[i] == 4 ? 18 : (depths[i] == 8 ? 4 : 2);
+			std::vector<String> tree = MakeFolderTree(depths[i], nfanout);
+			// Keep the folder names in the string pool, they are names of folder items
+			std::vector<PooledString> names;
+			for (int j = 0; j < nfanout; ++j)
+				names.push_back(string_format(_T("subfolder-%02d"), j));
+
+			size_t nPoolSize = PooledPath::GetPoolSize();
+			size_t nBytesWhole, nBytesTrie;
+			{
+				size_t nBytesBefore = GetPrivateBytes();
+				std::vector<PooledString> folders(tree.begin(), tree.end());
+				nBytesWhole = GetPrivateBytes() - nBytesBefore;
+			}
+			{
+				size_t nBytesBefore = GetPrivateBytes();
+				std::vector<PooledPath> folders(tree.begin(), tree.end());
+				nBytesTrie = GetPrivateBytes() - nBytesBefore;
+				EXPECT_EQ(nPoolSize + tree.size() + 4, PooledPath::GetPoolSize());
+			}
+			printf("depth %2d, %u folders: whole paths %u KB, path pool %u KB\n",
+				depths[i], static_cast<unsigned>(tree.size()),
+				static_cast<unsigned>(nBytesWhole / 1024), static_cast<unsigned>(nBytesTrie / 1024));
+		}
+	}
+
+	// Folder listing like DirTravel does it: one shared folder path and a
+	// name per item, from many scanning threads at the same time.
+	template<class Path, class Str>
+	double EnumerateItems(int nthreads, int nfolders, int nfiles)
+	{
+		struct Item
+		{
+			Path path;
+			Str filename;
+		};
+		std::vector<std::thread> threads;
+		auto start = std::chrono::steady_clock::now();
+		for (int i = 0; i < nthreads; ++i)
+		{
+			threads.push_back(std::thread([=]() {
+				std::vector<Item> items;
+				for (int folder = i; folder < nfolders; folder += nthreads)
+				{
+					Path dir(string_format(_T("C:\\Users\\someone\\Projects\\folder%d"), folder));
+					for (int file = 0; file < nfiles; ++file)
+					{
+						Item item;
+						item.path = dir;
+						item.filename = string_format(_T("file%d.txt"), file);
+						items.push_back(item);
+					}
+				}
+			}));
+		}
+		for (size_t i = 0; i < threads.size(); ++i)
+			threads[i].join();
+		return std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+	}
+
+	// Enumeration throughput of boost::flyweight<String>, used earlier for
+	// DirItem, against PooledPath and PooledString.
+	// Disabled by default, run with --gtest_also_run_disabled_tests.
+	TEST_F(PooledStringTest, DISABLED_EnumerationThroughput)
+	{
+		const int nfolders = 1000;
+		const int nfiles = 1000;
+		const int nitems = nfolders * nfiles;
+		int nthreadsList[] = { 1, 8, 16 };
+		for (size_t i = 0; i < sizeof(nthreadsList) / sizeof(nthreadsList[0]); ++i)
+		{
+			int nthreads = nthreadsList[i];
+			double secsFlyweight = EnumerateItems<boost::flyweight<String>, boost::flyweight<String> >(nthreads, nfolders, nfiles);
+			double secsPooled = EnumerateItems<PooledPath, PooledString>(nthreads, nfolders, nfiles);
+			printf("%2d threads: boost::flyweight %.1f Mitems/s, PooledPath and PooledString %.1f Mitems/s\n",
+				nthreads, nitems / secsFlyweight / 1e6, nitems / secsPooled / 1e6);
+		}
+	}
+
+}  // namespace
@@ -0,0 +1,205 @@
+#include <gtest/gtest.h>
+#include <io.h>
+#include <sys/stat.h>
+#include <fcntl.h>
+#include <cstdio>
+#include <cstring>
+#include <fstream>
+#include <string>
+#include "diff.h"
+#include "CompareOptions.h"
+#include "DiffItem.h"
+#include "DiffList.h"
+#include "DiffUtils.h"
+#include "StreamDiff.h"
+
+namespace
+{
+	const int NumLines = 120000;
+
+	/** @brief Return text of a line of the original file. */
+	std::string Line(int n)
+	{
+		char buf[64];
+		sprintf(buf, "line %06d of the file\n", n);
+		return buf;
+	}
+
+	/** @brief Return text of a changed line, as long as the original. */
+	std::string ChangedLine(int n)
+	{
+		char buf[64];
+		sprintf(buf, "LINE %06d OF THE FILE\n", n);
+		return buf;
+	}
+
+	struct TempFile
+	{
+		TempFile(const std::string& filename, const std::string& text) : m_filename(filename)
+		{
+			std::ofstream ostr(filename.c_str(), std::ios::out|std::ios::binary|std::ios::trunc);
+			ostr << text;
+		}
+		~TempFile()
+		{
+			remove(m_filename.c_str());
+		}
+		std::string m_filename;
+	};
+
+	/** @brief Result of diffing two files. */
+	struct DiffResult
+	{
+		int code;
+		int ndiffs;
+		int ntrivialdiffs;
+		DiffList list;
+	};
+
+	// The fixture for testing StreamDiff class.
+	// Files are a few megabytes, diffed in windows of a megabyte, and the
+	// result is checked against diffutils diffing the files whole.
+	class StreamDiffTest : public testing::Test
+	{
+	protected:
+		StreamDiffTest()
+		{
+		}
+
+		virtual ~StreamDiffTest()
+		{
+		}
+
+		virtual void SetUp()
+		{
+		}
+
+		virtual void TearDown()
+		{
+		}
+
+		void OpenFiles(const TempFile& left, const TempFile& right, file_data inf[2])
+		{
+			memset(inf, 0, sizeof(file_data) * 2);
+			inf[0].name = left.m_filename.c_str();
+			inf[1].name = right.m_filename.c_str();
+			inf[0].desc = _open(left.m_filename.c_str(), O_RDONLY | O_BINARY, _S_IREAD);
+			inf[1].desc = _open(right.m_filename.c_str(), O_RDONLY | O_BINARY, _S_IREAD);
+			_fstat(inf[0].desc, &inf[0].stat);
+			_fstat(inf[1].desc, &inf[1].stat);
+		}
+
+		void CloseFiles(file_data inf[2])
+		{
+			_close(inf[0].desc);
+			_close(inf[1].desc);
+		}
+
+		void StreamDiffFiles(const TempFile& left, const TempFile& right, DiffResult& result)
+		{
+			file_data inf[2];
+			OpenFiles(left, right, inf);
+			CompareEngines::StreamDiff streamDiff;
+			streamDiff.SetCompareOptions(m_options);
+			streamDiff.SetMemoryLimit(6 * 1024 * 1024);
+			streamDiff.SetFileData(2, inf);
+			result.code = streamDiff.CompareFiles(&result.list);
+			streamDiff.GetDiffCounts(result.ndiffs, result.ntrivialdiffs);
+			CloseFiles(inf);
+		}
+
+		void WholeDiffFiles(const TempFile& left, const TempFile& right, DiffResult& result)
+		{
+			file_data inf[2];
+			OpenFiles(left, right, inf);
+			CompareEngines::DiffUtils diffUtils;
+			diffUtils.SetCompareOptions(m_options);
+			diffUtils.SetDiffList(&result.list);
+			diffUtils.SetFileData(2, inf);
+			result.code = diffUtils.diffutils_compare_files();
+			diffUtils.GetDiffCounts(result.ndiffs, result.ntrivialdiffs);
+			cleanup_file_buffers(inf);
+			CloseFiles(inf);
+		}
+
+		void ExpectSameDiffs(const std::string& left, const std::string& right)
+		{
+			TempFile leftFile("_StreamDiff_left.txt", left);
+			TempFile rightFile("_StreamDiff_right.txt", right);
+			DiffResult streamed, whole;
+			StreamDiffFiles(leftFile, rightFile, streamed);
+			WholeDiffFiles(leftFile, rightFile, whole);
+
+			EXPECT_EQ(whole.code & DIFFCODE::COMPAREFLAGS, streamed.code & DIFFCODE::COMPAREFLAGS);
+			EXPECT_EQ(whole.ndiffs, streamed.ndiffs);
+			EXPECT_EQ(whole.ntrivialdiffs, streamed.ntrivialdiffs);
+			ASSERT_EQ(whole.list.GetSize(), streamed.list.GetSize());
+			for (int i = 0; i < whole.list.GetSize(); ++i)
+			{
+				const DIFFRANGE *w = whole.list.DiffRangeAt(i);
+				const DIFFRANGE *s = streamed.list.DiffRangeAt(i);
+				for (int file = 0; file < 2; ++file)
+				{
+					EXPECT_EQ(w->begin[file], s->begin[file]) << "diff " << i << " file " << file;
+					EXPECT_EQ(w->end[file], s->end[file]) << "diff " << i << " file " << file;
+				}
+				EXPECT_EQ(w->op, s->op) << "diff " << i;
+			}
+		}
+
+		DiffutilsOptions m_options;
+	};
+
+	TEST_F(StreamDiffTest, ScatteredChanges)
+	{
+		std::string left, right;
+		for (int i = 0; i < NumLines; ++i)
+		{
+			left += Line(i);
+			if (i % 5000 == 100)
+				right += ChangedLine(i);
+			else if (i % 7000 == 200)
+				; // deleted
+			else
+				right += Line(i);
+			if (i % 11000 == 300)
+				right += ChangedLine(-i);
+		}
+		ExpectSameDiffs(left, right);
+	}
+
+	TEST_F(StreamDiffTest, ChangeLongerThanWindow)
+	{
+		// About 1.4 MB of changed lines, so some windows have no anchor
+		std::string left, right;
+		for (int i = 0; i < NumLines; ++i)
+		{
+			left += Line(i);
+			right += (i >= 30000 && i < 90000) ? ChangedLine(i) : Line(i);
+		}
+		ExpectSameDiffs(left, right);
+
+		TempFile leftFile("_StreamDiff_left.txt", left);
+		TempFile rightFile("_StreamDiff_right.txt", right);
+		DiffResult streamed;
+		StreamDiffFiles(leftFile, rightFile, streamed);
+		EXPECT_EQ(1, streamed.ndiffs);
+		ASSERT_EQ(1, streamed.list.GetSize());
+		EXPECT_EQ(30000, streamed.list.DiffRangeAt(0)->begin[0]);
+		EXPECT_EQ(89999, streamed.list.DiffRangeAt(0)->end[1]);
+	}
+
+	TEST_F(StreamDiffTest, ChangesAtEnds)
+	{
+		std::string left, right;
+		for (int i = 0; i < NumLines; ++i)
+		{
+			left += Line(i);
+			right += (i < 10 || i >= NumLines - 10) ? ChangedLine(i) : Line(i);
+		}
+		// Last line without EOL
+		left.erase(left.size() - 1);
+		ExpectSameDiffs(left, right);
+	}
+
+}  // namespace
@@ -0,0 +1,216 @@
+#include <gtest/gtest.h>
+#include <windows.h>
+#include <tchar.h>
+#include <vector>
+#include <random>
+#include <chrono>
+#include <cstdio>
+#include "stringdiffs.h"
+#include "CompareOptions.h"
+
+using std::vector;
+
+namespace
+{
+	/**
+	 * @brief Make a line of minified JSON, from random keys and values.
+	 */
+	String MakeJsonLine(std::mt19937& rnd, int length)
+	{
+		static const TCHAR *const keys[] =
+		{
+			_T("\"id\":"), _T("\"name\":"), _T("\"value\":"), _T("\"items\":["), _T("\"type\":"), _T("\"enabled\":")
+		};
+		const int count = sizeof(keys) / sizeof(keys[0]);
+		String line = _T("{");
+		while (static_cast<int>(line.length()) < length)
+		{
+			line += keys[rnd() % count];
+			TCHAR buf[32];
+			_stprintf_s(buf, _T("%u,"), static_cast<unsigned>(rnd() % 100000));
+			line += buf;
+		}
+		return line + _T("}");
+	}
+
+	/**
+	 * @brief Make a line of base64 encoded data, without word boundaries.
+	 */
+	String MakeBase64Line(std::mt19937& rnd, int length)
+	{
+		static const TCHAR chars[] = _T("ABCDEFGHIJKLMNOPQRSTUVWXYZabcdefghijklmnopqrstuvwxyz0123456789+/");
+		String line(length, ' ');
+		for (int i = 0; i < length; i++)
+			line[i] = chars[rnd() % 64];
+		return line;
+	}
+
+	/**
+	 * @brief Are diffs in order, not overlapping, and within the lines?
+	 */
+	bool AreValid(const vector<wdiff>& diffs, const String& str1, const String& str2)
+	{
+		int next[2] = { 0, 0 };
+		const int length[2] = { static_cast<int>(str1.length()), static_cast<int>(str2.length()) };
+		for (size_t i = 0; i < diffs.size(); i++)
+		{
+			for (int j = 0; j < 2; j++)
+			{
+				if (diffs[i].begin[j] < next[j] || diffs[i].end[j] < diffs[i].begin[j] - 1 ||
+					diffs[i].end[j] >= length[j])
+					return false;
+				next[j] = diffs[i].end[j] + 1;
+			}
+		}
+		return true;
+	}
+
+	// The fixture for testing diffs of very long lines.
+	class StringDiffsLongLineTest : public testing::Test
+	{
+	protected:
+		StringDiffsLongLineTest()
+		{
+			sd_Init();
+		}
+
+		virtual ~StringDiffsLongLineTest()
+		{
+			sd_Close();
+		}
+
+		virtual void SetUp()
+		{
+			sd_SetBreakChars(_T(",.;:()[]{}"));
+		}
+
+		virtual void TearDown()
+		{
+		}
+	};
+
+	// Values changed far apart in a long line are found word by word
+	TEST_F(StringDiffsLongLineTest, ValuesChanged)
+	{
+		std::mt19937 rnd(1);
+		const String str1 = MakeJsonLine(rnd, 1024 * 1024);
+		String str2;
+		const int positions[] = { 1000, 300000, 300100, 900000 };
+		vector<wdiff> expected;
+		int copied = 0;
+		for (int i = 0; i < 4; i++)
+		{
+			// Replace first number after the position
+			const int begin = static_cast<int>(str1.find(':', positions[i])) + 1;
+			const int end = static_cast<int>(str1.find(',', begin));
+			str2 += str1.substr(copied, begin - copied);
+			const int begin2 = static_cast<int>(str2.length());
+			str2 += _T("-1");
+			copied = end;
+			expected.push_back(wdiff(begin, end - 1, begin2, begin2 + 1));
+		}
+		str2 += str1.substr(copied);
+		vector<wdiff> diffs;
+		sd_ComputeWordDiffs(str1, str2, true, WHITESPACE_COMPARE_ALL, 1, false, &diffs);
+		ASSERT_EQ(4u, diffs.size());
+		for (int i = 0; i < 4; i++)
+		{
+			EXPECT_EQ(expected[i].begin[0], diffs[i].begin[0]);
+			EXPECT_EQ(expected[i].end[0], diffs[i].end[0]);
+			EXPECT_EQ(expected[i].begin[1], diffs[i].begin[1]);
+			EXPECT_EQ(expected[i].end[1], diffs[i].end[1]);
+		}
+	}
+
+	// Text inserted in a line without word boundaries is found at byte level
+	TEST_F(StringDiffsLongLineTest, InsertedInBase64)
+	{
+		std::mt19937 rnd(2);
+		const String str1 = MakeBase64Line(rnd, 2 * 1024 * 1024);
+		String str2 = str1;
+		str2.insert(1000000, _T("!!!!!!!!!!!!!!!!!!!!"));
+		vector<wdiff> diffs;
+		sd_ComputeWordDiffs(str1, str2, true, WHITESPACE_COMPARE_ALL, 0, true, &diffs);
+		ASSERT_EQ(1u, diffs.size());
+		EXPECT_EQ(1000000, diffs[0].begin[0]);
+		EXPECT_EQ(999999, diffs[0].end[0]);
+		EXPECT_EQ(1000000, diffs[0].begin[1]);
+		EXPECT_EQ(1000019, diffs[0].end[1]);
+	}
+
+	// Whitespace and case options apply to chunks of long lines
+	TEST_F(StringDiffsLongLineTest, IgnoreWhitespaceChangeAndCase)
+	{
+		String str1, str2;
+		for (int i = 0; i < 20000; i++)
+		{
+			str1 += _T("return value; ");
+			str2 += i % 3 ? _T("return value; ") : _T("RETURN   Value;\t");
+		}
+		vector<wdiff> diffs;
+		sd_ComputeWordDiffs(str1, str2, false, WHITESPACE_IGNORE_CHANGE, 1, false, &diffs);
+		EXPECT_EQ(0u, diffs.size());
+		sd_ComputeWordDiffs(str1, str2, true, WHITESPACE_IGNORE_CHANGE, 1, false, &diffs);
+		EXPECT_LT(0u, diffs.size());
+		EXPECT_TRUE(AreValid(diffs, str1, str2));
+	}
+
+	// Lines too different to diff within the work budget get coarser diffs instead
+	TEST_F(StringDiffsLongLineTest, DifferentLines)
+	{
+		std::mt19937 rnd(3);
+		for (int byte_level = 0; byte_level < 2; byte_level++)
+		{
+			const String str1 = _T("same ") + MakeJsonLine(rnd, 8 * 1024 * 1024) + _T(" same");
+			const String str2 = _T("same ") + MakeJsonLine(rnd, 8 * 1024 * 1024) + _T(" same");
+			vector<wdiff> diffs;
+			std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+			sd_ComputeWordDiffs(str1, str2, true, WHITESPACE_COMPARE_ALL, 1, !!byte_level, &diffs);
+			std::chrono::duration<double> elapsed = std::chrono::steady_clock::now() - start;
+			printf("%s: %.3f seconds\n", byte_level ? "byte-level" : "word-level", elapsed.count());
+			ASSERT_LT(0u, diffs.size());
+			EXPECT_TRUE(AreValid(diffs, str1, str2));
+			EXPECT_LE(5, diffs[0].begin[0]);
+			EXPECT_GT(static_cast<int>(str1.length()) - 5, diffs.back().end[0]);
+		}
+	}
+
+	// Lines using up the work budget get the same diffs every time, however
+	// long diffing them takes, so their diffs can be cached
+	TEST_F(StringDiffsLongLineTest, SameDiffsEveryTime)
+	{
+		std::mt19937 rnd(4);
+		const String str1 = MakeJsonLine(rnd, 8 * 1024 * 1024);
+		String str2 = str1;
+		// Regions of words found nowhere else take much work to diff
+		for (int i = 0; i < 100; i++)
+		{
+			String words;
+			while (words.length() < 2000)
+			{
+				for (int j = 0; j < 4; j++)
+					words += static_cast<TCHAR>(_T('a') + rnd() % 26);
+				words += _T(' ');
+			}
+			str2.replace(str2.find(',', 100000 + i * 20000) + 1, words.length(), words);
+		}
+		vector<wdiff> diffs;
+		sd_ComputeWordDiffs(str1, str2, true, WHITESPACE_COMPARE_ALL, 1, false, &diffs);
+		ASSERT_LT(0u, diffs.size());
+		EXPECT_TRUE(AreValid(diffs, str1, str2));
+		for (int n = 0; n < 2; n++)
+		{
+			vector<wdiff> diffs2;
+			sd_ComputeWordDiffs(str1, str2, true, WHITESPACE_COMPARE_ALL, 1, false, &diffs2);
+			ASSERT_EQ(diffs.size(), diffs2.size());
+			for (size_t i = 0; i < diffs.size(); i++)
+			{
+				EXPECT_EQ(diffs[i].begin[0], diffs2[i].begin[0]);
+				EXPECT_EQ(diffs[i].end[0], diffs2[i].end[0]);
+				EXPECT_EQ(diffs[i].begin[1], diffs2[i].begin[1]);
+				EXPECT_EQ(diffs[i].end[1], diffs2[i].end[1]);
+			}
+		}
+	}
+
+}  // namespace
@@ -0,0 +1,248 @@
+#include <gtest/gtest.h>
+#include <windows.h>
+#include <tchar.h>
+#include <vector>
+#include <chrono>
+#include <cstdio>
+#ifdef _DEBUG
+#include <crtdbg.h>
+#endif
+#include "stringdiffs.h"
+
+using std::vector;
+
+namespace
+{
+	/** @brief Changed lines of real edits of source files, before and after. */
+	const TCHAR *const ChangedLines[][2] =
+	{
+		{ _T("\t\tCompareBatch& batch = m_batches[urgent];"),
+		  _T("\t\tCompareBatch& batch = m_batches[lane];") },
+		{ _T("\t\tif (nDiff < nDiffCount - 1)"),
+		  _T("\t\tif (nDiff < nFirstDiff + nDiffCount - 1)") },
+		{ _T("\tCompareBatcher batcher(queue, pCtxt, &group);"),
+		  _T("\tCompareBatcher batcher(scheduler, pCtxt, &group);") },
+		{ _T("\t\treturn FirstSideInMovedBlock(line);"),
+		  _T("\t\treturn FindLine(m_moved1, static_cast<int>(line));") },
+		{ _T("int MovedLines::FirstSideInMovedBlock(unsigned secondSideLine) const"),
+		  _T("int MovedLines::FindLine(const MovedBlocks & blocks, int line)") },
+		{ _T("static int CompareItems(NotificationQueue& queue, DiffFuncStruct *myStruct, uintptr_t parentdiffpos)"),
+		  _T("static int CompareItems(CompareWorkQueue& queue, DiffFuncStruct *myStruct, uintptr_t parentdiffpos)") },
+		{ _T("\tif (m_encoding.m_unicoding == ucr::UTF8 && m_encoding.m_bom)"),
+		  _T("\tif (m_encoding.m_unicoding == ucr::UTF8 && m_encoding.m_bom && nStartLine == 0)") },
+		{ _T("\tint res = CompareItems(queue, myStruct, parentdiffpos);"),
+		  _T("\tint res = CompareItems(scheduler, myStruct, parentdiffpos);") },
+		{ _T("\t\telse if (WorkCompletedNotification* pWorkCompletedNf = dynamic_cast<WorkCompletedNotification*>(pNf.get()))"),
+		  _T("\t\telse if (BatchCompletedNotification* pBatchNf = dynamic_cast<BatchCompletedNotification*>(pNf.get()))") },
+		{ _T("\tThreadPool threadPool(2, nscanners + nworkers + 2);"),
+		  _T("\tThreadPool threadPool(2, nscanners + scheduler.GetThreadCount() + 2);") },
+		{ _T("\t\t\tnew BatchCompletedNotification(batch.items[0]->parent, batch.count, ndiff));"),
+		  _T("\t\t\tnew BatchCompletedNotification(batch, ndiff));") },
+		{ _T("\tNotificationQueue queue;"),
+		  _T("\tCompareWorkQueue queue(nworkers);") },
+		{ _T("void CMergeDoc::GetWordDiffArray(int nLineIndex, vector<WordDiff> *pWordDiffs)"),
+		  _T("bool CMergeDoc::GetWordDiffArray(int nLineIndex, vector<WordDiff> *pWordDiffs, bool bWait/* = true*/)") },
+		{ _T("\t\treturn SecondSideInMovedBlock(line);"),
+		  _T("\t\treturn FindLine(m_moved0, static_cast<int>(line));") },
+		{ _T(" * @brief Save files to temp files & compare again."),
+		  _T(" * @brief Save files to memory or temp files & compare again.") },
+		{ _T("\t\tbool crflag, int64_t offset)"),
+		  _T("\t\tbool crflag, int64_t offset, bool vectorize)") },
+		{ _T("\t\t\tint ndiff = CompareItems(queue, myStruct, curpos);"),
+		  _T("\t\t\tint ndiff = CompareItems(scheduler, myStruct, curpos);") },
+		{ _T("\tfor (nDiff = nDiffCount - 1; nDiff >= 0; nDiff --)"),
+		  _T("\tfor (nDiff = nFirstDiff + nDiffCount - 1; nDiff >= nFirstDiff; nDiff --)") },
+		{ _T("\tNotificationQueue& m_queue;"),
+		  _T("\tCompareWorkQueue& m_queue;") },
+		{ _T("\treturn string_compare_nocase(ColFileNameGet<boost::flyweight<String> >(pCtxt, p), ColFileNameGet<boost::flyweight<String> >(pCtxt, q));"),
+		  _T("\treturn string_compare_nocase(ColFileNameGet<PooledString>(pCtxt, p), ColFileNameGet<PooledString>(pCtxt, q));") },
+		{ _T("static int CompareItems(CompareWorkQueue& queue, DiffFuncStruct *myStruct, uintptr_t parentdiffpos)"),
+		  _T("static int CompareItems(CompareScheduler& scheduler, DiffFuncStruct *myStruct, uintptr_t parentdiffpos)") },
+		{ _T("\tCompareWorkQueue queue(nworkers);"),
+		  _T("\tCompareScheduler scheduler(pCtxt);") },
+		{ _T("\t\t\tpNf = m_queue.waitDequeueNotification();"),
+		  _T("\t\t\tbatch.pSink->batchCompleted(batch, ndiff);") },
+		{ _T("\t\twhile (m_queue.waitPop(batch))"),
+		  _T("\t\twhile (m_scheduler.waitPop(m_pool, batch))") },
+	};
+	const int ChangedLineCount = sizeof(ChangedLines) / sizeof(ChangedLines[0]);
+
+#ifdef _DEBUG
+	int AllocCount;
+
+	int AllocHook(int allocType, void *, size_t, int, long, const unsigned char *, int)
+	{
+		if (allocType == _HOOK_ALLOC || allocType == _HOOK_REALLOC)
+			++AllocCount;
+		return TRUE;
+	}
+#endif
+
+	// The fixture for testing reuse of word diff buffers.
+	class StringDiffsWorkspaceTest : public testing::Test
+	{
+	protected:
+		StringDiffsWorkspaceTest()
+		{
+			sd_Init();
+		}
+
+		virtual ~StringDiffsWorkspaceTest()
+		{
+			sd_Close();
+		}
+
+		virtual void SetUp()
+		{
+			sd_SetBreakChars(_T(",.;:()[]"));
+		}
+
+		virtual void TearDown()
+		{
+		}
+
+		void ComputeAll(bool byte_level, vector<vector<wdiff> >& results)
+		{
+			results.resize(ChangedLineCount);
+			for (int i = 0; i < ChangedLineCount; i++)
+			{
+				results[i].clear();
+				sd_ComputeWordDiffs(ChangedLines[i][0], ChangedLines[i][1],
+					true, 0, 1, byte_level, &results[i]);
+			}
+		}
+
+		static bool AreSame(const vector<wdiff>& diffs1, const vector<wdiff>& diffs2)
+		{
+			if (diffs1.size() != diffs2.size())
+				return false;
+			for (size_t i = 0; i < diffs1.size(); i++)
+			{
+				for (int j = 0; j < 2; j++)
+				{
+					if (diffs1[i].begin[j] != diffs2[i].begin[j] || diffs1[i].end[j] != diffs2[i].end[j])
+						return false;
+				}
+			}
+			return true;
+		}
+	};
+
+	// Words of common beginning of lines are not diffed, positions of
+	// diffs after it are still in whole lines
+	TEST_F(StringDiffsWorkspaceTest, CommonBeginning)
+	{
+		std::vector<wdiff> diffs;
+		sd_ComputeWordDiffs(
+			//  0         1         2         3         4
+			//  01234567890123456789012345678901234567890123456789
+			_T("int CompareItems(queue, myStruct, parentdiffpos);"),
+			_T("int CompareItems(scheduler, myStruct, parentdiffpos);"),
+			true, 0, 1, false, &diffs);
+		EXPECT_EQ(1, diffs.size());
+		if (diffs.size() > 0)
+		{
+			wdiff *pDiff = &diffs[0];
+			EXPECT_EQ(17, pDiff->begin[0]);
+			EXPECT_EQ(17, pDiff->begin[1]);
+			EXPECT_EQ(21, pDiff->end[0]);
+			EXPECT_EQ(25, pDiff->end[1]);
+		}
+	}
+
+	// Common beginning ends in the middle of a word
+	TEST_F(StringDiffsWorkspaceTest, CommonBeginningInWord)
+	{
+		std::vector<wdiff> diffs;
+		sd_ComputeWordDiffs(
+			//  0         1         2
+			//  0123456789012345678901234
+			_T("return nFirstDiff + 1;"),
+			_T("return nFirstLine + 1;"),
+			true, 0, 1, false, &diffs);
+		EXPECT_EQ(1, diffs.size());
+		if (diffs.size() > 0)
+		{
+			wdiff *pDiff = &diffs[0];
+			EXPECT_EQ(7, pDiff->begin[0]);
+			EXPECT_EQ(7, pDiff->begin[1]);
+			EXPECT_EQ(16, pDiff->end[0]);
+			EXPECT_EQ(16, pDiff->end[1]);
+		}
+	}
+
+	// Text added after end of the shorter line
+	TEST_F(StringDiffsWorkspaceTest, CommonBeginningWholeLine)
+	{
+		std::vector<wdiff> diffs;
+		sd_ComputeWordDiffs(
+			//  0         1         2         3
+			//  0123456789012345678901234567890123
+			_T("\tif (nDiff < nDiffCount)"),
+			_T("\tif (nDiff < nDiffCount) break;"),
+			true, 0, 1, false, &diffs);
+		EXPECT_EQ(1, diffs.size());
+		if (diffs.size() > 0)
+		{
+			wdiff *pDiff = &diffs[0];
+			EXPECT_EQ(24, pDiff->begin[0]);
+			EXPECT_EQ(24, pDiff->begin[1]);
+			EXPECT_EQ(23, pDiff->end[0]);
+			EXPECT_EQ(30, pDiff->end[1]);
+		}
+	}
+
+	// Diffs do not depend on lines diffed before them
+	TEST_F(StringDiffsWorkspaceTest, SameAfterLongLine)
+	{
+		for (int byte_level = 0; byte_level < 2; byte_level++)
+		{
+			vector<vector<wdiff> > before, after;
+			ComputeAll(!!byte_level, before);
+
+			String long1, long2;
+			for (int i = 0; i < 3000; i++)
+			{
+				long1 += _T("word, ");
+				long2 += i % 7 ? _T("word, ") : _T("other; ");
+			}
+			std::vector<wdiff> diffs;
+			sd_ComputeWordDiffs(long1, long2, true, 0, 1, !!byte_level, &diffs);
+			EXPECT_LT(0u, diffs.size());
+
+			ComputeAll(!!byte_level, after);
+			for (int i = 0; i < ChangedLineCount; i++)
+				EXPECT_TRUE(AreSame(before[i], after[i])) << "line " << i;
+		}
+	}
+
+	// Throughput over the changed lines, and in debug builds, memory
+	// allocations per diff once buffers have grown (none expected)
+	TEST_F(StringDiffsWorkspaceTest, Benchmark)
+	{
+		const int Repeat = 500;
+		for (int byte_level = 0; byte_level < 2; byte_level++)
+		{
+			vector<vector<wdiff> > results;
+			ComputeAll(!!byte_level, results);
+
+#ifdef _DEBUG
+			AllocCount = 0;
+			_CRT_ALLOC_HOOK oldHook = _CrtSetAllocHook(AllocHook);
+#endif
+			std::chrono::high_resolution_clock::time_point start = std::chrono::high_resolution_clock::now();
+			for (int n = 0; n < Repeat; n++)
+				ComputeAll(!!byte_level, results);
+			std::chrono::duration<double> elapsed = std::chrono::high_resolution_clock::now() - start;
+#ifdef _DEBUG
+			_CrtSetAllocHook(oldHook);
+			const double allocs = static_cast<double>(AllocCount) / (Repeat * ChangedLineCount);
+			printf("%s: %.2f allocations per diff\n", byte_level ? "byte-level" : "word-level", allocs);
+			EXPECT_EQ(0, AllocCount);
+#endif
+			printf("%s: %.0f diffs per second\n", byte_level ? "byte-level" : "word-level",
+				Repeat * ChangedLineCount / elapsed.count());
+		}
+	}
+
+}  // namespace
@@ -0,0 +1,223 @@
+#include <gtest/gtest.h>
+#include <windows.h>
+#include <tchar.h>
+#include <vector>
+#include <cstdio>
+#include "WordDiffCache.h"
+#include "CompareOptions.h"
+
+using std::vector;
+
+namespace
+{
+	/**
+	 * @brief Make a job diffing two texts with the options.
+	 */
+	WordDiffCache::Job MakeJob(const String& str1, const String& str2, const WordDiffCache::Options& options)
+	{
+		WordDiffCache::Job job;
+		job.options = options;
+		job.nFiles = 2;
+		job.str[0] = str1;
+		job.str[1] = str2;
+		job.MakeKey();
+		return job;
+	}
+
+	/**
+	 * @brief Make a job of texts with a word diff every other word.
+	 * @param [in] n Number making the texts differ from those of other jobs.
+	 * @param [in] nDiffs Number of diffs of the texts.
+	 */
+	WordDiffCache::Job MakeManyDiffsJob(int n, int nDiffs)
+	{
+		TCHAR buf[32];
+		_stprintf_s(buf, _T("%d "), n);
+		String str1 = buf, str2 = buf;
+		for (int i = 0; i < nDiffs; i++)
+		{
+			str1 += _T("a x ");
+			str2 += _T("b x ");
+		}
+		return MakeJob(str1, str2, WordDiffCache::Options());
+	}
+
+	bool AreSame(const vector<wdiff>& diffs1, const vector<wdiff>& diffs2)
+	{
+		if (diffs1.size() != diffs2.size())
+			return false;
+		for (size_t i = 0; i < diffs1.size(); i++)
+		{
+			for (int file = 0; file < 2; file++)
+			{
+				if (diffs1[i].begin[file] != diffs2[i].begin[file] || diffs1[i].end[file] != diffs2[i].end[file])
+					return false;
+			}
+		}
+		return true;
+	}
+
+	// The fixture for testing WordDiffCache class.
+	class WordDiffCacheTest : public testing::Test
+	{
+	protected:
+		WordDiffCacheTest()
+		{
+			sd_Init();
+		}
+
+		virtual ~WordDiffCacheTest()
+		{
+			sd_Close();
+		}
+
+		virtual void SetUp()
+		{
+		}
+
+		virtual void TearDown()
+		{
+		}
+	};
+
+	TEST_F(WordDiffCacheTest, LookupFindsComputedDiffs)
+	{
+		WordDiffCache cache;
+		WordDiffCache::Job job = MakeJob(_T("abc def ghi"), _T("abc xyz ghi"), WordDiffCache::Options());
+		WordDiffCache::Job other = MakeJob(_T("abc def ghi"), _T("abc def"), WordDiffCache::Options());
+		EXPECT_NE(job.key, other.key);
+
+		vector<wdiff> diffs;
+		EXPECT_FALSE(cache.Lookup(job.key, &diffs));
+		cache.Compute(job, &diffs);
+		ASSERT_EQ(1u, diffs.size());
+		EXPECT_EQ(4, diffs[0].begin[0]);
+		EXPECT_EQ(6, diffs[0].end[0]);
+
+		vector<wdiff> found;
+		EXPECT_TRUE(cache.Lookup(job.key, &found));
+		EXPECT_TRUE(AreSame(diffs, found));
+		EXPECT_FALSE(cache.Lookup(other.key, &found));
+		EXPECT_EQ(1u, cache.GetVersion());
+
+		// Diffs of a key are stored once
+		cache.Compute(job, &diffs);
+		EXPECT_EQ(1u, cache.GetVersion());
+
+		cache.Clear();
+		EXPECT_FALSE(cache.Lookup(job.key, &found));
+	}
+
+	TEST_F(WordDiffCacheTest, SameTextsWithOtherOptionsHaveOtherKeys)
+	{
+		WordDiffCache::Options options;
+		options.breakType = 1;
+		options.breakChars = _T(".");
+		const String str1 = _T("abc.def ghi"), str2 = _T("abc.xyz ghi");
+		WordDiffCache::Job job = MakeJob(str1, str2, options);
+		EXPECT_EQ(job.key, MakeJob(str1, str2, options).key);
+
+		WordDiffCache::Options others[6];
+		for (int i = 0; i < 6; i++)
+			others[i] = options;
+		others[0].casitive = false;
+		others[1].xwhite = WHITESPACE_IGNORE_ALL;
+		others[2].breakType = 0;
+		others[3].byteColoring = true;
+		others[4].breakChars = _T(",");
+		others[5].breakChars.clear();
+		for (int i = 0; i < 6; i++)
+		{
+			EXPECT_FALSE(options == others[i]) << i;
+			EXPECT_NE(job.key, MakeJob(str1, str2, others[i]).key) << i;
+		}
+
+		// Diffs of keys differing by break characters only are kept apart
+		WordDiffCache cache;
+		WordDiffCache::Job noBreakJob = MakeJob(str1, str2, others[5]);
+		vector<wdiff> diffs, noBreakDiffs;
+		cache.Compute(job, &diffs);
+		cache.Compute(noBreakJob, &noBreakDiffs);
+		ASSERT_EQ(1u, diffs.size());
+		EXPECT_EQ(4, diffs[0].begin[0]);
+		ASSERT_EQ(1u, noBreakDiffs.size());
+		EXPECT_EQ(0, noBreakDiffs[0].begin[0]);
+
+		vector<wdiff> found;
+		EXPECT_TRUE(cache.Lookup(job.key, &found));
+		EXPECT_TRUE(AreSame(diffs, found));
+		EXPECT_TRUE(cache.Lookup(noBreakJob.key, &found));
+		EXPECT_TRUE(AreSame(noBreakDiffs, found));
+	}
+
+	TEST_F(WordDiffCacheTest, JobsKeepTheirBreakChars)
+	{
+		WordDiffCache::Options options;
+		options.breakType = 1;
+		options.breakChars = _T(".");
+		WordDiffCache::Job job = MakeJob(_T("abc.def ghi"), _T("abc.xyz ghi"), options);
+
+		// Break characters set after the job was made do not change its diffs
+		sd_SetBreakChars(_T(","));
+		WordDiffCache cache;
+		vector<wdiff> diffs;
+		cache.Compute(job, &diffs);
+		ASSERT_EQ(1u, diffs.size());
+		EXPECT_EQ(4, diffs[0].begin[0]);
+	}
+
+	TEST_F(WordDiffCacheTest, PrecomputeDropsDiffsUnusedSinceThePreviousOne)
+	{
+		// Diffs are only dropped once there are enough of them
+		const int nJobs = 200;
+		const int nDiffsPerJob = 400;
+		WordDiffCache cache;
+		vector<WordDiffCache::Key> keys;
+		vector<wdiff> diffs;
+		for (int n = 0; n < nJobs; n++)
+		{
+			WordDiffCache::Job job = MakeManyDiffsJob(n, nDiffsPerJob);
+			cache.Compute(job, &diffs);
+			ASSERT_EQ(static_cast<size_t>(nDiffsPerJob), diffs.size());
+			keys.push_back(job.key);
+		}
+
+		// Diffs computed since the previous precompute are kept
+		vector<WordDiffCache::Job> jobs;
+		cache.Precompute(jobs);
+		vector<wdiff> found;
+		for (int n = 0; n < nJobs; n++)
+			EXPECT_TRUE(cache.Lookup(keys[n], &found)) << n;
+
+		// Now only diffs looked up or precomputed again are
+		cache.Precompute(jobs);
+		cache.Lookup(keys[1], &found);
+		jobs.push_back(MakeManyDiffsJob(2, nDiffsPerJob));
+		cache.Precompute(jobs);
+		EXPECT_TRUE(cache.IsIdle());
+		EXPECT_FALSE(cache.Lookup(keys[0], &found));
+		EXPECT_TRUE(cache.Lookup(keys[1], &found));
+		EXPECT_EQ(static_cast<size_t>(nDiffsPerJob), found.size());
+		EXPECT_TRUE(cache.Lookup(keys[2], &found));
+		WordDiffCache::Job job = MakeManyDiffsJob(2, nDiffsPerJob);
+		cache.Compute(job, &diffs);
+		EXPECT_TRUE(AreSame(diffs, found));
+		for (int n = 3; n < nJobs; n++)
+			EXPECT_FALSE(cache.Lookup(keys[n], &found)) << n;
+	}
+
+	TEST_F(WordDiffCacheTest, QueuedJobsAreDiffedByWorkers)
+	{
+		WordDiffCache cache;
+		WordDiffCache::Job job = MakeManyDiffsJob(0, 10);
+		const WordDiffCache::Key key = job.key;
+		cache.Queue(job);
+		while (!cache.IsIdle())
+			Sleep(1);
+		EXPECT_FALSE(cache.IsPending(key));
+		vector<wdiff> found;
+		EXPECT_TRUE(cache.Lookup(key, &found));
+		EXPECT_EQ(10u, found.size());
+	}
+
+}  // namespace